@@ -1,5 +1,6 @@
 #include "windows.h"
 #include "stdio.h"
+#include "../shared/json-writer.h"
 
 #define verbose 0
 
@@ -37,31 +38,29 @@ int iterateAndDisplayClipboardFormatList()
   UINT f = EnumClipboardFormats(0);
 
   int clipboard_count = 0;
-  int buffer_index = 0;
+  const char *name;
+  JsonWriter writer;
 
-  buffer[buffer_index] = '[';
-  buffer_index++;
+  // The list is written in chunks of the writer so any number of formats fits
+  initJsonWriter(&writer, NULL, BUFFER_SIZE, NULL);
+  putJsonChar(&writer, '[');
 
   while (f != 0)
   {
-    buffer_index += snprintf(
-        &buffer[buffer_index],
-        BUFFER_SIZE - buffer_index - 1,
-        "{\"format\": %d",
-        f);
-    buffer_index += snprintf(
-        &buffer[buffer_index],
-        BUFFER_SIZE - buffer_index - 1,
-        ", \"name\": \"");
-    buffer_index += snprintf(&buffer[buffer_index], BUFFER_SIZE - buffer_index - 1, "%s", getFormatName(f));
-    f = f > 0 ? EnumClipboardFormats(f) : 0;
-    buffer_index += snprintf(&buffer[buffer_index], BUFFER_SIZE - buffer_index - 1, "%s", f == 0 ? "\"}" : "\"}, ");
+    if (clipboard_count != 0)
+      putJsonBytes(&writer, ", ", 2);
+    putJsonBytes(&writer, "{\"format\": ", 11);
+    putJsonUnsigned(&writer, (uint64_t)f);
+    putJsonBytes(&writer, ", \"name\": ", 10);
+    name = getFormatName(f);
+    putJsonString(&writer, name, strlen(name));
+    putJsonChar(&writer, '}');
+    f = EnumClipboardFormats(f);
     clipboard_count++;
   }
-  buffer_index += snprintf(&buffer[buffer_index], BUFFER_SIZE - buffer_index - 1, "]");
-  buffer[buffer_index] = '\0';
-  buffer_index++;
-  fwrite(buffer, buffer_index - 1, 1, stdout);
+  putJsonChar(&writer, ']');
+  flushJsonWriter(&writer);
+  freeJsonWriter(&writer);
   CloseClipboard();
   return clipboard_count != 0 ? 0 : 331;
 }
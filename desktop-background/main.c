@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <string.h>
+#include "../shared/json-writer.h"
 
 #pragma comment(lib, "User32.lib")
 #pragma comment(lib, "Advapi32.lib")
@@ -32,76 +33,17 @@ char global_out_buffer[BUFFER_SIZE];
 size_t global_out_buffer_size = (size_t)(BUFFER_SIZE / 2);
 size_t global_out_buffer_written = 0;
 
-size_t putJsonStringEscaped(char *input, size_t input_length, char *output, size_t *output_length)
-{
-  size_t i = 0;
-  size_t j = 0;
-  char c;
-
-  if (input_length <= 0) {
-    if (verbose > 1)
-      printf("[Verbose] Escaping input length is zero.\n");
-    return 0;
-  }
-
-  if (output_length <= 0) {
-    if (verbose > 1)
-      printf("[Verbose] Escaping output length is zero.\n");
-    return 0;
-  }
-  
-  if (verbose > 1)
-    printf("[Verbose] Starting escaped json string method.\n");
-
-  for (i = 0; j < output_length && i < input_length; i++) {
-    if (verbose > 1)
-      printf("[Verbose] Escaping starting at #%zd\n", i);
-    c = input[i];
-    if (verbose > 1)
-      printf("[Verbose] Escaping at #%zd has char \"%d\"\n", i, (int) c);
-    if (c == '\0') {
-      break;
-    }
-    if (c != '\\' && c != '"' && c != '\n' && c != '\t') {
-      output[j] = c;
-      j++;
-      continue;
-    }
-
-    if (verbose > 1)
-      printf("[Verbose] Found special character at #%zd: %c\n", i, c);
-
-    output[j] = '\\';
-    j++;
-
-    if (c == '\n' || c == '\t')
-      c = c == '\n' ? 'n' : 't';
-
-    output[j] = c;
-    j++;
-  }
-
-  if (j >= output_length)
-    j = output_length - 1;
-
-  output[j] = '\0';
-
-  if (verbose > 1)
-    printf("[Verbose] Completed escaping process.\n");
-
-  return j;
-}
-
+// Writes an object with a single string value, the output is truncated to the buffer size
 size_t putJsonObjectSingleKey(char *out_buffer, size_t out_buffer_size, char *key, char *value)
 {
-  size_t i = 0;
-  i += (size_t)snprintf(&out_buffer[i], out_buffer_size - i, "{\"");
-  i += putJsonStringEscaped(key, (size_t)BUFFER_SIZE/2, &out_buffer[i], out_buffer_size - i);
-  i += (size_t)snprintf(&out_buffer[i], out_buffer_size - i, "\": \"");
-  i += putJsonStringEscaped(value, (size_t)BUFFER_SIZE/2, &out_buffer[i], out_buffer_size - i);
-  i += (size_t)snprintf(&out_buffer[i], out_buffer_size - i, "\"}");
-  out_buffer[i] = '\0';
-  return i;
+  JsonWriter writer;
+  initJsonWriter(&writer, out_buffer, out_buffer_size, NULL);
+  putJsonChar(&writer, '{');
+  putJsonString(&writer, key, strnlen(key, (size_t)BUFFER_SIZE / 2));
+  putJsonBytes(&writer, ": ", 2);
+  putJsonString(&writer, value, strnlen(value, (size_t)BUFFER_SIZE / 2));
+  putJsonChar(&writer, '}');
+  return finishJsonWriter(&writer);
 }
 
 int handleGetRequest()
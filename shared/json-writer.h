@@ -0,0 +1,404 @@
+// JSON writer: streams JSON output into a chunk that is written with a single call when it is flushed.
+//
+// The chunk is either a buffer of the caller, which is never written past its end, or a buffer owned by the writer that
+// starts small and doubles up to a size limit. Values are appended without format strings: integers are converted two
+// digits at a time from a table and text is copied in runs between the characters that must be escaped, which are found
+// 16 or 32 bytes at a time with SSE2 or AVX2 when the compiler targets them, and bytes that are not valid UTF-8 are replaced.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define JSON_WRITER_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JSON_WRITER_SSE2 1
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define JSON_WRITER_INITIAL_SIZE 4096
+#define JSON_WRITER_DEFAULT_LIMIT 64 * 1024
+
+// Receives the content of a chunk when it is flushed, writers without a flush function write it to stdout
+typedef void (*JsonFlushFunction)(const char *data, size_t length);
+
+typedef struct
+{
+  char *data;
+  size_t length;
+  size_t size;
+  size_t limit;
+  JsonFlushFunction flush;
+  int is_owned;
+  int is_truncated;
+  int64_t flush_count;
+} JsonWriter;
+
+const char json_digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Characters that must be escaped in a JSON string are marked with the letter of their escape sequence, or 'u' for \u00XX,
+// and bytes of 0x80 and above with 'x' since they are only copied when they form a valid UTF-8 sequence
+const char json_escape_table[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x',
+    'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x',
+    'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x',
+    'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x',
+    'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x',
+    'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x',
+    'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x',
+    'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x'};
+
+// Writes into a buffer of the caller, or into chunks owned by the writer when the buffer is NULL
+void initJsonWriter(JsonWriter *writer, char *data, size_t size, JsonFlushFunction flush)
+{
+  writer->data = data;
+  writer->length = 0;
+  writer->size = data != NULL ? size : 0;
+  writer->limit = data != NULL ? size : (size > 0 ? size : JSON_WRITER_DEFAULT_LIMIT);
+  writer->flush = flush;
+  writer->is_owned = data == NULL;
+  writer->is_truncated = 0;
+  writer->flush_count = 0;
+}
+
+void freeJsonWriter(JsonWriter *writer)
+{
+  if (writer->is_owned)
+  {
+    free(writer->data);
+    writer->data = NULL;
+    writer->size = 0;
+  }
+  writer->length = 0;
+}
+
+// Writes the content of the chunk with a single call and starts a new chunk in the same buffer
+void flushJsonWriter(JsonWriter *writer)
+{
+  if (writer->length == 0)
+    return;
+  if (writer->flush != NULL)
+    writer->flush(writer->data, writer->length);
+  else
+    fwrite(writer->data, 1, writer->length, stdout);
+  writer->length = 0;
+  writer->flush_count++;
+}
+
+// Ends the content of a writer that is not flushed with a null character and returns its length
+size_t finishJsonWriter(JsonWriter *writer)
+{
+  if (writer->size == 0)
+    return 0;
+  if (writer->length >= writer->size)
+  {
+    writer->length = writer->size - 1;
+    writer->is_truncated = 1;
+  }
+  writer->data[writer->length] = '\0';
+  return writer->length;
+}
+
+// Makes room for a number of bytes by growing the chunk up to its limit or by flushing it, returns zero when it cannot
+int reserveJsonWriter(JsonWriter *writer, size_t length)
+{
+  size_t grown_size;
+  char *grown;
+  if (writer->length + length <= writer->size)
+    return 1;
+  if (writer->is_owned && writer->size < writer->limit)
+  {
+    grown_size = writer->size == 0 ? JSON_WRITER_INITIAL_SIZE : writer->size;
+    while (grown_size < writer->length + length && grown_size < writer->limit)
+      grown_size *= 2;
+    if (grown_size > writer->limit)
+      grown_size = writer->limit;
+    if (grown_size >= writer->length + length)
+    {
+      grown = (char *)realloc(writer->data, grown_size);
+      if (grown != NULL)
+      {
+        writer->data = grown;
+        writer->size = grown_size;
+        return 1;
+      }
+    }
+  }
+  if (writer->flush != NULL || writer->is_owned)
+    flushJsonWriter(writer);
+  if (writer->length + length <= writer->size)
+    return 1;
+  if (writer->flush == NULL && !writer->is_owned)
+    writer->is_truncated = 1;
+  return 0;
+}
+
+// Appends raw bytes, content larger than the chunk is written directly after flushing it
+void putJsonBytes(JsonWriter *writer, const char *data, size_t length)
+{
+  size_t available;
+  if (writer->length + length <= writer->size || reserveJsonWriter(writer, length))
+  {
+    memcpy(&writer->data[writer->length], data, length);
+    writer->length += length;
+    return;
+  }
+  if (writer->is_owned || writer->flush != NULL)
+  {
+    flushJsonWriter(writer);
+    if (writer->flush != NULL)
+      writer->flush(data, length);
+    else
+      fwrite(data, 1, length, stdout);
+    return;
+  }
+  // A buffer of the caller keeps the bytes that fit
+  available = writer->size - writer->length;
+  memcpy(&writer->data[writer->length], data, available);
+  writer->length += available;
+}
+
+void putJsonChar(JsonWriter *writer, char c)
+{
+  if (writer->length < writer->size || reserveJsonWriter(writer, 1))
+    writer->data[writer->length++] = c;
+}
+
+void putJsonText(JsonWriter *writer, const char *text)
+{
+  putJsonBytes(writer, text, strlen(text));
+}
+
+void putJsonUnsigned(JsonWriter *writer, uint64_t value)
+{
+  char digits[20];
+  size_t i = sizeof(digits);
+  size_t pair;
+  while (value >= 100)
+  {
+    pair = (size_t)(value % 100) * 2;
+    value /= 100;
+    digits[--i] = json_digit_pairs[pair + 1];
+    digits[--i] = json_digit_pairs[pair];
+  }
+  if (value >= 10)
+  {
+    pair = (size_t)value * 2;
+    digits[--i] = json_digit_pairs[pair + 1];
+    digits[--i] = json_digit_pairs[pair];
+  }
+  else
+  {
+    digits[--i] = (char)('0' + value);
+  }
+  putJsonBytes(writer, &digits[i], sizeof(digits) - i);
+}
+
+void putJsonInteger(JsonWriter *writer, int64_t value)
+{
+  if (value >= 0)
+  {
+    putJsonUnsigned(writer, (uint64_t)value);
+    return;
+  }
+  putJsonChar(writer, '-');
+  putJsonUnsigned(writer, (uint64_t)0 - (uint64_t)value);
+}
+
+void putJsonBoolean(JsonWriter *writer, int value)
+{
+  if (value)
+    putJsonBytes(writer, "true", 4);
+  else
+    putJsonBytes(writer, "false", 5);
+}
+
+// Returns the index of the first bit set in a non-zero mask
+unsigned int findJsonMaskBit(unsigned int mask)
+{
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return (unsigned int)index;
+#else
+  return (unsigned int)__builtin_ctz(mask);
+#endif
+}
+
+// Returns the position of the first character from a start position that must be escaped or checked as UTF-8, or the
+// length of the text
+size_t findJsonEscape(const char *text, size_t text_length, size_t start)
+{
+  const unsigned char *input = (const unsigned char *)text;
+  size_t i = start;
+  unsigned int mask;
+#if defined(JSON_WRITER_AVX2)
+  const __m256i quote32 = _mm256_set1_epi8('"');
+  const __m256i backslash32 = _mm256_set1_epi8('\\');
+  const __m256i control32 = _mm256_set1_epi8(0x1F);
+  __m256i block32;
+  for (; i + 32 <= text_length; i += 32)
+  {
+    block32 = _mm256_loadu_si256((const __m256i *)&input[i]);
+    // A byte is a control character when the unsigned maximum with 0x1F is 0x1F, and the high bit of the block itself
+    // marks the bytes of 0x80 and above
+    mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(block32, quote32), _mm256_cmpeq_epi8(block32, backslash32)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(block32, control32), control32), block32)));
+    if (mask != 0)
+      return i + findJsonMaskBit(mask);
+  }
+#endif
+#if defined(JSON_WRITER_SSE2)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1F);
+  __m128i block;
+  for (; i + 16 <= text_length; i += 16)
+  {
+    block = _mm_loadu_si128((const __m128i *)&input[i]);
+    mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)),
+        _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(block, control), control), block)));
+    if (mask != 0)
+      return i + findJsonMaskBit(mask);
+  }
+#endif
+  for (; i < text_length; i++)
+  {
+    if (json_escape_table[input[i]] != 0)
+      return i;
+  }
+  (void)mask;
+  return text_length;
+}
+
+// Returns the length of the UTF-8 sequence that starts at a position, or zero when it is invalid: overlong forms, surrogates,
+// code points above U+10FFFF and cut sequences are rejected as RFC 3629 describes
+size_t getJsonUtf8Length(const unsigned char *input, size_t text_length, size_t i)
+{
+  unsigned char c = input[i];
+  unsigned char low = 0x80;
+  unsigned char high = 0xBF;
+  size_t length;
+  size_t j;
+  if (c >= 0xC2 && c <= 0xDF)
+    length = 2;
+  else if (c >= 0xE0 && c <= 0xEF)
+    length = 3;
+  else if (c >= 0xF0 && c <= 0xF4)
+    length = 4;
+  else
+    return 0;
+  // The second byte has a narrower range after the lead bytes whose sequences could be overlong or out of range
+  if (c == 0xE0)
+    low = 0xA0;
+  else if (c == 0xED)
+    high = 0x9F;
+  else if (c == 0xF0)
+    low = 0x90;
+  else if (c == 0xF4)
+    high = 0x8F;
+  if (i + length > text_length || input[i + 1] < low || input[i + 1] > high)
+    return 0;
+  for (j = 2; j < length; j++)
+  {
+    if (input[i + j] < 0x80 || input[i + j] > 0xBF)
+      return 0;
+  }
+  return length;
+}
+
+// Appends the content of a JSON string without its quotes, runs of characters that need no escape are found a block at a
+// time and copied at once. Valid UTF-8 sequences are copied as they are and each byte that is not part of one is written
+// as \ufffd, so the output is valid JSON for any bytes: the Win32 backend converts its text to UTF-8, while X11 properties
+// in another encoding and file paths may hold any bytes.
+void putJsonEscaped(JsonWriter *writer, const char *text, size_t text_length)
+{
+  const unsigned char *input = (const unsigned char *)text;
+  char sequence[6];
+  size_t start = 0;
+  size_t i = 0;
+  size_t length;
+  char escape;
+  while (i < text_length)
+  {
+    i = findJsonEscape(text, text_length, i);
+    if (i >= text_length)
+      break;
+    escape = json_escape_table[input[i]];
+    if (escape == 'x')
+    {
+      // A valid sequence stays in the run of copied bytes
+      length = getJsonUtf8Length(input, text_length, i);
+      if (length > 0)
+      {
+        i += length;
+        continue;
+      }
+    }
+    if (i > start)
+      putJsonBytes(writer, &text[start], i - start);
+    sequence[0] = '\\';
+    sequence[1] = escape;
+    if (escape == 'x')
+    {
+      putJsonBytes(writer, "\\ufffd", 6);
+    }
+    else if (escape == 'u')
+    {
+      sequence[2] = '0';
+      sequence[3] = '0';
+      sequence[4] = "0123456789abcdef"[input[i] >> 4];
+      sequence[5] = "0123456789abcdef"[input[i] & 15];
+      putJsonBytes(writer, sequence, 6);
+    }
+    else
+    {
+      putJsonBytes(writer, sequence, 2);
+    }
+    start = ++i;
+  }
+  if (text_length > start)
+    putJsonBytes(writer, &text[start], text_length - start);
+}
+
+void putJsonString(JsonWriter *writer, const char *text, size_t text_length)
+{
+  putJsonChar(writer, '"');
+  putJsonEscaped(writer, text, text_length);
+  putJsonChar(writer, '"');
+}
+
+// Appends an object key with its separator, the separator is skipped for the first key of an object
+void putJsonKey(JsonWriter *writer, int is_first, const char *key)
+{
+  if (!is_first)
+    putJsonBytes(writer, ", ", 2);
+  putJsonChar(writer, '"');
+  putJsonText(writer, key);
+  putJsonBytes(writer, "\": ", 3);
+}
@@ -0,0 +1,229 @@
+// Published snapshot reader: reads the window list kept in shared memory by `window-state --publish <name>`.
+//
+// The region is named "window-state-<name>": a named file mapping in the session namespace ("Local\") on Windows and a
+// POSIX shared memory object ("/window-state-<name>", the file /dev/shm/window-state-<name> on Linux) elsewhere. It starts
+// with a 64-byte header followed by the payload, which is the list in the format given by the header. The publisher
+// guards the payload with a sequence lock: the sequence is odd while the payload is written and increased to the next even
+// number once it is complete, so a reader copies the payload between two reads of the sequence and retries when they
+// differ or are odd. Reading a snapshot makes no call to the window system and no system call at all once the region is
+// mapped, and a reader never blocks the publisher.
+//
+// This header has no dependency on the rest of the program so that other processes can include it on its own:
+//
+//   PublishedReader reader;
+//   if (openPublishedReader(&reader, "desktop"))
+//   {
+//     length = readPublishedSnapshot(&reader, buffer, sizeof(buffer), &generation, NULL);
+//     closePublishedReader(&reader);
+//   }
+
+#ifndef PUBLISHED_READER_H
+#define PUBLISHED_READER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <windows.h>
+#define PUBLISHED_BARRIER() MemoryBarrier()
+#define PUBLISHED_YIELD() SwitchToThread()
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#define PUBLISHED_BARRIER() __sync_synchronize()
+#define PUBLISHED_YIELD() sched_yield()
+#endif
+
+#define PUBLISHED_MAGIC "WSPUBLSH"
+#define PUBLISHED_VERSION 1
+#define PUBLISHED_NAME_PREFIX "window-state-"
+#define PUBLISHED_NAME_SIZE 256
+
+// Formats of the payload, the values of --format
+#define PUBLISHED_FORMAT_JSON 0
+#define PUBLISHED_FORMAT_NDJSON 1
+#define PUBLISHED_FORMAT_BINARY 2
+
+// Errors of readPublishedSnapshot
+#define PUBLISHED_ERROR_SIZE -1
+#define PUBLISHED_ERROR_BUSY -2
+#define PUBLISHED_ERROR_EMPTY -3
+
+// Attempts to copy the payload before giving up while the publisher keeps rewriting it
+#define PUBLISHED_READ_ATTEMPTS 4096
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t capacity;
+  // Twice the number of published snapshots, plus one while a snapshot is written
+  volatile uint64_t sequence;
+  volatile uint64_t length;
+  // Time of the snapshot in milliseconds since the Unix epoch
+  volatile int64_t time;
+  uint32_t format;
+  uint32_t publisher_pid;
+  uint8_t reserved[8];
+} PublishedHeader;
+
+typedef struct
+{
+  PublishedHeader *header;
+  const char *payload;
+  size_t size;
+  // Copy attempts that found the payload being written, for statistics
+  int64_t retry_count;
+#if defined(_WIN32)
+  HANDLE mapping;
+#endif
+} PublishedReader;
+
+// Writes the system name of a region, returns zero when the name is empty, too long or contains a path separator
+int getPublishedRegionName(const char *name, char *region_name, size_t region_name_size)
+{
+  size_t length = strlen(name);
+  size_t i;
+  if (length == 0 || length + sizeof(PUBLISHED_NAME_PREFIX) + 8 > region_name_size)
+    return 0;
+  for (i = 0; i < length; i++)
+    if (name[i] == '/' || name[i] == '\\')
+      return 0;
+#if defined(_WIN32)
+  snprintf(region_name, region_name_size, "Local\\" PUBLISHED_NAME_PREFIX "%s", name);
+#else
+  snprintf(region_name, region_name_size, "/" PUBLISHED_NAME_PREFIX "%s", name);
+#endif
+  return 1;
+}
+
+int isValidPublishedHeader(const PublishedHeader *header, size_t size)
+{
+  return memcmp(header->magic, PUBLISHED_MAGIC, 8) == 0 && header->version == PUBLISHED_VERSION && header->header_size == sizeof(PublishedHeader) && size >= sizeof(PublishedHeader) + header->capacity;
+}
+
+void closePublishedReader(PublishedReader *reader)
+{
+  if (reader->header != NULL)
+  {
+#if defined(_WIN32)
+    UnmapViewOfFile(reader->header);
+#else
+    munmap(reader->header, reader->size);
+#endif
+  }
+#if defined(_WIN32)
+  if (reader->mapping != NULL)
+    CloseHandle(reader->mapping);
+  reader->mapping = NULL;
+#endif
+  reader->header = NULL;
+  reader->payload = NULL;
+}
+
+// Maps the region of a publisher for reading, returns zero when it is not published
+int openPublishedReader(PublishedReader *reader, const char *name)
+{
+  char region_name[PUBLISHED_NAME_SIZE];
+  void *view;
+  size_t size;
+#if defined(_WIN32)
+  MEMORY_BASIC_INFORMATION info;
+#else
+  struct stat region_stat;
+  int file;
+#endif
+  memset(reader, 0, sizeof(PublishedReader));
+  if (!getPublishedRegionName(name, region_name, sizeof(region_name)))
+    return 0;
+#if defined(_WIN32)
+  reader->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, region_name);
+  if (reader->mapping == NULL)
+    return 0;
+  view = MapViewOfFile(reader->mapping, FILE_MAP_READ, 0, 0, 0);
+  if (view == NULL || VirtualQuery(view, &info, sizeof(info)) == 0)
+  {
+    if (view != NULL)
+      UnmapViewOfFile(view);
+    CloseHandle(reader->mapping);
+    reader->mapping = NULL;
+    return 0;
+  }
+  size = (size_t)info.RegionSize;
+#else
+  file = shm_open(region_name, O_RDONLY, 0);
+  if (file < 0)
+    return 0;
+  if (fstat(file, &region_stat) != 0 || region_stat.st_size < (off_t)sizeof(PublishedHeader))
+  {
+    close(file);
+    return 0;
+  }
+  size = (size_t)region_stat.st_size;
+  view = mmap(NULL, size, PROT_READ, MAP_SHARED, file, 0);
+  // The mapping stays valid once the object is closed
+  close(file);
+  if (view == MAP_FAILED)
+    return 0;
+#endif
+  reader->header = (PublishedHeader *)view;
+  reader->payload = (const char *)view + sizeof(PublishedHeader);
+  reader->size = size;
+  if (!isValidPublishedHeader(reader->header, size))
+  {
+    closePublishedReader(reader);
+    return 0;
+  }
+  return 1;
+}
+
+// Copies the last published snapshot into a buffer, returns its length or a negative PUBLISHED_ERROR_ code
+int64_t readPublishedSnapshot(PublishedReader *reader, char *buffer, size_t buffer_size, uint64_t *generation, int64_t *time)
+{
+  uint64_t sequence;
+  uint64_t length;
+  int64_t snapshot_time;
+  int attempt;
+  for (attempt = 0; attempt < PUBLISHED_READ_ATTEMPTS; attempt++)
+  {
+    sequence = reader->header->sequence;
+    PUBLISHED_BARRIER();
+    if ((sequence & 1) == 0)
+    {
+      if (sequence == 0)
+        return PUBLISHED_ERROR_EMPTY;
+      length = reader->header->length;
+      snapshot_time = reader->header->time;
+      if (length > reader->header->capacity)
+        length = 0;
+      if (length <= buffer_size)
+        memcpy(buffer, reader->payload, (size_t)length);
+      PUBLISHED_BARRIER();
+      if (reader->header->sequence == sequence)
+      {
+        if (length > buffer_size)
+          return PUBLISHED_ERROR_SIZE;
+        if (generation != NULL)
+          *generation = sequence / 2;
+        if (time != NULL)
+          *time = snapshot_time;
+        return (int64_t)length;
+      }
+    }
+    reader->retry_count++;
+    PUBLISHED_YIELD();
+  }
+  return PUBLISHED_ERROR_BUSY;
+}
+
+// Returns the length of the last published snapshot, to size the buffer of readPublishedSnapshot
+uint64_t getPublishedSnapshotLength(PublishedReader *reader)
+{
+  return reader->header->length;
+}
+
+#endif
@@ -0,0 +1,321 @@
+// Aggregation: writes a table of the selected windows grouped by process, executable or class with --group-by.
+//
+// The windows are added to their group as the list walks them instead of being written, and only the table is written
+// once the walk ends. Groups are found from an open-addressing table keyed by the hash of their pid or name, and their
+// names are kept in a single buffer. Grouping by executable resolves the executable of each process once: the group of a
+// process is kept in a table keyed by pid, so the other windows of the process only read their pid. Groups are written in
+// the order of their first window in the selection.
+//
+// Output, one object per group, with "visible_area" when --visible-area is set:
+//   {"executable": "C:\\Windows\\explorer.exe", "count": 12, "visible": 3, "topmost": 1, "area": 4147200}
+
+#define AGGREGATE_NONE 0
+#define AGGREGATE_PID 1
+#define AGGREGATE_EXECUTABLE 2
+#define AGGREGATE_CLASS 3
+
+typedef struct
+{
+  uint64_t hash;
+  DWORD pid;
+  // Position of the name in aggregate_names, names are not null-terminated there
+  size_t name;
+  size_t name_length;
+  int64_t count;
+  int64_t visible;
+  int64_t topmost;
+  int64_t area;
+  int64_t visible_area;
+} AggregateGroup;
+
+typedef struct
+{
+  DWORD pid;
+  int group;
+} AggregateProcess;
+
+int aggregate_key = AGGREGATE_NONE;
+
+AggregateGroup *aggregate_groups = NULL;
+int aggregate_group_count = 0;
+int aggregate_group_size = 0;
+int *aggregate_slots = NULL;
+int aggregate_slot_size = 0;
+AggregateProcess *aggregate_processes = NULL;
+int aggregate_process_count = 0;
+int aggregate_process_size = 0;
+char *aggregate_names = NULL;
+size_t aggregate_name_length = 0;
+size_t aggregate_name_size = 0;
+char aggregate_name[MIDDLE_BUFFER_SIZE];
+
+int64_t aggregate_window_count = 0;
+int64_t aggregate_resolve_count = 0;
+
+// Reads the name of a grouping key, returns zero after writing an error
+int parseAggregateKey(const char *name)
+{
+  if (isMatchingString("pid", name) || isMatchingString("process", name))
+    aggregate_key = AGGREGATE_PID;
+  else if (isMatchingString("executable", name) || isMatchingString("exe", name))
+    aggregate_key = AGGREGATE_EXECUTABLE;
+  else if (isMatchingString("class", name) || isMatchingString("classname", name))
+    aggregate_key = AGGREGATE_CLASS;
+  else
+  {
+    writeOutput("Error: Unknown grouping key \"%s\" (expected executable, pid or class)\n", name);
+    return 0;
+  }
+  return 1;
+}
+
+uint64_t hashAggregateName(const char *name, size_t length)
+{
+  uint64_t hash = 0xCBF29CE484222325ull;
+  size_t i;
+  for (i = 0; i < length; i++)
+    hash = (hash ^ (unsigned char)name[i]) * 0x100000001B3ull;
+  return hash;
+}
+
+uint64_t hashAggregatePid(DWORD pid)
+{
+  return (uint64_t)pid * 0x9E3779B97F4A7C15ull;
+}
+
+// Places the groups in a slot table of twice their number at least, returns zero when it cannot be allocated
+int growAggregateSlots()
+{
+  int *grown;
+  int size = aggregate_slot_size > 0 ? aggregate_slot_size * 2 : 256;
+  size_t slot;
+  int i;
+  grown = (int *)malloc((size_t)size * sizeof(int));
+  if (grown == NULL)
+    return 0;
+  free(aggregate_slots);
+  aggregate_slots = grown;
+  aggregate_slot_size = size;
+  memset(aggregate_slots, 0xFF, (size_t)size * sizeof(int));
+  for (i = 0; i < aggregate_group_count; i++)
+  {
+    for (slot = (size_t)(aggregate_groups[i].hash >> 32) & (size_t)(size - 1); aggregate_slots[slot] >= 0; slot = (slot + 1) & (size_t)(size - 1))
+    {
+    }
+    aggregate_slots[slot] = i;
+  }
+  return 1;
+}
+
+// Returns the group of a pid, or of a name when the groups are named, adding it when it is new, or -1 when it cannot be allocated
+int findAggregateGroup(DWORD pid, const char *name, size_t length)
+{
+  AggregateGroup *group;
+  AggregateGroup *grown;
+  uint64_t hash = aggregate_key == AGGREGATE_PID ? hashAggregatePid(pid) : hashAggregateName(name, length);
+  size_t slot;
+  size_t size;
+  char *names;
+  int index;
+  if (aggregate_group_count * 2 >= aggregate_slot_size && !growAggregateSlots())
+    return -1;
+  for (slot = (size_t)(hash >> 32) & (size_t)(aggregate_slot_size - 1); aggregate_slots[slot] >= 0; slot = (slot + 1) & (size_t)(aggregate_slot_size - 1))
+  {
+    group = &aggregate_groups[aggregate_slots[slot]];
+    if (group->hash != hash)
+      continue;
+    if (aggregate_key == AGGREGATE_PID ? group->pid == pid : group->name_length == length && memcmp(&aggregate_names[group->name], name, length) == 0)
+      return aggregate_slots[slot];
+  }
+  if (aggregate_group_count >= aggregate_group_size)
+  {
+    index = aggregate_group_size > 0 ? aggregate_group_size * 2 : 64;
+    grown = (AggregateGroup *)realloc(aggregate_groups, (size_t)index * sizeof(AggregateGroup));
+    if (grown == NULL)
+      return -1;
+    aggregate_groups = grown;
+    aggregate_group_size = index;
+  }
+  if (aggregate_name_length + length > aggregate_name_size)
+  {
+    for (size = aggregate_name_size > 0 ? aggregate_name_size : 4096; size < aggregate_name_length + length; size *= 2)
+    {
+    }
+    names = (char *)realloc(aggregate_names, size);
+    if (names == NULL)
+      return -1;
+    aggregate_names = names;
+    aggregate_name_size = size;
+  }
+  index = aggregate_group_count++;
+  group = &aggregate_groups[index];
+  memset(group, 0, sizeof(AggregateGroup));
+  group->hash = hash;
+  group->pid = pid;
+  group->name = aggregate_name_length;
+  group->name_length = length;
+  if (length > 0)
+    memcpy(&aggregate_names[aggregate_name_length], name, length);
+  aggregate_name_length += length;
+  aggregate_slots[slot] = index;
+  return index;
+}
+
+// Returns the executable group of a process, resolving its executable when the process is new, or -1
+int findAggregateProcessGroup(DWORD pid)
+{
+  AggregateProcess *grown;
+  AggregateProcess *previous;
+  size_t slot;
+  size_t length;
+  int size;
+  int i;
+  if (aggregate_process_count * 2 >= aggregate_process_size)
+  {
+    size = aggregate_process_size > 0 ? aggregate_process_size * 2 : 256;
+    grown = (AggregateProcess *)malloc((size_t)size * sizeof(AggregateProcess));
+    if (grown == NULL)
+      return -1;
+    for (i = 0; i < size; i++)
+      grown[i].group = -1;
+    previous = aggregate_processes;
+    for (i = 0; i < aggregate_process_size; i++)
+    {
+      if (previous[i].group < 0)
+        continue;
+      for (slot = (size_t)(hashAggregatePid(previous[i].pid) >> 32) & (size_t)(size - 1); grown[slot].group >= 0; slot = (slot + 1) & (size_t)(size - 1))
+      {
+      }
+      grown[slot] = previous[i];
+    }
+    free(previous);
+    aggregate_processes = grown;
+    aggregate_process_size = size;
+  }
+  for (slot = (size_t)(hashAggregatePid(pid) >> 32) & (size_t)(aggregate_process_size - 1); aggregate_processes[slot].group >= 0; slot = (slot + 1) & (size_t)(aggregate_process_size - 1))
+  {
+    if (aggregate_processes[slot].pid == pid)
+      return aggregate_processes[slot].group;
+  }
+  aggregate_resolve_count++;
+  aggregate_name[0] = '\0';
+  length = pid > 0 ? getProcessExecutable(pid, aggregate_name, MIDDLE_BUFFER_SIZE) : 0;
+  i = findAggregateGroup(0, aggregate_name, length);
+  if (i < 0)
+    return -1;
+  aggregate_processes[slot].pid = pid;
+  aggregate_processes[slot].group = i;
+  aggregate_process_count++;
+  return i;
+}
+
+// Adds a window of the selection to its group, returns zero when the group cannot be allocated
+int addAggregateWindow(HWND h)
+{
+  AggregateGroup *group;
+  RECT window_rect;
+  DWORD pid = 0;
+  size_t length;
+  int64_t start;
+  int index;
+  if (aggregate_key == AGGREGATE_CLASS)
+  {
+    aggregate_name[0] = '\0';
+    length = backendGetClassName(h, aggregate_name, MIDDLE_BUFFER_SIZE);
+    index = findAggregateGroup(0, aggregate_name, length);
+  }
+  else
+  {
+    backendGetWindowThreadProcessId(h, &pid);
+    index = aggregate_key == AGGREGATE_PID ? findAggregateGroup(pid, NULL, 0) : findAggregateProcessGroup(pid);
+  }
+  if (index < 0)
+    return 0;
+  group = &aggregate_groups[index];
+  group->count++;
+  group->visible += backendIsWindowVisible(h) ? 1 : 0;
+  group->topmost += (backendGetWindowLong(h, GWL_EXSTYLE) & WS_EX_TOPMOST) != 0 ? 1 : 0;
+  start = beginStatsCall();
+  memset(&window_rect, 0, sizeof(window_rect));
+  if (backendGetWindowRect(h, &window_rect) && window_rect.right > window_rect.left && window_rect.bottom > window_rect.top)
+    group->area += ((int64_t)window_rect.right - window_rect.left) * ((int64_t)window_rect.bottom - window_rect.top);
+  endStatsCall(STATS_CALL_WINDOW_RECT, start);
+  if (is_option_visible_area && (index = findOcclusionWindow(h)) >= 0)
+    group->visible_area += occlusion_windows[index].visible_area;
+  aggregate_window_count++;
+  return 1;
+}
+
+// Writes the table of the groups in the JSON or NDJSON format
+void writeAggregateTable()
+{
+  AggregateGroup *group;
+  int i;
+  if (output_format == FORMAT_JSON)
+    putJsonChar(&output_writer, '[');
+  for (i = 0; i < aggregate_group_count; i++)
+  {
+    group = &aggregate_groups[i];
+    if (output_format == FORMAT_JSON && i != 0)
+      putJsonBytes(&output_writer, ", ", 2);
+    putJsonChar(&output_writer, '{');
+    if (aggregate_key == AGGREGATE_PID)
+    {
+      putJsonKey(&output_writer, 1, "pid");
+      putJsonInteger(&output_writer, (int64_t)group->pid);
+    }
+    else
+    {
+      putJsonKey(&output_writer, 1, aggregate_key == AGGREGATE_EXECUTABLE ? "executable" : "classname");
+      // Processes whose executable could not be read are grouped together
+      if (group->name_length == 0)
+        putJsonText(&output_writer, "null");
+      else
+        putJsonString(&output_writer, &aggregate_names[group->name], group->name_length);
+    }
+    putJsonKey(&output_writer, 0, "count");
+    putJsonInteger(&output_writer, group->count);
+    putJsonKey(&output_writer, 0, "visible");
+    putJsonInteger(&output_writer, group->visible);
+    putJsonKey(&output_writer, 0, "topmost");
+    putJsonInteger(&output_writer, group->topmost);
+    putJsonKey(&output_writer, 0, "area");
+    putJsonInteger(&output_writer, group->area);
+    if (is_option_visible_area)
+    {
+      putJsonKey(&output_writer, 0, "visible_area");
+      putJsonInteger(&output_writer, group->visible_area);
+    }
+    putJsonChar(&output_writer, '}');
+    if (output_format == FORMAT_NDJSON)
+      putJsonChar(&output_writer, '\n');
+  }
+  if (output_format == FORMAT_JSON)
+    putJsonChar(&output_writer, ']');
+}
+
+// Writes the "aggregate" section of the statistics object
+void writeAggregateStats(JsonWriter *writer)
+{
+  beginStatsSection(writer, "aggregate");
+  putStatsCounter(writer, 1, "windows", aggregate_window_count);
+  putStatsCounter(writer, 0, "groups", aggregate_group_count);
+  putStatsCounter(writer, 0, "resolves", aggregate_resolve_count);
+  putJsonChar(writer, '}');
+}
+
+// Forgets the groups of a request, the tables are kept for the next one
+void resetAggregate()
+{
+  int i;
+  aggregate_key = AGGREGATE_NONE;
+  aggregate_group_count = 0;
+  if (aggregate_slot_size > 0)
+    memset(aggregate_slots, 0xFF, (size_t)aggregate_slot_size * sizeof(int));
+  aggregate_process_count = 0;
+  for (i = 0; i < aggregate_process_size; i++)
+    aggregate_processes[i].group = -1;
+  aggregate_name_length = 0;
+  aggregate_window_count = 0;
+  aggregate_resolve_count = 0;
+}
@@ -0,0 +1,983 @@
+// In-memory window backend: a deterministic synthetic desktop so window-state can run without a window system.
+//
+// The desktop is generated from a seed on first use and is configured by environment variables:
+//   WINDOW_STATE_MEMORY_WINDOWS   Number of top-level windows (default 48)
+//   WINDOW_STATE_MEMORY_CHILDREN  Number of child windows of each top-level window (default 2)
+//   WINDOW_STATE_MEMORY_DEPTH     Number of levels of child windows, each child has as many children (default 1)
+//   WINDOW_STATE_MEMORY_PROCESSES Number of processes that own the top-level windows (default one per 6 windows)
+//   WINDOW_STATE_MEMORY_TITLE     Length the titles of top-level windows are padded to (default 0, not padded)
+//   WINDOW_STATE_MEMORY_SEED      Seed of the generator (default 1)
+//   WINDOW_STATE_MEMORY_SLOW      Windows whose title takes a while to read, as a list of <handle>:<milliseconds> pairs
+//                                 separated by commas, standing for windows of hung applications
+//   WINDOW_STATE_MEMORY_LOG       File that records a line for each call that changes a window
+//   WINDOW_STATE_MEMORY_SCRIPT    File of changes applied while watching, one command per line:
+//                                   create <process> <title>        Add a top-level window of a process at the top
+//                                   destroy <handle>                Destroy a window and its children
+//                                   move <handle> <x> <y> <w> <h>   Move and resize a window
+//                                   title <handle> <title>          Change the title of a window
+//                                   focus <handle>                  Set the foreground window
+//                                   sleep <milliseconds>            Wait before the next command, to space out the changes in time
+//                                   tick                            End of a step, each wait applies one step
+//
+// Visible windows are captured as a drawing that depends only on the window and its size: a title bar in the color of the
+// application over a page of lines of text and a gradient.
+
+#include <stdlib.h>
+
+#define WINDOW_STATE_BACKEND_NAME "memory"
+#define WINDOW_STATE_BACKEND_CONCURRENT_LISTING 1
+
+#define MEMORY_HANDLE_BASE 0x10010
+#define MEMORY_HANDLE_STRIDE 2
+#define MEMORY_SCREEN_WIDTH 2560
+#define MEMORY_SCREEN_HEIGHT 1440
+#define MEMORY_TASKBAR_HEIGHT 48
+#define MEMORY_TITLE_SIZE 256
+#define MEMORY_SLOW_LIMIT 64
+
+// The desktop can be generated again with other dimensions by memoryGenerateDesktop
+#define WINDOW_STATE_SYNTHETIC_DESKTOP 1
+
+typedef struct
+{
+  char title[MEMORY_TITLE_SIZE];
+  char class[48];
+  int app;
+  int parent;
+  int first_child;
+  int next;
+  int prev;
+  DWORD pid;
+  DWORD thread;
+  LONG style;
+  LONG exstyle;
+  int is_unicode;
+  int is_destroyed;
+  RECT rect;
+} MemoryWindow;
+
+const char *memory_apps[][4] = {
+    {"File Explorer", "explorer.exe", "C:\\Windows", "CabinetWClass"},
+    {"Google Chrome", "chrome.exe", "C:\\Program Files\\Google\\Chrome\\Application", "Chrome_WidgetWin_1"},
+    {"Visual Studio Code", "Code.exe", "C:\\Users\\user\\AppData\\Local\\Programs\\Microsoft VS Code", "Chrome_WidgetWin_1"},
+    {"Notepad", "notepad.exe", "C:\\Windows\\System32", "Notepad"},
+    {"Command Prompt", "cmd.exe", "C:\\Windows\\System32", "ConsoleWindowClass"},
+    {"Outlook", "OUTLOOK.EXE", "C:\\Program Files\\Microsoft Office\\root\\Office16", "rctrl_renwnd32"},
+    {"Slack", "slack.exe", "C:\\Users\\user\\AppData\\Local\\slack", "Chrome_WidgetWin_1"},
+    {"Task Manager", "Taskmgr.exe", "C:\\Windows\\System32", "TaskManagerWindow"},
+};
+#define MEMORY_APP_COUNT (int)(sizeof(memory_apps) / sizeof(memory_apps[0]))
+
+const char memory_title_filler[] = " - Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua";
+
+const char *memory_child_classes[] = {"Button", "Edit", "Static", "ScrollBar", "ListBox", "ComboBox"};
+#define MEMORY_CHILD_CLASS_COUNT (int)(sizeof(memory_child_classes) / sizeof(memory_child_classes[0]))
+
+MemoryWindow *memory_windows = NULL;
+int memory_window_count = 0;
+int memory_first_top = -1;
+int memory_foreground = -1;
+int memory_process_count = 0;
+uint32_t memory_seed = 1;
+
+HWND memory_slow_handles[MEMORY_SLOW_LIMIT];
+int64_t memory_slow_delays[MEMORY_SLOW_LIMIT];
+int memory_slow_count = 0;
+
+// Counts the process lookups that would have opened a process handle on Windows
+int64_t backend_process_open_count = 0;
+
+// Counts every call that would have been made to the window system on Windows
+int64_t backend_call_count = 0;
+
+FILE *memory_log = NULL;
+int is_memory_log_opened = 0;
+
+// Appends a line to the call log, which lets the changes made by the program be compared with the expected calls
+void memoryRecord(const char *format, ...)
+{
+  va_list args;
+  if (!is_memory_log_opened)
+  {
+    const char *path = getenv("WINDOW_STATE_MEMORY_LOG");
+    is_memory_log_opened = 1;
+    memory_log = path != NULL && path[0] != '\0' ? fopen(path, "ab") : NULL;
+  }
+  if (memory_log == NULL)
+    return;
+  va_start(args, format);
+  vfprintf(memory_log, format, args);
+  va_end(args);
+  fputc('\n', memory_log);
+  fflush(memory_log);
+}
+
+int memoryReadEnvironment(const char *name, int fallback)
+{
+  const char *value = getenv(name);
+  if (value == NULL || value[0] == '\0')
+    return fallback;
+  return atoi(value);
+}
+
+uint32_t memoryRandom()
+{
+  memory_seed = memory_seed * 1664525u + 1013904223u;
+  return memory_seed >> 8;
+}
+
+void memoryLinkWindow(int index, int parent, int *last)
+{
+  memory_windows[index].parent = parent;
+  memory_windows[index].prev = *last;
+  memory_windows[index].next = -1;
+  if (*last >= 0)
+    memory_windows[*last].next = index;
+  else if (parent >= 0)
+    memory_windows[parent].first_child = index;
+  else
+    memory_first_top = index;
+  *last = index;
+}
+
+// Creates the children of a window after it in the window list, each child has its own children down to a number of levels
+void memoryCreateChildren(int parent, int child_count, int levels, int *index)
+{
+  int last_child = -1;
+  int j;
+  for (j = 0; j < child_count && levels > 0; j++)
+  {
+    int child_index = *index;
+    MemoryWindow *c = &memory_windows[child_index];
+    MemoryWindow *p = &memory_windows[parent];
+    int child_class = (int)(memoryRandom() % MEMORY_CHILD_CLASS_COUNT);
+    c->app = p->app;
+    c->pid = p->pid;
+    c->thread = p->thread;
+    c->first_child = -1;
+    c->style = WS_CHILD | WS_VISIBLE | WS_CLIPSIBLINGS;
+    c->is_unicode = 1;
+    c->rect.left = p->rect.left + 8 + j * 24;
+    c->rect.top = p->rect.top + 32 + j * 24;
+    c->rect.right = c->rect.left + 80;
+    c->rect.bottom = c->rect.top + 20;
+    snprintf(c->title, sizeof(c->title), "%s %d", memory_child_classes[child_class], j + 1);
+    snprintf(c->class, sizeof(c->class), "%s", memory_child_classes[child_class]);
+    memoryLinkWindow(child_index, parent, &last_child);
+    (*index)++;
+    memoryCreateChildren(child_index, child_count, levels - 1, index);
+  }
+}
+
+// Generates a desktop of top-level windows with children down to a number of levels, replacing the previous desktop
+void memoryGenerateDesktop(int top_count, int child_count, int child_depth, int process_count, int title_length, uint32_t seed)
+{
+  int64_t subtree_count;
+  int64_t level_count;
+  size_t length;
+  int i;
+  int index;
+  int last_top = -1;
+  free(memory_windows);
+  memory_windows = NULL;
+  memory_window_count = 0;
+  memory_first_top = -1;
+  memory_foreground = -1;
+  memory_seed = seed;
+  if (top_count < 0)
+    top_count = 0;
+  if (child_count < 0)
+    child_count = 0;
+  if (child_depth < 0)
+    child_depth = 0;
+  if (title_length >= MEMORY_TITLE_SIZE)
+    title_length = MEMORY_TITLE_SIZE - 1;
+  // Each top-level window has child_count children per level down to child_depth levels
+  subtree_count = 1;
+  level_count = 1;
+  for (i = 0; i < child_depth && child_count > 0 && subtree_count * top_count < 0x1000000; i++)
+  {
+    level_count *= child_count;
+    subtree_count += level_count;
+  }
+  child_depth = i;
+  memory_window_count = (int)(top_count * subtree_count);
+  memory_process_count = process_count > 0 ? process_count : (top_count / 6 > 0 ? top_count / 6 : 1);
+  memory_windows = (MemoryWindow *)calloc(memory_window_count > 0 ? memory_window_count : 1, sizeof(MemoryWindow));
+  if (memory_windows == NULL)
+  {
+    memory_window_count = 0;
+    return;
+  }
+  index = 0;
+  for (i = 0; i < top_count; i++)
+  {
+    MemoryWindow *w = &memory_windows[index];
+    int process = (int)(memoryRandom() % (uint32_t)memory_process_count);
+    int top_index = index;
+    w->app = process % MEMORY_APP_COUNT;
+    w->pid = (DWORD)(1000 + process * 4);
+    w->thread = w->pid * 16 + (DWORD)(memoryRandom() % 3);
+    w->first_child = -1;
+    w->style = WS_OVERLAPPEDWINDOW | WS_CLIPSIBLINGS;
+    if (memoryRandom() % 10 < 7)
+      w->style |= WS_VISIBLE;
+    if (memoryRandom() % 10 == 0)
+      w->style |= WS_MINIMIZE;
+    if (memoryRandom() % 16 == 0)
+      w->exstyle |= WS_EX_TOPMOST;
+    if (memoryRandom() % 12 == 0)
+      w->exstyle |= WS_EX_TOOLWINDOW;
+    w->is_unicode = 1;
+    w->rect.left = (LONG)(memoryRandom() % (MEMORY_SCREEN_WIDTH - 200));
+    w->rect.top = (LONG)(memoryRandom() % (MEMORY_SCREEN_HEIGHT - 150));
+    w->rect.right = w->rect.left + 200 + (LONG)(memoryRandom() % 1400);
+    w->rect.bottom = w->rect.top + 150 + (LONG)(memoryRandom() % 900);
+    if ((w->style & WS_VISIBLE) != 0)
+    {
+      snprintf(w->title, sizeof(w->title), "Document %d - %s", i + 1, memory_apps[w->app][0]);
+      // Padded titles repeat the filler text after the name of the application
+      for (length = strlen(w->title); (int)length < title_length; length++)
+        w->title[length] = memory_title_filler[length % (sizeof(memory_title_filler) - 1)];
+      w->title[length] = '\0';
+    }
+    snprintf(w->class, sizeof(w->class), "%s", memory_apps[w->app][3]);
+    memoryLinkWindow(index, -1, &last_top);
+    index++;
+    memoryCreateChildren(top_index, child_count, child_depth, &index);
+  }
+  for (i = memory_first_top; i >= 0; i = memory_windows[i].next)
+  {
+    if ((memory_windows[i].style & WS_VISIBLE) != 0 && (memory_windows[i].style & WS_MINIMIZE) == 0)
+    {
+      memory_foreground = i;
+      break;
+    }
+  }
+}
+
+void memoryReadSlowWindows()
+{
+  const char *value = getenv("WINDOW_STATE_MEMORY_SLOW");
+  char *end;
+  int64_t handle;
+  memory_slow_count = 0;
+  while (value != NULL && *value != '\0' && memory_slow_count < MEMORY_SLOW_LIMIT)
+  {
+    handle = (int64_t)strtoll(value, &end, 0);
+    if (*end != ':')
+      return;
+    memory_slow_handles[memory_slow_count] = (HWND)(intptr_t)handle;
+    memory_slow_delays[memory_slow_count] = (int64_t)strtoll(end + 1, &end, 0);
+    memory_slow_count++;
+    value = *end == ',' ? end + 1 : NULL;
+  }
+}
+
+void memoryInitialize()
+{
+  if (memory_windows != NULL)
+    return;
+  memoryReadSlowWindows();
+  memoryGenerateDesktop(memoryReadEnvironment("WINDOW_STATE_MEMORY_WINDOWS", 48), memoryReadEnvironment("WINDOW_STATE_MEMORY_CHILDREN", 2), memoryReadEnvironment("WINDOW_STATE_MEMORY_DEPTH", 1), memoryReadEnvironment("WINDOW_STATE_MEMORY_PROCESSES", 0), memoryReadEnvironment("WINDOW_STATE_MEMORY_TITLE", 0), (uint32_t)memoryReadEnvironment("WINDOW_STATE_MEMORY_SEED", 1));
+}
+
+int memoryGetIndex(HWND h)
+{
+  int64_t value = (int64_t)(intptr_t)h - MEMORY_HANDLE_BASE;
+  memoryInitialize();
+  if (value < 0 || value % MEMORY_HANDLE_STRIDE != 0 || value / MEMORY_HANDLE_STRIDE >= memory_window_count)
+    return -1;
+  if (memory_windows[value / MEMORY_HANDLE_STRIDE].is_destroyed)
+    return -1;
+  return (int)(value / MEMORY_HANDLE_STRIDE);
+}
+
+HWND memoryGetHandle(int index)
+{
+  if (index < 0 || index >= memory_window_count)
+    return NULL;
+  return (HWND)(intptr_t)(MEMORY_HANDLE_BASE + (int64_t)index * MEMORY_HANDLE_STRIDE);
+}
+
+size_t memoryCopyString(const char *source, char *target, size_t target_size)
+{
+  size_t length = 0;
+  if (target_size == 0)
+    return 0;
+  while (source[length] != '\0' && length + 1 < target_size)
+  {
+    target[length] = source[length];
+    length++;
+  }
+  target[length] = '\0';
+  return length;
+}
+
+void memoryUnlinkWindow(int index)
+{
+  MemoryWindow *w = &memory_windows[index];
+  if (w->prev >= 0)
+    memory_windows[w->prev].next = w->next;
+  else if (w->parent >= 0)
+    memory_windows[w->parent].first_child = w->next;
+  else
+    memory_first_top = w->next;
+  if (w->next >= 0)
+    memory_windows[w->next].prev = w->prev;
+  w->prev = -1;
+  w->next = -1;
+}
+
+void memoryRaiseWindow(int index)
+{
+  MemoryWindow *w = &memory_windows[index];
+  int *first = w->parent >= 0 ? &memory_windows[w->parent].first_child : &memory_first_top;
+  if (*first == index)
+    return;
+  memoryUnlinkWindow(index);
+  w->next = *first;
+  if (*first >= 0)
+    memory_windows[*first].prev = index;
+  *first = index;
+}
+
+// Moves a window below a sibling, or to the bottom of its siblings when the sibling is negative
+void memoryLowerWindow(int index, int after)
+{
+  MemoryWindow *w = &memory_windows[index];
+  int *first = w->parent >= 0 ? &memory_windows[w->parent].first_child : &memory_first_top;
+  int last;
+  if (after == index)
+    return;
+  memoryUnlinkWindow(index);
+  if (after < 0)
+  {
+    for (last = *first; last >= 0 && memory_windows[last].next >= 0; last = memory_windows[last].next)
+    {
+    }
+    after = last;
+  }
+  if (after < 0)
+  {
+    *first = index;
+    return;
+  }
+  w->prev = after;
+  w->next = memory_windows[after].next;
+  if (w->next >= 0)
+    memory_windows[w->next].prev = index;
+  memory_windows[after].next = index;
+}
+
+int backendIsWindow(HWND h)
+{
+  addCounter(&backend_call_count, 1);
+  return h != NULL && memoryGetIndex(h) >= 0;
+}
+
+HWND backendGetForegroundWindow()
+{
+  addCounter(&backend_call_count, 1);
+  memoryInitialize();
+  return memoryGetHandle(memory_foreground);
+}
+
+HWND backendGetFirstChild(HWND parent)
+{
+  addCounter(&backend_call_count, 1);
+  int index;
+  memoryInitialize();
+  if (parent == NULL)
+    return memoryGetHandle(memory_first_top);
+  index = memoryGetIndex(parent);
+  return index < 0 ? NULL : memoryGetHandle(memory_windows[index].first_child);
+}
+
+HWND backendGetWindow(HWND h, UINT cmd)
+{
+  addCounter(&backend_call_count, 1);
+  int index = memoryGetIndex(h);
+  if (index < 0)
+    return NULL;
+  if (cmd == GW_HWNDNEXT)
+    return memoryGetHandle(memory_windows[index].next);
+  if (cmd == GW_CHILD)
+    return memoryGetHandle(memory_windows[index].first_child);
+  return NULL;
+}
+
+HWND backendGetParent(HWND h)
+{
+  addCounter(&backend_call_count, 1);
+  int index = memoryGetIndex(h);
+  return index < 0 ? NULL : memoryGetHandle(memory_windows[index].parent);
+}
+
+size_t backendGetWindowText(HWND h, char *text, size_t text_size)
+{
+  addCounter(&backend_call_count, 1);
+  int index = memoryGetIndex(h);
+  int i;
+  for (i = 0; i < memory_slow_count; i++)
+  {
+    if (memory_slow_handles[i] == h)
+      sleepThread(memory_slow_delays[i]);
+  }
+  return memoryCopyString(index < 0 ? "" : memory_windows[index].title, text, text_size);
+}
+
+size_t backendGetWindowModuleFileName(HWND h, char *module, size_t module_size)
+{
+  addCounter(&backend_call_count, 1);
+  int index = memoryGetIndex(h);
+  char path[MAX_PATH];
+  path[0] = '\0';
+  if (index >= 0)
+    snprintf(path, sizeof(path), "%s\\%s", memory_apps[memory_windows[index].app][2], memory_apps[memory_windows[index].app][1]);
+  return memoryCopyString(path, module, module_size);
+}
+
+size_t backendGetClassName(HWND h, char *class, size_t class_size)
+{
+  addCounter(&backend_call_count, 1);
+  int index = memoryGetIndex(h);
+  return memoryCopyString(index < 0 ? "" : memory_windows[index].class, class, class_size);
+}
+
+DWORD backendGetWindowThreadProcessId(HWND h, DWORD *pid)
+{
+  addCounter(&backend_call_count, 1);
+  int index = memoryGetIndex(h);
+  if (index < 0)
+    return 0;
+  if (pid != NULL)
+    *pid = memory_windows[index].pid;
+  return memory_windows[index].thread;
+}
+
+size_t backendGetProcessExecutable(DWORD pid, char *exec, size_t exec_size)
+{
+  addCounter(&backend_call_count, 1);
+  int process = ((int)pid - 1000) / 4;
+  int app;
+  int64_t start = beginStatsCall();
+  int is_process;
+  size_t length;
+  memoryInitialize();
+  addCounter(&backend_process_open_count, 1);
+  // Checking the process stands for opening it and formatting its path for reading the file name of its module
+  is_process = pid >= 1000 && (pid - 1000) % 4 == 0 && process < memory_process_count;
+  endStatsCall(STATS_CALL_OPEN_PROCESS, start);
+  if (!is_process || exec_size == 0)
+    return 0;
+  start = beginStatsCall();
+  app = process % MEMORY_APP_COUNT;
+  length = (size_t)snprintf(exec, exec_size, "%s\\%s", memory_apps[app][2], memory_apps[app][1]);
+  endStatsCall(STATS_CALL_MODULE_FILE_NAME, start);
+  return length;
+}
+
+LONG backendGetWindowLong(HWND h, int index)
+{
+  addCounter(&backend_call_count, 1);
+  int i = memoryGetIndex(h);
+  if (i < 0)
+    return 0;
+  if (index == GWL_STYLE)
+    return memory_windows[i].style;
+  if (index == GWL_EXSTYLE)
+    return memory_windows[i].exstyle;
+  return 0;
+}
+
+int backendIsWindowUnicode(HWND h)
+{
+  addCounter(&backend_call_count, 1);
+  int index = memoryGetIndex(h);
+  return index < 0 ? 0 : memory_windows[index].is_unicode;
+}
+
+int backendIsWindowVisible(HWND h)
+{
+  addCounter(&backend_call_count, 1);
+  int index = memoryGetIndex(h);
+  while (index >= 0)
+  {
+    if ((memory_windows[index].style & WS_VISIBLE) == 0)
+      return 0;
+    index = memory_windows[index].parent;
+  }
+  return h != NULL && memoryGetIndex(h) >= 0;
+}
+
+int backendGetWindowRect(HWND h, RECT *rect)
+{
+  addCounter(&backend_call_count, 1);
+  int index = memoryGetIndex(h);
+  if (index < 0 || rect == NULL)
+    return 0;
+  *rect = memory_windows[index].rect;
+  return 1;
+}
+
+int backendSetForegroundWindow(HWND h)
+{
+  addCounter(&backend_call_count, 1);
+  int index = memoryGetIndex(h);
+  memoryRecord("SetForegroundWindow %" PRId64, (int64_t)(intptr_t)h);
+  if (index < 0)
+    return 0;
+  while (memory_windows[index].parent >= 0)
+    index = memory_windows[index].parent;
+  memory_foreground = index;
+  memoryRaiseWindow(index);
+  return 1;
+}
+
+int backendShowWindow(HWND h, int show_arg)
+{
+  addCounter(&backend_call_count, 1);
+  int index = memoryGetIndex(h);
+  memoryRecord("ShowWindow %" PRId64 " %d", (int64_t)(intptr_t)h, show_arg);
+  MemoryWindow *w;
+  int was_visible;
+  if (index < 0)
+    return 0;
+  w = &memory_windows[index];
+  was_visible = (w->style & WS_VISIBLE) != 0;
+  if (show_arg == SW_HIDE)
+  {
+    w->style &= ~WS_VISIBLE;
+    return was_visible;
+  }
+  w->style |= WS_VISIBLE;
+  if (show_arg == SW_MINIMIZE)
+  {
+    w->style = (w->style | WS_MINIMIZE) & ~WS_MAXIMIZE;
+  }
+  else if (show_arg == SW_MAXIMIZE)
+  {
+    w->style = (w->style | WS_MAXIMIZE) & ~WS_MINIMIZE;
+    w->rect.left = 0;
+    w->rect.top = 0;
+    w->rect.right = MEMORY_SCREEN_WIDTH;
+    w->rect.bottom = MEMORY_SCREEN_HEIGHT;
+  }
+  else if (show_arg == SW_RESTORE || show_arg == SW_SHOWNORMAL || show_arg == SW_SHOWNOACTIVATE)
+  {
+    w->style &= ~(WS_MINIMIZE | WS_MAXIMIZE);
+  }
+  return was_visible;
+}
+
+void memorySetWindowPos(int index, HWND insert_after, int x, int y, int w, int h_size, UINT flags)
+{
+  MemoryWindow *window = &memory_windows[index];
+  int after;
+  if ((flags & SWP_NOMOVE) == 0)
+  {
+    window->rect.right = x + (window->rect.right - window->rect.left);
+    window->rect.bottom = y + (window->rect.bottom - window->rect.top);
+    window->rect.left = x;
+    window->rect.top = y;
+  }
+  if ((flags & SWP_NOSIZE) == 0)
+  {
+    window->rect.right = window->rect.left + w;
+    window->rect.bottom = window->rect.top + h_size;
+  }
+  if ((flags & SWP_NOZORDER) == 0)
+  {
+    if (insert_after == HWND_TOPMOST)
+      window->exstyle |= WS_EX_TOPMOST;
+    else if (insert_after == HWND_NOTOPMOST)
+      window->exstyle &= ~WS_EX_TOPMOST;
+    if (insert_after == HWND_TOP || insert_after == HWND_TOPMOST)
+      memoryRaiseWindow(index);
+    else if (insert_after == HWND_BOTTOM)
+    {
+      window->exstyle &= ~WS_EX_TOPMOST;
+      memoryLowerWindow(index, -1);
+    }
+    else if (insert_after != HWND_NOTOPMOST)
+    {
+      after = memoryGetIndex(insert_after);
+      if (after >= 0 && memory_windows[after].parent == window->parent)
+        memoryLowerWindow(index, after);
+    }
+  }
+  if ((flags & SWP_SHOWWINDOW) != 0)
+    window->style |= WS_VISIBLE;
+  else if ((flags & SWP_HIDEWINDOW) != 0)
+    window->style &= ~WS_VISIBLE;
+}
+
+int backendSetWindowPos(HWND h, HWND insert_after, int x, int y, int w, int h_size, UINT flags)
+{
+  addCounter(&backend_call_count, 1);
+  int index = memoryGetIndex(h);
+  memoryRecord("SetWindowPos %" PRId64 " %" PRId64 " %d %d %d %d 0x%X", (int64_t)(intptr_t)h, (int64_t)(intptr_t)insert_after, x, y, w, h_size, flags);
+  if (index < 0)
+    return 0;
+  memorySetWindowPos(index, insert_after, x, y, w, h_size, flags);
+  return 1;
+}
+
+typedef struct
+{
+  int index;
+  HWND insert_after;
+  int x;
+  int y;
+  int w;
+  int h_size;
+  UINT flags;
+} MemoryDeferredPos;
+
+// Positions of the open batch, which are only applied when it ends, a single batch can be open at a time
+MemoryDeferredPos *memory_batch = NULL;
+int memory_batch_count = 0;
+int memory_batch_size = 0;
+int is_memory_batch_open = 0;
+
+HDWP backendBeginDeferWindowPos(int count)
+{
+  addCounter(&backend_call_count, 1);
+  memoryInitialize();
+  memoryRecord("BeginDeferWindowPos %d", count);
+  if (is_memory_batch_open)
+    return NULL;
+  is_memory_batch_open = 1;
+  memory_batch_count = 0;
+  return (HDWP)&memory_batch_count;
+}
+
+// Fails and discards the batch for an invalid window or for windows of different parents, as DeferWindowPos does
+HDWP backendDeferWindowPos(HDWP batch, HWND h, HWND insert_after, int x, int y, int w, int h_size, UINT flags)
+{
+  addCounter(&backend_call_count, 1);
+  int index = memoryGetIndex(h);
+  MemoryDeferredPos *grown;
+  int size;
+  memoryRecord("DeferWindowPos %" PRId64 " %" PRId64 " %d %d %d %d 0x%X", (int64_t)(intptr_t)h, (int64_t)(intptr_t)insert_after, x, y, w, h_size, flags);
+  if (batch == NULL || !is_memory_batch_open || index < 0 || (memory_batch_count > 0 && memory_windows[memory_batch[0].index].parent != memory_windows[index].parent))
+  {
+    is_memory_batch_open = 0;
+    return NULL;
+  }
+  if (memory_batch_count >= memory_batch_size)
+  {
+    size = memory_batch_size == 0 ? 64 : memory_batch_size * 2;
+    grown = (MemoryDeferredPos *)realloc(memory_batch, (size_t)size * sizeof(MemoryDeferredPos));
+    if (grown == NULL)
+    {
+      is_memory_batch_open = 0;
+      return NULL;
+    }
+    memory_batch = grown;
+    memory_batch_size = size;
+  }
+  memory_batch[memory_batch_count].index = index;
+  memory_batch[memory_batch_count].insert_after = insert_after;
+  memory_batch[memory_batch_count].x = x;
+  memory_batch[memory_batch_count].y = y;
+  memory_batch[memory_batch_count].w = w;
+  memory_batch[memory_batch_count].h_size = h_size;
+  memory_batch[memory_batch_count].flags = flags;
+  memory_batch_count++;
+  return batch;
+}
+
+int backendEndDeferWindowPos(HDWP batch)
+{
+  addCounter(&backend_call_count, 1);
+  int i;
+  memoryRecord("EndDeferWindowPos %d", memory_batch_count);
+  if (batch == NULL || !is_memory_batch_open)
+    return 0;
+  for (i = 0; i < memory_batch_count; i++)
+  {
+    if (!memory_windows[memory_batch[i].index].is_destroyed)
+      memorySetWindowPos(memory_batch[i].index, memory_batch[i].insert_after, memory_batch[i].x, memory_batch[i].y, memory_batch[i].w, memory_batch[i].h_size, memory_batch[i].flags);
+  }
+  is_memory_batch_open = 0;
+  memory_batch_count = 0;
+  return 1;
+}
+
+int backendGetWorkArea(RECT *rect)
+{
+  addCounter(&backend_call_count, 1);
+  rect->left = 0;
+  rect->top = 0;
+  rect->right = MEMORY_SCREEN_WIDTH;
+  rect->bottom = MEMORY_SCREEN_HEIGHT - MEMORY_TASKBAR_HEIGHT;
+  return 1;
+}
+
+int memoryIsMatchingClass(const char *str1, const char *str2)
+{
+  size_t i;
+  for (i = 0; str1[i] != '\0' || str2[i] != '\0'; i++)
+  {
+    char a = str1[i] >= 'A' && str1[i] <= 'Z' ? str1[i] + 32 : str1[i];
+    char b = str2[i] >= 'A' && str2[i] <= 'Z' ? str2[i] + 32 : str2[i];
+    if (a != b)
+      return 0;
+  }
+  return 1;
+}
+
+HWND backendFindWindowByClass(HWND parent, HWND after, const char *class)
+{
+  int index;
+  addCounter(&backend_call_count, 1);
+  memoryInitialize();
+  if (after != NULL)
+    index = memoryGetIndex(after) >= 0 ? memory_windows[memoryGetIndex(after)].next : -1;
+  else if (parent != NULL)
+    index = memoryGetIndex(parent) >= 0 ? memory_windows[memoryGetIndex(parent)].first_child : -1;
+  else
+    index = memory_first_top;
+  for (; index >= 0; index = memory_windows[index].next)
+    if (memoryIsMatchingClass(memory_windows[index].class, class))
+      return memoryGetHandle(index);
+  return NULL;
+}
+
+// Every process of the synthetic desktop owns three threads, see the thread assignment in memoryInitialize
+int backendListProcessThreads(DWORD pid, DWORD *threads, int thread_size)
+{
+  int thread_count = 0;
+  addCounter(&backend_call_count, 1);
+  memoryInitialize();
+  if (pid < 1000 || (pid - 1000) % 4 != 0 || ((int)pid - 1000) / 4 >= memory_process_count)
+    return 0;
+  while (thread_count < 3 && thread_count < thread_size)
+  {
+    threads[thread_count] = pid * 16 + (DWORD)thread_count;
+    thread_count++;
+  }
+  return thread_count;
+}
+
+int backendListThreadWindows(DWORD thread, HWND *windows, int window_size)
+{
+  int window_count = 0;
+  int index;
+  addCounter(&backend_call_count, 1);
+  memoryInitialize();
+  for (index = memory_first_top; index >= 0 && window_count < window_size; index = memory_windows[index].next)
+    if (memory_windows[index].thread == thread)
+      windows[window_count++] = memoryGetHandle(index);
+  return window_count;
+}
+
+FILE *memory_script = NULL;
+int is_memory_script_opened = 0;
+
+int memoryCreateWindow(int process, const char *text)
+{
+  MemoryWindow *grown = (MemoryWindow *)realloc(memory_windows, (size_t)(memory_window_count + 1) * sizeof(MemoryWindow));
+  MemoryWindow *w;
+  int index;
+  if (grown == NULL)
+    return -1;
+  memory_windows = grown;
+  index = memory_window_count++;
+  w = &memory_windows[index];
+  memset(w, 0, sizeof(MemoryWindow));
+  w->app = process % MEMORY_APP_COUNT;
+  w->pid = (DWORD)(1000 + process * 4);
+  w->thread = w->pid * 16;
+  if (process >= memory_process_count)
+    memory_process_count = process + 1;
+  w->first_child = -1;
+  w->parent = -1;
+  w->prev = -1;
+  w->next = -1;
+  w->style = WS_OVERLAPPEDWINDOW | WS_CLIPSIBLINGS | WS_VISIBLE;
+  w->is_unicode = 1;
+  w->rect.left = 100;
+  w->rect.top = 100;
+  w->rect.right = 900;
+  w->rect.bottom = 700;
+  memoryCopyString(text, w->title, sizeof(w->title));
+  memoryCopyString(memory_apps[w->app][3], w->class, sizeof(w->class));
+  if (memory_first_top >= 0)
+  {
+    w->next = memory_first_top;
+    memory_windows[memory_first_top].prev = index;
+  }
+  memory_first_top = index;
+  return index;
+}
+
+void memoryDestroyChildren(int index)
+{
+  int child;
+  for (child = memory_windows[index].first_child; child >= 0; child = memory_windows[child].next)
+  {
+    memoryDestroyChildren(child);
+    memory_windows[child].is_destroyed = 1;
+  }
+}
+
+void memoryDestroyWindow(int index)
+{
+  memoryDestroyChildren(index);
+  memoryUnlinkWindow(index);
+  memory_windows[index].is_destroyed = 1;
+  if (memory_foreground == index)
+    memory_foreground = -1;
+}
+
+// Applies a command of the script, unknown and malformed commands are ignored
+void memoryApplyCommand(const char *line)
+{
+  char text[96];
+  long long handle = 0;
+  int process = 0;
+  int x;
+  int y;
+  int w;
+  int h;
+  int index;
+  text[0] = '\0';
+  if (sscanf(line, "create %d %95[^\n]", &process, text) >= 1 && process >= 0)
+  {
+    memoryCreateWindow(process, text);
+    return;
+  }
+  if (sscanf(line, "sleep %d", &x) == 1 && x >= 0)
+  {
+    sleepThread(x);
+    return;
+  }
+  if (sscanf(line, "%*s %lli", &handle) != 1)
+    return;
+  index = memoryGetIndex((HWND)(intptr_t)handle);
+  if (index < 0)
+    return;
+  if (strncmp(line, "destroy", 7) == 0)
+    memoryDestroyWindow(index);
+  else if (sscanf(line, "move %*i %d %d %d %d", &x, &y, &w, &h) == 4)
+  {
+    memory_windows[index].rect.left = x;
+    memory_windows[index].rect.top = y;
+    memory_windows[index].rect.right = x + w;
+    memory_windows[index].rect.bottom = y + h;
+  }
+  else if (strncmp(line, "title", 5) == 0)
+  {
+    sscanf(line, "title %*i %95[^\n]", text);
+    memoryCopyString(text, memory_windows[index].title, sizeof(memory_windows[index].title));
+  }
+  else if (strncmp(line, "focus", 5) == 0)
+  {
+    memory_foreground = index;
+    memoryRaiseWindow(index);
+  }
+}
+
+// Title bar colors of the applications, as 0xRRGGBB
+const uint32_t memory_app_colors[MEMORY_APP_COUNT] = {0xF0C850, 0x4285F4, 0x0065A9, 0xE0E0E0, 0x0C0C0C, 0x0F6CBD, 0x4A154B, 0x1F7A3F};
+
+uint8_t *memory_capture_pixels = NULL;
+size_t memory_capture_size = 0;
+
+uint8_t *backendCaptureWindow(HWND h, int *width, int *height, size_t *stride)
+{
+  int index = memoryGetIndex(h);
+  MemoryWindow *w;
+  uint32_t *row;
+  uint32_t color;
+  uint32_t glyphs;
+  uint8_t *grown;
+  size_t size;
+  int x;
+  int y;
+  int line;
+  int line_width;
+  addCounter(&backend_call_count, 1);
+  if (index < 0 || !backendIsWindowVisible(h) || (memory_windows[index].style & WS_MINIMIZE) != 0)
+    return NULL;
+  w = &memory_windows[index];
+  *width = (int)(w->rect.right - w->rect.left);
+  *height = (int)(w->rect.bottom - w->rect.top);
+  if (*width <= 0 || *height <= 0)
+    return NULL;
+  *stride = (size_t)*width * 4;
+  size = *stride * (size_t)*height;
+  if (size > memory_capture_size)
+  {
+    grown = (uint8_t *)realloc(memory_capture_pixels, size);
+    if (grown == NULL)
+      return NULL;
+    memory_capture_pixels = grown;
+    memory_capture_size = size;
+  }
+  // The pixels are written as 0xAARRGGBB, which is BGRA in memory, with an alpha of zero as on displays without alpha
+  for (y = 0; y < *height; y++)
+  {
+    row = (uint32_t *)(memory_capture_pixels + (size_t)y * *stride);
+    if (y < 30)
+    {
+      color = memory_app_colors[w->app];
+      for (x = 0; x < *width; x++)
+        row[x] = color;
+      continue;
+    }
+    // Lines of text are 12 pixels high every 22 pixels, with glyphs of 7 pixels chosen from the window and the line
+    line = (y - 30) / 22;
+    line_width = *width * 3 / 4 - (int)(((uint32_t)(index * 31 + line * 17)) % 97) * 4;
+    glyphs = (uint32_t)(index + 1) * 2654435761u ^ (uint32_t)(line + 1) * 40503u;
+    for (x = 0; x < *width; x++)
+    {
+      if (x >= *width * 3 / 4)
+        color = (uint32_t)((x * 255 / *width) << 16 | (y * 255 / *height) << 8 | 0xC0);
+      else if ((y - 30) % 22 >= 6 && (y - 30) % 22 < 18 && x >= 8 && x < line_width && ((glyphs >> ((x / 7) & 31)) & 1) != 0 && ((x + y) & 3) != 0)
+        color = 0x202020;
+      else
+        color = 0xF3F3F3;
+      row[x] = color;
+    }
+  }
+  return memory_capture_pixels;
+}
+
+// Applies the next step of the script and asks for a rescan, returns -1 once the script has ended
+int backendWaitForWindowEvents(HWND scope, HWND *handles, int handle_size, int timeout, int *is_rescan)
+{
+  char line[256];
+  size_t length;
+  int is_applied = 0;
+  addCounter(&backend_call_count, 1);
+  memoryInitialize();
+  *is_rescan = 1;
+  if (!is_memory_script_opened)
+  {
+    const char *path = getenv("WINDOW_STATE_MEMORY_SCRIPT");
+    is_memory_script_opened = 1;
+    memory_script = path != NULL && path[0] != '\0' ? fopen(path, "rb") : NULL;
+  }
+  if (memory_script == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), memory_script) != NULL)
+  {
+    length = strlen(line);
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+      line[--length] = '\0';
+    if (strcmp(line, "tick") == 0)
+      return 0;
+    if (length > 0 && line[0] != '#')
+    {
+      memoryApplyCommand(line);
+      is_applied = 1;
+    }
+  }
+  fclose(memory_script);
+  memory_script = NULL;
+  return is_applied ? 0 : -1;
+}
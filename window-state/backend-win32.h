@@ -0,0 +1,391 @@
+// Win32 window backend: thin wrappers over the user32 and psapi calls used by window-state.
+
+#include <tlhelp32.h>
+
+#define WINDOW_STATE_BACKEND_NAME "win32"
+#define WINDOW_STATE_BACKEND_CONCURRENT_LISTING 1
+
+// Sizes in UTF-16 units of the buffers the wide calls write to before their text is converted to UTF-8
+#define BACKEND_WIDE_TEXT_SIZE 1024
+#define BACKEND_WIDE_PATH_SIZE 4096
+
+int64_t backend_process_open_count = 0;
+
+// Counts every call made to the window system
+int64_t backend_call_count = 0;
+
+int backendIsWindow(HWND h)
+{
+  addCounter(&backend_call_count, 1);
+  return h != NULL && IsWindow(h);
+}
+
+HWND backendGetForegroundWindow()
+{
+  addCounter(&backend_call_count, 1);
+  return GetForegroundWindow();
+}
+
+HWND backendGetFirstChild(HWND parent)
+{
+  addCounter(&backend_call_count, 1);
+  return FindWindowExW(parent, NULL, NULL, NULL);
+}
+
+HWND backendGetWindow(HWND h, UINT cmd)
+{
+  addCounter(&backend_call_count, 1);
+  return GetWindow(h, cmd);
+}
+
+HWND backendGetParent(HWND h)
+{
+  addCounter(&backend_call_count, 1);
+  return GetParent(h);
+}
+
+// Converts UTF-16 text to UTF-8, truncated at a code point boundary when it does not fit with its terminator, and returns
+// its length. Lone surrogates are converted to U+FFFD, 3 bytes like the other characters of the basic plane.
+size_t convertWideText(const WCHAR *wide_text, int wide_length, char *text, size_t text_size)
+{
+  size_t text_length = 0;
+  size_t code_size;
+  int fitting_length = 0;
+  int code_length;
+  if (text_size == 0)
+    return 0;
+  // WideCharToMultiByte fails instead of truncating when the output is too small, so the prefix that fits is measured first
+  while (fitting_length < wide_length)
+  {
+    code_length = 1;
+    if (wide_text[fitting_length] < 0x80)
+      code_size = 1;
+    else if (wide_text[fitting_length] < 0x800)
+      code_size = 2;
+    else if (wide_text[fitting_length] >= 0xD800 && wide_text[fitting_length] <= 0xDBFF && fitting_length + 1 < wide_length && wide_text[fitting_length + 1] >= 0xDC00 && wide_text[fitting_length + 1] <= 0xDFFF)
+    {
+      code_size = 4;
+      code_length = 2;
+    }
+    else
+      code_size = 3;
+    if (text_length + code_size > text_size - 1)
+      break;
+    text_length += code_size;
+    fitting_length += code_length;
+  }
+  if (fitting_length == 0)
+  {
+    text[0] = '\0';
+    return 0;
+  }
+  code_length = WideCharToMultiByte(CP_UTF8, 0, wide_text, fitting_length, text, (int)text_size - 1, NULL, NULL);
+  if (code_length <= 0)
+    code_length = 0;
+  text[code_length] = '\0';
+  return (size_t)code_length;
+}
+
+// Window titles are read as UTF-16 and converted to UTF-8 so that they can be matched and written without a code page.
+// InternalGetWindowText reads the title stored by the system instead of sending WM_GETTEXT to the thread of the window, so a
+// hung application cannot block the read, and returns the same title as GetWindowText for windows of other processes.
+size_t backendGetWindowText(HWND h, char *text, size_t text_size)
+{
+  WCHAR wide_text[BACKEND_WIDE_TEXT_SIZE];
+  int wide_length;
+  addCounter(&backend_call_count, 1);
+  wide_length = InternalGetWindowText(h, wide_text, BACKEND_WIDE_TEXT_SIZE);
+  return convertWideText(wide_text, wide_length > 0 ? wide_length : 0, text, text_size);
+}
+
+// Module paths, class names and executable paths are read with the wide calls too, the ANSI calls replace the characters
+// outside of the code page
+size_t backendGetWindowModuleFileName(HWND h, char *module, size_t module_size)
+{
+  WCHAR wide_module[BACKEND_WIDE_PATH_SIZE];
+  UINT wide_length;
+  addCounter(&backend_call_count, 1);
+  wide_length = GetWindowModuleFileNameW(h, wide_module, BACKEND_WIDE_PATH_SIZE);
+  return convertWideText(wide_module, (int)wide_length, module, module_size);
+}
+
+size_t backendGetClassName(HWND h, char *class, size_t class_size)
+{
+  WCHAR wide_class[BACKEND_WIDE_TEXT_SIZE];
+  int wide_length;
+  addCounter(&backend_call_count, 1);
+  wide_length = GetClassNameW(h, wide_class, BACKEND_WIDE_TEXT_SIZE);
+  return convertWideText(wide_class, wide_length > 0 ? wide_length : 0, class, class_size);
+}
+
+DWORD backendGetWindowThreadProcessId(HWND h, DWORD *pid)
+{
+  addCounter(&backend_call_count, 1);
+  return GetWindowThreadProcessId(h, pid);
+}
+
+size_t backendGetProcessExecutable(DWORD pid, char *exec, size_t exec_size)
+{
+  WCHAR wide_exec[BACKEND_WIDE_PATH_SIZE];
+  DWORD wide_length = 0;
+  int64_t start;
+  HANDLE hProcess;
+  addCounter(&backend_call_count, 1);
+  start = beginStatsCall();
+  hProcess = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, pid);
+  endStatsCall(STATS_CALL_OPEN_PROCESS, start);
+  addCounter(&backend_process_open_count, 1);
+  if (hProcess != NULL)
+  {
+    start = beginStatsCall();
+    wide_length = GetModuleFileNameExW(hProcess, NULL, wide_exec, BACKEND_WIDE_PATH_SIZE);
+    endStatsCall(STATS_CALL_MODULE_FILE_NAME, start);
+    CloseHandle(hProcess);
+  }
+  return convertWideText(wide_exec, (int)wide_length, exec, exec_size);
+}
+
+LONG backendGetWindowLong(HWND h, int index)
+{
+  addCounter(&backend_call_count, 1);
+  return GetWindowLong(h, index);
+}
+
+int backendIsWindowUnicode(HWND h)
+{
+  addCounter(&backend_call_count, 1);
+  return IsWindowUnicode(h);
+}
+
+int backendIsWindowVisible(HWND h)
+{
+  addCounter(&backend_call_count, 1);
+  return IsWindowVisible(h);
+}
+
+int backendGetWindowRect(HWND h, RECT *rect)
+{
+  addCounter(&backend_call_count, 1);
+  return GetWindowRect(h, rect);
+}
+
+int backendSetForegroundWindow(HWND h)
+{
+  addCounter(&backend_call_count, 1);
+  return SetForegroundWindow(h);
+}
+
+int backendShowWindow(HWND h, int show_arg)
+{
+  addCounter(&backend_call_count, 1);
+  return ShowWindow(h, show_arg);
+}
+
+int backendSetWindowPos(HWND h, HWND insert_after, int x, int y, int w, int h_size, UINT flags)
+{
+  addCounter(&backend_call_count, 1);
+  return SetWindowPos(h, insert_after, x, y, w, h_size, flags);
+}
+
+// Positions of several windows are deferred into one batch that is applied, and repainted, at once
+HDWP backendBeginDeferWindowPos(int count)
+{
+  addCounter(&backend_call_count, 1);
+  return BeginDeferWindowPos(count);
+}
+
+HDWP backendDeferWindowPos(HDWP batch, HWND h, HWND insert_after, int x, int y, int w, int h_size, UINT flags)
+{
+  addCounter(&backend_call_count, 1);
+  return DeferWindowPos(batch, h, insert_after, x, y, w, h_size, flags);
+}
+
+int backendEndDeferWindowPos(HDWP batch)
+{
+  addCounter(&backend_call_count, 1);
+  return EndDeferWindowPos(batch);
+}
+
+// Area of the primary monitor that is not covered by the taskbar
+int backendGetWorkArea(RECT *rect)
+{
+  addCounter(&backend_call_count, 1);
+  return SystemParametersInfoA(SPI_GETWORKAREA, 0, rect, 0);
+}
+
+// The class name is given in UTF-8 like the class names that are read
+HWND backendFindWindowByClass(HWND parent, HWND after, const char *class)
+{
+  WCHAR wide_class[BACKEND_WIDE_TEXT_SIZE];
+  addCounter(&backend_call_count, 1);
+  if (MultiByteToWideChar(CP_UTF8, 0, class, -1, wide_class, BACKEND_WIDE_TEXT_SIZE) == 0)
+    return NULL;
+  return FindWindowExW(parent, after, wide_class, NULL);
+}
+
+int backendListProcessThreads(DWORD pid, DWORD *threads, int thread_size)
+{
+  int thread_count = 0;
+  THREADENTRY32 entry;
+  HANDLE snapshot;
+  addCounter(&backend_call_count, 1);
+  snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+  if (snapshot == INVALID_HANDLE_VALUE)
+    return 0;
+  entry.dwSize = sizeof(entry);
+  if (Thread32First(snapshot, &entry))
+  {
+    do
+    {
+      if (entry.th32OwnerProcessID == pid && thread_count < thread_size)
+        threads[thread_count++] = entry.th32ThreadID;
+    } while (Thread32Next(snapshot, &entry));
+  }
+  CloseHandle(snapshot);
+  return thread_count;
+}
+
+HWND *thread_window_list = NULL;
+int thread_window_count = 0;
+int thread_window_size = 0;
+
+BOOL CALLBACK appendThreadWindow(HWND h, LPARAM param)
+{
+  if (thread_window_count >= thread_window_size)
+    return FALSE;
+  thread_window_list[thread_window_count++] = h;
+  return TRUE;
+}
+
+int backendListThreadWindows(DWORD thread, HWND *windows, int window_size)
+{
+  addCounter(&backend_call_count, 1);
+  thread_window_list = windows;
+  thread_window_count = 0;
+  thread_window_size = window_size;
+  EnumThreadWindows(thread, appendThreadWindow, 0);
+  return thread_window_count;
+}
+
+#if !defined(PW_RENDERFULLCONTENT)
+#define PW_RENDERFULLCONTENT 0x00000002
+#endif
+
+// Bitmap of the last capture, deleted by the next one
+HDC capture_dc = NULL;
+HBITMAP capture_bitmap = NULL;
+
+// Windows are drawn into a top-down DIB section with PrintWindow, which also renders windows covered by others and the
+// content of DirectComposition windows, and copied from the screen with BitBlt when the window does not print itself
+uint8_t *backendCaptureWindow(HWND h, int *width, int *height, size_t *stride)
+{
+  BITMAPINFO info;
+  RECT rect;
+  HDC window_dc;
+  void *bits = NULL;
+  int is_drawn;
+  addCounter(&backend_call_count, 1);
+  if (capture_bitmap != NULL)
+  {
+    DeleteObject(capture_bitmap);
+    capture_bitmap = NULL;
+  }
+  if (!GetWindowRect(h, &rect) || rect.right <= rect.left || rect.bottom <= rect.top || IsIconic(h))
+    return NULL;
+  if (capture_dc == NULL)
+    capture_dc = CreateCompatibleDC(NULL);
+  if (capture_dc == NULL)
+    return NULL;
+  memset(&info, 0, sizeof(info));
+  info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+  info.bmiHeader.biWidth = rect.right - rect.left;
+  // A negative height stores the rows from the top
+  info.bmiHeader.biHeight = -(rect.bottom - rect.top);
+  info.bmiHeader.biPlanes = 1;
+  info.bmiHeader.biBitCount = 32;
+  info.bmiHeader.biCompression = BI_RGB;
+  capture_bitmap = CreateDIBSection(capture_dc, &info, DIB_RGB_COLORS, &bits, NULL, 0);
+  if (capture_bitmap == NULL || bits == NULL)
+    return NULL;
+  SelectObject(capture_dc, capture_bitmap);
+  is_drawn = PrintWindow(h, capture_dc, PW_RENDERFULLCONTENT);
+  if (!is_drawn)
+  {
+    window_dc = GetWindowDC(h);
+    is_drawn = window_dc != NULL && BitBlt(capture_dc, 0, 0, rect.right - rect.left, rect.bottom - rect.top, window_dc, 0, 0, SRCCOPY);
+    if (window_dc != NULL)
+      ReleaseDC(h, window_dc);
+  }
+  // The bitmap is written by the GDI batch, which is flushed before the pixels are read
+  GdiFlush();
+  if (!is_drawn)
+    return NULL;
+  *width = rect.right - rect.left;
+  *height = rect.bottom - rect.top;
+  *stride = (size_t)*width * 4;
+  return (uint8_t *)bits;
+}
+
+// Window events are received by out-of-context WinEvent hooks, which are delivered while this thread pumps messages
+HWINEVENTHOOK window_event_hooks[2] = {NULL, NULL};
+HWND *window_event_list = NULL;
+int window_event_count = 0;
+int window_event_size = 0;
+int is_window_event_overflow = 0;
+HWND window_event_scope = NULL;
+
+void CALLBACK appendWindowEvent(HWINEVENTHOOK hook, DWORD event, HWND h, LONG object, LONG child, DWORD thread, DWORD time)
+{
+  if (h == NULL || object != OBJID_WINDOW || child != CHILDID_SELF)
+    return;
+  // Destroyed windows can no longer be checked, and the foreground window may be owned by a window of the scope
+  if (event != EVENT_OBJECT_DESTROY && event != EVENT_SYSTEM_FOREGROUND && GetAncestor(h, GA_PARENT) != window_event_scope)
+    return;
+  if (window_event_count >= window_event_size)
+  {
+    is_window_event_overflow = 1;
+    return;
+  }
+  window_event_list[window_event_count++] = h;
+}
+
+// Waits until windows are created, destroyed, moved or renamed, or until the timeout elapses
+int backendWaitForWindowEvents(HWND scope, HWND *handles, int handle_size, int timeout, int *is_rescan)
+{
+  MSG message;
+  DWORD start;
+  DWORD elapsed;
+  addCounter(&backend_call_count, 1);
+  window_event_list = handles;
+  window_event_count = 0;
+  window_event_size = handle_size;
+  is_window_event_overflow = 0;
+  window_event_scope = scope != NULL ? scope : GetDesktopWindow();
+  if (window_event_hooks[0] == NULL)
+  {
+    window_event_hooks[0] = SetWinEventHook(EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND, NULL, appendWindowEvent, 0, 0, WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+    window_event_hooks[1] = SetWinEventHook(EVENT_OBJECT_CREATE, EVENT_OBJECT_NAMECHANGE, NULL, appendWindowEvent, 0, 0, WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+  }
+  // Without hooks the windows of the scope are compared with the previous snapshot on every interval
+  if (window_event_hooks[0] == NULL || window_event_hooks[1] == NULL)
+  {
+    Sleep((DWORD)timeout);
+    *is_rescan = 1;
+    return 0;
+  }
+  start = GetTickCount();
+  for (;;)
+  {
+    while (PeekMessage(&message, NULL, 0, 0, PM_REMOVE))
+    {
+      TranslateMessage(&message);
+      DispatchMessage(&message);
+    }
+    elapsed = GetTickCount() - start;
+    if (window_event_count > 0 || is_window_event_overflow || elapsed >= (DWORD)timeout)
+      break;
+    MsgWaitForMultipleObjects(0, NULL, FALSE, (DWORD)timeout - elapsed, QS_ALLINPUT);
+  }
+  *is_rescan = is_window_event_overflow;
+  return window_event_count;
+}
@@ -0,0 +1,953 @@
+// X11 window backend: Xlib calls and the EWMH properties of the window manager, so window-state runs on Linux desktops.
+//
+// The top-level windows are the client windows that the window manager lists in _NET_CLIENT_LIST_STACKING, in z-order
+// from the top, and their children are read with XQueryTree. Titles come from _NET_WM_NAME (or WM_NAME), class names from
+// the class of WM_CLASS, process ids from _NET_WM_PID and executables from /proc. The WS_ style bits are derived from the
+// map state and from _NET_WM_STATE, rectangles include the _NET_FRAME_EXTENTS of the window manager, and show states and
+// stacking are requested from the window manager with EWMH client messages. Handles are the XIDs of the windows.
+//
+// The display of $DISPLAY is opened on first use. X has no notion of the thread of a window, so the thread of a window is
+// its process id. X11 cannot position several windows atomically: a deferred batch only buffers its requests, which are
+// sent together when it ends.
+//
+// Windows are captured with XGetImage on displays of 24 or 32 bits per pixel. Defining WINDOW_STATE_X11_XSHM, and linking
+// with -lXext, reads the pixels through a shared memory segment of the MIT-SHM extension instead of the X connection,
+// with XGetImage used when the extension is not available, as on remote displays.
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/Xatom.h>
+#include <unistd.h>
+#include <sys/select.h>
+#if defined(WINDOW_STATE_X11_XSHM)
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
+
+#define WINDOW_STATE_BACKEND_NAME "x11"
+// Listing the top-level windows replaces the client list that backendGetWindow reads for the sibling of a window
+#define WINDOW_STATE_BACKEND_CONCURRENT_LISTING 0
+
+#define X11_NET_CLIENT_LIST_STACKING 0
+#define X11_NET_CLIENT_LIST 1
+#define X11_NET_ACTIVE_WINDOW 2
+#define X11_NET_WM_NAME 3
+#define X11_UTF8_STRING 4
+#define X11_NET_WM_PID 5
+#define X11_NET_WM_STATE 6
+#define X11_NET_WM_STATE_HIDDEN 7
+#define X11_NET_WM_STATE_MAXIMIZED_VERT 8
+#define X11_NET_WM_STATE_MAXIMIZED_HORZ 9
+#define X11_NET_WM_STATE_ABOVE 10
+#define X11_NET_WM_STATE_SKIP_TASKBAR 11
+#define X11_NET_FRAME_EXTENTS 12
+#define X11_NET_WORKAREA 13
+#define X11_NET_RESTACK_WINDOW 14
+#define X11_NET_WM_WINDOW_TYPE 15
+#define X11_NET_WM_WINDOW_TYPE_UTILITY 16
+#define X11_NET_WM_WINDOW_TYPE_TOOLBAR 17
+#define X11_ATOM_COUNT 18
+
+// Source indication of the EWMH requests, 2 is a pager or a tool acting for the user
+#define X11_SOURCE_PAGER 2
+
+char *x11_atom_names[X11_ATOM_COUNT] = {
+    "_NET_CLIENT_LIST_STACKING",
+    "_NET_CLIENT_LIST",
+    "_NET_ACTIVE_WINDOW",
+    "_NET_WM_NAME",
+    "UTF8_STRING",
+    "_NET_WM_PID",
+    "_NET_WM_STATE",
+    "_NET_WM_STATE_HIDDEN",
+    "_NET_WM_STATE_MAXIMIZED_VERT",
+    "_NET_WM_STATE_MAXIMIZED_HORZ",
+    "_NET_WM_STATE_ABOVE",
+    "_NET_WM_STATE_SKIP_TASKBAR",
+    "_NET_FRAME_EXTENTS",
+    "_NET_WORKAREA",
+    "_NET_RESTACK_WINDOW",
+    "_NET_WM_WINDOW_TYPE",
+    "_NET_WM_WINDOW_TYPE_UTILITY",
+    "_NET_WM_WINDOW_TYPE_TOOLBAR",
+};
+
+Display *x11_display = NULL;
+Window x11_root = 0;
+int x11_screen = 0;
+int is_x11_opened = 0;
+Atom x11_atoms[X11_ATOM_COUNT];
+
+// Client windows of the last enumeration of the top-level windows, from the top of the z-order, each thread keeps the index of
+// the last client it found since the threads walk different parts of the list
+Window *x11_clients = NULL;
+int x11_client_count = 0;
+THREAD_LOCAL int x11_client_hint = 0;
+
+int is_x11_batch_open = 0;
+int is_x11_watching = 0;
+
+// Counts the /proc lookups that resolve executables
+int64_t backend_process_open_count = 0;
+
+// Counts every call made to the window system
+int64_t backend_call_count = 0;
+
+// Windows can be destroyed at any time, errors of requests about them are ignored and reported by the return values
+int x11IgnoreError(Display *display, XErrorEvent *error)
+{
+  return 0;
+}
+
+Display *x11Open()
+{
+  if (is_x11_opened)
+    return x11_display;
+  is_x11_opened = 1;
+  // The tree mode makes requests from several threads
+  XInitThreads();
+  x11_display = XOpenDisplay(NULL);
+  if (x11_display == NULL)
+    return NULL;
+  XSetErrorHandler(x11IgnoreError);
+  x11_screen = DefaultScreen(x11_display);
+  x11_root = RootWindow(x11_display, x11_screen);
+  XInternAtoms(x11_display, x11_atom_names, X11_ATOM_COUNT, False, x11_atoms);
+  return x11_display;
+}
+
+Window x11GetWindow(HWND h)
+{
+  return (Window)(uintptr_t)h;
+}
+
+HWND x11GetHandle(Window w)
+{
+  return (HWND)(uintptr_t)w;
+}
+
+// Reads a property of a window into data that is released with XFree, returns the number of items or zero
+unsigned long x11GetProperty(Window w, int atom, Atom type, unsigned char **data)
+{
+  Atom actual_type;
+  int actual_format;
+  unsigned long count = 0;
+  unsigned long remaining;
+  *data = NULL;
+  if (XGetWindowProperty(x11_display, w, x11_atoms[atom], 0, 1 << 20, False, type, &actual_type, &actual_format, &count, &remaining, data) != Success)
+  {
+    *data = NULL;
+    return 0;
+  }
+  if (*data == NULL || count == 0)
+  {
+    if (*data != NULL)
+      XFree(*data);
+    *data = NULL;
+    return 0;
+  }
+  return count;
+}
+
+// Reads the first value of a CARDINAL or WINDOW property, items of format 32 are returned by Xlib as longs
+int x11GetCardinal(Window w, int atom, Atom type, long *value)
+{
+  unsigned char *data;
+  if (x11GetProperty(w, atom, type, &data) == 0)
+    return 0;
+  *value = ((long *)data)[0];
+  XFree(data);
+  return 1;
+}
+
+// Loads the client windows, in stacking order when the window manager provides it, or the children of the root window
+void x11LoadClients()
+{
+  unsigned char *data;
+  unsigned long count;
+  Window *children = NULL;
+  Window root_return;
+  Window parent_return;
+  unsigned int child_count = 0;
+  unsigned long i;
+  free(x11_clients);
+  x11_clients = NULL;
+  x11_client_count = 0;
+  x11_client_hint = 0;
+  count = x11GetProperty(x11_root, X11_NET_CLIENT_LIST_STACKING, XA_WINDOW, &data);
+  if (count == 0)
+    count = x11GetProperty(x11_root, X11_NET_CLIENT_LIST, XA_WINDOW, &data);
+  if (count > 0)
+  {
+    x11_clients = (Window *)malloc(count * sizeof(Window));
+    // Both lists are ordered from the bottom of the stack
+    for (i = 0; x11_clients != NULL && i < count; i++)
+      x11_clients[i] = (Window)((long *)data)[count - 1 - i];
+    x11_client_count = x11_clients != NULL ? (int)count : 0;
+    XFree(data);
+    return;
+  }
+  if (!XQueryTree(x11_display, x11_root, &root_return, &parent_return, &children, &child_count) || child_count == 0)
+    return;
+  x11_clients = (Window *)malloc(child_count * sizeof(Window));
+  for (i = 0; x11_clients != NULL && i < child_count; i++)
+    x11_clients[i] = children[child_count - 1 - i];
+  x11_client_count = x11_clients != NULL ? (int)child_count : 0;
+  XFree(children);
+}
+
+// Returns the index of a client window, starting after the last one found since the list is mostly walked in order
+int x11FindClient(Window w)
+{
+  int i;
+  for (i = x11_client_hint; i < x11_client_count; i++)
+  {
+    if (x11_clients[i] == w)
+      return x11_client_hint = i;
+  }
+  for (i = 0; i < x11_client_hint && i < x11_client_count; i++)
+  {
+    if (x11_clients[i] == w)
+      return x11_client_hint = i;
+  }
+  return -1;
+}
+
+// Returns the parent of a window, or None for client windows and children of the root
+Window x11GetParent(Window w)
+{
+  Window root_return;
+  Window parent = None;
+  Window *children = NULL;
+  unsigned int child_count = 0;
+  if (x11FindClient(w) >= 0)
+    return None;
+  if (!XQueryTree(x11_display, w, &root_return, &parent, &children, &child_count))
+    return None;
+  if (children != NULL)
+    XFree(children);
+  return parent == x11_root ? None : parent;
+}
+
+// Returns the window stacked below a child of a parent, the children of XQueryTree are ordered from the bottom
+Window x11GetNextChild(Window parent, Window w)
+{
+  Window root_return;
+  Window parent_return;
+  Window *children = NULL;
+  Window next = None;
+  unsigned int child_count = 0;
+  unsigned int i;
+  if (!XQueryTree(x11_display, parent, &root_return, &parent_return, &children, &child_count))
+    return None;
+  for (i = 0; i < child_count; i++)
+  {
+    if (children[i] == w)
+    {
+      next = w == None ? None : (i > 0 ? children[i - 1] : None);
+      break;
+    }
+  }
+  if (w == None && child_count > 0)
+    next = children[child_count - 1];
+  if (children != NULL)
+    XFree(children);
+  return next;
+}
+
+int backendIsWindow(HWND h)
+{
+  XWindowAttributes attributes;
+  addCounter(&backend_call_count, 1);
+  if (h == NULL || x11Open() == NULL)
+    return 0;
+  return XGetWindowAttributes(x11_display, x11GetWindow(h), &attributes) != 0;
+}
+
+HWND backendGetForegroundWindow()
+{
+  long value;
+  addCounter(&backend_call_count, 1);
+  if (x11Open() == NULL || !x11GetCardinal(x11_root, X11_NET_ACTIVE_WINDOW, XA_WINDOW, &value))
+    return NULL;
+  return x11GetHandle((Window)value);
+}
+
+HWND backendGetFirstChild(HWND parent)
+{
+  addCounter(&backend_call_count, 1);
+  if (x11Open() == NULL)
+    return NULL;
+  if (parent == NULL)
+  {
+    x11LoadClients();
+    return x11_client_count > 0 ? x11GetHandle(x11_clients[0]) : NULL;
+  }
+  return x11GetHandle(x11GetNextChild(x11GetWindow(parent), None));
+}
+
+HWND backendGetWindow(HWND h, UINT cmd)
+{
+  Window w = x11GetWindow(h);
+  Window parent;
+  int index;
+  addCounter(&backend_call_count, 1);
+  if (h == NULL || x11Open() == NULL)
+    return NULL;
+  if (cmd == GW_CHILD)
+    return x11GetHandle(x11GetNextChild(w, None));
+  if (cmd != GW_HWNDNEXT)
+    return NULL;
+  index = x11FindClient(w);
+  if (index >= 0)
+    return index + 1 < x11_client_count ? x11GetHandle(x11_clients[index + 1]) : NULL;
+  parent = x11GetParent(w);
+  return x11GetHandle(x11GetNextChild(parent != None ? parent : x11_root, w));
+}
+
+HWND backendGetParent(HWND h)
+{
+  addCounter(&backend_call_count, 1);
+  if (h == NULL || x11Open() == NULL)
+    return NULL;
+  return x11GetHandle(x11GetParent(x11GetWindow(h)));
+}
+
+size_t x11CopyText(const char *source, size_t source_length, char *text, size_t text_size)
+{
+  size_t length = source_length < text_size ? source_length : text_size - 1;
+  if (text_size == 0)
+    return 0;
+  memcpy(text, source, length);
+  text[length] = '\0';
+  return strnlen(text, length);
+}
+
+size_t backendGetWindowText(HWND h, char *text, size_t text_size)
+{
+  unsigned char *data;
+  unsigned long count;
+  char *name = NULL;
+  size_t length = 0;
+  addCounter(&backend_call_count, 1);
+  if (text_size > 0)
+    text[0] = '\0';
+  if (h == NULL || x11Open() == NULL)
+    return 0;
+  count = x11GetProperty(x11GetWindow(h), X11_NET_WM_NAME, x11_atoms[X11_UTF8_STRING], &data);
+  if (count > 0)
+  {
+    length = x11CopyText((char *)data, (size_t)count, text, text_size);
+    XFree(data);
+    return length;
+  }
+  if (XFetchName(x11_display, x11GetWindow(h), &name) && name != NULL)
+  {
+    length = x11CopyText(name, strlen(name), text, text_size);
+    XFree(name);
+  }
+  return length;
+}
+
+DWORD backendGetWindowThreadProcessId(HWND h, DWORD *pid)
+{
+  long value = 0;
+  addCounter(&backend_call_count, 1);
+  if (h != NULL && x11Open() != NULL)
+    x11GetCardinal(x11GetWindow(h), X11_NET_WM_PID, XA_CARDINAL, &value);
+  if (pid != NULL)
+    *pid = (DWORD)value;
+  return (DWORD)value;
+}
+
+size_t backendGetProcessExecutable(DWORD pid, char *exec, size_t exec_size)
+{
+  char path[64];
+  ssize_t length;
+  int64_t start;
+  addCounter(&backend_call_count, 1);
+  addCounter(&backend_process_open_count, 1);
+  if (exec_size > 0)
+    exec[0] = '\0';
+  if (pid == 0 || exec_size == 0)
+    return 0;
+  snprintf(path, sizeof(path), "/proc/%u/exe", (unsigned int)pid);
+  // The link of the process is read without opening it, only the module file name is timed
+  start = beginStatsCall();
+  length = readlink(path, exec, exec_size - 1);
+  endStatsCall(STATS_CALL_MODULE_FILE_NAME, start);
+  if (length < 0)
+    length = 0;
+  exec[length] = '\0';
+  return (size_t)length;
+}
+
+// The module of a window is the executable of its process, shared libraries do not own windows in X
+size_t backendGetWindowModuleFileName(HWND h, char *module, size_t module_size)
+{
+  DWORD pid = 0;
+  addCounter(&backend_call_count, 1);
+  backendGetWindowThreadProcessId(h, &pid);
+  return backendGetProcessExecutable(pid, module, module_size);
+}
+
+size_t backendGetClassName(HWND h, char *class, size_t class_size)
+{
+  XClassHint hint;
+  size_t length = 0;
+  addCounter(&backend_call_count, 1);
+  if (class_size > 0)
+    class[0] = '\0';
+  if (h == NULL || x11Open() == NULL)
+    return 0;
+  hint.res_name = NULL;
+  hint.res_class = NULL;
+  if (!XGetClassHint(x11_display, x11GetWindow(h), &hint))
+    return 0;
+  if (hint.res_class != NULL)
+    length = x11CopyText(hint.res_class, strlen(hint.res_class), class, class_size);
+  if (hint.res_name != NULL)
+    XFree(hint.res_name);
+  if (hint.res_class != NULL)
+    XFree(hint.res_class);
+  return length;
+}
+
+// Returns whether a window lists a state or a type in a property of atoms
+int x11HasAtom(Window w, int property, int atom)
+{
+  unsigned char *data;
+  unsigned long count = x11GetProperty(w, property, XA_ATOM, &data);
+  unsigned long i;
+  int is_found = 0;
+  for (i = 0; i < count && !is_found; i++)
+    is_found = (Atom)((long *)data)[i] == x11_atoms[atom];
+  if (data != NULL)
+    XFree(data);
+  return is_found;
+}
+
+LONG x11GetStyle(Window w, int index)
+{
+  XWindowAttributes attributes;
+  LONG style = 0;
+  int is_client;
+  if (!XGetWindowAttributes(x11_display, w, &attributes))
+    return 0;
+  is_client = x11FindClient(w) >= 0;
+  if (index == GWL_EXSTYLE)
+  {
+    if (x11HasAtom(w, X11_NET_WM_STATE, X11_NET_WM_STATE_ABOVE))
+      style |= WS_EX_TOPMOST;
+    if (attributes.class == InputOnly)
+      style |= WS_EX_TRANSPARENT;
+    if (is_client && (x11HasAtom(w, X11_NET_WM_STATE, X11_NET_WM_STATE_SKIP_TASKBAR) || x11HasAtom(w, X11_NET_WM_WINDOW_TYPE, X11_NET_WM_WINDOW_TYPE_UTILITY) || x11HasAtom(w, X11_NET_WM_WINDOW_TYPE, X11_NET_WM_WINDOW_TYPE_TOOLBAR)))
+      style |= WS_EX_TOOLWINDOW;
+    return style;
+  }
+  if (index != GWL_STYLE)
+    return 0;
+  style = is_client ? WS_OVERLAPPEDWINDOW | WS_CLIPSIBLINGS : WS_CHILD;
+  if (attributes.map_state == IsViewable)
+    style |= WS_VISIBLE;
+  if (is_client && x11HasAtom(w, X11_NET_WM_STATE, X11_NET_WM_STATE_HIDDEN))
+  {
+    // Windows keeps minimized windows visible
+    style |= WS_MINIMIZE | WS_VISIBLE;
+  }
+  else if (is_client && x11HasAtom(w, X11_NET_WM_STATE, X11_NET_WM_STATE_MAXIMIZED_VERT) && x11HasAtom(w, X11_NET_WM_STATE, X11_NET_WM_STATE_MAXIMIZED_HORZ))
+  {
+    style |= WS_MAXIMIZE;
+  }
+  return style;
+}
+
+LONG backendGetWindowLong(HWND h, int index)
+{
+  addCounter(&backend_call_count, 1);
+  if (h == NULL || x11Open() == NULL)
+    return 0;
+  return x11GetStyle(x11GetWindow(h), index);
+}
+
+int backendIsWindowUnicode(HWND h)
+{
+  addCounter(&backend_call_count, 1);
+  return h != NULL;
+}
+
+int backendIsWindowVisible(HWND h)
+{
+  addCounter(&backend_call_count, 1);
+  if (h == NULL || x11Open() == NULL)
+    return 0;
+  return (x11GetStyle(x11GetWindow(h), GWL_STYLE) & WS_VISIBLE) != 0;
+}
+
+// Reads the frame extents that the window manager adds around a client window, as left, right, top and bottom
+int x11GetFrameExtents(Window w, long *extents)
+{
+  unsigned char *data;
+  unsigned long count = x11GetProperty(w, X11_NET_FRAME_EXTENTS, XA_CARDINAL, &data);
+  int i;
+  for (i = 0; i < 4; i++)
+    extents[i] = count >= 4 ? ((long *)data)[i] : 0;
+  if (data != NULL)
+    XFree(data);
+  return count >= 4;
+}
+
+// The rectangle is in screen coordinates and includes the border and the frame of the window manager, like GetWindowRect
+int backendGetWindowRect(HWND h, RECT *rect)
+{
+  XWindowAttributes attributes;
+  Window w = x11GetWindow(h);
+  Window child;
+  long extents[4];
+  int x;
+  int y;
+  addCounter(&backend_call_count, 1);
+  if (h == NULL || x11Open() == NULL || !XGetWindowAttributes(x11_display, w, &attributes))
+    return 0;
+  if (!XTranslateCoordinates(x11_display, w, x11_root, 0, 0, &x, &y, &child))
+    return 0;
+  rect->left = x - attributes.border_width;
+  rect->top = y - attributes.border_width;
+  rect->right = x + attributes.width + attributes.border_width;
+  rect->bottom = y + attributes.height + attributes.border_width;
+  if (x11FindClient(w) >= 0 && x11GetFrameExtents(w, extents))
+  {
+    rect->left -= extents[0];
+    rect->right += extents[1];
+    rect->top -= extents[2];
+    rect->bottom += extents[3];
+  }
+  return 1;
+}
+
+// Sends an EWMH request about a window to the window manager
+void x11SendRequest(Window w, int atom, long l0, long l1, long l2, long l3)
+{
+  XEvent event;
+  memset(&event, 0, sizeof(event));
+  event.xclient.type = ClientMessage;
+  event.xclient.window = w;
+  event.xclient.message_type = x11_atoms[atom];
+  event.xclient.format = 32;
+  event.xclient.data.l[0] = l0;
+  event.xclient.data.l[1] = l1;
+  event.xclient.data.l[2] = l2;
+  event.xclient.data.l[3] = l3;
+  event.xclient.data.l[4] = 0;
+  XSendEvent(x11_display, x11_root, False, SubstructureRedirectMask | SubstructureNotifyMask, &event);
+}
+
+// Adds (1) or removes (0) up to two states of a client window
+void x11SetState(Window w, int is_added, int first, int second)
+{
+  x11SendRequest(w, X11_NET_WM_STATE, is_added, (long)x11_atoms[first], second >= 0 ? (long)x11_atoms[second] : 0, X11_SOURCE_PAGER);
+}
+
+void x11Activate(Window w)
+{
+  if (x11FindClient(w) >= 0)
+    x11SendRequest(w, X11_NET_ACTIVE_WINDOW, X11_SOURCE_PAGER, CurrentTime, 0, 0);
+  else
+    XSetInputFocus(x11_display, w, RevertToParent, CurrentTime);
+}
+
+void x11Flush()
+{
+  if (!is_x11_batch_open)
+    XFlush(x11_display);
+}
+
+int backendSetForegroundWindow(HWND h)
+{
+  addCounter(&backend_call_count, 1);
+  if (h == NULL || x11Open() == NULL)
+    return 0;
+  x11LoadClients();
+  x11Activate(x11GetWindow(h));
+  x11Flush();
+  return 1;
+}
+
+int backendShowWindow(HWND h, int show_arg)
+{
+  Window w = x11GetWindow(h);
+  int was_visible;
+  addCounter(&backend_call_count, 1);
+  if (h == NULL || x11Open() == NULL)
+    return 0;
+  x11LoadClients();
+  was_visible = (x11GetStyle(w, GWL_STYLE) & WS_VISIBLE) != 0;
+  if (show_arg == SW_HIDE)
+  {
+    XWithdrawWindow(x11_display, w, x11_screen);
+  }
+  else if (show_arg == SW_MINIMIZE)
+  {
+    XIconifyWindow(x11_display, w, x11_screen);
+  }
+  else if (show_arg == SW_MAXIMIZE)
+  {
+    XMapWindow(x11_display, w);
+    x11SetState(w, 1, X11_NET_WM_STATE_MAXIMIZED_VERT, X11_NET_WM_STATE_MAXIMIZED_HORZ);
+  }
+  else if (show_arg == SW_RESTORE || show_arg == SW_SHOWNORMAL || show_arg == SW_SHOWNOACTIVATE)
+  {
+    XMapWindow(x11_display, w);
+    x11SetState(w, 0, X11_NET_WM_STATE_MAXIMIZED_VERT, X11_NET_WM_STATE_MAXIMIZED_HORZ);
+    x11SetState(w, 0, X11_NET_WM_STATE_HIDDEN, -1);
+    if (show_arg != SW_SHOWNOACTIVATE)
+      x11Activate(w);
+  }
+  else
+  {
+    XMapWindow(x11_display, w);
+  }
+  x11Flush();
+  return was_visible;
+}
+
+// Requests a position, size and stacking without flushing, the position of a client is the position of its frame
+void x11SetWindowPos(Window w, HWND insert_after, int x, int y, int width, int height, UINT flags)
+{
+  XWindowChanges changes;
+  unsigned int mask = 0;
+  long extents[4];
+  int is_client = x11FindClient(w) >= 0;
+  if ((flags & SWP_HIDEWINDOW) != 0)
+    XWithdrawWindow(x11_display, w, x11_screen);
+  if ((flags & SWP_NOMOVE) == 0)
+  {
+    changes.x = x;
+    changes.y = y;
+    mask |= CWX | CWY;
+  }
+  if ((flags & SWP_NOSIZE) == 0)
+  {
+    // Sizes of GetWindowRect include the frame, X sizes do not
+    if (!is_client || !x11GetFrameExtents(w, extents))
+      extents[0] = extents[1] = extents[2] = extents[3] = 0;
+    changes.width = width - (int)(extents[0] + extents[1]) > 1 ? width - (int)(extents[0] + extents[1]) : 1;
+    changes.height = height - (int)(extents[2] + extents[3]) > 1 ? height - (int)(extents[2] + extents[3]) : 1;
+    mask |= CWWidth | CWHeight;
+  }
+  if ((flags & SWP_NOZORDER) == 0)
+  {
+    if (insert_after == HWND_TOPMOST || insert_after == HWND_NOTOPMOST)
+      x11SetState(w, insert_after == HWND_TOPMOST, X11_NET_WM_STATE_ABOVE, -1);
+    if (insert_after == HWND_TOP || insert_after == HWND_TOPMOST)
+    {
+      changes.stack_mode = Above;
+      mask |= CWStackMode;
+    }
+    else if (insert_after == HWND_BOTTOM)
+    {
+      changes.stack_mode = Below;
+      mask |= CWStackMode;
+    }
+    else if (insert_after != HWND_NOTOPMOST && is_client)
+    {
+      // Clients are stacked by the window manager since their frames, not the clients, are siblings
+      x11SendRequest(w, X11_NET_RESTACK_WINDOW, X11_SOURCE_PAGER, (long)x11GetWindow(insert_after), Below, 0);
+    }
+    else if (insert_after != HWND_NOTOPMOST)
+    {
+      changes.sibling = x11GetWindow(insert_after);
+      changes.stack_mode = Below;
+      mask |= CWSibling | CWStackMode;
+    }
+  }
+  if (mask != 0)
+    XConfigureWindow(x11_display, w, mask, &changes);
+  if ((flags & SWP_SHOWWINDOW) != 0)
+    XMapWindow(x11_display, w);
+}
+
+int backendSetWindowPos(HWND h, HWND insert_after, int x, int y, int w, int h_size, UINT flags)
+{
+  XWindowAttributes attributes;
+  addCounter(&backend_call_count, 1);
+  if (h == NULL || x11Open() == NULL || !XGetWindowAttributes(x11_display, x11GetWindow(h), &attributes))
+    return 0;
+  x11LoadClients();
+  x11SetWindowPos(x11GetWindow(h), insert_after, x, y, w, h_size, flags);
+  x11Flush();
+  return 1;
+}
+
+HDWP backendBeginDeferWindowPos(int count)
+{
+  addCounter(&backend_call_count, 1);
+  if (x11Open() == NULL || is_x11_batch_open)
+    return NULL;
+  x11LoadClients();
+  is_x11_batch_open = 1;
+  return (HDWP)&is_x11_batch_open;
+}
+
+HDWP backendDeferWindowPos(HDWP batch, HWND h, HWND insert_after, int x, int y, int w, int h_size, UINT flags)
+{
+  XWindowAttributes attributes;
+  addCounter(&backend_call_count, 1);
+  if (batch == NULL || !is_x11_batch_open || h == NULL || !XGetWindowAttributes(x11_display, x11GetWindow(h), &attributes))
+  {
+    is_x11_batch_open = 0;
+    return NULL;
+  }
+  x11SetWindowPos(x11GetWindow(h), insert_after, x, y, w, h_size, flags);
+  return batch;
+}
+
+// The requests of the batch are written to the server with a single flush
+int backendEndDeferWindowPos(HDWP batch)
+{
+  addCounter(&backend_call_count, 1);
+  if (batch == NULL || !is_x11_batch_open)
+    return 0;
+  is_x11_batch_open = 0;
+  XFlush(x11_display);
+  return 1;
+}
+
+int backendGetWorkArea(RECT *rect)
+{
+  XWindowAttributes attributes;
+  unsigned char *data;
+  unsigned long count;
+  addCounter(&backend_call_count, 1);
+  if (x11Open() == NULL)
+    return 0;
+  count = x11GetProperty(x11_root, X11_NET_WORKAREA, XA_CARDINAL, &data);
+  if (count >= 4)
+  {
+    rect->left = (LONG)((long *)data)[0];
+    rect->top = (LONG)((long *)data)[1];
+    rect->right = rect->left + (LONG)((long *)data)[2];
+    rect->bottom = rect->top + (LONG)((long *)data)[3];
+    XFree(data);
+    return 1;
+  }
+  if (data != NULL)
+    XFree(data);
+  if (!XGetWindowAttributes(x11_display, x11_root, &attributes))
+    return 0;
+  rect->left = 0;
+  rect->top = 0;
+  rect->right = attributes.width;
+  rect->bottom = attributes.height;
+  return 1;
+}
+
+int x11IsMatchingClass(const char *str1, const char *str2)
+{
+  size_t i;
+  for (i = 0; str1[i] != '\0' || str2[i] != '\0'; i++)
+  {
+    if ((str1[i] >= 'A' && str1[i] <= 'Z' ? str1[i] + 32 : str1[i]) != (str2[i] >= 'A' && str2[i] <= 'Z' ? str2[i] + 32 : str2[i]))
+      return 0;
+  }
+  return 1;
+}
+
+HWND backendFindWindowByClass(HWND parent, HWND after, const char *class)
+{
+  char name[256];
+  HWND h;
+  addCounter(&backend_call_count, 1);
+  if (x11Open() == NULL)
+    return NULL;
+  h = after != NULL ? backendGetWindow(after, GW_HWNDNEXT) : backendGetFirstChild(parent);
+  for (; h != NULL; h = backendGetWindow(h, GW_HWNDNEXT))
+  {
+    backendGetClassName(h, name, sizeof(name));
+    if (x11IsMatchingClass(name, class))
+      return h;
+  }
+  return NULL;
+}
+
+// The process is its own single thread, see backendGetWindowThreadProcessId
+int backendListProcessThreads(DWORD pid, DWORD *threads, int thread_size)
+{
+  addCounter(&backend_call_count, 1);
+  if (pid == 0 || thread_size <= 0)
+    return 0;
+  threads[0] = pid;
+  return 1;
+}
+
+int backendListThreadWindows(DWORD thread, HWND *windows, int window_size)
+{
+  long pid;
+  int count = 0;
+  int i;
+  addCounter(&backend_call_count, 1);
+  if (x11Open() == NULL)
+    return 0;
+  x11LoadClients();
+  for (i = 0; i < x11_client_count && count < window_size; i++)
+  {
+    if (x11GetCardinal(x11_clients[i], X11_NET_WM_PID, XA_CARDINAL, &pid) && (DWORD)pid == thread)
+      windows[count++] = x11GetHandle(x11_clients[i]);
+  }
+  return count;
+}
+
+// Image of the last capture, destroyed by the next one
+XImage *x11_capture_image = NULL;
+
+#if defined(WINDOW_STATE_X11_XSHM)
+// Segment shared with the X server, grown to the largest capture and kept for the next ones
+XShmSegmentInfo x11_shm_segment;
+size_t x11_shm_size = 0;
+int is_x11_shm_checked = 0;
+int is_x11_shm_available = 0;
+
+// Reads the pixels of a window into the shared segment, returns NULL when the extension or the segment is not available
+XImage *x11CaptureShared(Window w, XWindowAttributes *attributes)
+{
+  XImage *image;
+  size_t size;
+  if (!is_x11_shm_checked)
+  {
+    is_x11_shm_checked = 1;
+    is_x11_shm_available = XShmQueryExtension(x11_display);
+  }
+  if (!is_x11_shm_available)
+    return NULL;
+  image = XShmCreateImage(x11_display, attributes->visual, (unsigned int)attributes->depth, ZPixmap, NULL, &x11_shm_segment, (unsigned int)attributes->width, (unsigned int)attributes->height);
+  if (image == NULL)
+    return NULL;
+  size = (size_t)image->bytes_per_line * (size_t)image->height;
+  if (size > x11_shm_size)
+  {
+    if (x11_shm_size > 0)
+    {
+      XShmDetach(x11_display, &x11_shm_segment);
+      shmdt(x11_shm_segment.shmaddr);
+      x11_shm_size = 0;
+    }
+    x11_shm_segment.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+    x11_shm_segment.shmaddr = x11_shm_segment.shmid >= 0 ? (char *)shmat(x11_shm_segment.shmid, NULL, 0) : (char *)-1;
+    if (x11_shm_segment.shmaddr == (char *)-1)
+    {
+      if (x11_shm_segment.shmid >= 0)
+        shmctl(x11_shm_segment.shmid, IPC_RMID, NULL);
+      XDestroyImage(image);
+      return NULL;
+    }
+    x11_shm_segment.readOnly = False;
+    XShmAttach(x11_display, &x11_shm_segment);
+    XSync(x11_display, False);
+    // The segment is removed once both processes have detached it, even when this process does not stop normally
+    shmctl(x11_shm_segment.shmid, IPC_RMID, NULL);
+    x11_shm_size = size;
+  }
+  image->data = x11_shm_segment.shmaddr;
+  // The request fails when the segment could not be attached by the server, which is then not asked again
+  if (!XShmGetImage(x11_display, w, image, 0, 0, AllPlanes))
+  {
+    image->data = NULL;
+    XDestroyImage(image);
+    is_x11_shm_available = 0;
+    return NULL;
+  }
+  return image;
+}
+#endif
+
+// The client area of the window is captured, without the frame of the window manager, and the parts of the window covered
+// by other windows are only read correctly with a compositing manager
+uint8_t *backendCaptureWindow(HWND h, int *width, int *height, size_t *stride)
+{
+  XWindowAttributes attributes;
+  XImage *image = NULL;
+  Window w = x11GetWindow(h);
+  addCounter(&backend_call_count, 1);
+  if (x11_capture_image != NULL)
+  {
+    // The data of an image of the shared segment belongs to the segment
+#if defined(WINDOW_STATE_X11_XSHM)
+    if (x11_capture_image->obdata != NULL)
+      x11_capture_image->data = NULL;
+#endif
+    XDestroyImage(x11_capture_image);
+    x11_capture_image = NULL;
+  }
+  if (h == NULL || x11Open() == NULL || !XGetWindowAttributes(x11_display, w, &attributes) || attributes.map_state != IsViewable)
+    return NULL;
+#if defined(WINDOW_STATE_X11_XSHM)
+  image = x11CaptureShared(w, &attributes);
+#endif
+  if (image == NULL)
+    image = XGetImage(x11_display, w, 0, 0, (unsigned int)attributes.width, (unsigned int)attributes.height, AllPlanes, ZPixmap);
+  if (image == NULL)
+    return NULL;
+  x11_capture_image = image;
+  // Pixels of 32 bits with the red, green and blue masks of 0xFF0000, 0xFF00 and 0xFF are BGRA in memory
+  if (image->bits_per_pixel != 32 || image->byte_order != LSBFirst || image->red_mask != 0xFF0000 || image->green_mask != 0xFF00 || image->blue_mask != 0xFF)
+    return NULL;
+  *width = image->width;
+  *height = image->height;
+  *stride = (size_t)image->bytes_per_line;
+  return (uint8_t *)image->data;
+}
+
+// Waits for X events about the windows of the scope: property and geometry changes of a client window report that window,
+// any other event (clients added or removed, frames moved, the active window changed) asks for a rescan
+int backendWaitForWindowEvents(HWND scope, HWND *handles, int handle_size, int timeout, int *is_rescan)
+{
+  struct timeval wait;
+  fd_set descriptors;
+  XEvent event;
+  Window w;
+  int count = 0;
+  int i;
+  addCounter(&backend_call_count, 1);
+  if (x11Open() == NULL)
+    return -1;
+  if (!is_x11_watching)
+  {
+    is_x11_watching = 1;
+    XSelectInput(x11_display, scope != NULL ? x11GetWindow(scope) : x11_root, PropertyChangeMask | SubstructureNotifyMask);
+  }
+  // Clients that appeared since the last wait are watched for title and geometry changes
+  if (scope == NULL)
+  {
+    x11LoadClients();
+    for (i = 0; i < x11_client_count; i++)
+      XSelectInput(x11_display, x11_clients[i], PropertyChangeMask | StructureNotifyMask);
+  }
+  XFlush(x11_display);
+  if (XPending(x11_display) == 0)
+  {
+    FD_ZERO(&descriptors);
+    FD_SET(ConnectionNumber(x11_display), &descriptors);
+    wait.tv_sec = timeout / 1000;
+    wait.tv_usec = (timeout % 1000) * 1000;
+    if (select(ConnectionNumber(x11_display) + 1, &descriptors, NULL, NULL, &wait) <= 0)
+      return 0;
+  }
+  while (XPending(x11_display) > 0)
+  {
+    XNextEvent(x11_display, &event);
+    w = event.xany.window;
+    if ((event.type == PropertyNotify || event.type == ConfigureNotify) && w != x11_root && x11FindClient(w) >= 0)
+    {
+      if (count < handle_size)
+        handles[count++] = x11GetHandle(w);
+      else
+        *is_rescan = 1;
+    }
+    else
+    {
+      *is_rescan = 1;
+    }
+  }
+  return count;
+}
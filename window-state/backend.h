@@ -0,0 +1,120 @@
+// Window backend: the window system calls made by window-state, implemented once per window system.
+//
+// Every backend implements the functions declared below with the semantics of the user32 calls they are named after, so the
+// rest of the program, and its output, is the same for every backend. Windows are identified by HWND values and window
+// styles are reported with the WS_ bits of Win32. The backend is selected when compiling:
+//   backend-win32.h   user32 and psapi, the default on Windows
+//   backend-x11.h     Xlib with the EWMH properties of the window manager, with WINDOW_STATE_X11_BACKEND
+//   backend-memory.h  A deterministic synthetic desktop, with WINDOW_STATE_MEMORY_BACKEND and the default elsewhere
+//
+// Each backend defines WINDOW_STATE_BACKEND_NAME and counts its calls in backend_call_count and the processes it opens to
+// resolve executables in backend_process_open_count, with addCounter since the parallel modes call the backend from several
+// threads. WINDOW_STATE_BACKEND_CONCURRENT_LISTING is 1 when windows can be listed while other threads read windows, which
+// lets serve mode run a request while workers abandoned by a --timeout are still reading.
+
+#if !defined(_WIN32)
+// Win32 types and constants of the interface, for the backends built on other systems
+typedef void *HWND;
+typedef void *HANDLE;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef unsigned int UINT;
+typedef char TCHAR;
+typedef void *HDWP;
+typedef struct tagRECT
+{
+  LONG left;
+  LONG top;
+  LONG right;
+  LONG bottom;
+} RECT;
+
+#define MAX_PATH 260
+
+#define GW_HWNDNEXT 2
+#define GW_CHILD 5
+#define GWL_STYLE (-16)
+#define GWL_EXSTYLE (-20)
+
+#define WS_POPUP 0x80000000L
+#define WS_CHILD 0x40000000L
+#define WS_MINIMIZE 0x20000000L
+#define WS_VISIBLE 0x10000000L
+#define WS_CLIPSIBLINGS 0x04000000L
+#define WS_MAXIMIZE 0x01000000L
+#define WS_BORDER 0x00800000L
+#define WS_VSCROLL 0x00200000L
+#define WS_HSCROLL 0x00100000L
+#define WS_THICKFRAME 0x00040000L
+#define WS_OVERLAPPEDWINDOW 0x00CF0000L
+#define WS_EX_TOPMOST 0x00000008L
+#define WS_EX_TRANSPARENT 0x00000020L
+#define WS_EX_TOOLWINDOW 0x00000080L
+
+#define SW_HIDE 0
+#define SW_SHOWNORMAL 1
+#define SW_SHOWNOACTIVATE 4
+#define SW_MAXIMIZE 3
+#define SW_SHOW 5
+#define SW_MINIMIZE 6
+#define SW_RESTORE 9
+
+#define SWP_NOSIZE 0x0001
+#define SWP_NOMOVE 0x0002
+#define SWP_NOZORDER 0x0004
+#define SWP_NOACTIVATE 0x0010
+#define SWP_SHOWWINDOW 0x0040
+#define SWP_HIDEWINDOW 0x0080
+
+#define HWND_TOP ((HWND)0)
+#define HWND_BOTTOM ((HWND)1)
+#define HWND_TOPMOST ((HWND)-1)
+#define HWND_NOTOPMOST ((HWND)-2)
+#endif
+
+int backendIsWindow(HWND h);
+HWND backendGetForegroundWindow();
+// Returns the top of the z-order of the children of a window, or of the top-level windows when the parent is NULL
+HWND backendGetFirstChild(HWND parent);
+// Returns the next window in z-order (GW_HWNDNEXT) or the first child (GW_CHILD)
+HWND backendGetWindow(HWND h, UINT cmd);
+HWND backendGetParent(HWND h);
+// Strings are written as UTF-8 with a null character and their length is returned
+size_t backendGetWindowText(HWND h, char *text, size_t text_size);
+size_t backendGetWindowModuleFileName(HWND h, char *module, size_t module_size);
+size_t backendGetClassName(HWND h, char *class, size_t class_size);
+DWORD backendGetWindowThreadProcessId(HWND h, DWORD *pid);
+size_t backendGetProcessExecutable(DWORD pid, char *exec, size_t exec_size);
+// Returns the WS_ bits of GWL_STYLE or GWL_EXSTYLE
+LONG backendGetWindowLong(HWND h, int index);
+int backendIsWindowUnicode(HWND h);
+int backendIsWindowVisible(HWND h);
+int backendGetWindowRect(HWND h, RECT *rect);
+int backendSetForegroundWindow(HWND h);
+int backendShowWindow(HWND h, int show_arg);
+int backendSetWindowPos(HWND h, HWND insert_after, int x, int y, int w, int h_size, UINT flags);
+HDWP backendBeginDeferWindowPos(int count);
+HDWP backendDeferWindowPos(HDWP batch, HWND h, HWND insert_after, int x, int y, int w, int h_size, UINT flags);
+int backendEndDeferWindowPos(HDWP batch);
+int backendGetWorkArea(RECT *rect);
+HWND backendFindWindowByClass(HWND parent, HWND after, const char *class);
+int backendListProcessThreads(DWORD pid, DWORD *threads, int thread_size);
+// Lists the top-level windows of a thread in z-order
+int backendListThreadWindows(DWORD thread, HWND *windows, int window_size);
+// Reads the pixels of a window as rows of 32-bit BGRA pixels from the top, the alpha bytes are undefined. The pixels are
+// owned by the backend, may be changed by the caller and stay valid until the next capture, NULL is returned when the
+// window cannot be captured
+uint8_t *backendCaptureWindow(HWND h, int *width, int *height, size_t *stride);
+// Waits for window changes of a scope and returns the changed windows, sets is_rescan when the whole scope must be compared
+// instead, and returns -1 when no more changes will come
+int backendWaitForWindowEvents(HWND scope, HWND *handles, int handle_size, int timeout, int *is_rescan);
+
+#if defined(WINDOW_STATE_MEMORY_BACKEND)
+#include "backend-memory.h"
+#elif defined(WINDOW_STATE_X11_BACKEND)
+#include "backend-x11.h"
+#elif defined(_WIN32)
+#include "backend-win32.h"
+#else
+#include "backend-memory.h"
+#endif
@@ -0,0 +1,420 @@
+// Benchmark: measures the cost per window of listing the desktop on generated desktops of several shapes.
+//
+// Each case generates a desktop of top-level windows with the in-memory backend, of a number of windows, a title length and
+// a number of processes owning them, and times the phases of a listing separately:
+//   enumerate  Walks the top-level windows in z-order into the selected window list
+//   fetch      Reads the attributes of each window, with executables resolved once per process as in a listing
+//   serialize  Writes the windows as a JSON list into a writer that discards its chunks
+//   index      Builds the spatial index of the --at and --intersects queries over the top-level windows
+//   query      Hit-tests as many points spread over the desktop as there are windows
+//   occlusion  Computes the visible area of every top-level window of --visible-area
+// Each phase is repeated until it has processed BENCHMARK_MIN_WINDOWS windows, and at least BENCHMARK_MIN_REPETITIONS
+// times, and its fastest repetition is kept. Other backends measure their own desktop as a single "desktop" case.
+//
+// A baseline file stores one "<case> <phase> <nanoseconds per window>" line per phase. --save-baseline writes the results
+// to it, and --baseline compares them with it and fails when a phase is slower than its baseline by more than --tolerance.
+
+#define BENCHMARK_MIN_WINDOWS 200000
+#define BENCHMARK_MIN_REPETITIONS 3
+#define BENCHMARK_BASELINE_LIMIT 256
+#define BENCHMARK_LINE_SIZE 256
+#define BENCHMARK_PHASE_COUNT 6
+
+typedef struct
+{
+  char name[SMALL_BUFFER_SIZE];
+  int window_count;
+  int title_length;
+  int process_count;
+} BenchmarkCase;
+
+typedef struct
+{
+  char name[SMALL_BUFFER_SIZE];
+  int phase;
+  double nanoseconds;
+} BenchmarkBaseline;
+
+// Record of a fetched window, its strings are stored one after the other in the string buffer from an offset
+typedef struct
+{
+  WindowRecord record;
+  size_t strings;
+} BenchmarkWindow;
+
+int is_option_benchmark = 0;
+int is_option_baseline = 0;
+char baseline_path[MIDDLE_BUFFER_SIZE];
+int is_option_save_baseline = 0;
+char save_baseline_path[MIDDLE_BUFFER_SIZE];
+int64_t benchmark_tolerance = 20;
+
+const char *benchmark_phase_names[BENCHMARK_PHASE_COUNT] = {"enumerate", "fetch", "serialize", "index", "query", "occlusion"};
+const int benchmark_sizes[] = {50, 500, 5000, 50000};
+const int benchmark_title_lengths[] = {0, 200};
+const char *benchmark_title_names[] = {"short", "long"};
+// Few processes share the executable cache between their windows, a process per window misses it for every window
+const int benchmark_process_counts[] = {4, 0};
+const char *benchmark_process_names[] = {"few", "many"};
+
+BenchmarkBaseline benchmark_baselines[BENCHMARK_BASELINE_LIMIT];
+int benchmark_baseline_count = 0;
+
+BenchmarkWindow *benchmark_windows = NULL;
+int benchmark_window_size = 0;
+char *benchmark_strings = NULL;
+size_t benchmark_string_length = 0;
+size_t benchmark_string_size = 0;
+int64_t benchmark_byte_count = 0;
+
+void freeBenchmark()
+{
+  free(benchmark_windows);
+  benchmark_windows = NULL;
+  benchmark_window_size = 0;
+  free(benchmark_strings);
+  benchmark_strings = NULL;
+  benchmark_string_length = 0;
+  benchmark_string_size = 0;
+  freeSelectedWindows();
+  freeSpatialIndex();
+  freeOcclusion();
+}
+
+// Counts the serialized bytes instead of writing them, so that the phase measures the serialization alone
+void discardBenchmarkOutput(const char *data, size_t length)
+{
+  benchmark_byte_count += (int64_t)length;
+}
+
+// Appends a string and its null character to the string buffer, returns zero when it cannot grow
+int appendBenchmarkString(const char *text, size_t length)
+{
+  size_t size;
+  char *grown;
+  if (benchmark_string_length + length + 1 > benchmark_string_size)
+  {
+    size = benchmark_string_size == 0 ? 64 * 1024 : benchmark_string_size;
+    while (size < benchmark_string_length + length + 1)
+      size *= 2;
+    grown = (char *)realloc(benchmark_strings, size);
+    if (grown == NULL)
+      return 0;
+    benchmark_strings = grown;
+    benchmark_string_size = size;
+  }
+  memcpy(&benchmark_strings[benchmark_string_length], text, length);
+  benchmark_strings[benchmark_string_length + length] = '\0';
+  benchmark_string_length += length + 1;
+  return 1;
+}
+
+int enumerateBenchmarkWindows()
+{
+  HWND h;
+  selected_count = 0;
+  for (h = backendGetFirstChild(NULL); h != NULL; h = backendGetWindow(h, GW_HWNDNEXT))
+  {
+    if (!appendSelectedWindow(h))
+      return 0;
+  }
+  return 1;
+}
+
+int fetchBenchmarkWindows()
+{
+  BenchmarkWindow *grown;
+  int i;
+  // The executables are resolved again by each repetition, as they are by each execution of the program
+  process_cache_generation++;
+  process_cache_count = 0;
+  if (selected_count > benchmark_window_size)
+  {
+    grown = (BenchmarkWindow *)realloc(benchmark_windows, (size_t)selected_count * sizeof(BenchmarkWindow));
+    if (grown == NULL)
+      return 0;
+    benchmark_windows = grown;
+    benchmark_window_size = selected_count;
+  }
+  benchmark_string_length = 0;
+  for (i = 0; i < selected_count; i++)
+  {
+    fetchWindowRecordStrings(selected_list[i], output_fields, &benchmark_windows[i].record, title, module, (char *)exec_file_path, class);
+    benchmark_windows[i].strings = benchmark_string_length;
+    if (!appendBenchmarkString(title, benchmark_windows[i].record.title_length) || !appendBenchmarkString(module, benchmark_windows[i].record.module_length) || !appendBenchmarkString((char *)exec_file_path, benchmark_windows[i].record.executable_length) || !appendBenchmarkString(class, benchmark_windows[i].record.classname_length))
+      return 0;
+  }
+  return 1;
+}
+
+void serializeBenchmarkWindows(JsonWriter *writer)
+{
+  WindowRecord *record;
+  char *strings;
+  int i;
+  benchmark_byte_count = 0;
+  putJsonChar(writer, '[');
+  for (i = 0; i < selected_count; i++)
+  {
+    record = &benchmark_windows[i].record;
+    strings = &benchmark_strings[benchmark_windows[i].strings];
+    if (i != 0)
+      putJsonBytes(writer, ", ", 2);
+    putJsonChar(writer, '{');
+    putWindowRecordKeys(writer, 1, output_fields, record, strings, &strings[record->title_length + 1], &strings[record->title_length + record->module_length + 2], &strings[record->title_length + record->module_length + record->executable_length + 3]);
+    putJsonChar(writer, '}');
+  }
+  putJsonChar(writer, ']');
+  flushJsonWriter(writer);
+}
+
+// Hit-tests a point per window, spread over the indexed area by steps that are prime with its size, returns the hit count
+int queryBenchmarkWindows()
+{
+  int64_t width = spatial_cell_width * spatial_columns;
+  int64_t height = spatial_cell_height * spatial_rows;
+  int count = 0;
+  int i;
+  for (i = 0; i < selected_count && width > 0 && height > 0; i++)
+  {
+    if (findSpatialWindow(spatial_left + (int64_t)i * 7919 % width, spatial_top + (int64_t)i * 104729 % height, 0) >= 0)
+      count++;
+  }
+  return count;
+}
+
+// Returns the baseline of a phase of a case in nanoseconds per window, or a negative number when it has none
+double findBenchmarkBaseline(const char *name, int phase)
+{
+  int i;
+  for (i = 0; i < benchmark_baseline_count; i++)
+  {
+    if (benchmark_baselines[i].phase == phase && strcmp(benchmark_baselines[i].name, name) == 0)
+      return benchmark_baselines[i].nanoseconds;
+  }
+  return -1;
+}
+
+int readBenchmarkBaseline(const char *path)
+{
+  char line[BENCHMARK_LINE_SIZE];
+  char name[SMALL_BUFFER_SIZE];
+  char phase[SMALL_BUFFER_SIZE];
+  double nanoseconds;
+  int line_number = 0;
+  int i;
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    writeOutput("Error: Could not open baseline file \"%s\"\n", path);
+    return 1;
+  }
+  benchmark_baseline_count = 0;
+  while (fgets(line, BENCHMARK_LINE_SIZE, file) != NULL)
+  {
+    line_number++;
+    if (line[0] == '#' || line[0] == '\r' || line[0] == '\n')
+      continue;
+    i = sscanf(line, "%63s %63s %lf", name, phase, &nanoseconds) == 3 ? findLayoutName(phase, benchmark_phase_names, BENCHMARK_PHASE_COUNT) : -1;
+    if (i < 0 || nanoseconds < 0 || benchmark_baseline_count >= BENCHMARK_BASELINE_LIMIT)
+    {
+      writeOutput("Error: Invalid baseline entry at line %d of \"%s\"\n", line_number, path);
+      fclose(file);
+      return 1;
+    }
+    memcpy(benchmark_baselines[benchmark_baseline_count].name, name, sizeof(name));
+    benchmark_baselines[benchmark_baseline_count].phase = i;
+    benchmark_baselines[benchmark_baseline_count].nanoseconds = nanoseconds;
+    benchmark_baseline_count++;
+  }
+  fclose(file);
+  return 0;
+}
+
+void putBenchmarkNumber(JsonWriter *writer, double value)
+{
+  char text[SMALL_BUFFER_SIZE];
+  int length = snprintf(text, sizeof(text), "%.2f", value);
+  putJsonBytes(writer, text, length > 0 ? (size_t)length : 0);
+}
+
+// Measures the phases of a case, writes its result and returns the number of phases that regressed, or -1 on failure
+int runBenchmarkCase(BenchmarkCase *test, JsonWriter *sink, double *results)
+{
+  int64_t best[BENCHMARK_PHASE_COUNT];
+  int64_t elapsed;
+  int64_t start;
+  int repetitions;
+  int regression_count = 0;
+  int is_first = 1;
+  double baseline;
+  int r;
+  int p;
+#if defined(WINDOW_STATE_SYNTHETIC_DESKTOP)
+  if (test->window_count > 0)
+    memoryGenerateDesktop(test->window_count, 0, 0, test->process_count > 0 ? test->process_count : test->window_count, test->title_length, 1);
+#endif
+  if (!enumerateBenchmarkWindows())
+    return -1;
+  repetitions = selected_count > 0 ? (BENCHMARK_MIN_WINDOWS + selected_count - 1) / selected_count : BENCHMARK_MIN_REPETITIONS;
+  if (repetitions < BENCHMARK_MIN_REPETITIONS)
+    repetitions = BENCHMARK_MIN_REPETITIONS;
+  for (p = 0; p < BENCHMARK_PHASE_COUNT; p++)
+    best[p] = INT64_MAX;
+  for (r = 0; r < repetitions; r++)
+  {
+    start = getClockNanoseconds();
+    if (!enumerateBenchmarkWindows())
+      return -1;
+    elapsed = getClockNanoseconds() - start;
+    best[0] = elapsed < best[0] ? elapsed : best[0];
+    start = getClockNanoseconds();
+    if (!fetchBenchmarkWindows())
+      return -1;
+    elapsed = getClockNanoseconds() - start;
+    best[1] = elapsed < best[1] ? elapsed : best[1];
+    start = getClockNanoseconds();
+    serializeBenchmarkWindows(sink);
+    elapsed = getClockNanoseconds() - start;
+    best[2] = elapsed < best[2] ? elapsed : best[2];
+    start = getClockNanoseconds();
+    if (!buildSpatialIndex(NULL))
+      return -1;
+    elapsed = getClockNanoseconds() - start;
+    best[3] = elapsed < best[3] ? elapsed : best[3];
+    start = getClockNanoseconds();
+    queryBenchmarkWindows();
+    elapsed = getClockNanoseconds() - start;
+    best[4] = elapsed < best[4] ? elapsed : best[4];
+    start = getClockNanoseconds();
+    if (!computeOcclusion())
+      return -1;
+    elapsed = getClockNanoseconds() - start;
+    best[5] = elapsed < best[5] ? elapsed : best[5];
+  }
+  putJsonText(&output_writer, "{\"case\": ");
+  putJsonString(&output_writer, test->name, strlen(test->name));
+  putJsonText(&output_writer, ", \"windows\": ");
+  putJsonInteger(&output_writer, selected_count);
+  putJsonText(&output_writer, ", \"title_length\": ");
+  putJsonInteger(&output_writer, test->title_length);
+  putJsonText(&output_writer, ", \"processes\": ");
+  putJsonInteger(&output_writer, test->process_count > 0 ? test->process_count : selected_count);
+  putJsonText(&output_writer, ", \"repetitions\": ");
+  putJsonInteger(&output_writer, repetitions);
+  putJsonText(&output_writer, ", \"bytes\": ");
+  putJsonInteger(&output_writer, benchmark_byte_count);
+  for (p = 0; p < BENCHMARK_PHASE_COUNT; p++)
+  {
+    results[p] = selected_count > 0 ? (double)best[p] / selected_count : (double)best[p];
+    putJsonKey(&output_writer, 0, benchmark_phase_names[p]);
+    putBenchmarkNumber(&output_writer, results[p]);
+  }
+  if (is_option_baseline)
+  {
+    putJsonText(&output_writer, ", \"regressions\": [");
+    for (p = 0; p < BENCHMARK_PHASE_COUNT; p++)
+    {
+      baseline = findBenchmarkBaseline(test->name, p);
+      if (baseline < 0 || results[p] * 100 <= baseline * (double)(100 + benchmark_tolerance))
+        continue;
+      if (!is_first)
+        putJsonBytes(&output_writer, ", ", 2);
+      putJsonString(&output_writer, benchmark_phase_names[p], strlen(benchmark_phase_names[p]));
+      is_first = 0;
+      regression_count++;
+    }
+    putJsonChar(&output_writer, ']');
+  }
+  putJsonChar(&output_writer, '}');
+  return regression_count;
+}
+
+// Runs every case, writes the results as a JSON list and compares them with the baseline, returns an exit code
+int runBenchmark()
+{
+  BenchmarkCase cases[BENCHMARK_BASELINE_LIMIT / BENCHMARK_PHASE_COUNT];
+  double results[BENCHMARK_BASELINE_LIMIT / BENCHMARK_PHASE_COUNT][BENCHMARK_PHASE_COUNT];
+  JsonWriter sink;
+  FILE *file;
+  int case_count = 0;
+  int regression_count = 0;
+  int count;
+  int t;
+  int p;
+#if defined(WINDOW_STATE_SYNTHETIC_DESKTOP)
+  int s;
+#endif
+  if (is_option_baseline && readBenchmarkBaseline(baseline_path) != 0)
+    return 1;
+#if defined(WINDOW_STATE_SYNTHETIC_DESKTOP)
+  for (s = 0; s < (int)(sizeof(benchmark_sizes) / sizeof(benchmark_sizes[0])); s++)
+  {
+    for (t = 0; t < 2; t++)
+    {
+      for (p = 0; p < 2; p++)
+      {
+        snprintf(cases[case_count].name, SMALL_BUFFER_SIZE, "%d-%s-%s", benchmark_sizes[s], benchmark_title_names[t], benchmark_process_names[p]);
+        cases[case_count].window_count = benchmark_sizes[s];
+        cases[case_count].title_length = benchmark_title_lengths[t];
+        cases[case_count].process_count = benchmark_process_counts[p];
+        case_count++;
+      }
+    }
+  }
+#else
+  snprintf(cases[0].name, SMALL_BUFFER_SIZE, "desktop");
+  cases[0].window_count = 0;
+  cases[0].title_length = 0;
+  cases[0].process_count = 0;
+  case_count = 1;
+#endif
+  initJsonWriter(&sink, NULL, 0, discardBenchmarkOutput);
+  putJsonChar(&output_writer, '[');
+  for (t = 0; t < case_count; t++)
+  {
+    if (t != 0)
+      putJsonBytes(&output_writer, ", ", 2);
+    count = runBenchmarkCase(&cases[t], &sink, results[t]);
+    if (count < 0)
+    {
+      putJsonChar(&output_writer, ']');
+      writeOutput("\nError: Could not allocate the benchmark windows\n");
+      freeJsonWriter(&sink);
+      freeBenchmark();
+      return 1;
+    }
+    regression_count += count;
+    // Each case takes a while, its result is written as soon as it is measured
+    if (!is_output_captured)
+    {
+      flushJsonWriter(&output_writer);
+      fflush(stdout);
+    }
+  }
+  putJsonChar(&output_writer, ']');
+  freeJsonWriter(&sink);
+  freeBenchmark();
+  if (is_option_save_baseline)
+  {
+    file = fopen(save_baseline_path, "wb");
+    if (file == NULL)
+    {
+      writeOutput("\nError: Could not write baseline file \"%s\"\n", save_baseline_path);
+      return 1;
+    }
+    fprintf(file, "# <case> <phase> <nanoseconds per window>\n");
+    for (t = 0; t < case_count; t++)
+    {
+      for (p = 0; p < BENCHMARK_PHASE_COUNT; p++)
+        fprintf(file, "%s %s %.2f\n", cases[t].name, benchmark_phase_names[p], results[t][p]);
+    }
+    fclose(file);
+  }
+  if (regression_count > 0)
+  {
+    writeOutput("\nError: %d benchmark phases are slower than the baseline by more than %" PRId64 "%%\n", regression_count, benchmark_tolerance);
+    return 3;
+  }
+  return 0;
+}
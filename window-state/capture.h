@@ -0,0 +1,683 @@
+// Capture: writes the pixels of the selected windows to PNG or raw BGRA files with --capture, in place of their records.
+//
+// The backend reads the pixels of a window into a buffer of 32-bit BGRA rows that the encoder reads in place. A raw file
+// is that buffer with its alpha set, written with a single call when its rows have no padding. A PNG file is encoded a row
+// at a time and written as it is encoded, so a capture of any size only needs a few rows of memory:
+//   swizzle  BGRA pixels are shuffled to opaque RGBA 16 or 32 bytes at a time with SSE2, SSSE3 or AVX2
+//   filter   The Sub and Up filters of the row are computed together with the sum of their absolute values, and the
+//            filter of the smaller sum is kept as it usually compresses better
+//   deflate  The filtered bytes are compressed into a single block of fixed Huffman codes, where runs of a repeated byte
+//            are matches at a distance of one byte, found a block at a time: the filtered rows of flat areas are runs
+//            of zeros, which is most of a window, and the other bytes are written as literals
+//   write    The compressed stream is written in IDAT chunks of CAPTURE_CHUNK_SIZE bytes as soon as they are full
+//
+// The path of --capture selects the format by its extension, .png, or .bgra and .raw for raw pixels, and "{handle}" in the
+// path is replaced by the handle of each window. Each window of the list is written as its capture instead of its record:
+//   {"handle": 65552, "path": "window-65552.png", "width": 1280, "height": 720, "bytes": 40312}
+// and windows that could not be captured or written are listed with an error.
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define CAPTURE_SSSE3 1
+#endif
+
+#define CAPTURE_FORMAT_PNG 1
+#define CAPTURE_FORMAT_RAW 2
+#define CAPTURE_CHUNK_SIZE 256 * 1024
+#define CAPTURE_PLACEHOLDER "{handle}"
+// Zero bytes before each row, read as the pixel on the left of the first pixel by the Sub filter
+#define CAPTURE_ROW_PADDING 32
+
+int is_option_capture = 0;
+int capture_format = CAPTURE_FORMAT_PNG;
+char capture_path[MIDDLE_BUFFER_SIZE];
+
+int64_t capture_window_count = 0;
+int64_t capture_failure_count = 0;
+int64_t capture_byte_count = 0;
+int64_t capture_pixel_count = 0;
+int64_t capture_grab_time = 0;
+int64_t capture_encode_time = 0;
+
+// Rows of the encoder, kept for the next captures: the current and previous RGBA rows after their padding, and the two
+// filtered rows with their filter type byte
+uint8_t *capture_rows = NULL;
+size_t capture_row_size = 0;
+// Compressed bytes not yet written in a chunk, with room for a compressed row after CAPTURE_CHUNK_SIZE bytes
+uint8_t *capture_chunk = NULL;
+size_t capture_chunk_size = 0;
+
+// Fixed Huffman codes of the literals and of the matches of each length at a distance of one, with their bits reversed
+// to be written from the lowest bit
+uint32_t capture_literal_codes[256];
+uint8_t capture_literal_lengths[256];
+uint32_t capture_match_codes[259];
+uint8_t capture_match_lengths[259];
+uint32_t capture_crc_table[8][256];
+int is_capture_table_built = 0;
+
+typedef struct
+{
+  FILE *file;
+  uint8_t *chunk;
+  size_t chunk_length;
+  uint64_t bits;
+  int bit_count;
+  uint32_t adler_a;
+  uint32_t adler_b;
+  int64_t bytes;
+  int is_failed;
+} CaptureEncoder;
+
+// Selects the format of the capture from the extension of its path, returns zero after writing an error
+int parseCapturePath(const char *path)
+{
+  size_t length = strlen(path);
+  size_t i;
+  for (i = 0; i + 1 < MIDDLE_BUFFER_SIZE && path[i] != '\0'; i++)
+    capture_path[i] = path[i];
+  capture_path[i] = '\0';
+  if (length >= 4 && isMatchingText(&path[length - 4], ".png"))
+    capture_format = CAPTURE_FORMAT_PNG;
+  else if ((length >= 5 && isMatchingText(&path[length - 5], ".bgra")) || (length >= 4 && isMatchingText(&path[length - 4], ".raw")))
+    capture_format = CAPTURE_FORMAT_RAW;
+  else
+  {
+    writeOutput("Error: Invalid capture file \"%s\" (expected a .png, .bgra or .raw file)\n", path);
+    return 0;
+  }
+  is_option_capture = 1;
+  return 1;
+}
+
+uint32_t reverseCaptureBits(uint32_t code, int length)
+{
+  uint32_t reversed = 0;
+  int i;
+  for (i = 0; i < length; i++)
+    reversed |= ((code >> i) & 1) << (length - 1 - i);
+  return reversed;
+}
+
+// Sets the fixed Huffman code of a symbol of the literal and length alphabet (RFC 1951, 3.2.6)
+void getCaptureSymbolCode(int symbol, uint32_t *code, uint8_t *length)
+{
+  if (symbol < 144)
+    *length = 8, *code = reverseCaptureBits(0x30 + (uint32_t)symbol, 8);
+  else if (symbol < 256)
+    *length = 9, *code = reverseCaptureBits(0x190 + (uint32_t)(symbol - 144), 9);
+  else if (symbol < 280)
+    *length = 7, *code = reverseCaptureBits((uint32_t)(symbol - 256), 7);
+  else
+    *length = 8, *code = reverseCaptureBits(0xC0 + (uint32_t)(symbol - 280), 8);
+}
+
+void buildCaptureTables()
+{
+  static const int bases[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+  static const int extras[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+  uint32_t code;
+  uint32_t crc;
+  uint8_t length;
+  int symbol;
+  int match;
+  int i;
+  if (is_capture_table_built)
+    return;
+  for (i = 0; i < 256; i++)
+    getCaptureSymbolCode(i, &capture_literal_codes[i], &capture_literal_lengths[i]);
+  // A match is the code of its length, the extra bits of the length and the 5 bits of the distance code 0, all zero
+  for (symbol = 0; symbol < 29; symbol++)
+  {
+    getCaptureSymbolCode(257 + symbol, &code, &length);
+    for (match = bases[symbol]; match < (symbol == 28 ? 259 : bases[symbol + 1]); match++)
+    {
+      capture_match_codes[match] = code | (uint32_t)(match - bases[symbol]) << length;
+      capture_match_lengths[match] = (uint8_t)(length + extras[symbol] + 5);
+    }
+  }
+  // CRC-32 tables to process 8 bytes at a time
+  for (i = 0; i < 256; i++)
+  {
+    crc = (uint32_t)i;
+    for (symbol = 0; symbol < 8; symbol++)
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    capture_crc_table[0][i] = crc;
+  }
+  for (i = 0; i < 256; i++)
+    for (symbol = 1; symbol < 8; symbol++)
+      capture_crc_table[symbol][i] = (capture_crc_table[symbol - 1][i] >> 8) ^ capture_crc_table[0][capture_crc_table[symbol - 1][i] & 0xFF];
+  is_capture_table_built = 1;
+}
+
+uint32_t updateCaptureCrc(uint32_t crc, const uint8_t *data, size_t length)
+{
+  uint32_t low;
+  uint32_t high;
+  crc = ~crc;
+  for (; length >= 8; data += 8, length -= 8)
+  {
+    low = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+    high = (uint32_t)data[4] | (uint32_t)data[5] << 8 | (uint32_t)data[6] << 16 | (uint32_t)data[7] << 24;
+    crc = capture_crc_table[7][low & 0xFF] ^ capture_crc_table[6][(low >> 8) & 0xFF] ^ capture_crc_table[5][(low >> 16) & 0xFF] ^ capture_crc_table[4][low >> 24] ^
+          capture_crc_table[3][high & 0xFF] ^ capture_crc_table[2][(high >> 8) & 0xFF] ^ capture_crc_table[1][(high >> 16) & 0xFF] ^ capture_crc_table[0][high >> 24];
+  }
+  for (; length > 0; data++, length--)
+    crc = (crc >> 8) ^ capture_crc_table[0][(crc ^ *data) & 0xFF];
+  return ~crc;
+}
+
+// Adler-32 of the uncompressed stream, the sums are reduced every 5552 bytes, before the second one can overflow. With SSE2
+// the first sum of 16 bytes is found by _mm_sad_epu8 and the second one, where each byte counts once for each byte from it
+// to the end of the block, by multiplying the bytes by 16 down to 1, the sums of the blocks before each one being added later
+void updateCaptureAdler(CaptureEncoder *encoder, const uint8_t *data, size_t length)
+{
+  uint32_t a = encoder->adler_a;
+  uint32_t b = encoder->adler_b;
+  size_t block;
+  size_t i;
+#if defined(JSON_WRITER_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i high_weights = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+  const __m128i low_weights = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+  __m128i bytes;
+  __m128i sums;
+  __m128i weighted;
+  __m128i previous;
+  uint32_t lanes[4];
+#endif
+  while (length > 0)
+  {
+    block = length < 5552 ? length : 5552;
+    i = 0;
+#if defined(JSON_WRITER_SSE2)
+    sums = zero;
+    weighted = zero;
+    previous = zero;
+    for (; i + 16 <= block; i += 16)
+    {
+      bytes = _mm_loadu_si128((const __m128i *)&data[i]);
+      previous = _mm_add_epi32(previous, sums);
+      sums = _mm_add_epi32(sums, _mm_sad_epu8(bytes, zero));
+      weighted = _mm_add_epi32(weighted, _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), high_weights), _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), low_weights)));
+    }
+    b += a * (uint32_t)i;
+    weighted = _mm_add_epi32(weighted, _mm_slli_epi32(previous, 4));
+    _mm_storeu_si128((__m128i *)lanes, weighted);
+    b += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_si128((__m128i *)lanes, sums);
+    a += lanes[0] + lanes[2];
+#endif
+    for (; i + 4 <= block; i += 4)
+    {
+      a += data[i];
+      b += a;
+      a += data[i + 1];
+      b += a;
+      a += data[i + 2];
+      b += a;
+      a += data[i + 3];
+      b += a;
+    }
+    for (; i < block; i++)
+    {
+      a += data[i];
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+    data += block;
+    length -= block;
+  }
+  encoder->adler_a = a;
+  encoder->adler_b = b;
+}
+
+void writeCaptureBytes(CaptureEncoder *encoder, const void *data, size_t length)
+{
+  if (encoder->is_failed || fwrite(data, 1, length, encoder->file) != length)
+    encoder->is_failed = 1;
+  encoder->bytes += (int64_t)length;
+}
+
+void writeCaptureChunk(CaptureEncoder *encoder, const char *type, const uint8_t *data, size_t length)
+{
+  uint8_t header[8];
+  uint8_t trailer[4];
+  uint32_t crc;
+  header[0] = (uint8_t)(length >> 24);
+  header[1] = (uint8_t)(length >> 16);
+  header[2] = (uint8_t)(length >> 8);
+  header[3] = (uint8_t)length;
+  memcpy(&header[4], type, 4);
+  crc = updateCaptureCrc(updateCaptureCrc(0, &header[4], 4), data, length);
+  trailer[0] = (uint8_t)(crc >> 24);
+  trailer[1] = (uint8_t)(crc >> 16);
+  trailer[2] = (uint8_t)(crc >> 8);
+  trailer[3] = (uint8_t)crc;
+  writeCaptureBytes(encoder, header, 8);
+  writeCaptureBytes(encoder, data, length);
+  writeCaptureBytes(encoder, trailer, 4);
+}
+
+// Appends bits to the compressed stream, at most 32 at a time, whole 32-bit words are moved to the chunk
+void putCaptureBits(CaptureEncoder *encoder, uint32_t bits, int count)
+{
+  encoder->bits |= (uint64_t)bits << encoder->bit_count;
+  encoder->bit_count += count;
+  if (encoder->bit_count >= 32)
+  {
+    encoder->chunk[encoder->chunk_length] = (uint8_t)encoder->bits;
+    encoder->chunk[encoder->chunk_length + 1] = (uint8_t)(encoder->bits >> 8);
+    encoder->chunk[encoder->chunk_length + 2] = (uint8_t)(encoder->bits >> 16);
+    encoder->chunk[encoder->chunk_length + 3] = (uint8_t)(encoder->bits >> 24);
+    encoder->chunk_length += 4;
+    encoder->bits >>= 32;
+    encoder->bit_count -= 32;
+  }
+}
+
+// Returns the number of bytes from a position equal to the byte before it, up to the longest match of 258 bytes
+size_t findCaptureRun(const uint8_t *data, size_t position, size_t length)
+{
+  size_t end = length - position < 258 ? length : position + 258;
+  size_t i = position;
+  uint8_t value = data[position - 1];
+  unsigned int mask;
+#if defined(JSON_WRITER_SSE2)
+  const __m128i repeated = _mm_set1_epi8((char)value);
+  for (; i + 16 <= end; i += 16)
+  {
+    mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&data[i]), repeated)) ^ 0xFFFF;
+    if (mask != 0)
+      return i + findJsonMaskBit(mask) - position;
+  }
+#endif
+  for (; i < end && data[i] == value; i++)
+    ;
+  (void)mask;
+  return i - position;
+}
+
+// Compresses a filtered row, whose first byte is its filter type, into the block of fixed Huffman codes
+void deflateCaptureRow(CaptureEncoder *encoder, const uint8_t *data, size_t length)
+{
+  size_t i = 1;
+  size_t run;
+  putCaptureBits(encoder, capture_literal_codes[data[0]], capture_literal_lengths[data[0]]);
+  while (i < length)
+  {
+    if (data[i] == data[i - 1] && i + 2 < length && data[i + 1] == data[i - 1] && data[i + 2] == data[i - 1])
+    {
+      run = findCaptureRun(data, i, length);
+      putCaptureBits(encoder, capture_match_codes[run], capture_match_lengths[run]);
+      i += run;
+    }
+    else
+    {
+      putCaptureBits(encoder, capture_literal_codes[data[i]], capture_literal_lengths[data[i]]);
+      i++;
+    }
+  }
+}
+
+// Copies a row of BGRA pixels as opaque RGBA pixels
+void swizzleCaptureRow(const uint8_t *source, uint8_t *target, int width)
+{
+  size_t length = (size_t)width * 4;
+  size_t i = 0;
+  uint32_t pixel;
+#if defined(JSON_WRITER_AVX2)
+  const __m256i order32 = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15, 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+  const __m256i alpha32 = _mm256_set1_epi32((int)0xFF000000);
+  for (; i + 32 <= length; i += 32)
+    _mm256_storeu_si256((__m256i *)&target[i], _mm256_or_si256(_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)&source[i]), order32), alpha32));
+#endif
+#if defined(CAPTURE_SSSE3)
+  const __m128i order = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+  const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+  for (; i + 16 <= length; i += 16)
+    _mm_storeu_si128((__m128i *)&target[i], _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&source[i]), order), alpha));
+#elif defined(JSON_WRITER_SSE2)
+  // Without a byte shuffle the red and blue bytes are exchanged with shifts of the 32-bit pixels
+  const __m128i green = _mm_set1_epi32(0x0000FF00);
+  const __m128i low = _mm_set1_epi32(0x000000FF);
+  const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+  __m128i block;
+  for (; i + 16 <= length; i += 16)
+  {
+    block = _mm_loadu_si128((const __m128i *)&source[i]);
+    block = _mm_or_si128(_mm_or_si128(_mm_and_si128(block, green), alpha),
+                         _mm_or_si128(_mm_and_si128(_mm_srli_epi32(block, 16), low), _mm_slli_epi32(_mm_and_si128(block, low), 16)));
+    _mm_storeu_si128((__m128i *)&target[i], block);
+  }
+#endif
+  for (; i < length; i += 4)
+  {
+    memcpy(&pixel, &source[i], 4);
+    pixel = (pixel & 0x0000FF00) | (pixel >> 16 & 0xFF) | (pixel & 0xFF) << 16 | 0xFF000000;
+    memcpy(&target[i], &pixel, 4);
+  }
+}
+
+// Writes the Sub and Up filters of an RGBA row after their type byte, returns the sum of the absolute values of the Sub
+// filter and sets the one of the Up filter, the bytes being read as signed
+uint64_t filterCaptureRow(const uint8_t *row, const uint8_t *previous, size_t length, uint8_t *sub, uint8_t *up, uint64_t *up_sum)
+{
+  uint64_t sub_total = 0;
+  uint64_t up_total = 0;
+  size_t i = 0;
+  uint8_t value;
+  sub[0] = 1;
+  up[0] = 2;
+  sub++;
+  up++;
+#if defined(JSON_WRITER_AVX2)
+  const __m256i zero32 = _mm256_setzero_si256();
+  __m256i sub_sums32 = zero32;
+  __m256i up_sums32 = zero32;
+  __m256i current32;
+  __m256i filtered32;
+  for (; i + 32 <= length; i += 32)
+  {
+    current32 = _mm256_loadu_si256((const __m256i *)&row[i]);
+    // The row is preceded by zero bytes, so the pixel on the left of the first pixel is read as zero
+    filtered32 = _mm256_sub_epi8(current32, _mm256_loadu_si256((const __m256i *)&row[i - 4]));
+    _mm256_storeu_si256((__m256i *)&sub[i], filtered32);
+    sub_sums32 = _mm256_add_epi64(sub_sums32, _mm256_sad_epu8(_mm256_min_epu8(filtered32, _mm256_sub_epi8(zero32, filtered32)), zero32));
+    filtered32 = _mm256_sub_epi8(current32, _mm256_loadu_si256((const __m256i *)&previous[i]));
+    _mm256_storeu_si256((__m256i *)&up[i], filtered32);
+    up_sums32 = _mm256_add_epi64(up_sums32, _mm256_sad_epu8(_mm256_min_epu8(filtered32, _mm256_sub_epi8(zero32, filtered32)), zero32));
+  }
+  sub_total += (uint64_t)_mm256_extract_epi64(sub_sums32, 0) + (uint64_t)_mm256_extract_epi64(sub_sums32, 1) + (uint64_t)_mm256_extract_epi64(sub_sums32, 2) + (uint64_t)_mm256_extract_epi64(sub_sums32, 3);
+  up_total += (uint64_t)_mm256_extract_epi64(up_sums32, 0) + (uint64_t)_mm256_extract_epi64(up_sums32, 1) + (uint64_t)_mm256_extract_epi64(up_sums32, 2) + (uint64_t)_mm256_extract_epi64(up_sums32, 3);
+#endif
+#if defined(JSON_WRITER_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sub_sums = zero;
+  __m128i up_sums = zero;
+  __m128i current;
+  __m128i filtered;
+  for (; i + 16 <= length; i += 16)
+  {
+    current = _mm_loadu_si128((const __m128i *)&row[i]);
+    filtered = _mm_sub_epi8(current, _mm_loadu_si128((const __m128i *)&row[i - 4]));
+    _mm_storeu_si128((__m128i *)&sub[i], filtered);
+    // The absolute value of a signed byte is the unsigned minimum of the byte and its negation
+    sub_sums = _mm_add_epi64(sub_sums, _mm_sad_epu8(_mm_min_epu8(filtered, _mm_sub_epi8(zero, filtered)), zero));
+    filtered = _mm_sub_epi8(current, _mm_loadu_si128((const __m128i *)&previous[i]));
+    _mm_storeu_si128((__m128i *)&up[i], filtered);
+    up_sums = _mm_add_epi64(up_sums, _mm_sad_epu8(_mm_min_epu8(filtered, _mm_sub_epi8(zero, filtered)), zero));
+  }
+  sub_total += (uint32_t)_mm_cvtsi128_si32(sub_sums) + (uint64_t)(uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(sub_sums, 8));
+  up_total += (uint32_t)_mm_cvtsi128_si32(up_sums) + (uint64_t)(uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(up_sums, 8));
+#endif
+  for (; i < length; i++)
+  {
+    value = (uint8_t)(row[i] - row[i - 4]);
+    sub[i] = value;
+    sub_total += value < 128 ? value : 256 - value;
+    value = (uint8_t)(row[i] - previous[i]);
+    up[i] = value;
+    up_total += value < 128 ? value : 256 - value;
+  }
+  *up_sum = up_total;
+  return sub_total;
+}
+
+// Grows the rows and the chunk of the encoder for rows of a width, returns zero when they cannot be allocated
+int growCaptureBuffers(int width)
+{
+  size_t row_size = (size_t)width * 4 + CAPTURE_ROW_PADDING;
+  // A compressed row takes at most 9 bits per byte and a word of pending bits
+  size_t chunk_size = CAPTURE_CHUNK_SIZE + row_size * 9 / 8 + 16;
+  uint8_t *grown;
+  if (row_size > capture_row_size)
+  {
+    grown = (uint8_t *)realloc(capture_rows, row_size * 4);
+    if (grown == NULL)
+      return 0;
+    capture_rows = grown;
+    capture_row_size = row_size;
+  }
+  if (chunk_size > capture_chunk_size)
+  {
+    grown = (uint8_t *)realloc(capture_chunk, chunk_size);
+    if (grown == NULL)
+      return 0;
+    capture_chunk = grown;
+    capture_chunk_size = chunk_size;
+  }
+  return 1;
+}
+
+// Encodes the pixels of a capture as an 8-bit RGBA PNG file, returns zero when it could not be written
+int writeCapturePng(FILE *file, const uint8_t *pixels, int width, int height, size_t stride, int64_t *bytes)
+{
+  static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  CaptureEncoder encoder;
+  uint8_t header[13];
+  uint8_t *current;
+  uint8_t *previous;
+  uint8_t *swapped;
+  uint8_t *sub;
+  uint8_t *up;
+  uint64_t sub_sum;
+  uint64_t up_sum;
+  size_t length = (size_t)width * 4;
+  int y;
+  buildCaptureTables();
+  if (!growCaptureBuffers(width))
+    return 0;
+  memset(&encoder, 0, sizeof(encoder));
+  encoder.file = file;
+  encoder.chunk = capture_chunk;
+  encoder.adler_a = 1;
+  // The rows of pixels are preceded by their padding of zeros, the row above the first one is all zeros
+  memset(capture_rows, 0, capture_row_size * 2);
+  current = capture_rows + CAPTURE_ROW_PADDING;
+  previous = capture_rows + capture_row_size + CAPTURE_ROW_PADDING;
+  sub = capture_rows + capture_row_size * 2;
+  up = capture_rows + capture_row_size * 3;
+  writeCaptureBytes(&encoder, signature, 8);
+  header[0] = (uint8_t)(width >> 24);
+  header[1] = (uint8_t)(width >> 16);
+  header[2] = (uint8_t)(width >> 8);
+  header[3] = (uint8_t)width;
+  header[4] = (uint8_t)(height >> 24);
+  header[5] = (uint8_t)(height >> 16);
+  header[6] = (uint8_t)(height >> 8);
+  header[7] = (uint8_t)height;
+  // 8 bits per channel, RGBA, deflate, adaptive filters, not interlaced
+  header[8] = 8;
+  header[9] = 6;
+  header[10] = 0;
+  header[11] = 0;
+  header[12] = 0;
+  writeCaptureChunk(&encoder, "IHDR", header, 13);
+  // The zlib header of a 32 KB window without a dictionary, then the final block of fixed Huffman codes
+  encoder.chunk[0] = 0x78;
+  encoder.chunk[1] = 0x01;
+  encoder.chunk_length = 2;
+  putCaptureBits(&encoder, 3, 3);
+  for (y = 0; y < height && !encoder.is_failed; y++)
+  {
+    swizzleCaptureRow(pixels + (size_t)y * stride, current, width);
+    sub_sum = filterCaptureRow(current, previous, length, sub, up, &up_sum);
+    updateCaptureAdler(&encoder, sub_sum <= up_sum ? sub : up, length + 1);
+    deflateCaptureRow(&encoder, sub_sum <= up_sum ? sub : up, length + 1);
+    if (encoder.chunk_length >= CAPTURE_CHUNK_SIZE)
+    {
+      writeCaptureChunk(&encoder, "IDAT", encoder.chunk, encoder.chunk_length);
+      encoder.chunk_length = 0;
+    }
+    swapped = current;
+    current = previous;
+    previous = swapped;
+  }
+  // The end of the block, the symbol 256 of 7 zero bits, then the pending bits up to a whole byte and the Adler-32 of the stream
+  putCaptureBits(&encoder, 0, 7);
+  while (encoder.bit_count > 0)
+  {
+    encoder.chunk[encoder.chunk_length++] = (uint8_t)encoder.bits;
+    encoder.bits >>= 8;
+    encoder.bit_count = encoder.bit_count > 8 ? encoder.bit_count - 8 : 0;
+  }
+  encoder.chunk[encoder.chunk_length++] = (uint8_t)(encoder.adler_b >> 8);
+  encoder.chunk[encoder.chunk_length++] = (uint8_t)encoder.adler_b;
+  encoder.chunk[encoder.chunk_length++] = (uint8_t)(encoder.adler_a >> 8);
+  encoder.chunk[encoder.chunk_length++] = (uint8_t)encoder.adler_a;
+  writeCaptureChunk(&encoder, "IDAT", encoder.chunk, encoder.chunk_length);
+  writeCaptureChunk(&encoder, "IEND", NULL, 0);
+  *bytes = encoder.bytes;
+  return !encoder.is_failed;
+}
+
+// Writes the pixels of a capture as raw BGRA rows without padding after setting their alpha in place, returns zero when
+// they could not be written
+int writeCaptureRaw(FILE *file, uint8_t *pixels, int width, int height, size_t stride, int64_t *bytes)
+{
+  size_t length = (size_t)width * 4;
+  size_t i;
+  uint8_t *row;
+  int y;
+#if defined(JSON_WRITER_SSE2)
+  const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+#endif
+  for (y = 0; y < height; y++)
+  {
+    row = pixels + (size_t)y * stride;
+    i = 0;
+#if defined(JSON_WRITER_SSE2)
+    for (; i + 16 <= length; i += 16)
+      _mm_storeu_si128((__m128i *)&row[i], _mm_or_si128(_mm_loadu_si128((const __m128i *)&row[i]), alpha));
+#endif
+    for (; i < length; i += 4)
+      row[i + 3] = 0xFF;
+  }
+  *bytes = (int64_t)length * height;
+  if (stride == length)
+    return fwrite(pixels, 1, length * (size_t)height, file) == length * (size_t)height;
+  for (y = 0; y < height; y++)
+    if (fwrite(pixels + (size_t)y * stride, 1, length, file) != length)
+      return 0;
+  return 1;
+}
+
+// Writes the path of the capture of a window, with its handle in place of the placeholder, returns zero when there is no
+// placeholder for a window after the first one, which would replace the capture of the first one
+int getCaptureWindowPath(HWND h, int count, char *path, size_t path_size)
+{
+  const char *placeholder = strstr(capture_path, CAPTURE_PLACEHOLDER);
+  if (placeholder == NULL)
+  {
+    snprintf(path, path_size, "%s", capture_path);
+    return count == 0;
+  }
+  snprintf(path, path_size, "%.*s%" PRId64 "%s", (int)(placeholder - capture_path), capture_path, (int64_t)(intptr_t)h, placeholder + sizeof(CAPTURE_PLACEHOLDER) - 1);
+  return 1;
+}
+
+void putCaptureError(JsonWriter *writer, HWND h, const char *path, const char *error)
+{
+  putJsonChar(writer, '{');
+  putJsonKey(writer, 1, "handle");
+  putJsonInteger(writer, (int64_t)(intptr_t)h);
+  if (path != NULL)
+  {
+    putJsonKey(writer, 0, "path");
+    putJsonString(writer, path, strlen(path));
+  }
+  putJsonKey(writer, 0, "error");
+  putJsonString(writer, error, strlen(error));
+  putJsonChar(writer, '}');
+  capture_failure_count++;
+}
+
+// Captures a window of the list into its file and writes it as an item of the list, failures are listed with an error
+void putCaptureItem(JsonWriter *writer, HWND h, int count)
+{
+  char path[MIDDLE_BUFFER_SIZE + 32];
+  uint8_t *pixels;
+  FILE *file;
+  size_t stride = 0;
+  int64_t bytes = 0;
+  int64_t start;
+  int width = 0;
+  int height = 0;
+  int is_written;
+  if (!getCaptureWindowPath(h, count, path, sizeof(path)))
+  {
+    putCaptureError(writer, h, NULL, "Several windows are selected and the capture file has no {handle} placeholder");
+    return;
+  }
+  start = getClockNanoseconds();
+  pixels = backendCaptureWindow(h, &width, &height, &stride);
+  capture_grab_time += getClockNanoseconds() - start;
+  if (pixels == NULL)
+  {
+    putCaptureError(writer, h, path, "Could not capture the window");
+    return;
+  }
+  file = fopen(path, "wb");
+  if (file == NULL)
+  {
+    putCaptureError(writer, h, path, "Could not create the capture file");
+    return;
+  }
+  start = getClockNanoseconds();
+  if (capture_format == CAPTURE_FORMAT_PNG)
+    is_written = writeCapturePng(file, pixels, width, height, stride, &bytes);
+  else
+    is_written = writeCaptureRaw(file, pixels, width, height, stride, &bytes);
+  if (fclose(file) != 0)
+    is_written = 0;
+  capture_encode_time += getClockNanoseconds() - start;
+  if (!is_written)
+  {
+    putCaptureError(writer, h, path, "Could not write the capture file");
+    return;
+  }
+  capture_window_count++;
+  capture_byte_count += bytes;
+  capture_pixel_count += (int64_t)width * height;
+  putJsonChar(writer, '{');
+  putJsonKey(writer, 1, "handle");
+  putJsonInteger(writer, (int64_t)(intptr_t)h);
+  putJsonKey(writer, 0, "path");
+  putJsonString(writer, path, strlen(path));
+  putJsonKey(writer, 0, "width");
+  putJsonInteger(writer, width);
+  putJsonKey(writer, 0, "height");
+  putJsonInteger(writer, height);
+  putJsonKey(writer, 0, "bytes");
+  putJsonInteger(writer, bytes);
+  putJsonChar(writer, '}');
+}
+
+// Writes the "capture" section of the statistics object
+void writeCaptureStats(JsonWriter *writer)
+{
+  beginStatsSection(writer, "capture");
+  putStatsCounter(writer, 1, "windows", capture_window_count);
+  putStatsCounter(writer, 0, "failures", capture_failure_count);
+  putStatsCounter(writer, 0, "pixels", capture_pixel_count);
+  putStatsCounter(writer, 0, "bytes", capture_byte_count);
+  putStatsCounter(writer, 0, "grab_ns", capture_grab_time);
+  putStatsCounter(writer, 0, "encode_ns", capture_encode_time);
+  putJsonChar(writer, '}');
+}
+
+// Forgets the captures of a request, the buffers of the encoder are kept for the next one
+void resetCapture()
+{
+  is_option_capture = 0;
+  capture_format = CAPTURE_FORMAT_PNG;
+  capture_path[0] = '\0';
+  capture_window_count = 0;
+  capture_failure_count = 0;
+  capture_byte_count = 0;
+  capture_pixel_count = 0;
+  capture_grab_time = 0;
+  capture_encode_time = 0;
+}
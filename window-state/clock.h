@@ -0,0 +1,42 @@
+// Clock: a monotonic time in nanoseconds for the modes that measure how long their phases take, and the time of day in
+// milliseconds since the Unix epoch for the records that other processes read.
+
+#if defined(_WIN32)
+int64_t getClockNanoseconds()
+{
+  static LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+  if (frequency.QuadPart == 0)
+    QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  // Whole seconds and the remainder are converted separately so that the product does not overflow
+  return (int64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000 + (int64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+}
+
+int64_t getWallClockMilliseconds()
+{
+  FILETIME now;
+  ULARGE_INTEGER ticks;
+  GetSystemTimeAsFileTime(&now);
+  ticks.LowPart = now.dwLowDateTime;
+  ticks.HighPart = now.dwHighDateTime;
+  // File times count 100 ns intervals since 1601
+  return (int64_t)((ticks.QuadPart - 116444736000000000ull) / 10000);
+}
+#else
+#include <time.h>
+
+int64_t getClockNanoseconds()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000000 + (int64_t)now.tv_nsec;
+}
+
+int64_t getWallClockMilliseconds()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (int64_t)now.tv_sec * 1000 + (int64_t)now.tv_nsec / 1000000;
+}
+#endif
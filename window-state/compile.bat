@@ -1,7 +1,7 @@
 @echo off
 SET ENVSCRIPT="C:\Program Files (x86)\Microsoft Visual Studio\2019\Community\VC\Auxiliary\Build\vcvars64.bat"
 SET SETUP=call %ENVSCRIPT%
-SET COMPILE=cl.exe /nologo /Ob0 /O2 ./main.c /Fe"window-state.exe" user32.lib
+SET COMPILE=cl.exe /nologo /Ob0 /O2 ./main.c /Fe"window-state.exe" user32.lib gdi32.lib
 SET EXECUTE1=window-state.exe --help
 SET EXECUTE2=window-state.exe --f
 %SETUP%
@@ -0,0 +1,769 @@
+// Filter expressions: the --where argument is compiled once into a predicate tree that is evaluated on each candidate window.
+//
+//   expression := or
+//   or         := and (("||" | "or") and)*
+//   and        := unary (("&&" | "and") unary)*
+//   unary      := ("!" | "not") unary | "(" expression ")" | attribute [operator value]
+//   operator   := "==" | "=" | "!=" | "<" | "<=" | ">" | ">=" | "~" | "!~"
+//   value      := number | "string" | true | false
+//
+// Fractions such as visible_fraction are compared with decimal numbers (e.g. "visible_fraction >= 0.5") to six digits.
+//
+// The operands of every "and" / "or" node are sorted by the cost of the attributes they read, so attributes that are
+// expensive to query (title, executable) are only fetched for windows that pass the cheaper numeric comparisons.
+
+#include <errno.h>
+
+#define EXPRESSION_NODE_LIMIT 256
+#define EXPRESSION_STRING_SIZE 4096
+
+#define NODE_AND 1
+#define NODE_OR 2
+#define NODE_NOT 3
+#define NODE_COMPARE 4
+#define NODE_TRUTHY 5
+
+#define OPERATOR_EQUAL 1
+#define OPERATOR_NOT_EQUAL 2
+#define OPERATOR_LESS 3
+#define OPERATOR_LESS_EQUAL 4
+#define OPERATOR_GREATER 5
+#define OPERATOR_GREATER_EQUAL 6
+#define OPERATOR_CONTAINS 7
+#define OPERATOR_NOT_CONTAINS 8
+
+#define VALUE_NUMBER 1
+#define VALUE_STRING 2
+#define VALUE_BOOLEAN 3
+#define VALUE_FRACTION 4
+
+// Groups of attributes that are fetched together by a single query
+#define GROUP_PROCESS 0x001
+#define GROUP_STYLE 0x002
+#define GROUP_EXSTYLE 0x004
+#define GROUP_VISIBLE 0x008
+#define GROUP_UNICODE 0x010
+#define GROUP_PARENT 0x020
+#define GROUP_RECT 0x040
+#define GROUP_CLASS 0x080
+#define GROUP_MODULE 0x100
+#define GROUP_TITLE 0x200
+#define GROUP_EXECUTABLE 0x400
+#define GROUP_OCCLUSION 0x800
+
+typedef struct
+{
+  const char *name;
+  int type;
+  int group;
+  int cost;
+} ExpressionAttribute;
+
+// The index of each attribute in this table identifies it in the predicate tree
+const ExpressionAttribute expression_attributes[] = {
+    {"handle", VALUE_NUMBER, 0, 0},
+    {"pid", VALUE_NUMBER, GROUP_PROCESS, 1},
+    {"thread", VALUE_NUMBER, GROUP_PROCESS, 1},
+    {"style", VALUE_NUMBER, GROUP_STYLE, 1},
+    {"exstyle", VALUE_NUMBER, GROUP_EXSTYLE, 1},
+    {"popup", VALUE_BOOLEAN, GROUP_STYLE, 1},
+    {"contained", VALUE_BOOLEAN, GROUP_STYLE, 1},
+    {"bordered", VALUE_BOOLEAN, GROUP_STYLE, 1},
+    {"scrollable", VALUE_BOOLEAN, GROUP_STYLE, 1},
+    {"minimized", VALUE_BOOLEAN, GROUP_STYLE, 1},
+    {"maximized", VALUE_BOOLEAN, GROUP_STYLE, 1},
+    {"topmost", VALUE_BOOLEAN, GROUP_EXSTYLE, 1},
+    {"transparent", VALUE_BOOLEAN, GROUP_EXSTYLE, 1},
+    {"visible", VALUE_BOOLEAN, GROUP_VISIBLE, 1},
+    {"unicode", VALUE_BOOLEAN, GROUP_UNICODE, 1},
+    {"parent", VALUE_NUMBER, GROUP_PARENT, 1},
+    {"left", VALUE_NUMBER, GROUP_RECT, 2},
+    {"top", VALUE_NUMBER, GROUP_RECT, 2},
+    {"right", VALUE_NUMBER, GROUP_RECT, 2},
+    {"bottom", VALUE_NUMBER, GROUP_RECT, 2},
+    {"width", VALUE_NUMBER, GROUP_RECT, 2},
+    {"height", VALUE_NUMBER, GROUP_RECT, 2},
+    {"area", VALUE_NUMBER, GROUP_RECT, 2},
+    {"classname", VALUE_STRING, GROUP_CLASS, 3},
+    {"class", VALUE_STRING, GROUP_CLASS, 3},
+    {"module", VALUE_STRING, GROUP_MODULE, 4},
+    {"title", VALUE_STRING, GROUP_TITLE, 5},
+    {"executable", VALUE_STRING, GROUP_PROCESS | GROUP_EXECUTABLE, 6},
+    {"visible_area", VALUE_NUMBER, GROUP_OCCLUSION, 2},
+    {"visible_fraction", VALUE_FRACTION, GROUP_OCCLUSION, 2},
+};
+#define EXPRESSION_ATTRIBUTE_COUNT (int)(sizeof(expression_attributes) / sizeof(expression_attributes[0]))
+
+#define ATTRIBUTE_HANDLE 0
+#define ATTRIBUTE_PID 1
+#define ATTRIBUTE_THREAD 2
+#define ATTRIBUTE_STYLE 3
+#define ATTRIBUTE_EXSTYLE 4
+#define ATTRIBUTE_POPUP 5
+#define ATTRIBUTE_CONTAINED 6
+#define ATTRIBUTE_BORDERED 7
+#define ATTRIBUTE_SCROLLABLE 8
+#define ATTRIBUTE_MINIMIZED 9
+#define ATTRIBUTE_MAXIMIZED 10
+#define ATTRIBUTE_TOPMOST 11
+#define ATTRIBUTE_TRANSPARENT 12
+#define ATTRIBUTE_VISIBLE 13
+#define ATTRIBUTE_UNICODE 14
+#define ATTRIBUTE_PARENT 15
+#define ATTRIBUTE_LEFT 16
+#define ATTRIBUTE_TOP 17
+#define ATTRIBUTE_RIGHT 18
+#define ATTRIBUTE_BOTTOM 19
+#define ATTRIBUTE_WIDTH 20
+#define ATTRIBUTE_HEIGHT 21
+#define ATTRIBUTE_AREA 22
+#define ATTRIBUTE_CLASSNAME 23
+#define ATTRIBUTE_CLASS 24
+#define ATTRIBUTE_MODULE 25
+#define ATTRIBUTE_TITLE 26
+#define ATTRIBUTE_EXECUTABLE 27
+#define ATTRIBUTE_VISIBLE_AREA 28
+#define ATTRIBUTE_VISIBLE_FRACTION 29
+
+typedef struct
+{
+  int type;
+  int attribute;
+  int op;
+  int value_type;
+  int64_t number;
+  char *string;
+  int first_child;
+  int next_sibling;
+  int cost;
+} ExpressionNode;
+
+ExpressionNode expression_nodes[EXPRESSION_NODE_LIMIT];
+int expression_node_count = 0;
+int expression_root = -1;
+char expression_strings[EXPRESSION_STRING_SIZE];
+size_t expression_strings_length = 0;
+
+const char *expression_source = NULL;
+const char *expression_cursor = NULL;
+const char *expression_error = NULL;
+
+// Attributes of the window being evaluated, each group is queried at most once per window
+typedef struct
+{
+  HWND handle;
+  int fetched;
+  DWORD pid;
+  DWORD thread;
+  LONG style;
+  LONG exstyle;
+  int is_visible;
+  int is_unicode;
+  HWND parent;
+  RECT rect;
+  int64_t visible_area;
+  int64_t visible_fraction;
+  size_t class_length;
+  size_t module_length;
+  size_t title_length;
+  size_t exec_length;
+  char class[MIDDLE_BUFFER_SIZE];
+  char module[MIDDLE_BUFFER_SIZE];
+  char title[MIDDLE_BUFFER_SIZE];
+  char exec[MIDDLE_BUFFER_SIZE];
+} ExpressionWindow;
+
+ExpressionWindow expression_window;
+
+int64_t expression_evaluation_count = 0;
+int64_t expression_fetch_count = 0;
+
+int isExpressionIdentifier(char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+void skipExpressionWhitespace()
+{
+  while (*expression_cursor == ' ' || *expression_cursor == '\t' || *expression_cursor == '\r' || *expression_cursor == '\n')
+    expression_cursor++;
+}
+
+// Consumes a symbol or a keyword (a keyword must not be followed by an identifier character)
+int acceptExpressionToken(const char *token)
+{
+  size_t length = strlen(token);
+  skipExpressionWhitespace();
+  if (strncmp(expression_cursor, token, length) != 0)
+    return 0;
+  if (isExpressionIdentifier(token[0]) && isExpressionIdentifier(expression_cursor[length]))
+    return 0;
+  expression_cursor += length;
+  return 1;
+}
+
+int failExpression(const char *message)
+{
+  if (expression_error == NULL)
+    expression_error = message;
+  return -1;
+}
+
+int addExpressionNode(int type)
+{
+  ExpressionNode *node;
+  if (expression_node_count >= EXPRESSION_NODE_LIMIT)
+    return failExpression("expression has too many terms");
+  node = &expression_nodes[expression_node_count];
+  memset(node, 0, sizeof(ExpressionNode));
+  node->type = type;
+  node->first_child = -1;
+  node->next_sibling = -1;
+  return expression_node_count++;
+}
+
+// Inserts an operand in the list of a logical node keeping the list sorted by ascending cost
+void insertExpressionOperand(int parent, int child)
+{
+  int *link = &expression_nodes[parent].first_child;
+  while (*link >= 0 && expression_nodes[*link].cost <= expression_nodes[child].cost)
+    link = &expression_nodes[*link].next_sibling;
+  expression_nodes[child].next_sibling = *link;
+  *link = child;
+  if (expression_nodes[child].cost > expression_nodes[parent].cost)
+    expression_nodes[parent].cost = expression_nodes[child].cost;
+}
+
+int parseExpressionOr();
+
+int parseExpressionValue(ExpressionNode *node)
+{
+  const char *start;
+  char *target;
+  long value;
+  int64_t fraction = 0;
+  int digits = 0;
+  int is_negative;
+  skipExpressionWhitespace();
+  if (*expression_cursor == '"' || *expression_cursor == '\'')
+  {
+    char quote = *expression_cursor++;
+    target = &expression_strings[expression_strings_length];
+    node->string = target;
+    while (*expression_cursor != quote)
+    {
+      if (*expression_cursor == '\0')
+        return failExpression("unterminated string");
+      if (*expression_cursor == '\\' && expression_cursor[1] != '\0')
+        expression_cursor++;
+      if (expression_strings_length + 2 >= EXPRESSION_STRING_SIZE)
+        return failExpression("expression strings are too long");
+      expression_strings[expression_strings_length++] = *expression_cursor++;
+    }
+    expression_cursor++;
+    expression_strings[expression_strings_length++] = '\0';
+    node->value_type = VALUE_STRING;
+    return 0;
+  }
+  if (acceptExpressionToken("true"))
+  {
+    node->value_type = VALUE_BOOLEAN;
+    node->number = 1;
+    return 0;
+  }
+  if (acceptExpressionToken("false"))
+  {
+    node->value_type = VALUE_BOOLEAN;
+    node->number = 0;
+    return 0;
+  }
+  start = expression_cursor;
+  is_negative = *expression_cursor == '-';
+  if (is_negative)
+    expression_cursor++;
+  while (isExpressionIdentifier(*expression_cursor))
+    expression_cursor++;
+  if (expression_attributes[node->attribute].type == VALUE_FRACTION)
+  {
+    // Fractions are compared in millionths, an integer part is optional before the decimals
+    value = 0;
+    if (expression_cursor > start + is_negative)
+    {
+      if (expression_cursor - start >= 31)
+        return failExpression("invalid number");
+      memcpy(parse_buffer, start, expression_cursor - start);
+      parse_buffer[expression_cursor - start] = '\0';
+      errno = 0;
+      if (!safeParseLong(&value) || errno == ERANGE)
+        return failExpression("invalid number");
+    }
+    if (*expression_cursor == '.')
+    {
+      for (expression_cursor++; *expression_cursor >= '0' && *expression_cursor <= '9'; expression_cursor++, digits++)
+      {
+        if (digits >= OCCLUSION_FRACTION_DIGITS)
+          return failExpression("fractions have at most six decimals");
+        fraction = fraction * 10 + (*expression_cursor - '0');
+      }
+      if (digits == 0)
+        return failExpression("expected decimals after the point");
+      for (; digits < OCCLUSION_FRACTION_DIGITS; digits++)
+        fraction *= 10;
+    }
+    else if (expression_cursor == start + is_negative)
+      return failExpression("expected a number, a string or a boolean value");
+    node->value_type = VALUE_NUMBER;
+    node->number = (int64_t)value * OCCLUSION_FRACTION_SCALE + (is_negative ? -fraction : fraction);
+    return 0;
+  }
+  if (expression_cursor == start || expression_cursor - start >= 31)
+    return failExpression("expected a number, a string or a boolean value");
+  if (*expression_cursor == '.')
+    return failExpression("decimal numbers are only supported by fractions");
+  memcpy(parse_buffer, start, expression_cursor - start);
+  parse_buffer[expression_cursor - start] = '\0';
+  errno = 0;
+  if (!safeParseLong(&value) || errno == ERANGE)
+    return failExpression("invalid number");
+  node->value_type = VALUE_NUMBER;
+  node->number = value;
+  return 0;
+}
+
+int parseExpressionComparison()
+{
+  const char *start;
+  size_t length;
+  int attribute;
+  int index;
+  ExpressionNode *node;
+  skipExpressionWhitespace();
+  start = expression_cursor;
+  while (isExpressionIdentifier(*expression_cursor))
+    expression_cursor++;
+  length = (size_t)(expression_cursor - start);
+  if (length == 0)
+    return failExpression("expected an attribute name");
+  for (attribute = 0; attribute < EXPRESSION_ATTRIBUTE_COUNT; attribute++)
+    if (strlen(expression_attributes[attribute].name) == length && strncmp(expression_attributes[attribute].name, start, length) == 0)
+      break;
+  if (attribute >= EXPRESSION_ATTRIBUTE_COUNT)
+  {
+    expression_cursor = start;
+    return failExpression("unknown attribute");
+  }
+  index = addExpressionNode(NODE_COMPARE);
+  if (index < 0)
+    return -1;
+  node = &expression_nodes[index];
+  node->attribute = attribute;
+  node->cost = expression_attributes[attribute].cost;
+  skipExpressionWhitespace();
+  if (acceptExpressionToken("=="))
+    node->op = OPERATOR_EQUAL;
+  else if (acceptExpressionToken("!="))
+    node->op = OPERATOR_NOT_EQUAL;
+  else if (acceptExpressionToken("!~"))
+    node->op = OPERATOR_NOT_CONTAINS;
+  else if (acceptExpressionToken("<="))
+    node->op = OPERATOR_LESS_EQUAL;
+  else if (acceptExpressionToken(">="))
+    node->op = OPERATOR_GREATER_EQUAL;
+  else if (acceptExpressionToken("<"))
+    node->op = OPERATOR_LESS;
+  else if (acceptExpressionToken(">"))
+    node->op = OPERATOR_GREATER;
+  else if (acceptExpressionToken("~"))
+    node->op = OPERATOR_CONTAINS;
+  else if (acceptExpressionToken("="))
+    node->op = OPERATOR_EQUAL;
+  if (node->op == 0)
+  {
+    node->type = NODE_TRUTHY;
+    return index;
+  }
+  if (parseExpressionValue(node) < 0)
+    return -1;
+  if (expression_attributes[attribute].type == VALUE_STRING)
+  {
+    if (node->value_type != VALUE_STRING)
+      return failExpression("text attributes must be compared with a string");
+    if (node->op != OPERATOR_EQUAL && node->op != OPERATOR_NOT_EQUAL && node->op != OPERATOR_CONTAINS && node->op != OPERATOR_NOT_CONTAINS)
+      return failExpression("text attributes only support ==, !=, ~ and !~");
+  }
+  else
+  {
+    if (node->value_type == VALUE_STRING)
+      return failExpression("numeric attributes must be compared with a number");
+    if (node->op == OPERATOR_CONTAINS || node->op == OPERATOR_NOT_CONTAINS)
+      return failExpression("the ~ operator is only supported by text attributes");
+  }
+  return index;
+}
+
+int parseExpressionUnary()
+{
+  int index;
+  int child;
+  if (acceptExpressionToken("!") || acceptExpressionToken("not"))
+  {
+    child = parseExpressionUnary();
+    if (child < 0)
+      return -1;
+    index = addExpressionNode(NODE_NOT);
+    if (index < 0)
+      return -1;
+    insertExpressionOperand(index, child);
+    return index;
+  }
+  if (acceptExpressionToken("("))
+  {
+    index = parseExpressionOr();
+    if (index < 0)
+      return -1;
+    if (!acceptExpressionToken(")"))
+      return failExpression("expected a closing parenthesis");
+    return index;
+  }
+  return parseExpressionComparison();
+}
+
+int parseExpressionAnd()
+{
+  int index = -1;
+  int child = parseExpressionUnary();
+  if (child < 0)
+    return -1;
+  while (acceptExpressionToken("&&") || acceptExpressionToken("and"))
+  {
+    if (index < 0)
+    {
+      index = addExpressionNode(NODE_AND);
+      if (index < 0)
+        return -1;
+      insertExpressionOperand(index, child);
+    }
+    child = parseExpressionUnary();
+    if (child < 0)
+      return -1;
+    insertExpressionOperand(index, child);
+  }
+  return index < 0 ? child : index;
+}
+
+int parseExpressionOr()
+{
+  int index = -1;
+  int child = parseExpressionAnd();
+  if (child < 0)
+    return -1;
+  while (acceptExpressionToken("||") || acceptExpressionToken("or"))
+  {
+    if (index < 0)
+    {
+      index = addExpressionNode(NODE_OR);
+      if (index < 0)
+        return -1;
+      insertExpressionOperand(index, child);
+    }
+    child = parseExpressionAnd();
+    if (child < 0)
+      return -1;
+    insertExpressionOperand(index, child);
+  }
+  return index < 0 ? child : index;
+}
+
+// Compiles a filter expression into the predicate tree, returns zero and writes an error when it is invalid
+int compileExpression(const char *source)
+{
+  expression_node_count = 0;
+  expression_strings_length = 0;
+  expression_error = NULL;
+  expression_source = source;
+  expression_cursor = source;
+  expression_root = parseExpressionOr();
+  skipExpressionWhitespace();
+  if (expression_root >= 0 && *expression_cursor != '\0')
+    expression_root = failExpression("unexpected text after the expression");
+  if (expression_root < 0)
+  {
+    writeOutput("Error: Invalid filter expression at column %d: %s\n", (int)(expression_cursor - source) + 1, expression_error != NULL ? expression_error : "syntax error");
+    return 0;
+  }
+  return 1;
+}
+
+// Returns the groups of the attributes read by the expression
+int findExpressionGroups()
+{
+  int groups = 0;
+  int i;
+  if (expression_root < 0)
+    return 0;
+  for (i = 0; i < expression_node_count; i++)
+  {
+    if (expression_nodes[i].type == NODE_COMPARE || expression_nodes[i].type == NODE_TRUTHY)
+      groups |= expression_attributes[expression_nodes[i].attribute].group;
+  }
+  return groups;
+}
+
+// Returns the value of a numeric comparison that every window must satisfy for the expression to match, if there is one
+int findRequiredExpressionNumber(int attribute, int64_t *value)
+{
+  int index;
+  if (expression_root < 0)
+    return 0;
+  if (expression_nodes[expression_root].type == NODE_COMPARE)
+    index = expression_root;
+  else if (expression_nodes[expression_root].type == NODE_AND)
+    index = expression_nodes[expression_root].first_child;
+  else
+    return 0;
+  for (; index >= 0; index = expression_nodes[index].next_sibling)
+  {
+    ExpressionNode *node = &expression_nodes[index];
+    if (node->type == NODE_COMPARE && node->attribute == attribute && node->op == OPERATOR_EQUAL && node->value_type == VALUE_NUMBER)
+    {
+      *value = node->number;
+      return 1;
+    }
+    if (index == expression_root)
+      break;
+  }
+  return 0;
+}
+
+void fetchExpressionGroup(int group)
+{
+  ExpressionWindow *w = &expression_window;
+  HWND h = w->handle;
+  int index;
+  expression_fetch_count++;
+  if (group == GROUP_PROCESS)
+    w->thread = backendGetWindowThreadProcessId(h, &w->pid);
+  else if (group == GROUP_STYLE)
+    w->style = backendGetWindowLong(h, GWL_STYLE);
+  else if (group == GROUP_EXSTYLE)
+    w->exstyle = backendGetWindowLong(h, GWL_EXSTYLE);
+  else if (group == GROUP_VISIBLE)
+    w->is_visible = backendIsWindowVisible(h);
+  else if (group == GROUP_UNICODE)
+    w->is_unicode = backendIsWindowUnicode(h);
+  else if (group == GROUP_PARENT)
+    w->parent = backendGetParent(h);
+  else if (group == GROUP_RECT && 0 == backendGetWindowRect(h, &w->rect))
+    memset(&w->rect, 0, sizeof(RECT));
+  else if (group == GROUP_CLASS)
+    w->class_length = backendGetClassName(h, w->class, MIDDLE_BUFFER_SIZE);
+  else if (group == GROUP_MODULE)
+    w->module_length = backendGetWindowModuleFileName(h, w->module, MIDDLE_BUFFER_SIZE);
+  else if (group == GROUP_TITLE)
+    w->title_length = backendGetWindowText(h, w->title, MIDDLE_BUFFER_SIZE);
+  else if (group == GROUP_EXECUTABLE)
+    w->exec_length = w->pid > 0 ? getProcessExecutable(w->pid, w->exec, MIDDLE_BUFFER_SIZE) : 0;
+  else if (group == GROUP_OCCLUSION)
+  {
+    // Windows that are not top-level have no visible area
+    index = findOcclusionWindow(h);
+    w->visible_area = index >= 0 ? occlusion_windows[index].visible_area : 0;
+    w->visible_fraction = index >= 0 ? getOcclusionFraction(index) : 0;
+  }
+  w->fetched |= group;
+}
+
+// Fetches the groups that were not queried yet for the current window, the process group first since the executable depends on it
+void requireExpressionGroups(int groups)
+{
+  int missing = groups & ~expression_window.fetched;
+  int group;
+  if (missing & GROUP_PROCESS)
+    fetchExpressionGroup(GROUP_PROCESS);
+  for (group = GROUP_STYLE; group <= GROUP_OCCLUSION; group <<= 1)
+    if (missing & group)
+      fetchExpressionGroup(group);
+}
+
+int64_t getExpressionNumber(int attribute)
+{
+  ExpressionWindow *w = &expression_window;
+  requireExpressionGroups(expression_attributes[attribute].group);
+  switch (attribute)
+  {
+  case ATTRIBUTE_HANDLE:
+    return (int64_t)(intptr_t)w->handle;
+  case ATTRIBUTE_PID:
+    return w->pid;
+  case ATTRIBUTE_THREAD:
+    return w->thread;
+  case ATTRIBUTE_STYLE:
+    return (int64_t)w->style;
+  case ATTRIBUTE_EXSTYLE:
+    return (int64_t)w->exstyle;
+  case ATTRIBUTE_POPUP:
+    return (w->style & WS_POPUP) != 0;
+  case ATTRIBUTE_CONTAINED:
+    return (w->style & WS_CLIPSIBLINGS) != 0;
+  case ATTRIBUTE_BORDERED:
+    return (w->style & WS_BORDER) != 0 || (w->style & WS_THICKFRAME) != 0;
+  case ATTRIBUTE_SCROLLABLE:
+    return (w->style & WS_HSCROLL) != 0 || (w->style & WS_VSCROLL) != 0;
+  case ATTRIBUTE_MINIMIZED:
+    return (w->style & WS_MINIMIZE) != 0;
+  case ATTRIBUTE_MAXIMIZED:
+    return (w->style & WS_MAXIMIZE) != 0;
+  case ATTRIBUTE_TOPMOST:
+    return (w->exstyle & WS_EX_TOPMOST) != 0;
+  case ATTRIBUTE_TRANSPARENT:
+    return (w->exstyle & WS_EX_TRANSPARENT) != 0;
+  case ATTRIBUTE_VISIBLE:
+    return w->is_visible != 0;
+  case ATTRIBUTE_UNICODE:
+    return w->is_unicode != 0;
+  case ATTRIBUTE_PARENT:
+    return (int64_t)(intptr_t)w->parent;
+  case ATTRIBUTE_LEFT:
+    return w->rect.left;
+  case ATTRIBUTE_TOP:
+    return w->rect.top;
+  case ATTRIBUTE_RIGHT:
+    return w->rect.right;
+  case ATTRIBUTE_BOTTOM:
+    return w->rect.bottom;
+  case ATTRIBUTE_WIDTH:
+    return (int64_t)w->rect.right - w->rect.left;
+  case ATTRIBUTE_HEIGHT:
+    return (int64_t)w->rect.bottom - w->rect.top;
+  case ATTRIBUTE_AREA:
+    return ((int64_t)w->rect.right - w->rect.left) * ((int64_t)w->rect.bottom - w->rect.top);
+  case ATTRIBUTE_VISIBLE_AREA:
+    return w->visible_area;
+  case ATTRIBUTE_VISIBLE_FRACTION:
+    return w->visible_fraction;
+  }
+  return 0;
+}
+
+const char *getExpressionString(int attribute, size_t *length)
+{
+  ExpressionWindow *w = &expression_window;
+  requireExpressionGroups(expression_attributes[attribute].group);
+  switch (attribute)
+  {
+  case ATTRIBUTE_CLASSNAME:
+  case ATTRIBUTE_CLASS:
+    *length = w->class_length;
+    return w->class;
+  case ATTRIBUTE_MODULE:
+    *length = w->module_length;
+    return w->module;
+  case ATTRIBUTE_TITLE:
+    *length = w->title_length;
+    return w->title;
+  case ATTRIBUTE_EXECUTABLE:
+    *length = w->exec_length;
+    return w->exec;
+  }
+  *length = 0;
+  return "";
+}
+
+// Case-insensitive substring search for the ~ operator, folding case like the --title pattern matcher
+int containsText(const char *text, size_t text_length, const char *pattern)
+{
+  size_t pattern_length = strlen(pattern);
+  size_t i;
+  size_t j;
+  unsigned char a;
+  unsigned char b;
+  if (pattern_length == 0)
+    return 1;
+  for (i = 0; i + pattern_length <= text_length; i++)
+  {
+    for (j = 0; j < pattern_length; j++)
+    {
+      a = foldByte(i + j > 0 ? (unsigned char)text[i + j - 1] : 0, (unsigned char)text[i + j]);
+      b = foldByte(j > 0 ? (unsigned char)pattern[j - 1] : 0, (unsigned char)pattern[j]);
+      if (a != b)
+        break;
+    }
+    if (j == pattern_length)
+      return 1;
+  }
+  return 0;
+}
+
+int evaluateExpressionNode(int index)
+{
+  ExpressionNode *node = &expression_nodes[index];
+  int child;
+  int64_t number;
+  const char *text;
+  size_t text_length;
+  switch (node->type)
+  {
+  case NODE_AND:
+    for (child = node->first_child; child >= 0; child = expression_nodes[child].next_sibling)
+      if (!evaluateExpressionNode(child))
+        return 0;
+    return 1;
+  case NODE_OR:
+    for (child = node->first_child; child >= 0; child = expression_nodes[child].next_sibling)
+      if (evaluateExpressionNode(child))
+        return 1;
+    return 0;
+  case NODE_NOT:
+    return !evaluateExpressionNode(node->first_child);
+  case NODE_TRUTHY:
+    if (expression_attributes[node->attribute].type == VALUE_STRING)
+    {
+      getExpressionString(node->attribute, &text_length);
+      return text_length > 0;
+    }
+    return getExpressionNumber(node->attribute) != 0;
+  }
+  if (expression_attributes[node->attribute].type == VALUE_STRING)
+  {
+    text = getExpressionString(node->attribute, &text_length);
+    if (node->op == OPERATOR_CONTAINS || node->op == OPERATOR_NOT_CONTAINS)
+      return containsText(text, text_length, node->string) == (node->op == OPERATOR_CONTAINS);
+    return isMatchingText(text, node->string) == (node->op == OPERATOR_EQUAL);
+  }
+  number = getExpressionNumber(node->attribute);
+  switch (node->op)
+  {
+  case OPERATOR_EQUAL:
+    return number == node->number;
+  case OPERATOR_NOT_EQUAL:
+    return number != node->number;
+  case OPERATOR_LESS:
+    return number < node->number;
+  case OPERATOR_LESS_EQUAL:
+    return number <= node->number;
+  case OPERATOR_GREATER:
+    return number > node->number;
+  case OPERATOR_GREATER_EQUAL:
+    return number >= node->number;
+  }
+  return 0;
+}
+
+int evaluateExpression(HWND h)
+{
+  if (expression_root < 0)
+    return 1;
+  expression_evaluation_count++;
+  expression_window.handle = h;
+  expression_window.fetched = 0;
+  return evaluateExpressionNode(expression_root);
+}
+
+// Writes the "expression" section of the statistics object
+void writeExpressionStats(JsonWriter *writer)
+{
+  beginStatsSection(writer, "expression");
+  putStatsCounter(writer, 1, "evaluations", expression_evaluation_count);
+  putStatsCounter(writer, 0, "fetches", expression_fetch_count);
+  putJsonChar(writer, '}');
+}
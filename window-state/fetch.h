@@ -0,0 +1,335 @@
+// Bounded fetching: reads the attributes of the listed windows on a pool of threads, with a time budget per window.
+//
+// With --timeout, the windows are selected first and their attributes are read by worker threads, at most FETCH_RING_SIZE
+// windows ahead of the output. The output is written in the order of the selection as the windows are read, and a window
+// that was not read within the budget after a worker started on it is written as {"handle": <handle>, "timeout": true}.
+// Its worker is abandoned and replaced: it exits by itself once the window system returns, without touching the results.
+// Workers keep their own copy of the state of the listing they were started for: the fields are read from fetch_fields
+// when they take a window, the record is read into buffers of the worker, and calls are timed into the StatsCopy of the
+// worker with the --stats option of that listing, added to the statistics when the worker is joined and dropped when it is
+// abandoned. Only the process cache is shared with the later requests of serve mode: it stays locked by every thread until
+// the abandoned workers have exited. A later request does not wait for them unless it changes windows, or lists them with
+// a backend whose listing replaces what the workers read, see waitFetchWorkers.
+
+#define FETCH_RING_SIZE 256
+#define FETCH_THREAD_LIMIT 64
+#define FETCH_MIN_WORKERS 4
+// Output waiting on a slow window is flushed after this delay so that the windows before it are not held back
+#define FETCH_FLUSH_DELAY 20
+
+#define FETCH_RUNNING 1
+#define FETCH_DONE 2
+
+typedef struct
+{
+  ThreadHandle thread;
+  int is_abandoned;
+  StatsCopy stats;
+  WindowRecord record;
+  char title[MIDDLE_BUFFER_SIZE];
+  char module[MIDDLE_BUFFER_SIZE];
+  char exec[MIDDLE_BUFFER_SIZE];
+  char class[MIDDLE_BUFFER_SIZE];
+} FetchWorker;
+
+typedef struct
+{
+  int task;
+  int state;
+  int64_t start;
+  FetchWorker *worker;
+  WindowRecord record;
+  char title[MIDDLE_BUFFER_SIZE];
+  char module[MIDDLE_BUFFER_SIZE];
+  char exec[MIDDLE_BUFFER_SIZE];
+  char class[MIDDLE_BUFFER_SIZE];
+} FetchSlot;
+
+int64_t fetch_timeout = 0;
+int64_t fetch_timeout_count = 0;
+int fetch_used_worker_count = 0;
+
+// The pool state is only accessed with the mutex held, the mutex and condition are never released since abandoned workers
+// can outlive the listing
+ThreadMutex fetch_mutex;
+ThreadCondition fetch_condition;
+FetchWorker *fetch_workers[FETCH_THREAD_LIMIT];
+FetchSlot *fetch_slots = NULL;
+int fetch_live_count = 0;
+int fetch_abandoned_count = 0;
+int fetch_task_count = 0;
+int fetch_next_task = 0;
+int fetch_written_count = 0;
+int is_fetch_closed = 0;
+int fetch_fields = 0;
+
+void initFetch()
+{
+  initMutex(&fetch_mutex);
+  initCondition(&fetch_condition);
+}
+
+void copyFetchString(char *target, const char *source, uint32_t length)
+{
+  memcpy(target, source, length);
+  target[length] = '\0';
+}
+
+THREAD_FUNCTION(runFetchWorker, argument)
+{
+  FetchWorker *worker = (FetchWorker *)argument;
+  FetchSlot *slot;
+  HWND h;
+  int fields;
+  thread_stats = &worker->stats;
+  lockMutex(&fetch_mutex);
+  while (1)
+  {
+    // A window is only taken once the output has released the slot it is read into
+    while (!is_fetch_closed && fetch_next_task < fetch_task_count && fetch_next_task >= fetch_written_count + FETCH_RING_SIZE)
+      waitCondition(&fetch_condition, &fetch_mutex, -1);
+    if (is_fetch_closed || fetch_next_task >= fetch_task_count)
+      break;
+    slot = &fetch_slots[fetch_next_task % FETCH_RING_SIZE];
+    slot->task = fetch_next_task;
+    slot->state = FETCH_RUNNING;
+    slot->start = getClockNanoseconds();
+    slot->worker = worker;
+    h = selected_list[fetch_next_task];
+    fields = fetch_fields;
+    fetch_next_task++;
+    signalAllConditions(&fetch_condition);
+    unlockMutex(&fetch_mutex);
+    fetchWindowRecordStrings(h, fields, &worker->record, worker->title, worker->module, worker->exec, worker->class);
+    lockMutex(&fetch_mutex);
+    if (worker->is_abandoned)
+    {
+      fetch_abandoned_count--;
+      signalAllConditions(&fetch_condition);
+      unlockMutex(&fetch_mutex);
+      free(worker);
+      THREAD_RETURN;
+    }
+    slot->record = worker->record;
+    copyFetchString(slot->title, worker->title, worker->record.title_length);
+    copyFetchString(slot->module, worker->module, worker->record.module_length);
+    copyFetchString(slot->exec, worker->exec, worker->record.executable_length);
+    copyFetchString(slot->class, worker->class, worker->record.classname_length);
+    slot->state = FETCH_DONE;
+    signalAllConditions(&fetch_condition);
+  }
+  unlockMutex(&fetch_mutex);
+  THREAD_RETURN;
+}
+
+// Starts a worker with the mutex held, returns zero when the thread limit is reached or the thread cannot be started
+int startFetchWorker()
+{
+  FetchWorker *worker;
+  int w;
+  if (fetch_live_count + fetch_abandoned_count >= FETCH_THREAD_LIMIT)
+    return 0;
+  for (w = 0; fetch_workers[w] != NULL; w++)
+  {
+  }
+  worker = (FetchWorker *)calloc(1, sizeof(FetchWorker));
+  if (worker == NULL)
+    return 0;
+  worker->stats.is_timed = is_option_stats;
+  if (!startThread(&worker->thread, runFetchWorker, worker))
+  {
+    free(worker);
+    return 0;
+  }
+  fetch_workers[w] = worker;
+  fetch_live_count++;
+  fetch_used_worker_count++;
+  return 1;
+}
+
+// Gives up on the window of a slot with the mutex held, its worker exits by itself and another one takes its place
+void abandonFetchWorker(FetchSlot *slot)
+{
+  int w;
+  for (w = 0; w < FETCH_THREAD_LIMIT; w++)
+  {
+    if (fetch_workers[w] == slot->worker)
+      fetch_workers[w] = NULL;
+  }
+  slot->worker->is_abandoned = 1;
+  detachThread(slot->worker->thread);
+  fetch_live_count--;
+  fetch_abandoned_count++;
+  if (fetch_next_task < fetch_task_count)
+    startFetchWorker();
+}
+
+// Waits with the mutex held until the window of a task is read or its budget has elapsed, returns zero on a timeout
+int waitFetchSlot(FetchSlot *slot, int task)
+{
+  int64_t now = getClockNanoseconds();
+  int64_t flush_time = now + (int64_t)FETCH_FLUSH_DELAY * 1000000;
+  int64_t wait;
+  int is_flushed = 0;
+  while (slot->task != task || slot->state != FETCH_DONE)
+  {
+    now = getClockNanoseconds();
+    if (!is_flushed && now >= flush_time)
+    {
+      unlockMutex(&fetch_mutex);
+      flushJsonWriter(&output_writer);
+      if (!is_output_captured)
+        fflush(stdout);
+      lockMutex(&fetch_mutex);
+      is_flushed = 1;
+      continue;
+    }
+    if (slot->task == task)
+    {
+      wait = slot->start + fetch_timeout * 1000000 - now;
+      if (wait <= 0)
+      {
+        abandonFetchWorker(slot);
+        return 0;
+      }
+    }
+    else
+    {
+      // Windows are taken in order, so a window that was not started waits for an idle worker unless there is none left
+      if (fetch_live_count == 0 && !startFetchWorker())
+      {
+        fetch_next_task = task + 1;
+        return 0;
+      }
+      wait = (int64_t)FETCH_FLUSH_DELAY * 1000000;
+    }
+    if (!is_flushed && flush_time - now < wait)
+      wait = flush_time - now;
+    waitCondition(&fetch_condition, &fetch_mutex, (wait + 999999) / 1000000);
+  }
+  return 1;
+}
+
+// Stops locking the process cache once the abandoned workers have exited, without waiting for them. The flag is read by
+// the workers, it is only cleared once there are none.
+void releaseFetchWorkers()
+{
+  lockMutex(&fetch_mutex);
+  if (fetch_abandoned_count == 0)
+    is_process_cache_shared = 0;
+  unlockMutex(&fetch_mutex);
+}
+
+// Lists the selected windows with their attributes read by the pool, returns an exit code
+int writeBoundedWindowList()
+{
+  FetchSlot *slot;
+  int worker_count;
+  int code = collectSelectedWindows();
+  int is_read;
+  int i;
+  int w;
+  if (code != 0)
+  {
+    freeSelectedWindows();
+    return code;
+  }
+  fetch_slots = (FetchSlot *)malloc(FETCH_RING_SIZE * sizeof(FetchSlot));
+  if (fetch_slots == NULL)
+  {
+    freeSelectedWindows();
+    writeOutput("Error: Could not allocate the window records\n");
+    return 1;
+  }
+  for (i = 0; i < FETCH_RING_SIZE; i++)
+    fetch_slots[i].task = -1;
+  worker_count = (int)(tree_thread_count > 0 ? tree_thread_count : getProcessorCount());
+  if (worker_count < FETCH_MIN_WORKERS && tree_thread_count <= 0)
+    worker_count = FETCH_MIN_WORKERS;
+  if (worker_count > selected_count)
+    worker_count = selected_count;
+  lockMutex(&fetch_mutex);
+  fetch_task_count = selected_count;
+  fetch_next_task = 0;
+  fetch_written_count = 0;
+  is_fetch_closed = 0;
+  fetch_fields = output_fields;
+  // Abandoned workers of an earlier request may be reading the flag, which is then already set
+  if (!is_process_cache_shared)
+    is_process_cache_shared = 1;
+  for (w = 0; w < worker_count; w++)
+    startFetchWorker();
+  unlockMutex(&fetch_mutex);
+  beginWindowList();
+  for (i = 0; i < selected_count; i++)
+  {
+    slot = &fetch_slots[i % FETCH_RING_SIZE];
+    lockMutex(&fetch_mutex);
+    is_read = waitFetchSlot(slot, i);
+    unlockMutex(&fetch_mutex);
+    // The slot of a window is not taken again until it is released below
+    if (output_format == FORMAT_JSON && i != 0)
+      putJsonBytes(&output_writer, ", ", 2);
+    if (is_read)
+    {
+      putJsonChar(&output_writer, '{');
+      putWindowRecordKeys(&output_writer, 1, output_fields, &slot->record, slot->title, slot->module, slot->exec, slot->class);
+      putJsonChar(&output_writer, '}');
+    }
+    else
+    {
+      putJsonText(&output_writer, "{\"handle\": ");
+      putJsonInteger(&output_writer, (int64_t)(intptr_t)selected_list[i]);
+      putJsonText(&output_writer, ", \"timeout\": true}");
+      fetch_timeout_count++;
+    }
+    if (output_format == FORMAT_NDJSON)
+      putJsonChar(&output_writer, '\n');
+    lockMutex(&fetch_mutex);
+    fetch_written_count++;
+    signalAllConditions(&fetch_condition);
+    unlockMutex(&fetch_mutex);
+  }
+  lockMutex(&fetch_mutex);
+  is_fetch_closed = 1;
+  signalAllConditions(&fetch_condition);
+  unlockMutex(&fetch_mutex);
+  for (w = 0; w < FETCH_THREAD_LIMIT; w++)
+  {
+    if (fetch_workers[w] == NULL)
+      continue;
+    joinThread(fetch_workers[w]->thread);
+    addStatsCopy(&fetch_workers[w]->stats);
+    free(fetch_workers[w]);
+    fetch_workers[w] = NULL;
+  }
+  lockMutex(&fetch_mutex);
+  fetch_live_count = 0;
+  unlockMutex(&fetch_mutex);
+  releaseFetchWorkers();
+  free(fetch_slots);
+  fetch_slots = NULL;
+  i = selected_count;
+  freeSelectedWindows();
+  return endWindowList(i);
+}
+
+// Waits until the abandoned workers have returned from the window system, so that the windows they read can be changed and
+// the backend is only called from this thread again
+void waitFetchWorkers()
+{
+  lockMutex(&fetch_mutex);
+  while (fetch_abandoned_count > 0)
+    waitCondition(&fetch_condition, &fetch_mutex, -1);
+  is_process_cache_shared = 0;
+  unlockMutex(&fetch_mutex);
+}
+
+// Writes the "fetch" section of the statistics object
+void writeFetchStats(JsonWriter *writer)
+{
+  beginStatsSection(writer, "fetch");
+  putStatsCounter(writer, 1, "workers", fetch_used_worker_count);
+  putStatsCounter(writer, 0, "timeouts", fetch_timeout_count);
+  putJsonChar(writer, '}');
+}
@@ -0,0 +1,351 @@
+// Focus history: records the changes of the foreground window into a ring file with --record-focus, and lists them with
+// --focus-history, from the time given by --focus-since.
+//
+// The file is a header followed by a fixed number of records, and is mapped in memory by the recorder and by the readers,
+// so the readers see each record as soon as it is written without a lock or a request to the recorder. The recorder waits
+// for window events like the watch mode and appends a record when the foreground window or its title changed. Record i is
+// kept in slot i % FOCUS_CAPACITY until it is overwritten FOCUS_CAPACITY records later. The sequence of a slot is zeroed
+// before its record is written and set to i + 1 once it is complete, then the count of the header is increased, so a
+// reader compares the sequence before and after copying a record and skips the records that were being overwritten. A
+// file is written by one recorder at a time, and a recorder started on an existing file appends to its records.
+//
+// Records are 32 bytes: the sequence, the time in milliseconds since the Unix epoch, the handle, the pid and the 32-bit
+// FNV-1a hash of the title. The foreground window is written with handle 0 when no window has the focus.
+//
+// Output of --focus-history, one object per record from the oldest, with the milliseconds until the next record:
+//   {"time": 1760700000000, "handle": 65552, "pid": 1000, "title_hash": 2166136261, "duration": 1500}
+// The duration of the last record, whose window may still have the focus, is null.
+
+#if defined(_WIN32)
+#define FOCUS_BARRIER() MemoryBarrier()
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define FOCUS_BARRIER() __sync_synchronize()
+#endif
+
+#define FOCUS_MAGIC "WSFOCUS\n"
+#define FOCUS_VERSION 1
+#define FOCUS_CAPACITY 65536
+
+#define FOCUS_NONE 0
+#define FOCUS_RECORD 1
+#define FOCUS_HISTORY 2
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t record_size;
+  uint32_t capacity;
+  // Number of records written to the file, increased after each record is complete
+  volatile int64_t write_count;
+  int64_t created;
+  uint8_t reserved[24];
+} FocusHeader;
+
+typedef struct
+{
+  volatile int64_t sequence;
+  int64_t time;
+  int64_t handle;
+  uint32_t pid;
+  uint32_t title_hash;
+} FocusRecord;
+
+typedef struct
+{
+  char *view;
+  size_t size;
+#if defined(_WIN32)
+  HANDLE file;
+  HANDLE mapping;
+#else
+  int file;
+#endif
+} FocusMapping;
+
+int focus_mode = FOCUS_NONE;
+char focus_path[MIDDLE_BUFFER_SIZE];
+int is_option_focus_since = 0;
+int64_t focus_since = INT64_MIN;
+
+int64_t focus_record_count = 0;
+int64_t focus_skipped_count = 0;
+
+// Maps a file in memory, with the size of the ring when it is written and its own size when it is read, returns zero on failure
+int openFocusMapping(FocusMapping *mapping, const char *path, int is_writable)
+{
+  size_t size = sizeof(FocusHeader) + (size_t)FOCUS_CAPACITY * sizeof(FocusRecord);
+#if defined(_WIN32)
+  LARGE_INTEGER file_size;
+  mapping->view = NULL;
+  mapping->mapping = NULL;
+  mapping->file = CreateFileA(path, GENERIC_READ | (is_writable ? GENERIC_WRITE : 0), FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, is_writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (mapping->file == INVALID_HANDLE_VALUE)
+    return 0;
+  if (!is_writable)
+  {
+    if (!GetFileSizeEx(mapping->file, &file_size) || file_size.QuadPart < (LONGLONG)sizeof(FocusHeader))
+      return 0;
+    size = (size_t)file_size.QuadPart;
+  }
+  // A writable mapping larger than the file extends it
+  mapping->mapping = CreateFileMappingA(mapping->file, NULL, is_writable ? PAGE_READWRITE : PAGE_READONLY, (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL);
+  if (mapping->mapping == NULL)
+    return 0;
+  mapping->view = (char *)MapViewOfFile(mapping->mapping, is_writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+#else
+  struct stat file_stat;
+  void *view;
+  mapping->view = NULL;
+  mapping->file = open(path, is_writable ? O_RDWR | O_CREAT : O_RDONLY, 0600);
+  if (mapping->file < 0)
+    return 0;
+  if (is_writable && ftruncate(mapping->file, (off_t)size) != 0)
+    return 0;
+  if (!is_writable)
+  {
+    if (fstat(mapping->file, &file_stat) != 0 || file_stat.st_size < (off_t)sizeof(FocusHeader))
+      return 0;
+    size = (size_t)file_stat.st_size;
+  }
+  view = mmap(NULL, size, is_writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, mapping->file, 0);
+  mapping->view = view != MAP_FAILED ? (char *)view : NULL;
+#endif
+  mapping->size = size;
+  return mapping->view != NULL;
+}
+
+void closeFocusMapping(FocusMapping *mapping)
+{
+#if defined(_WIN32)
+  if (mapping->view != NULL)
+    UnmapViewOfFile(mapping->view);
+  if (mapping->mapping != NULL)
+    CloseHandle(mapping->mapping);
+  if (mapping->file != INVALID_HANDLE_VALUE)
+    CloseHandle(mapping->file);
+#else
+  if (mapping->view != NULL)
+    munmap(mapping->view, mapping->size);
+  if (mapping->file >= 0)
+    close(mapping->file);
+#endif
+  mapping->view = NULL;
+}
+
+int isValidFocusFile(FocusMapping *mapping)
+{
+  FocusHeader *header = (FocusHeader *)mapping->view;
+  return memcmp(header->magic, FOCUS_MAGIC, 8) == 0 && header->version == FOCUS_VERSION && header->header_size == sizeof(FocusHeader) && header->record_size == sizeof(FocusRecord) && header->capacity > 0 && mapping->size >= sizeof(FocusHeader) + (size_t)header->capacity * sizeof(FocusRecord);
+}
+
+void appendFocusRecord(FocusHeader *header, HWND h, DWORD pid, uint32_t title_hash)
+{
+  int64_t index = header->write_count;
+  volatile FocusRecord *record = (volatile FocusRecord *)((char *)header + sizeof(FocusHeader)) + (size_t)(index % header->capacity);
+  record->sequence = 0;
+  FOCUS_BARRIER();
+  record->time = getWallClockMilliseconds();
+  record->handle = (int64_t)h;
+  record->pid = (uint32_t)pid;
+  record->title_hash = title_hash;
+  FOCUS_BARRIER();
+  record->sequence = index + 1;
+  FOCUS_BARRIER();
+  header->write_count = index + 1;
+  focus_record_count++;
+}
+
+// Appends a record for each change of the foreground window until the backend stops reporting events, returns an exit code
+int recordFocus()
+{
+  FocusMapping mapping;
+  FocusHeader *header;
+  HWND last = NULL;
+  HWND h;
+  DWORD pid;
+  uint32_t title_hash;
+  uint32_t last_title_hash = 0;
+  int is_first = 1;
+  int is_rescan;
+  size_t length;
+  if (!openFocusMapping(&mapping, focus_path, 1))
+  {
+    closeFocusMapping(&mapping);
+    writeOutput("Error: Could not map the focus history file \"%s\"\n", focus_path);
+    return 1;
+  }
+  header = (FocusHeader *)mapping.view;
+  if (!isValidFocusFile(&mapping) || header->capacity != FOCUS_CAPACITY)
+  {
+    // The magic is written last so that a reader never accepts a header that is being initialized
+    memset(mapping.view, 0, mapping.size);
+    header->version = FOCUS_VERSION;
+    header->header_size = sizeof(FocusHeader);
+    header->record_size = sizeof(FocusRecord);
+    header->capacity = FOCUS_CAPACITY;
+    header->created = getWallClockMilliseconds();
+    FOCUS_BARRIER();
+    memcpy(header->magic, FOCUS_MAGIC, 8);
+  }
+  for (;;)
+  {
+    h = backendGetForegroundWindow();
+    pid = 0;
+    title_hash = 0;
+    if (h != NULL && backendIsWindow(h))
+    {
+      backendGetWindowThreadProcessId(h, &pid);
+      length = backendGetWindowText(h, title, MIDDLE_BUFFER_SIZE);
+      title_hash = hashWatchTitle(title, length);
+    }
+    else
+      h = NULL;
+    if (is_first || h != last || title_hash != last_title_hash)
+      appendFocusRecord(header, h, pid, title_hash);
+    is_first = 0;
+    last = h;
+    last_title_hash = title_hash;
+    is_rescan = 0;
+    if (backendWaitForWindowEvents(NULL, watch_event_list, WATCH_EVENT_LIST_SIZE, (int)watch_interval, &is_rescan) < 0)
+      break;
+  }
+  closeFocusMapping(&mapping);
+  return 0;
+}
+
+void putFocusRecordJson(FocusRecord *record, int is_first, int64_t duration)
+{
+  if (output_format == FORMAT_JSON && !is_first)
+    putJsonBytes(&output_writer, ", ", 2);
+  putJsonChar(&output_writer, '{');
+  putJsonKey(&output_writer, 1, "time");
+  putJsonInteger(&output_writer, record->time);
+  putJsonKey(&output_writer, 0, "handle");
+  putJsonInteger(&output_writer, record->handle);
+  putJsonKey(&output_writer, 0, "pid");
+  putJsonInteger(&output_writer, (int64_t)record->pid);
+  putJsonKey(&output_writer, 0, "title_hash");
+  putJsonInteger(&output_writer, (int64_t)record->title_hash);
+  putJsonKey(&output_writer, 0, "duration");
+  if (duration < 0)
+    putJsonText(&output_writer, "null");
+  else
+    putJsonInteger(&output_writer, duration);
+  putJsonChar(&output_writer, '}');
+  if (output_format == FORMAT_NDJSON)
+    putJsonChar(&output_writer, '\n');
+}
+
+// Reads the time of --focus-since in milliseconds since the Unix epoch, or before now when it is negative, returns zero when invalid
+int parseFocusSince(const char *text)
+{
+  char *end;
+  errno = 0;
+  focus_since = strtoll(text, &end, 10);
+  if (end == text || *end != '\0' || errno == ERANGE)
+  {
+    writeOutput("Error: Invalid focus history time \"%s\" (expected milliseconds since the Unix epoch, or negative milliseconds before now)\n", text);
+    return 0;
+  }
+  is_option_focus_since = 1;
+  return 1;
+}
+
+// Lists the records of the windows that had the focus at or after a time, negative times are relative to now, returns an exit code
+int writeFocusHistory(int64_t since)
+{
+  FocusMapping mapping;
+  FocusHeader *header;
+  volatile FocusRecord *records;
+  volatile FocusRecord *slot;
+  FocusRecord record;
+  FocusRecord pending;
+  int64_t count;
+  int64_t index;
+  int64_t oldest;
+  int64_t sequence;
+  int is_pending = 0;
+  int is_first = 1;
+  if (!openFocusMapping(&mapping, focus_path, 0) || !isValidFocusFile(&mapping))
+  {
+    closeFocusMapping(&mapping);
+    writeOutput("Error: Could not read the focus history file \"%s\"\n", focus_path);
+    return 1;
+  }
+  if (since < 0)
+    since += getWallClockMilliseconds();
+  header = (FocusHeader *)mapping.view;
+  records = (volatile FocusRecord *)(mapping.view + sizeof(FocusHeader));
+  count = header->write_count;
+  FOCUS_BARRIER();
+  if (output_format == FORMAT_JSON)
+    putJsonChar(&output_writer, '[');
+  for (index = count > header->capacity ? count - header->capacity : 0; index < count; index++)
+  {
+    slot = &records[index % header->capacity];
+    sequence = slot->sequence;
+    FOCUS_BARRIER();
+    record.time = slot->time;
+    record.handle = slot->handle;
+    record.pid = slot->pid;
+    record.title_hash = slot->title_hash;
+    FOCUS_BARRIER();
+    // The recorder overwrote the slot while it was copied, so the reader fell a lap behind: the record before it is dropped
+    // since its duration is not known, and the reading resumes at the oldest record still in the file
+    if (sequence != index + 1 || slot->sequence != index + 1)
+    {
+      focus_skipped_count += is_pending ? 2 : 1;
+      is_pending = 0;
+      oldest = header->write_count - header->capacity;
+      if (oldest > index + 1)
+      {
+        focus_skipped_count += (oldest < count ? oldest : count) - index - 1;
+        index = oldest - 1;
+      }
+      continue;
+    }
+    // A record is written once the next one tells whether its window still had the focus at the time
+    if (is_pending && record.time > since)
+    {
+      putFocusRecordJson(&pending, is_first, record.time - pending.time);
+      is_first = 0;
+      focus_record_count++;
+    }
+    pending = record;
+    is_pending = 1;
+  }
+  if (is_pending)
+  {
+    putFocusRecordJson(&pending, is_first, -1);
+    focus_record_count++;
+  }
+  if (output_format == FORMAT_JSON)
+    putJsonChar(&output_writer, ']');
+  closeFocusMapping(&mapping);
+  return 0;
+}
+
+// Writes the "focus" section of the statistics object
+void writeFocusStats(JsonWriter *writer)
+{
+  beginStatsSection(writer, "focus");
+  putStatsCounter(writer, 1, "records", focus_record_count);
+  putStatsCounter(writer, 0, "skipped", focus_skipped_count);
+  putJsonChar(writer, '}');
+}
+
+void resetFocus()
+{
+  focus_mode = FOCUS_NONE;
+  focus_path[0] = '\0';
+  is_option_focus_since = 0;
+  focus_since = INT64_MIN;
+  focus_record_count = 0;
+  focus_skipped_count = 0;
+}
@@ -0,0 +1,184 @@
+// Handle streams: reads the window handles of --handles-from from a file or stdin, without a limit on their number.
+//
+// Handles are read one per line, in decimal or in hexadecimal with a "0x" prefix, and blank lines and lines starting with
+// "#" are skipped. Each handle is passed on as soon as its line is read, so results are written while the list is still
+// being read, and handles that were already read are skipped using an open-addressing set. Lines that are not handles
+// and handles that are not windows are reported without stopping the stream.
+
+#include <sys/stat.h>
+#include <errno.h>
+
+#if !defined(S_ISREG)
+#define S_ISREG(mode) (((mode) & S_IFMT) == S_IFREG)
+#endif
+
+#define HANDLE_LINE_SIZE 128
+#define HANDLE_SET_INITIAL_SIZE 1024
+
+// Receives a window of the stream and returns zero to continue or an exit code to stop it
+typedef int (*HandleVisitFunction)(HWND h);
+// Receives a line that is not a handle (handle 0) or a handle that is not a window, with its line number (0 for --handle)
+typedef void (*HandleErrorFunction)(int64_t handle, int64_t line, const char *error);
+
+typedef struct
+{
+  uint64_t *slots;
+  size_t size;
+  size_t count;
+} HandleSet;
+
+int is_filter_handle_stream = 0;
+char handle_stream_path[MIDDLE_BUFFER_SIZE];
+
+int64_t handle_read_count = 0;
+int64_t handle_duplicate_count = 0;
+int64_t handle_invalid_count = 0;
+
+void freeHandleSet(HandleSet *set)
+{
+  free(set->slots);
+  set->slots = NULL;
+  set->size = 0;
+  set->count = 0;
+}
+
+size_t getHandleSlot(uint64_t handle, size_t size)
+{
+  return (size_t)((handle * 0x9E3779B97F4A7C15ull) >> 32) & (size - 1);
+}
+
+// Adds a non-zero handle, returns 1 when it was added, 0 when it was already in the set and -1 when memory is exhausted
+int insertHandleSet(HandleSet *set, uint64_t handle)
+{
+  uint64_t *slots;
+  size_t size;
+  size_t slot;
+  size_t i;
+  if (set->count * 2 >= set->size)
+  {
+    // The table is kept at most half full and rehashed into twice the size
+    size = set->size == 0 ? HANDLE_SET_INITIAL_SIZE : set->size * 2;
+    slots = (uint64_t *)calloc(size, sizeof(uint64_t));
+    if (slots == NULL)
+      return -1;
+    for (i = 0; i < set->size; i++)
+    {
+      if (set->slots[i] == 0)
+        continue;
+      for (slot = getHandleSlot(set->slots[i], size); slots[slot] != 0; slot = (slot + 1) & (size - 1))
+      {
+      }
+      slots[slot] = set->slots[i];
+    }
+    free(set->slots);
+    set->slots = slots;
+    set->size = size;
+  }
+  for (slot = getHandleSlot(handle, set->size); set->slots[slot] != 0; slot = (slot + 1) & (set->size - 1))
+  {
+    if (set->slots[slot] == handle)
+      return 0;
+  }
+  set->slots[slot] = handle;
+  set->count++;
+  return 1;
+}
+
+// Passes a handle to the visitor unless it was already read or is not a window, returns an exit code
+int visitStreamHandle(HandleSet *set, int64_t handle, int64_t line, HandleVisitFunction visit, HandleErrorFunction report)
+{
+  int is_added;
+  handle_read_count++;
+  is_added = handle != 0 ? insertHandleSet(set, (uint64_t)handle) : 1;
+  if (is_added < 0)
+  {
+    writeOutput("Error: Could not allocate the handle set\n");
+    return 1;
+  }
+  if (is_added == 0)
+  {
+    handle_duplicate_count++;
+    return 0;
+  }
+  if (!backendIsWindow((HWND)(intptr_t)handle))
+  {
+    handle_invalid_count++;
+    report(handle, line, "not found");
+    return 0;
+  }
+  return visit((HWND)(intptr_t)handle);
+}
+
+// Opens the file of --handles-from, or returns NULL after writing an error
+FILE *openHandleStream()
+{
+  FILE *file = (handle_stream_path[0] == '-' && handle_stream_path[1] == '\0') ? stdin : fopen(handle_stream_path, "rb");
+  if (file == NULL)
+    writeOutput("Error: Could not open handle file \"%s\"\n", handle_stream_path);
+  return file;
+}
+
+// Reads the handles of the --handle arguments and then of an opened stream, which is closed, returns an exit code
+int streamHandles(FILE *file, HandleVisitFunction visit, HandleErrorFunction report)
+{
+  char line[HANDLE_LINE_SIZE];
+  HandleSet set = {NULL, 0, 0};
+  struct stat status;
+  int64_t line_number = 0;
+  int64_t handle;
+  int is_regular;
+  int is_cut;
+  int code = 0;
+  char *start;
+  char *end;
+  int i;
+  // Results of handles read from a pipe are written before waiting for the next line
+  is_regular = fstat(fileno(file), &status) == 0 && S_ISREG(status.st_mode);
+  for (i = 0; i < filter_handle_list_size && code == 0; i++)
+    code = visitStreamHandle(&set, filter_handle_list[i], 0, visit, report);
+  while (code == 0)
+  {
+    if (!is_regular && !is_output_captured)
+    {
+      flushJsonWriter(&output_writer);
+      fflush(stdout);
+    }
+    if (fgets(line, HANDLE_LINE_SIZE, file) == NULL)
+      break;
+    line_number++;
+    // The rest of a line longer than the buffer is skipped rather than read as another line
+    is_cut = skipLineRest(line, file);
+    for (start = line; *start == ' ' || *start == '\t'; start++)
+    {
+    }
+    if (*start == '\0' || *start == '\r' || *start == '\n' || *start == '#')
+      continue;
+    errno = 0;
+    handle = parseIntegerText(start, &end);
+    while (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n')
+      end++;
+    // A handle too large for 64 bits is clamped by strtoll, the line is invalid rather than read as another handle
+    if (is_cut || end == start || *end != '\0' || handle <= 0 || errno == ERANGE)
+    {
+      handle_read_count++;
+      handle_invalid_count++;
+      report(0, line_number, "invalid handle");
+      continue;
+    }
+    code = visitStreamHandle(&set, handle, line_number, visit, report);
+  }
+  if (file != stdin)
+    fclose(file);
+  freeHandleSet(&set);
+  return code;
+}
+
+// Writes the "handles" section of the statistics object
+void writeHandleStats(JsonWriter *writer)
+{
+  beginStatsSection(writer, "handles");
+  putStatsCounter(writer, 1, "read", handle_read_count);
+  putStatsCounter(writer, 0, "duplicates", handle_duplicate_count);
+  putStatsCounter(writer, 0, "invalid", handle_invalid_count);
+  putJsonChar(writer, '}');
+}
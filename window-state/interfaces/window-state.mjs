@@ -1,6 +1,7 @@
 let UTILITY_EXECUTABLE_PATH = "../window-state.exe";
 
 import child_process from "node:child_process";
+import fs from "node:fs";
 
 async function example() {
   console.log("window-state example - Node.js (ES Modules)");
@@ -94,28 +95,186 @@ export async function getForegroundWindowState() {
 
 /**
  * Retrieves the states of children windows from the desktop.
+ * @param {object} [config] - Sorting and page of the windows, which are selected by the utility before they are read.
+ * @param {"area" | "visible-area" | "z" | "title" | "pid"} [config.sort] - Order of the windows (largest first for areas).
+ * @param {number} [config.limit] - Number of windows to return.
+ * @param {number} [config.offset] - Number of windows to skip.
  * @returns {Promise<WindowData[]>} An array of window data for each child window.
  */
-export async function getDesktopChildrenStates() {
-  const text = await executeWindowStateUtility(["--desktop"]);
-  if (text.length <= 2 || !text.startsWith("[") || !text.endsWith("]")) {
+export async function getDesktopChildrenStates(config = {}) {
+  const args = ["--desktop", "--format", "binary"];
+  if (config.sort !== undefined) {
+    args.push("--sort", config.sort);
+  }
+  if (config.limit !== undefined) {
+    args.push("--limit", config.limit.toString());
+  }
+  if (config.offset !== undefined) {
+    args.push("--offset", config.offset.toString());
+  }
+  const list = decodeWindowStateRecords(
+    await executeWindowStateUtilityBuffer(args)
+  );
+  // A page may be empty, the full list never is
+  if (config.limit === undefined && config.offset === undefined && (!list.length || !list[0])) {
+    throw new Error("Window state list is empty");
+  }
+  return list;
+}
+
+/**
+ * Retrieves the number of windows, visible windows and topmost windows and the total area of the desktop children per group.
+ * @param {"executable" | "pid" | "class"} groupBy - Attribute the windows are grouped by.
+ * @returns {Promise<object[]>} An array with an object for each group, keyed by "executable", "pid" or "classname".
+ */
+export async function getDesktopGroups(groupBy) {
+  const text = await executeWindowStateUtility(["--desktop", "--group-by", groupBy]);
+  if (!text.startsWith("[") || !text.endsWith("]")) {
     throw new Error(`Window state failed: ${JSON.stringify(text)}`);
   }
-  /** @type {WindowData[]} */
+  return JSON.parse(text);
+}
+
+/**
+ * Writes the pixels of a window to a PNG file, or to a raw file of BGRA rows when the path ends with ".bgra" or ".raw".
+ * @param {number} handle - Handle of the window.
+ * @param {string} path - Path of the file to write.
+ * @returns {Promise<{handle: number, path: string, width: number, height: number, bytes: number}>} The size of the capture and of its file.
+ */
+export async function captureWindow(handle, path) {
+  const text = await executeWindowStateUtility(["--handle", handle, "--capture", path]);
   const list = JSON.parse(text);
-  if (!list.length || !list[0]) {
-    throw new Error("Window state list is empty");
+  if (!list.length || list[0].error) {
+    throw new Error(`Window capture failed: ${text}`);
   }
-  if (!(list instanceof Array) || typeof list[0] !== "object") {
-    throw new Error(`Window state list is invalid: ${JSON.stringify(list)}`);
+  return list[0];
+}
+
+const FIELD_HANDLE = 0x000001;
+const FIELD_TITLE = 0x000002;
+const FIELD_MODULE = 0x000004;
+const FIELD_EXECUTABLE = 0x000008;
+const FIELD_CLASSNAME = 0x000010;
+const FIELD_PARENT = 0x000020;
+const FIELD_SIBLING = 0x000040;
+const FIELD_CHILD = 0x000080;
+const FIELD_PID = 0x000100;
+const FIELD_THREAD = 0x000200;
+const FIELD_STYLE = 0x000400;
+const FIELD_EXSTYLE = 0x000800;
+const FIELD_VISIBLE = 0x001000;
+const FIELD_UNICODE = 0x002000;
+const FIELD_VISIBLE_ALT = 0x040000;
+const FIELD_RECT = 0x400000;
+/** @type {[number, string][]} */
+const RECORD_FLAG_KEYS = [
+  [0x004000, "popup"],
+  [0x008000, "contained"],
+  [0x010000, "bordered"],
+  [0x020000, "scrollable"],
+  [0x080000, "minimized"],
+  [0x100000, "topmost"],
+  [0x200000, "transparent"],
+];
+
+/**
+ * @param {Buffer} data
+ * @param {number} strings
+ * @param {number} at
+ */
+function readRecordString(data, strings, at) {
+  const length = data.readUInt32LE(at + 4);
+  if (length === 0) {
+    return "";
   }
-  const problems = list.filter(
-    (a) => !a || typeof a.handle !== "number" || typeof a.pid !== "number"
-  );
-  if (problems.length) {
-    throw new Error(
-      `Unexpected response with invalid elements: ${JSON.stringify(problems)}`
-    );
+  const offset = strings + data.readUInt32LE(at);
+  return data.toString("utf8", offset, offset + length);
+}
+
+// Handles and styles fit in 53 bits, so they are read as two 32-bit halves instead of a BigInt
+/**
+ * @param {Buffer} data
+ * @param {number} at
+ */
+function readRecordInt64(data, at) {
+  return data.readInt32LE(at + 4) * 0x100000000 + data.readUInt32LE(at);
+}
+
+/**
+ * Decodes the output of the utility with "--format binary" into window states with the same keys of the JSON output.
+ * @param {Buffer} data - The output of the utility.
+ * @returns {WindowData[]} An array of window data for each record.
+ */
+export function decodeWindowStateRecords(data) {
+  if (data.length < 16 || data.toString("latin1", 0, 8) !== "WSRECS\r\n") {
+    throw new Error(`Window state failed: ${JSON.stringify(data.toString("utf8"))}`);
+  }
+  const recordSize = data.readUInt32LE(12);
+  const list = [];
+  let i = 16;
+  while (i + 4 <= data.length) {
+    const frameLength = data.readUInt32LE(i);
+    const r = i + 4;
+    const strings = r + recordSize;
+    if (frameLength < recordSize || r + frameLength > data.length) {
+      throw new Error(`Window state record at ${i} is truncated`);
+    }
+    const flags = data.readUInt32LE(r + 68);
+    const fields = data.readUInt32LE(r + 72);
+    /** @type {any} */
+    const state = {};
+    if (fields & FIELD_HANDLE) state.handle = readRecordInt64(data, r);
+    if (fields & FIELD_TITLE) {
+      const title = readRecordString(data, strings, r + 76);
+      if (title) state.title = title;
+    }
+    if (fields & FIELD_MODULE) {
+      const module = readRecordString(data, strings, r + 84);
+      if (module) state.module = module;
+    }
+    if (fields & FIELD_EXECUTABLE) {
+      const executable = readRecordString(data, strings, r + 92);
+      if (executable) state.executable = executable;
+    }
+    if (fields & FIELD_CLASSNAME) {
+      const classname = readRecordString(data, strings, r + 100);
+      if (classname) state.classname = classname;
+    }
+    if (fields & FIELD_PARENT) state.parent = readRecordInt64(data, r + 8);
+    if (fields & FIELD_SIBLING) {
+      const sibling = readRecordInt64(data, r + 16);
+      if (sibling !== 0) state.sibling = sibling;
+    }
+    if (fields & FIELD_CHILD) {
+      const child = readRecordInt64(data, r + 24);
+      if (child !== 0) state.child = child;
+    }
+    if (fields & FIELD_PID) state.pid = data.readUInt32LE(r + 40);
+    if (fields & FIELD_THREAD) state.thread = data.readUInt32LE(r + 44);
+    if (fields & FIELD_STYLE) state.style = data.readInt32LE(r + 48);
+    if (fields & FIELD_EXSTYLE) state.exstyle = readRecordInt64(data, r + 32);
+    if (fields & FIELD_VISIBLE) state.visible = (flags & FIELD_VISIBLE) !== 0;
+    if (fields & FIELD_UNICODE) state.unicode = (flags & FIELD_UNICODE) !== 0;
+    for (const [field, key] of RECORD_FLAG_KEYS) {
+      if (fields & flags & field) state[key] = true;
+    }
+    if (fields & FIELD_VISIBLE_ALT && (flags & FIELD_VISIBLE_ALT) !== 0 !== ((flags & FIELD_VISIBLE) !== 0)) {
+      state.visible_alt = true;
+    }
+    if (fields & FIELD_RECT) {
+      const top = data.readInt32LE(r + 52);
+      const right = data.readInt32LE(r + 56);
+      const bottom = data.readInt32LE(r + 60);
+      const left = data.readInt32LE(r + 64);
+      if (top || right || bottom || left) {
+        state.top = top;
+        state.right = right;
+        state.bottom = bottom;
+        state.left = left;
+      }
+    }
+    list.push(state);
+    i = r + frameLength;
   }
   return list;
 }
@@ -224,12 +383,259 @@ export async function setWindowState(
   throw new Error(`Window state returned: ${JSON.stringify(text)}`);
 }
 
+/**
+ * @typedef {object} UtilitySession
+ * @property {import("node:child_process").ChildProcessWithoutNullStreams} child
+ * @property {number} nextId
+ * @property {Map<number, { resolve: (data: Buffer) => void, reject: (err: Error) => void }>} pending
+ */
+
+/** @type {UtilitySession | null} */
+let utilitySession = null;
+
+/**
+ * Starts a persistent utility process in serve mode so that the following calls reuse it instead of spawning a process per call.
+ */
+export function startWindowStateSession() {
+  if (utilitySession) {
+    return;
+  }
+  const command = UTILITY_EXECUTABLE_PATH;
+  const child = child_process.spawn(command, ["--serve"], {
+    shell: false,
+    stdio: ["pipe", "pipe", "ignore"],
+  });
+  /** @type {UtilitySession} */
+  const session = { child, nextId: 1, pending: new Map() };
+  let received = Buffer.alloc(0);
+  child.stdout.on("data", (data) => {
+    received = Buffer.concat([received, data]);
+    while (true) {
+      const headerEnd = received.indexOf(10);
+      if (headerEnd === -1) {
+        break;
+      }
+      const header = JSON.parse(received.subarray(0, headerEnd).toString("utf8"));
+      const payloadEnd = headerEnd + 1 + header.length;
+      if (received.length < payloadEnd + 1) {
+        break;
+      }
+      const payload = received.subarray(headerEnd + 1, payloadEnd);
+      received = received.subarray(payloadEnd + 1);
+      const request = session.pending.get(header.id);
+      if (!request) {
+        continue;
+      }
+      session.pending.delete(header.id);
+      if (header.code === 0) {
+        request.resolve(payload);
+      } else {
+        const text = payload.toString("utf8").trim();
+        request.reject(new Error(text || `Error code ${header.code}`));
+      }
+    }
+  });
+  /** @param {Error} err */
+  const close = (err) => {
+    for (const request of session.pending.values()) {
+      request.reject(err);
+    }
+    session.pending.clear();
+    if (utilitySession === session) {
+      utilitySession = null;
+    }
+  };
+  child.on("error", (err) =>
+    close(
+      err["code"] === "ENOENT"
+        ? new Error(`Could not find executable at "${command}"`, {
+            cause: err,
+          })
+        : err
+    )
+  );
+  child.on("exit", (exit) =>
+    close(new Error(`Utility session exited with code ${exit}`))
+  );
+  utilitySession = session;
+}
+
+/**
+ * Stops the persistent utility process, pending requests are still answered before it exits.
+ */
+export function stopWindowStateSession() {
+  if (!utilitySession) {
+    return;
+  }
+  utilitySession.child.stdin.end();
+  utilitySession = null;
+}
+
+/**
+ * Send a request to the persistent utility process, requests are tagged by id so they can be pipelined.
+ * @param {UtilitySession} session
+ * @param {string[]} args
+ * @returns {Promise<string>}
+ */
+function requestWindowStateSession(session, args) {
+  return new Promise((resolve, reject) => {
+    const id = session.nextId++;
+    session.pending.set(id, { resolve, reject });
+    session.child.stdin.write(JSON.stringify({ id, args }) + "\n");
+  });
+}
+
+/**
+ * Starts the utility in watch mode and calls the listener for each window event until the returned function is called.
+ * @param {(event: object) => void} listener
+ * @param {Array<number | string | { handle: number }>} [args] Scope and filter arguments of the watched windows (e.g. ["--parent", 1234] or ["--title", "Chrome"]).
+ * @returns {() => void}
+ */
+export function watchWindowStates(listener, args = []) {
+  const child = child_process.spawn(
+    UTILITY_EXECUTABLE_PATH,
+    [
+      "--watch",
+      ...args.map((a) =>
+        typeof a === "object" && typeof a.handle === "number"
+          ? a.handle.toString()
+          : a.toString()
+      ),
+    ],
+    {
+      shell: false,
+      stdio: ["ignore", "pipe", "ignore"],
+    }
+  );
+  let received = "";
+  child.stdout.on("data", (data) => {
+    received += data.toString("utf8");
+    const lines = received.split("\n");
+    received = lines.pop() || "";
+    for (const line of lines) {
+      if (line.trim().length) {
+        listener(JSON.parse(line));
+      }
+    }
+  });
+  return () => {
+    child.kill();
+  };
+}
+
+/**
+ * Starts the utility as a publisher that keeps the window list in shared memory under a name until the returned function is called.
+ * @param {string} name
+ * @param {Array<number | string | { handle: number }>} [args] Scope, filter and format arguments of the published list (e.g. ["--desktop", "--format", "binary"]).
+ * @returns {() => void}
+ */
+export function publishWindowStates(name, args = ["--desktop"]) {
+  const child = child_process.spawn(
+    UTILITY_EXECUTABLE_PATH,
+    [
+      "--publish",
+      name,
+      ...args.map((a) =>
+        typeof a === "object" && typeof a.handle === "number"
+          ? a.handle.toString()
+          : a.toString()
+      ),
+    ],
+    {
+      shell: false,
+      stdio: ["ignore", "ignore", "ignore"],
+    }
+  );
+  return () => {
+    child.kill();
+  };
+}
+
+/**
+ * Decodes a published list in the JSON (0), NDJSON (1) or binary (2) format.
+ * @param {Buffer} data
+ * @param {number} format
+ */
+function decodePublishedWindowStates(data, format) {
+  if (format === 2) {
+    return decodeWindowStateRecords(data);
+  }
+  const text = data.toString("utf8");
+  if (format === 1) {
+    return text
+      .split("\n")
+      .filter((line) => line.trim().length)
+      .map((line) => JSON.parse(line));
+  }
+  return JSON.parse(text);
+}
+
+/**
+ * Reads the window list kept in shared memory by a publisher without querying the window system.
+ * On Linux the region is read from /dev/shm under its sequence lock, elsewhere the utility reads it with "--read-published".
+ * @param {string} name
+ */
+export async function readPublishedWindowStates(name) {
+  const path = `/dev/shm/window-state-${name}`;
+  if (process.platform === "win32" || !fs.existsSync(path)) {
+    const data = await executeWindowStateUtilityBuffer(["--read-published", name]);
+    const format = data.toString("latin1", 0, 8) === "WSRECS\r\n" ? 2 : data[0] === 0x5b ? 0 : 1;
+    return decodePublishedWindowStates(data, format);
+  }
+  const file = fs.openSync(path, "r");
+  try {
+    const header = Buffer.alloc(64);
+    for (let attempt = 0; attempt < 4096; attempt++) {
+      fs.readSync(file, header, 0, 64, 0);
+      if (header.toString("latin1", 0, 8) !== "WSPUBLSH") {
+        throw new Error(`No window list is published as "${name}"`);
+      }
+      // The sequence is odd while the publisher writes the list, and changes once it is written
+      const sequence = readRecordInt64(header, 24);
+      if (sequence === 0) {
+        throw new Error(`No window list was published as "${name}" yet`);
+      }
+      if (sequence % 2 === 1) {
+        continue;
+      }
+      const data = Buffer.alloc(readRecordInt64(header, 32));
+      fs.readSync(file, data, 0, data.length, 64);
+      fs.readSync(file, header, 0, 8, 24);
+      if (readRecordInt64(header, 0) === sequence) {
+        return decodePublishedWindowStates(data, header.readUInt32LE(48));
+      }
+    }
+    throw new Error(`The window list published as "${name}" kept changing while it was read`);
+  } finally {
+    fs.closeSync(file);
+  }
+}
+
 /**
  * Execute the utility process with specified arguments
  * @param {string[]} args
  */
-function executeWindowStateUtility(args) {
-  /** @type {Promise<string>} */
+async function executeWindowStateUtility(args) {
+  return (await executeWindowStateUtilityBuffer(args)).toString("utf8").trim();
+}
+
+/**
+ * Execute the utility process with specified arguments and return its raw output
+ * @param {string[]} args
+ * @returns {Promise<Buffer>}
+ */
+function executeWindowStateUtilityBuffer(args) {
+  if (utilitySession) {
+    return requestWindowStateSession(
+      utilitySession,
+      args.map((a) =>
+        typeof a === "object" && typeof a.handle === "number"
+          ? a.handle.toString()
+          : a.toString()
+      )
+    );
+  }
+  /** @type {Promise<Buffer>} */
   const promise = new Promise((resolve, reject) => {
     try {
       const command = UTILITY_EXECUTABLE_PATH;
@@ -246,8 +652,9 @@ function executeWindowStateUtility(args) {
         }
       );
       const chunks = [];
+      const errors = [];
       child.stdout.on("data", (data) => chunks.push(data));
-      child.stderr.on("data", (data) => chunks.push(data));
+      child.stderr.on("data", (data) => errors.push(data));
       child.on("error", (err) =>
         reject(
           err["code"] === "ENOENT"
@@ -258,10 +665,11 @@ function executeWindowStateUtility(args) {
         )
       );
       child.on("exit", (exit) => {
-        const text = Buffer.concat(chunks).toString("utf8").trim();
-        return exit === 0
-          ? resolve(text)
-          : reject(new Error(text || `Error code ${exit}`));
+        if (exit === 0) {
+          return resolve(Buffer.concat(chunks));
+        }
+        const text = Buffer.concat([...chunks, ...errors]).toString("utf8").trim();
+        return reject(new Error(text || `Error code ${exit}`));
       });
     } catch (err) {
       reject(err);
@@ -4,6 +4,8 @@ import subprocess
 import asyncio
 import os
 import json
+import mmap
+import struct
 
 
 async def example():
@@ -65,31 +67,140 @@ async def get_foreground_window_state():
   return WindowState(**window_data)
 
 
-async def get_desktop_children_states():
-  text = await execute_window_state_utility(["--desktop"])
-  if len(text) <= 2 or not text.startswith("[") or not text.endswith("]"):
-    raise ValueError(f"Window state failed: {json.dumps(text)}")
-  list_data = json.loads(text)
-  if not list_data or not list_data[0]:
+async def get_desktop_children_states(sort=None, limit=None, offset=None):
+  """
+  Retrieves the states of the children of the desktop, sorted by "area", "visible-area", "z", "title" or "pid" and paged
+  by the utility so that only the returned windows are read.
+  """
+  args = ["--desktop", "--format", "binary"]
+  if sort is not None:
+    args.extend(["--sort", sort])
+  if limit is not None:
+    args.extend(["--limit", limit])
+  if offset is not None:
+    args.extend(["--offset", offset])
+  data = await execute_window_state_utility_bytes(args)
+  list_data = decode_window_state_records(data)
+  # A page may be empty, the full list never is
+  if not list_data and limit is None and offset is None:
     raise ValueError("Window state list is empty")
-  if not isinstance(list_data, list) or not isinstance(list_data[0], dict):
-    raise ValueError(f"Window state list is invalid: {json.dumps(list_data)}")
-  problems = [
-    a
-    for a in list_data
-    if not a
-    or not isinstance(a.get("handle"), int)
-    or not isinstance(a.get("pid"), int)
-  ]
-  if problems:
-    raise ValueError(
-      f"Unexpected response with invalid elements: {json.dumps(problems)}"
-    )
-  window_states = []
-  for window_data in list_data:
-    window_state = WindowState(**window_data)
-    window_states.append(window_state)
-  return window_states
+  return [WindowState(**window_data) for window_data in list_data]
+
+
+async def get_desktop_groups(group_by):
+  """
+  Retrieves the number of windows, visible windows and topmost windows and the total area of the desktop children per
+  "executable", "pid" or "class", as dicts keyed by "executable", "pid" or "classname".
+  """
+  text = await execute_window_state_utility(["--desktop", "--group-by", group_by])
+  if not text.startswith("[") or not text.endswith("]"):
+    raise ValueError(f"Window state failed: {json.dumps(text)}")
+  return json.loads(text)
+
+
+async def capture_window(handle, path):
+  """
+  Writes the pixels of a window to a PNG file, or to a raw file of BGRA rows when the path ends with ".bgra" or ".raw",
+  and returns a dict with the "handle", "path", "width", "height" and "bytes" of the capture.
+  """
+  text = await execute_window_state_utility(["--handle", handle, "--capture", path])
+  captures = json.loads(text)
+  if not captures or "error" in captures[0]:
+    raise ValueError(f"Window capture failed: {text}")
+  return captures[0]
+
+
+FIELD_HANDLE = 0x000001
+FIELD_TITLE = 0x000002
+FIELD_MODULE = 0x000004
+FIELD_EXECUTABLE = 0x000008
+FIELD_CLASSNAME = 0x000010
+FIELD_PARENT = 0x000020
+FIELD_SIBLING = 0x000040
+FIELD_CHILD = 0x000080
+FIELD_PID = 0x000100
+FIELD_THREAD = 0x000200
+FIELD_STYLE = 0x000400
+FIELD_EXSTYLE = 0x000800
+FIELD_VISIBLE = 0x001000
+FIELD_UNICODE = 0x002000
+FIELD_VISIBLE_ALT = 0x040000
+FIELD_RECT = 0x400000
+RECORD_FLAG_KEYS = [
+  (0x004000, "popup"),
+  (0x008000, "contained"),
+  (0x010000, "bordered"),
+  (0x020000, "scrollable"),
+  (0x080000, "minimized"),
+  (0x100000, "topmost"),
+  (0x200000, "transparent"),
+]
+RECORD_STRUCT = struct.Struct("<qqqqqIIiiiiiIIIIIIIIIII")
+
+
+def decode_window_state_records(data):
+  """
+  Decodes the output of the utility with "--format binary" into dicts with the same keys of the JSON output.
+  """
+  if len(data) < 16 or data[:8] != b"WSRECS\r\n":
+    raise ValueError(f"Window state failed: {json.dumps(data.decode('utf-8', 'replace'))}")
+  record_size = struct.unpack_from("<I", data, 12)[0]
+  if record_size < RECORD_STRUCT.size:
+    raise ValueError(f"Window state record size {record_size} is not supported")
+  view = memoryview(data)
+  list_data = []
+  i = 16
+  while i + 4 <= len(data):
+    frame_length = struct.unpack_from("<I", data, i)[0]
+    r = i + 4
+    strings = r + record_size
+    if frame_length < record_size or r + frame_length > len(data):
+      raise ValueError(f"Window state record at {i} is truncated")
+    (
+      handle, parent, sibling, child, exstyle, pid, thread, style, top, right, bottom, left, flags, fields,
+      title_offset, title_length, module_offset, module_length, executable_offset, executable_length,
+      classname_offset, classname_length, _,
+    ) = RECORD_STRUCT.unpack_from(data, r)
+    state = {"handle": handle} if fields & FIELD_HANDLE else {}
+    for field, key, offset, length in (
+      (FIELD_TITLE, "title", title_offset, title_length),
+      (FIELD_MODULE, "module", module_offset, module_length),
+      (FIELD_EXECUTABLE, "executable", executable_offset, executable_length),
+      (FIELD_CLASSNAME, "classname", classname_offset, classname_length),
+    ):
+      if fields & field and length > 0:
+        state[key] = str(view[strings + offset : strings + offset + length], "utf-8")
+    if fields & FIELD_PARENT:
+      state["parent"] = parent
+    if fields & FIELD_SIBLING and sibling != 0:
+      state["sibling"] = sibling
+    if fields & FIELD_CHILD and child != 0:
+      state["child"] = child
+    if fields & FIELD_PID:
+      state["pid"] = pid
+    if fields & FIELD_THREAD:
+      state["thread"] = thread
+    if fields & FIELD_STYLE:
+      state["style"] = style
+    if fields & FIELD_EXSTYLE:
+      state["exstyle"] = exstyle
+    if fields & FIELD_VISIBLE:
+      state["visible"] = bool(flags & FIELD_VISIBLE)
+    if fields & FIELD_UNICODE:
+      state["unicode"] = bool(flags & FIELD_UNICODE)
+    for field, key in RECORD_FLAG_KEYS:
+      if fields & flags & field:
+        state[key] = True
+    if fields & FIELD_VISIBLE_ALT and bool(flags & FIELD_VISIBLE_ALT) != bool(flags & FIELD_VISIBLE):
+      state["visible_alt"] = True
+    if fields & FIELD_RECT and (top or right or bottom or left):
+      state["top"] = top
+      state["right"] = right
+      state["bottom"] = bottom
+      state["left"] = left
+    list_data.append(state)
+    i = r + frame_length
+  return list_data
 
 
 async def get_window_state(handle):
@@ -311,7 +422,219 @@ class WindowState:
     }
 
 
+utility_session = None
+
+
+async def start_window_state_session():
+  """
+  Starts a persistent utility process in serve mode so that the following calls reuse it instead of spawning a process per call.
+  """
+  global utility_session
+  if utility_session is not None:
+    return
+  if not os.path.exists(UTILITY_EXECUTABLE_PATH):
+    raise FileNotFoundError(
+      f"Executable file '{UTILITY_EXECUTABLE_PATH}' not found."
+    )
+  process = await asyncio.create_subprocess_exec(
+    UTILITY_EXECUTABLE_PATH,
+    "--serve",
+    stdin=subprocess.PIPE,
+    stdout=subprocess.PIPE,
+    stderr=subprocess.DEVNULL,
+  )
+  session = {"process": process, "next_id": 1, "pending": {}}
+  session["reader"] = asyncio.ensure_future(read_window_state_session(session))
+  utility_session = session
+
+
+async def stop_window_state_session():
+  """
+  Stops the persistent utility process, pending requests are still answered before it exits.
+  """
+  global utility_session
+  if utility_session is None:
+    return
+  session = utility_session
+  utility_session = None
+  session["process"].stdin.close()
+  await session["reader"]
+  await session["process"].wait()
+
+
+async def read_window_state_session(session):
+  """
+  Reads the framed responses of the persistent utility process and resolves the pending request with the same id.
+  """
+  global utility_session
+  process = session["process"]
+  try:
+    while True:
+      header_line = await process.stdout.readline()
+      if not header_line:
+        break
+      header = json.loads(header_line)
+      payload = await process.stdout.readexactly(header["length"] + 1)
+      future = session["pending"].pop(header["id"], None)
+      if future is None or future.done():
+        continue
+      data = payload[:-1]
+      if header["code"] == 0:
+        future.set_result(data)
+      else:
+        future.set_exception(
+          Exception(data.decode("utf-8").strip() or f"Error code {header['code']}")
+        )
+  finally:
+    for future in session["pending"].values():
+      if not future.done():
+        future.set_exception(Exception("Utility session exited"))
+    session["pending"].clear()
+    if utility_session is session:
+      utility_session = None
+
+
+async def request_window_state_session(session, args):
+  """
+  Send a request to the persistent utility process, requests are tagged by id so they can be pipelined.
+  """
+  request_id = session["next_id"]
+  session["next_id"] += 1
+  future = asyncio.get_running_loop().create_future()
+  session["pending"][request_id] = future
+  line = json.dumps({"id": request_id, "args": args}, ensure_ascii=False) + "\n"
+  session["process"].stdin.write(line.encode("utf-8"))
+  await session["process"].stdin.drain()
+  return await future
+
+
+async def watch_window_states(listener, args=[]):
+  """
+  Runs the utility in watch mode and calls the listener with each window event until the task is cancelled.
+  """
+  args = [str(arg) if not isinstance(arg, (str, bytes)) else arg for arg in args]
+  process = await asyncio.create_subprocess_exec(
+    UTILITY_EXECUTABLE_PATH,
+    "--watch",
+    *args,
+    stdout=subprocess.PIPE,
+    stderr=subprocess.DEVNULL,
+  )
+  try:
+    while True:
+      line = await process.stdout.readline()
+      if not line:
+        break
+      if line.strip():
+        listener(json.loads(line))
+  finally:
+    if process.returncode is None:
+      process.kill()
+    await process.wait()
+
+
+
+async def publish_window_states(name, args=["--desktop"]):
+  """
+  Runs the utility as a publisher that keeps the window list in shared memory under a name until the task is cancelled.
+  """
+  args = [str(arg) if not isinstance(arg, (str, bytes)) else arg for arg in args]
+  process = await asyncio.create_subprocess_exec(
+    UTILITY_EXECUTABLE_PATH,
+    "--publish",
+    name,
+    *args,
+    stdout=subprocess.DEVNULL,
+    stderr=subprocess.DEVNULL,
+  )
+  try:
+    await process.wait()
+  finally:
+    if process.returncode is None:
+      process.kill()
+      await process.wait()
+
+
+def decode_published_window_states(data, format):
+  """
+  Decodes a published list in the JSON (0), NDJSON (1) or binary (2) format.
+  """
+  if format == 2:
+    list_data = decode_window_state_records(data)
+  elif format == 1:
+    list_data = [json.loads(line) for line in data.splitlines() if line.strip()]
+  else:
+    list_data = json.loads(data)
+  # Keys that are not attributes of the window state, such as "visible_area", are not kept
+  code = WindowState.__init__.__code__
+  keys = code.co_varnames[1:code.co_argcount]
+  return [WindowState(**{key: value for key, value in window_data.items() if key in keys}) for window_data in list_data]
+
+
+def open_published_region(name):
+  """
+  Maps the shared memory region of a publisher for reading, or returns None when it cannot be mapped directly.
+  """
+  if os.name == "nt":
+    tagname = f"Local\\window-state-{name}"
+    header = mmap.mmap(-1, 64, tagname=tagname, access=mmap.ACCESS_READ)
+    try:
+      if header[:8] != b"WSPUBLSH":
+        return None
+      capacity = struct.unpack_from("<Q", header, 16)[0]
+    finally:
+      header.close()
+    return mmap.mmap(-1, 64 + capacity, tagname=tagname, access=mmap.ACCESS_READ)
+  path = f"/dev/shm/window-state-{name}"
+  if not os.path.exists(path):
+    return None
+  with open(path, "rb") as file:
+    return mmap.mmap(file.fileno(), 0, access=mmap.ACCESS_READ)
+
+
+async def read_published_window_states(name):
+  """
+  Reads the window list kept in shared memory by a publisher without querying the window system, under the sequence lock
+  of the region. Systems without /dev/shm read it through the utility with "--read-published".
+  """
+  region = open_published_region(name)
+  if region is None:
+    if os.name == "nt":
+      raise ValueError(f"No window list is published as {json.dumps(name)}")
+    data = await execute_window_state_utility_bytes(["--read-published", name])
+    format = 2 if data[:8] == b"WSRECS\r\n" else 0 if data[:1] == b"[" else 1
+    return decode_published_window_states(data, format)
+  try:
+    if region[:8] != b"WSPUBLSH":
+      raise ValueError(f"No window list is published as {json.dumps(name)}")
+    for _ in range(4096):
+      # The sequence is odd while the publisher writes the list, and changes once it is written
+      sequence = struct.unpack_from("<Q", region, 24)[0]
+      if sequence == 0:
+        raise ValueError(f"No window list was published as {json.dumps(name)} yet")
+      if sequence % 2 == 1:
+        continue
+      length, _, format = struct.unpack_from("<QqI", region, 32)
+      data = region[64:64 + length]
+      if struct.unpack_from("<Q", region, 24)[0] == sequence:
+        return decode_published_window_states(data, format)
+    raise ValueError(f"The window list published as {json.dumps(name)} kept changing while it was read")
+  finally:
+    region.close()
+
 async def execute_window_state_utility(args):
+  data = await execute_window_state_utility_bytes(args)
+  return data.decode("utf-8")
+
+
+async def execute_window_state_utility_bytes(args):
+  """
+  Executes the utility and returns its raw output, which is needed to read the binary output format.
+  """
+  if utility_session is not None:
+    args = [str(arg) if not isinstance(arg, (str, bytes)) else arg for arg in args]
+    return await request_window_state_session(utility_session, args)
+
   if not isinstance(UTILITY_EXECUTABLE_PATH, str):
     raise TypeError("Executable file path must be a string")
 
@@ -335,7 +658,7 @@ async def execute_window_state_utility(args):
   stdout, stderr = await process.communicate()
 
   if process.returncode == 0:
-    return stdout.decode("utf-8")
+    return stdout
 
   raise Exception(
     stderr.decode("utf-8").strip() or f"Error code {process.returncode}"
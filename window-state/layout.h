@@ -0,0 +1,514 @@
+// Layout: applies the position, z-order and show state of several windows in deferred positioning batches.
+//
+// The entries of a layout are read from a file, one window per line, or generated by --tile and --cascade:
+//   <handle> <x> <y> <width> <height> [z-order] [show-state]
+//   <handle> - [z-order] [show-state]                     Keeps the position and size of the window
+// The z-order is keep (default), top, bottom, topmost or notopmost and the show state is keep (default), show, hide,
+// restore, minimize or maximize. Numbers are decimal or hexadecimal with a "0x" prefix, and lines starting with "#" are
+// ignored.
+//
+// The plan groups the entries by parent because a batch can only position siblings. For each group the windows to restore
+// are shown first, every position is deferred into one batch that the window system applies at once, and the windows to
+// minimize or maximize are changed last. Consecutive "top" and "topmost" entries are stacked in the order of the layout.
+
+#include <limits.h>
+
+#define LAYOUT_Z_KEEP 0
+#define LAYOUT_Z_TOP 1
+#define LAYOUT_Z_BOTTOM 2
+#define LAYOUT_Z_TOPMOST 3
+#define LAYOUT_Z_NOTOPMOST 4
+
+#define LAYOUT_SHOW_KEEP 0
+#define LAYOUT_SHOW_SHOW 1
+#define LAYOUT_SHOW_HIDE 2
+#define LAYOUT_SHOW_RESTORE 3
+#define LAYOUT_SHOW_MINIMIZE 4
+#define LAYOUT_SHOW_MAXIMIZE 5
+
+#define LAYOUT_NONE 0
+#define LAYOUT_FILE 1
+#define LAYOUT_TILE 2
+#define LAYOUT_CASCADE 3
+
+#define LAYOUT_LINE_SIZE 256
+#define LAYOUT_CASCADE_STEP 32
+
+typedef struct
+{
+  HWND handle;
+  HWND parent;
+  int is_placed;
+  int x;
+  int y;
+  int width;
+  int height;
+  int z_order;
+  int show_state;
+} LayoutEntry;
+
+typedef struct
+{
+  HWND handle;
+  HWND insert_after;
+  int x;
+  int y;
+  int width;
+  int height;
+  UINT flags;
+  int is_deferred;
+  // ShowWindow commands applied before and after the batch, or -1
+  int show_before;
+  int show_after;
+  int batch;
+} LayoutStep;
+
+int layout_mode = LAYOUT_NONE;
+char layout_path[MIDDLE_BUFFER_SIZE];
+
+LayoutEntry *layout_entries = NULL;
+int layout_entry_count = 0;
+int layout_entry_size = 0;
+LayoutStep *layout_steps = NULL;
+int layout_step_count = 0;
+int layout_batch_count = 0;
+
+int64_t layout_window_count = 0;
+int64_t layout_applied_batch_count = 0;
+int64_t layout_deferred_count = 0;
+int64_t layout_fallback_count = 0;
+
+const char *layout_z_names[] = {"keep", "top", "bottom", "topmost", "notopmost"};
+const char *layout_show_names[] = {"keep", "show", "hide", "restore", "minimize", "maximize"};
+
+int appendLayoutEntry(LayoutEntry *entry)
+{
+  LayoutEntry *grown;
+  int size;
+  if (layout_entry_count >= layout_entry_size)
+  {
+    size = layout_entry_size == 0 ? 64 : layout_entry_size * 2;
+    grown = (LayoutEntry *)realloc(layout_entries, (size_t)size * sizeof(LayoutEntry));
+    if (grown == NULL)
+      return 0;
+    layout_entries = grown;
+    layout_entry_size = size;
+  }
+  layout_entries[layout_entry_count++] = *entry;
+  return 1;
+}
+
+void freeLayout()
+{
+  free(layout_entries);
+  layout_entries = NULL;
+  layout_entry_count = 0;
+  layout_entry_size = 0;
+  free(layout_steps);
+  layout_steps = NULL;
+  layout_step_count = 0;
+  layout_batch_count = 0;
+}
+
+// Returns the index of a word in a list of names, or -1
+int findLayoutName(const char *word, const char **names, int name_count)
+{
+  int i;
+  for (i = 0; i < name_count; i++)
+  {
+    if (strcmp(word, names[i]) == 0)
+      return i;
+  }
+  return -1;
+}
+
+// Reads a decimal or 0x hexadecimal number between two bounds, returns zero when the word is not one
+int parseLayoutNumber(const char *word, int64_t minimum, int64_t maximum, int64_t *value)
+{
+  char *end;
+  if (word == NULL || word[0] == '\0')
+    return 0;
+  errno = 0;
+  *value = parseIntegerText(word, &end);
+  return end != word && *end == '\0' && errno != ERANGE && *value >= minimum && *value <= maximum;
+}
+
+// Parses a layout line split into words, returns zero when it is malformed
+int parseLayoutEntry(char **words, int word_count, LayoutEntry *entry)
+{
+  int64_t values[5];
+  int next;
+  int i;
+  memset(entry, 0, sizeof(LayoutEntry));
+  if (word_count < 2 || !parseLayoutNumber(words[0], 0, INTPTR_MAX, &values[0]))
+    return 0;
+  entry->handle = (HWND)(intptr_t)values[0];
+  if (strcmp(words[1], "-") == 0)
+  {
+    next = 2;
+  }
+  else
+  {
+    if (word_count < 5)
+      return 0;
+    for (i = 1; i < 5; i++)
+    {
+      if (!parseLayoutNumber(words[i], INT_MIN, INT_MAX, &values[i]))
+        return 0;
+    }
+    entry->is_placed = 1;
+    entry->x = (int)values[1];
+    entry->y = (int)values[2];
+    entry->width = (int)values[3];
+    entry->height = (int)values[4];
+    next = 5;
+  }
+  if (next < word_count && (entry->z_order = findLayoutName(words[next++], layout_z_names, 5)) < 0)
+    return 0;
+  if (next < word_count && (entry->show_state = findLayoutName(words[next++], layout_show_names, 6)) < 0)
+    return 0;
+  return next == word_count;
+}
+
+int readLayoutFile(const char *path)
+{
+  char line[LAYOUT_LINE_SIZE];
+  char *words[8];
+  int word_count;
+  int line_number = 0;
+  char *c;
+  LayoutEntry entry;
+  FILE *file = (path[0] == '-' && path[1] == '\0') ? stdin : fopen(path, "rb");
+  if (file == NULL)
+  {
+    writeOutput("Error: Could not open layout file \"%s\"\n", path);
+    return 1;
+  }
+  while (fgets(line, LAYOUT_LINE_SIZE, file) != NULL)
+  {
+    line_number++;
+    if (skipLineRest(line, file))
+    {
+      writeOutput("Error: Layout line %d of \"%s\" exceeds %d characters\n", line_number, path, LAYOUT_LINE_SIZE - 1);
+      if (file != stdin)
+        fclose(file);
+      return 1;
+    }
+    word_count = 0;
+    for (c = line; *c != '\0' && word_count < 8;)
+    {
+      while (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n')
+        *c++ = '\0';
+      if (*c == '\0')
+        break;
+      words[word_count++] = c;
+      while (*c != '\0' && *c != ' ' && *c != '\t' && *c != '\r' && *c != '\n')
+        c++;
+    }
+    if (word_count == 0 || words[0][0] == '#')
+      continue;
+    if (!parseLayoutEntry(words, word_count, &entry))
+    {
+      writeOutput("Error: Invalid layout entry at line %d of \"%s\"\n", line_number, path);
+      if (file != stdin)
+        fclose(file);
+      return 1;
+    }
+    if (!appendLayoutEntry(&entry))
+    {
+      writeOutput("Error: Could not allocate the layout\n");
+      if (file != stdin)
+        fclose(file);
+      return 1;
+    }
+  }
+  if (file != stdin)
+    fclose(file);
+  return 0;
+}
+
+// Arranges the windows in a grid over the area in z-order, row by row, the last row shares its width between fewer windows
+void generateTileLayout(HWND *windows, int window_count, RECT *area)
+{
+  LayoutEntry entry;
+  int columns = 1;
+  int rows;
+  int row;
+  int row_count;
+  int column;
+  int width = area->right - area->left;
+  int height = area->bottom - area->top;
+  int i;
+  while (columns * columns < window_count)
+    columns++;
+  rows = window_count > 0 ? (window_count + columns - 1) / columns : 1;
+  for (i = 0; i < window_count; i++)
+  {
+    row = i / columns;
+    column = i % columns;
+    row_count = row == rows - 1 ? window_count - row * columns : columns;
+    memset(&entry, 0, sizeof(LayoutEntry));
+    entry.handle = windows[i];
+    entry.is_placed = 1;
+    entry.x = area->left + (int)((int64_t)width * column / row_count);
+    entry.y = area->top + (int)((int64_t)height * row / rows);
+    entry.width = area->left + (int)((int64_t)width * (column + 1) / row_count) - entry.x;
+    entry.height = area->top + (int)((int64_t)height * (row + 1) / rows) - entry.y;
+    if (!appendLayoutEntry(&entry))
+      return;
+  }
+}
+
+// Offsets the windows diagonally from the top-left corner of the area, the window on top of the others is placed last
+// so that every title bar stays visible, and the offsets restart once a window would leave the area
+void generateCascadeLayout(HWND *windows, int window_count, RECT *area)
+{
+  LayoutEntry entry;
+  int width = (area->right - area->left) * 3 / 5;
+  int height = (area->bottom - area->top) * 3 / 5;
+  int step_count;
+  int k;
+  int i;
+  step_count = ((area->right - area->left) - width) / LAYOUT_CASCADE_STEP;
+  if (((area->bottom - area->top) - height) / LAYOUT_CASCADE_STEP < step_count)
+    step_count = ((area->bottom - area->top) - height) / LAYOUT_CASCADE_STEP;
+  step_count = step_count > 0 ? step_count + 1 : 1;
+  for (i = 0; i < window_count; i++)
+  {
+    k = (window_count - 1 - i) % step_count;
+    memset(&entry, 0, sizeof(LayoutEntry));
+    entry.handle = windows[i];
+    entry.is_placed = 1;
+    entry.x = area->left + k * LAYOUT_CASCADE_STEP;
+    entry.y = area->top + k * LAYOUT_CASCADE_STEP;
+    entry.width = width;
+    entry.height = height;
+    entry.z_order = LAYOUT_Z_TOP;
+    if (!appendLayoutEntry(&entry))
+      return;
+  }
+}
+
+// Computes the steps of the layout entries, the plan only depends on the entries so it is the same for every backend
+int planLayout(LayoutEntry *entries, int entry_count)
+{
+  HWND last_top;
+  HWND last_topmost;
+  LayoutEntry *entry;
+  LayoutStep *step;
+  int *groups;
+  int group_count = 0;
+  int g;
+  int i;
+  layout_steps = (LayoutStep *)calloc((size_t)(entry_count > 0 ? entry_count : 1), sizeof(LayoutStep));
+  groups = (int *)malloc((size_t)(entry_count > 0 ? entry_count : 1) * sizeof(int));
+  if (layout_steps == NULL || groups == NULL)
+  {
+    free(groups);
+    return 0;
+  }
+  // Groups are ordered by the first entry of each parent
+  for (i = 0; i < entry_count; i++)
+  {
+    for (g = 0; g < group_count && entries[groups[g]].parent != entries[i].parent; g++)
+    {
+    }
+    if (g == group_count)
+      groups[group_count++] = i;
+  }
+  layout_step_count = 0;
+  for (g = 0; g < group_count; g++)
+  {
+    last_top = NULL;
+    last_topmost = NULL;
+    for (i = groups[g]; i < entry_count; i++)
+    {
+      entry = &entries[i];
+      if (entry->parent != entries[groups[g]].parent)
+        continue;
+      step = &layout_steps[layout_step_count++];
+      step->handle = entry->handle;
+      step->batch = g;
+      step->x = entry->x;
+      step->y = entry->y;
+      step->width = entry->width;
+      step->height = entry->height;
+      step->flags = SWP_NOACTIVATE | (entry->is_placed ? 0 : SWP_NOMOVE | SWP_NOSIZE);
+      step->show_before = entry->show_state == LAYOUT_SHOW_RESTORE ? SW_SHOWNOACTIVATE : -1;
+      step->show_after = entry->show_state == LAYOUT_SHOW_MINIMIZE ? SW_MINIMIZE : entry->show_state == LAYOUT_SHOW_MAXIMIZE ? SW_MAXIMIZE
+                                                                                                                              : -1;
+      if (entry->show_state == LAYOUT_SHOW_SHOW)
+        step->flags |= SWP_SHOWWINDOW;
+      else if (entry->show_state == LAYOUT_SHOW_HIDE)
+        step->flags |= SWP_HIDEWINDOW;
+      if (entry->z_order == LAYOUT_Z_TOP)
+      {
+        step->insert_after = last_top != NULL ? last_top : HWND_TOP;
+        last_top = entry->handle;
+      }
+      else if (entry->z_order == LAYOUT_Z_TOPMOST)
+      {
+        step->insert_after = last_topmost != NULL ? last_topmost : HWND_TOPMOST;
+        last_topmost = entry->handle;
+      }
+      else if (entry->z_order == LAYOUT_Z_BOTTOM)
+        step->insert_after = HWND_BOTTOM;
+      else if (entry->z_order == LAYOUT_Z_NOTOPMOST)
+        step->insert_after = HWND_NOTOPMOST;
+      else
+        step->flags |= SWP_NOZORDER;
+      step->is_deferred = entry->is_placed || entry->z_order != LAYOUT_Z_KEEP || entry->show_state == LAYOUT_SHOW_SHOW || entry->show_state == LAYOUT_SHOW_HIDE;
+    }
+  }
+  layout_batch_count = group_count;
+  free(groups);
+  return 1;
+}
+
+// Positions the windows of a batch one at a time, used when the window system rejects the batch
+int applyLayoutSteps(int begin, int end)
+{
+  LayoutStep *step;
+  int error_line = 0;
+  int i;
+  layout_fallback_count++;
+  for (i = begin; i < end; i++)
+  {
+    step = &layout_steps[i];
+    if (step->is_deferred && 0 == backendSetWindowPos(step->handle, step->insert_after, step->x, step->y, step->width, step->height, step->flags))
+    {
+      writeOutput("Warning: SetWindowPos failed for %" PRId64 "\n", (int64_t)step->handle);
+      error_line = 155;
+    }
+  }
+  return error_line;
+}
+
+int applyLayoutPlan()
+{
+  HDWP batch;
+  LayoutStep *step;
+  int error_line = 0;
+  int deferred_count;
+  int begin;
+  int end;
+  int i;
+  for (begin = 0; begin < layout_step_count; begin = end)
+  {
+    deferred_count = 0;
+    for (end = begin; end < layout_step_count && layout_steps[end].batch == layout_steps[begin].batch; end++)
+    {
+      if (layout_steps[end].show_before >= 0)
+        backendShowWindow(layout_steps[end].handle, layout_steps[end].show_before);
+      deferred_count += layout_steps[end].is_deferred;
+    }
+    if (deferred_count > 0)
+    {
+      batch = backendBeginDeferWindowPos(deferred_count);
+      for (i = begin; i < end && batch != NULL; i++)
+      {
+        step = &layout_steps[i];
+        if (step->is_deferred)
+          batch = backendDeferWindowPos(batch, step->handle, step->insert_after, step->x, step->y, step->width, step->height, step->flags);
+      }
+      layout_applied_batch_count++;
+      layout_deferred_count += deferred_count;
+      // A batch that fails is discarded with the positions deferred into it
+      if (batch == NULL || !backendEndDeferWindowPos(batch))
+      {
+        writeOutput("Warning: Deferred positioning failed, positioning %d windows one at a time\n", deferred_count);
+        i = applyLayoutSteps(begin, end);
+        if (i != 0)
+          error_line = i;
+      }
+    }
+    for (i = begin; i < end; i++)
+    {
+      if (layout_steps[i].show_after >= 0)
+        backendShowWindow(layout_steps[i].handle, layout_steps[i].show_after);
+    }
+  }
+  return error_line;
+}
+
+// Reads or generates the layout, checks its windows and applies it, returns an exit code
+int runLayout()
+{
+  RECT area;
+  LONG style;
+  int code = 0;
+  int count = 0;
+  int i;
+  if (layout_mode == LAYOUT_FILE)
+  {
+    code = readLayoutFile(layout_path);
+  }
+  else
+  {
+    code = collectSelectedWindows();
+    if (code == 0 && !backendGetWorkArea(&area))
+    {
+      writeOutput("Error: Could not read the work area\n");
+      code = 1;
+    }
+    if (code == 0)
+    {
+      // Only the windows that are shown and not minimized are arranged
+      for (i = 0; i < selected_count; i++)
+      {
+        style = backendGetWindowLong(selected_list[i], GWL_STYLE);
+        if ((style & WS_VISIBLE) != 0 && (style & WS_MINIMIZE) == 0)
+          selected_list[count++] = selected_list[i];
+      }
+      if (layout_mode == LAYOUT_TILE)
+        generateTileLayout(selected_list, count, &area);
+      else
+        generateCascadeLayout(selected_list, count, &area);
+      if (layout_entry_count != count)
+      {
+        writeOutput("Error: Could not allocate the layout\n");
+        code = 1;
+      }
+    }
+    freeSelectedWindows();
+  }
+  for (i = 0; code == 0 && i < layout_entry_count; i++)
+  {
+    if (!backendIsWindow(layout_entries[i].handle))
+    {
+      writeOutput("Error: Target handle %" PRId64 " was not found\n", (int64_t)layout_entries[i].handle);
+      code = 170;
+      break;
+    }
+    style = backendGetWindowLong(layout_entries[i].handle, GWL_STYLE);
+    layout_entries[i].parent = (style & WS_CHILD) != 0 ? backendGetParent(layout_entries[i].handle) : NULL;
+    // Generated layouts restore maximized windows so that they take their place
+    if (layout_mode != LAYOUT_FILE && (style & WS_MAXIMIZE) != 0)
+      layout_entries[i].show_state = LAYOUT_SHOW_RESTORE;
+  }
+  if (code == 0 && !planLayout(layout_entries, layout_entry_count))
+  {
+    writeOutput("Error: Could not allocate the layout plan\n");
+    code = 1;
+  }
+  if (code == 0)
+  {
+    layout_window_count += layout_entry_count;
+    code = applyLayoutPlan();
+    if (code != 0)
+      writeOutput("Error: Failed to apply the layout with code %d\n", code);
+  }
+  freeLayout();
+  return code;
+}
+
+// Writes the "layout" section of the statistics object
+void writeLayoutStats(JsonWriter *writer)
+{
+  beginStatsSection(writer, "layout");
+  putStatsCounter(writer, 1, "windows", layout_window_count);
+  putStatsCounter(writer, 0, "batches", layout_applied_batch_count);
+  putStatsCounter(writer, 0, "deferred", layout_deferred_count);
+  putStatsCounter(writer, 0, "fallbacks", layout_fallback_count);
+  putJsonChar(writer, '}');
+}
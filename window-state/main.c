@@ -1,48 +1,188 @@
+#if defined(_WIN32)
 #include "windows.h"
-#include "stdio.h"
 #include <psapi.h>
+#include <io.h>
+#include <fcntl.h>
+#pragma comment(lib, "User32.lib")
+#endif
+#include "stdio.h"
 #include <stdint.h>
 #include <inttypes.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "../shared/json-writer.h"
+#include "../shared/published-reader.h"
 
-#pragma comment(lib, "User32.lib")
+#include "threads.h"
+#include "clock.h"
+#include "stats.h"
+#include "backend.h"
 
 #define verbose 0
 
+char *output = NULL;
+size_t output_length = 0;
+size_t output_size = 0;
+int is_output_captured = 0;
+
+// Window lists are serialized into the chunk of this writer, which is written before any other output
+JsonWriter output_writer;
+
+void emitOutputBytes(const char *data, size_t length);
+
+// Writes formatted program output to stdout, or appends it to the response buffer while a served request is executing
+void writeOutput(const char *format, ...)
+{
+  va_list args;
+  int length;
+  size_t required;
+  size_t grown_size;
+  char *grown;
+  flushJsonWriter(&output_writer);
+  va_start(args, format);
+  if (!is_output_captured)
+  {
+    length = vprintf(format, args);
+    va_end(args);
+    stats_output_bytes += length > 0 ? length : 0;
+    return;
+  }
+  length = vsnprintf(output != NULL ? &output[output_length] : NULL, output != NULL ? output_size - output_length : 0, format, args);
+  va_end(args);
+  if (length < 0)
+    return;
+  stats_output_bytes += length;
+  required = output_length + (size_t)length + 1;
+  if (output == NULL || required > output_size)
+  {
+    grown_size = output_size == 0 ? 64 * 1024 : output_size;
+    while (grown_size < required)
+      grown_size *= 2;
+    grown = (char *)realloc(output, grown_size);
+    if (grown == NULL)
+      return;
+    output = grown;
+    output_size = grown_size;
+    va_start(args, format);
+    vsnprintf(&output[output_length], output_size - output_length, format, args);
+    va_end(args);
+  }
+  output_length += (size_t)length;
+}
+
+// Writes raw program output, which may contain null bytes, the same way as writeOutput
+void writeOutputBytes(const void *data, size_t length)
+{
+  flushJsonWriter(&output_writer);
+  emitOutputBytes((const char *)data, length);
+}
+
+// Receives the chunks of the output writer
+void emitOutputBytes(const char *data, size_t length)
+{
+  size_t grown_size;
+  char *grown;
+  stats_output_bytes += (int64_t)length;
+  if (!is_output_captured)
+  {
+    fwrite(data, 1, length, stdout);
+    return;
+  }
+  if (output == NULL || output_length + length + 1 > output_size)
+  {
+    grown_size = output_size == 0 ? 64 * 1024 : output_size;
+    while (grown_size < output_length + length + 1)
+      grown_size *= 2;
+    grown = (char *)realloc(output, grown_size);
+    if (grown == NULL)
+      return;
+    output = grown;
+    output_size = grown_size;
+  }
+  memcpy(&output[output_length], data, length);
+  output_length += length;
+  output[output_length] = '\0';
+}
+
 void printHelp()
 {
-  printf("window-state - Utility to interact with window states\n");
-  printf("\n");
-  printf("Usage:\n");
-  printf("\twindow-state [...filters] [...operations]\n");
-  printf("\n");
-  printf("Filters:\n");
-  printf("\n");
-  printf("\t\t--foreground         Select the focused window currently active\n");
-  printf("\t\t--handle <handle>    Select a window by its numeric handle id.\n");
-  printf("\t\t--desktop            Select all children from the top-level desktop window object.\n");
-  printf("\t\t--parent <handle>    Select all children of a specific window.\n");
+  writeOutput("window-state - Utility to interact with window states\n");
+  writeOutput("\n");
+  writeOutput("Usage:\n");
+  writeOutput("\twindow-state [...filters] [...operations]\n");
+  writeOutput("\n");
+  writeOutput("Filters:\n");
+  writeOutput("\n");
+  writeOutput("\t\t--foreground         Select the focused window currently active\n");
+  writeOutput("\t\t--handle <handle>    Select a window by its numeric handle id.\n");
+  writeOutput("\t\t--handles-from <file> Select the windows of a file with one handle per line (\"-\" for stdin), without a limit.\n");
+  writeOutput("\t\t--desktop            Select all children from the top-level desktop window object.\n");
+  writeOutput("\t\t--parent <handle>    Select all children of a specific window.\n");
+  writeOutput("\t\t--pid <pid>          Filter windows by a process.\n");
+  writeOutput("\t\t--class <name>       Filter windows by their class name.\n");
+  writeOutput("\t\t--style <code>       Filter windows with all bits of a style code.\n");
+  writeOutput("\t\t--exstyle <code>     Filter windows with all bits of an extended style code.\n");
+  writeOutput("\t\t--where <expression> Filter windows by an expression (e.g. 'visible && pid == 1234 && title ~ \"Chrome\"').\n");
+  writeOutput("\t\t--title <substring>  Filter windows with titles that include a substring (repeat to match any of them).\n");
+  writeOutput("\t\t--titles-from <file>  Filter windows with titles that include any line of a file (\"-\" for stdin).\n");
+  writeOutput("\t\t--class-contains <substring>  Filter windows with class names that include a substring.\n");
+  writeOutput("\t\t--classes-from <file> Filter windows with class names that include any line of a file.\n");
   // Features not implemented
-  // printf("\t\t--pid <pid>          Filter windows by a process.\n");
-  // printf("\t\t--title <substring>  Filter windows with titles that includes a substring.\n");
-  // printf("\t\t--style <code>       Filter by matching style code.\n");
-  // printf("\t\t--exstyle <code>     Filter by matching extended style code.\n");
-  // printf("\t\t--message            Filter message-only windows.\n");
-  printf("\n");
-  printf("Operations:\n");
-  printf("\n");
-  printf("\t\t--move <x> <y>       Move matching windows to a specific position\n");
-  printf("\t\t--size <w> <h>       Resize matching windows to a specified size.\n");
-  printf("\t\t--show               Show matching windows.\n");
-  printf("\t\t--hide               Hide matching windows.\n");
-  printf("\t\t--maximize           Maximize matching windows.\n");
-  printf("\t\t--minimize           Minimize matching windows.\n");
-  printf("\t\t--set-foreground     Set the first match as the focused window.\n");
-  printf("\t\t--set-top            Bring the first matching window to top.\n");
-  printf("\t\t--set-top-most       Bring the first matching window to the top-most layer.\n");
+  // writeOutput("\t\t--message            Filter message-only windows.\n");
+  writeOutput("\n");
+  writeOutput("Operations:\n");
+  writeOutput("\n");
+  writeOutput("\t\t--move <x> <y>       Move matching windows to a specific position\n");
+  writeOutput("\t\t--size <w> <h>       Resize matching windows to a specified size.\n");
+  writeOutput("\t\t--show               Show matching windows.\n");
+  writeOutput("\t\t--hide               Hide matching windows.\n");
+  writeOutput("\t\t--maximize           Maximize matching windows.\n");
+  writeOutput("\t\t--minimize           Minimize matching windows.\n");
+  writeOutput("\t\t--set-foreground     Set the first match as the focused window.\n");
+  writeOutput("\t\t--set-top            Bring the first matching window to top.\n");
+  writeOutput("\t\t--set-top-most       Bring the first matching window to the top-most layer.\n");
+  writeOutput("\t\t--layout <file>      Apply the positions, z-order and show states of a layout file (\"-\" for stdin) in one batch.\n");
+  writeOutput("\t\t--tile               Arrange the visible matching windows in a grid over the work area in one batch.\n");
+  writeOutput("\t\t--cascade            Arrange the visible matching windows diagonally over the work area in one batch.\n");
+  writeOutput("\n");
+  writeOutput("Modes:\n");
+  writeOutput("\n");
+  writeOutput("\t\t--serve              Read newline-delimited JSON requests from stdin and write one framed response per request.\n");
+  writeOutput("\t\t--watch              Write a JSON line for each window created, destroyed, moved, renamed or focused until interrupted.\n");
+  writeOutput("\t\t--interval <ms>      Interval of the watch mode when window events are not available (default 250).\n");
+  writeOutput("\t\t--tree               Write the selected windows with their descendants as nested \"children\" lists.\n");
+  writeOutput("\t\t--depth <n>          Levels of descendants written by the tree mode (default unlimited).\n");
+  writeOutput("\t\t--threads <n>        Threads of the tree mode and of --timeout (default one per processor).\n");
+  writeOutput("\t\t--benchmark          Measure the enumeration, fetch, serialization, spatial queries and visible areas of generated desktops per window.\n");
+  writeOutput("\t\t--baseline <file>    Fail the benchmark when a phase is slower than in a baseline file.\n");
+  writeOutput("\t\t--save-baseline <file> Write the benchmark results to a baseline file.\n");
+  writeOutput("\t\t--tolerance <percent> Slowdown of a phase allowed by the baseline (default 20).\n");
+  writeOutput("\t\t--at <x> <y>         Write the topmost visible window at a point (repeat to query several points).\n");
+  writeOutput("\t\t--intersects <left> <top> <right> <bottom> Write the visible windows intersecting a rectangle in z-order.\n");
+  writeOutput("\n");
+  writeOutput("Options:\n");
+  writeOutput("\n");
+  writeOutput("\t\t--fields <list>      Comma-separated list of keys to output (e.g. \"handle,pid,rect\"), other attributes are not queried.\n");
+  writeOutput("\t\t--format <format>    Output format: json (default), ndjson (one window per line) or binary (length-prefixed records).\n");
+  writeOutput("\t\t--stats              Write execution statistics as JSON to stderr.\n");
+  writeOutput("\t\t--timeout <ms>       Read windows on a thread pool and list those not read in time as \"timeout\": true.\n");
+  writeOutput("\t\t--sort <key>         Order the selected windows by area, visible-area, z, title or pid before they are read and written.\n");
+  writeOutput("\t\t--limit <n>          Read and write only the first n selected windows in the order of --sort (default z-order).\n");
+  writeOutput("\t\t--offset <k>         Skip the first k selected windows in the order of --sort.\n");
+  writeOutput("\t\t--group-by <key>     Write the count, visible count, topmost count and area of the selected windows per executable, pid or class.\n");
+  writeOutput("\t\t--capture <file>      Write the pixels of the selected windows to .png or raw .bgra files, \"{handle}\" is replaced by each handle.\n");
+  writeOutput("\t\t--visible-area       Write the area of each top-level window not covered by the windows above it and its fraction.\n");
+  writeOutput("\t\t--snapshot-out <file> Write the selected windows to a binary snapshot file instead of the output.\n");
+  writeOutput("\t\t--since <file>        Write only the windows added, removed or changed since a snapshot file.\n");
+  writeOutput("\t\t--publish <name>     Keep the selected window list in the shared memory region \"window-state-<name>\" until stopped.\n");
+  writeOutput("\t\t--publish-size <bytes> Capacity of the published region (default 16 MB).\n");
+  writeOutput("\t\t--read-published <name> Write the window list published under a name without calling the window system.\n");
+  writeOutput("\t\t--record-focus <file> Record each change of the foreground window into a ring file until stopped.\n");
+  writeOutput("\t\t--focus-history <file> Write the records of a focus ring file, with --focus-since <ms> to skip older ones.\n");
   // Features not implemented
-  // printf("\t\t--long <i>           Read a window long value from each matching window.\n");
-  // printf("\t\t--word <i>           Read a window word value from each matching window.\n");
+  // writeOutput("\t\t--long <i>           Read a window long value from each matching window.\n");
+  // writeOutput("\t\t--word <i>           Read a window word value from each matching window.\n");
 }
 
 #define BUFFER_SIZE 1024 * 1024
@@ -69,9 +209,8 @@ RECT rect;
 int is_filter_foreground = 0;
 int is_filter_desktop = 0;
 int is_filter_message = 0;
-char filter_title[MIDDLE_BUFFER_SIZE];
-size_t filter_title_length = 0;
 int is_filter_title = 0;
+int is_filter_class_pattern = 0;
 
 int is_filter_handle = 0;
 int64_t filter_handle_list[SMALL_BUFFER_SIZE];
@@ -84,6 +223,9 @@ int is_filter_style = 0;
 int64_t filter_style = 0;
 int is_filter_exstyle = 0;
 int64_t filter_exstyle = 0;
+int is_filter_class = 0;
+char filter_class[MIDDLE_BUFFER_SIZE];
+int is_filter_where = 0;
 
 int is_action_set_foreground = 0;
 int is_action_bring_to_top = 0;
@@ -98,10 +240,194 @@ int is_action_hide = 0;
 int is_action_maximize = 0;
 int is_action_minimize = 0;
 
+#define FORMAT_JSON 0
+#define FORMAT_NDJSON 1
+#define FORMAT_BINARY 2
+int output_format = FORMAT_JSON;
+
+#define FIELD_HANDLE 0x000001
+#define FIELD_TITLE 0x000002
+#define FIELD_MODULE 0x000004
+#define FIELD_EXECUTABLE 0x000008
+#define FIELD_CLASSNAME 0x000010
+#define FIELD_PARENT 0x000020
+#define FIELD_SIBLING 0x000040
+#define FIELD_CHILD 0x000080
+#define FIELD_PID 0x000100
+#define FIELD_THREAD 0x000200
+#define FIELD_STYLE 0x000400
+#define FIELD_EXSTYLE 0x000800
+#define FIELD_VISIBLE 0x001000
+#define FIELD_UNICODE 0x002000
+#define FIELD_POPUP 0x004000
+#define FIELD_CONTAINED 0x008000
+#define FIELD_BORDERED 0x010000
+#define FIELD_SCROLLABLE 0x020000
+#define FIELD_VISIBLE_ALT 0x040000
+#define FIELD_MINIMIZED 0x080000
+#define FIELD_TOPMOST 0x100000
+#define FIELD_TRANSPARENT 0x200000
+#define FIELD_RECT 0x400000
+#define FIELD_ALL 0x7FFFFF
+// Written by --visible-area, computed over every top-level window so only included when it is requested
+#define FIELD_VISIBLE_AREA 0x800000
+#define FIELD_FLAGS (FIELD_POPUP | FIELD_CONTAINED | FIELD_BORDERED | FIELD_SCROLLABLE | FIELD_VISIBLE_ALT | FIELD_MINIMIZED | FIELD_TOPMOST | FIELD_TRANSPARENT)
+#define FIELD_STYLE_DEPENDENT (FIELD_STYLE | FIELD_POPUP | FIELD_CONTAINED | FIELD_BORDERED | FIELD_SCROLLABLE | FIELD_VISIBLE_ALT | FIELD_MINIMIZED)
+#define FIELD_EXSTYLE_DEPENDENT (FIELD_EXSTYLE | FIELD_TOPMOST | FIELD_TRANSPARENT)
+
+// Attributes written to the output and attributes required to evaluate the selected filters
+int output_fields = FIELD_ALL;
+int filter_fields = 0;
+
 HWND last_next;
 
-size_t makeWindowJson(char *buffer, size_t buffer_size, HWND h);
-size_t putWindowJson(char *buffer, size_t buffer_size, HWND h, char *title, size_t title_size, char *module, size_t module_size, char *exec, size_t exec_length, char *class, size_t class_size, HWND parent, HWND next, HWND child, DWORD pid, DWORD thread, LONG style, int64_t exstyle, int is_unicode, int is_visible, int is_popup, int is_contained, int is_bordered, int is_scrollable, int is_visible_alt, int is_minimized, int is_topmost, int is_transparent, RECT *rect);
+#define SOURCE_SIBLINGS 0
+#define SOURCE_CLASS 1
+#define SOURCE_PROCESS 2
+
+#define CANDIDATE_LIST_SIZE 65536
+#define THREAD_LIST_SIZE 4096
+
+HWND candidate_list[CANDIDATE_LIST_SIZE];
+HWND candidate_sorted_list[CANDIDATE_LIST_SIZE];
+int candidate_count = 0;
+int candidate_index = 0;
+DWORD thread_list[THREAD_LIST_SIZE];
+
+// Windows selected by the modes that read every match before writing or changing them
+HWND *selected_list = NULL;
+int selected_count = 0;
+int selected_size = 0;
+
+#define PROCESS_CACHE_SIZE 1024
+
+typedef struct
+{
+  DWORD pid;
+  int generation;
+  size_t exec_length;
+  char exec[MIDDLE_BUFFER_SIZE];
+} ProcessCacheEntry;
+
+ProcessCacheEntry process_cache[PROCESS_CACHE_SIZE];
+int process_cache_generation = 1;
+int process_cache_count = 0;
+int64_t process_cache_hits = 0;
+int64_t process_cache_misses = 0;
+// Set while several threads resolve executables, the cache is then only accessed with the mutex held
+int is_process_cache_shared = 0;
+ThreadMutex process_cache_mutex;
+
+#include "record.h"
+
+void makeWindowJson(JsonWriter *writer, HWND h);
+void fetchWindowRecord(HWND h, int fields, WindowRecord *record);
+void fetchWindowRecordStrings(HWND h, int fields, WindowRecord *record, char *title, char *module, char *exec, char *class);
+int putWindowRecordKeys(JsonWriter *writer, int is_first, int fields, WindowRecord *record, char *title, char *module, char *exec, char *class);
+void putWindowRecordJson(JsonWriter *writer, int fields, WindowRecord *record);
+void writeStats();
+HWND getNextCandidate(int source, HWND scope, HWND handle);
+int listProcessWindows(DWORD pid);
+int orderCandidateWindows(int count);
+int collectSelectedWindows();
+int appendSelectedWindow(HWND h);
+void beginWindowList();
+int endWindowList(int count);
+void freeSelectedWindows();
+int startProgram();
+int isMatchingFilters(HWND h, int is_class_matched);
+int isMatchingText(const char *str1, const char *str2);
+int isMatchingString(const char *str1, const char *str2);
+int safeParseLong(long *target);
+int64_t parseIntegerText(const char *text, char **end);
+int skipLineRest(const char *line, FILE *file);
+size_t getProcessExecutable(DWORD pid, char *exec, size_t exec_size);
+void resetProcessCache();
+
+char parse_buffer[32];
+
+#include "matcher.h"
+#include "occlusion.h"
+#include "expression.h"
+#include "watch.h"
+#include "snapshot.h"
+#include "tree.h"
+#include "fetch.h"
+#include "layout.h"
+#include "handles.h"
+#include "spatial.h"
+#include "order.h"
+#include "aggregate.h"
+#include "capture.h"
+#include "focus.h"
+#include "publish.h"
+#include "benchmark.h"
+
+// Substring patterns of the --title and --class-contains filters, a window matches when it contains any of them
+PatternMatcher title_matcher;
+PatternMatcher class_matcher;
+int putWindowJson(JsonWriter *writer, int is_first, int fields, HWND h, char *title, size_t title_length, char *module, size_t module_length, char *exec, size_t exec_length, char *class, size_t class_length, HWND parent, HWND next, HWND child, DWORD pid, DWORD thread, LONG style, int64_t exstyle, int is_unicode, int is_visible, int is_popup, int is_contained, int is_bordered, int is_scrollable, int is_visible_alt, int is_minimized, int is_topmost, int is_transparent, RECT *rect);
+
+// Writes the start of the list of windows of the result
+void beginWindowList()
+{
+  if (is_option_snapshot_out || is_option_since || aggregate_key != AGGREGATE_NONE)
+    return;
+  if (output_format == FORMAT_BINARY)
+    writeOutputBytes(buffer, putRecordStreamHeader(buffer));
+  else if (output_format == FORMAT_JSON)
+    writeOutput("[");
+}
+
+// Writes a window of the result, or keeps its record when the result is compared or written to a snapshot file, or adds it
+// to its group, or writes its capture
+int putWindowListItem(HWND h, int count)
+{
+  WindowRecord record;
+  size_t length;
+  if (is_option_capture)
+  {
+    if (output_format == FORMAT_JSON && count != 0)
+      putJsonBytes(&output_writer, ", ", 2);
+    putCaptureItem(&output_writer, h, count);
+    if (output_format == FORMAT_NDJSON)
+      putJsonChar(&output_writer, '\n');
+    return 1;
+  }
+  if (aggregate_key != AGGREGATE_NONE)
+    return addAggregateWindow(h);
+  if (is_option_snapshot_out || is_option_since)
+    return appendSnapshotWindow(h);
+  if (output_format == FORMAT_BINARY)
+  {
+    fetchWindowRecord(h, output_fields | filter_fields, &record);
+    record.fields = (uint32_t)output_fields;
+    length = putRecordFrame(buffer, BUFFER_SIZE, &record, title, module, (char *)exec_file_path, class);
+    writeOutputBytes(buffer, length);
+    return 1;
+  }
+  if (output_format == FORMAT_JSON && count != 0)
+    putJsonBytes(&output_writer, ", ", 2);
+  makeWindowJson(&output_writer, h);
+  if (output_format == FORMAT_NDJSON)
+    putJsonChar(&output_writer, '\n');
+  return 1;
+}
+
+int endWindowList(int count)
+{
+  if (is_option_snapshot_out || is_option_since)
+    return finishSnapshot();
+  if (aggregate_key != AGGREGATE_NONE)
+  {
+    writeAggregateTable();
+    return 0;
+  }
+  if (output_format == FORMAT_JSON)
+    writeOutput("]");
+  // The list is complete when a window could not be captured, but the captures are not
+  return capture_failure_count > 0 ? 1 : 0;
+}
 
 int checkHasActions()
 {
@@ -116,9 +442,9 @@ int applyActions(HWND handle)
   {
     if (verbose)
       printf("[Verbose] Executing SetForegroundWindow on %" PRId64 "\n", (int64_t)handle);
-    if (0 == SetForegroundWindow(handle))
+    if (0 == backendSetForegroundWindow(handle))
     {
-      printf("Warning: SetForegroundWindow failed for %" PRId64 "\n", (int64_t)handle);
+      writeOutput("Warning: SetForegroundWindow failed for %" PRId64 "\n", (int64_t)handle);
       error_line = 118;
     }
     else if (is_action_set_foreground != 0)
@@ -131,7 +457,7 @@ int applyActions(HWND handle)
   {
     if (verbose)
       printf("[Verbose] Executing ShowWindow on %" PRId64 " with %c%c%c%c: %" PRId64 "\n", (int64_t)handle, (is_action_show != 0 ? 'S' : ' '), (is_action_maximize != 0 ? 'M' : ' '), (is_action_hide != 0 ? 'H' : ' '), (is_action_minimize != 0 ? 'm' : ' '), (int64_t)show_arg);
-    ShowWindow(handle, show_arg);
+    backendShowWindow(handle, show_arg);
   }
 
   if (handle != NULL && (is_action_bring_to_top != 0 || is_action_move != 0 || is_action_size != 0))
@@ -149,9 +475,9 @@ int applyActions(HWND handle)
       flags_arg = 0;
     if (verbose)
       printf("[Verbose] Executing SetWindowPos on %" PRId64 "\n", (int64_t)handle);
-    if (0 == SetWindowPos(handle, insert_arg, action_x, action_y, action_w, action_h, flags_arg))
+    if (0 == backendSetWindowPos(handle, insert_arg, action_x, action_y, action_w, action_h, flags_arg))
     {
-      printf("Warning: SetWindowPos failed for %" PRId64 "\n", (int64_t)handle);
+      writeOutput("Warning: SetWindowPos failed for %" PRId64 "\n", (int64_t)handle);
       error_line = 155;
     }
     else if (is_action_bring_to_top != 0)
@@ -161,27 +487,173 @@ int applyActions(HWND handle)
   return error_line;
 }
 
+int handle_list_count = 0;
+
+// Writes or changes a window read by --handles-from
+int visitListedHandle(HWND h)
+{
+  int isFiltered = is_filter_pid || is_filter_class || is_filter_style || is_filter_exstyle || is_filter_where || is_filter_title || is_filter_class_pattern;
+  int err;
+  if (isFiltered && !isMatchingFilters(h, 0))
+    return 0;
+  if (checkHasActions())
+  {
+    err = applyActions(h);
+    if (err != 0)
+    {
+      writeOutput("Error: Failed to apply actions to %" PRId64 " with code %d\n", (int64_t)h, err);
+      return 183;
+    }
+    return 0;
+  }
+  if (!putWindowListItem(h, handle_list_count))
+  {
+    writeOutput("Error: Could not allocate the window records\n");
+    return 1;
+  }
+  handle_list_count++;
+  return 0;
+}
+
+// Streamed handles that are not windows are skipped with a warning naming the handle, or the line when it could not be read
+void warnStreamedHandle(int64_t handle, int64_t line, const char *error)
+{
+  if (handle != 0)
+    fprintf(stderr, "Warning: Target handle %" PRId64 " skipped (%s)\n", handle, error);
+  else
+    fprintf(stderr, "Warning: Line %" PRId64 " skipped (%s)\n", line, error);
+}
+
+// Handles that are not windows are listed in place of their window by the JSON formats, and reported as warnings otherwise
+void reportListedHandle(int64_t handle, int64_t line, const char *error)
+{
+  if (checkHasActions())
+  {
+    if (handle != 0)
+      writeOutput("Warning: Target handle %" PRId64 " was not found\n", handle);
+    else
+      writeOutput("Warning: Invalid handle at line %" PRId64 "\n", line);
+    return;
+  }
+  if (output_format == FORMAT_BINARY || is_option_snapshot_out || is_option_since || aggregate_key != AGGREGATE_NONE)
+  {
+    warnStreamedHandle(handle, line, error);
+    return;
+  }
+  if (output_format == FORMAT_JSON && handle_list_count != 0)
+    putJsonBytes(&output_writer, ", ", 2);
+  putJsonChar(&output_writer, '{');
+  putJsonKey(&output_writer, 1, handle != 0 ? "handle" : "line");
+  putJsonInteger(&output_writer, handle != 0 ? handle : line);
+  putJsonKey(&output_writer, 0, "error");
+  putJsonString(&output_writer, error, strlen(error));
+  putJsonChar(&output_writer, '}');
+  if (output_format == FORMAT_NDJSON)
+    putJsonChar(&output_writer, '\n');
+  handle_list_count++;
+}
+
+int writeHandleStream(int isActionMode)
+{
+  int code;
+  // The list is only started once the stream is open, so that an error is written alone
+  FILE *file = openHandleStream();
+  if (file == NULL)
+    return 1;
+  handle_list_count = 0;
+  if (!isActionMode)
+    beginWindowList();
+  code = streamHandles(file, visitListedHandle, reportListedHandle);
+  if (code != 0 || isActionMode)
+    return code;
+  return endWindowList(handle_list_count);
+}
+
+// Lists or changes the windows of the page of --sort, --offset and --limit, which are selected before any is written
+int writeOrderedWindowList(int isActionMode)
+{
+  int isFiltered = is_filter_pid || is_filter_class || is_filter_style || is_filter_exstyle || is_filter_where || is_filter_title || is_filter_class_pattern;
+  int code;
+  int err;
+  int i;
+  if (!is_filter_handle && !is_filter_foreground && !is_filter_parent && !is_filter_desktop && !isFiltered)
+  {
+    if (isActionMode)
+    {
+      writeOutput("Error: Cannot apply actions because there are no window filters\n");
+      return 225;
+    }
+    writeOutput("Error: Could not find starting window\n");
+    return 258;
+  }
+  code = collectSelectedWindows();
+  if (code != 0)
+  {
+    freeSelectedWindows();
+    return code;
+  }
+  if (!isActionMode)
+    beginWindowList();
+  for (i = 0; i < selected_count; i++)
+  {
+    if (isActionMode)
+    {
+      err = applyActions(selected_list[i]);
+      if (err != 0)
+      {
+        writeOutput("Error: Failed to apply actions to %" PRId64 " with code %d\n", (int64_t)selected_list[i], err);
+        freeSelectedWindows();
+        return 272;
+      }
+    }
+    else if (!putWindowListItem(selected_list[i], i))
+    {
+      writeOutput("Error: Could not allocate the window records\n");
+      freeSelectedWindows();
+      return 1;
+    }
+  }
+  freeSelectedWindows();
+  if (!isActionMode)
+    return endWindowList(i);
+  return 0;
+}
+
 int startProgram()
 {
-  HWND handle;
+  HWND handle = NULL;
   int is_win;
   int i;
   int err;
+  int count;
+  int source;
+  HWND scope;
+  int64_t start;
   int isActionMode = checkHasActions();
+  int isFiltered = is_filter_pid || is_filter_class || is_filter_style || is_filter_exstyle || is_filter_where || is_filter_title || is_filter_class_pattern;
+
+  if (fetch_timeout > 0 && !isActionMode)
+    return writeBoundedWindowList();
+
+  if (isOrderingSelection())
+    return writeOrderedWindowList(isActionMode);
+
+  if (is_filter_handle_stream)
+    return writeHandleStream(isActionMode);
 
   if (is_filter_handle)
   {
-    is_win = filter_handle_list[0] != 0 && IsWindow((HWND)filter_handle_list[0]);
+    is_win = filter_handle_list[0] != 0 && backendIsWindow((HWND)filter_handle_list[0]);
     if (verbose)
       printf("[Verbose] %s handle source: \"filter_handle[0]\": %" PRId64 " (%s)\n", filter_handle_list_size == 1 ? "Single" : "Multiple", (int64_t)filter_handle_list[0], is_win ? "valid window" : "invalid window");
     // Verify handle list
     for (i = 0; i < filter_handle_list_size; i++)
     {
       handle = (HWND)filter_handle_list[i];
-      is_win = handle != NULL && handle != 0 && IsWindow(handle);
+      is_win = backendIsWindow(handle);
       if (!is_win)
       {
-        printf("Error: Target handle %" PRId64 " was not found\n", (int64_t)handle);
+        writeOutput("Error: Target handle %" PRId64 " was not found\n", (int64_t)handle);
         return 170;
       }
     }
@@ -190,181 +662,568 @@ int startProgram()
       for (i = 0; i < filter_handle_list_size; i++)
       {
         handle = (HWND)filter_handle_list[i];
+        if (isFiltered && !isMatchingFilters(handle, 0))
+          continue;
         err = applyActions(handle);
         if (err != 0)
         {
-          printf("Error: Failed to apply actions to %" PRId64 " with code %d\n", (int64_t)handle, err);
+          writeOutput("Error: Failed to apply actions to %" PRId64 " with code %d\n", (int64_t)handle, err);
           return 183;
         }
       }
       return 0;
     }
-    printf("[");
-    for (i = 0; i < filter_handle_list_size; i++)
+    beginWindowList();
+    for (i = 0, count = 0; i < filter_handle_list_size; i++)
     {
       handle = (HWND)filter_handle_list[i];
-      makeWindowJson(buffer, BUFFER_SIZE, handle);
-      printf("%s%s", buffer, i + 1 < filter_handle_list_size ? ", " : "]");
+      if (isFiltered && !isMatchingFilters(handle, 0))
+        continue;
+      if (!putWindowListItem(handle, count))
+      {
+        writeOutput("Error: Could not allocate the window records\n");
+        return 1;
+      }
+      count++;
     }
-    return 0;
+    return endWindowList(count);
   }
 
   if (is_filter_foreground)
   {
-    handle = GetForegroundWindow();
-    is_win = handle != NULL && IsWindow(handle);
+    handle = backendGetForegroundWindow();
+    is_win = backendIsWindow(handle);
     if (verbose)
       printf("[Verbose] Single handle source: \"filter_foreground\": %" PRId64 " (%d)\n", (int64_t)handle, (int)is_win);
     if (!is_win)
     {
-      printf("Error: Could not find foreground window\n");
+      writeOutput("Error: Could not find foreground window\n");
       return 207;
     }
+    if (isFiltered && !isMatchingFilters(handle, 0))
+    {
+      if (!isActionMode)
+      {
+        beginWindowList();
+        return endWindowList(0);
+      }
+      return 0;
+    }
     if (isActionMode)
     {
       err = applyActions(handle);
       if (err != 0)
       {
-        printf("Error: Failed to apply actions to %" PRId64 " with code %d\n", (int64_t)handle, err);
+        writeOutput("Error: Failed to apply actions to %" PRId64 " with code %d\n", (int64_t)handle, err);
         return 216;
       }
       return 0;
     }
-    makeWindowJson(buffer, BUFFER_SIZE, handle);
-    printf("[%s]", buffer);
-    return 0;
+    beginWindowList();
+    if (!putWindowListItem(handle, 0))
+    {
+      writeOutput("Error: Could not allocate the window records\n");
+      return 1;
+    }
+    return endWindowList(1);
   }
 
-  if (is_filter_parent == 0 && is_filter_desktop == 0 && isActionMode)
+  if (is_filter_parent == 0 && is_filter_desktop == 0 && !isFiltered && isActionMode)
   {
-    printf("Error: Cannot apply actions because there are no window filters\n");
+    writeOutput("Error: Cannot apply actions because there are no window filters\n");
     return 225;
   }
-  if (is_filter_parent != 0)
+  // Filters without a parent select from the top-level windows, as the desktop filter does
+  scope = is_filter_parent != 0 && is_filter_desktop == 0 ? (HWND)filter_parent : NULL;
+  start = beginStatsCall();
+  if (is_filter_class)
   {
     if (verbose)
-      printf("[Verbose] Starting handle source: \"filter_parent\"\n");
-    handle = FindWindowExW((HWND)filter_parent, NULL, NULL, NULL);
-    is_win = handle != NULL && IsWindow(handle);
-    if (!is_win)
-    {
-      printf("Error: Could not find parent window\n");
-      return 237;
-    }
+      printf("[Verbose] Starting handle source: \"filter_class\"\n");
+    source = SOURCE_CLASS;
+    handle = backendFindWindowByClass(scope, NULL, filter_class);
   }
-  if (is_filter_desktop != 0)
+  else if (is_filter_pid && scope == NULL)
   {
     if (verbose)
-      printf("[Verbose] Starting handle source: \"filter_desktop\"\n");
-    handle = FindWindowExW(NULL, NULL, NULL, NULL);
-    is_win = handle != NULL && IsWindow(handle);
-    if (!is_win)
-    {
-      printf("Error: Could not find desktop window\n");
-      return 249;
-    }
+      printf("[Verbose] Starting handle source: \"filter_pid\"\n");
+    source = SOURCE_PROCESS;
+    candidate_count = listProcessWindows((DWORD)filter_pid);
+    candidate_index = 0;
+    handle = candidate_count > 0 ? candidate_list[0] : NULL;
   }
-  if (handle == NULL)
+  else
   {
-    printf("Error: Could not find starting window\n");
-    return 258;
+    source = SOURCE_SIBLINGS;
+    if (is_filter_parent != 0)
+    {
+      if (verbose)
+        printf("[Verbose] Starting handle source: \"filter_parent\"\n");
+      handle = backendGetFirstChild((HWND)filter_parent);
+      is_win = backendIsWindow(handle);
+      if (!is_win)
+      {
+        writeOutput("Error: Could not find parent window\n");
+        return 237;
+      }
+    }
+    if (is_filter_desktop != 0 || (is_filter_parent == 0 && isFiltered))
+    {
+      if (verbose)
+        printf("[Verbose] Starting handle source: \"filter_desktop\"\n");
+      handle = backendGetFirstChild(NULL);
+      is_win = backendIsWindow(handle);
+      if (!is_win)
+      {
+        writeOutput("Error: Could not find desktop window\n");
+        return 249;
+      }
+    }
+    if (handle == NULL)
+    {
+      writeOutput("Error: Could not find starting window\n");
+      return 258;
+    }
   }
-  is_win = IsWindow(handle);
-  if (!is_win)
+  is_win = backendIsWindow(handle);
+  endStatsPhase(&stats_enumerate_time, start);
+  if (!is_win && source == SOURCE_SIBLINGS)
   {
-    printf("Error: Starting window handle is not valid\n");
+    writeOutput("Error: Starting window handle is not valid\n");
     return 266;
   }
-  i = 0;
+  count = 0;
+  if (!isActionMode)
+    beginWindowList();
   while (handle && is_win)
   {
-    if (isActionMode)
+    last_next = NULL;
+    start = beginStatsCall();
+    if (isFiltered && !isMatchingFilters(handle, source == SOURCE_CLASS))
+    {
+      // Not selected
+      endStatsPhase(&stats_enumerate_time, start);
+    }
+    else if (isActionMode)
     {
+      endStatsPhase(&stats_enumerate_time, start);
       err = applyActions(handle);
       if (err != 0)
       {
-        printf("Error: Failed to apply actions to %" PRId64 " with code %d\n", (int64_t)handle, err);
+        writeOutput("Error: Failed to apply actions to %" PRId64 " with code %d\n", (int64_t)handle, err);
         return 272;
       }
-      last_next = GetWindow(handle, GW_HWNDNEXT);
     }
     else
     {
-      makeWindowJson(buffer, BUFFER_SIZE, handle);
-      printf("%s%s", i == 0 ? "[" : ", ", buffer);
+      endStatsPhase(&stats_enumerate_time, start);
+      if (!putWindowListItem(handle, count))
+      {
+        writeOutput("Error: Could not allocate the window records\n");
+        return 1;
+      }
+      count++;
     }
-    handle = last_next;
-    is_win = handle != NULL && handle != 0 && IsWindow(handle);
-    i++;
+    start = beginStatsCall();
+    handle = getNextCandidate(source, scope, handle);
+    is_win = backendIsWindow(handle);
+    endStatsPhase(&stats_enumerate_time, start);
   }
   if (!isActionMode)
+    return endWindowList(count);
+  return 0;
+}
+
+int appendSelectedWindow(HWND h)
+{
+  HWND *grown;
+  int size;
+  if (selected_count >= selected_size)
   {
-    printf("]");
+    size = selected_size == 0 ? 256 : selected_size * 2;
+    grown = (HWND *)realloc(selected_list, (size_t)size * sizeof(HWND));
+    if (grown == NULL)
+      return 0;
+    selected_list = grown;
+    selected_size = size;
   }
-  return 0;
+  selected_list[selected_count++] = h;
+  return 1;
 }
 
-int isMatchingString(const char *str1, const char *str2)
+void freeSelectedWindows()
 {
-  size_t i;
-  if (str1 == NULL || str2 == NULL || SMALL_BUFFER_SIZE == 0)
+  free(selected_list);
+  selected_list = NULL;
+  selected_count = 0;
+  selected_size = 0;
+}
+
+int appendStreamedWindow(HWND h)
+{
+  int isFiltered = is_filter_pid || is_filter_class || is_filter_style || is_filter_exstyle || is_filter_where || is_filter_title || is_filter_class_pattern;
+  if ((!isFiltered || isMatchingFilters(h, 0)) && !appendSelectedWindow(h))
   {
-    return 0;
+    writeOutput("Error: Could not allocate the window list\n");
+    return 1;
   }
-  for (i = 0; i < SMALL_BUFFER_SIZE; i++)
+  return 0;
+}
+
+// Selects the windows of the handle, foreground, parent and desktop scopes that match the filters, returns an exit code
+int collectScopeWindows()
+{
+  int isFiltered = is_filter_pid || is_filter_class || is_filter_style || is_filter_exstyle || is_filter_where || is_filter_title || is_filter_class_pattern;
+  HWND h;
+  int64_t start;
+  int i;
+  selected_count = 0;
+  if (is_filter_handle)
   {
-    if (str1[i] == '\0' && str2[i] == '\0')
-    {
-      if (verbose)
-        printf("[Verbose] Matched string of size %llu: \"%s\"\n", i, str1);
-      return 1;
-    }
-    if (str1[i] == '\0' || str2[i] == '\0')
-    {
-      // if (verbose && i != 0) printf("[Verbose] Unmatching at %llu: \"%s\" != \"%s\"\n", i, str1, str2);
-      return 0;
-    }
-    if (str1[i] == str2[i])
+    if (is_filter_handle_stream)
     {
-      continue;
+      FILE *file = openHandleStream();
+      return file != NULL ? streamHandles(file, appendStreamedWindow, warnStreamedHandle) : 1;
     }
-    if (str1[i] >= 'A' && str1[i] <= 'Z' && str1[i] + 32 == str2[i])
+    for (i = 0; i < filter_handle_list_size; i++)
     {
-      continue;
+      h = (HWND)filter_handle_list[i];
+      if (!backendIsWindow(h))
+      {
+        writeOutput("Error: Target handle %" PRId64 " was not found\n", (int64_t)h);
+        return 170;
+      }
+      if ((!isFiltered || isMatchingFilters(h, 0)) && !appendSelectedWindow(h))
+        return 1;
     }
-    if (str1[i] >= 'a' && str1[i] <= 'z' && str1[i] - 32 == str2[i])
+    return 0;
+  }
+  if (is_filter_foreground)
+  {
+    h = backendGetForegroundWindow();
+    if (!backendIsWindow(h))
     {
-      continue;
+      writeOutput("Error: Could not find foreground window\n");
+      return 207;
     }
-    // if (verbose && i != 0) printf("[Verbose] Unmatching at %llu: \"%s\" != \"%s\"\n", i, str1, str2);
+    if ((!isFiltered || isMatchingFilters(h, 0)) && !appendSelectedWindow(h))
+      return 1;
     return 0;
   }
+  if (is_filter_parent && !is_filter_desktop && !backendIsWindow((HWND)filter_parent))
+  {
+    writeOutput("Error: Could not find parent window\n");
+    return 237;
+  }
+  start = beginStatsCall();
+  for (h = backendGetFirstChild(is_filter_parent && !is_filter_desktop ? (HWND)filter_parent : NULL); h != NULL; h = backendGetWindow(h, GW_HWNDNEXT))
+  {
+    if ((!isFiltered || isMatchingFilters(h, 0)) && !appendSelectedWindow(h))
+      return 1;
+  }
+  endStatsPhase(&stats_enumerate_time, start);
   return 0;
 }
-char parse_buffer[32];
-int safeParseLong(long *target)
+
+// Selects the windows of the scope that match the filters, limited to the page of --sort, --offset and --limit
+int collectSelectedWindows()
 {
-  if (parse_buffer[0] == '\0' || (parse_buffer[0] < '0' && parse_buffer[0] > '9' && parse_buffer[0] != '-'))
+  int code = collectScopeWindows();
+  if (code != 0 || !isOrderingSelection())
+    return code;
+  return orderSelectedWindows();
+}
+
+// Returns the window after a candidate from the source selected by the filters
+HWND getNextCandidate(int source, HWND scope, HWND handle)
+{
+  if (source == SOURCE_CLASS)
+    return backendFindWindowByClass(scope, handle, filter_class);
+  if (source == SOURCE_PROCESS)
+    return ++candidate_index < candidate_count ? candidate_list[candidate_index] : NULL;
+  // The sibling was already fetched when the window was serialized with it
+  if (last_next != NULL)
+    return last_next;
+  return backendGetWindow(handle, GW_HWNDNEXT);
+}
+
+// Lists the top-level windows of a process by enumerating the windows of each of its threads instead of walking every top-level window
+int listProcessWindows(DWORD pid)
+{
+  int thread_count = backendListProcessThreads(pid, thread_list, THREAD_LIST_SIZE);
+  int count = 0;
+  int listed;
+  int source_count = 0;
+  int t;
+  for (t = 0; t < thread_count && count < CANDIDATE_LIST_SIZE; t++)
   {
-    return 0;
+    listed = backendListThreadWindows(thread_list[t], &candidate_list[count], CANDIDATE_LIST_SIZE - count);
+    source_count += listed > 0 ? 1 : 0;
+    count += listed;
   }
-  if (parse_buffer[0] == '0' && parse_buffer[1] == '\0')
+  // The windows of a thread are listed in z-order, only the lists of several threads need to be merged
+  return source_count > 1 ? orderCandidateWindows(count) : count;
+}
+
+int compareCandidateHandles(const void *a, const void *b)
+{
+  uintptr_t x = (uintptr_t)*(const HWND *)a;
+  uintptr_t y = (uintptr_t)*(const HWND *)b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// Puts the windows of the threads back in z-order, like the other sources, with one walk of the top-level windows that only
+// reads their handles and stops at the lowest candidate. Windows destroyed since they were listed are dropped, returns the
+// remaining count.
+int orderCandidateWindows(int count)
+{
+  HWND h;
+  int ordered = 0;
+  memcpy(candidate_sorted_list, candidate_list, (size_t)count * sizeof(HWND));
+  qsort(candidate_sorted_list, (size_t)count, sizeof(HWND), compareCandidateHandles);
+  for (h = backendGetFirstChild(NULL); h != NULL && ordered < count; h = backendGetWindow(h, GW_HWNDNEXT))
   {
-    *target = 0;
-    return 1;
+    if (bsearch(&h, candidate_sorted_list, (size_t)count, sizeof(HWND), compareCandidateHandles) != NULL)
+      candidate_list[ordered++] = h;
   }
-  int base = 10;
-  int j;
-  for (j = 0; j < 32; j++)
+  return ordered;
+}
+
+// Evaluates the selected filters on a window, the numeric attributes are checked before any string is fetched
+int isMatchingFilters(HWND h, int is_class_matched)
+{
+  DWORD pid = 0;
+  if (is_filter_pid)
   {
-    if (parse_buffer[j] == '\0')
-    {
-      break;
-    }
-    if (j == 0 && parse_buffer[j] == '-')
-    {
-      continue;
-    }
+    backendGetWindowThreadProcessId(h, &pid);
+    if ((int64_t)pid != filter_pid)
+      return 0;
+  }
+  if (is_filter_style && ((uint32_t)backendGetWindowLong(h, GWL_STYLE) & (uint32_t)filter_style) != (uint32_t)filter_style)
+    return 0;
+  if (is_filter_exstyle && ((uint32_t)backendGetWindowLong(h, GWL_EXSTYLE) & (uint32_t)filter_exstyle) != (uint32_t)filter_exstyle)
+    return 0;
+  if (is_filter_class && !is_class_matched)
+  {
+    class_length = backendGetClassName(h, class, MIDDLE_BUFFER_SIZE);
+    if (!isMatchingText(class, filter_class))
+      return 0;
+  }
+  if (is_filter_class_pattern)
+  {
+    if (!is_filter_class || is_class_matched)
+      class_length = backendGetClassName(h, class, MIDDLE_BUFFER_SIZE);
+    if (!matchPatterns(&class_matcher, class, class_length))
+      return 0;
+  }
+  if (is_filter_where && !evaluateExpression(h))
+    return 0;
+  // Titles may require a message to the window thread so they are matched last
+  if (is_filter_title)
+  {
+    title_length = backendGetWindowText(h, title, MIDDLE_BUFFER_SIZE);
+    if (!matchPatterns(&title_matcher, title, title_length))
+      return 0;
+  }
+  return 1;
+}
+
+// Compares two strings of any length ignoring the case of ascii letters
+int isMatchingText(const char *str1, const char *str2)
+{
+  size_t i;
+  char a;
+  char b;
+  for (i = 0;; i++)
+  {
+    a = str1[i] >= 'A' && str1[i] <= 'Z' ? str1[i] + 32 : str1[i];
+    b = str2[i] >= 'A' && str2[i] <= 'Z' ? str2[i] + 32 : str2[i];
+    if (a != b)
+      return 0;
+    if (a == '\0')
+      return 1;
+  }
+}
+
+int isMatchingString(const char *str1, const char *str2)
+{
+  size_t i;
+  if (str1 == NULL || str2 == NULL || SMALL_BUFFER_SIZE == 0)
+  {
+    return 0;
+  }
+  for (i = 0; i < SMALL_BUFFER_SIZE; i++)
+  {
+    if (str1[i] == '\0' && str2[i] == '\0')
+    {
+      if (verbose)
+        printf("[Verbose] Matched string of size %llu: \"%s\"\n", i, str1);
+      return 1;
+    }
+    if (str1[i] == '\0' || str2[i] == '\0')
+    {
+      // if (verbose && i != 0) printf("[Verbose] Unmatching at %llu: \"%s\" != \"%s\"\n", i, str1, str2);
+      return 0;
+    }
+    if (str1[i] == str2[i])
+    {
+      continue;
+    }
+    if (str1[i] >= 'A' && str1[i] <= 'Z' && str1[i] + 32 == str2[i])
+    {
+      continue;
+    }
+    if (str1[i] >= 'a' && str1[i] <= 'z' && str1[i] - 32 == str2[i])
+    {
+      continue;
+    }
+    // if (verbose && i != 0) printf("[Verbose] Unmatching at %llu: \"%s\" != \"%s\"\n", i, str1, str2);
+    return 0;
+  }
+  return 0;
+}
+// Interprets a comma-separated list of output keys such as "handle,pid,rect" into a field mask
+int parseFieldList(const char *list, int *fields)
+{
+  char name[SMALL_BUFFER_SIZE];
+  size_t length;
+  int field;
+  *fields = 0;
+  while (1)
+  {
+    for (length = 0; list[length] != ',' && list[length] != '\0'; length++)
+    {
+      if (length + 1 >= SMALL_BUFFER_SIZE)
+      {
+        writeOutput("Error: Field name is too long at \"%s\"\n", list);
+        return 0;
+      }
+      name[length] = list[length];
+    }
+    name[length] = '\0';
+    field = 0;
+    if (length == 0)
+      field = 0;
+    else if (isMatchingString("handle", name))
+      field = FIELD_HANDLE;
+    else if (isMatchingString("title", name))
+      field = FIELD_TITLE;
+    else if (isMatchingString("module", name))
+      field = FIELD_MODULE;
+    else if (isMatchingString("executable", name) || isMatchingString("exec", name))
+      field = FIELD_EXECUTABLE;
+    else if (isMatchingString("classname", name) || isMatchingString("class", name))
+      field = FIELD_CLASSNAME;
+    else if (isMatchingString("parent", name))
+      field = FIELD_PARENT;
+    else if (isMatchingString("sibling", name))
+      field = FIELD_SIBLING;
+    else if (isMatchingString("child", name))
+      field = FIELD_CHILD;
+    else if (isMatchingString("pid", name))
+      field = FIELD_PID;
+    else if (isMatchingString("thread", name))
+      field = FIELD_THREAD;
+    else if (isMatchingString("style", name))
+      field = FIELD_STYLE;
+    else if (isMatchingString("exstyle", name))
+      field = FIELD_EXSTYLE;
+    else if (isMatchingString("visible", name))
+      field = FIELD_VISIBLE;
+    else if (isMatchingString("unicode", name))
+      field = FIELD_UNICODE;
+    else if (isMatchingString("popup", name))
+      field = FIELD_POPUP;
+    else if (isMatchingString("contained", name))
+      field = FIELD_CONTAINED;
+    else if (isMatchingString("bordered", name))
+      field = FIELD_BORDERED;
+    else if (isMatchingString("scrollable", name))
+      field = FIELD_SCROLLABLE;
+    else if (isMatchingString("visible_alt", name))
+      field = FIELD_VISIBLE_ALT;
+    else if (isMatchingString("minimized", name))
+      field = FIELD_MINIMIZED;
+    else if (isMatchingString("topmost", name))
+      field = FIELD_TOPMOST;
+    else if (isMatchingString("transparent", name))
+      field = FIELD_TRANSPARENT;
+    else if (isMatchingString("flags", name))
+      field = FIELD_FLAGS;
+    else if (isMatchingString("rect", name) || isMatchingString("top", name) || isMatchingString("right", name) || isMatchingString("bottom", name) || isMatchingString("left", name))
+      field = FIELD_RECT;
+    else if (isMatchingString("visible_area", name) || isMatchingString("visible_fraction", name))
+      field = FIELD_VISIBLE_AREA;
+    else if (isMatchingString("all", name))
+      field = FIELD_ALL;
+    if (length != 0 && field == 0)
+    {
+      writeOutput("Error: Unknown field \"%s\" (expected a window state key such as handle, title, pid or rect)\n", name);
+      return 0;
+    }
+    *fields |= field;
+    if (list[length] == '\0')
+      break;
+    list = &list[length + 1];
+  }
+  if (*fields == 0)
+  {
+    writeOutput("Error: Field list is empty\n");
+    return 0;
+  }
+  return 1;
+}
+// Reads a decimal number, or a hexadecimal one after a "0x" prefix, a leading zero is not read as octal as by strtoll
+int64_t parseIntegerText(const char *text, char **end)
+{
+  char c = text[0] == '-' ? text[1] : text[0];
+  // strtoll would accept a second prefix after the first one
+  if (text[0] == '0' && (text[1] == 'x' || text[1] == 'X') && ((text[2] >= '0' && text[2] <= '9') || (text[2] >= 'a' && text[2] <= 'f') || (text[2] >= 'A' && text[2] <= 'F')) && text[3] != 'x' && text[3] != 'X')
+    return (int64_t)strtoll(&text[2], end, 16);
+  if (c < '0' || c > '9')
+  {
+    *end = (char *)text;
+    return 0;
+  }
+  return (int64_t)strtoll(text, end, 10);
+}
+
+// Consumes the rest of a line that did not fit in the buffer of fgets, returns one when the line was cut
+int skipLineRest(const char *line, FILE *file)
+{
+  size_t length = strlen(line);
+  int c;
+  int is_cut = 0;
+  if (length > 0 && line[length - 1] == '\n')
+    return 0;
+  while ((c = fgetc(file)) != EOF && c != '\n')
+    is_cut = 1;
+  return is_cut;
+}
+
+int safeParseLong(long *target)
+{
+  if (parse_buffer[0] == '\0' || (parse_buffer[0] < '0' && parse_buffer[0] > '9' && parse_buffer[0] != '-'))
+  {
+    return 0;
+  }
+  if (parse_buffer[0] == '0' && parse_buffer[1] == '\0')
+  {
+    *target = 0;
+    return 1;
+  }
+  int base = 10;
+  int j;
+  for (j = 0; j < 32; j++)
+  {
+    if (parse_buffer[j] == '\0')
+    {
+      break;
+    }
+    if (j == 0 && parse_buffer[j] == '-')
+    {
+      continue;
+    }
     if (parse_buffer[j] == 'x' && ((j == 1 && parse_buffer[0] == '0') || (j == 2 && parse_buffer[0] == '-' && parse_buffer[1] == '0')))
     {
       base = 16;
@@ -389,11 +1248,212 @@ int safeParseLong(long *target)
   return 1;
 }
 
-int main(int argn, char **argv)
+void resetState()
+{
+  is_filter_foreground = 0;
+  is_filter_desktop = 0;
+  is_filter_message = 0;
+  is_filter_title = 0;
+  freePatternMatcher(&title_matcher);
+  is_filter_class_pattern = 0;
+  freePatternMatcher(&class_matcher);
+  is_filter_handle = 0;
+  filter_handle_list_size = 0;
+  is_filter_handle_stream = 0;
+  handle_read_count = 0;
+  handle_duplicate_count = 0;
+  handle_invalid_count = 0;
+  is_filter_parent = 0;
+  filter_parent = 0;
+  is_filter_pid = 0;
+  filter_pid = 0;
+  is_filter_style = 0;
+  filter_style = 0;
+  is_filter_exstyle = 0;
+  filter_exstyle = 0;
+  is_filter_class = 0;
+  filter_class[0] = '\0';
+  is_filter_where = 0;
+  expression_root = -1;
+  expression_evaluation_count = 0;
+  expression_fetch_count = 0;
+  is_option_watch = 0;
+  is_option_tree = 0;
+  tree_depth = -1;
+  tree_thread_count = 0;
+  tree_node_count = 0;
+  tree_steal_count = 0;
+  tree_used_worker_count = 0;
+  layout_mode = LAYOUT_NONE;
+  layout_window_count = 0;
+  layout_applied_batch_count = 0;
+  layout_deferred_count = 0;
+  layout_fallback_count = 0;
+  is_option_benchmark = 0;
+  fetch_timeout = 0;
+  fetch_timeout_count = 0;
+  fetch_used_worker_count = 0;
+  // The spatial index itself is kept for the next request
+  spatial_query_count = 0;
+  spatial_build_count = 0;
+  spatial_reuse_count = 0;
+  spatial_candidate_count = 0;
+  spatial_build_time = 0;
+  spatial_query_time = 0;
+  is_option_visible_area = 0;
+  resetOcclusion();
+  resetOrder();
+  resetAggregate();
+  resetCapture();
+  resetFocus();
+  resetPublish();
+  is_option_baseline = 0;
+  is_option_save_baseline = 0;
+  benchmark_tolerance = 20;
+  output_format = FORMAT_JSON;
+  resetSnapshots();
+  watch_interval = 250;
+  is_action_set_foreground = 0;
+  is_action_bring_to_top = 0;
+  is_action_move = 0;
+  action_x = 0;
+  action_y = 0;
+  is_action_size = 0;
+  action_w = 0;
+  action_h = 0;
+  is_action_show = 0;
+  is_action_hide = 0;
+  is_action_maximize = 0;
+  is_action_minimize = 0;
+  last_next = NULL;
+  is_option_stats = 0;
+  resetStats();
+  output_fields = FIELD_ALL;
+  filter_fields = 0;
+  resetProcessCache();
+  resetCounter(&backend_process_open_count);
+  resetCounter(&backend_call_count);
+}
+
+// Modes and options that restrict each other, the active ones are collected once into a mask checked against a table
+#define MODE_ACTIONS (1u << 0)
+#define MODE_HANDLE (1u << 1)
+#define MODE_FOREGROUND (1u << 2)
+#define MODE_PARENT (1u << 3)
+#define MODE_DESKTOP (1u << 4)
+#define MODE_FILTERS (1u << 5)
+#define MODE_HANDLE_STREAM (1u << 6)
+#define MODE_WATCH (1u << 7)
+#define MODE_TREE (1u << 8)
+#define MODE_LAYOUT (1u << 9)
+#define MODE_LAYOUT_FILE (1u << 10)
+#define MODE_BENCHMARK (1u << 11)
+#define MODE_SPATIAL (1u << 12)
+#define MODE_VISIBLE_AREA (1u << 13)
+#define MODE_OCCLUSION (1u << 14)
+#define MODE_ORDER (1u << 15)
+#define MODE_AGGREGATE (1u << 16)
+#define MODE_CAPTURE (1u << 17)
+#define MODE_TIMEOUT (1u << 18)
+#define MODE_SNAPSHOT (1u << 19)
+#define MODE_SINCE (1u << 20)
+#define MODE_PUBLISH (1u << 21)
+#define MODE_READ_PUBLISHED (1u << 22)
+#define MODE_FOCUS_RECORD (1u << 23)
+#define MODE_FOCUS_HISTORY (1u << 24)
+#define MODE_BINARY (1u << 25)
+#define MODE_NOT_JSON (1u << 26)
+#define MODE_SERVE (1u << 27)
+
+#define MODE_FOCUS_CONFLICTS (MODE_ACTIONS | MODE_HANDLE | MODE_PARENT | MODE_FOREGROUND | MODE_FILTERS | MODE_HANDLE_STREAM | MODE_WATCH | MODE_TREE | MODE_LAYOUT | MODE_BENCHMARK | MODE_SPATIAL | MODE_VISIBLE_AREA | MODE_ORDER | MODE_AGGREGATE | MODE_CAPTURE | MODE_TIMEOUT | MODE_SNAPSHOT | MODE_SINCE | MODE_BINARY)
+
+typedef struct
+{
+  uint32_t mode;
+  uint32_t conflicts;
+  const char *error;
+} ModeConflict;
+
+// Checked in order, the first conflict of an active mode is reported
+const ModeConflict mode_conflicts[] = {
+    {MODE_FOCUS_RECORD, MODE_SERVE, "Focus recording is not available in serve mode"},
+    {MODE_FOCUS_RECORD, MODE_FOCUS_CONFLICTS, "Focus recording runs on its own, without filters, operations, snapshots or other modes"},
+    {MODE_FOCUS_HISTORY, MODE_FOCUS_CONFLICTS, "Focus history only applies to JSON and NDJSON without filters, operations or other modes"},
+    {MODE_READ_PUBLISHED, MODE_PUBLISH | MODE_ACTIONS | MODE_HANDLE | MODE_PARENT | MODE_DESKTOP | MODE_FOREGROUND | MODE_FILTERS | MODE_HANDLE_STREAM | MODE_WATCH | MODE_TREE | MODE_LAYOUT | MODE_BENCHMARK | MODE_SPATIAL | MODE_VISIBLE_AREA | MODE_ORDER | MODE_AGGREGATE | MODE_CAPTURE | MODE_TIMEOUT | MODE_SNAPSHOT | MODE_SINCE, "Published lists are read as they were published, without filters, operations or other modes"},
+    {MODE_SPATIAL, MODE_ACTIONS | MODE_WATCH | MODE_TREE | MODE_LAYOUT | MODE_BENCHMARK | MODE_SNAPSHOT | MODE_SINCE | MODE_TIMEOUT | MODE_BINARY | MODE_HANDLE | MODE_FOREGROUND, "Spatial queries only apply to the desktop and parent scopes in JSON or NDJSON without operations, modes or snapshots"},
+    {MODE_OCCLUSION, MODE_ACTIONS | MODE_WATCH | MODE_LAYOUT | MODE_BENCHMARK | MODE_SNAPSHOT | MODE_SINCE | MODE_BINARY, "Visible areas only apply to JSON and NDJSON lists without operations, watches, layouts, benchmarks or snapshots"},
+    {MODE_TIMEOUT, MODE_ACTIONS | MODE_WATCH | MODE_TREE | MODE_LAYOUT | MODE_BENCHMARK | MODE_SNAPSHOT | MODE_SINCE | MODE_BINARY, "Timeouts only apply to JSON and NDJSON lists without operations, trees, layouts or snapshots"},
+    {MODE_ORDER, MODE_WATCH | MODE_BENCHMARK | MODE_LAYOUT_FILE | MODE_SPATIAL | MODE_SNAPSHOT | MODE_SINCE, "Sorting and pages do not apply to watches, benchmarks, layout files, spatial queries or snapshots"},
+    {MODE_AGGREGATE, MODE_ACTIONS | MODE_WATCH | MODE_TREE | MODE_LAYOUT | MODE_BENCHMARK | MODE_SPATIAL | MODE_SNAPSHOT | MODE_SINCE | MODE_TIMEOUT | MODE_BINARY, "Groups only apply to JSON and NDJSON lists without operations, modes, timeouts or snapshots"},
+    {MODE_CAPTURE, MODE_ACTIONS | MODE_WATCH | MODE_TREE | MODE_LAYOUT | MODE_BENCHMARK | MODE_SPATIAL | MODE_AGGREGATE | MODE_TIMEOUT | MODE_SNAPSHOT | MODE_SINCE | MODE_PUBLISH | MODE_BINARY, "Captures only apply to JSON and NDJSON lists without operations, modes, groups, timeouts or snapshots"},
+    {MODE_PUBLISH, MODE_SERVE, "Publishing is not available in serve mode"},
+    {MODE_PUBLISH, MODE_ACTIONS | MODE_WATCH | MODE_TREE | MODE_LAYOUT | MODE_BENCHMARK | MODE_SPATIAL | MODE_AGGREGATE | MODE_TIMEOUT | MODE_SNAPSHOT | MODE_SINCE, "Publishing only applies to window lists without operations, modes, groups, timeouts or snapshots"},
+    {MODE_WATCH, MODE_SERVE, "Watch mode is not available in serve mode"},
+    {MODE_WATCH, MODE_HANDLE | MODE_FOREGROUND | MODE_ACTIONS, "Watch mode only supports the --desktop and --parent scopes without operations"},
+    {MODE_BENCHMARK, MODE_SERVE, "Benchmark mode is not available in serve mode"},
+    {MODE_BENCHMARK, MODE_ACTIONS | MODE_TREE | MODE_LAYOUT | MODE_SNAPSHOT | MODE_SINCE, "Benchmark mode cannot be combined with operations, trees, layouts or snapshots"},
+    {MODE_TREE, MODE_ACTIONS | MODE_SNAPSHOT | MODE_SINCE | MODE_NOT_JSON, "Tree mode only supports the JSON format without operations or snapshots"},
+    {MODE_LAYOUT, MODE_ACTIONS | MODE_TREE | MODE_SNAPSHOT | MODE_SINCE, "Layout mode cannot be combined with operations, trees or snapshots"}};
+
+// Returns non-zero when the listing needs the visible areas of the top-level windows
+int isOcclusionSelected()
+{
+  return is_option_visible_area || (output_fields & FIELD_VISIBLE_AREA) != 0 || order_key == ORDER_VISIBLE_AREA || (is_filter_where && (findExpressionGroups() & GROUP_OCCLUSION) != 0);
+}
+
+uint32_t getActiveModes()
+{
+  uint32_t modes = 0;
+  modes |= checkHasActions() ? MODE_ACTIONS : 0;
+  modes |= is_filter_handle ? MODE_HANDLE : 0;
+  modes |= is_filter_foreground ? MODE_FOREGROUND : 0;
+  modes |= is_filter_parent ? MODE_PARENT : 0;
+  modes |= is_filter_desktop ? MODE_DESKTOP : 0;
+  modes |= is_filter_pid || is_filter_class || is_filter_class_pattern || is_filter_title || is_filter_style || is_filter_exstyle || is_filter_where ? MODE_FILTERS : 0;
+  modes |= is_filter_handle_stream ? MODE_HANDLE_STREAM : 0;
+  modes |= is_option_watch ? MODE_WATCH : 0;
+  modes |= is_option_tree ? MODE_TREE : 0;
+  modes |= layout_mode != LAYOUT_NONE ? MODE_LAYOUT : 0;
+  modes |= layout_mode == LAYOUT_FILE ? MODE_LAYOUT_FILE : 0;
+  modes |= is_option_benchmark ? MODE_BENCHMARK : 0;
+  modes |= spatial_query_count > 0 ? MODE_SPATIAL : 0;
+  modes |= is_option_visible_area ? MODE_VISIBLE_AREA : 0;
+  modes |= isOcclusionSelected() ? MODE_OCCLUSION : 0;
+  modes |= isOrderingSelection() ? MODE_ORDER : 0;
+  modes |= aggregate_key != AGGREGATE_NONE ? MODE_AGGREGATE : 0;
+  modes |= is_option_capture ? MODE_CAPTURE : 0;
+  modes |= fetch_timeout > 0 ? MODE_TIMEOUT : 0;
+  modes |= is_option_snapshot_out ? MODE_SNAPSHOT : 0;
+  modes |= is_option_since ? MODE_SINCE : 0;
+  modes |= is_option_publish ? MODE_PUBLISH : 0;
+  modes |= is_option_read_published ? MODE_READ_PUBLISHED : 0;
+  modes |= focus_mode == FOCUS_RECORD ? MODE_FOCUS_RECORD : 0;
+  modes |= focus_mode != FOCUS_NONE && focus_mode != FOCUS_RECORD ? MODE_FOCUS_HISTORY : 0;
+  modes |= output_format == FORMAT_BINARY ? MODE_BINARY : 0;
+  modes |= output_format != FORMAT_JSON ? MODE_NOT_JSON : 0;
+  modes |= is_output_captured ? MODE_SERVE : 0;
+  return modes;
+}
+
+// Returns the error of the first conflict between the active modes, or NULL when they can be combined
+const char *findModeConflict(uint32_t modes)
+{
+  size_t i;
+  for (i = 0; i < sizeof(mode_conflicts) / sizeof(mode_conflicts[0]); i++)
+  {
+    if ((modes & mode_conflicts[i].mode) != 0 && (modes & mode_conflicts[i].conflicts) != 0)
+      return mode_conflicts[i].error;
+  }
+  return NULL;
+}
+
+int executeArguments(int argn, char **argv)
 {
   if (verbose)
-    printf("[Verbose] Program started with %d arguments\n", argn);
+    printf("[Verbose] Executing with %d arguments\n", argn);
 
+  // The clock is read before the arguments are parsed since --stats is not known until then
+  stats_start_time = getClockNanoseconds();
   if (argn <= 1 || argv == NULL || argv[0] == NULL || argv[1] == NULL || argv[1][0] == '\0')
   {
     printHelp();
@@ -401,6 +1461,23 @@ int main(int argn, char **argv)
   }
   int isHelpArg;
   int isMessageArg;
+  int isStatsArg;
+  int isWatchArg;
+  int isIntervalArg;
+  int isTreeArg;
+  int isLayoutArg;
+  int isHandleStreamArg;
+  int isTileArg;
+  int isCascadeArg;
+  int isDepthArg;
+  int isThreadsArg;
+  int isBenchmarkArg;
+  int isBaselineArg;
+  int isToleranceArg;
+  int isTimeoutArg;
+  int isVisibleAreaArg;
+  int isAtArg;
+  int isIntersectsArg;
   int isForegroundArg;
   int isDesktopArg;
   int isSetForegroundArg;
@@ -411,6 +1488,22 @@ int main(int argn, char **argv)
   int isMaximizeArg;
   int isMinimizeArg;
   int isTitleArg;
+  int isFieldsArg;
+  int isSortArg;
+  int isGroupByArg;
+  int isCaptureArg;
+  int isLimitArg;
+  int isOffsetArg;
+  int isPublishSizeArg;
+  int isSnapshotArg;
+  int isFocusArg;
+  int isFocusSinceArg;
+  int isPublishArg;
+  int isFormatArg;
+  int isClassArg;
+  int isClassPatternArg;
+  PatternMatcher *matcher;
+  int isWhereArg;
   int isHandleArg;
   int isParentArg;
   int isPidArg;
@@ -423,6 +1516,9 @@ int main(int argn, char **argv)
   long v;
   int i;
   int j;
+  int isOcclusionUsed;
+  const char *conflict;
+  uint32_t modes;
   char *str = NULL;
   char *flag = NULL;
   char *next = NULL;
@@ -451,7 +1547,7 @@ int main(int argn, char **argv)
       v = 0;
       if (i + 1 > argn || !safeParseLong(&v))
       {
-        printf("Error: Invalid starting numeric argument: \"%s\" from index %d\n", str, i);
+        writeOutput("Error: Invalid starting numeric argument: \"%s\" from index %d\n", str, i);
         return 1;
       }
       is_filter_handle = 1;
@@ -461,7 +1557,7 @@ int main(int argn, char **argv)
     }
     if (!(c == '-' || c == '\\' || c == '=' || c == '//' || c == '*' || c == '+'))
     {
-      printf("Error: Unexpected argument prefix \"%c\" at index %d (use \"--help\" for help)\n", c, i);
+      writeOutput("Error: Unexpected argument prefix \"%c\" at index %d (use \"--help\" for help)\n", c, i);
       return 1;
     }
     c = argv[i][1];
@@ -472,7 +1568,7 @@ int main(int argn, char **argv)
     }
     if (!(c == '-' || c == '\\' || c == '=' || c == '//' || c == '*' || c == '+'))
     {
-      printf("Error: Unexpected incomplete flag argument \"%s\" at index %d (use \"--help\" for help)\n", str, i);
+      writeOutput("Error: Unexpected incomplete flag argument \"%s\" at index %d (use \"--help\" for help)\n", str, i);
       return 1;
     }
     flag = &str[2];
@@ -489,7 +1585,7 @@ int main(int argn, char **argv)
     }
     if (c == '-' || c == '\\' || c == '=' || c == '//' || c == '*' || c == '+' || c == '\0')
     {
-      printf("Error: Unexpected long flag \"%s\" at index %d\n", str, i);
+      writeOutput("Error: Unexpected long flag \"%s\" at index %d\n", str, i);
       return 1;
     }
     // Filters
@@ -511,6 +1607,47 @@ int main(int argn, char **argv)
       continue;
     }
 
+    // Options
+    isStatsArg = isMatchingString("stats", flag);
+    if (isStatsArg)
+    {
+      is_option_stats = 1;
+      continue;
+    }
+    isVisibleAreaArg = isMatchingString("visible-area", flag) || isMatchingString("occlusion", flag);
+    if (isVisibleAreaArg)
+    {
+      is_option_visible_area = 1;
+      continue;
+    }
+
+    // Modes
+    isWatchArg = isMatchingString("watch", flag) || isMatchingString("events", flag);
+    if (isWatchArg)
+    {
+      is_option_watch = 1;
+      continue;
+    }
+    isTreeArg = isMatchingString("tree", flag) || isMatchingString("hierarchy", flag);
+    if (isTreeArg)
+    {
+      is_option_tree = 1;
+      continue;
+    }
+    isBenchmarkArg = isMatchingString("benchmark", flag) || isMatchingString("bench", flag);
+    if (isBenchmarkArg)
+    {
+      is_option_benchmark = 1;
+      continue;
+    }
+    isTileArg = isMatchingString("tile", flag) || isMatchingString("grid", flag);
+    isCascadeArg = isMatchingString("cascade", flag);
+    if (isTileArg || isCascadeArg)
+    {
+      layout_mode = isTileArg ? LAYOUT_TILE : LAYOUT_CASCADE;
+      continue;
+    }
+
     // Operations
     isSetForegroundArg = isMatchingString("set-foreground", flag) || isMatchingString("set-focus", flag) || isMatchingString("set-main", flag) || (is_filter_handle != 0 && isMatchingString("focus", flag));
     isSetTopArg = isMatchingString("set-top", flag) || isMatchingString("make-top", flag) || isMatchingString("raise", flag) || isMatchingString("bring-to-top", flag) || isMatchingString("bring-top", flag);
@@ -545,123 +1682,408 @@ int main(int argn, char **argv)
       printf("[Verbose] Verifying possible standalone argument at %d.\n", i);
     if (i + 1 >= argn)
     {
-      printf("Error: Invalid or incomplete argument after \"%s\" from index %d\n", argv[i], i);
+      writeOutput("Error: Invalid or incomplete argument after \"%s\" from index %d\n", argv[i], i);
       return 1;
     }
     next = argv[i + 1];
-    isTitleArg = isMatchingString("title", flag);
-    if (isTitleArg)
+    isTitleArg = isMatchingString("title", flag) || isMatchingString("titles-from", flag);
+    isClassPatternArg = isMatchingString("class-contains", flag) || isMatchingString("classes-from", flag);
+    if (isTitleArg || isClassPatternArg)
     {
       next = argv[i + 1];
-      printf("isTitleArg src %s\n", next);
-      is_filter_title = 1;
-      for (filter_title_length = 0; filter_title_length < MIDDLE_BUFFER_SIZE; filter_title_length++)
+      matcher = isTitleArg ? &title_matcher : &class_matcher;
+      if (isMatchingString("titles-from", flag) || isMatchingString("classes-from", flag))
       {
-        c = next[filter_title_length];
-        filter_title[filter_title_length] = c;
-        if (filter_title[filter_title_length] == '\0')
-        {
-          break;
-        }
+        if (!addPatternsFromFile(matcher, next))
+          return 1;
       }
-      filter_title[filter_title_length] = '\0';
-      printf("titleArg size %zd\n", filter_title_length);
-      printf("titleArg: %s\n", filter_title);
+      else if (!addPattern(matcher, next, strlen(next)))
+      {
+        writeOutput("Error: Could not add pattern \"%s\" from index %d\n", next, i + 1);
+        return 1;
+      }
+      if (isTitleArg)
+        is_filter_title = 1;
+      else
+        is_filter_class_pattern = 1;
       i++;
       continue;
     }
 
-    if (i + 1 < argn)
+    isClassArg = isMatchingString("class", flag) || isMatchingString("classname", flag);
+    if (isClassArg)
     {
-      if (verbose)
-        printf("[Verbose] Parsing numeric argument at %d.\n", i + 1);
-      v = 0;
-      for (v = 0; v < 31 && argv[i + 1][v] != '\0'; v++)
+      next = argv[i + 1];
+      for (j = 0; j + 1 < MIDDLE_BUFFER_SIZE && next[j] != '\0'; j++)
+        filter_class[j] = next[j];
+      filter_class[j] = '\0';
+      is_filter_class = 1;
+      i++;
+      continue;
+    }
+
+    isWhereArg = isMatchingString("where", flag) || isMatchingString("filter", flag);
+    if (isWhereArg)
+    {
+      if (is_filter_where)
       {
-        parse_buffer[v] = argv[i + 1][v];
+        writeOutput("Error: Filter expression has already been specified (duplicated at index %d)\n", i);
+        return 1;
       }
-      parse_buffer[v] = '\0';
-      v = 0;
-      if (i + 1 > argn || !safeParseLong(&v))
-      {
-        printf("Error: Invalid argument after \"%s\" from index %d\n", argv[i], i);
+      if (!compileExpression(argv[i + 1]))
         return 1;
+      is_filter_where = 1;
+      i++;
+      continue;
+    }
+
+    isSnapshotArg = isMatchingString("snapshot-out", flag) || isMatchingString("snapshot", flag) || isMatchingString("since", flag);
+    if (isSnapshotArg)
+    {
+      next = argv[i + 1];
+      if (flag[1] == 'i')
+      {
+        is_option_since = 1;
+        for (j = 0; j + 1 < MIDDLE_BUFFER_SIZE && next[j] != '\0'; j++)
+          since_path[j] = next[j];
+        since_path[j] = '\0';
       }
-      if (verbose)
+      else
       {
-        printf("[Verbose] Numeric argument at %d: \"%s\"\n", i, argv[i]);
+        is_option_snapshot_out = 1;
+        for (j = 0; j + 1 < MIDDLE_BUFFER_SIZE && next[j] != '\0'; j++)
+          snapshot_out_path[j] = next[j];
+        snapshot_out_path[j] = '\0';
       }
+      i++;
+      continue;
     }
 
-    isHandleArg = isMatchingString("handle", flag);
-    if (verbose)
-      printf("[Verbose] isHandleArg %d\n", isHandleArg);
-    isParentArg = isMatchingString("parent", flag);
-    if (verbose)
-      printf("[Verbose] isParentArg %d\n", isParentArg);
-    isPidArg = isMatchingString("pid", flag) || isMatchingString("parent", flag);
-    if (verbose)
-      printf("[Verbose] isPidArg %d\n", isPidArg);
-    isStyleArg = isMatchingString("style", flag);
-    if (verbose)
-      printf("[Verbose] isStyleArg %d\n", isStyleArg);
-    isExstyleArg = isMatchingString("exstyle", flag);
-    if (verbose)
-      printf("[Verbose] isExstyleArg %d\n", isExstyleArg);
-    isMoveArg = isMatchingString("move", flag) || isMatchingString("pos", flag);
-    if (verbose)
-      printf("[Verbose] isMoveArg %d\n", isMoveArg);
-    isSizeArg = isMatchingString("size", flag) || isMatchingString("resize", flag);
-    if (verbose)
-      printf("[Verbose] isSizeArg %d\n", isSizeArg);
-    i++;
-    if (isHandleArg)
+    isHandleStreamArg = isMatchingString("handles-from", flag) || isMatchingString("handle-list", flag);
+    if (isHandleStreamArg)
     {
-      if (is_filter_handle != 1)
+      next = argv[i + 1];
+      is_filter_handle = 1;
+      is_filter_handle_stream = 1;
+      for (j = 0; j + 1 < MIDDLE_BUFFER_SIZE && next[j] != '\0'; j++)
+        handle_stream_path[j] = next[j];
+      handle_stream_path[j] = '\0';
+      i++;
+      continue;
+    }
+
+    isLayoutArg = isMatchingString("layout", flag) || isMatchingString("layout-from", flag);
+    if (isLayoutArg)
+    {
+      next = argv[i + 1];
+      layout_mode = LAYOUT_FILE;
+      for (j = 0; j + 1 < MIDDLE_BUFFER_SIZE && next[j] != '\0'; j++)
+        layout_path[j] = next[j];
+      layout_path[j] = '\0';
+      i++;
+      continue;
+    }
+
+    isBaselineArg = isMatchingString("baseline", flag) || isMatchingString("save-baseline", flag);
+    if (isBaselineArg)
+    {
+      next = argv[i + 1];
+      if (flag[0] == 's' || flag[0] == 'S')
       {
-        is_filter_handle = 1;
-        filter_handle_list_size = 0;
+        is_option_save_baseline = 1;
+        for (j = 0; j + 1 < MIDDLE_BUFFER_SIZE && next[j] != '\0'; j++)
+          save_baseline_path[j] = next[j];
+        save_baseline_path[j] = '\0';
       }
-      if (verbose)
-        printf("[Verbose] Setting handler filter [%d] to %" PRId64 "\n", (int)filter_handle_list_size, (int64_t)v);
-      if (filter_handle_list_size >= SMALL_BUFFER_SIZE)
+      else
       {
-        printf("Error: Too many window handles have been specified (Max is %d)\n", (int)SMALL_BUFFER_SIZE);
-        return 1;
+        is_option_baseline = 1;
+        for (j = 0; j + 1 < MIDDLE_BUFFER_SIZE && next[j] != '\0'; j++)
+          baseline_path[j] = next[j];
+        baseline_path[j] = '\0';
       }
-      filter_handle_list[filter_handle_list_size] = v;
-      filter_handle_list_size++;
+      i++;
       continue;
     }
-    if (isParentArg)
+
+    isFormatArg = isMatchingString("format", flag) || isMatchingString("output", flag);
+    if (isFormatArg)
     {
-      if (is_filter_parent == 1)
+      next = argv[i + 1];
+      if (isMatchingString("json", next))
+        output_format = FORMAT_JSON;
+      else if (isMatchingString("ndjson", next) || isMatchingString("jsonl", next) || isMatchingString("lines", next))
+        output_format = FORMAT_NDJSON;
+      else if (isMatchingString("binary", next) || isMatchingString("bin", next))
+        output_format = FORMAT_BINARY;
+      else
       {
-        printf("Error: Window parent has already been specified (duplicated at index %d)\n", i);
+        writeOutput("Error: Unknown output format \"%s\" (expected json, ndjson or binary)\n", next);
         return 1;
       }
-      is_filter_parent = 1;
-      filter_parent = v;
+#if defined(_WIN32)
+      // Line breaks of binary output must not be translated by the console runtime
+      if (output_format == FORMAT_BINARY && !is_output_captured)
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+      i++;
       continue;
     }
-    if (isPidArg)
+
+    isSortArg = isMatchingString("sort", flag) || isMatchingString("order-by", flag) || isMatchingString("sort-by", flag);
+    if (isSortArg)
     {
-      if (is_filter_pid == 1)
-      {
-        printf("Error: Window pid has already been specified (duplicated at index %d)\n", i);
+      if (!parseOrderKey(argv[i + 1]))
         return 1;
-      }
-      is_filter_pid = 1;
-      filter_pid = v;
+      i++;
       continue;
     }
-    if (isStyleArg)
+
+    isFocusSinceArg = isMatchingString("focus-since", flag);
+    if (isFocusSinceArg)
     {
-      is_filter_style = 1;
-      filter_style = v;
+      if (!parseFocusSince(argv[i + 1]))
+        return 1;
+      i++;
       continue;
     }
-    if (isExstyleArg)
+
+    isFocusArg = isMatchingString("record-focus", flag) || isMatchingString("focus-history", flag);
+    if (isFocusArg)
+    {
+      next = argv[i + 1];
+      focus_mode = flag[0] == 'r' || flag[0] == 'R' ? FOCUS_RECORD : FOCUS_HISTORY;
+      for (j = 0; j + 1 < MIDDLE_BUFFER_SIZE && next[j] != '\0'; j++)
+        focus_path[j] = next[j];
+      focus_path[j] = '\0';
+      i++;
+      continue;
+    }
+
+    isPublishArg = isMatchingString("publish", flag) || isMatchingString("read-published", flag);
+    if (isPublishArg)
+    {
+      next = argv[i + 1];
+      if (flag[0] == 'r' || flag[0] == 'R')
+        is_option_read_published = 1;
+      else
+        is_option_publish = 1;
+      for (j = 0; j + 1 < MIDDLE_BUFFER_SIZE && next[j] != '\0'; j++)
+        publish_name[j] = next[j];
+      publish_name[j] = '\0';
+      i++;
+      continue;
+    }
+
+    isGroupByArg = isMatchingString("group-by", flag) || isMatchingString("group", flag) || isMatchingString("aggregate", flag);
+    if (isGroupByArg)
+    {
+      if (!parseAggregateKey(argv[i + 1]))
+        return 1;
+      i++;
+      continue;
+    }
+
+    isCaptureArg = isMatchingString("capture", flag) || isMatchingString("screenshot", flag);
+    if (isCaptureArg)
+    {
+      if (!parseCapturePath(argv[i + 1]))
+        return 1;
+      i++;
+      continue;
+    }
+
+    isFieldsArg = isMatchingString("fields", flag) || isMatchingString("field", flag) || isMatchingString("select", flag);
+    if (isFieldsArg)
+    {
+      if (!parseFieldList(argv[i + 1], &output_fields))
+        return 1;
+      i++;
+      continue;
+    }
+
+    isAtArg = isMatchingString("at", flag) || isMatchingString("hit-test", flag) || isMatchingString("point", flag);
+    isIntersectsArg = isMatchingString("intersects", flag) || isMatchingString("intersect", flag);
+    if (isAtArg || isIntersectsArg)
+    {
+      if (!parseSpatialQuery(isAtArg ? SPATIAL_AT : SPATIAL_INTERSECTS, argn, argv, i + 1))
+        return 1;
+      i += isAtArg ? 2 : 4;
+      continue;
+    }
+
+    if (i + 1 < argn)
+    {
+      if (verbose)
+        printf("[Verbose] Parsing numeric argument at %d.\n", i + 1);
+      v = 0;
+      for (v = 0; v < 31 && argv[i + 1][v] != '\0'; v++)
+      {
+        parse_buffer[v] = argv[i + 1][v];
+      }
+      parse_buffer[v] = '\0';
+      v = 0;
+      if (i + 1 > argn || !safeParseLong(&v))
+      {
+        writeOutput("Error: Invalid argument after \"%s\" from index %d\n", argv[i], i);
+        return 1;
+      }
+      if (verbose)
+      {
+        printf("[Verbose] Numeric argument at %d: \"%s\"\n", i, argv[i]);
+      }
+    }
+
+    isHandleArg = isMatchingString("handle", flag);
+    if (verbose)
+      printf("[Verbose] isHandleArg %d\n", isHandleArg);
+    isParentArg = isMatchingString("parent", flag);
+    if (verbose)
+      printf("[Verbose] isParentArg %d\n", isParentArg);
+    isPidArg = isMatchingString("pid", flag) || isMatchingString("parent", flag);
+    if (verbose)
+      printf("[Verbose] isPidArg %d\n", isPidArg);
+    isStyleArg = isMatchingString("style", flag);
+    if (verbose)
+      printf("[Verbose] isStyleArg %d\n", isStyleArg);
+    isExstyleArg = isMatchingString("exstyle", flag);
+    if (verbose)
+      printf("[Verbose] isExstyleArg %d\n", isExstyleArg);
+    isMoveArg = isMatchingString("move", flag) || isMatchingString("pos", flag);
+    if (verbose)
+      printf("[Verbose] isMoveArg %d\n", isMoveArg);
+    isSizeArg = isMatchingString("size", flag) || isMatchingString("resize", flag);
+    if (verbose)
+      printf("[Verbose] isSizeArg %d\n", isSizeArg);
+    isIntervalArg = isMatchingString("interval", flag);
+    isDepthArg = isMatchingString("depth", flag);
+    isThreadsArg = isMatchingString("threads", flag) || isMatchingString("jobs", flag);
+    isToleranceArg = isMatchingString("tolerance", flag);
+    isTimeoutArg = isMatchingString("timeout", flag);
+    isLimitArg = isMatchingString("limit", flag) || isMatchingString("first", flag);
+    isOffsetArg = isMatchingString("offset", flag) || isMatchingString("skip", flag);
+    isPublishSizeArg = isMatchingString("publish-size", flag);
+    i++;
+    if (isIntervalArg)
+    {
+      if (v <= 0)
+      {
+        writeOutput("Error: Invalid watch interval %" PRId64 " (expected a positive number of milliseconds)\n", (int64_t)v);
+        return 1;
+      }
+      watch_interval = v;
+      continue;
+    }
+    if (isDepthArg)
+    {
+      if (v < 0)
+      {
+        writeOutput("Error: Invalid tree depth %" PRId64 " (expected zero or a positive number of levels)\n", (int64_t)v);
+        return 1;
+      }
+      tree_depth = v;
+      continue;
+    }
+    if (isThreadsArg)
+    {
+      if (v <= 0)
+      {
+        writeOutput("Error: Invalid thread count %" PRId64 " (expected a positive number)\n", (int64_t)v);
+        return 1;
+      }
+      tree_thread_count = v;
+      continue;
+    }
+    if (isTimeoutArg)
+    {
+      if (v <= 0)
+      {
+        writeOutput("Error: Invalid timeout %" PRId64 " (expected a positive number of milliseconds)\n", (int64_t)v);
+        return 1;
+      }
+      fetch_timeout = v;
+      continue;
+    }
+    if (isPublishSizeArg)
+    {
+      if (v <= 0)
+      {
+        writeOutput("Error: Invalid published capacity %" PRId64 " (expected a positive number of bytes)\n", (int64_t)v);
+        return 1;
+      }
+      publish_capacity = v;
+      continue;
+    }
+    if (isLimitArg || isOffsetArg)
+    {
+      if (v < 0)
+      {
+        writeOutput("Error: Invalid %s %" PRId64 " (expected zero or a positive number of windows)\n", isLimitArg ? "limit" : "offset", (int64_t)v);
+        return 1;
+      }
+      if (isLimitArg)
+        order_limit = v;
+      else
+        order_offset = v;
+      continue;
+    }
+    if (isToleranceArg)
+    {
+      if (v < 0)
+      {
+        writeOutput("Error: Invalid benchmark tolerance %" PRId64 " (expected zero or a positive percentage)\n", (int64_t)v);
+        return 1;
+      }
+      benchmark_tolerance = v;
+      continue;
+    }
+    if (isHandleArg)
+    {
+      if (is_filter_handle != 1)
+      {
+        is_filter_handle = 1;
+        filter_handle_list_size = 0;
+      }
+      if (verbose)
+        printf("[Verbose] Setting handler filter [%d] to %" PRId64 "\n", (int)filter_handle_list_size, (int64_t)v);
+      if (filter_handle_list_size >= SMALL_BUFFER_SIZE)
+      {
+        writeOutput("Error: Too many window handles have been specified (Max is %d)\n", (int)SMALL_BUFFER_SIZE);
+        return 1;
+      }
+      filter_handle_list[filter_handle_list_size] = v;
+      filter_handle_list_size++;
+      continue;
+    }
+    if (isParentArg)
+    {
+      if (is_filter_parent == 1)
+      {
+        writeOutput("Error: Window parent has already been specified (duplicated at index %d)\n", i);
+        return 1;
+      }
+      is_filter_parent = 1;
+      filter_parent = v;
+      continue;
+    }
+    if (isPidArg)
+    {
+      if (is_filter_pid == 1)
+      {
+        writeOutput("Error: Window pid has already been specified (duplicated at index %d)\n", i);
+        return 1;
+      }
+      is_filter_pid = 1;
+      filter_pid = v;
+      continue;
+    }
+    if (isStyleArg)
+    {
+      is_filter_style = 1;
+      filter_style = v;
+      continue;
+    }
+    if (isExstyleArg)
     {
       is_filter_exstyle = 1;
       filter_exstyle = v;
@@ -686,7 +2108,7 @@ int main(int argn, char **argv)
     v = 0;
     if (i + 1 > argn || !safeParseLong(&v))
     {
-      printf("Error: Invalid argument after \"%s\" from index %d\n", argv[i], i);
+      writeOutput("Error: Invalid argument after \"%s\" from index %d\n", argv[i], i);
       return 1;
     }
     if (isMoveArg)
@@ -710,7 +2132,9 @@ int main(int argn, char **argv)
     if (is_filter_message)
       printf("[Verbose] filter_message.\n");
     if (is_filter_title)
-      printf("[Verbose] filter_title: [%zd] %s\n", (int64_t)filter_title_length, filter_title);
+      printf("[Verbose] filter_title: %d patterns\n", title_matcher.pattern_count);
+    if (is_filter_class_pattern)
+      printf("[Verbose] filter_class_pattern: %d patterns\n", class_matcher.pattern_count);
     if (is_filter_handle && filter_handle_list_size > 0)
       printf("[Verbose] filter_handle_list[0]: %" PRId64 "\n", (int64_t)filter_handle_list[0]);
     if (is_filter_handle && filter_handle_list_size > 1)
@@ -743,156 +2167,738 @@ int main(int argn, char **argv)
       printf("[Verbose] is_action_minimize: %" PRId64 "\n", (int64_t)is_action_minimize);
   }
 
-  if (is_filter_message || is_filter_title || is_filter_pid || is_filter_style || is_filter_exstyle)
+  // Equality comparisons that every match must satisfy select the windows at the source like the --pid and --class filters
+  if (is_filter_where && !is_filter_pid && findRequiredExpressionNumber(ATTRIBUTE_PID, &filter_pid))
+    is_filter_pid = 1;
+
+  if ((is_filter_title && !buildPatternMatcher(&title_matcher)) || (is_filter_class_pattern && !buildPatternMatcher(&class_matcher)))
+  {
+    writeOutput("Error: Could not allocate the pattern matcher\n");
+    return 1;
+  }
+
+  stats_parse_time = getClockNanoseconds() - stats_start_time;
+
+  if (is_filter_message)
   {
-    printf("Error: Selected filters are not implemented\n");
+    writeOutput("Error: Selected filters are not implemented\n");
     return 1;
   }
 
-  return startProgram();
+  if (is_filter_handle_stream && is_output_captured && handle_stream_path[0] == '-' && handle_stream_path[1] == '\0')
+  {
+    writeOutput("Error: Handles cannot be read from stdin in serve mode\n");
+    return 1;
+  }
+
+  modes = getActiveModes();
+  conflict = findModeConflict(modes);
+  if (conflict != NULL)
+  {
+    writeOutput("Error: %s\n", conflict);
+    return 1;
+  }
+  // Workers abandoned by a --timeout of an earlier serve request may still be reading windows: requests that change windows
+  // wait for them, and so does every request when a listing of the backend replaces what the workers read
+  if ((modes & (MODE_ACTIONS | MODE_LAYOUT)) != 0 || !WINDOW_STATE_BACKEND_CONCURRENT_LISTING)
+    waitFetchWorkers();
+  if (is_option_focus_since && focus_mode != FOCUS_HISTORY)
+  {
+    writeOutput("Error: The --focus-since time only applies to --focus-history\n");
+    return 1;
+  }
+
+  if (focus_mode != FOCUS_NONE)
+  {
+    if (focus_mode == FOCUS_RECORD)
+      i = recordFocus();
+    else
+      i = writeFocusHistory(focus_since);
+    if (is_option_stats)
+      writeStats();
+    return i;
+  }
+
+  if (is_option_read_published)
+  {
+    i = writePublishedList();
+    if (is_option_stats)
+      writeStats();
+    return i;
+  }
+
+  // Windows changed by this process are not reported by the backend, so a kept spatial index is rebuilt after them
+  if (checkHasActions() || layout_mode != LAYOUT_NONE)
+    is_spatial_index_built = 0;
+
+  if (spatial_query_count > 0 && is_filter_parent && !is_filter_desktop && !backendIsWindow((HWND)filter_parent))
+  {
+    writeOutput("Error: Could not find parent window\n");
+    return 237;
+  }
+
+  isOcclusionUsed = isOcclusionSelected();
+  if (output_fields & FIELD_VISIBLE_AREA)
+    is_option_visible_area = 1;
+  if (is_option_visible_area)
+    output_fields |= FIELD_VISIBLE_AREA;
+
+  // The windows above a window may be outside of the selection, so every top-level window is computed before the listing
+  if (isOcclusionUsed && !computeOcclusion())
+  {
+    writeOutput("Error: Could not allocate the visible areas\n");
+    return 1;
+  }
+
+  if (is_option_publish)
+  {
+    i = runPublisher(is_filter_parent && !is_filter_desktop ? (HWND)filter_parent : NULL, isOcclusionUsed);
+    if (is_option_stats)
+      writeStats();
+    return i;
+  }
+
+  if (is_option_watch)
+  {
+    if (is_filter_parent && !is_filter_desktop && !backendIsWindow((HWND)filter_parent))
+    {
+      writeOutput("Error: Target parent %" PRId64 " was not found\n", (int64_t)filter_parent);
+      return 1;
+    }
+    i = watchWindows(is_filter_parent && !is_filter_desktop ? (HWND)filter_parent : NULL);
+    if (is_option_stats)
+      writeStats();
+    return i;
+  }
+
+  if (is_option_benchmark)
+  {
+    i = runBenchmark();
+    if (is_option_stats)
+      writeStats();
+    return i;
+  }
+
+  if (is_option_tree)
+  {
+    i = writeWindowTree();
+    if (is_option_stats)
+      writeStats();
+    return i;
+  }
+
+  if (layout_mode != LAYOUT_NONE)
+  {
+    if (layout_mode == LAYOUT_FILE && is_output_captured && layout_path[0] == '-' && layout_path[1] == '\0')
+    {
+      writeOutput("Error: Layout cannot be read from stdin in serve mode\n");
+      return 1;
+    }
+    if (layout_mode != LAYOUT_FILE && !is_filter_handle && !is_filter_foreground && !is_filter_parent && !is_filter_desktop && !is_filter_pid && !is_filter_class && !is_filter_style && !is_filter_exstyle && !is_filter_where && !is_filter_title && !is_filter_class_pattern)
+    {
+      writeOutput("Error: Cannot arrange windows because there are no window filters\n");
+      return 225;
+    }
+    i = runLayout();
+    if (is_option_stats)
+      writeStats();
+    return i;
+  }
+
+  if (spatial_query_count > 0)
+  {
+    i = writeSpatialQueries();
+    if (is_option_stats)
+      writeStats();
+    return i;
+  }
+
+  i = startProgram();
+  if (is_option_stats)
+    writeStats();
+  return i;
+}
+
+#define REQUEST_ARGUMENT_LIMIT 256
+
+char request_line[BUFFER_SIZE];
+char *request_argv[REQUEST_ARGUMENT_LIMIT];
+int request_argn = 0;
+char request_id[SMALL_BUFFER_SIZE];
+
+char *skipJsonWhitespace(char *str)
+{
+  while (*str == ' ' || *str == '\t' || *str == '\r' || *str == '\n')
+    str++;
+  return str;
+}
+
+// Returns the value of the 4 hexadecimal digits of a \u escape, or -1 when they are not all hexadecimal
+long parseJsonHexQuad(const char *str)
+{
+  long code = 0;
+  int j;
+  for (j = 0; j < 4; j++)
+  {
+    code <<= 4;
+    if (str[j] >= '0' && str[j] <= '9')
+      code |= str[j] - '0';
+    else if (str[j] >= 'a' && str[j] <= 'f')
+      code |= str[j] - 'a' + 10;
+    else if (str[j] >= 'A' && str[j] <= 'F')
+      code |= str[j] - 'A' + 10;
+    else
+      return -1;
+  }
+  return code;
+}
+
+// Decodes a JSON string in place (the cursor must be at the opening quote) and returns the position after the closing quote,
+// an escaped NUL character or a lone surrogate is rejected since the arguments are NUL terminated UTF-8 strings
+char *parseJsonStringInPlace(char *str, char **value)
+{
+  char *write = str;
+  long code;
+  long low_code;
+  if (*str != '"')
+    return NULL;
+  str++;
+  *value = write;
+  while (*str != '"')
+  {
+    if (*str == '\0')
+      return NULL;
+    if (*str != '\\')
+    {
+      *write++ = *str++;
+      continue;
+    }
+    str++;
+    switch (*str)
+    {
+    case 'n':
+      *write++ = '\n';
+      break;
+    case 't':
+      *write++ = '\t';
+      break;
+    case 'r':
+      *write++ = '\r';
+      break;
+    case 'b':
+      *write++ = '\b';
+      break;
+    case 'f':
+      *write++ = '\f';
+      break;
+    case 'u':
+      code = parseJsonHexQuad(str + 1);
+      if (code <= 0 || (code >= 0xDC00 && code <= 0xDFFF))
+        return NULL;
+      str += 4;
+      // A high surrogate must be followed by an escaped low surrogate, the pair is one code point above the basic plane
+      if (code >= 0xD800 && code <= 0xDBFF)
+      {
+        if (str[1] != '\\' || str[2] != 'u')
+          return NULL;
+        low_code = parseJsonHexQuad(str + 3);
+        if (low_code < 0xDC00 || low_code > 0xDFFF)
+          return NULL;
+        code = 0x10000 + ((code - 0xD800) << 10) + (low_code - 0xDC00);
+        str += 6;
+      }
+      if (code < 0x80)
+      {
+        *write++ = (char)code;
+      }
+      else if (code < 0x800)
+      {
+        *write++ = (char)(0xC0 | (code >> 6));
+        *write++ = (char)(0x80 | (code & 0x3F));
+      }
+      else if (code < 0x10000)
+      {
+        *write++ = (char)(0xE0 | (code >> 12));
+        *write++ = (char)(0x80 | ((code >> 6) & 0x3F));
+        *write++ = (char)(0x80 | (code & 0x3F));
+      }
+      else
+      {
+        *write++ = (char)(0xF0 | (code >> 18));
+        *write++ = (char)(0x80 | ((code >> 12) & 0x3F));
+        *write++ = (char)(0x80 | ((code >> 6) & 0x3F));
+        *write++ = (char)(0x80 | (code & 0x3F));
+      }
+      break;
+    case '"':
+    case '\\':
+    case '/':
+      *write++ = *str;
+      break;
+    default:
+      // Any other escape is invalid JSON, as is a backslash at the end of the text
+      return NULL;
+    }
+    str++;
+  }
+  *write = '\0';
+  return str + 1;
 }
 
-size_t makeWindowJson(char *buffer, size_t buffer_size, HWND h)
+// Returns the position after a JSON number, boolean or null token
+char *skipJsonLiteral(char *str)
 {
-  int is_win = h == NULL ? 0 : IsWindow(h);
+  while ((*str >= '0' && *str <= '9') || (*str >= 'a' && *str <= 'z') || *str == '-' || *str == '+' || *str == '.' || *str == 'E')
+    str++;
+  return str;
+}
+
+// Parses a request line such as {"id": 1, "args": ["--handle", 1234]} into the request argument list
+int parseRequestLine(char *str)
+{
+  char *key;
+  char *value;
+  char *end;
+  char separator;
+  size_t length;
+  separator = '\0';
+  request_argn = 0;
+  request_argv[request_argn++] = "window-state";
+  request_id[0] = '\0';
+  str = skipJsonWhitespace(str);
+  if (*str != '{')
+    return 0;
+  str = skipJsonWhitespace(str + 1);
+  while (*str != '}')
+  {
+    str = parseJsonStringInPlace(str, &key);
+    if (str == NULL)
+      return 0;
+    str = skipJsonWhitespace(str);
+    if (*str != ':')
+      return 0;
+    str = skipJsonWhitespace(str + 1);
+    if (isMatchingString("args", key) && *str == '[')
+    {
+      str = skipJsonWhitespace(str + 1);
+      if (*str == ']')
+        str = skipJsonWhitespace(str + 1);
+      else
+        separator = ',';
+      while (separator == ',' && *str != '\0')
+      {
+        if (*str == '"')
+        {
+          str = parseJsonStringInPlace(str, &value);
+        }
+        else
+        {
+          value = str;
+          str = skipJsonLiteral(str);
+          if (str == value)
+            return 0;
+        }
+        if (str == NULL || request_argn + 1 >= REQUEST_ARGUMENT_LIMIT)
+          return 0;
+        end = str;
+        str = skipJsonWhitespace(str);
+        separator = *str;
+        if (separator != ',' && separator != ']')
+          return 0;
+        *end = '\0';
+        request_argv[request_argn++] = value;
+        str = skipJsonWhitespace(str + 1);
+        if (separator == ']')
+          break;
+      }
+    }
+    else if (isMatchingString("id", key))
+    {
+      value = str;
+      if (*str == '"')
+      {
+        for (str++; *str != '"' && *str != '\0'; str++)
+          if (*str == '\\' && str[1] != '\0')
+            str++;
+        if (*str == '\0')
+          return 0;
+        str++;
+      }
+      else
+      {
+        str = skipJsonLiteral(str);
+      }
+      length = (size_t)(str - value);
+      if (length == 0 || length >= SMALL_BUFFER_SIZE)
+        return 0;
+      memcpy(request_id, value, length);
+      request_id[length] = '\0';
+    }
+    else
+    {
+      return 0;
+    }
+    str = skipJsonWhitespace(str);
+    if (*str == ',')
+      str = skipJsonWhitespace(str + 1);
+    else if (*str != '}')
+      return 0;
+  }
+  request_argv[request_argn] = NULL;
+  return 1;
+}
+
+// Serves requests from stdin until it closes, each response is framed by a header line with the byte length of its payload:
+// {"id": <id>, "code": <exit code>, "length": <payload bytes>}\n<payload>\n
+int serveRequests()
+{
+  int code;
+  size_t length;
+#if defined(_WIN32)
+  // Response lengths count bytes, so line breaks must not be translated by the console runtime
+  _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  while (fgets(request_line, BUFFER_SIZE, stdin) != NULL)
+  {
+    length = strlen(request_line);
+    if (length == 0 || (length == 1 && request_line[0] == '\n'))
+      continue;
+    // Workers abandoned by a --timeout of a previous request may still be reading windows, they are only waited for by the
+    // requests that need them gone, see executeArguments
+    releaseFetchWorkers();
+    resetState();
+    is_output_captured = 1;
+    output_length = 0;
+    if (length + 1 >= BUFFER_SIZE && request_line[length - 1] != '\n')
+    {
+      while (fgets(request_line, BUFFER_SIZE, stdin) != NULL && request_line[strlen(request_line) - 1] != '\n')
+        continue;
+      request_id[0] = '\0';
+      writeOutput("Error: Request line exceeds %d bytes\n", (int)BUFFER_SIZE);
+      code = 1;
+    }
+    else if (!parseRequestLine(request_line))
+    {
+      writeOutput("Error: Invalid request line (expected {\"id\": <id>, \"args\": [...]})\n");
+      code = 1;
+    }
+    else
+    {
+      code = executeArguments(request_argn, request_argv);
+    }
+    flushJsonWriter(&output_writer);
+    is_output_captured = 0;
+    printf("{\"id\": %s, \"code\": %d, \"length\": %zu}\n", request_id[0] != '\0' ? request_id : "null", code, output_length);
+    if (output_length > 0)
+      fwrite(output, 1, output_length, stdout);
+    printf("\n");
+    fflush(stdout);
+  }
+  return 0;
+}
+
+int main(int argn, char **argv)
+{
+  int r;
+  if (verbose)
+    printf("[Verbose] Program started with %d arguments\n", argn);
+
+  initJsonWriter(&output_writer, NULL, 0, emitOutputBytes);
+  initMutex(&process_cache_mutex);
+  initMutex(&stats_mutex);
+  initFetch();
+
+  if (argn == 2 && argv[1] != NULL && (isMatchingString("--serve", argv[1]) || isMatchingString("--server", argv[1])))
+    return serveRequests();
+
+  r = executeArguments(argn, argv);
+  flushJsonWriter(&output_writer);
+  return r;
+}
+
+size_t getCachedProcessExecutable(DWORD pid, char *exec, size_t exec_size);
+
+size_t getProcessExecutable(DWORD pid, char *exec, size_t exec_size)
+{
+  size_t length;
+  if (!is_process_cache_shared)
+    return getCachedProcessExecutable(pid, exec, exec_size);
+  lockMutex(&process_cache_mutex);
+  length = getCachedProcessExecutable(pid, exec, exec_size);
+  unlockMutex(&process_cache_mutex);
+  return length;
+}
+
+// Resolves the executable path of a process once per execution, windows of the same process are served from an open-addressing table keyed by pid
+size_t getCachedProcessExecutable(DWORD pid, char *exec, size_t exec_size)
+{
+  size_t slot = ((size_t)pid * 2654435761u) & (PROCESS_CACHE_SIZE - 1);
+  ProcessCacheEntry *entry;
+  size_t length;
+  while (process_cache[slot].generation == process_cache_generation)
+  {
+    if (process_cache[slot].pid == pid)
+    {
+      entry = &process_cache[slot];
+      process_cache_hits++;
+      length = entry->exec_length < exec_size ? entry->exec_length : exec_size - 1;
+      memcpy(exec, entry->exec, length);
+      exec[length] = '\0';
+      return length;
+    }
+    slot = (slot + 1) & (PROCESS_CACHE_SIZE - 1);
+  }
+  process_cache_misses++;
+  length = backendGetProcessExecutable(pid, exec, exec_size);
+  // Keep the table at most three quarters full so probe sequences stay short, later processes are resolved without caching
+  if (process_cache_count >= PROCESS_CACHE_SIZE * 3 / 4)
+    return length;
+  entry = &process_cache[slot];
+  entry->pid = pid;
+  entry->generation = process_cache_generation;
+  entry->exec_length = length < MIDDLE_BUFFER_SIZE ? length : MIDDLE_BUFFER_SIZE - 1;
+  memcpy(entry->exec, exec, entry->exec_length);
+  entry->exec[entry->exec_length] = '\0';
+  process_cache_count++;
+  return length;
+}
+
+// Forgets the executables of the previous request, with the cache locked while abandoned workers of bounded fetching use it
+void resetProcessCache()
+{
+  if (is_process_cache_shared)
+    lockMutex(&process_cache_mutex);
+  process_cache_generation++;
+  process_cache_count = 0;
+  process_cache_hits = 0;
+  process_cache_misses = 0;
+  if (is_process_cache_shared)
+    unlockMutex(&process_cache_mutex);
+}
+
+// Writes the "process_cache" section of the statistics object
+void writeProcessCacheStats(JsonWriter *writer)
+{
+  beginStatsSection(writer, "process_cache");
+  putStatsCounter(writer, 1, "hits", process_cache_hits);
+  putStatsCounter(writer, 0, "misses", process_cache_misses);
+  putStatsCounter(writer, 0, "entries", process_cache_count);
+  putJsonChar(writer, '}');
+  putStatsCounter(writer, 0, "process_opens", readCounter(&backend_process_open_count));
+  putStatsCounter(writer, 0, "backend_calls", readCounter(&backend_call_count));
+}
+
+// Writes execution statistics to stderr so that the program output is not affected
+void writeStats()
+{
+  JsonWriter writer;
+  // The output still in the chunk is written first so that its bytes are counted
+  noteStatsBuffer(output_writer.size);
+  flushJsonWriter(&output_writer);
+  // Workers abandoned by --timeout may still be counting, the shared counters are read with their mutexes held, taken in
+  // the order of getProcessExecutable, which times its calls with the cache locked
+  if (is_process_cache_shared)
+    lockMutex(&process_cache_mutex);
+  if (is_stats_shared)
+    lockMutex(&stats_mutex);
+  initJsonWriter(&writer, NULL, 0, writeStatsBytes);
+  putJsonText(&writer, "{\"backend\": ");
+  putJsonString(&writer, WINDOW_STATE_BACKEND_NAME, strlen(WINDOW_STATE_BACKEND_NAME));
+  writeProcessCacheStats(&writer);
+  writeExpressionStats(&writer);
+  writeTreeStats(&writer);
+  writeLayoutStats(&writer);
+  writeHandleStats(&writer);
+  writeFetchStats(&writer);
+  writeSpatialStats(&writer);
+  writeOcclusionStats(&writer);
+  writeOrderStats(&writer);
+  writeAggregateStats(&writer);
+  writeFocusStats(&writer);
+  writePublishStats(&writer);
+  writeCaptureStats(&writer);
+  noteStatsBuffer(output_size);
+  writeStatsTimings(&writer);
+  putJsonBytes(&writer, "}\n", 2);
+  flushJsonWriter(&writer);
+  freeJsonWriter(&writer);
+  if (is_stats_shared)
+    unlockMutex(&stats_mutex);
+  if (is_process_cache_shared)
+    unlockMutex(&process_cache_mutex);
+}
+
+void makeWindowJson(JsonWriter *writer, HWND h)
+{
+  WindowRecord record;
+  int is_win = backendIsWindow(h);
   if (!is_win)
   {
-    size_t i = 0;
-    i += snprintf(&buffer[i], buffer_size - i, "{\"target\": %" PRId64 ", \"error\": \"Window not found\"}", (int64_t)h);
-    return i;
+    putJsonBytes(writer, "{\"target\": ", 11);
+    putJsonInteger(writer, (int64_t)h);
+    putJsonText(writer, ", \"error\": \"Window not found\"}");
+    return;
   }
+  // Attributes are only requested from the system when they are projected or needed by a filter
+  fetchWindowRecord(h, output_fields | filter_fields, &record);
+  putWindowRecordJson(writer, output_fields, &record);
+}
+
+// Reads the attributes of a window into a record, the strings are read into the title, module, executable and class buffers
+void fetchWindowRecord(HWND h, int fields, WindowRecord *record)
+{
+  fetchWindowRecordStrings(h, fields, record, title, module, (char *)exec_file_path, class);
+  title_length = record->title_length;
+  module_length = record->module_length;
+  exec_file_path_length = record->executable_length;
+  class_length = record->classname_length;
+  last_next = (HWND)record->sibling;
+  rect.top = record->top;
+  rect.right = record->right;
+  rect.bottom = record->bottom;
+  rect.left = record->left;
+}
+
+// Reads the attributes of a window into a record and its strings into buffers of MIDDLE_BUFFER_SIZE bytes of the caller
+void fetchWindowRecordStrings(HWND h, int fields, WindowRecord *record, char *title, char *module, char *exec, char *class)
+{
+  RECT rect;
+  memset(record, 0, sizeof(WindowRecord));
+  record->handle = (int64_t)h;
+  record->fields = (uint32_t)fields;
   title[0] = '\0';
   title[1] = '\0';
-  title_length = is_win ? GetWindowText(h, title, MIDDLE_BUFFER_SIZE) : 0;
+  int64_t start = beginStatsCall();
+  size_t title_length = (fields & FIELD_TITLE) ? backendGetWindowText(h, title, MIDDLE_BUFFER_SIZE) : 0;
+  if (fields & FIELD_TITLE)
+    endStatsCall(STATS_CALL_WINDOW_TEXT, start);
   module[0] = '\0';
   module[1] = '\0';
-  module_length = is_win ? GetWindowModuleFileName(h, module, MIDDLE_BUFFER_SIZE) : 0;
+  size_t module_length = (fields & FIELD_MODULE) ? backendGetWindowModuleFileName(h, module, MIDDLE_BUFFER_SIZE) : 0;
   class[0] = '\0';
   class[1] = '\0';
-  class_length = is_win ? GetClassName(h, class, MIDDLE_BUFFER_SIZE) : 0;
-  HWND parent = is_win ? GetParent(h) : NULL;
-  HWND next = is_win ? GetWindow(h, GW_HWNDNEXT) : NULL;
-  last_next = next;
-  HWND child = is_win ? GetWindow(h, GW_CHILD) : NULL;
+  size_t class_length = (fields & FIELD_CLASSNAME) ? backendGetClassName(h, class, MIDDLE_BUFFER_SIZE) : 0;
+  HWND parent = (fields & FIELD_PARENT) ? backendGetParent(h) : NULL;
+  HWND next = (fields & FIELD_SIBLING) ? backendGetWindow(h, GW_HWNDNEXT) : NULL;
+  HWND child = (fields & FIELD_CHILD) ? backendGetWindow(h, GW_CHILD) : NULL;
   DWORD pid = 0;
-  DWORD thread = GetWindowThreadProcessId(h, &pid);
-  exec_file_path_length = 0;
-  if (pid > 0)
-  {
-    HANDLE hProcess = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, pid);
-    if (hProcess != NULL)
-    {
-      exec_file_path_length = GetModuleFileNameEx(hProcess, NULL, exec_file_path, MIDDLE_BUFFER_SIZE);
-      CloseHandle(hProcess);
-    }
-  }
-  LONG style = GetWindowLong(h, GWL_STYLE);
-  int64_t exstyle = (int64_t)GetWindowLong(h, GWL_EXSTYLE);
-  int is_unicode = IsWindowUnicode(h);
-  int is_visible = IsWindowVisible(h);
-  int is_popup = (style & WS_POPUP) > 0;
-  int is_contained = (style & WS_CLIPSIBLINGS) > 0;
-  int is_bordered = ((style & WS_BORDER) > 0) || ((style & WS_THICKFRAME) > 0);
-  int is_scrollable = (style & WS_HSCROLL) > 0 || (style & WS_VSCROLL) > 0;
-  int is_visible_alt = (style & WS_VISIBLE) > 0;
-  int is_minimized = (style & WS_MINIMIZE) > 0;
-  int is_topmost = (exstyle & WS_EX_TOPMOST) > 0;
-  int is_transparent = (exstyle & WS_EX_TRANSPARENT) > 0;
+  DWORD thread = (fields & (FIELD_PID | FIELD_THREAD | FIELD_EXECUTABLE)) ? backendGetWindowThreadProcessId(h, &pid) : 0;
+  exec[0] = '\0';
+  size_t exec_length = 0;
+  if (pid > 0 && (fields & FIELD_EXECUTABLE))
+    exec_length = getProcessExecutable(pid, exec, MIDDLE_BUFFER_SIZE);
+  LONG style = (fields & FIELD_STYLE_DEPENDENT) ? backendGetWindowLong(h, GWL_STYLE) : 0;
+  int64_t exstyle = (fields & FIELD_EXSTYLE_DEPENDENT) ? (int64_t)backendGetWindowLong(h, GWL_EXSTYLE) : 0;
+  int is_unicode = (fields & FIELD_UNICODE) ? backendIsWindowUnicode(h) : 0;
+  int is_visible = (fields & (FIELD_VISIBLE | FIELD_VISIBLE_ALT)) ? backendIsWindowVisible(h) : 0;
+  record->flags |= is_visible ? FIELD_VISIBLE : 0;
+  record->flags |= is_unicode ? FIELD_UNICODE : 0;
+  record->flags |= (style & WS_POPUP) > 0 ? FIELD_POPUP : 0;
+  record->flags |= (style & WS_CLIPSIBLINGS) > 0 ? FIELD_CONTAINED : 0;
+  record->flags |= ((style & WS_BORDER) > 0) || ((style & WS_THICKFRAME) > 0) ? FIELD_BORDERED : 0;
+  record->flags |= (style & WS_HSCROLL) > 0 || (style & WS_VSCROLL) > 0 ? FIELD_SCROLLABLE : 0;
+  record->flags |= (style & WS_VISIBLE) > 0 ? FIELD_VISIBLE_ALT : 0;
+  record->flags |= (style & WS_MINIMIZE) > 0 ? FIELD_MINIMIZED : 0;
+  record->flags |= (exstyle & WS_EX_TOPMOST) > 0 ? FIELD_TOPMOST : 0;
+  record->flags |= (exstyle & WS_EX_TRANSPARENT) > 0 ? FIELD_TRANSPARENT : 0;
 
   rect.top = 0;
   rect.left = 0;
   rect.right = 0;
   rect.bottom = 0;
-  if (0 == GetWindowRect(h, &rect))
+  start = beginStatsCall();
+  if ((fields & FIELD_RECT) && 0 == backendGetWindowRect(h, &rect))
   {
     rect.top = 0;
     rect.left = 0;
     rect.right = 0;
     rect.bottom = 0;
   }
-  return putWindowJson(
-      buffer,
-      BUFFER_SIZE,
-      h,
-      title,
-      title_length,
-      module,
-      module_length,
-      (char *)exec_file_path,
-      exec_file_path_length,
-      class,
-      class_length,
-      parent,
-      next,
-      child,
-      pid,
-      thread,
-      style,
-      exstyle,
-      is_unicode,
-      is_visible,
-      is_popup,
-      is_contained,
-      is_bordered,
-      is_scrollable,
-      is_visible_alt,
-      is_minimized,
-      is_topmost,
-      is_transparent,
-      &rect);
+  if (fields & FIELD_RECT)
+    endStatsCall(STATS_CALL_WINDOW_RECT, start);
+  record->parent = (int64_t)parent;
+  record->sibling = (int64_t)next;
+  record->child = (int64_t)child;
+  record->pid = (uint32_t)pid;
+  record->thread = (uint32_t)thread;
+  record->style = (int32_t)style;
+  record->exstyle = exstyle;
+  record->top = (int32_t)rect.top;
+  record->right = (int32_t)rect.right;
+  record->bottom = (int32_t)rect.bottom;
+  record->left = (int32_t)rect.left;
+  record->title_length = (uint32_t)title_length;
+  record->module_length = (uint32_t)module_length;
+  record->executable_length = (uint32_t)exec_length;
+  record->classname_length = (uint32_t)class_length;
 }
 
-char escape[BUFFER_SIZE];
-size_t escape_length = 0;
+// Writes a record as a JSON object, its strings must be in the title, module, executable and class buffers
+void putWindowRecordJson(JsonWriter *writer, int fields, WindowRecord *record)
+{
+  putJsonChar(writer, '{');
+  putWindowRecordKeys(writer, 1, fields, record, title, module, (char *)exec_file_path, class);
+  putJsonChar(writer, '}');
+}
 
-int escapeJsonString(char *text, size_t *text_length)
+// Writes the keys of a record with strings from buffers of the caller, returns zero when at least one key was written
+int putWindowRecordKeys(JsonWriter *writer, int is_first, int fields, WindowRecord *record, char *title, char *module, char *exec, char *class)
 {
-  int updated = 0;
-  size_t i = 0;
-  size_t i_max = *text_length;
-  size_t j = 0;
-  size_t j_max = BUFFER_SIZE - 1;
-  for (i = 0; i < i_max; i++)
-  {
-    char c = text[i];
-    if (c == '\\')
-    {
-      updated = 1;
-      escape[j++] = '/';
-    }
-    else if ((c == '"' || c == '\\' || c == '\n' || c == '\t') && j + 2 < j_max)
-    {
-      updated = 1;
-      escape[j++] = '\\';
-      escape[j++] = c == '\n' ? 'n' : (c == '\t' ? 't' : c);
-    }
-    else if (j < j_max)
-    {
-      escape[j++] = c;
-    }
-  }
-  if (updated == 0)
-    return 0;
-  for (i = 0; i <= j; i++)
-  {
-    text[i] = i == j ? '\0' : escape[i];
-  }
-  *text_length = i;
-  return updated ? 1 : 0;
+  RECT rect;
+  rect.top = record->top;
+  rect.right = record->right;
+  rect.bottom = record->bottom;
+  rect.left = record->left;
+  is_first = putWindowJson(
+      writer,
+      is_first,
+      fields,
+      (HWND)record->handle,
+      title,
+      record->title_length,
+      module,
+      record->module_length,
+      exec,
+      record->executable_length,
+      class,
+      record->classname_length,
+      (HWND)record->parent,
+      (HWND)record->sibling,
+      (HWND)record->child,
+      (DWORD)record->pid,
+      (DWORD)record->thread,
+      (LONG)record->style,
+      record->exstyle,
+      (record->flags & FIELD_UNICODE) != 0,
+      (record->flags & FIELD_VISIBLE) != 0,
+      (record->flags & FIELD_POPUP) != 0,
+      (record->flags & FIELD_CONTAINED) != 0,
+      (record->flags & FIELD_BORDERED) != 0,
+      (record->flags & FIELD_SCROLLABLE) != 0,
+      (record->flags & FIELD_VISIBLE_ALT) != 0,
+      (record->flags & FIELD_MINIMIZED) != 0,
+      (record->flags & FIELD_TOPMOST) != 0,
+      (record->flags & FIELD_TRANSPARENT) != 0,
+      &rect);
+  if (fields & FIELD_VISIBLE_AREA)
+    is_first = putOcclusionJson(writer, is_first, (HWND)record->handle);
+  return is_first;
 }
 
-size_t putWindowJson(
-    char *buffer,
-    size_t buffer_size,
+// Writes the keys of a window state without the braces of its object, returns zero when at least one key was written
+int putWindowJson(
+    JsonWriter *writer,
+    int is_first,
+    int fields,
     HWND h,
     char *title,
-    size_t title_size,
+    size_t title_length,
     char *module,
-    size_t module_size,
+    size_t module_length,
     char *exec,
     size_t exec_length,
     char *class,
-    size_t class_size,
+    size_t class_length,
     HWND parent,
     HWND next,
     HWND child,
@@ -912,65 +2918,154 @@ size_t putWindowJson(
     int is_transparent,
     RECT *rect)
 {
-  size_t i = 0;
-  i += snprintf(&buffer[i], buffer_size - i, "{\"handle\": %" PRId64 ", ", (int64_t)h);
-  if (title_length > 0 && title != NULL)
-  {
-    escapeJsonString(title, &title_length);
-    i += snprintf(&buffer[i], buffer_size - i, "\"title\": \"%s\", ", (char *)title);
-  }
-  if (module_length > 0 && module != NULL)
-  {
-    escapeJsonString(module, &module_length);
-    i += snprintf(&buffer[i], buffer_size - i, "\"module\": \"%s\", ", (char *)module);
-  }
-  if (exec_length > 0 && exec != NULL)
-  {
-    escapeJsonString(exec, &exec_length);
-    i += snprintf(&buffer[i], buffer_size - i, "\"executable\": \"%s\", ", exec);
-  }
-  if (class_length > 0 && class != NULL)
-  {
-    escapeJsonString(class, &class_length);
-    i += snprintf(&buffer[i], buffer_size - i, "\"classname\": \"%s\", ", (char *)class);
-  }
-  i += snprintf(&buffer[i], buffer_size - i, "\"parent\": %" PRId64 ", ", (int64_t)parent);
-  if (next != 0)
-  {
-    i += snprintf(&buffer[i], buffer_size - i, "\"sibling\": %" PRId64 ", ", (int64_t)next);
-  }
-  if (child != NULL)
-    i += snprintf(&buffer[i], buffer_size - i, "\"child\": %" PRId64 ", ", (int64_t)child);
-  i += snprintf(&buffer[i], buffer_size - i, "\"pid\": %" PRId64 ", ", (int64_t)pid);
-
-  i += snprintf(&buffer[i], buffer_size - i, "\"thread\": %" PRId64 ", ", (int64_t)thread);
-  i += snprintf(&buffer[i], buffer_size - i, "\"style\": %" PRId64 ", ", (int64_t)style);
-  i += snprintf(&buffer[i], buffer_size - i, "\"exstyle\": %" PRId64 ", ", (int64_t)exstyle);
-  i += snprintf(&buffer[i], buffer_size - i, "\"visible\": %s, ", is_visible ? "true" : "false");
-  i += snprintf(&buffer[i], buffer_size - i, "\"unicode\": %s", is_unicode ? "true" : "false");
-  if (is_popup)
-    i += snprintf(&buffer[i], buffer_size - i, ", \"popup\": true");
-  if (is_contained)
-    i += snprintf(&buffer[i], buffer_size - i, ", \"contained\": true");
-  if (is_bordered)
-    i += snprintf(&buffer[i], buffer_size - i, ", \"bordered\": true");
-  if (is_scrollable)
-    i += snprintf(&buffer[i], buffer_size - i, ", \"scrollable\": true");
-  if (is_visible_alt != is_visible)
-    i += snprintf(&buffer[i], buffer_size - i, ", \"visible_alt\": true");
-  if (is_minimized)
-    i += snprintf(&buffer[i], buffer_size - i, ", \"minimized\": true");
-  if (is_topmost)
-    i += snprintf(&buffer[i], buffer_size - i, ", \"topmost\": true");
-  if (is_transparent)
-    i += snprintf(&buffer[i], buffer_size - i, ", \"transparent\": true");
+  // Keys are written with a leading separator that is skipped for the first key of the object
+  if (fields & FIELD_HANDLE)
+  {
+    putJsonKey(writer, is_first, "handle");
+    putJsonInteger(writer, (int64_t)h);
+    is_first = 0;
+  }
+  if ((fields & FIELD_TITLE) && title_length > 0 && title != NULL)
+  {
+    putJsonKey(writer, is_first, "title");
+    putJsonString(writer, title, title_length);
+    is_first = 0;
+  }
+  if ((fields & FIELD_MODULE) && module_length > 0 && module != NULL)
+  {
+    putJsonKey(writer, is_first, "module");
+    putJsonString(writer, module, module_length);
+    is_first = 0;
+  }
+  if ((fields & FIELD_EXECUTABLE) && exec_length > 0 && exec != NULL)
+  {
+    putJsonKey(writer, is_first, "executable");
+    putJsonString(writer, exec, exec_length);
+    is_first = 0;
+  }
+  if ((fields & FIELD_CLASSNAME) && class_length > 0 && class != NULL)
+  {
+    putJsonKey(writer, is_first, "classname");
+    putJsonString(writer, class, class_length);
+    is_first = 0;
+  }
+  if (fields & FIELD_PARENT)
+  {
+    putJsonKey(writer, is_first, "parent");
+    putJsonInteger(writer, (int64_t)parent);
+    is_first = 0;
+  }
+  if ((fields & FIELD_SIBLING) && next != 0)
+  {
+    putJsonKey(writer, is_first, "sibling");
+    putJsonInteger(writer, (int64_t)next);
+    is_first = 0;
+  }
+  if ((fields & FIELD_CHILD) && child != NULL)
+  {
+    putJsonKey(writer, is_first, "child");
+    putJsonInteger(writer, (int64_t)child);
+    is_first = 0;
+  }
+  if (fields & FIELD_PID)
+  {
+    putJsonKey(writer, is_first, "pid");
+    putJsonInteger(writer, (int64_t)pid);
+    is_first = 0;
+  }
+  if (fields & FIELD_THREAD)
+  {
+    putJsonKey(writer, is_first, "thread");
+    putJsonInteger(writer, (int64_t)thread);
+    is_first = 0;
+  }
+  if (fields & FIELD_STYLE)
+  {
+    putJsonKey(writer, is_first, "style");
+    putJsonInteger(writer, (int64_t)style);
+    is_first = 0;
+  }
+  if (fields & FIELD_EXSTYLE)
+  {
+    putJsonKey(writer, is_first, "exstyle");
+    putJsonInteger(writer, exstyle);
+    is_first = 0;
+  }
+  if (fields & FIELD_VISIBLE)
+  {
+    putJsonKey(writer, is_first, "visible");
+    putJsonBoolean(writer, is_visible);
+    is_first = 0;
+  }
+  if (fields & FIELD_UNICODE)
+  {
+    putJsonKey(writer, is_first, "unicode");
+    putJsonBoolean(writer, is_unicode);
+    is_first = 0;
+  }
+  if ((fields & FIELD_POPUP) && is_popup)
+  {
+    putJsonKey(writer, is_first, "popup");
+    putJsonBoolean(writer, 1);
+    is_first = 0;
+  }
+  if ((fields & FIELD_CONTAINED) && is_contained)
+  {
+    putJsonKey(writer, is_first, "contained");
+    putJsonBoolean(writer, 1);
+    is_first = 0;
+  }
+  if ((fields & FIELD_BORDERED) && is_bordered)
+  {
+    putJsonKey(writer, is_first, "bordered");
+    putJsonBoolean(writer, 1);
+    is_first = 0;
+  }
+  if ((fields & FIELD_SCROLLABLE) && is_scrollable)
+  {
+    putJsonKey(writer, is_first, "scrollable");
+    putJsonBoolean(writer, 1);
+    is_first = 0;
+  }
+  if ((fields & FIELD_VISIBLE_ALT) && is_visible_alt != is_visible)
+  {
+    putJsonKey(writer, is_first, "visible_alt");
+    putJsonBoolean(writer, 1);
+    is_first = 0;
+  }
+  if ((fields & FIELD_MINIMIZED) && is_minimized)
+  {
+    putJsonKey(writer, is_first, "minimized");
+    putJsonBoolean(writer, 1);
+    is_first = 0;
+  }
+  if ((fields & FIELD_TOPMOST) && is_topmost)
+  {
+    putJsonKey(writer, is_first, "topmost");
+    putJsonBoolean(writer, 1);
+    is_first = 0;
+  }
+  if ((fields & FIELD_TRANSPARENT) && is_transparent)
+  {
+    putJsonKey(writer, is_first, "transparent");
+    putJsonBoolean(writer, 1);
+    is_first = 0;
+  }
   int64_t top = (int64_t)(rect != NULL ? rect->top : 0);
   int64_t right = (int64_t)(rect != NULL ? rect->right : 0);
   int64_t bottom = (int64_t)(rect != NULL ? rect->bottom : 0);
   int64_t left = (int64_t)(rect != NULL ? rect->left : 0);
-  if (top != 0 || left != 0 || right != 0 || bottom != 0)
-    i += snprintf(&buffer[i], buffer_size - i, ", \"top\": %" PRId64 ", \"right\": %" PRId64 ", \"bottom\": %" PRId64 ", \"left\": %" PRId64 "", top, right, bottom, left);
-  i += snprintf(&buffer[i], buffer_size - i, "}");
-  buffer[i] = '\0';
-  return i;
-}
\ No newline at end of file
+  if ((fields & FIELD_RECT) && (top != 0 || left != 0 || right != 0 || bottom != 0))
+  {
+    putJsonKey(writer, is_first, "top");
+    putJsonInteger(writer, top);
+    putJsonKey(writer, 0, "right");
+    putJsonInteger(writer, right);
+    putJsonKey(writer, 0, "bottom");
+    putJsonInteger(writer, bottom);
+    putJsonKey(writer, 0, "left");
+    putJsonInteger(writer, left);
+    is_first = 0;
+  }
+  return is_first;
+}
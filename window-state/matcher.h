@@ -0,0 +1,222 @@
+// Multi-pattern substring matcher: an Aho-Corasick automaton that tells if a text contains any of a set of patterns.
+//
+// Texts and patterns are UTF-8 and compared ignoring case: ascii letters and the Latin-1 supplement letters (U+00C0 to
+// U+00DE, encoded as 0xC3 0x80-0x9E) are folded to lower case byte by byte before being matched. The automaton is built
+// as a complete transition table over the byte classes that appear in the patterns, so matching costs one table lookup
+// per byte of text regardless of the number of patterns.
+
+#define MATCHER_PATTERN_SIZE 256
+
+typedef struct
+{
+  // Trie built from the added patterns, converted into the transition table by buildPatternMatcher
+  int *transitions;
+  int *failures;
+  char *accepting;
+  int state_count;
+  int state_size;
+  int class_count;
+  int pattern_count;
+  int is_built;
+  unsigned char classes[256];
+} PatternMatcher;
+
+// Folds a byte of UTF-8 text to lower case given the byte that precedes it
+unsigned char foldByte(unsigned char previous, unsigned char c)
+{
+  if (c >= 'A' && c <= 'Z')
+    return c + 32;
+  if (previous == 0xC3 && c >= 0x80 && c <= 0x9E && c != 0x97)
+    return c + 32;
+  return c;
+}
+
+void initPatternMatcher(PatternMatcher *matcher)
+{
+  memset(matcher, 0, sizeof(PatternMatcher));
+}
+
+void freePatternMatcher(PatternMatcher *matcher)
+{
+  free(matcher->transitions);
+  free(matcher->failures);
+  free(matcher->accepting);
+  initPatternMatcher(matcher);
+}
+
+// Adds a state to the trie, the transitions of the trie use every byte value until the table is compressed into classes
+int addMatcherState(PatternMatcher *matcher)
+{
+  int *transitions;
+  char *accepting;
+  int state_size;
+  if (matcher->state_count >= matcher->state_size)
+  {
+    state_size = matcher->state_size == 0 ? 64 : matcher->state_size * 2;
+    transitions = (int *)realloc(matcher->transitions, (size_t)state_size * 256 * sizeof(int));
+    if (transitions == NULL)
+      return -1;
+    matcher->transitions = transitions;
+    accepting = (char *)realloc(matcher->accepting, (size_t)state_size);
+    if (accepting == NULL)
+      return -1;
+    matcher->accepting = accepting;
+    matcher->state_size = state_size;
+  }
+  memset(&matcher->transitions[(size_t)matcher->state_count * 256], 0xFF, 256 * sizeof(int));
+  matcher->accepting[matcher->state_count] = 0;
+  return matcher->state_count++;
+}
+
+int addPattern(PatternMatcher *matcher, const char *pattern, size_t pattern_length)
+{
+  int state;
+  int next;
+  size_t i;
+  unsigned char previous = 0;
+  unsigned char c;
+  if (matcher->is_built || pattern_length == 0)
+    return pattern_length == 0;
+  if (matcher->state_count == 0 && addMatcherState(matcher) < 0)
+    return 0;
+  state = 0;
+  for (i = 0; i < pattern_length; i++)
+  {
+    c = foldByte(previous, (unsigned char)pattern[i]);
+    previous = (unsigned char)pattern[i];
+    next = matcher->transitions[(size_t)state * 256 + c];
+    if (next < 0)
+    {
+      next = addMatcherState(matcher);
+      if (next < 0)
+        return 0;
+      matcher->transitions[(size_t)state * 256 + c] = next;
+    }
+    state = next;
+  }
+  matcher->accepting[state] = 1;
+  matcher->pattern_count++;
+  return 1;
+}
+
+// Adds each non-empty line of a file as a pattern, a "-" path reads the patterns from stdin
+int addPatternsFromFile(PatternMatcher *matcher, const char *path)
+{
+  char line[MATCHER_PATTERN_SIZE];
+  size_t length;
+  FILE *file = (path[0] == '-' && path[1] == '\0') ? stdin : fopen(path, "rb");
+  if (file == NULL)
+  {
+    writeOutput("Error: Could not open pattern file \"%s\"\n", path);
+    return 0;
+  }
+  while (fgets(line, MATCHER_PATTERN_SIZE, file) != NULL)
+  {
+    length = strlen(line);
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+      line[--length] = '\0';
+    if (length > 0 && !addPattern(matcher, line, length))
+    {
+      writeOutput("Error: Could not add pattern \"%s\"\n", line);
+      if (file != stdin)
+        fclose(file);
+      return 0;
+    }
+  }
+  if (file != stdin)
+    fclose(file);
+  return 1;
+}
+
+// Computes the failure links breadth-first and replaces the trie by a complete transition table over byte classes
+int buildPatternMatcher(PatternMatcher *matcher)
+{
+  int *queue;
+  int *table;
+  int head = 0;
+  int tail = 0;
+  int state;
+  int next;
+  int c;
+  int k;
+  if (matcher->is_built)
+    return 1;
+  if (matcher->state_count == 0 && addMatcherState(matcher) < 0)
+    return 0;
+  // Bytes that do not appear in any pattern share the class zero
+  memset(matcher->classes, 0, sizeof(matcher->classes));
+  matcher->class_count = 1;
+  for (state = 0; state < matcher->state_count; state++)
+    for (c = 0; c < 256; c++)
+      if (matcher->transitions[(size_t)state * 256 + c] >= 0 && matcher->classes[c] == 0)
+        matcher->classes[c] = (unsigned char)matcher->class_count++;
+  queue = (int *)malloc((size_t)matcher->state_count * sizeof(int));
+  matcher->failures = (int *)malloc((size_t)matcher->state_count * sizeof(int));
+  table = (int *)malloc((size_t)matcher->state_count * matcher->class_count * sizeof(int));
+  if (queue == NULL || matcher->failures == NULL || table == NULL)
+  {
+    free(queue);
+    free(table);
+    return 0;
+  }
+  matcher->failures[0] = 0;
+  for (k = 0; k < matcher->class_count; k++)
+    table[k] = 0;
+  for (c = 0; c < 256; c++)
+  {
+    next = matcher->transitions[c];
+    if (next < 0)
+      continue;
+    table[matcher->classes[c]] = next;
+    matcher->failures[next] = 0;
+    queue[tail++] = next;
+  }
+  while (head < tail)
+  {
+    state = queue[head++];
+    if (matcher->accepting[matcher->failures[state]])
+      matcher->accepting[state] = 1;
+    // Missing transitions follow the transition of the failure state, which is complete since it was visited earlier
+    for (k = 0; k < matcher->class_count; k++)
+      table[(size_t)state * matcher->class_count + k] = table[(size_t)matcher->failures[state] * matcher->class_count + k];
+    for (c = 0; c < 256; c++)
+    {
+      next = matcher->transitions[(size_t)state * 256 + c];
+      if (next < 0)
+        continue;
+      matcher->failures[next] = table[(size_t)matcher->failures[state] * matcher->class_count + matcher->classes[c]];
+      table[(size_t)state * matcher->class_count + matcher->classes[c]] = next;
+      queue[tail++] = next;
+    }
+  }
+  free(queue);
+  free(matcher->transitions);
+  matcher->transitions = table;
+  matcher->is_built = 1;
+  return 1;
+}
+
+// Returns one when the text contains any of the patterns
+int matchPatterns(PatternMatcher *matcher, const char *text, size_t text_length)
+{
+  const int *table = matcher->transitions;
+  const char *accepting = matcher->accepting;
+  int class_count = matcher->class_count;
+  int state = 0;
+  unsigned char previous = 0;
+  unsigned char c;
+  size_t i;
+  if (matcher->pattern_count == 0)
+    return 1;
+  if (accepting[0])
+    return 1;
+  for (i = 0; i < text_length; i++)
+  {
+    c = (unsigned char)text[i];
+    state = table[(size_t)state * class_count + matcher->classes[foldByte(previous, c)]];
+    previous = c;
+    if (accepting[state])
+      return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,481 @@
+// Occlusion: computes the part of each top-level window that is not covered by the windows above it, for --visible-area.
+//
+// The top-level windows are walked once from the top of the z-order while the area covered by the windows already walked
+// is kept as a region of horizontal bands, each band listing the sorted and disjoint spans it covers, as window systems
+// keep their clipping regions. The covered area of a window is the intersection of its rectangle with the region, found
+// by a binary search of the bands and of the spans of each band it crosses, and its rectangle is then merged into the
+// region. Adjacent bands with the same spans are joined, so the region of many overlapping windows stays a few bands, and a
+// window that the region already covers entirely is not merged. Hidden and minimized windows cover nothing and have no
+// visible area.
+//
+// Windows are compared by their rectangles: the parts of a window outside of the screens count as visible, and its shape
+// and transparency are not considered. Windows that are not top-level have no visible area and are written with nulls.
+//
+// Output keys of each window, with fractions of the area of its rectangle truncated to OCCLUSION_FRACTION_DIGITS digits:
+//   "visible_area": 120000, "visible_fraction": 0.625
+
+#define OCCLUSION_FRACTION_SCALE 1000000
+#define OCCLUSION_FRACTION_DIGITS 6
+
+typedef struct
+{
+  HWND handle;
+  int64_t area;
+  int64_t visible_area;
+} OcclusionWindow;
+
+// Rows of the region from top to bottom, the spans of a band are stored from its first span from left to right
+typedef struct
+{
+  LONG top;
+  LONG bottom;
+  int first;
+  int count;
+} OcclusionBand;
+
+typedef struct
+{
+  LONG left;
+  LONG right;
+} OcclusionSpan;
+
+int is_option_visible_area = 0;
+
+// Top-level windows in z-order, found by handle from an open-addressing table of their positions
+OcclusionWindow *occlusion_windows = NULL;
+int occlusion_window_count = 0;
+int occlusion_window_size = 0;
+int *occlusion_slots = NULL;
+int occlusion_slot_size = 0;
+
+OcclusionBand *occlusion_bands = NULL;
+int occlusion_band_count = 0;
+int occlusion_band_size = 0;
+// Spans are only appended and never changed, so bands split from a band share its spans. The spans of the bands replaced by
+// a merge are left in the list until it is compacted
+OcclusionSpan *occlusion_spans = NULL;
+int occlusion_span_count = 0;
+int occlusion_span_size = 0;
+int occlusion_live_span_count = 0;
+OcclusionSpan *occlusion_compact_spans = NULL;
+int occlusion_compact_span_size = 0;
+// Bands rebuilt by a merge before they replace the bands the rectangle crosses
+OcclusionBand *occlusion_new_bands = NULL;
+int occlusion_new_band_count = 0;
+int occlusion_new_band_size = 0;
+int is_occlusion_failed = 0;
+
+int64_t occlusion_build_time = 0;
+
+// Resizes a list to hold at least a number of items, returns zero when it cannot grow
+int growOcclusionList(void **list, int *size, int count, size_t item_size)
+{
+  void *grown;
+  int grown_size;
+  if (count <= *size)
+    return 1;
+  grown_size = *size == 0 ? 256 : *size;
+  while (grown_size < count)
+    grown_size *= 2;
+  grown = realloc(*list, (size_t)grown_size * item_size);
+  if (grown == NULL)
+    return 0;
+  *list = grown;
+  *size = grown_size;
+  return 1;
+}
+
+void addOcclusionSpan(LONG left, LONG right)
+{
+  if (!growOcclusionList((void **)&occlusion_spans, &occlusion_span_size, occlusion_span_count + 1, sizeof(OcclusionSpan)))
+  {
+    is_occlusion_failed = 1;
+    return;
+  }
+  occlusion_spans[occlusion_span_count].left = left;
+  occlusion_spans[occlusion_span_count].right = right;
+  occlusion_span_count++;
+}
+
+int isJoiningOcclusionBand(OcclusionBand *previous, LONG top, int first, int count)
+{
+  return previous != NULL && previous->bottom == top && previous->count == count && memcmp(&occlusion_spans[previous->first], &occlusion_spans[first], (size_t)count * sizeof(OcclusionSpan)) == 0;
+}
+
+void pushOcclusionBand(LONG top, LONG bottom, int first, int count)
+{
+  if (!growOcclusionList((void **)&occlusion_new_bands, &occlusion_new_band_size, occlusion_new_band_count + 1, sizeof(OcclusionBand)))
+  {
+    is_occlusion_failed = 1;
+    return;
+  }
+  occlusion_new_bands[occlusion_new_band_count].top = top;
+  occlusion_new_bands[occlusion_new_band_count].bottom = bottom;
+  occlusion_new_bands[occlusion_new_band_count].first = first;
+  occlusion_new_bands[occlusion_new_band_count].count = count;
+  occlusion_new_band_count++;
+}
+
+// Adds a band of the spans appended since its first span, or extends the previous band when it has the same spans
+void endOcclusionBand(LONG top, LONG bottom, int first)
+{
+  OcclusionBand *previous = occlusion_new_band_count > 0 ? &occlusion_new_bands[occlusion_new_band_count - 1] : NULL;
+  int count = occlusion_span_count - first;
+  if (is_occlusion_failed || count == 0 || bottom <= top)
+  {
+    occlusion_span_count = first;
+    return;
+  }
+  if (isJoiningOcclusionBand(previous, top, first, count))
+  {
+    previous->bottom = bottom;
+    occlusion_span_count = first;
+    return;
+  }
+  pushOcclusionBand(top, bottom, first, count);
+}
+
+// Keeps the spans of a band of the region over a part of its rows without copying them, joined when they are the same
+void keepOcclusionBand(OcclusionBand *band, LONG top, LONG bottom)
+{
+  OcclusionBand *previous = occlusion_new_band_count > 0 ? &occlusion_new_bands[occlusion_new_band_count - 1] : NULL;
+  if (isJoiningOcclusionBand(previous, top, band->first, band->count))
+    previous->bottom = bottom;
+  else
+    pushOcclusionBand(top, bottom, band->first, band->count);
+}
+
+int findOcclusionSpan(OcclusionBand *band, LONG left);
+
+// Copies a band with a span merged into its spans, the spans it overlaps or touches are joined with it, and keeps the band
+// when one of its spans contains it. The spans are read by position since appending may move them
+void mergeOcclusionBand(OcclusionBand *band, LONG top, LONG bottom, LONG left, LONG right)
+{
+  int first = occlusion_span_count;
+  int is_merged = 0;
+  int i = findOcclusionSpan(band, left);
+  if (i < band->first + band->count && occlusion_spans[i].left <= left && occlusion_spans[i].right >= right)
+  {
+    keepOcclusionBand(band, top, bottom);
+    return;
+  }
+  for (i = band->first; i < band->first + band->count; i++)
+  {
+    if (occlusion_spans[i].right < left)
+      addOcclusionSpan(occlusion_spans[i].left, occlusion_spans[i].right);
+    else if (occlusion_spans[i].left > right)
+    {
+      if (!is_merged)
+        addOcclusionSpan(left, right);
+      is_merged = 1;
+      addOcclusionSpan(occlusion_spans[i].left, occlusion_spans[i].right);
+    }
+    else
+    {
+      left = occlusion_spans[i].left < left ? occlusion_spans[i].left : left;
+      right = occlusion_spans[i].right > right ? occlusion_spans[i].right : right;
+    }
+  }
+  if (!is_merged)
+    addOcclusionSpan(left, right);
+  endOcclusionBand(top, bottom, first);
+}
+
+void addOcclusionGap(LONG top, LONG bottom, LONG left, LONG right)
+{
+  int first = occlusion_span_count;
+  addOcclusionSpan(left, right);
+  endOcclusionBand(top, bottom, first);
+}
+
+// Moves the spans of the bands to the start of a second list, returns zero when it cannot be allocated
+int compactOcclusionSpans()
+{
+  OcclusionSpan *spans;
+  int size;
+  int count = 0;
+  int b;
+  if (!growOcclusionList((void **)&occlusion_compact_spans, &occlusion_compact_span_size, occlusion_live_span_count, sizeof(OcclusionSpan)))
+    return 0;
+  for (b = 0; b < occlusion_band_count; b++)
+  {
+    memcpy(&occlusion_compact_spans[count], &occlusion_spans[occlusion_bands[b].first], (size_t)occlusion_bands[b].count * sizeof(OcclusionSpan));
+    occlusion_bands[b].first = count;
+    count += occlusion_bands[b].count;
+  }
+  spans = occlusion_spans;
+  occlusion_spans = occlusion_compact_spans;
+  occlusion_compact_spans = spans;
+  size = occlusion_span_size;
+  occlusion_span_size = occlusion_compact_span_size;
+  occlusion_compact_span_size = size;
+  occlusion_span_count = count;
+  return 1;
+}
+
+// Returns the first band of the region that ends below a coordinate
+int findOcclusionBand(LONG top)
+{
+  int low = 0;
+  int high = occlusion_band_count;
+  int middle;
+  while (low < high)
+  {
+    middle = (low + high) / 2;
+    if (occlusion_bands[middle].bottom <= top)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+// Returns the first span of a band that ends after a coordinate
+int findOcclusionSpan(OcclusionBand *band, LONG left)
+{
+  int low = band->first;
+  int high = band->first + band->count;
+  int middle;
+  while (low < high)
+  {
+    middle = (low + high) / 2;
+    if (occlusion_spans[middle].right <= left)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+// Returns the area of the intersection of a rectangle with the region
+int64_t getOcclusionCoveredArea(RECT *rect)
+{
+  OcclusionBand *band;
+  OcclusionSpan *span;
+  int64_t covered = 0;
+  int64_t width;
+  int b;
+  int s;
+  for (b = findOcclusionBand(rect->top); b < occlusion_band_count && occlusion_bands[b].top < rect->bottom; b++)
+  {
+    band = &occlusion_bands[b];
+    width = 0;
+    for (s = findOcclusionSpan(band, rect->left); s < band->first + band->count && occlusion_spans[s].left < rect->right; s++)
+    {
+      span = &occlusion_spans[s];
+      width += (int64_t)(span->right < rect->right ? span->right : rect->right) - (span->left > rect->left ? span->left : rect->left);
+    }
+    covered += width * ((int64_t)(band->bottom < rect->bottom ? band->bottom : rect->bottom) - (band->top > rect->top ? band->top : rect->top));
+  }
+  return covered;
+}
+
+// Merges a rectangle into the region, returns zero when the region cannot grow
+int addOcclusionRect(RECT *rect)
+{
+  OcclusionBand *band;
+  LONG y = rect->top;
+  int low = findOcclusionBand(rect->top);
+  int high = low;
+  int start;
+  int end;
+  int b;
+  while (high < occlusion_band_count && occlusion_bands[high].top < rect->bottom)
+    high++;
+  // Only the bands crossed by the rectangle are rebuilt, with the bands around them kept to be joined with them
+  start = low > 0 ? low - 1 : low;
+  end = high < occlusion_band_count ? high + 1 : high;
+  occlusion_new_band_count = 0;
+  if (low > 0)
+    keepOcclusionBand(&occlusion_bands[low - 1], occlusion_bands[low - 1].top, occlusion_bands[low - 1].bottom);
+  for (b = low; b < high; b++)
+  {
+    band = &occlusion_bands[b];
+    // The rows of the rectangle between the bands are covered by the rectangle alone
+    if (y < band->top)
+      addOcclusionGap(y, band->top, rect->left, rect->right);
+    // A band crossing an edge of the rectangle is split at the edge
+    if (band->top < rect->top)
+      keepOcclusionBand(band, band->top, rect->top);
+    mergeOcclusionBand(band, band->top > rect->top ? band->top : rect->top, band->bottom < rect->bottom ? band->bottom : rect->bottom, rect->left, rect->right);
+    if (band->bottom > rect->bottom)
+      keepOcclusionBand(band, rect->bottom, band->bottom);
+    y = band->bottom;
+  }
+  if (y < rect->bottom)
+    addOcclusionGap(y, rect->bottom, rect->left, rect->right);
+  if (high < occlusion_band_count)
+    keepOcclusionBand(&occlusion_bands[high], occlusion_bands[high].top, occlusion_bands[high].bottom);
+  if (is_occlusion_failed || !growOcclusionList((void **)&occlusion_bands, &occlusion_band_size, occlusion_band_count - (end - start) + occlusion_new_band_count, sizeof(OcclusionBand)))
+    return 0;
+  for (b = start; b < end; b++)
+    occlusion_live_span_count -= occlusion_bands[b].count;
+  for (b = 0; b < occlusion_new_band_count; b++)
+    occlusion_live_span_count += occlusion_new_bands[b].count;
+  memmove(&occlusion_bands[start + occlusion_new_band_count], &occlusion_bands[end], (size_t)(occlusion_band_count - end) * sizeof(OcclusionBand));
+  memcpy(&occlusion_bands[start], occlusion_new_bands, (size_t)occlusion_new_band_count * sizeof(OcclusionBand));
+  occlusion_band_count += occlusion_new_band_count - (end - start);
+  // The spans left by the replaced bands are dropped once they outnumber the spans of the bands
+  if (occlusion_span_count > 2 * occlusion_live_span_count + 1024 && !compactOcclusionSpans())
+    return 0;
+  return 1;
+}
+
+size_t getOcclusionSlot(HWND h)
+{
+  return (size_t)(((uint64_t)(uintptr_t)h * 0x9E3779B97F4A7C15ull) >> 32) & (size_t)(occlusion_slot_size - 1);
+}
+
+// Returns the position of a top-level window in the computed windows, or -1
+int findOcclusionWindow(HWND h)
+{
+  size_t slot;
+  if (occlusion_slot_size == 0)
+    return -1;
+  for (slot = getOcclusionSlot(h); occlusion_slots[slot] >= 0; slot = (slot + 1) & (size_t)(occlusion_slot_size - 1))
+  {
+    if (occlusion_windows[occlusion_slots[slot]].handle == h)
+      return occlusion_slots[slot];
+  }
+  return -1;
+}
+
+// Returns the visible part of the area of a computed window in millionths
+int64_t getOcclusionFraction(int index)
+{
+  OcclusionWindow *w = &occlusion_windows[index];
+  return w->area > 0 ? w->visible_area * OCCLUSION_FRACTION_SCALE / w->area : 0;
+}
+
+// Lists the top-level windows with the visible part of their rectangles, returns zero when the lists cannot be allocated
+int computeOcclusion()
+{
+  OcclusionWindow *w;
+  RECT window_rect;
+  HWND h;
+  int64_t start = beginStatsCall();
+  int64_t covered;
+  size_t slot;
+  int slot_size;
+  int i;
+  occlusion_window_count = 0;
+  occlusion_band_count = 0;
+  occlusion_span_count = 0;
+  occlusion_live_span_count = 0;
+  is_occlusion_failed = 0;
+  for (h = backendGetFirstChild(NULL); h != NULL; h = backendGetWindow(h, GW_HWNDNEXT))
+  {
+    if (!growOcclusionList((void **)&occlusion_windows, &occlusion_window_size, occlusion_window_count + 1, sizeof(OcclusionWindow)))
+      return 0;
+    w = &occlusion_windows[occlusion_window_count++];
+    w->handle = h;
+    w->area = 0;
+    w->visible_area = 0;
+    memset(&window_rect, 0, sizeof(window_rect));
+    if (!backendGetWindowRect(h, &window_rect) || window_rect.right <= window_rect.left || window_rect.bottom <= window_rect.top)
+      continue;
+    w->area = ((int64_t)window_rect.right - window_rect.left) * ((int64_t)window_rect.bottom - window_rect.top);
+    if (!backendIsWindowVisible(h) || (backendGetWindowLong(h, GWL_STYLE) & WS_MINIMIZE) != 0)
+      continue;
+    covered = getOcclusionCoveredArea(&window_rect);
+    w->visible_area = w->area - covered;
+    if (covered < w->area && !addOcclusionRect(&window_rect))
+      return 0;
+  }
+  // The table is kept at most half full so that the probe sequences stay short
+  for (slot_size = 256; slot_size < occlusion_window_count * 2; slot_size *= 2)
+  {
+  }
+  if (slot_size > occlusion_slot_size)
+  {
+    free(occlusion_slots);
+    occlusion_slots = (int *)malloc((size_t)slot_size * sizeof(int));
+    occlusion_slot_size = occlusion_slots != NULL ? slot_size : 0;
+    if (occlusion_slots == NULL)
+      return 0;
+  }
+  memset(occlusion_slots, 0xFF, (size_t)occlusion_slot_size * sizeof(int));
+  for (i = 0; i < occlusion_window_count; i++)
+  {
+    for (slot = getOcclusionSlot(occlusion_windows[i].handle); occlusion_slots[slot] >= 0; slot = (slot + 1) & (size_t)(occlusion_slot_size - 1))
+    {
+    }
+    occlusion_slots[slot] = i;
+  }
+  endStatsPhase(&occlusion_build_time, start);
+  return 1;
+}
+
+// Writes the "occlusion" section of the statistics object
+void writeOcclusionStats(JsonWriter *writer)
+{
+  beginStatsSection(writer, "occlusion");
+  putStatsCounter(writer, 1, "windows", occlusion_window_count);
+  putStatsCounter(writer, 0, "bands", occlusion_band_count);
+  putStatsCounter(writer, 0, "spans", occlusion_live_span_count);
+  putStatsCounter(writer, 0, "build_ns", occlusion_build_time);
+  putJsonChar(writer, '}');
+}
+
+// Forgets the computed windows, the lists are kept for the next request
+void resetOcclusion()
+{
+  occlusion_window_count = 0;
+  occlusion_band_count = 0;
+  occlusion_span_count = 0;
+  occlusion_live_span_count = 0;
+  if (occlusion_slot_size > 0)
+    memset(occlusion_slots, 0xFF, (size_t)occlusion_slot_size * sizeof(int));
+  occlusion_build_time = 0;
+}
+
+void freeOcclusion()
+{
+  free(occlusion_windows);
+  occlusion_windows = NULL;
+  occlusion_window_size = 0;
+  free(occlusion_slots);
+  occlusion_slots = NULL;
+  occlusion_slot_size = 0;
+  free(occlusion_bands);
+  occlusion_bands = NULL;
+  occlusion_band_size = 0;
+  free(occlusion_spans);
+  occlusion_spans = NULL;
+  occlusion_span_size = 0;
+  free(occlusion_compact_spans);
+  occlusion_compact_spans = NULL;
+  occlusion_compact_span_size = 0;
+  free(occlusion_new_bands);
+  occlusion_new_bands = NULL;
+  occlusion_new_band_size = 0;
+  resetOcclusion();
+}
+
+// Writes the visible area keys of a window, with nulls for a window that is not top-level, returns zero
+int putOcclusionJson(JsonWriter *writer, int is_first, HWND h)
+{
+  char text[SMALL_BUFFER_SIZE];
+  int index = findOcclusionWindow(h);
+  int64_t fraction;
+  int length;
+  putJsonKey(writer, is_first, "visible_area");
+  if (index < 0)
+  {
+    putJsonText(writer, "null");
+    putJsonKey(writer, 0, "visible_fraction");
+    putJsonText(writer, "null");
+    return 0;
+  }
+  putJsonInteger(writer, occlusion_windows[index].visible_area);
+  putJsonKey(writer, 0, "visible_fraction");
+  fraction = getOcclusionFraction(index);
+  // The digits of the fraction are written without trailing zeros, "0" and "1" for hidden and entirely visible windows
+  length = snprintf(text, sizeof(text), "%" PRId64 ".%0*" PRId64, fraction / OCCLUSION_FRACTION_SCALE, OCCLUSION_FRACTION_DIGITS, fraction % OCCLUSION_FRACTION_SCALE);
+  while (length > 0 && text[length - 1] == '0' && fraction % OCCLUSION_FRACTION_SCALE != 0)
+    length--;
+  if (fraction % OCCLUSION_FRACTION_SCALE == 0)
+    length -= OCCLUSION_FRACTION_DIGITS + 1;
+  putJsonBytes(writer, text, length > 0 ? (size_t)length : 0);
+  return 0;
+}
@@ -0,0 +1,286 @@
+// Ordering: selects the windows of a page of the selection sorted by --sort, with --offset and --limit.
+//
+// The windows are selected by the scope and the filters first, then only the attribute compared by the sort is read from
+// each of them: the rectangle for "area", the process for "pid", the title for "title", and nothing for "z" since the
+// selection is already in z-order. With a limit, the windows of the page and the ones before it are kept in a bounded heap
+// of offset + limit entries whose root is the last of them, so a window that sorts after the root is dropped without
+// being kept and a selection of n windows is ordered in O(n log k). The page is then sorted and replaces the selection, so
+// only its windows are read entirely and written by the list, tree, timeout and arrangement modes. Windows with the same
+// key stay in z-order.
+//
+// Sort keys:
+//   area          Area of the window rectangle, largest first
+//   visible-area  Area not covered by the windows above it (see --visible-area), largest first
+//   z             Position in the z-order, topmost first (the default of --limit and --offset)
+//   title         Title, in the order of its bytes with ASCII letters compared without case
+//   pid           Process id, lowest first
+
+#define ORDER_NONE 0
+#define ORDER_Z 1
+#define ORDER_AREA 2
+#define ORDER_VISIBLE_AREA 3
+#define ORDER_TITLE 4
+#define ORDER_PID 5
+
+typedef struct
+{
+  HWND handle;
+  // Position of the window in the selection, which breaks ties in z-order
+  int position;
+  int64_t key;
+  char *title;
+  size_t title_size;
+} OrderEntry;
+
+int order_key = ORDER_NONE;
+int64_t order_limit = -1;
+int64_t order_offset = 0;
+
+OrderEntry *order_entries = NULL;
+int order_entry_count = 0;
+int order_entry_size = 0;
+char order_title[MIDDLE_BUFFER_SIZE];
+
+int order_candidate_count = 0;
+int64_t order_replacement_count = 0;
+int64_t order_time = 0;
+
+// Reads the name of a sort key, returns zero after writing an error
+int parseOrderKey(const char *name)
+{
+  if (isMatchingString("area", name) || isMatchingString("size", name))
+    order_key = ORDER_AREA;
+  else if (isMatchingString("visible-area", name) || isMatchingString("visible_area", name))
+    order_key = ORDER_VISIBLE_AREA;
+  else if (isMatchingString("z", name) || isMatchingString("z-order", name))
+    order_key = ORDER_Z;
+  else if (isMatchingString("title", name))
+    order_key = ORDER_TITLE;
+  else if (isMatchingString("pid", name))
+    order_key = ORDER_PID;
+  else
+  {
+    writeOutput("Error: Unknown sort key \"%s\" (expected area, visible-area, z, title or pid)\n", name);
+    return 0;
+  }
+  return 1;
+}
+
+int isOrderingSelection()
+{
+  return order_key != ORDER_NONE || order_limit >= 0 || order_offset > 0;
+}
+
+int compareOrderTitles(const char *a, const char *b)
+{
+  unsigned char x;
+  unsigned char y;
+  int i;
+  for (i = 0; a[i] != '\0' || b[i] != '\0'; i++)
+  {
+    x = (unsigned char)a[i];
+    y = (unsigned char)b[i];
+    x = x >= 'A' && x <= 'Z' ? x + ('a' - 'A') : x;
+    y = y >= 'A' && y <= 'Z' ? y + ('a' - 'A') : y;
+    if (x != y)
+      return x < y ? -1 : 1;
+  }
+  return strcmp(a, b);
+}
+
+// Returns a negative number when a window is written before another
+int compareOrderEntries(const OrderEntry *a, const OrderEntry *b)
+{
+  int result = 0;
+  if (order_key == ORDER_TITLE)
+    result = compareOrderTitles(a->title, b->title);
+  else if (order_key == ORDER_AREA || order_key == ORDER_VISIBLE_AREA)
+    result = a->key > b->key ? -1 : a->key < b->key ? 1 : 0;
+  else if (order_key == ORDER_PID)
+    result = a->key < b->key ? -1 : a->key > b->key ? 1 : 0;
+  if (result != 0)
+    return result;
+  return a->position < b->position ? -1 : a->position > b->position ? 1 : 0;
+}
+
+int sortOrderEntries(const void *a, const void *b)
+{
+  return compareOrderEntries((const OrderEntry *)a, (const OrderEntry *)b);
+}
+
+// Reads the sort key of a window into an entry, the title is read into order_title
+void readOrderKey(HWND h, OrderEntry *entry)
+{
+  RECT window_rect;
+  DWORD pid = 0;
+  int64_t start;
+  int index;
+  entry->key = 0;
+  if (order_key == ORDER_AREA)
+  {
+    start = beginStatsCall();
+    memset(&window_rect, 0, sizeof(window_rect));
+    if (backendGetWindowRect(h, &window_rect) && window_rect.right > window_rect.left && window_rect.bottom > window_rect.top)
+      entry->key = ((int64_t)window_rect.right - window_rect.left) * ((int64_t)window_rect.bottom - window_rect.top);
+    endStatsCall(STATS_CALL_WINDOW_RECT, start);
+  }
+  else if (order_key == ORDER_VISIBLE_AREA)
+  {
+    index = findOcclusionWindow(h);
+    entry->key = index >= 0 ? occlusion_windows[index].visible_area : 0;
+  }
+  else if (order_key == ORDER_PID)
+  {
+    backendGetWindowThreadProcessId(h, &pid);
+    entry->key = (int64_t)pid;
+  }
+  else if (order_key == ORDER_TITLE)
+  {
+    start = beginStatsCall();
+    order_title[0] = '\0';
+    backendGetWindowText(h, order_title, MIDDLE_BUFFER_SIZE);
+    endStatsCall(STATS_CALL_WINDOW_TEXT, start);
+  }
+}
+
+// Copies the title read by readOrderKey into an entry, reusing its buffer when it is large enough
+int keepOrderTitle(OrderEntry *entry)
+{
+  size_t size = strlen(order_title) + 1;
+  char *grown;
+  if (size > entry->title_size)
+  {
+    grown = (char *)realloc(entry->title, size);
+    if (grown == NULL)
+      return 0;
+    entry->title = grown;
+    entry->title_size = size;
+  }
+  memcpy(entry->title, order_title, size);
+  return 1;
+}
+
+// Moves the entry at a position of the heap down until the entries below it are written before it
+void siftOrderEntry(int position)
+{
+  OrderEntry entry = order_entries[position];
+  int child;
+  while ((child = position * 2 + 1) < order_entry_count)
+  {
+    if (child + 1 < order_entry_count && compareOrderEntries(&order_entries[child + 1], &order_entries[child]) > 0)
+      child++;
+    if (compareOrderEntries(&order_entries[child], &entry) <= 0)
+      break;
+    order_entries[position] = order_entries[child];
+    position = child;
+  }
+  order_entries[position] = entry;
+}
+
+// Replaces the selected windows by the windows of the page in order, returns an exit code
+int orderSelectedWindows()
+{
+  OrderEntry candidate;
+  OrderEntry *grown;
+  int64_t start = beginStatsCall();
+  int64_t kept = selected_count;
+  int count;
+  int i;
+  order_candidate_count = selected_count;
+  order_entry_count = 0;
+  if (order_limit >= 0 && order_offset < selected_count && order_limit < selected_count - order_offset)
+    kept = order_offset + order_limit;
+  if (order_key == ORDER_NONE || order_key == ORDER_Z)
+  {
+    // The selection is already in z-order
+    count = order_offset < kept ? (int)(kept - order_offset) : 0;
+    if (count > 0 && order_offset > 0)
+      memmove(selected_list, &selected_list[order_offset], (size_t)count * sizeof(HWND));
+    selected_count = count;
+    order_entry_count = count;
+    endStatsPhase(&order_time, start);
+    return 0;
+  }
+  if (kept > order_entry_size)
+  {
+    grown = (OrderEntry *)realloc(order_entries, (size_t)kept * sizeof(OrderEntry));
+    if (grown == NULL)
+    {
+      writeOutput("Error: Could not allocate the window order\n");
+      return 1;
+    }
+    // The title buffers of the new entries are allocated when a title is kept in them
+    memset(&grown[order_entry_size], 0, (size_t)(kept - order_entry_size) * sizeof(OrderEntry));
+    order_entries = grown;
+    order_entry_size = (int)kept;
+  }
+  memset(&candidate, 0, sizeof(candidate));
+  for (i = 0; i < selected_count && kept > 0; i++)
+  {
+    candidate.handle = selected_list[i];
+    candidate.position = i;
+    readOrderKey(candidate.handle, &candidate);
+    candidate.title = order_title;
+    if (order_entry_count < kept)
+    {
+      order_entries[order_entry_count].handle = candidate.handle;
+      order_entries[order_entry_count].position = candidate.position;
+      order_entries[order_entry_count].key = candidate.key;
+      if (order_key == ORDER_TITLE && !keepOrderTitle(&order_entries[order_entry_count]))
+        break;
+      order_entry_count++;
+      // The heap is built once it is full, the entries before are only collected
+      if (order_entry_count == kept && kept < selected_count)
+      {
+        for (count = order_entry_count / 2 - 1; count >= 0; count--)
+          siftOrderEntry(count);
+      }
+      continue;
+    }
+    // The root is the last window of the page, a window written after it is not on the page
+    if (compareOrderEntries(&candidate, &order_entries[0]) >= 0)
+      continue;
+    order_entries[0].handle = candidate.handle;
+    order_entries[0].position = candidate.position;
+    order_entries[0].key = candidate.key;
+    if (order_key == ORDER_TITLE && !keepOrderTitle(&order_entries[0]))
+      break;
+    siftOrderEntry(0);
+    order_replacement_count++;
+  }
+  if (i < selected_count && kept > 0)
+  {
+    writeOutput("Error: Could not allocate the window order\n");
+    return 1;
+  }
+  qsort(order_entries, (size_t)order_entry_count, sizeof(OrderEntry), sortOrderEntries);
+  count = 0;
+  for (i = order_offset < order_entry_count ? (int)order_offset : order_entry_count; i < order_entry_count; i++)
+    selected_list[count++] = order_entries[i].handle;
+  selected_count = count;
+  endStatsPhase(&order_time, start);
+  return 0;
+}
+
+// Writes the "order" section of the statistics object
+void writeOrderStats(JsonWriter *writer)
+{
+  beginStatsSection(writer, "order");
+  putStatsCounter(writer, 1, "candidates", order_candidate_count);
+  putStatsCounter(writer, 0, "kept", order_entry_count);
+  putStatsCounter(writer, 0, "replacements", order_replacement_count);
+  putStatsCounter(writer, 0, "order_ns", order_time);
+  putJsonChar(writer, '}');
+}
+
+// Forgets the options of a request, the entries and their title buffers are kept for the next one
+void resetOrder()
+{
+  order_key = ORDER_NONE;
+  order_limit = -1;
+  order_offset = 0;
+  order_entry_count = 0;
+  order_candidate_count = 0;
+  order_replacement_count = 0;
+  order_time = 0;
+}
@@ -0,0 +1,299 @@
+// Publishing: keeps the selected window list in a named shared memory region with --publish, for local processes that
+// read it with --read-published or the reader of shared/published-reader.h instead of listing the windows themselves.
+//
+// The publisher lists the windows like a request in serve mode, capturing the output of the list into the output buffer,
+// then waits for window events like the watch mode and lists them again. A list that differs from the published one is
+// copied into the region under the sequence lock described in published-reader.h, so readers never wait for the publisher
+// and only retry a copy that overlapped a change. A list equal to the published one is not written, which keeps the
+// sequence still while the desktop is. The region is created for each publisher with a fixed capacity and removed when it
+// stops; it is recreated rather than reused so that a reader of a previous publisher keeps a consistent, if stale, mapping.
+// A name whose publisher is still running is refused, and a region left by a publisher that exited is replaced.
+//
+// Output of --publish, one line per published list:
+//   {"event": "published", "generation": 3, "length": 26904}
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <signal.h>
+#endif
+
+#define PUBLISH_DEFAULT_CAPACITY 16 * 1024 * 1024
+
+typedef struct
+{
+  PublishedHeader *header;
+  char *payload;
+  size_t size;
+  char region_name[PUBLISHED_NAME_SIZE];
+#if defined(_WIN32)
+  HANDLE mapping;
+#else
+  // Identifies the object created by this publisher, the name may refer to the object of another one after it
+  dev_t device;
+  ino_t inode;
+#endif
+} PublishRegion;
+
+int is_option_publish = 0;
+int is_option_read_published = 0;
+char publish_name[MIDDLE_BUFFER_SIZE];
+int64_t publish_capacity = PUBLISH_DEFAULT_CAPACITY;
+
+int64_t publish_count = 0;
+int64_t publish_unchanged_count = 0;
+int64_t publish_retry_count = 0;
+int64_t publish_time = 0;
+
+void closePublishRegion(PublishRegion *region)
+{
+#if defined(_WIN32)
+  if (region->header != NULL)
+    UnmapViewOfFile(region->header);
+  if (region->mapping != NULL)
+    CloseHandle(region->mapping);
+  region->mapping = NULL;
+#else
+  struct stat region_stat;
+  int file;
+  if (region->header != NULL)
+    munmap(region->header, region->size);
+  // The region is only removed while its name still refers to it
+  file = region->inode != 0 ? shm_open(region->region_name, O_RDONLY, 0) : -1;
+  if (file >= 0)
+  {
+    if (fstat(file, &region_stat) == 0 && region_stat.st_dev == region->device && region_stat.st_ino == region->inode)
+      shm_unlink(region->region_name);
+    close(file);
+  }
+  region->inode = 0;
+#endif
+  region->header = NULL;
+}
+
+#if !defined(_WIN32)
+// Returns non-zero when the region of a name was created by a process that is still running
+int isPublisherRunning(const char *name)
+{
+  PublishedReader reader;
+  uint32_t pid;
+  if (!openPublishedReader(&reader, name))
+    return 0;
+  pid = reader.header->publisher_pid;
+  closePublishedReader(&reader);
+  // A process of another user is reported as running by EPERM
+  return pid != 0 && (kill((pid_t)pid, 0) == 0 || errno == EPERM);
+}
+#endif
+
+// Creates the region of a publisher, returns zero after writing an error
+int openPublishRegion(PublishRegion *region, const char *name, size_t capacity)
+{
+  void *view;
+#if !defined(_WIN32)
+  struct stat region_stat;
+  int file;
+#endif
+  memset(region, 0, sizeof(PublishRegion));
+  region->size = sizeof(PublishedHeader) + capacity;
+  if (!getPublishedRegionName(name, region->region_name, sizeof(region->region_name)))
+  {
+    writeOutput("Error: Invalid published name \"%s\" (expected a name without path separators)\n", name);
+    return 0;
+  }
+#if defined(_WIN32)
+  region->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((uint64_t)region->size >> 32), (DWORD)region->size, region->region_name);
+  if (region->mapping != NULL && GetLastError() == ERROR_ALREADY_EXISTS)
+  {
+    CloseHandle(region->mapping);
+    region->mapping = NULL;
+    writeOutput("Error: The name \"%s\" is already published by another process\n", name);
+    return 0;
+  }
+  view = region->mapping != NULL ? MapViewOfFile(region->mapping, FILE_MAP_WRITE, 0, 0, region->size) : NULL;
+#else
+  file = shm_open(region->region_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (file < 0 && errno == EEXIST)
+  {
+    if (isPublisherRunning(name))
+    {
+      writeOutput("Error: The name \"%s\" is already published by another process\n", name);
+      return 0;
+    }
+    // A region left by a publisher that did not stop is replaced, its readers keep their mapping of it
+    shm_unlink(region->region_name);
+    file = shm_open(region->region_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  }
+  view = NULL;
+  if (file >= 0)
+  {
+    if (fstat(file, &region_stat) == 0)
+    {
+      region->device = region_stat.st_dev;
+      region->inode = region_stat.st_ino;
+    }
+    if (ftruncate(file, (off_t)region->size) == 0)
+      view = mmap(NULL, region->size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    close(file);
+    if (view == MAP_FAILED)
+      view = NULL;
+  }
+#endif
+  if (view == NULL)
+  {
+    closePublishRegion(region);
+    writeOutput("Error: Could not create the shared memory region \"%s\" of %" PRId64 " bytes\n", region->region_name, (int64_t)region->size);
+    return 0;
+  }
+  region->header = (PublishedHeader *)view;
+  region->payload = (char *)view + sizeof(PublishedHeader);
+  region->header->version = PUBLISHED_VERSION;
+  region->header->header_size = sizeof(PublishedHeader);
+  region->header->capacity = capacity;
+  region->header->format = (uint32_t)output_format;
+#if defined(_WIN32)
+  region->header->publisher_pid = (uint32_t)GetCurrentProcessId();
+#else
+  region->header->publisher_pid = (uint32_t)getpid();
+#endif
+  // The magic is written last so that a reader never accepts a header that is being initialized
+  PUBLISHED_BARRIER();
+  memcpy(region->header->magic, PUBLISHED_MAGIC, 8);
+  return 1;
+}
+
+// Copies a list into the region unless it is already published, returns non-zero when it was copied
+int publishWindowList(PublishRegion *region, const char *data, size_t length)
+{
+  PublishedHeader *header = region->header;
+  uint64_t sequence = header->sequence;
+  int64_t start = getClockNanoseconds();
+  if (sequence != 0 && header->length == length && memcmp(region->payload, data, length) == 0)
+  {
+    publish_unchanged_count++;
+    return 0;
+  }
+  header->sequence = sequence + 1;
+  PUBLISHED_BARRIER();
+  memcpy(region->payload, data, length);
+  header->length = length;
+  header->time = getWallClockMilliseconds();
+  PUBLISHED_BARRIER();
+  header->sequence = sequence + 2;
+  publish_count++;
+  publish_time += getClockNanoseconds() - start;
+  return 1;
+}
+
+// Lists the selected windows into the region after each change until the backend stops reporting events, returns an exit code
+int runPublisher(HWND scope, int isOcclusionUsed)
+{
+  PublishRegion region;
+  int is_rescan;
+  int code = 0;
+  if (!openPublishRegion(&region, publish_name, (size_t)publish_capacity))
+    return 1;
+  for (;;)
+  {
+    is_output_captured = 1;
+    output_length = 0;
+    if (isOcclusionUsed && !computeOcclusion())
+    {
+      writeOutput("Error: Could not allocate the visible areas\n");
+      code = 1;
+    }
+    else
+      code = startProgram();
+    flushJsonWriter(&output_writer);
+    is_output_captured = 0;
+    if (code != 0)
+    {
+      // The error of the list was captured, it is written as the output of the publisher
+      fwrite(output, 1, output_length, stdout);
+      break;
+    }
+    if (output_length > (size_t)publish_capacity)
+    {
+      writeOutput("Error: The window list of %" PRId64 " bytes exceeds the published capacity of %" PRId64 " bytes (see --publish-size)\n", (int64_t)output_length, publish_capacity);
+      code = 1;
+      break;
+    }
+    if (publishWindowList(&region, output, output_length))
+      writeOutput("{\"event\": \"published\", \"generation\": %" PRId64 ", \"length\": %" PRId64 "}\n", (int64_t)(region.header->sequence / 2), (int64_t)output_length);
+    fflush(stdout);
+    is_rescan = 0;
+    if (backendWaitForWindowEvents(scope, watch_event_list, WATCH_EVENT_LIST_SIZE, (int)watch_interval, &is_rescan) < 0)
+      break;
+  }
+  closePublishRegion(&region);
+  return code;
+}
+
+// Writes the list published under a name, returns an exit code
+int writePublishedList()
+{
+  PublishedReader reader;
+  char *data = NULL;
+  char *grown;
+  size_t size = 0;
+  uint64_t generation = 0;
+  int64_t length = PUBLISHED_ERROR_SIZE;
+  int64_t start = getClockNanoseconds();
+  if (!openPublishedReader(&reader, publish_name))
+  {
+    writeOutput("Error: No window list is published as \"%s\"\n", publish_name);
+    return 1;
+  }
+  // The list may grow between reading its length and copying it, the buffer is grown until the copy fits
+  while (length == PUBLISHED_ERROR_SIZE)
+  {
+    size = (size_t)getPublishedSnapshotLength(&reader) + 4096;
+    grown = (char *)realloc(data, size);
+    if (grown == NULL)
+      break;
+    data = grown;
+    length = readPublishedSnapshot(&reader, data, size, &generation, NULL);
+  }
+  publish_count = length >= 0 ? (int64_t)generation : 0;
+  publish_retry_count = reader.retry_count;
+  publish_time = getClockNanoseconds() - start;
+  if (length >= 0)
+  {
+#if defined(_WIN32)
+    if (reader.header->format == PUBLISHED_FORMAT_BINARY && !is_output_captured)
+      _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    writeOutputBytes(data, (size_t)length);
+  }
+  else if (length == PUBLISHED_ERROR_EMPTY)
+    writeOutput("Error: No window list was published as \"%s\" yet\n", publish_name);
+  else if (length == PUBLISHED_ERROR_BUSY)
+    writeOutput("Error: The window list published as \"%s\" kept changing while it was read\n", publish_name);
+  else
+    writeOutput("Error: Could not allocate the published window list\n");
+  free(data);
+  closePublishedReader(&reader);
+  return length >= 0 ? 0 : 1;
+}
+
+// Writes the "publish" section of the statistics object
+void writePublishStats(JsonWriter *writer)
+{
+  beginStatsSection(writer, "publish");
+  putStatsCounter(writer, 1, "published", publish_count);
+  putStatsCounter(writer, 0, "unchanged", publish_unchanged_count);
+  putStatsCounter(writer, 0, "retries", publish_retry_count);
+  putStatsCounter(writer, 0, "copy_ns", publish_time);
+  putJsonChar(writer, '}');
+}
+
+void resetPublish()
+{
+  is_option_publish = 0;
+  is_option_read_published = 0;
+  publish_name[0] = '\0';
+  publish_capacity = PUBLISH_DEFAULT_CAPACITY;
+  publish_count = 0;
+  publish_unchanged_count = 0;
+  publish_retry_count = 0;
+  publish_time = 0;
+}
@@ -0,0 +1,114 @@
+// Window record: the fixed-size state of a window shared by the output formats and the snapshot files.
+//
+// Strings are stored outside of the record in a heap and referenced by offset and length. The boolean attributes are
+// stored in a bitmask that uses the bits of their FIELD_* flags, and the fields bitmask tells which attributes were read.
+
+typedef struct
+{
+  int64_t handle;
+  int64_t parent;
+  int64_t sibling;
+  int64_t child;
+  int64_t exstyle;
+  uint32_t pid;
+  uint32_t thread;
+  int32_t style;
+  int32_t top;
+  int32_t right;
+  int32_t bottom;
+  int32_t left;
+  uint32_t flags;
+  uint32_t fields;
+  uint32_t title_offset;
+  uint32_t title_length;
+  uint32_t module_offset;
+  uint32_t module_length;
+  uint32_t executable_offset;
+  uint32_t executable_length;
+  uint32_t classname_offset;
+  uint32_t classname_length;
+  uint32_t reserved;
+} WindowRecord;
+
+typedef struct
+{
+  char *data;
+  size_t length;
+  size_t size;
+} RecordHeap;
+
+// Appends a string to the heap and returns its offset, or -1 when the heap cannot grow
+int64_t appendRecordString(RecordHeap *heap, const char *text, size_t text_length)
+{
+  size_t grown_size;
+  char *grown;
+  int64_t offset;
+  if (text_length == 0)
+    return (int64_t)heap->length;
+  if (heap->length + text_length > heap->size)
+  {
+    grown_size = heap->size == 0 ? 64 * 1024 : heap->size;
+    while (grown_size < heap->length + text_length)
+      grown_size *= 2;
+    grown = (char *)realloc(heap->data, grown_size);
+    if (grown == NULL)
+      return -1;
+    heap->data = grown;
+    heap->size = grown_size;
+  }
+  offset = (int64_t)heap->length;
+  memcpy(&heap->data[heap->length], text, text_length);
+  heap->length += text_length;
+  return offset;
+}
+
+void freeRecordHeap(RecordHeap *heap)
+{
+  free(heap->data);
+  heap->data = NULL;
+  heap->length = 0;
+  heap->size = 0;
+}
+
+// Binary output: a stream header followed by one frame per window, in native byte order (little-endian on every target)
+//   char[8] magic, uint32_t version, uint32_t record_size
+//   uint32_t frame_length, WindowRecord, title, module, executable and classname strings without terminators
+// The string offsets of a frame are relative to the first byte after its record.
+
+#define RECORD_STREAM_MAGIC "WSRECS\r\n"
+#define RECORD_STREAM_VERSION 1
+
+size_t putRecordStreamHeader(char *buffer)
+{
+  uint32_t version = RECORD_STREAM_VERSION;
+  uint32_t record_size = (uint32_t)sizeof(WindowRecord);
+  memcpy(buffer, RECORD_STREAM_MAGIC, 8);
+  memcpy(&buffer[8], &version, 4);
+  memcpy(&buffer[12], &record_size, 4);
+  return 16;
+}
+
+// Writes a record and its strings as a frame, returns zero when the frame does not fit in the buffer
+size_t putRecordFrame(char *buffer, size_t buffer_size, WindowRecord *record, const char *title, const char *module, const char *executable, const char *classname)
+{
+  WindowRecord frame = *record;
+  uint32_t frame_length = (uint32_t)(sizeof(WindowRecord) + record->title_length + record->module_length + record->executable_length + record->classname_length);
+  size_t i = 4 + sizeof(WindowRecord);
+  if (4 + (size_t)frame_length > buffer_size)
+    return 0;
+  frame.title_offset = 0;
+  frame.module_offset = frame.title_offset + frame.title_length;
+  frame.executable_offset = frame.module_offset + frame.module_length;
+  frame.classname_offset = frame.executable_offset + frame.executable_length;
+  memcpy(buffer, &frame_length, 4);
+  memcpy(&buffer[4], &frame, sizeof(WindowRecord));
+  memcpy(&buffer[i], title, frame.title_length);
+  i += frame.title_length;
+  memcpy(&buffer[i], module, frame.module_length);
+  i += frame.module_length;
+  memcpy(&buffer[i], executable, frame.executable_length);
+  i += frame.executable_length;
+  memcpy(&buffer[i], classname, frame.classname_length);
+  i += frame.classname_length;
+  return i;
+}
@@ -0,0 +1,343 @@
+// Snapshot files: the window records of a result written as a binary file, and the difference of a result to a file.
+//
+// Layout (native byte order, every section is 8-byte aligned so the file can be mapped and read in place):
+//   SnapshotHeader                            Magic, version, sizes and the fields of the records
+//   WindowRecord[record_count]                Records sorted by handle
+//   char[heap_size]                           Strings referenced by the records, offsets are relative to the heap start
+//
+// Since both the stored and the current records are sorted by handle, the difference is computed by a linear merge.
+
+#define SNAPSHOT_MAGIC "WSSNAP\r\n"
+#define SNAPSHOT_VERSION 1
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t record_count;
+  uint32_t fields;
+  uint64_t heap_size;
+} SnapshotHeader;
+
+int is_option_snapshot_out = 0;
+char snapshot_out_path[MIDDLE_BUFFER_SIZE];
+int is_option_since = 0;
+char since_path[MIDDLE_BUFFER_SIZE];
+
+// Records of the current result
+WindowRecord *snapshot_records = NULL;
+int snapshot_record_count = 0;
+int snapshot_record_size = 0;
+RecordHeap snapshot_heap = {NULL, 0, 0};
+
+// Contents of the file given to --since
+char *since_data = NULL;
+WindowRecord *since_records = NULL;
+int since_record_count = 0;
+const char *since_heap = NULL;
+
+int64_t snapshot_file_size = 0;
+
+void resetSnapshots()
+{
+  is_option_snapshot_out = 0;
+  snapshot_out_path[0] = '\0';
+  is_option_since = 0;
+  since_path[0] = '\0';
+  free(snapshot_records);
+  snapshot_records = NULL;
+  snapshot_record_count = 0;
+  snapshot_record_size = 0;
+  freeRecordHeap(&snapshot_heap);
+  free(since_data);
+  since_data = NULL;
+  since_records = NULL;
+  since_record_count = 0;
+  since_heap = NULL;
+}
+
+int appendSnapshotWindow(HWND h)
+{
+  WindowRecord *record;
+  WindowRecord *grown;
+  int grown_size;
+  int64_t offsets[4];
+  if (snapshot_record_count >= snapshot_record_size)
+  {
+    grown_size = snapshot_record_size == 0 ? 256 : snapshot_record_size * 2;
+    grown = (WindowRecord *)realloc(snapshot_records, (size_t)grown_size * sizeof(WindowRecord));
+    if (grown == NULL)
+      return 0;
+    snapshot_records = grown;
+    snapshot_record_size = grown_size;
+  }
+  record = &snapshot_records[snapshot_record_count];
+  fetchWindowRecord(h, output_fields | filter_fields, record);
+  record->fields = (uint32_t)output_fields;
+  offsets[0] = appendRecordString(&snapshot_heap, title, record->title_length);
+  offsets[1] = appendRecordString(&snapshot_heap, module, record->module_length);
+  offsets[2] = appendRecordString(&snapshot_heap, (char *)exec_file_path, record->executable_length);
+  offsets[3] = appendRecordString(&snapshot_heap, class, record->classname_length);
+  if (offsets[0] < 0 || offsets[1] < 0 || offsets[2] < 0 || offsets[3] < 0 || snapshot_heap.length > UINT32_MAX)
+    return 0;
+  record->title_offset = (uint32_t)offsets[0];
+  record->module_offset = (uint32_t)offsets[1];
+  record->executable_offset = (uint32_t)offsets[2];
+  record->classname_offset = (uint32_t)offsets[3];
+  snapshot_record_count++;
+  return 1;
+}
+
+int compareRecordHandles(const void *a, const void *b)
+{
+  int64_t x = ((const WindowRecord *)a)->handle;
+  int64_t y = ((const WindowRecord *)b)->handle;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+int writeSnapshotFile(const char *path)
+{
+  SnapshotHeader header;
+  size_t padding = (8 - snapshot_heap.length % 8) % 8;
+  char zeros[8] = {0};
+  FILE *file = fopen(path, "wb");
+  if (file == NULL)
+  {
+    writeOutput("Error: Could not open snapshot file \"%s\" for writing\n", path);
+    return 0;
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+  header.version = SNAPSHOT_VERSION;
+  header.record_size = (uint32_t)sizeof(WindowRecord);
+  header.record_count = (uint32_t)snapshot_record_count;
+  header.fields = (uint32_t)output_fields;
+  header.heap_size = (uint64_t)snapshot_heap.length;
+  if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+      (snapshot_record_count > 0 && fwrite(snapshot_records, sizeof(WindowRecord), (size_t)snapshot_record_count, file) != (size_t)snapshot_record_count) ||
+      (snapshot_heap.length > 0 && fwrite(snapshot_heap.data, 1, snapshot_heap.length, file) != snapshot_heap.length) ||
+      fwrite(zeros, 1, padding, file) != padding)
+  {
+    fclose(file);
+    writeOutput("Error: Could not write snapshot file \"%s\"\n", path);
+    return 0;
+  }
+  fclose(file);
+  snapshot_file_size = (int64_t)(sizeof(header) + (size_t)snapshot_record_count * sizeof(WindowRecord) + snapshot_heap.length + padding);
+  return 1;
+}
+
+// Reads a whole snapshot file and validates that every string of its records is inside of the heap
+int readSnapshotFile(const char *path)
+{
+  SnapshotHeader *header;
+  long file_size;
+  size_t records_size;
+  int i;
+  WindowRecord *r;
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    writeOutput("Error: Could not open snapshot file \"%s\"\n", path);
+    return 0;
+  }
+  fseek(file, 0, SEEK_END);
+  file_size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  since_data = file_size >= (long)sizeof(SnapshotHeader) ? (char *)malloc((size_t)file_size) : NULL;
+  if (since_data == NULL || fread(since_data, 1, (size_t)file_size, file) != (size_t)file_size)
+  {
+    fclose(file);
+    writeOutput("Error: Could not read snapshot file \"%s\"\n", path);
+    return 0;
+  }
+  fclose(file);
+  header = (SnapshotHeader *)since_data;
+  records_size = (size_t)header->record_count * sizeof(WindowRecord);
+  if (memcmp(header->magic, SNAPSHOT_MAGIC, 8) != 0 || header->version != SNAPSHOT_VERSION || header->record_size != sizeof(WindowRecord) ||
+      sizeof(SnapshotHeader) + records_size + header->heap_size > (uint64_t)file_size)
+  {
+    writeOutput("Error: Invalid snapshot file \"%s\"\n", path);
+    return 0;
+  }
+  since_records = (WindowRecord *)&since_data[sizeof(SnapshotHeader)];
+  since_record_count = (int)header->record_count;
+  since_heap = &since_data[sizeof(SnapshotHeader) + records_size];
+  for (i = 0; i < since_record_count; i++)
+  {
+    r = &since_records[i];
+    if ((uint64_t)r->title_offset + r->title_length > header->heap_size || (uint64_t)r->module_offset + r->module_length > header->heap_size ||
+        (uint64_t)r->executable_offset + r->executable_length > header->heap_size || (uint64_t)r->classname_offset + r->classname_length > header->heap_size ||
+        r->title_length >= MIDDLE_BUFFER_SIZE || r->module_length >= MIDDLE_BUFFER_SIZE || r->executable_length >= MIDDLE_BUFFER_SIZE || r->classname_length >= MIDDLE_BUFFER_SIZE ||
+        (i > 0 && since_records[i - 1].handle >= r->handle))
+    {
+      writeOutput("Error: Invalid snapshot file \"%s\" (record %d is corrupted)\n", path, i);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Copies the strings of a record into the title, module, executable and class buffers
+void loadRecordStrings(WindowRecord *record, const char *heap)
+{
+  memcpy(title, &heap[record->title_offset], record->title_length);
+  title[record->title_length] = '\0';
+  memcpy(module, &heap[record->module_offset], record->module_length);
+  module[record->module_length] = '\0';
+  memcpy(exec_file_path, &heap[record->executable_offset], record->executable_length);
+  exec_file_path[record->executable_length] = '\0';
+  memcpy(class, &heap[record->classname_offset], record->classname_length);
+  class[record->classname_length] = '\0';
+}
+
+int isRecordStringChanged(const char *a_heap, uint32_t a_offset, uint32_t a_length, const char *b_heap, uint32_t b_offset, uint32_t b_length)
+{
+  return a_length != b_length || memcmp(&a_heap[a_offset], &b_heap[b_offset], a_length) != 0;
+}
+
+// Writes the handle and the attributes that differ between two records of a window, returns zero when nothing changed
+size_t putRecordChangesJson(char *buffer, size_t buffer_size, WindowRecord *before, const char *before_heap, WindowRecord *after, const char *after_heap)
+{
+  const int flag_fields[] = {FIELD_VISIBLE, FIELD_UNICODE, FIELD_POPUP, FIELD_CONTAINED, FIELD_BORDERED, FIELD_SCROLLABLE, FIELD_VISIBLE_ALT, FIELD_MINIMIZED, FIELD_TOPMOST, FIELD_TRANSPARENT};
+  const char *flag_keys[] = {"visible", "unicode", "popup", "contained", "bordered", "scrollable", "visible_alt", "minimized", "topmost", "transparent"};
+  const int number_fields[] = {FIELD_PARENT, FIELD_SIBLING, FIELD_CHILD, FIELD_PID, FIELD_THREAD, FIELD_STYLE, FIELD_EXSTYLE};
+  const char *number_keys[] = {"parent", "sibling", "child", "pid", "thread", "style", "exstyle"};
+  const int string_fields[] = {FIELD_TITLE, FIELD_MODULE, FIELD_EXECUTABLE, FIELD_CLASSNAME};
+  const char *string_keys[] = {"title", "module", "executable", "classname"};
+  char *strings[4] = {title, module, (char *)exec_file_path, class};
+  uint32_t before_offsets[4] = {before->title_offset, before->module_offset, before->executable_offset, before->classname_offset};
+  uint32_t before_lengths[4] = {before->title_length, before->module_length, before->executable_length, before->classname_length};
+  uint32_t after_offsets[4] = {after->title_offset, after->module_offset, after->executable_offset, after->classname_offset};
+  uint32_t after_lengths[4] = {after->title_length, after->module_length, after->executable_length, after->classname_length};
+  int64_t before_numbers[7] = {before->parent, before->sibling, before->child, before->pid, before->thread, before->style, before->exstyle};
+  int64_t after_numbers[7] = {after->parent, after->sibling, after->child, after->pid, after->thread, after->style, after->exstyle};
+  uint32_t fields = before->fields & after->fields;
+  JsonWriter writer;
+  int k;
+  int is_changed = 0;
+  initJsonWriter(&writer, buffer, buffer_size, NULL);
+  loadRecordStrings(after, after_heap);
+  putJsonChar(&writer, '{');
+  putJsonKey(&writer, 1, "handle");
+  putJsonInteger(&writer, after->handle);
+  for (k = 0; k < 4; k++)
+  {
+    if ((fields & string_fields[k]) && isRecordStringChanged(before_heap, before_offsets[k], before_lengths[k], after_heap, after_offsets[k], after_lengths[k]))
+    {
+      putJsonKey(&writer, 0, string_keys[k]);
+      putJsonString(&writer, strings[k], after_lengths[k]);
+      is_changed = 1;
+    }
+  }
+  for (k = 0; k < 7; k++)
+  {
+    if ((fields & number_fields[k]) && before_numbers[k] != after_numbers[k])
+    {
+      putJsonKey(&writer, 0, number_keys[k]);
+      putJsonInteger(&writer, after_numbers[k]);
+      is_changed = 1;
+    }
+  }
+  for (k = 0; k < 10; k++)
+  {
+    if ((fields & flag_fields[k]) && (before->flags & flag_fields[k]) != (after->flags & flag_fields[k]))
+    {
+      putJsonKey(&writer, 0, flag_keys[k]);
+      putJsonBoolean(&writer, (after->flags & flag_fields[k]) != 0);
+      is_changed = 1;
+    }
+  }
+  if ((fields & FIELD_RECT) && (before->top != after->top || before->right != after->right || before->bottom != after->bottom || before->left != after->left))
+  {
+    putJsonKey(&writer, 0, "top");
+    putJsonInteger(&writer, after->top);
+    putJsonKey(&writer, 0, "right");
+    putJsonInteger(&writer, after->right);
+    putJsonKey(&writer, 0, "bottom");
+    putJsonInteger(&writer, after->bottom);
+    putJsonKey(&writer, 0, "left");
+    putJsonInteger(&writer, after->left);
+    is_changed = 1;
+  }
+  putJsonChar(&writer, '}');
+  return is_changed ? finishJsonWriter(&writer) : 0;
+}
+
+#define SNAPSHOT_ADDED 0
+#define SNAPSHOT_REMOVED 1
+#define SNAPSHOT_CHANGED 2
+
+// Merges the stored and the current records and writes the windows of one kind of difference
+void writeSnapshotDifference(int kind)
+{
+  int i = 0;
+  int j = 0;
+  int count = 0;
+  size_t length;
+  while (i < since_record_count || j < snapshot_record_count)
+  {
+    if (j >= snapshot_record_count || (i < since_record_count && since_records[i].handle < snapshot_records[j].handle))
+    {
+      if (kind == SNAPSHOT_REMOVED)
+      {
+        if (count++ != 0)
+          putJsonBytes(&output_writer, ", ", 2);
+        putJsonInteger(&output_writer, since_records[i].handle);
+      }
+      i++;
+    }
+    else if (i >= since_record_count || snapshot_records[j].handle < since_records[i].handle)
+    {
+      if (kind == SNAPSHOT_ADDED)
+      {
+        loadRecordStrings(&snapshot_records[j], snapshot_heap.data);
+        if (count++ != 0)
+          putJsonBytes(&output_writer, ", ", 2);
+        putWindowRecordJson(&output_writer, (int)snapshot_records[j].fields, &snapshot_records[j]);
+      }
+      j++;
+    }
+    else
+    {
+      if (kind == SNAPSHOT_CHANGED)
+      {
+        length = putRecordChangesJson(buffer, BUFFER_SIZE, &since_records[i], since_heap, &snapshot_records[j], snapshot_heap.data);
+        if (length > 0 && count++ != 0)
+          putJsonBytes(&output_writer, ", ", 2);
+        if (length > 0)
+          putJsonBytes(&output_writer, buffer, length);
+      }
+      i++;
+      j++;
+    }
+  }
+}
+
+// Sorts the collected records, writes the difference to the --since file and replaces the --snapshot-out file
+int finishSnapshot()
+{
+  if (snapshot_record_count > 1)
+    qsort(snapshot_records, (size_t)snapshot_record_count, sizeof(WindowRecord), compareRecordHandles);
+  if (is_option_since)
+  {
+    if (!readSnapshotFile(since_path))
+      return 1;
+    writeOutput("{\"added\": [");
+    writeSnapshotDifference(SNAPSHOT_ADDED);
+    writeOutput("], \"removed\": [");
+    writeSnapshotDifference(SNAPSHOT_REMOVED);
+    writeOutput("], \"changed\": [");
+    writeSnapshotDifference(SNAPSHOT_CHANGED);
+    writeOutput("]}");
+  }
+  if (is_option_snapshot_out)
+  {
+    if (!writeSnapshotFile(snapshot_out_path))
+      return 1;
+    if (!is_option_since)
+      writeOutput("{\"count\": %d, \"size\": %" PRId64 "}", snapshot_record_count, snapshot_file_size);
+  }
+  return 0;
+}
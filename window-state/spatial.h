@@ -0,0 +1,510 @@
+// Spatial queries: answers --at hit-tests and --intersects rectangle queries from a grid built over the window rectangles.
+//
+// The index holds the visible, not minimized windows of the desktop or --parent scope in z-order, with their rectangles
+// read once. The bounding box of the rectangles is split into cells of half the mean window size, and each window is
+// listed in the cells it covers in z-order, so a hit-test scans the cell of the point from the top of the z-order and
+// stops at the first window that contains it. Windows covering more than SPATIAL_LARGE_CELLS cells, such as maximized
+// windows above many small ones, are kept in a separate list merged with the cell by z-order instead.
+//
+// A served session keeps the index between requests. Before a query it asks the backend for window changes without
+// waiting, which starts listening on the first query, and only rebuilds the index when a change was reported or when a
+// request applied operations or a layout, since the changes made by this process are not reported.
+//
+// Output, one object per query in the order of the arguments:
+//   {"x": 10, "y": 20, "window": {...}}                                       Topmost window at the point, or null
+//   {"top": 0, "right": 800, "bottom": 600, "left": 0, "windows": [...]}     Windows intersecting the rectangle in z-order
+
+#define SPATIAL_AT 0
+#define SPATIAL_INTERSECTS 1
+
+#define SPATIAL_QUERY_LIMIT 256
+#define SPATIAL_AXIS_LIMIT 1024
+#define SPATIAL_LARGE_CELLS 256
+#define SPATIAL_EVENT_LIST_SIZE 256
+
+typedef struct
+{
+  int type;
+  int64_t left;
+  int64_t top;
+  int64_t right;
+  int64_t bottom;
+} SpatialQuery;
+
+typedef struct
+{
+  HWND handle;
+  RECT rect;
+} SpatialWindow;
+
+SpatialQuery spatial_queries[SPATIAL_QUERY_LIMIT];
+int spatial_query_count = 0;
+
+// Windows of the index in z-order, a window is referred to by its position in this list
+SpatialWindow *spatial_windows = NULL;
+int spatial_window_count = 0;
+int spatial_window_size = 0;
+// Position of the first entry of each cell in the entry list, the list of cell i ends where the one of cell i + 1 starts
+int *spatial_cells = NULL;
+int spatial_cell_size = 0;
+int *spatial_entries = NULL;
+size_t spatial_entry_size = 0;
+int *spatial_large = NULL;
+int spatial_large_count = 0;
+// Windows already seen by the current rectangle query are marked with its number, the hits are then sorted in z-order
+int *spatial_marks = NULL;
+int *spatial_hits = NULL;
+int spatial_mark = 0;
+
+int64_t spatial_left = 0;
+int64_t spatial_top = 0;
+int64_t spatial_cell_width = 1;
+int64_t spatial_cell_height = 1;
+int spatial_columns = 0;
+int spatial_rows = 0;
+int is_spatial_index_built = 0;
+HWND spatial_scope = NULL;
+HWND spatial_event_list[SPATIAL_EVENT_LIST_SIZE];
+
+int64_t spatial_build_count = 0;
+int64_t spatial_reuse_count = 0;
+int64_t spatial_candidate_count = 0;
+int64_t spatial_build_time = 0;
+int64_t spatial_query_time = 0;
+
+// Reads the coordinates of a query from the arguments that follow its flag, returns zero after writing an error
+int parseSpatialQuery(int type, int argn, char **argv, int index)
+{
+  SpatialQuery *query;
+  int64_t values[4];
+  int count = type == SPATIAL_AT ? 2 : 4;
+  long v;
+  int i;
+  int j;
+  if (spatial_query_count >= SPATIAL_QUERY_LIMIT)
+  {
+    writeOutput("Error: Too many spatial queries have been specified (Max is %d)\n", (int)SPATIAL_QUERY_LIMIT);
+    return 0;
+  }
+  for (i = 0; i < count; i++)
+  {
+    if (index + i >= argn || argv[index + i] == NULL)
+    {
+      writeOutput("Error: Expected %d coordinates after \"%s\" from index %d\n", count, argv[index - 1], index - 1);
+      return 0;
+    }
+    for (j = 0; j < 31 && argv[index + i][j] != '\0'; j++)
+      parse_buffer[j] = argv[index + i][j];
+    parse_buffer[j] = '\0';
+    v = 0;
+    if (!safeParseLong(&v))
+    {
+      writeOutput("Error: Invalid coordinate \"%s\" at index %d\n", argv[index + i], index + i);
+      return 0;
+    }
+    values[i] = v;
+  }
+  query = &spatial_queries[spatial_query_count];
+  query->type = type;
+  query->left = values[0];
+  query->top = values[1];
+  query->right = type == SPATIAL_AT ? values[0] + 1 : values[2];
+  query->bottom = type == SPATIAL_AT ? values[1] + 1 : values[3];
+  if (query->right <= query->left || query->bottom <= query->top)
+  {
+    writeOutput("Error: Invalid rectangle %" PRId64 " %" PRId64 " %" PRId64 " %" PRId64 " (expected left < right and top < bottom)\n", values[0], values[1], values[2], values[3]);
+    return 0;
+  }
+  spatial_query_count++;
+  return 1;
+}
+
+// Resizes a list of integers to hold at least a number of items, returns zero when it cannot grow
+int growSpatialList(int **list, size_t count)
+{
+  int *grown = (int *)realloc(*list, (count > 0 ? count : 1) * sizeof(int));
+  if (grown == NULL)
+    return 0;
+  *list = grown;
+  return 1;
+}
+
+// Lists the visible windows of the scope in z-order with their rectangles
+int collectSpatialWindows(HWND scope)
+{
+  SpatialWindow *grown;
+  RECT window_rect;
+  HWND h;
+  int size;
+  spatial_window_count = 0;
+  for (h = backendGetFirstChild(scope); h != NULL; h = backendGetWindow(h, GW_HWNDNEXT))
+  {
+    if (!backendIsWindowVisible(h) || (backendGetWindowLong(h, GWL_STYLE) & WS_MINIMIZE) != 0)
+      continue;
+    memset(&window_rect, 0, sizeof(window_rect));
+    if (!backendGetWindowRect(h, &window_rect) || window_rect.right <= window_rect.left || window_rect.bottom <= window_rect.top)
+      continue;
+    if (spatial_window_count >= spatial_window_size)
+    {
+      size = spatial_window_size == 0 ? 256 : spatial_window_size * 2;
+      grown = (SpatialWindow *)realloc(spatial_windows, (size_t)size * sizeof(SpatialWindow));
+      if (grown == NULL)
+        return 0;
+      spatial_windows = grown;
+      spatial_window_size = size;
+    }
+    spatial_windows[spatial_window_count].handle = h;
+    spatial_windows[spatial_window_count].rect = window_rect;
+    spatial_window_count++;
+  }
+  return 1;
+}
+
+// Returns the cell column or row of a coordinate, clamped to the grid
+int getSpatialCell(int64_t value, int64_t origin, int64_t cell_size, int count)
+{
+  int64_t cell = (value - origin) / cell_size;
+  if (value < origin || count == 0)
+    return 0;
+  return cell >= count ? count - 1 : (int)cell;
+}
+
+// Returns the columns and rows of the cells covered by a rectangle, clamped to the grid
+void getSpatialSpan(int64_t left, int64_t top, int64_t right, int64_t bottom, int *left_column, int *top_row, int *right_column, int *bottom_row)
+{
+  *left_column = getSpatialCell(left, spatial_left, spatial_cell_width, spatial_columns);
+  *top_row = getSpatialCell(top, spatial_top, spatial_cell_height, spatial_rows);
+  *right_column = getSpatialCell(right - 1, spatial_left, spatial_cell_width, spatial_columns);
+  *bottom_row = getSpatialCell(bottom - 1, spatial_top, spatial_cell_height, spatial_rows);
+}
+
+// Builds the index over the windows of a scope, returns zero when it cannot be allocated
+int buildSpatialIndex(HWND scope)
+{
+  SpatialWindow *w;
+  int64_t right = 0;
+  int64_t bottom = 0;
+  int64_t width_sum = 0;
+  int64_t height_sum = 0;
+  size_t entry_count = 0;
+  int cell_count;
+  int left_column;
+  int right_column;
+  int top_row;
+  int bottom_row;
+  int cell;
+  int large;
+  int i;
+  int r;
+  int c;
+  is_spatial_index_built = 0;
+  spatial_build_count++;
+  if (!collectSpatialWindows(scope))
+    return 0;
+  spatial_left = 0;
+  spatial_top = 0;
+  for (i = 0; i < spatial_window_count; i++)
+  {
+    w = &spatial_windows[i];
+    spatial_left = i == 0 || w->rect.left < spatial_left ? w->rect.left : spatial_left;
+    spatial_top = i == 0 || w->rect.top < spatial_top ? w->rect.top : spatial_top;
+    right = i == 0 || w->rect.right > right ? w->rect.right : right;
+    bottom = i == 0 || w->rect.bottom > bottom ? w->rect.bottom : bottom;
+    width_sum += w->rect.right - w->rect.left;
+    height_sum += w->rect.bottom - w->rect.top;
+  }
+  // Cells of half the mean window size list each window in a few cells, the grid is bounded for scattered windows
+  spatial_cell_width = spatial_window_count > 0 ? width_sum / spatial_window_count / 2 : 1;
+  spatial_cell_height = spatial_window_count > 0 ? height_sum / spatial_window_count / 2 : 1;
+  if (spatial_cell_width < (right - spatial_left) / SPATIAL_AXIS_LIMIT + 1)
+    spatial_cell_width = (right - spatial_left) / SPATIAL_AXIS_LIMIT + 1;
+  if (spatial_cell_height < (bottom - spatial_top) / SPATIAL_AXIS_LIMIT + 1)
+    spatial_cell_height = (bottom - spatial_top) / SPATIAL_AXIS_LIMIT + 1;
+  spatial_columns = spatial_window_count > 0 ? (int)((right - spatial_left + spatial_cell_width - 1) / spatial_cell_width) : 0;
+  spatial_rows = spatial_window_count > 0 ? (int)((bottom - spatial_top + spatial_cell_height - 1) / spatial_cell_height) : 0;
+  cell_count = spatial_columns * spatial_rows;
+  if (cell_count + 1 > spatial_cell_size)
+  {
+    if (!growSpatialList(&spatial_cells, (size_t)cell_count + 1))
+      return 0;
+    spatial_cell_size = cell_count + 1;
+  }
+  if (!growSpatialList(&spatial_large, (size_t)spatial_window_count) || !growSpatialList(&spatial_marks, (size_t)spatial_window_count) || !growSpatialList(&spatial_hits, (size_t)spatial_window_count))
+    return 0;
+  memset(spatial_cells, 0, ((size_t)cell_count + 1) * sizeof(int));
+  memset(spatial_marks, 0, (size_t)(spatial_window_count > 0 ? spatial_window_count : 1) * sizeof(int));
+  spatial_mark = 0;
+  spatial_large_count = 0;
+  // The entries are counted per cell first, so that the lists of the cells are laid out one after the other
+  for (i = 0; i < spatial_window_count; i++)
+  {
+    w = &spatial_windows[i];
+    getSpatialSpan(w->rect.left, w->rect.top, w->rect.right, w->rect.bottom, &left_column, &top_row, &right_column, &bottom_row);
+    if ((int64_t)(right_column - left_column + 1) * (bottom_row - top_row + 1) > SPATIAL_LARGE_CELLS)
+    {
+      spatial_large[spatial_large_count++] = i;
+      continue;
+    }
+    for (r = top_row; r <= bottom_row; r++)
+    {
+      for (c = left_column; c <= right_column; c++)
+        spatial_cells[r * spatial_columns + c + 1]++;
+    }
+    entry_count += (size_t)(right_column - left_column + 1) * (bottom_row - top_row + 1);
+  }
+  if (entry_count > spatial_entry_size)
+  {
+    if (!growSpatialList(&spatial_entries, entry_count))
+      return 0;
+    spatial_entry_size = entry_count;
+  }
+  for (cell = 0; cell < cell_count; cell++)
+    spatial_cells[cell + 1] += spatial_cells[cell];
+  // Each window is appended to its cells in z-order, which moves the start of each cell to its end
+  for (i = 0, large = 0; i < spatial_window_count; i++)
+  {
+    if (large < spatial_large_count && spatial_large[large] == i)
+    {
+      large++;
+      continue;
+    }
+    w = &spatial_windows[i];
+    getSpatialSpan(w->rect.left, w->rect.top, w->rect.right, w->rect.bottom, &left_column, &top_row, &right_column, &bottom_row);
+    for (r = top_row; r <= bottom_row; r++)
+    {
+      for (c = left_column; c <= right_column; c++)
+        spatial_entries[spatial_cells[r * spatial_columns + c]++] = i;
+    }
+  }
+  // The end of each cell is the start of the next one
+  for (cell = cell_count; cell > 0; cell--)
+    spatial_cells[cell] = spatial_cells[cell - 1];
+  spatial_cells[0] = 0;
+  spatial_scope = scope;
+  is_spatial_index_built = 1;
+  return 1;
+}
+
+void freeSpatialIndex()
+{
+  free(spatial_windows);
+  spatial_windows = NULL;
+  spatial_window_count = 0;
+  spatial_window_size = 0;
+  free(spatial_cells);
+  spatial_cells = NULL;
+  spatial_cell_size = 0;
+  free(spatial_entries);
+  spatial_entries = NULL;
+  spatial_entry_size = 0;
+  free(spatial_large);
+  spatial_large = NULL;
+  spatial_large_count = 0;
+  free(spatial_marks);
+  spatial_marks = NULL;
+  free(spatial_hits);
+  spatial_hits = NULL;
+  is_spatial_index_built = 0;
+}
+
+// Builds the index of a scope, or keeps it between the requests of a served session while the backend reports no change,
+// returns zero when it cannot be allocated
+int prepareSpatialIndex(HWND scope)
+{
+  int is_rescan = 0;
+  int count = 0;
+  int64_t start;
+  // Without waiting the backend returns the changes since the previous query, the first call starts listening
+  if (is_output_captured)
+    count = backendWaitForWindowEvents(scope, spatial_event_list, SPATIAL_EVENT_LIST_SIZE, 0, &is_rescan);
+  if (is_output_captured && is_spatial_index_built && spatial_scope == scope && (count < 0 || (count == 0 && !is_rescan)))
+  {
+    spatial_reuse_count++;
+    return 1;
+  }
+  start = beginStatsCall();
+  count = buildSpatialIndex(scope);
+  endStatsPhase(&spatial_build_time, start);
+  return count;
+}
+
+// Returns the topmost window of the index that contains a point and matches the filters, or -1
+int findSpatialWindow(int64_t x, int64_t y, int is_filtered)
+{
+  SpatialWindow *w;
+  int large = 0;
+  int index;
+  int cell;
+  int end;
+  int i;
+  if (spatial_window_count == 0 || x < spatial_left || y < spatial_top || x >= spatial_left + spatial_cell_width * spatial_columns || y >= spatial_top + spatial_cell_height * spatial_rows)
+    return -1;
+  cell = getSpatialCell(y, spatial_top, spatial_cell_height, spatial_rows) * spatial_columns + getSpatialCell(x, spatial_left, spatial_cell_width, spatial_columns);
+  i = spatial_cells[cell];
+  end = spatial_cells[cell + 1];
+  // The windows of the cell and the large windows are both in z-order, they are merged until one contains the point
+  while (i < end || large < spatial_large_count)
+  {
+    if (large >= spatial_large_count || (i < end && spatial_entries[i] < spatial_large[large]))
+      index = spatial_entries[i++];
+    else
+      index = spatial_large[large++];
+    spatial_candidate_count++;
+    w = &spatial_windows[index];
+    if (x < w->rect.left || x >= w->rect.right || y < w->rect.top || y >= w->rect.bottom)
+      continue;
+    if (is_filtered && !isMatchingFilters(w->handle, 0))
+      continue;
+    return index;
+  }
+  return -1;
+}
+
+int compareSpatialHits(const void *a, const void *b)
+{
+  return *(const int *)a - *(const int *)b;
+}
+
+int isSpatialIntersecting(SpatialWindow *w, SpatialQuery *query)
+{
+  return query->left < w->rect.right && query->right > w->rect.left && query->top < w->rect.bottom && query->bottom > w->rect.top;
+}
+
+// Lists the windows of the index that intersect a rectangle into the hit list in z-order, returns their count
+int findSpatialWindows(SpatialQuery *query)
+{
+  int left_column;
+  int right_column;
+  int top_row;
+  int bottom_row;
+  int count = 0;
+  int index;
+  int cell;
+  int i;
+  int r;
+  int c;
+  if (spatial_window_count == 0 || query->right <= spatial_left || query->bottom <= spatial_top || query->left >= spatial_left + spatial_cell_width * spatial_columns || query->top >= spatial_top + spatial_cell_height * spatial_rows)
+    return 0;
+  // A window listed in several cells of the rectangle is only checked once
+  if (spatial_mark == 0x7FFFFFFF)
+  {
+    memset(spatial_marks, 0, (size_t)spatial_window_count * sizeof(int));
+    spatial_mark = 0;
+  }
+  spatial_mark++;
+  getSpatialSpan(query->left, query->top, query->right, query->bottom, &left_column, &top_row, &right_column, &bottom_row);
+  for (r = top_row; r <= bottom_row; r++)
+  {
+    for (c = left_column; c <= right_column; c++)
+    {
+      cell = r * spatial_columns + c;
+      for (i = spatial_cells[cell]; i < spatial_cells[cell + 1]; i++)
+      {
+        index = spatial_entries[i];
+        if (spatial_marks[index] == spatial_mark)
+          continue;
+        spatial_marks[index] = spatial_mark;
+        spatial_candidate_count++;
+        if (isSpatialIntersecting(&spatial_windows[index], query))
+          spatial_hits[count++] = index;
+      }
+    }
+  }
+  for (i = 0; i < spatial_large_count; i++)
+  {
+    spatial_candidate_count++;
+    if (isSpatialIntersecting(&spatial_windows[spatial_large[i]], query))
+      spatial_hits[count++] = spatial_large[i];
+  }
+  qsort(spatial_hits, (size_t)count, sizeof(int), compareSpatialHits);
+  return count;
+}
+
+// Answers the queries in the order of the arguments, returns an exit code
+int writeSpatialQueries()
+{
+  SpatialQuery *query;
+  HWND scope = is_filter_parent && !is_filter_desktop ? (HWND)filter_parent : NULL;
+  int isFiltered = is_filter_pid || is_filter_class || is_filter_style || is_filter_exstyle || is_filter_where || is_filter_title || is_filter_class_pattern;
+  int64_t start;
+  int is_first;
+  int count;
+  int index;
+  int q;
+  int i;
+  if (!prepareSpatialIndex(scope))
+  {
+    writeOutput("Error: Could not allocate the spatial index\n");
+    return 1;
+  }
+  if (output_format == FORMAT_JSON)
+    putJsonChar(&output_writer, '[');
+  for (q = 0; q < spatial_query_count; q++)
+  {
+    query = &spatial_queries[q];
+    if (output_format == FORMAT_JSON && q != 0)
+      putJsonBytes(&output_writer, ", ", 2);
+    if (query->type == SPATIAL_AT)
+    {
+      start = beginStatsCall();
+      index = findSpatialWindow(query->left, query->top, isFiltered);
+      endStatsPhase(&spatial_query_time, start);
+      putJsonText(&output_writer, "{\"x\": ");
+      putJsonInteger(&output_writer, query->left);
+      putJsonText(&output_writer, ", \"y\": ");
+      putJsonInteger(&output_writer, query->top);
+      putJsonText(&output_writer, ", \"window\": ");
+      if (index < 0)
+        putJsonText(&output_writer, "null");
+      else
+        makeWindowJson(&output_writer, spatial_windows[index].handle);
+    }
+    else
+    {
+      start = beginStatsCall();
+      count = findSpatialWindows(query);
+      endStatsPhase(&spatial_query_time, start);
+      putJsonText(&output_writer, "{\"top\": ");
+      putJsonInteger(&output_writer, query->top);
+      putJsonText(&output_writer, ", \"right\": ");
+      putJsonInteger(&output_writer, query->right);
+      putJsonText(&output_writer, ", \"bottom\": ");
+      putJsonInteger(&output_writer, query->bottom);
+      putJsonText(&output_writer, ", \"left\": ");
+      putJsonInteger(&output_writer, query->left);
+      putJsonText(&output_writer, ", \"windows\": [");
+      for (i = 0, is_first = 1; i < count; i++)
+      {
+        if (isFiltered && !isMatchingFilters(spatial_windows[spatial_hits[i]].handle, 0))
+          continue;
+        if (!is_first)
+          putJsonBytes(&output_writer, ", ", 2);
+        makeWindowJson(&output_writer, spatial_windows[spatial_hits[i]].handle);
+        is_first = 0;
+      }
+      putJsonChar(&output_writer, ']');
+    }
+    putJsonChar(&output_writer, '}');
+    if (output_format == FORMAT_NDJSON)
+      putJsonChar(&output_writer, '\n');
+  }
+  if (output_format == FORMAT_JSON)
+    putJsonChar(&output_writer, ']');
+  return 0;
+}
+
+// Writes the "spatial" section of the statistics object
+void writeSpatialStats(JsonWriter *writer)
+{
+  beginStatsSection(writer, "spatial");
+  putStatsCounter(writer, 1, "windows", is_spatial_index_built ? spatial_window_count : 0);
+  putStatsCounter(writer, 0, "cells", is_spatial_index_built ? spatial_columns * spatial_rows : 0);
+  putStatsCounter(writer, 0, "large", is_spatial_index_built ? spatial_large_count : 0);
+  putStatsCounter(writer, 0, "builds", spatial_build_count);
+  putStatsCounter(writer, 0, "reuses", spatial_reuse_count);
+  putStatsCounter(writer, 0, "queries", spatial_query_count);
+  putStatsCounter(writer, 0, "candidates", spatial_candidate_count);
+  putStatsCounter(writer, 0, "build_ns", spatial_build_time);
+  putStatsCounter(writer, 0, "query_ns", spatial_query_time);
+  putJsonChar(writer, '}');
+}
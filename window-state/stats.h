@@ -0,0 +1,190 @@
+// Statistics: the counters, timings and latency histograms written as JSON to stderr by the --stats option.
+//
+// The calls to the window system that dominate a listing are timed by reading the clock before them with beginStatsCall
+// and recording the latency after them with endStatsCall. Without --stats, beginStatsCall returns zero without reading the
+// clock and endStatsCall returns on that zero, so the instrumentation only costs a branch per call. Latencies are counted
+// in power-of-two buckets of nanoseconds, bucket i counting the calls that took less than 2^(i+1) nanoseconds.
+
+#define STATS_BUCKET_COUNT 40
+
+#define STATS_CALL_WINDOW_TEXT 0
+#define STATS_CALL_OPEN_PROCESS 1
+#define STATS_CALL_MODULE_FILE_NAME 2
+#define STATS_CALL_WINDOW_RECT 3
+#define STATS_CALL_COUNT 4
+
+typedef struct
+{
+  int64_t count;
+  int64_t total;
+  int64_t max;
+  int64_t buckets[STATS_BUCKET_COUNT];
+} StatsCall;
+
+int is_option_stats = 0;
+// Set while several threads make timed calls, the statistics are then only updated with the mutex held
+int is_stats_shared = 0;
+ThreadMutex stats_mutex;
+
+const char *stats_call_names[STATS_CALL_COUNT] = {"GetWindowText", "OpenProcess", "GetModuleFileNameEx", "GetWindowRect"};
+StatsCall stats_calls[STATS_CALL_COUNT];
+
+// Timing option and call statistics of a thread that can outlive its request, counted apart from the statistics of the
+// request and added to them when the thread is joined
+typedef struct
+{
+  int is_timed;
+  StatsCall calls[STATS_CALL_COUNT];
+} StatsCopy;
+
+// Copy the calling thread counts into, NULL for the threads that count into stats_calls
+THREAD_LOCAL StatsCopy *thread_stats = NULL;
+
+// Start of the execution, end of the argument parsing and time spent walking the windows to select
+int64_t stats_start_time = 0;
+int64_t stats_parse_time = 0;
+int64_t stats_enumerate_time = 0;
+
+// Bytes written to the output and largest buffer the output was assembled in
+int64_t stats_output_bytes = 0;
+size_t stats_peak_buffer = 0;
+
+void resetStats()
+{
+  memset(stats_calls, 0, sizeof(stats_calls));
+  stats_parse_time = 0;
+  stats_enumerate_time = 0;
+  stats_output_bytes = 0;
+  stats_peak_buffer = 0;
+}
+
+int64_t beginStatsCall()
+{
+  if (thread_stats != NULL)
+    return thread_stats->is_timed ? getClockNanoseconds() : 0;
+  return is_option_stats ? getClockNanoseconds() : 0;
+}
+
+void endStatsCall(int call, int64_t start)
+{
+  StatsCall *stats;
+  int64_t elapsed;
+  int bucket = 0;
+  if (start == 0)
+    return;
+  elapsed = getClockNanoseconds() - start;
+  while (bucket + 1 < STATS_BUCKET_COUNT && (elapsed >> (bucket + 1)) != 0)
+    bucket++;
+  if (thread_stats != NULL)
+  {
+    stats = &thread_stats->calls[call];
+    stats->count++;
+    stats->total += elapsed;
+    stats->max = elapsed > stats->max ? elapsed : stats->max;
+    stats->buckets[bucket]++;
+    return;
+  }
+  if (is_stats_shared)
+    lockMutex(&stats_mutex);
+  stats = &stats_calls[call];
+  stats->count++;
+  stats->total += elapsed;
+  stats->max = elapsed > stats->max ? elapsed : stats->max;
+  stats->buckets[bucket]++;
+  if (is_stats_shared)
+    unlockMutex(&stats_mutex);
+}
+
+// Adds the calls counted by a thread that was joined to the statistics of the request
+void addStatsCopy(const StatsCopy *copy)
+{
+  StatsCall *stats;
+  int call;
+  int bucket;
+  for (call = 0; call < STATS_CALL_COUNT; call++)
+  {
+    stats = &stats_calls[call];
+    stats->count += copy->calls[call].count;
+    stats->total += copy->calls[call].total;
+    stats->max = copy->calls[call].max > stats->max ? copy->calls[call].max : stats->max;
+    for (bucket = 0; bucket < STATS_BUCKET_COUNT; bucket++)
+      stats->buckets[bucket] += copy->calls[call].buckets[bucket];
+  }
+}
+
+// Adds the time since a start of beginStatsCall to a phase, only called from the main thread
+void endStatsPhase(int64_t *phase, int64_t start)
+{
+  if (start != 0)
+    *phase += getClockNanoseconds() - start;
+}
+
+void noteStatsBuffer(size_t size)
+{
+  if (size > stats_peak_buffer)
+    stats_peak_buffer = size;
+}
+
+// The statistics object is assembled in a writer flushed to stderr, each module writes its own section of counters
+void writeStatsBytes(const char *data, size_t length)
+{
+  fwrite(data, 1, length, stderr);
+}
+
+void beginStatsSection(JsonWriter *writer, const char *key)
+{
+  putJsonKey(writer, 0, key);
+  putJsonChar(writer, '{');
+}
+
+void putStatsCounter(JsonWriter *writer, int is_first, const char *key, int64_t value)
+{
+  putJsonKey(writer, is_first, key);
+  putJsonInteger(writer, value);
+}
+
+// Writes the "time", "output" and "calls" sections of the statistics object
+void writeStatsTimings(JsonWriter *writer)
+{
+  StatsCall *stats;
+  int is_first;
+  int c;
+  int b;
+  beginStatsSection(writer, "time");
+  putStatsCounter(writer, 1, "parse_ns", stats_parse_time);
+  putStatsCounter(writer, 0, "enumerate_ns", stats_enumerate_time);
+  putStatsCounter(writer, 0, "total_ns", getClockNanoseconds() - stats_start_time);
+  putJsonChar(writer, '}');
+  beginStatsSection(writer, "output");
+  putStatsCounter(writer, 1, "bytes", stats_output_bytes);
+  putJsonKey(writer, 0, "peak_buffer");
+  putJsonUnsigned(writer, (uint64_t)stats_peak_buffer);
+  putJsonChar(writer, '}');
+  beginStatsSection(writer, "calls");
+  for (c = 0; c < STATS_CALL_COUNT; c++)
+  {
+    stats = &stats_calls[c];
+    putJsonKey(writer, c == 0, stats_call_names[c]);
+    putJsonChar(writer, '{');
+    putStatsCounter(writer, 1, "count", stats->count);
+    putStatsCounter(writer, 0, "total_ns", stats->total);
+    putStatsCounter(writer, 0, "max_ns", stats->max);
+    beginStatsSection(writer, "histogram");
+    // Only the buckets with calls are written, keyed by their upper bound in nanoseconds
+    is_first = 1;
+    for (b = 0; b < STATS_BUCKET_COUNT; b++)
+    {
+      if (stats->buckets[b] == 0)
+        continue;
+      if (!is_first)
+        putJsonBytes(writer, ", ", 2);
+      putJsonChar(writer, '"');
+      putJsonInteger(writer, (int64_t)1 << (b + 1));
+      putJsonBytes(writer, "\": ", 3);
+      putJsonInteger(writer, stats->buckets[b]);
+      is_first = 0;
+    }
+    putJsonBytes(writer, "}}", 2);
+  }
+  putJsonChar(writer, '}');
+}
@@ -0,0 +1,258 @@
+// Aggregate test: compares the tables of --group-by with groups built from the windows listed by the same selection, by
+// executable, pid and class, then measures a grouped listing against a full listing of a generated desktop.
+//
+// The reference lists the handles of the selection, reads the key, visibility, extended style and rectangle of each window
+// from the backend and adds it to its group in the order of the first window of each group. The desktop has more processes
+// than the process cache holds and a few windows whose process cannot be read, which must be grouped under null. Each
+// process must be resolved once, and the filters, pages, --visible-area and --parent must select the same windows as the
+// listing:
+//
+//   gcc -O2 -pthread ./tests/aggregate.c -o aggregate-test
+//   ./aggregate-test
+
+#include "harness.h"
+
+#define TEST_TOP_COUNT 5000
+#define TEST_MISSING_COUNT 7
+#define TEST_SELECTION_COUNT 6
+#define TEST_MEASURE_TOP_COUNT 50000
+#define TEST_MEASURE_COUNT 10
+#define TEST_REFERENCE_SIZE (1 << 20)
+
+typedef struct
+{
+  DWORD pid;
+  char name[MIDDLE_BUFFER_SIZE];
+  int64_t count;
+  int64_t visible;
+  int64_t topmost;
+  int64_t area;
+  int64_t visible_area;
+} TestGroup;
+
+TestGroup *groups = NULL;
+int group_count = 0;
+DWORD *pids = NULL;
+int pid_count = 0;
+char reference[TEST_REFERENCE_SIZE];
+size_t reference_length = 0;
+
+// Appends formatted text to the reference table
+void appendReference(const char *format, ...)
+{
+  va_list arguments;
+  va_start(arguments, format);
+  reference_length += (size_t)vsnprintf(&reference[reference_length], TEST_REFERENCE_SIZE - reference_length, format, arguments);
+  va_end(arguments);
+}
+
+// Returns the group of a window for a key, adding it when it is new
+TestGroup *findGroup(int key, HWND h)
+{
+  char name[MIDDLE_BUFFER_SIZE];
+  DWORD pid = 0;
+  int i;
+  name[0] = '\0';
+  backendGetWindowThreadProcessId(h, &pid);
+  if (key == AGGREGATE_CLASS)
+    backendGetClassName(h, name, MIDDLE_BUFFER_SIZE);
+  else if (key == AGGREGATE_EXECUTABLE && pid > 0 && backendGetProcessExecutable(pid, name, MIDDLE_BUFFER_SIZE) == 0)
+    name[0] = '\0';
+  for (i = 0; i < pid_count && pids[i] != pid; i++)
+  {
+  }
+  if (i == pid_count)
+    pids[pid_count++] = pid;
+  for (i = 0; i < group_count; i++)
+    if (key == AGGREGATE_PID ? groups[i].pid == pid : strcmp(groups[i].name, name) == 0)
+      return &groups[i];
+  memset(&groups[group_count], 0, sizeof(TestGroup));
+  groups[group_count].pid = pid;
+  snprintf(groups[group_count].name, MIDDLE_BUFFER_SIZE, "%s", name);
+  return &groups[group_count++];
+}
+
+// Builds the table of a key from the windows listed by a selection, in the JSON or NDJSON format
+void buildReference(int key, const char **selection, int selection_count, int is_visible_area, int is_ndjson)
+{
+  const char *arguments[HARNESS_ARGUMENT_COUNT];
+  const char *line;
+  const char *position;
+  TestGroup *group;
+  RECT rect;
+  HWND h;
+  int count = 0;
+  int i;
+  arguments[count++] = "--fields";
+  arguments[count++] = "handle";
+  arguments[count++] = "--format";
+  arguments[count++] = "ndjson";
+  if (is_visible_area)
+    arguments[count++] = "--visible-area";
+  for (i = 0; i < selection_count; i++)
+    arguments[count++] = selection[i];
+  for (; count < HARNESS_ARGUMENT_COUNT; count++)
+    arguments[count] = NULL;
+  runHarnessRequest(arguments[0], arguments[1], arguments[2], arguments[3], arguments[4], arguments[5], arguments[6], arguments[7], arguments[8], arguments[9], arguments[10], arguments[11], arguments[12], arguments[13], NULL);
+  group_count = 0;
+  pid_count = 0;
+  for (line = output; strncmp(line, "{\"handle\": ", 11) == 0; line = strchr(line, '\n') + 1)
+  {
+    h = (HWND)(intptr_t)strtoll(line + 11, NULL, 10);
+    group = findGroup(key, h);
+    group->count++;
+    group->visible += backendIsWindowVisible(h) ? 1 : 0;
+    group->topmost += (backendGetWindowLong(h, GWL_EXSTYLE) & WS_EX_TOPMOST) != 0 ? 1 : 0;
+    if (backendGetWindowRect(h, &rect) && rect.right > rect.left && rect.bottom > rect.top)
+      group->area += ((int64_t)rect.right - rect.left) * ((int64_t)rect.bottom - rect.top);
+    if (is_visible_area && (position = strstr(line, "\"visible_area\": ")) != NULL)
+      group->visible_area += strtoll(position + 16, NULL, 10);
+  }
+  reference_length = 0;
+  appendReference("%s", is_ndjson ? "" : "[");
+  for (i = 0; i < group_count; i++)
+  {
+    group = &groups[i];
+    appendReference("%s{", i == 0 || is_ndjson ? "" : ", ");
+    if (key == AGGREGATE_PID)
+      appendReference("\"pid\": %lu", (unsigned long)group->pid);
+    else if (group->name[0] == '\0')
+      appendReference("\"%s\": null", key == AGGREGATE_EXECUTABLE ? "executable" : "classname");
+    else
+    {
+      appendReference("\"%s\": \"", key == AGGREGATE_EXECUTABLE ? "executable" : "classname");
+      // The names of the desktop only need their backslashes escaped
+      for (position = group->name; *position != '\0'; position++)
+        appendReference(*position == '\\' ? "\\\\" : "%c", *position);
+      appendReference("\"");
+    }
+    appendReference(", \"count\": %lld, \"visible\": %lld, \"topmost\": %lld, \"area\": %lld", (long long)group->count, (long long)group->visible, (long long)group->topmost, (long long)group->area);
+    if (is_visible_area)
+      appendReference(", \"visible_area\": %lld", (long long)group->visible_area);
+    appendReference("}%s", is_ndjson ? "\n" : "");
+  }
+  appendReference("%s", is_ndjson ? "" : "]");
+}
+
+// Returns zero when --group-by writes another table than the reference for a selection
+int isTableLikeReference(int key, const char **selection, int selection_count, int is_visible_area, int is_ndjson)
+{
+  const char *keys[4] = {NULL, "pid", "executable", "class"};
+  const char *arguments[HARNESS_ARGUMENT_COUNT];
+  int count = 0;
+  int i;
+  buildReference(key, selection, selection_count, is_visible_area, is_ndjson);
+  arguments[count++] = "--group-by";
+  arguments[count++] = keys[key];
+  arguments[count++] = "--format";
+  arguments[count++] = is_ndjson ? "ndjson" : "json";
+  if (is_visible_area)
+    arguments[count++] = "--visible-area";
+  for (i = 0; i < selection_count; i++)
+    arguments[count++] = selection[i];
+  for (; count < HARNESS_ARGUMENT_COUNT; count++)
+    arguments[count] = NULL;
+  runHarnessRequest(arguments[0], arguments[1], arguments[2], arguments[3], arguments[4], arguments[5], arguments[6], arguments[7], arguments[8], arguments[9], arguments[10], arguments[11], arguments[12], arguments[13], NULL);
+  if (output_length != reference_length || memcmp(output, reference, reference_length) != 0)
+  {
+    printf("--group-by %s writes %.300s\ninstead of %.300s\n", keys[key], output, reference);
+    return 0;
+  }
+  return key != AGGREGATE_EXECUTABLE || aggregate_resolve_count == pid_count;
+}
+
+// Returns the fastest time of a request in milliseconds, and its output size in bytes
+double measureRequest(const char *key, size_t *length)
+{
+  int64_t best = 0;
+  int64_t start;
+  int64_t elapsed;
+  int i;
+  for (i = 0; i < TEST_MEASURE_COUNT; i++)
+  {
+    start = getClockNanoseconds();
+    if (key != NULL)
+      runHarnessRequest("--desktop", "--group-by", key, NULL);
+    else
+      runHarnessRequest("--desktop", NULL);
+    elapsed = getClockNanoseconds() - start;
+    best = best == 0 || elapsed < best ? elapsed : best;
+  }
+  *length = output_length;
+  return best / 1e6;
+}
+
+int main(int argn, char **argv)
+{
+  const char *selections[TEST_SELECTION_COUNT][8] = {
+      {"--desktop"},
+      {"--desktop", "--title", "Document 1"},
+      {"--desktop", "--sort", "area", "--limit", "300", "--offset", "100"},
+      {"--desktop", "--where", "visible && pid < 2500"},
+      {"--desktop", "--class-contains", "Chrome"},
+      {"--parent", NULL},
+  };
+  int selection_counts[TEST_SELECTION_COUNT] = {1, 3, 7, 3, 3, 2};
+  const char *names[4] = {NULL, "pid", "executable", "class"};
+  char parent[32];
+  char text[32];
+  size_t grouped_length;
+  size_t listed_length;
+  double grouped_time;
+  double listed_time;
+  HWND h;
+  int process_count;
+  int failures = 0;
+  int key;
+  int i;
+  snprintf(text, sizeof(text), "%d", TEST_TOP_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", text);
+  initHarness();
+  groups = (TestGroup *)malloc(sizeof(TestGroup) * TEST_TOP_COUNT * 3);
+  pids = (DWORD *)malloc(sizeof(DWORD) * TEST_TOP_COUNT * 3);
+  if (groups == NULL || pids == NULL)
+    return 1;
+  // Windows whose process cannot be read, one of them without a process
+  for (i = 0, h = backendGetFirstChild(NULL); h != NULL && i < TEST_MISSING_COUNT; h = backendGetWindow(h, GW_HWNDNEXT), i++)
+    memory_windows[memoryGetIndex(h)].pid = i == 0 ? 0 : (DWORD)(3 + i * 4);
+  h = backendGetWindow(backendGetFirstChild(NULL), GW_HWNDNEXT);
+  snprintf(parent, sizeof(parent), "%lld", (long long)(intptr_t)backendGetWindow(h, GW_HWNDNEXT));
+  selections[5][1] = parent;
+
+  buildReference(AGGREGATE_PID, selections[0], 1, 0, 0);
+  process_count = pid_count;
+  checkHarness(process_count > PROCESS_CACHE_SIZE * 3 / 4, "the %d processes of the desktop fit in the process cache", process_count);
+  for (key = AGGREGATE_PID; key <= AGGREGATE_CLASS; key++)
+  {
+    for (i = 0; i < TEST_SELECTION_COUNT; i++)
+    {
+      if (!isTableLikeReference(key, selections[i], selection_counts[i], 0, 0))
+      {
+        printf("--group-by %s differs with %s %s\n", names[key], selections[i][0], selection_counts[i] > 1 ? selections[i][1] : "");
+        failures++;
+      }
+    }
+    failures += !isTableLikeReference(key, selections[0], 1, 1, 0);
+    failures += !isTableLikeReference(key, selections[2], selection_counts[2], 1, 1);
+  }
+  checkHarness(failures == 0, "%d tables of --group-by differ from the listed windows", failures);
+  runHarnessRequest("--desktop", "--group-by", "executable", NULL);
+  checkHarness(aggregate_resolve_count == process_count && strstr(output, "{\"executable\": null, \"count\": 7, ") != NULL, "--group-by executable resolves %lld of %d processes and writes %.200s", (long long)aggregate_resolve_count, process_count, output);
+
+  runHarnessRequest("--desktop", "--group-by", "title", NULL);
+  checkHarness(strncmp(output, "Error: Unknown grouping key", 27) == 0, "--group-by title writes %.80s", output);
+  runHarnessRequest("--desktop", "--group-by", "pid", "--timeout", "100", NULL);
+  checkHarness(strncmp(output, "Error: Groups only apply", 24) == 0, "--group-by with --timeout writes %.80s", output);
+  runHarnessRequest("--desktop", "--group-by", "pid", "--format", "binary", NULL);
+  checkHarness(strncmp(output, "Error: Groups only apply", 24) == 0, "--group-by with --format binary writes %.80s", output);
+
+  // Generated desktop of many windows, each of its processes with thousands of windows
+  memoryGenerateDesktop(TEST_MEASURE_TOP_COUNT, 0, 1, 0, 0, 1);
+  grouped_time = measureRequest("executable", &grouped_length);
+  listed_time = measureRequest(NULL, &listed_length);
+  printf("%d windows: --group-by executable in %.2f ms over %d bytes, --desktop in %.2f ms over %d bytes\n", TEST_MEASURE_TOP_COUNT, grouped_time, (int)grouped_length, listed_time, (int)listed_length);
+
+  free(pids);
+  free(groups);
+  return finishHarness("aggregate");
+}
@@ -0,0 +1,338 @@
+// Backend test: checks the invariants that the rest of the program expects from the calls of backend.h, using only those
+// calls, then compares the JSON output with the values the calls return and measures them.
+//
+// The walks of the top-level windows and of their children must reach every window once with the parent it reports, the
+// strings must be cut to the buffer with their length returned, the windows of a thread and the searches by class must be
+// the windows of the z-order with that thread or class in the same order, and handles of no window must fail every call.
+// Every call counts once in backend_call_count. The changes of the last checks are those of the synthetic desktop of the
+// in-memory backend:
+//
+//   gcc -O2 -pthread ./tests/backend.c -o backend-test
+//   ./backend-test
+
+#include "harness.h"
+
+#define TEST_TOP_COUNT 500
+#define TEST_WINDOW_LIMIT 100000
+#define TEST_THREAD_LIMIT 64
+
+HWND *windows;
+HWND *parents;
+int window_count = 0;
+HWND *tops;
+int top_count = 0;
+
+// Returns the value of a number key of an NDJSON line, zero when the line does not have the key
+int64_t findJsonNumber(const char *line, const char *end, const char *key)
+{
+  char pattern[64];
+  const char *position;
+  snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+  position = strstr(line, pattern);
+  if (position == NULL || position > end)
+    return 0;
+  return strtoll(position + strlen(pattern), NULL, 10);
+}
+
+// Orders handles by value for finding those listed twice
+int compareHandles(const void *a, const void *b)
+{
+  intptr_t x = (intptr_t)*(const HWND *)a;
+  intptr_t y = (intptr_t)*(const HWND *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Lists the windows of a walk of siblings and of their descendants, returns zero when a window does not report the parent
+// of its walk or the first child of a window differs between the two calls that return it
+int walkWindows(HWND parent)
+{
+  HWND h;
+  int is_valid = 1;
+  if (backendGetWindow(parent, GW_CHILD) != backendGetFirstChild(parent) && parent != NULL)
+    return 0;
+  for (h = backendGetFirstChild(parent); h != NULL && window_count < TEST_WINDOW_LIMIT; h = backendGetWindow(h, GW_HWNDNEXT))
+  {
+    if (!backendIsWindow(h) || backendGetParent(h) != parent)
+      is_valid = 0;
+    if (parent == NULL)
+      tops[top_count++] = h;
+    parents[window_count] = parent;
+    windows[window_count++] = h;
+    is_valid &= walkWindows(h);
+  }
+  return is_valid;
+}
+
+// Returns zero when a string call does not return the length of its text, or does not cut it to a smaller buffer
+int isStringCut(size_t (*get)(HWND, char *, size_t), HWND h)
+{
+  char text[MIDDLE_BUFFER_SIZE];
+  char cut[8];
+  size_t length = get(h, text, sizeof(text));
+  size_t size;
+  if (length != strlen(text))
+    return 0;
+  for (size = 1; size <= sizeof(cut); size++)
+  {
+    memset(cut, 'x', sizeof(cut));
+    if (get(h, cut, size) != (length < size ? length : size - 1) || strlen(cut) != (length < size ? length : size - 1) || strncmp(cut, text, strlen(cut)) != 0)
+      return 0;
+  }
+  return 1;
+}
+
+// Returns zero when the windows of a thread are not the top-level windows of the thread in z-order
+int isThreadListLikeWalk(DWORD thread)
+{
+  HWND listed[TEST_TOP_COUNT];
+  DWORD pid;
+  int count = backendListThreadWindows(thread, listed, TEST_TOP_COUNT);
+  int j = 0;
+  int i;
+  for (i = 0; i < top_count; i++)
+  {
+    if (backendGetWindowThreadProcessId(tops[i], &pid) != thread)
+      continue;
+    if (j >= count || listed[j] != tops[i])
+      return 0;
+    j++;
+  }
+  return j == count && count > 0;
+}
+
+// Returns zero when a search by class does not return the siblings of that class in z-order, whatever the case of the name
+int isClassSearchLikeWalk(HWND parent, const char *class)
+{
+  char name[MIDDLE_BUFFER_SIZE];
+  HWND found = backendFindWindowByClass(parent, NULL, class);
+  HWND h;
+  for (h = backendGetFirstChild(parent); h != NULL; h = backendGetWindow(h, GW_HWNDNEXT))
+  {
+    backendGetClassName(h, name, sizeof(name));
+    if (!isMatchingString(name, class))
+      continue;
+    if (found != h)
+      return 0;
+    found = backendFindWindowByClass(parent, found, class);
+  }
+  return found == NULL;
+}
+
+// Returns zero when a handle of no window is answered as a window by any call
+int isMissingWindow(HWND h)
+{
+  char text[16] = "x";
+  RECT rect;
+  DWORD pid = 7;
+  return !backendIsWindow(h) && backendGetWindowText(h, text, sizeof(text)) == 0 && text[0] == '\0' && backendGetWindowRect(h, &rect) == 0 && backendGetWindowThreadProcessId(h, &pid) == 0 && backendGetParent(h) == NULL && backendGetWindow(h, GW_HWNDNEXT) == NULL && !backendIsWindowVisible(h);
+}
+
+// Returns zero when a line of the desktop list has other values than the calls for its window
+int isLineLikeCalls(const char *line, const char *end, HWND h)
+{
+  RECT rect = {0, 0, 0, 0};
+  DWORD pid = 0;
+  DWORD thread = backendGetWindowThreadProcessId(h, &pid);
+  int is_visible = backendIsWindowVisible(h);
+  backendGetWindowRect(h, &rect);
+  if (findJsonNumber(line, end, "handle") != (int64_t)(intptr_t)h || findJsonNumber(line, end, "pid") != pid || findJsonNumber(line, end, "thread") != thread)
+    return 0;
+  if (findJsonNumber(line, end, "style") != backendGetWindowLong(h, GWL_STYLE) || findJsonNumber(line, end, "exstyle") != backendGetWindowLong(h, GWL_EXSTYLE))
+    return 0;
+  if ((strstr(line, "\"visible\": true") != NULL && strstr(line, "\"visible\": true") < end) != is_visible)
+    return 0;
+  return (rect.left == 0 && rect.top == 0 && rect.right == 0 && rect.bottom == 0) || (findJsonNumber(line, end, "left") == rect.left && findJsonNumber(line, end, "top") == rect.top && findJsonNumber(line, end, "right") == rect.right && findJsonNumber(line, end, "bottom") == rect.bottom);
+}
+
+int main(int argn, char **argv)
+{
+  char text[MIDDLE_BUFFER_SIZE];
+  DWORD threads[TEST_THREAD_LIMIT];
+  DWORD checked_threads[TEST_TOP_COUNT];
+  RECT rect;
+  RECT moved;
+  HWND *sorted;
+  HWND h;
+  HWND child;
+  DWORD pid;
+  DWORD thread;
+  LONG style;
+  uint8_t *pixels;
+  size_t stride;
+  const char *line;
+  const char *end;
+  int64_t calls;
+  int64_t opens;
+  int64_t start;
+  int64_t elapsed;
+  int checked_thread_count = 0;
+  int failures[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  int width;
+  int height;
+  int count;
+  int i;
+  int j;
+  snprintf(text, sizeof(text), "%d", TEST_TOP_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", text);
+  initHarness();
+  windows = (HWND *)malloc(sizeof(HWND) * TEST_WINDOW_LIMIT);
+  parents = (HWND *)malloc(sizeof(HWND) * TEST_WINDOW_LIMIT);
+  tops = (HWND *)malloc(sizeof(HWND) * TEST_WINDOW_LIMIT);
+  sorted = (HWND *)malloc(sizeof(HWND) * TEST_WINDOW_LIMIT);
+  if (windows == NULL || parents == NULL || tops == NULL || sorted == NULL)
+    return 1;
+
+  checkHarness(walkWindows(NULL), "a window of a walk reports another parent or first child");
+  memcpy(sorted, windows, sizeof(HWND) * (size_t)window_count);
+  qsort(sorted, (size_t)window_count, sizeof(HWND), compareHandles);
+  for (i = 1, count = 0; i < window_count; i++)
+    count += sorted[i] == sorted[i - 1];
+  checkHarness(count == 0 && window_count > 0, "the walks reach %d windows more than once", count);
+#if defined(WINDOW_STATE_SYNTHETIC_DESKTOP)
+  checkHarness(top_count == TEST_TOP_COUNT && window_count == memory_window_count, "the walks reach %d top-level windows and %d windows instead of %d and %d", top_count, window_count, TEST_TOP_COUNT, memory_window_count);
+#endif
+
+  for (i = 0; i < window_count; i++)
+  {
+    h = windows[i];
+    failures[0] += !isStringCut(backendGetWindowText, h) || !isStringCut(backendGetClassName, h) || !isStringCut(backendGetWindowModuleFileName, h);
+    pid = 0;
+    thread = backendGetWindowThreadProcessId(h, &pid);
+    failures[1] += thread == 0 || pid == 0;
+    style = backendGetWindowLong(h, GWL_STYLE);
+    // A window is visible when it and every window above it in the hierarchy have WS_VISIBLE
+    failures[2] += backendIsWindowVisible(h) != ((style & WS_VISIBLE) != 0 && (parents[i] == NULL || backendIsWindowVisible(parents[i])));
+    failures[2] += ((style & WS_CHILD) != 0) != (parents[i] != NULL);
+    failures[3] += !backendGetWindowRect(h, &rect) || rect.right < rect.left || rect.bottom < rect.top;
+    if (parents[i] != NULL)
+      continue;
+    // The threads of the process of a top-level window include the thread of the window, whose windows are listed in z-order
+    count = backendListProcessThreads(pid, threads, TEST_THREAD_LIMIT);
+    for (j = 0; j < count && threads[j] != thread; j++)
+    {
+    }
+    failures[4] += j == count;
+    for (j = 0; j < checked_thread_count && checked_threads[j] != thread; j++)
+    {
+    }
+    if (j == checked_thread_count)
+    {
+      checked_threads[checked_thread_count++] = thread;
+      failures[4] += !isThreadListLikeWalk(thread);
+    }
+    // Opening the process of a window stands for one open
+    opens = readCounter(&backend_process_open_count);
+    failures[5] += backendGetProcessExecutable(pid, text, sizeof(text)) == 0 || readCounter(&backend_process_open_count) != opens + 1;
+    if ((style & WS_VISIBLE) != 0 && (style & WS_MINIMIZE) == 0 && rect.right > rect.left && rect.bottom > rect.top)
+    {
+      pixels = backendCaptureWindow(h, &width, &height, &stride);
+      failures[6] += pixels == NULL || width != rect.right - rect.left || height != rect.bottom - rect.top || stride < (size_t)width * 4;
+    }
+  }
+  checkHarness(failures[0] == 0, "%d windows return strings longer than their length or not cut to a small buffer", failures[0]);
+  checkHarness(failures[1] == 0, "%d windows have no pid or thread", failures[1]);
+  checkHarness(failures[2] == 0, "%d windows are visible or children against their styles", failures[2]);
+  checkHarness(failures[3] == 0, "%d windows have no rectangle", failures[3]);
+  checkHarness(failures[4] == 0, "%d threads are not listed with their process or list other windows than the walk (%d threads)", failures[4], checked_thread_count);
+  checkHarness(failures[5] == 0, "%d processes have no executable or are not counted once", failures[5]);
+  checkHarness(failures[6] == 0, "%d visible windows are captured with another size than their rectangle", failures[6]);
+
+  // Searches by class, among the top-level windows and the children of a window, in the case of the names or another
+  for (i = 0; i < 20; i++)
+  {
+    backendGetClassName(tops[i * 7 % top_count], text, sizeof(text));
+    checkHarness(isClassSearchLikeWalk(NULL, text), "the search of class %s differs from the walk", text);
+    for (j = 0; text[j] != '\0'; j++)
+      text[j] = (char)(text[j] >= 'a' && text[j] <= 'z' ? text[j] - 32 : text[j]);
+    checkHarness(isClassSearchLikeWalk(NULL, text), "the search of class %s differs from the walk", text);
+    child = backendGetFirstChild(tops[i]);
+    if (child != NULL)
+    {
+      backendGetClassName(child, text, sizeof(text));
+      checkHarness(isClassSearchLikeWalk(tops[i], text), "the search of class %s among children differs from the walk", text);
+    }
+  }
+  checkHarness(backendFindWindowByClass(NULL, NULL, "No Such Class") == NULL, "a class of no window is found");
+
+  for (i = 0; i < 4; i++)
+  {
+    h = i == 0 ? NULL : i == 1 ? (HWND)((intptr_t)tops[0] + 1) : i == 2 ? (HWND)(intptr_t)0x7FFFFFF0 : (HWND)(intptr_t)999;
+    checkHarness(isMissingWindow(h), "the handle %lld of no window is answered as a window", (long long)(intptr_t)h);
+  }
+  checkHarness(backendListThreadWindows(1, (HWND *)threads, 1) == 0 && backendListProcessThreads(1, threads, TEST_THREAD_LIMIT) == 0, "a thread or process of no window has windows or threads");
+
+  // Each call counts once, which the statistics and the field tests rely on
+  calls = readCounter(&backend_call_count);
+  backendIsWindow(tops[0]);
+  backendGetWindowText(tops[0], text, sizeof(text));
+  backendGetWindowThreadProcessId(tops[0], &pid);
+  backendGetWindowRect(tops[0], &rect);
+  backendGetWindow(tops[0], GW_HWNDNEXT);
+  checkHarness(readCounter(&backend_call_count) == calls + 5, "5 calls count %lld", (long long)(readCounter(&backend_call_count) - calls));
+
+  // The output has the values of the calls
+  runHarnessRequest("--desktop", "--fields", "handle,pid,thread,style,exstyle,visible,rect", "--format", "ndjson", NULL);
+  for (i = 0, line = output, count = 0; i < top_count && line != NULL && *line == '{'; i++, line = end + 1)
+  {
+    end = strchr(line, '\n');
+    if (end == NULL)
+      break;
+    count += !isLineLikeCalls(line, end, tops[i]);
+  }
+  checkHarness(i == top_count && count == 0, "%d of %d lines of the desktop differ from the calls", count + top_count - i, top_count);
+
+#if defined(WINDOW_STATE_SYNTHETIC_DESKTOP)
+  // Changes of the synthetic desktop are seen by the calls
+  h = tops[top_count / 2];
+  snprintf(text, sizeof(text), "focus %lld", (long long)(intptr_t)h);
+  memoryApplyCommand(text);
+  checkHarness(backendGetForegroundWindow() == h && backendGetFirstChild(NULL) == h, "the focused window is not the foreground window on top");
+  backendGetWindowRect(h, &rect);
+  checkHarness(backendSetWindowPos(h, HWND_BOTTOM, 10, 20, 300, 200, SWP_NOACTIVATE) && backendGetWindowRect(h, &moved) && moved.left == 10 && moved.top == 20 && moved.right == 310 && moved.bottom == 220, "a moved window has the rectangle %ld %ld %ld %ld", (long)moved.left, (long)moved.top, (long)moved.right, (long)moved.bottom);
+  for (child = backendGetFirstChild(NULL); child != NULL && backendGetWindow(child, GW_HWNDNEXT) != NULL; child = backendGetWindow(child, GW_HWNDNEXT))
+  {
+  }
+  checkHarness(child == h, "a window moved to the bottom is not the last of the walk");
+  child = backendGetFirstChild(h);
+  backendShowWindow(h, SW_SHOW);
+  backendShowWindow(h, SW_HIDE);
+  checkHarness(!backendIsWindowVisible(h) && child != NULL && !backendIsWindowVisible(child), "the child of a hidden window is visible");
+  snprintf(text, sizeof(text), "destroy %lld", (long long)(intptr_t)h);
+  memoryApplyCommand(text);
+  checkHarness(isMissingWindow(h) && isMissingWindow(child), "a destroyed window or its child is still a window");
+  window_count = 0;
+  top_count = 0;
+  walkWindows(NULL);
+  for (i = 0, count = 0; i < window_count; i++)
+    count += windows[i] == h || windows[i] == child;
+  checkHarness(count == 0 && top_count == TEST_TOP_COUNT - 1, "the walks reach a destroyed window");
+#endif
+
+  // The calls of a walk and of the attributes of each window
+  start = getClockNanoseconds();
+  calls = readCounter(&backend_call_count);
+  window_count = 0;
+  top_count = 0;
+  walkWindows(NULL);
+  elapsed = getClockNanoseconds() - start;
+  calls = readCounter(&backend_call_count) - calls;
+  printf("%s backend, %d windows: walk of %lld calls in %.1f ns per call", WINDOW_STATE_BACKEND_NAME, window_count, (long long)calls, (double)elapsed / calls);
+  start = getClockNanoseconds();
+  calls = readCounter(&backend_call_count);
+  for (i = 0; i < window_count; i++)
+  {
+    backendGetWindowText(windows[i], text, sizeof(text));
+    backendGetWindowThreadProcessId(windows[i], &pid);
+    backendGetWindowLong(windows[i], GWL_STYLE);
+    backendGetWindowRect(windows[i], &rect);
+  }
+  elapsed = getClockNanoseconds() - start;
+  calls = readCounter(&backend_call_count) - calls;
+  printf(", title, pid, style and rectangle in %.1f ns per call\n", (double)elapsed / calls);
+
+  free(sorted);
+  free(windows);
+  free(parents);
+  free(tops);
+  return finishHarness("backend");
+}
@@ -0,0 +1,257 @@
+// Benchmark test: runs --benchmark in child processes, since benchmarks are not available to served requests, and checks
+// its results, the baseline file it saves and the regressions it finds against baselines of known values.
+//
+// Each case must report the size of its desktop and six positive phases, and its bytes must be the size of the --desktop
+// list of the same generated desktop. The saved baseline must hold the reported values. The baseline is then changed and
+// compared with a tolerance of 500%: the phases of a case a hundred times faster than measured and a phase ten times faster
+// must regress and the program must exit with 3, while a phase three times faster and the slower phases must not:
+//
+//   gcc -O2 -pthread ./tests/benchmark.c -o benchmark-test
+//   ./benchmark-test
+
+#include "harness.h"
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define TEST_CASE_COUNT 16
+#define TEST_SIZE_COUNT 4
+
+char baseline_file[64];
+char changed_file[64];
+char output_file[64];
+char *results = NULL;
+size_t result_length = 0;
+
+// Runs the arguments that follow until a NULL one in a child process as a new execution, leaves its output in results and
+// returns its exit code
+int runBenchmarkChild(const char *argument, ...)
+{
+  char *arguments[HARNESS_ARGUMENT_COUNT + 2];
+  FILE *file;
+  va_list list;
+  pid_t child;
+  long size;
+  int count = 0;
+  int status = 0;
+  int descriptor;
+  arguments[count++] = (char *)"window-state";
+  va_start(list, argument);
+  for (; argument != NULL && count <= HARNESS_ARGUMENT_COUNT; argument = va_arg(list, const char *))
+    arguments[count++] = (char *)argument;
+  va_end(list);
+  arguments[count] = NULL;
+  fflush(stdout);
+  child = fork();
+  if (child == 0)
+  {
+    descriptor = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    dup2(descriptor, 1);
+    close(descriptor);
+    // The options of the requests run before the child are forgotten as in a new process
+    resetState();
+    status = runWindowState(count, arguments);
+    fflush(stdout);
+    _exit(status);
+  }
+  waitpid(child, &status, 0);
+  free(results);
+  results = NULL;
+  result_length = 0;
+  file = fopen(output_file, "rb");
+  if (file != NULL)
+  {
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    results = (char *)malloc((size_t)size + 1);
+    result_length = results != NULL ? fread(results, 1, (size_t)size, file) : 0;
+    fclose(file);
+  }
+  if (results == NULL)
+    results = (char *)calloc(1, 1);
+  else
+    results[result_length] = '\0';
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Returns the result object of a case, or NULL
+const char *findCase(const char *name)
+{
+  char pattern[64];
+  snprintf(pattern, sizeof(pattern), "{\"case\": \"%s\", ", name);
+  return strstr(results, pattern);
+}
+
+// Returns the number of a key of a case result, or -1
+double readCaseNumber(const char *name, const char *key)
+{
+  char pattern[64];
+  const char *result = findCase(name);
+  const char *end = result != NULL ? strchr(result, '}') : NULL;
+  const char *position;
+  snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+  position = result != NULL ? strstr(result, pattern) : NULL;
+  return position == NULL || position > end ? -1 : strtod(position + strlen(pattern), NULL);
+}
+
+// Returns the list of regressions of a case, or NULL, the list ends at its closing bracket
+const char *findRegressions(const char *name)
+{
+  const char *result = findCase(name);
+  const char *position = result != NULL ? strstr(result, "\"regressions\": [") : NULL;
+  return position == NULL || position > strchr(result, '}') ? NULL : position + 16;
+}
+
+// Returns the factor of the baseline of a phase: every phase of a case a hundred times faster than measured, a phase ten
+// times faster, a phase three times faster, which the tolerance of the test allows, and the other phases a hundred times
+// slower
+double getBaselineFactor(const char *name, const char *phase)
+{
+  if (strcmp(name, "500-short-many") == 0)
+    return 0.01;
+  if (strcmp(name, "5000-long-many") == 0 && strcmp(phase, "serialize") == 0)
+    return 0.1;
+  if (strcmp(name, "50-short-few") == 0 && strcmp(phase, "fetch") == 0)
+    return 0.3;
+  return 100;
+}
+
+// Writes the baseline file again with the values of its phases multiplied by their factor
+int writeChangedBaseline()
+{
+  FILE *source = fopen(baseline_file, "rb");
+  FILE *target = fopen(changed_file, "wb");
+  char line[256];
+  char name[64];
+  char phase[64];
+  double nanoseconds;
+  if (source == NULL || target == NULL)
+    return 0;
+  while (fgets(line, sizeof(line), source) != NULL)
+  {
+    if (sscanf(line, "%63s %63s %lf", name, phase, &nanoseconds) != 3)
+      fputs(line, target);
+    else
+      fprintf(target, "%s %s %.4f\n", name, phase, nanoseconds * getBaselineFactor(name, phase));
+  }
+  fclose(source);
+  fclose(target);
+  return 1;
+}
+
+int main(int argn, char **argv)
+{
+  const char *title_names[2] = {"short", "long"};
+  const char *process_names[2] = {"few", "many"};
+  char names[TEST_CASE_COUNT][32];
+  char line[256];
+  char phase[64];
+  char case_name[64];
+  double nanoseconds;
+  double value;
+  const char *regressions;
+  FILE *file;
+  int64_t start;
+  double elapsed;
+  int case_count = 0;
+  int line_count = 0;
+  int failures = 0;
+  int code;
+  int s;
+  int t;
+  int p;
+  initHarness();
+  snprintf(baseline_file, sizeof(baseline_file), "/tmp/window-state-benchmark-test-%d.txt", (int)getpid());
+  snprintf(changed_file, sizeof(changed_file), "/tmp/window-state-benchmark-test-%d-changed.txt", (int)getpid());
+  snprintf(output_file, sizeof(output_file), "/tmp/window-state-benchmark-test-%d.json", (int)getpid());
+  for (s = 0; s < TEST_SIZE_COUNT; s++)
+    for (t = 0; t < 2; t++)
+      for (p = 0; p < 2; p++)
+        snprintf(names[case_count++], sizeof(names[0]), "%d-%s-%s", benchmark_sizes[s], title_names[t], process_names[p]);
+
+  start = getClockNanoseconds();
+  code = runBenchmarkChild("--benchmark", "--save-baseline", baseline_file, NULL);
+  elapsed = (getClockNanoseconds() - start) / 1e6;
+  checkHarness(code == 0 && results[0] == '[' && results[result_length - 1] == ']' && strstr(results, "regressions") == NULL, "--benchmark exits with %d and writes %.200s", code, results);
+  // The cases in order, each with its desktop and its phases
+  for (s = 0, failures = 0; s < TEST_CASE_COUNT; s++)
+  {
+    failures += findCase(names[s]) == NULL || (s > 0 && findCase(names[s]) < findCase(names[s - 1]));
+    failures += readCaseNumber(names[s], "windows") != benchmark_sizes[s / 4] || readCaseNumber(names[s], "title_length") != benchmark_title_lengths[s / 2 % 2] || readCaseNumber(names[s], "processes") != (s % 2 == 0 ? 4 : benchmark_sizes[s / 4]);
+    for (p = 0; p < BENCHMARK_PHASE_COUNT; p++)
+      failures += readCaseNumber(names[s], benchmark_phase_names[p]) <= 0;
+  }
+  checkHarness(failures == 0, "%d values of the cases of --benchmark are missing or unlike their desktop", failures);
+  // The bytes of the cases of the three smaller sizes are those of the --desktop list of the same desktop
+  for (s = 0, failures = 0; s < TEST_CASE_COUNT - 4; s++)
+  {
+    memoryGenerateDesktop(benchmark_sizes[s / 4], 0, 0, s % 2 == 0 ? 4 : benchmark_sizes[s / 4], benchmark_title_lengths[s / 2 % 2], 1);
+    runHarnessRequest("--desktop", NULL);
+    if (readCaseNumber(names[s], "bytes") != (double)output_length)
+    {
+      printf("%s serializes %.0f bytes, --desktop writes %d\n", names[s], readCaseNumber(names[s], "bytes"), (int)output_length);
+      failures++;
+    }
+  }
+  checkHarness(failures == 0, "%d cases of --benchmark serialize another list than --desktop", failures);
+  // The saved baseline holds the reported values
+  file = fopen(baseline_file, "rb");
+  for (failures = 0; file != NULL && fgets(line, sizeof(line), file) != NULL;)
+  {
+    if (line[0] == '#')
+      continue;
+    line_count++;
+    snprintf(phase, sizeof(phase), "%s", "");
+    if (sscanf(line, "%63s %63s %lf", case_name, phase, &nanoseconds) != 3)
+    {
+      failures++;
+      continue;
+    }
+    value = readCaseNumber(case_name, phase);
+    failures += value < 0 || fabs(value - nanoseconds) > 0.005;
+  }
+  if (file != NULL)
+    fclose(file);
+  checkHarness(file != NULL && failures == 0 && line_count == TEST_CASE_COUNT * BENCHMARK_PHASE_COUNT, "the baseline has %d lines, %d unlike the results", line_count, failures);
+  printf("benchmark: %d cases in %.0f ms", TEST_CASE_COUNT, elapsed);
+
+  // Regressions of the changed baseline with a tolerance of 500%
+  if (!writeChangedBaseline())
+    return 1;
+  code = runBenchmarkChild("--benchmark", "--baseline", changed_file, "--tolerance", "500", NULL);
+  for (s = 0, failures = 0; s < TEST_CASE_COUNT; s++)
+  {
+    regressions = findRegressions(names[s]);
+    if (regressions == NULL)
+      failures++;
+    else if (strcmp(names[s], "500-short-many") == 0)
+      failures += strncmp(regressions, "\"enumerate\", \"fetch\", \"serialize\", \"index\", \"query\", \"occlusion\"]", 65) != 0;
+    else if (strcmp(names[s], "5000-long-many") == 0)
+      failures += strncmp(regressions, "\"serialize\"]", 12) != 0;
+    else
+      failures += regressions[0] != ']';
+  }
+  checkHarness(code == 3 && failures == 0 && strstr(results, "\nError: 7 benchmark phases are slower than the baseline by more than 500%\n") != NULL, "--baseline exits with %d and finds other regressions in %d cases", code, failures);
+  printf(", 2 runs in %.0f ms\n", (getClockNanoseconds() - start) / 1e6);
+
+  // Baselines that cannot be read are reported before measuring
+  file = fopen(changed_file, "wb");
+  if (file == NULL)
+    return 1;
+  fprintf(file, "# <case> <phase> <nanoseconds per window>\n50-short-few speed 3.0\n");
+  fclose(file);
+  code = runBenchmarkChild("--benchmark", "--baseline", changed_file, NULL);
+  checkHarness(code == 1 && strncmp(results, "Error: Invalid baseline entry at line 2 of", 42) == 0, "a baseline of an unknown phase exits with %d and writes %.80s", code, results);
+  remove(changed_file);
+  code = runBenchmarkChild("--benchmark", "--baseline", changed_file, NULL);
+  checkHarness(code == 1 && strncmp(results, "Error: Could not open baseline file", 35) == 0, "a missing baseline exits with %d and writes %.80s", code, results);
+  runHarnessRequest("--benchmark", NULL);
+  checkHarness(strncmp(output, "Error: Benchmark mode is not available in serve mode", 52) == 0, "--benchmark in serve mode writes %.80s", output);
+
+  remove(baseline_file);
+  remove(output_file);
+  free(results);
+  return finishHarness("benchmark");
+}
@@ -0,0 +1,350 @@
+// Binary format test: decodes the frames written by --format binary into JSON lines with the rules of the decoders of the
+// interfaces, and compares them with the NDJSON output of the same windows and fields, then measures both formats.
+//
+// Titles are renamed with quotes, backslashes, control characters and UTF-8 text so that the strings of the frames are
+// compared with their escaped JSON form. When python3 is available, the decoder of window-state.py is also compared with
+// the NDJSON output:
+//
+//   gcc -O2 -pthread ./tests/binary.c -o binary-test
+//   ./binary-test
+
+#include "harness.h"
+
+#define TEST_WINDOW_COUNT 10000
+
+const char *field_lists[] = {"all", "handle", "handle,title", "title,pid,rect", "flags", "visible,visible_alt", "module,executable,classname", "parent,sibling,child,thread,style,exstyle,unicode"};
+
+const char *test_titles[] = {"Quote \" and backslash \\", "Tab\tand bell\a", "Caf\xC3\xA9 \xE6\x97\xA5\xE6\x9C\xAC \xF0\x9F\x93\x81", "</script>", ""};
+
+char *binary = NULL;
+size_t binary_length = 0;
+JsonWriter decoded_writer;
+int is_decoded_first;
+char *decoded = NULL;
+size_t decoded_length = 0;
+size_t decoded_size = 0;
+// Keeps the results of the measured decoders so that they are not optimized out
+volatile int64_t measure_sink;
+
+void emitDecodedBytes(const char *bytes, size_t length)
+{
+  if (decoded_length + length + 1 > decoded_size)
+  {
+    decoded_size = (decoded_length + length + 1) * 2;
+    decoded = (char *)realloc(decoded, decoded_size);
+  }
+  memcpy(decoded + decoded_length, bytes, length);
+  decoded_length += length;
+  decoded[decoded_length] = '\0';
+}
+
+uint32_t readUint32(const char *bytes)
+{
+  uint32_t value;
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+void putDecodedKey(const char *key)
+{
+  putJsonKey(&decoded_writer, is_decoded_first, key);
+  is_decoded_first = 0;
+}
+
+// Writes the frames of a binary output as JSON lines with the keys that the decoders of the interfaces rebuild from the
+// fields of each record, returns the number of frames or -1 when the stream is not framed as the readme describes
+int decodeFrames(const char *data, size_t length)
+{
+  const char *string_keys[] = {"title", "module", "executable", "classname"};
+  const int string_fields[] = {FIELD_TITLE, FIELD_MODULE, FIELD_EXECUTABLE, FIELD_CLASSNAME};
+  const char *flag_keys[] = {"popup", "contained", "bordered", "scrollable", "minimized", "topmost", "transparent"};
+  const int flag_fields[] = {FIELD_POPUP, FIELD_CONTAINED, FIELD_BORDERED, FIELD_SCROLLABLE, FIELD_MINIMIZED, FIELD_TOPMOST, FIELD_TRANSPARENT};
+  WindowRecord record;
+  uint32_t offsets[4];
+  uint32_t lengths[4];
+  uint32_t record_size;
+  uint32_t frame_length;
+  const char *strings;
+  size_t i = 16;
+  int count = 0;
+  int k;
+  decoded_length = 0;
+  if (length < 16 || memcmp(data, RECORD_STREAM_MAGIC, 8) != 0 || readUint32(data + 8) != RECORD_STREAM_VERSION)
+    return -1;
+  record_size = readUint32(data + 12);
+  if (record_size != sizeof(WindowRecord))
+    return -1;
+  initJsonWriter(&decoded_writer, NULL, 0, emitDecodedBytes);
+  while (i + 4 <= length)
+  {
+    frame_length = readUint32(data + i);
+    if (frame_length < record_size || i + 4 + frame_length > length)
+      return -1;
+    memcpy(&record, data + i + 4, sizeof(record));
+    strings = data + i + 4 + record_size;
+    offsets[0] = record.title_offset;
+    offsets[1] = record.module_offset;
+    offsets[2] = record.executable_offset;
+    offsets[3] = record.classname_offset;
+    lengths[0] = record.title_length;
+    lengths[1] = record.module_length;
+    lengths[2] = record.executable_length;
+    lengths[3] = record.classname_length;
+    putJsonChar(&decoded_writer, '{');
+    is_decoded_first = 1;
+    if (record.fields & FIELD_HANDLE)
+    {
+      putDecodedKey("handle");
+      putJsonInteger(&decoded_writer, record.handle);
+    }
+    for (k = 0; k < 4; k++)
+    {
+      if ((record.fields & string_fields[k]) == 0 || lengths[k] == 0)
+        continue;
+      if ((size_t)offsets[k] + lengths[k] > frame_length - record_size)
+        return -1;
+      putDecodedKey(string_keys[k]);
+      putJsonString(&decoded_writer, strings + offsets[k], lengths[k]);
+    }
+    if (record.fields & FIELD_PARENT)
+    {
+      putDecodedKey("parent");
+      putJsonInteger(&decoded_writer, record.parent);
+    }
+    if ((record.fields & FIELD_SIBLING) && record.sibling != 0)
+    {
+      putDecodedKey("sibling");
+      putJsonInteger(&decoded_writer, record.sibling);
+    }
+    if ((record.fields & FIELD_CHILD) && record.child != 0)
+    {
+      putDecodedKey("child");
+      putJsonInteger(&decoded_writer, record.child);
+    }
+    if (record.fields & FIELD_PID)
+    {
+      putDecodedKey("pid");
+      putJsonInteger(&decoded_writer, record.pid);
+    }
+    if (record.fields & FIELD_THREAD)
+    {
+      putDecodedKey("thread");
+      putJsonInteger(&decoded_writer, record.thread);
+    }
+    if (record.fields & FIELD_STYLE)
+    {
+      putDecodedKey("style");
+      putJsonInteger(&decoded_writer, record.style);
+    }
+    if (record.fields & FIELD_EXSTYLE)
+    {
+      putDecodedKey("exstyle");
+      putJsonInteger(&decoded_writer, record.exstyle);
+    }
+    if (record.fields & FIELD_VISIBLE)
+    {
+      putDecodedKey("visible");
+      putJsonBoolean(&decoded_writer, (record.flags & FIELD_VISIBLE) != 0);
+    }
+    if (record.fields & FIELD_UNICODE)
+    {
+      putDecodedKey("unicode");
+      putJsonBoolean(&decoded_writer, (record.flags & FIELD_UNICODE) != 0);
+    }
+    for (k = 0; k < 7; k++)
+    {
+      if (k == 4 && (record.fields & FIELD_VISIBLE_ALT) && ((record.flags & FIELD_VISIBLE_ALT) != 0) != ((record.flags & FIELD_VISIBLE) != 0))
+      {
+        putDecodedKey("visible_alt");
+        putJsonBoolean(&decoded_writer, 1);
+      }
+      if (record.fields & record.flags & flag_fields[k])
+      {
+        putDecodedKey(flag_keys[k]);
+        putJsonBoolean(&decoded_writer, 1);
+      }
+    }
+    if ((record.fields & FIELD_RECT) && (record.top != 0 || record.right != 0 || record.bottom != 0 || record.left != 0))
+    {
+      putDecodedKey("top");
+      putJsonInteger(&decoded_writer, record.top);
+      putDecodedKey("right");
+      putJsonInteger(&decoded_writer, record.right);
+      putDecodedKey("bottom");
+      putJsonInteger(&decoded_writer, record.bottom);
+      putDecodedKey("left");
+      putJsonInteger(&decoded_writer, record.left);
+    }
+    putJsonBytes(&decoded_writer, "}\n", 2);
+    i += 4 + frame_length;
+    count++;
+  }
+  flushJsonWriter(&decoded_writer);
+  freeJsonWriter(&decoded_writer);
+  return i == length ? count : -1;
+}
+
+// Keeps a copy of the binary output of a request
+void readBinary(const char *fields)
+{
+  runHarnessRequest("--desktop", "--fields", fields, "--format", "binary", NULL);
+  binary = (char *)realloc(binary, output_length + 1);
+  memcpy(binary, output, output_length);
+  binary_length = output_length;
+}
+
+// Writes a file of the binary output and a file of the NDJSON output of every field, and returns the number of windows that
+// the decoder of window-state.py decodes differently from the NDJSON lines, -1 when the comparison did not run
+int countPythonDifferences(const char *binary_path, const char *ndjson_path)
+{
+  char command[1024];
+  FILE *file;
+  int count = -1;
+  readBinary("all");
+  file = fopen(binary_path, "wb");
+  fwrite(binary, 1, binary_length, file);
+  fclose(file);
+  runHarnessRequest("--desktop", "--format", "ndjson", NULL);
+  file = fopen(ndjson_path, "wb");
+  fwrite(output, 1, output_length, file);
+  fclose(file);
+  snprintf(command, sizeof(command),
+           "python3 -c \"import json\n"
+           "module = {}\n"
+           "exec(open('interfaces/window-state.py', encoding='utf-8').read().replace('asyncio.run(example())', ''), module)\n"
+           "decoded = module['decode_window_state_records'](open('%s', 'rb').read())\n"
+           "lines = [json.loads(line) for line in open('%s', encoding='utf-8')]\n"
+           "print(abs(len(decoded) - len(lines)) + sum(a != b for a, b in zip(decoded, lines)))\" 2>/dev/null",
+           binary_path, ndjson_path);
+  file = popen(command, "r");
+  if (file == NULL)
+    return -1;
+  if (fscanf(file, "%d", &count) != 1)
+    count = -1;
+  pclose(file);
+  return count;
+}
+
+// Reads the records of the frames of a binary output and the strings they reference, returns the number of string bytes
+int64_t scanFrames(const char *data, size_t length)
+{
+  WindowRecord record;
+  int64_t total = 0;
+  size_t i;
+  for (i = 16; i + 4 + sizeof(WindowRecord) <= length; i += 4 + readUint32(data + i))
+  {
+    memcpy(&record, data + i + 4, sizeof(record));
+    total += record.title_length + record.module_length + record.executable_length + record.classname_length;
+  }
+  return total;
+}
+
+// Reads the values of the JSON lines of a list, unescaping their strings, which a JSON parser does at least, returns the
+// number of values
+int64_t scanJsonLines(const char *text)
+{
+  char string[MIDDLE_BUFFER_SIZE];
+  const char *position = text;
+  int64_t count = 0;
+  size_t length;
+  for (position = strstr(position, "\": "); position != NULL; position = strstr(position, "\": "))
+  {
+    position += 3;
+    count++;
+    if (*position != '"')
+    {
+      strtoll(position, NULL, 10);
+      continue;
+    }
+    for (position++, length = 0; *position != '"' && length + 1 < sizeof(string); position++)
+    {
+      if (*position == '\\' && position[1] == 'u')
+      {
+        string[length++] = (char)strtol(position + 2, NULL, 16);
+        position += 5;
+      }
+      else if (*position == '\\')
+        string[length++] = *++position;
+      else
+        string[length++] = *position;
+    }
+    string[length] = '\0';
+  }
+  return count;
+}
+
+// Returns the fastest time of writing every window in a format and decoding it, in milliseconds
+double measureFormat(const char *format, int is_decoded)
+{
+  int64_t best = 0;
+  int64_t start;
+  int64_t elapsed;
+  int i;
+  for (i = 0; i < 5; i++)
+  {
+    start = getClockNanoseconds();
+    runHarnessRequest("--desktop", "--format", format, NULL);
+    if (is_decoded && strcmp(format, "binary") == 0)
+      measure_sink = scanFrames(output, output_length);
+    else if (is_decoded)
+      measure_sink = scanJsonLines(output);
+    elapsed = getClockNanoseconds() - start;
+    best = best == 0 || elapsed < best ? elapsed : best;
+  }
+  return best / 1e6;
+}
+
+int main(int argn, char **argv)
+{
+  char binary_path[] = "/tmp/window-state-binary-XXXXXX";
+  char ndjson_path[] = "/tmp/window-state-ndjson-XXXXXX";
+  char command[256];
+  char count_text[32];
+  size_t json_length;
+  int count;
+  int i;
+  int binary_descriptor = mkstemp(binary_path);
+  int ndjson_descriptor = mkstemp(ndjson_path);
+  if (binary_descriptor < 0 || ndjson_descriptor < 0)
+    return 1;
+  close(binary_descriptor);
+  close(ndjson_descriptor);
+  snprintf(count_text, sizeof(count_text), "%d", TEST_WINDOW_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", count_text);
+  initHarness();
+  for (i = 0; i < (int)(sizeof(test_titles) / sizeof(test_titles[0])); i++)
+  {
+    snprintf(command, sizeof(command), "title %lld %s", (long long)memoryGetHandle(3 * (i + 1)), test_titles[i]);
+    memoryApplyCommand(command);
+  }
+
+  for (i = 0; i < (int)(sizeof(field_lists) / sizeof(field_lists[0])); i++)
+  {
+    readBinary(field_lists[i]);
+    count = decodeFrames(binary, binary_length);
+    runHarnessRequest("--desktop", "--fields", field_lists[i], "--format", "ndjson", NULL);
+    if (!checkHarness(count == TEST_WINDOW_COUNT, "--fields %s wrote %d frames instead of %d", field_lists[i], count, TEST_WINDOW_COUNT))
+      continue;
+    checkHarness(decoded_length == output_length && strcmp(decoded, output) == 0, "the frames of --fields %s decode to other lines than NDJSON", field_lists[i]);
+  }
+  runHarnessRequest("--pid", "999", "--format", "binary", NULL);
+  checkHarness(decodeFrames(output, output_length) == 0 && output_length == 16, "an empty selection is not written as a header alone");
+  runHarnessRequest("--handle", "65552", "--format", "binary", NULL);
+  checkHarness(decodeFrames(output, output_length) == 1, "a handle is not written as one frame");
+  count = countPythonDifferences(binary_path, ndjson_path);
+  if (count >= 0)
+    checkHarness(count == 0, "window-state.py decodes %d windows differently from NDJSON", count);
+  else
+    printf("python3 is not available, the decoder of window-state.py is not compared\n");
+
+  readBinary("all");
+  runHarnessRequest("--desktop", "--format", "json", NULL);
+  json_length = output_length;
+  printf("windows: %d, binary: %zu bytes, JSON: %zu bytes\n", TEST_WINDOW_COUNT, binary_length, json_length);
+  printf("binary: %.1f ms, with decoding %.1f ms, JSON: %.1f ms, with a scan of each line %.1f ms\n", measureFormat("binary", 0), measureFormat("binary", 1), measureFormat("json", 0), measureFormat("ndjson", 1));
+  remove(binary_path);
+  remove(ndjson_path);
+  free(binary);
+  free(decoded);
+  return finishHarness("binary");
+}
@@ -0,0 +1,625 @@
+// Capture test: decodes the PNG and raw files written by the capture encoder and compares their pixels with the pixels they
+// were encoded from, then measures the encoding of large captures of a window of text, a flat window and random pixels.
+//
+// The test has its own inflate, for stored, fixed and dynamic blocks, and checks the signature, the chunk order and CRCs,
+// the zlib header and Adler-32 and the five PNG filters, so the files are checked as another decoder would read them. The
+// buffers have widths around the 16 and 32 bytes of the SIMD paths, rows with padding, runs longer than a match and pixels
+// without runs, and captures of more than one IDAT chunk. --capture must write the files of the listed windows, list the
+// windows that cannot be captured with an error and exit with 1. The SSSE3 and AVX2 paths are checked when the test is
+// built with -mssse3 or -mavx2:
+//
+//   gcc -O2 -pthread ./tests/capture.c -o capture-test
+//   ./capture-test
+
+#include "harness.h"
+
+#define TEST_WIDTH_COUNT 18
+#define TEST_HEIGHT_COUNT 4
+#define TEST_PATTERN_COUNT 5
+#define TEST_WINDOW_COUNT 12
+#define TEST_LARGE_WIDTH 3840
+#define TEST_LARGE_HEIGHT 2160
+#define TEST_MEASURE_COUNT 5
+
+typedef struct
+{
+  const uint8_t *data;
+  size_t length;
+  size_t position;
+  uint32_t bits;
+  int bit_count;
+  uint8_t *output;
+  size_t output_length;
+  size_t output_size;
+  int is_failed;
+} TestInflater;
+
+typedef struct
+{
+  short counts[16];
+  short symbols[288];
+} TestHuffman;
+
+char path_prefix[64];
+char path[128];
+uint32_t crc_table[256];
+uint64_t random_state = 88172645463325252ull;
+
+uint64_t nextRandom()
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+// Reads bits of the stream from the least significant, failing past its end
+int readBits(TestInflater *inflater, int count)
+{
+  uint32_t value = inflater->bits;
+  while (inflater->bit_count < count)
+  {
+    if (inflater->position >= inflater->length)
+    {
+      inflater->is_failed = 1;
+      return 0;
+    }
+    value |= (uint32_t)inflater->data[inflater->position++] << inflater->bit_count;
+    inflater->bit_count += 8;
+  }
+  inflater->bits = (uint32_t)((uint64_t)value >> count);
+  inflater->bit_count -= count;
+  return (int)(value & ((1u << count) - 1));
+}
+
+// Builds the canonical code of the lengths of symbols, returns zero when the lengths are over-subscribed
+int buildHuffman(TestHuffman *huffman, const short *lengths, int count)
+{
+  short offsets[16];
+  int left = 1;
+  int i;
+  memset(huffman->counts, 0, sizeof(huffman->counts));
+  for (i = 0; i < count; i++)
+    huffman->counts[lengths[i]]++;
+  for (i = 1; i < 16; i++)
+  {
+    left = left * 2 - huffman->counts[i];
+    if (left < 0)
+      return 0;
+  }
+  offsets[1] = 0;
+  for (i = 1; i < 15; i++)
+    offsets[i + 1] = (short)(offsets[i] + huffman->counts[i]);
+  for (i = 0; i < count; i++)
+    if (lengths[i] != 0)
+      huffman->symbols[offsets[lengths[i]]++] = (short)i;
+  return 1;
+}
+
+// Decodes a symbol a bit at a time, returns -1 on an invalid code
+int decodeSymbol(TestInflater *inflater, const TestHuffman *huffman)
+{
+  int code = 0;
+  int first = 0;
+  int index = 0;
+  int length;
+  for (length = 1; length < 16 && !inflater->is_failed; length++)
+  {
+    code |= readBits(inflater, 1);
+    if (code - huffman->counts[length] < first)
+      return huffman->symbols[index + (code - first)];
+    index += huffman->counts[length];
+    first = (first + huffman->counts[length]) << 1;
+    code <<= 1;
+  }
+  return -1;
+}
+
+// Appends a byte to the inflated data, which cannot grow past its expected size
+void putInflatedByte(TestInflater *inflater, uint8_t byte)
+{
+  if (inflater->output_length >= inflater->output_size)
+  {
+    inflater->is_failed = 1;
+    return;
+  }
+  inflater->output[inflater->output_length++] = byte;
+}
+
+// Inflates the symbols of a block until its end, returns zero on an invalid code or distance
+int inflateCodes(TestInflater *inflater, const TestHuffman *literals, const TestHuffman *distances)
+{
+  static const short length_bases[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+  static const short length_extras[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+  static const int distance_bases[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+  static const short distance_extras[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+  int symbol;
+  int length;
+  size_t distance;
+  for (;;)
+  {
+    symbol = decodeSymbol(inflater, literals);
+    if (symbol < 0 || inflater->is_failed)
+      return 0;
+    if (symbol < 256)
+      putInflatedByte(inflater, (uint8_t)symbol);
+    else if (symbol == 256)
+      return 1;
+    else
+    {
+      symbol -= 257;
+      if (symbol >= 29)
+        return 0;
+      length = length_bases[symbol] + readBits(inflater, length_extras[symbol]);
+      symbol = decodeSymbol(inflater, distances);
+      if (symbol < 0 || symbol >= 30)
+        return 0;
+      distance = (size_t)(distance_bases[symbol] + readBits(inflater, distance_extras[symbol]));
+      if (distance > inflater->output_length || distance > 32768)
+        return 0;
+      for (; length > 0; length--)
+        putInflatedByte(inflater, inflater->output[inflater->output_length - distance]);
+    }
+  }
+}
+
+// Inflates a zlib stream into a buffer of its expected size, returns zero when it is invalid or of another size
+int inflateStream(const uint8_t *data, size_t length, uint8_t *output, size_t output_size)
+{
+  static const short order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+  TestInflater inflater;
+  TestHuffman literals;
+  TestHuffman distances;
+  short lengths[320];
+  uint32_t a = 1;
+  uint32_t b = 0;
+  uint32_t adler;
+  size_t stored;
+  size_t i;
+  int is_last = 0;
+  int type;
+  int literal_count;
+  int distance_count;
+  int count;
+  int symbol;
+  int repeat;
+  if (length < 6 || (data[0] & 0x0F) != 8 || (data[0] >> 4) > 7 || ((data[0] << 8) | data[1]) % 31 != 0 || (data[1] & 0x20) != 0)
+    return 0;
+  memset(&inflater, 0, sizeof(inflater));
+  inflater.data = data + 2;
+  inflater.length = length - 6;
+  inflater.output = output;
+  inflater.output_size = output_size;
+  while (!is_last && !inflater.is_failed)
+  {
+    is_last = readBits(&inflater, 1);
+    type = readBits(&inflater, 2);
+    if (type == 0)
+    {
+      inflater.bits = 0;
+      inflater.bit_count = 0;
+      if (inflater.position + 4 > inflater.length)
+        return 0;
+      stored = (size_t)inflater.data[inflater.position] | (size_t)inflater.data[inflater.position + 1] << 8;
+      if ((stored ^ 0xFFFF) != ((size_t)inflater.data[inflater.position + 2] | (size_t)inflater.data[inflater.position + 3] << 8))
+        return 0;
+      inflater.position += 4;
+      for (i = 0; i < stored && inflater.position < inflater.length; i++)
+        putInflatedByte(&inflater, inflater.data[inflater.position++]);
+      continue;
+    }
+    if (type == 1)
+    {
+      for (i = 0; i < 288; i++)
+        lengths[i] = (short)(i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8);
+      buildHuffman(&literals, lengths, 288);
+      for (i = 0; i < 30; i++)
+        lengths[i] = 5;
+      buildHuffman(&distances, lengths, 30);
+    }
+    else if (type == 2)
+    {
+      literal_count = readBits(&inflater, 5) + 257;
+      distance_count = readBits(&inflater, 5) + 1;
+      count = readBits(&inflater, 4) + 4;
+      memset(lengths, 0, sizeof(lengths));
+      for (i = 0; i < (size_t)count; i++)
+        lengths[order[i]] = (short)readBits(&inflater, 3);
+      if (!buildHuffman(&literals, lengths, 19))
+        return 0;
+      for (i = 0; i < (size_t)(literal_count + distance_count);)
+      {
+        symbol = decodeSymbol(&inflater, &literals);
+        if (symbol < 0 || inflater.is_failed)
+          return 0;
+        if (symbol < 16)
+        {
+          lengths[i++] = (short)symbol;
+          continue;
+        }
+        if (symbol == 16 && i == 0)
+          return 0;
+        repeat = symbol == 16 ? 3 + readBits(&inflater, 2) : symbol == 17 ? 3 + readBits(&inflater, 3) : 11 + readBits(&inflater, 7);
+        if (i + (size_t)repeat > (size_t)(literal_count + distance_count))
+          return 0;
+        for (symbol = symbol == 16 ? lengths[i - 1] : 0; repeat > 0; repeat--)
+          lengths[i++] = (short)symbol;
+      }
+      if (!buildHuffman(&literals, lengths, literal_count) || !buildHuffman(&distances, lengths + literal_count, distance_count))
+        return 0;
+    }
+    else
+      return 0;
+    if (!inflateCodes(&inflater, &literals, &distances))
+      return 0;
+  }
+  if (inflater.is_failed || inflater.output_length != output_size)
+    return 0;
+  for (i = 0; i < output_size; i++)
+  {
+    a = (a + output[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  data += length - 4;
+  adler = (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+  return adler == (b << 16 | a);
+}
+
+uint32_t readBigEndian(const uint8_t *data)
+{
+  return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+}
+
+uint32_t computeCrc(const uint8_t *data, size_t length)
+{
+  uint32_t crc = 0xFFFFFFFFu;
+  size_t i;
+  for (i = 0; i < length; i++)
+    crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return crc ^ 0xFFFFFFFFu;
+}
+
+// Reads a whole file into a buffer to free, returns NULL when it cannot be read
+uint8_t *readFile(const char *name, size_t *length)
+{
+  FILE *file = fopen(name, "rb");
+  uint8_t *data;
+  long size;
+  if (file == NULL)
+    return NULL;
+  fseek(file, 0, SEEK_END);
+  size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  data = (uint8_t *)malloc((size_t)size + 1);
+  *length = data != NULL ? fread(data, 1, (size_t)size, file) : 0;
+  fclose(file);
+  return data;
+}
+
+int getPaeth(int a, int b, int c)
+{
+  int p = a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+  return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// Returns zero after printing the reason when a PNG file does not hold the BGRA pixels it was encoded from as opaque RGBA
+int isPngLikePixels(const char *name, const uint8_t *pixels, int width, int height, size_t stride)
+{
+  static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  const char *reason = NULL;
+  uint8_t *file;
+  uint8_t *stream;
+  uint8_t *rows;
+  uint8_t *row;
+  uint8_t *above;
+  size_t file_length = 0;
+  size_t stream_length = 0;
+  size_t row_length = (size_t)width * 4 + 1;
+  size_t position;
+  size_t chunk;
+  size_t i;
+  int chunk_count = 0;
+  int is_ended = 0;
+  int left;
+  int up;
+  int corner;
+  int x;
+  int y;
+  file = readFile(name, &file_length);
+  stream = (uint8_t *)malloc(file_length + 1);
+  rows = (uint8_t *)malloc(row_length * (size_t)height);
+  if (file == NULL || stream == NULL || rows == NULL)
+    reason = "cannot be read";
+  else if (file_length < 8 + 25 + 12 || memcmp(file, signature, 8) != 0)
+    reason = "has no PNG signature";
+  for (position = 8; reason == NULL && !is_ended; position += chunk + 12, chunk_count++)
+  {
+    if (position + 12 > file_length || (chunk = readBigEndian(&file[position])) > file_length - position - 12)
+      reason = "ends within a chunk";
+    else if (computeCrc(&file[position + 4], chunk + 4) != readBigEndian(&file[position + 8 + chunk]))
+      reason = "has a chunk of another CRC";
+    else if (chunk_count == 0 && (memcmp(&file[position + 4], "IHDR", 4) != 0 || chunk != 13))
+      reason = "does not start with its header";
+    else if (chunk_count == 0 && ((int)readBigEndian(&file[position + 8]) != width || (int)readBigEndian(&file[position + 12]) != height || memcmp(&file[position + 16], "\x08\x06\x00\x00\x00", 5) != 0))
+      reason = "has a header of another size or format";
+    else if (memcmp(&file[position + 4], "IDAT", 4) == 0)
+    {
+      memcpy(&stream[stream_length], &file[position + 8], chunk);
+      stream_length += chunk;
+    }
+    else if (memcmp(&file[position + 4], "IEND", 4) == 0)
+      is_ended = chunk == 0 && position + 12 == file_length;
+    else if (chunk_count > 0)
+      reason = "has an unknown chunk";
+  }
+  if (reason == NULL && !is_ended)
+    reason = "does not end with IEND";
+  if (reason == NULL && !inflateStream(stream, stream_length, rows, row_length * (size_t)height))
+    reason = "has an invalid zlib stream";
+  for (y = 0; reason == NULL && y < height; y++)
+  {
+    row = rows + row_length * (size_t)y + 1;
+    above = y > 0 ? row - row_length : NULL;
+    if (row[-1] > 4)
+      reason = "has an unknown filter";
+    for (i = 0; reason == NULL && i + 1 < row_length; i++)
+    {
+      left = i >= 4 ? row[i - 4] : 0;
+      up = above != NULL ? above[i] : 0;
+      corner = i >= 4 && above != NULL ? above[i - 4] : 0;
+      row[i] = (uint8_t)(row[i] + (row[-1] == 1 ? left : row[-1] == 2 ? up : row[-1] == 3 ? (left + up) / 2 : row[-1] == 4 ? getPaeth(left, up, corner) : 0));
+    }
+    for (x = 0; reason == NULL && x < width; x++)
+    {
+      const uint8_t *pixel = pixels + (size_t)y * stride + (size_t)x * 4;
+      if (row[x * 4] != pixel[2] || row[x * 4 + 1] != pixel[1] || row[x * 4 + 2] != pixel[0] || row[x * 4 + 3] != 0xFF)
+        reason = "has other pixels";
+    }
+  }
+  if (reason != NULL)
+    printf("the PNG file of %dx%d pixels %s\n", width, height, reason);
+  free(rows);
+  free(stream);
+  free(file);
+  return reason == NULL;
+}
+
+// Returns zero when a raw file does not hold the rows of the pixels without padding and with an opaque alpha
+int isRawLikePixels(const char *name, const uint8_t *pixels, int width, int height, size_t stride)
+{
+  size_t length = 0;
+  uint8_t *file = readFile(name, &length);
+  int is_like = file != NULL && length == (size_t)width * height * 4;
+  int x;
+  int y;
+  for (y = 0; is_like && y < height; y++)
+    for (x = 0; x < width * 4; x++)
+      is_like &= file[(size_t)y * width * 4 + x] == ((x & 3) == 3 ? 0xFF : pixels[(size_t)y * stride + x]);
+  free(file);
+  return is_like;
+}
+
+// Fills pixels with a pattern: flat, random, text-like strokes over a flat background, a gradient, or stripes of runs
+// longer than a match, and fills the padding of the rows with other bytes
+void fillPixels(uint8_t *pixels, int width, int height, size_t stride, int pattern)
+{
+  uint32_t *pixel;
+  uint32_t color = (uint32_t)nextRandom();
+  int x;
+  int y;
+  for (y = 0; y < height; y++)
+  {
+    memset(pixels + (size_t)y * stride, 0xA5, stride);
+    for (x = 0; x < width; x++)
+    {
+      pixel = (uint32_t *)(pixels + (size_t)y * stride) + x;
+      if (pattern == 0)
+        *pixel = 0x00F3F3F3;
+      else if (pattern == 1)
+        *pixel = (uint32_t)nextRandom();
+      else if (pattern == 2)
+        *pixel = nextRandom() % 9 == 0 ? 0x00202020 : 0x00F3F3F3;
+      else if (pattern == 3)
+        *pixel = (uint32_t)((x * 255 / width) << 16 | (y * 255 / height) << 8 | 0xC0);
+      else
+        *pixel = (x / 97) % 2 == 0 ? color : 0x00F3F3F3;
+    }
+  }
+}
+
+// Encodes pixels into the file of the test, returns zero when they are not written
+int encodeFile(const uint8_t *pixels, int width, int height, size_t stride, int is_raw, int64_t *bytes)
+{
+  FILE *file = fopen(path, "wb");
+  int is_written;
+  if (file == NULL)
+    return 0;
+  is_written = is_raw ? writeCaptureRaw(file, (uint8_t *)pixels, width, height, stride, bytes) : writeCapturePng(file, pixels, width, height, stride, bytes);
+  return fclose(file) == 0 && is_written;
+}
+
+// Returns the fastest encoding of pixels in milliseconds, and the size of the file
+double measureEncoding(const uint8_t *pixels, int width, int height, int is_raw, int64_t *bytes)
+{
+  int64_t best = 0;
+  int64_t start;
+  int64_t elapsed;
+  int i;
+  for (i = 0; i < TEST_MEASURE_COUNT; i++)
+  {
+    start = getClockNanoseconds();
+    encodeFile(pixels, width, height, (size_t)width * 4, is_raw, bytes);
+    elapsed = getClockNanoseconds() - start;
+    best = best == 0 || elapsed < best ? elapsed : best;
+  }
+  return best / 1e6;
+}
+
+// Returns the number of windows of a --capture listing whose file differs from their pixels, or whose item is not the
+// expected one, adding the windows that could not be captured to a count
+int countListedDifferences(const char *extension, int *failure_count)
+{
+  char pattern[128];
+  const char *line;
+  const char *name;
+  uint8_t *pixels;
+  size_t stride = 0;
+  size_t file_length = 0;
+  uint8_t *file;
+  int64_t handle;
+  int width = 0;
+  int height = 0;
+  int count = 0;
+  int code;
+  int i;
+  snprintf(pattern, sizeof(pattern), "%s-{handle}.%s", path_prefix, extension);
+  snprintf(path, sizeof(path), "%d", TEST_WINDOW_COUNT);
+  code = runHarnessRequest("--desktop", "--limit", path, "--capture", pattern, "--format", "ndjson", NULL);
+  *failure_count = 0;
+  for (i = 0, line = output; i < TEST_WINDOW_COUNT; i++, line = strchr(line, '\n') + 1)
+  {
+    if (strncmp(line, "{\"handle\": ", 11) != 0 || strchr(line, '\n') == NULL)
+      return TEST_WINDOW_COUNT - i;
+    handle = strtoll(line + 11, NULL, 10);
+    snprintf(path, sizeof(path), "\"path\": \"%s-%lld.%s\", ", path_prefix, (long long)handle, extension);
+    name = strstr(line, path);
+    pixels = backendCaptureWindow((HWND)(intptr_t)handle, &width, &height, &stride);
+    if (pixels == NULL)
+    {
+      *failure_count += 1;
+      count += name == NULL || strstr(line, "\"error\": \"Could not capture the window\"}") == NULL;
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s-%lld.%s", path_prefix, (long long)handle, extension);
+    file = readFile(path, &file_length);
+    free(file);
+    snprintf(pattern, sizeof(pattern), "\"width\": %d, \"height\": %d, \"bytes\": %lld}", width, height, (long long)file_length);
+    count += name == NULL || strstr(line, pattern) == NULL;
+    count += extension[0] == 'p' ? !isPngLikePixels(path, pixels, width, height, stride) : !isRawLikePixels(path, pixels, width, height, stride);
+    remove(path);
+  }
+  return count + (*line != '\0') + (code != (*failure_count > 0 ? 1 : 0));
+}
+
+int main(int argn, char **argv)
+{
+  const int widths[TEST_WIDTH_COUNT] = {1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 257};
+  const int heights[TEST_HEIGHT_COUNT] = {1, 2, 5, 40};
+  const char *patterns[TEST_PATTERN_COUNT] = {"flat", "random", "text", "gradient", "stripes"};
+  uint8_t *pixels;
+  uint8_t *large;
+  uint8_t *window_pixels;
+  size_t large_size = (size_t)TEST_LARGE_WIDTH * TEST_LARGE_HEIGHT * 4;
+  size_t stride;
+  int64_t bytes = 0;
+  double elapsed;
+  HWND h;
+  uint32_t crc;
+  int failure_count = 0;
+  int failures = 0;
+  int width;
+  int height;
+  int pattern;
+  int padding;
+  int w;
+  int i;
+  int j;
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", "24");
+  initHarness();
+  for (i = 0; i < 256; i++)
+  {
+    for (crc = (uint32_t)i, j = 0; j < 8; j++)
+      crc = (crc & 1) != 0 ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+    crc_table[i] = crc;
+  }
+  snprintf(path_prefix, sizeof(path_prefix), "/tmp/window-state-capture-test-%d", (int)getpid());
+  pixels = (uint8_t *)malloc((size_t)(257 * 4 + 12) * 40);
+  large = (uint8_t *)malloc(large_size);
+  if (pixels == NULL || large == NULL)
+    return 1;
+
+  // Small buffers of every pattern, with and without padding after the rows
+  for (w = 0; w < TEST_WIDTH_COUNT; w++)
+  {
+    for (i = 0; i < TEST_HEIGHT_COUNT; i++)
+    {
+      for (pattern = 0; pattern < TEST_PATTERN_COUNT; pattern++)
+      {
+        for (padding = 0; padding <= 12; padding += 12)
+        {
+          width = widths[w];
+          height = heights[i];
+          stride = (size_t)width * 4 + (size_t)padding;
+          fillPixels(pixels, width, height, stride, pattern);
+          snprintf(path, sizeof(path), "%s.png", path_prefix);
+          if (!encodeFile(pixels, width, height, stride, 0, &bytes) || !isPngLikePixels(path, pixels, width, height, stride))
+          {
+            printf("%s pixels of %dx%d with a stride of %d differ in PNG\n", patterns[pattern], width, height, (int)stride);
+            failures++;
+          }
+          snprintf(path, sizeof(path), "%s.bgra", path_prefix);
+          if (!encodeFile(pixels, width, height, stride, 1, &bytes) || bytes != (int64_t)width * height * 4 || !isRawLikePixels(path, pixels, width, height, stride))
+          {
+            printf("%s pixels of %dx%d with a stride of %d differ in raw\n", patterns[pattern], width, height, (int)stride);
+            failures++;
+          }
+        }
+      }
+    }
+  }
+  checkHarness(failures == 0, "%d of %d small captures differ from their pixels", failures, TEST_WIDTH_COUNT * TEST_HEIGHT_COUNT * TEST_PATTERN_COUNT * 4);
+
+  // Large captures of several IDAT chunks, with few runs or none
+  snprintf(path, sizeof(path), "%s.png", path_prefix);
+  for (pattern = 1, failures = 0; pattern < TEST_PATTERN_COUNT; pattern += 2)
+  {
+    fillPixels(large, TEST_LARGE_WIDTH, TEST_LARGE_HEIGHT, (size_t)TEST_LARGE_WIDTH * 4, pattern);
+    failures += !encodeFile(large, TEST_LARGE_WIDTH, TEST_LARGE_HEIGHT, (size_t)TEST_LARGE_WIDTH * 4, 0, &bytes) || !isPngLikePixels(path, large, TEST_LARGE_WIDTH, TEST_LARGE_HEIGHT, (size_t)TEST_LARGE_WIDTH * 4);
+  }
+  checkHarness(failures == 0, "%d of %d large captures differ from their pixels", failures, TEST_PATTERN_COUNT / 2);
+
+  // Captures of the listed windows, some of them hidden or minimized
+  failures = countListedDifferences("png", &failure_count);
+  checkHarness(failures == 0 && failure_count > 0 && failure_count < TEST_WINDOW_COUNT, "%d of %d windows captured as PNG differ from their pixels, %d not captured", failures, TEST_WINDOW_COUNT, failure_count);
+  failures = countListedDifferences("bgra", &failure_count);
+  checkHarness(failures == 0, "%d of %d windows captured as raw pixels differ from their pixels", failures, TEST_WINDOW_COUNT);
+  snprintf(path, sizeof(path), "%s.png", path_prefix);
+  runHarnessRequest("--desktop", "--limit", "2", "--capture", path, "--format", "ndjson", NULL);
+  checkHarness(strstr(output, "\"error\": \"Several windows are selected and the capture file has no {handle} placeholder\"}\n") != NULL, "a second window without placeholder writes %.200s", output);
+  runHarnessRequest("--desktop", "--capture", "window.bmp", NULL);
+  checkHarness(strncmp(output, "Error: Invalid capture file", 27) == 0, "--capture window.bmp writes %.80s", output);
+  runHarnessRequest("--desktop", "--capture", "window.png", "--group-by", "pid", NULL);
+  checkHarness(strncmp(output, "Error: Captures only apply", 26) == 0, "--capture with --group-by writes %.80s", output);
+
+  // A window of text of the size of a 4K display, then flat and random pixels of the same size
+  for (h = backendGetFirstChild(NULL); h != NULL && !(backendIsWindowVisible(h) && (backendGetWindowLong(h, GWL_STYLE) & WS_MINIMIZE) == 0); h = backendGetWindow(h, GW_HWNDNEXT))
+  {
+  }
+  memory_windows[memoryGetIndex(h)].rect.right = memory_windows[memoryGetIndex(h)].rect.left + TEST_LARGE_WIDTH;
+  memory_windows[memoryGetIndex(h)].rect.bottom = memory_windows[memoryGetIndex(h)].rect.top + TEST_LARGE_HEIGHT;
+  window_pixels = backendCaptureWindow(h, &width, &height, &stride);
+  if (window_pixels == NULL)
+    return 1;
+  memcpy(large, window_pixels, large_size);
+  elapsed = measureEncoding(large, TEST_LARGE_WIDTH, TEST_LARGE_HEIGHT, 0, &bytes);
+  printf("%dx%d PNG: text in %.1f ms (%.0f megapixels per second, %.1f%% of raw)", TEST_LARGE_WIDTH, TEST_LARGE_HEIGHT, elapsed, TEST_LARGE_WIDTH * TEST_LARGE_HEIGHT / elapsed / 1e3, bytes * 100.0 / (double)large_size);
+  fillPixels(large, TEST_LARGE_WIDTH, TEST_LARGE_HEIGHT, (size_t)TEST_LARGE_WIDTH * 4, 0);
+  elapsed = measureEncoding(large, TEST_LARGE_WIDTH, TEST_LARGE_HEIGHT, 0, &bytes);
+  printf(", flat in %.1f ms", elapsed);
+  fillPixels(large, TEST_LARGE_WIDTH, TEST_LARGE_HEIGHT, (size_t)TEST_LARGE_WIDTH * 4, 1);
+  elapsed = measureEncoding(large, TEST_LARGE_WIDTH, TEST_LARGE_HEIGHT, 0, &bytes);
+  printf(", random in %.1f ms", elapsed);
+  elapsed = measureEncoding(large, TEST_LARGE_WIDTH, TEST_LARGE_HEIGHT, 1, &bytes);
+  printf(", raw in %.1f ms\n", elapsed);
+
+  snprintf(path, sizeof(path), "%s.png", path_prefix);
+  remove(path);
+  snprintf(path, sizeof(path), "%s.bgra", path_prefix);
+  remove(path);
+  free(large);
+  free(pixels);
+  return finishHarness("capture");
+}
@@ -0,0 +1,362 @@
+// Filter expression test: checks the errors of invalid --where expressions, checks that random expressions select the same
+// windows as a reference evaluator over the listed attributes and that the expressions select the same windows as the
+// equivalent filters, then measures a filter against listing the windows it reads.
+//
+//   gcc -O2 -pthread ./tests/expression.c -o expression-test
+//   ./expression-test
+
+#include "harness.h"
+
+#define TEST_WINDOW_COUNT 2000
+#define TEST_EXPRESSION_COUNT 500
+#define TEST_NODE_LIMIT 64
+#define TEST_SOURCE_SIZE 4096
+
+typedef struct
+{
+  const char *source;
+  // Exact error written for the expression, NULL when it is valid
+  const char *error;
+} ParserCase;
+
+const ParserCase parser_cases[] = {
+    {"visible", NULL},
+    {"!visible", NULL},
+    {"not visible", NULL},
+    {"!!visible", NULL},
+    {"  visible  ", NULL},
+    {"((((visible))))", NULL},
+    {"visible && pid == 1004", NULL},
+    {"visible and pid == 1004", NULL},
+    {"(visible || minimized) && width > 800", NULL},
+    {"maximized or topmost", NULL},
+    {"width>=800&&height<=600||left<-100", NULL},
+    {"pid = 1004", NULL},
+    {"title ~ \"Chrome\"", NULL},
+    {"title ~ 'Chrome'", NULL},
+    {"title !~ \"chrome\"", NULL},
+    {"title == \"document 5 - notepad\"", NULL},
+    {"classname != 'Notepad'", NULL},
+    {"title ~ \"say \\\"hi\\\"\"", NULL},
+    {"visible == true && minimized == false", NULL},
+    {"visible_fraction >= 0.5", NULL},
+    {"visible_fraction > .25", NULL},
+    {"visible_area > 0", NULL},
+    {"", "Error: Invalid filter expression at column 1: expected an attribute name\n"},
+    {"visible &&", "Error: Invalid filter expression at column 11: expected an attribute name\n"},
+    {"visible ||| minimized", "Error: Invalid filter expression at column 11: expected an attribute name\n"},
+    {"notvisible", "Error: Invalid filter expression at column 1: unknown attribute\n"},
+    {"visible && colour == 1", "Error: Invalid filter expression at column 12: unknown attribute\n"},
+    {"pid ==", "Error: Invalid filter expression at column 7: expected a number, a string or a boolean value\n"},
+    {"pid == 'x'", "Error: Invalid filter expression at column 11: numeric attributes must be compared with a number\n"},
+    {"pid ~ 4", "Error: Invalid filter expression at column 8: the ~ operator is only supported by text attributes\n"},
+    {"title == 5", "Error: Invalid filter expression at column 11: text attributes must be compared with a string\n"},
+    {"title > 'a'", "Error: Invalid filter expression at column 12: text attributes only support ==, !=, ~ and !~\n"},
+    {"title ~ \"abc", "Error: Invalid filter expression at column 13: unterminated string\n"},
+    {"(visible", "Error: Invalid filter expression at column 9: expected a closing parenthesis\n"},
+    {"visible)", "Error: Invalid filter expression at column 8: unexpected text after the expression\n"},
+    {"visible minimized", "Error: Invalid filter expression at column 9: unexpected text after the expression\n"},
+    {"width > 1.5", "Error: Invalid filter expression at column 10: decimal numbers are only supported by fractions\n"},
+    {"visible_fraction > 1.", "Error: Invalid filter expression at column 22: expected decimals after the point\n"},
+    {"visible_fraction > 0.1234567", "Error: Invalid filter expression at column 28: fractions have at most six decimals\n"},
+    {"pid == 99999999999999999999", "Error: Invalid filter expression at column 28: invalid number\n"},
+};
+
+// Attributes of the reference evaluator, read from the listed windows
+const char *test_attributes[] = {"pid", "visible", "minimized", "topmost", "bordered", "left", "top", "right", "bottom", "width", "height", "area"};
+#define TEST_ATTRIBUTE_COUNT (int)(sizeof(test_attributes) / sizeof(test_attributes[0]))
+#define TEST_BOOLEAN_FIRST 1
+#define TEST_BOOLEAN_LAST 4
+
+typedef struct
+{
+  int64_t handle;
+  int64_t values[TEST_ATTRIBUTE_COUNT];
+} TestWindow;
+
+typedef struct
+{
+  // NODE_AND, NODE_OR, NODE_NOT, NODE_COMPARE or NODE_TRUTHY of the program
+  int type;
+  int attribute;
+  int op;
+  int64_t number;
+  int left;
+  int right;
+} TestNode;
+
+TestWindow test_windows[TEST_WINDOW_COUNT];
+int test_window_count = 0;
+TestNode test_nodes[TEST_NODE_LIMIT];
+int test_node_count = 0;
+char test_source[TEST_SOURCE_SIZE];
+size_t test_source_length = 0;
+int64_t expected_handles[TEST_WINDOW_COUNT];
+uint64_t random_state = 88172645463325252ull;
+
+uint64_t nextRandom()
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+// Returns the value of a number or boolean key of an NDJSON line, zero when the line does not have the key
+int64_t findJsonNumber(const char *line, const char *key)
+{
+  char pattern[64];
+  const char *position;
+  const char *end = strchr(line, '\n');
+  snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+  position = strstr(line, pattern);
+  if (position == NULL || (end != NULL && position > end))
+    return 0;
+  position += strlen(pattern);
+  if (strncmp(position, "true", 4) == 0)
+    return 1;
+  return strtoll(position, NULL, 10);
+}
+
+// Reads the handles of an NDJSON list, returns their number
+int readHandles(int64_t *handles, int handle_size)
+{
+  const char *line = output;
+  int count = 0;
+  while (line != NULL && *line == '{' && count < handle_size)
+  {
+    handles[count++] = findJsonNumber(line, "handle");
+    line = strchr(line, '\n');
+    line = line != NULL ? line + 1 : NULL;
+  }
+  return count;
+}
+
+// Lists the windows with the attributes of the reference evaluator, booleans that are false are left out of the output
+void readTestWindows()
+{
+  const char *line;
+  TestWindow *window;
+  int i;
+  runHarnessRequest("--desktop", "--fields", "handle,pid,visible,minimized,topmost,bordered,rect", "--format", "ndjson", NULL);
+  for (line = output; line != NULL && *line == '{' && test_window_count < TEST_WINDOW_COUNT; line = strchr(line, '\n'), line = line != NULL ? line + 1 : NULL)
+  {
+    window = &test_windows[test_window_count++];
+    window->handle = findJsonNumber(line, "handle");
+    for (i = 0; i <= 8; i++)
+      window->values[i] = findJsonNumber(line, test_attributes[i]);
+    window->values[9] = window->values[7] - window->values[5];
+    window->values[10] = window->values[8] - window->values[6];
+    window->values[11] = window->values[9] > 0 && window->values[10] > 0 ? window->values[9] * window->values[10] : 0;
+  }
+}
+
+void appendSource(const char *text)
+{
+  size_t length = strlen(text);
+  if (test_source_length + length < TEST_SOURCE_SIZE)
+  {
+    memcpy(&test_source[test_source_length], text, length + 1);
+    test_source_length += length;
+  }
+}
+
+int isEvaluatedTrue(int index, const TestWindow *window)
+{
+  const TestNode *node = &test_nodes[index];
+  int64_t value;
+  if (node->type == NODE_AND)
+    return isEvaluatedTrue(node->left, window) && isEvaluatedTrue(node->right, window);
+  if (node->type == NODE_OR)
+    return isEvaluatedTrue(node->left, window) || isEvaluatedTrue(node->right, window);
+  if (node->type == NODE_NOT)
+    return !isEvaluatedTrue(node->left, window);
+  value = window->values[node->attribute];
+  if (node->type == NODE_TRUTHY)
+    return value != 0;
+  switch (node->op)
+  {
+  case OPERATOR_EQUAL:
+    return value == node->number;
+  case OPERATOR_NOT_EQUAL:
+    return value != node->number;
+  case OPERATOR_LESS:
+    return value < node->number;
+  case OPERATOR_LESS_EQUAL:
+    return value <= node->number;
+  case OPERATOR_GREATER:
+    return value > node->number;
+  default:
+    return value >= node->number;
+  }
+}
+
+// Appends the source of a node, a child is written without parentheses when the precedence of the operators keeps it whole
+void writeTestNode(int index, int parent_type)
+{
+  static const char *operators[] = {"", " == ", " != ", " < ", " <= ", " > ", " >= "};
+  const TestNode *node = &test_nodes[index];
+  char number[32];
+  int is_grouped;
+  if (node->type == NODE_COMPARE || node->type == NODE_TRUTHY)
+  {
+    appendSource(test_attributes[node->attribute]);
+    if (node->type == NODE_TRUTHY)
+      return;
+    appendSource(operators[node->op]);
+    if (node->attribute >= TEST_BOOLEAN_FIRST && node->attribute <= TEST_BOOLEAN_LAST)
+      appendSource(node->number != 0 ? "true" : "false");
+    else
+    {
+      snprintf(number, sizeof(number), "%" PRId64, node->number);
+      appendSource(number);
+    }
+    return;
+  }
+  if (node->type == NODE_NOT)
+  {
+    appendSource(nextRandom() % 2 == 0 ? "!(" : "not (");
+    writeTestNode(node->left, NODE_NOT);
+    appendSource(")");
+    return;
+  }
+  is_grouped = parent_type == NODE_NOT || (parent_type == NODE_AND && node->type == NODE_OR) || nextRandom() % 3 == 0;
+  appendSource(is_grouped ? "(" : "");
+  writeTestNode(node->left, node->type);
+  if (node->type == NODE_AND)
+    appendSource(nextRandom() % 2 == 0 ? " && " : " and ");
+  else
+    appendSource(nextRandom() % 2 == 0 ? " || " : " or ");
+  writeTestNode(node->right, node->type);
+  appendSource(is_grouped ? ")" : "");
+}
+
+// Adds a random expression node, comparisons use the values of the windows so that equalities match some of them
+int generateTestNode(int depth)
+{
+  int index = test_node_count++;
+  TestNode *node = &test_nodes[index];
+  uint64_t choice = nextRandom() % 8;
+  const TestWindow *window = &test_windows[nextRandom() % test_window_count];
+  memset(node, 0, sizeof(TestNode));
+  if (depth > 0 && test_node_count + 2 < TEST_NODE_LIMIT && choice < 5)
+  {
+    node->type = choice < 2 ? NODE_AND : choice < 4 ? NODE_OR : NODE_NOT;
+    node->left = generateTestNode(depth - 1);
+    node->right = node->type != NODE_NOT ? generateTestNode(depth - 1) : -1;
+    return index;
+  }
+  node->attribute = (int)(nextRandom() % TEST_ATTRIBUTE_COUNT);
+  if (node->attribute >= TEST_BOOLEAN_FIRST && node->attribute <= TEST_BOOLEAN_LAST && nextRandom() % 2 == 0)
+  {
+    node->type = NODE_TRUTHY;
+    return index;
+  }
+  node->type = NODE_COMPARE;
+  node->op = 1 + (int)(nextRandom() % 6);
+  node->number = window->values[node->attribute] + (node->attribute > TEST_BOOLEAN_LAST ? (int64_t)(nextRandom() % 3) - 1 : 0);
+  return index;
+}
+
+// Returns zero when an expression selects other windows than the reference evaluator
+int isSelectedLikeReference()
+{
+  int64_t handles[TEST_WINDOW_COUNT];
+  int expected_count = 0;
+  int count;
+  int i;
+  for (i = 0; i < test_window_count; i++)
+    if (isEvaluatedTrue(0, &test_windows[i]))
+      expected_handles[expected_count++] = test_windows[i].handle;
+  if (runHarnessRequest("--desktop", "--where", test_source, "--fields", "handle", "--format", "ndjson", NULL) != 0)
+    return 0;
+  count = readHandles(handles, TEST_WINDOW_COUNT);
+  return count == expected_count && memcmp(handles, expected_handles, sizeof(int64_t) * count) == 0;
+}
+
+// Returns zero when two requests write different windows
+int isSameSelection(const char *first_option, const char *first_value, const char *second_option, const char *second_value)
+{
+  char *first;
+  int is_same;
+  runHarnessRequest("--desktop", first_option, first_value, "--fields", "handle", "--format", "ndjson", NULL);
+  first = (char *)malloc(output_length + 1);
+  memcpy(first, output, output_length + 1);
+  runHarnessRequest("--desktop", second_option, second_value, "--fields", "handle", "--format", "ndjson", NULL);
+  is_same = strcmp(first, output) == 0 && first[0] == '{';
+  free(first);
+  return is_same;
+}
+
+// Returns the fastest time of several requests, in nanoseconds per window
+double measureRequest(const char *option, const char *value, const char *fields)
+{
+  int64_t best = 0;
+  int64_t start;
+  int64_t elapsed;
+  int i;
+  for (i = 0; i < 20; i++)
+  {
+    start = getClockNanoseconds();
+    if (option != NULL)
+      runHarnessRequest("--desktop", option, value, "--fields", fields, NULL);
+    else
+      runHarnessRequest("--desktop", "--fields", fields, NULL);
+    elapsed = getClockNanoseconds() - start;
+    best = best == 0 || elapsed < best ? elapsed : best;
+  }
+  return (double)best / test_window_count;
+}
+
+int main(int argn, char **argv)
+{
+  char count_text[32];
+  const ParserCase *test;
+  int code;
+  int i;
+  snprintf(count_text, sizeof(count_text), "%d", TEST_WINDOW_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", count_text);
+  initHarness();
+
+  for (i = 0; i < (int)(sizeof(parser_cases) / sizeof(parser_cases[0])); i++)
+  {
+    test = &parser_cases[i];
+    code = runHarnessRequest("--desktop", "--where", test->source, "--fields", "handle", NULL);
+    if (test->error == NULL)
+      checkHarness(code == 0 && output_length > 0 && output[0] == '[', "'%s' is rejected: %s", test->source, output);
+    else
+      checkHarness(code != 0 && strcmp(output, test->error) == 0, "'%s' gives %s", test->source, output);
+  }
+  // An expression of more terms than the compiled tree holds
+  test_source_length = 0;
+  test_source[0] = '\0';
+  for (i = 0; i < EXPRESSION_NODE_LIMIT; i++)
+    appendSource(i == 0 ? "visible" : " || visible");
+  code = runHarnessRequest("--desktop", "--where", test_source, NULL);
+  checkHarness(code != 0 && strstr(output, "too many terms") != NULL, "an expression of %d terms gives %s", EXPRESSION_NODE_LIMIT, output);
+
+  readTestWindows();
+  checkHarness(test_window_count == TEST_WINDOW_COUNT, "%d windows are listed instead of %d", test_window_count, TEST_WINDOW_COUNT);
+  for (i = 0; i < TEST_EXPRESSION_COUNT && test_window_count > 0; i++)
+  {
+    test_node_count = 0;
+    test_source_length = 0;
+    test_source[0] = '\0';
+    generateTestNode(1 + i % 5);
+    writeTestNode(0, 0);
+    if (!checkHarness(isSelectedLikeReference(), "'%s' selects other windows than the reference", test_source))
+      break;
+  }
+
+  checkHarness(isSameSelection("--where", "pid == 1004", "--pid", "1004"), "pid == 1004 differs from --pid");
+  checkHarness(isSameSelection("--where", "title ~ \"chrome\"", "--title", "CHROME"), "title ~ differs from --title");
+  checkHarness(isSameSelection("--where", "classname ~ \"notepad\"", "--class-contains", "Notepad"), "classname ~ differs from --class-contains");
+  checkHarness(isSameSelection("--where", "visible && title ~ 'code' && pid != 1004", "--where", "pid != 1004 && title ~ \"Code\" && visible"), "the order of the terms changes the selection");
+  checkHarness(isSameSelection("--where", "!(visible && pid == 1004)", "--where", "not visible or pid != 1004"), "De Morgan's law does not hold");
+
+  printf("windows: %d\n", test_window_count);
+  printf("where: %.1f ns per window, written costliest first: %.1f ns per window\n", measureRequest("--where", "visible && pid == 1004 && title ~ \"Chrome\" && width > 800", "handle"), measureRequest("--where", "title ~ \"Chrome\" && width > 800 && pid == 1004 && visible", "handle"));
+  printf("where without pid: %.1f ns per window\n", measureRequest("--where", "visible && title ~ \"Chrome\" && width > 800", "handle"));
+  printf("list of the attributes: %.1f ns per window\n", measureRequest(NULL, NULL, "handle,pid,visible,title,rect"));
+  return finishHarness("expression");
+}
@@ -0,0 +1,266 @@
+// Field selection test: counts the calls made to the in-memory backend for each --fields list, which stand for the calls
+// to the window system, and compares the keys and values written with those of every field.
+//
+// Listing the handles alone walks the windows, so the calls of a list beyond that walk are those of its attributes, which
+// the test expects once per window and attribute, with attributes read by the same call counted once:
+//
+//   gcc -O2 -pthread ./tests/fields.c -o fields-test
+//   ./fields-test
+
+#include "harness.h"
+
+#include <sys/wait.h>
+
+#define TEST_WINDOW_COUNT 2000
+#define TEST_MEASURE_WINDOW_COUNT 50000
+#define TEST_KEY_COUNT 32
+
+typedef struct
+{
+  const char *list;
+  // Calls of each window beyond the walk
+  int calls;
+  // Keys the list may write, separated by commas
+  const char *keys;
+} FieldCase;
+
+const FieldCase field_cases[] = {
+    {"title", 1, "title"},
+    {"module", 1, "module"},
+    {"classname", 1, "classname"},
+    {"class", 1, "classname"},
+    {"parent", 1, "parent"},
+    // The walk goes on from the sibling that was read, only the last window reads its missing sibling again
+    {"sibling", 0, "sibling"},
+    {"child", 1, "child"},
+    {"pid", 1, "pid"},
+    {"thread", 1, "thread"},
+    {"pid,thread", 1, "pid,thread"},
+    {"style", 1, "style"},
+    {"exstyle", 1, "exstyle"},
+    {"visible", 1, "visible"},
+    {"unicode", 1, "unicode"},
+    {"popup", 1, "popup"},
+    {"style,popup,minimized", 1, "style,popup,minimized"},
+    // Written only when it differs from the visible key
+    {"visible_alt", 2, "visible_alt"},
+    {"topmost,transparent", 1, "topmost,transparent"},
+    {"flags", 3, "popup,contained,bordered,scrollable,visible_alt,minimized,topmost,transparent"},
+    {"rect", 1, "top,right,bottom,left"},
+    {"left", 1, "top,right,bottom,left"},
+    {"handle,pid,rect", 2, "handle,pid,top,right,bottom,left"},
+};
+
+typedef struct
+{
+  const char *key;
+  size_t key_length;
+  const char *value;
+  size_t value_length;
+} TestPair;
+
+char *every_field;
+int64_t walk_calls;
+
+// Splits an NDJSON object into its keys and values, returns the number of pairs or -1 when the line is not an object
+int splitJsonLine(const char *line, TestPair *pairs)
+{
+  const char *position = line + 1;
+  int count = 0;
+  if (*line != '{')
+    return -1;
+  if (line[1] == '}')
+    return 0;
+  while (*position == '"' && count < TEST_KEY_COUNT)
+  {
+    pairs[count].key = position + 1;
+    position = strchr(position + 1, '"');
+    if (position == NULL || strncmp(position, "\": ", 3) != 0)
+      return -1;
+    pairs[count].key_length = (size_t)(position - pairs[count].key);
+    position += 3;
+    pairs[count].value = position;
+    if (*position == '"')
+    {
+      for (position++; *position != '"' && *position != '\0'; position++)
+        if (*position == '\\')
+          position++;
+      position++;
+    }
+    else
+      while (*position != ',' && *position != '}' && *position != '\0')
+        position++;
+    pairs[count].value_length = (size_t)(position - pairs[count].value);
+    count++;
+    if (*position == '}')
+      return count;
+    if (strncmp(position, ", ", 2) != 0)
+      return -1;
+    position += 2;
+  }
+  return -1;
+}
+
+// Returns one when a key is in a list of keys separated by commas
+int isListedKey(const char *keys, const char *key, size_t key_length)
+{
+  const char *end;
+  for (; *keys != '\0'; keys = *end == ',' ? end + 1 : end)
+  {
+    end = strchr(keys, ',');
+    end = end != NULL ? end : keys + strlen(keys);
+    if ((size_t)(end - keys) == key_length && strncmp(keys, key, key_length) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+// Returns zero when a line of the output is not the line of the same window with every field, without the keys that the
+// list does not write, in the same order
+int isProjectionOfEveryField(const char *keys)
+{
+  TestPair every[TEST_KEY_COUNT];
+  TestPair projected[TEST_KEY_COUNT];
+  const char *line = output;
+  const char *full = every_field;
+  int every_count;
+  int projected_count;
+  int i;
+  int j;
+  for (; line != NULL && *line == '{'; line = strchr(line, '\n'), line = line != NULL ? line + 1 : NULL)
+  {
+    if (full == NULL || *full != '{')
+      return 0;
+    every_count = splitJsonLine(full, every);
+    projected_count = splitJsonLine(line, projected);
+    if (every_count < 0 || projected_count < 0)
+      return 0;
+    for (i = 0, j = 0; i < every_count; i++)
+    {
+      if (!isListedKey(keys, every[i].key, every[i].key_length))
+        continue;
+      if (j >= projected_count || every[i].key_length != projected[j].key_length || every[i].value_length != projected[j].value_length || strncmp(every[i].key, projected[j].key, every[i].key_length) != 0 || strncmp(every[i].value, projected[j].value, every[i].value_length) != 0)
+        return 0;
+      j++;
+    }
+    if (j != projected_count)
+      return 0;
+    full = strchr(full, '\n');
+    full = full != NULL ? full + 1 : NULL;
+  }
+  return full != NULL && *full == '\0';
+}
+
+// Returns the number of lines of the output
+int64_t countLines()
+{
+  int64_t count = 0;
+  const char *line;
+  for (line = strchr(output, '\n'); line != NULL; line = strchr(line + 1, '\n'))
+    count++;
+  return count;
+}
+
+// Returns the backend calls of listing the desktop with a list of fields
+int64_t countCalls(const char *fields)
+{
+  runHarnessRequest("--desktop", "--fields", fields, "--format", "ndjson", NULL);
+  return readCounter(&backend_call_count);
+}
+
+// Returns the fastest time of a request, in milliseconds
+double measureRequest(const char *fields)
+{
+  int64_t best = 0;
+  int64_t start;
+  int64_t elapsed;
+  int i;
+  for (i = 0; i < 5; i++)
+  {
+    start = getClockNanoseconds();
+    runHarnessRequest("--desktop", "--fields", fields, "--format", "ndjson", NULL);
+    elapsed = getClockNanoseconds() - start;
+    best = best == 0 || elapsed < best ? elapsed : best;
+  }
+  return best / 1e6;
+}
+
+// Forks a process for the measures, which need a larger desktop than the one already read by the checks
+int runMeasures()
+{
+  char count_text[32];
+  const char *lists[] = {"all", "handle,pid,rect", "handle"};
+  int64_t calls;
+  size_t length;
+  int i;
+  pid_t child = fork();
+  int status;
+  if (child != 0)
+  {
+    waitpid(child, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+  }
+  snprintf(count_text, sizeof(count_text), "%d", TEST_MEASURE_WINDOW_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", count_text);
+  initHarness();
+  for (i = 0; i < 3; i++)
+  {
+    calls = countCalls(lists[i]);
+    length = output_length;
+    printf("--fields %s: %.1f calls and %.0f bytes per window, %.1f ms for %d windows\n", lists[i], (double)calls / TEST_MEASURE_WINDOW_COUNT, (double)length / TEST_MEASURE_WINDOW_COUNT, measureRequest(lists[i]), TEST_MEASURE_WINDOW_COUNT);
+  }
+  fflush(stdout);
+  _exit(0);
+}
+
+int main(int argn, char **argv)
+{
+  char count_text[32];
+  const FieldCase *field;
+  int64_t calls;
+  int64_t opens;
+  int64_t written;
+  int i;
+  // The desktop of the measures is generated in a child forked before the harness starts any thread
+  if (runMeasures() != 0)
+    return 1;
+  snprintf(count_text, sizeof(count_text), "%d", TEST_WINDOW_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", count_text);
+  initHarness();
+
+  countCalls("all");
+  every_field = (char *)malloc(output_length + 1);
+  memcpy(every_field, output, output_length + 1);
+  walk_calls = countCalls("handle");
+  checkHarness(isProjectionOfEveryField("handle"), "--fields handle writes other keys or values");
+
+  for (i = 0; i < (int)(sizeof(field_cases) / sizeof(field_cases[0])); i++)
+  {
+    field = &field_cases[i];
+    calls = countCalls(field->list);
+    checkHarness(isProjectionOfEveryField(field->keys), "--fields %s writes other keys or values than every field", field->list);
+    // The last window has no sibling, which the walk reads again
+    if (strcmp(field->list, "sibling") == 0)
+      calls--;
+    checkHarness(calls - walk_calls == (int64_t)field->calls * TEST_WINDOW_COUNT, "--fields %s makes %.2f calls per window instead of %d", field->list, (double)(calls - walk_calls) / TEST_WINDOW_COUNT, field->calls);
+  }
+  // The executable reads the pid and opens each process once
+  calls = countCalls("executable");
+  opens = readCounter(&backend_process_open_count);
+  checkHarness(isProjectionOfEveryField("executable"), "--fields executable writes other keys or values than every field");
+  checkHarness(calls - walk_calls == TEST_WINDOW_COUNT + opens, "--fields executable makes %lld calls instead of %lld", (long long)(calls - walk_calls), (long long)(TEST_WINDOW_COUNT + opens));
+
+  // Attributes of filters are read for every window without being written, and read again for the windows written with them
+  runHarnessRequest("--desktop", "--where", "title ~ 'Chrome'", "--fields", "handle", "--format", "ndjson", NULL);
+  calls = readCounter(&backend_call_count);
+  checkHarness(output_length > 0 && strstr(output, "title") == NULL, "a filter on titles writes them");
+  checkHarness(expression_fetch_count == TEST_WINDOW_COUNT, "a filter on titles read %lld windows instead of %d", (long long)expression_fetch_count, TEST_WINDOW_COUNT);
+  written = countLines();
+  runHarnessRequest("--desktop", "--where", "title ~ 'Chrome'", "--fields", "handle,title", "--format", "ndjson", NULL);
+  checkHarness(readCounter(&backend_call_count) - calls == written, "writing the titles of %lld filtered windows makes %lld calls", (long long)written, (long long)(readCounter(&backend_call_count) - calls));
+  runHarnessRequest("--desktop", "--fields", "handle,nothing", NULL);
+  checkHarness(strncmp(output, "Error: Unknown field \"nothing\"", 30) == 0, "an unknown field is answered with \"%s\"", output);
+
+  free(every_field);
+  return finishHarness("fields");
+}
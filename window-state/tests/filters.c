@@ -0,0 +1,222 @@
+// Filter test: compares the windows selected by --pid and --class, which enumerate the windows of the threads of a process
+// and search a class, with the windows of the whole desktop filtered afterwards, and counts the calls made to the backend.
+//
+// The desktop has 50,000 generated windows like the figures of the readme. The windows of a process are spread over three
+// threads, so most processes merge the lists of several threads back in z-order with a walk that stops at their lowest
+// window, while processes with a single window thread are listed without it:
+//
+//   gcc -O2 -pthread ./tests/filters.c -o filters-test
+//   ./filters-test
+
+#include "harness.h"
+
+#define TEST_WINDOW_COUNT 50000
+#define TEST_PID_COUNT 200
+// Calls of a window written with its handle and checked against the filters, beyond the calls of its source
+#define TEST_WINDOW_CALLS 4
+
+typedef struct
+{
+  int64_t handle;
+  int64_t pid;
+  int64_t thread;
+  int64_t style;
+  char classname[SMALL_BUFFER_SIZE];
+} TestWindow;
+
+const char *test_classes[] = {"Chrome_WidgetWin_1", "chrome_widgetwin_1", "Notepad", "TaskManagerWindow", "ConsoleWindowClass", "Absent"};
+
+TestWindow *test_windows;
+int test_window_count = 0;
+uint64_t random_state = 88172645463325252ull;
+
+uint64_t nextRandom()
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+// Returns the value of a number key of an NDJSON line, zero when the line does not have the key
+int64_t findJsonNumber(const char *line, const char *end, const char *key)
+{
+  char pattern[64];
+  const char *position;
+  snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+  position = strstr(line, pattern);
+  if (position == NULL || position > end)
+    return 0;
+  return strtoll(position + strlen(pattern), NULL, 10);
+}
+
+// Lists every window in z-order with the attributes of the filters
+void readTestWindows()
+{
+  const char *line;
+  const char *end;
+  const char *position;
+  TestWindow *window;
+  size_t length;
+  runHarnessRequest("--desktop", "--fields", "handle,pid,thread,classname,style", "--format", "ndjson", NULL);
+  for (line = output; line != NULL && *line == '{' && test_window_count < TEST_WINDOW_COUNT; line = end + 1)
+  {
+    end = strchr(line, '\n');
+    if (end == NULL)
+      break;
+    window = &test_windows[test_window_count++];
+    window->handle = findJsonNumber(line, end, "handle");
+    window->pid = findJsonNumber(line, end, "pid");
+    window->thread = findJsonNumber(line, end, "thread");
+    window->style = findJsonNumber(line, end, "style");
+    window->classname[0] = '\0';
+    position = strstr(line, "\"classname\": \"");
+    if (position != NULL && position < end)
+    {
+      position += 14;
+      length = (size_t)(strchr(position, '"') - position);
+      length = length < SMALL_BUFFER_SIZE ? length : SMALL_BUFFER_SIZE - 1;
+      memcpy(window->classname, position, length);
+      window->classname[length] = '\0';
+    }
+  }
+}
+
+// Returns zero when the handles of the output are not those of the windows that match, in z-order, and counts the matches,
+// the position of the lowest one and whether they come from several threads
+int isSelectionLikeReference(int64_t pid, const char *classname, int64_t style, int *count, int *lowest, int *is_merged)
+{
+  const TestWindow *window;
+  const char *line = output;
+  int64_t thread = -1;
+  int i;
+  *count = 0;
+  *lowest = -1;
+  *is_merged = 0;
+  for (i = 0; i < test_window_count; i++)
+  {
+    window = &test_windows[i];
+    if ((pid >= 0 && window->pid != pid) || (classname != NULL && !isMatchingText(window->classname, classname)) || (window->style & style) != style)
+      continue;
+    if (line == NULL || strncmp(line, "{\"handle\": ", 11) != 0 || strtoll(line + 11, NULL, 10) != window->handle)
+      return 0;
+    line = strchr(line, '\n');
+    line = line != NULL ? line + 1 : NULL;
+    (*count)++;
+    *lowest = i;
+    *is_merged |= thread >= 0 && thread != window->thread;
+    thread = window->thread;
+  }
+  return line != NULL && *line == '\0';
+}
+
+// Returns the fastest time of a request, in microseconds
+double measureRequest(const char *option, const char *value)
+{
+  int64_t best = 0;
+  int64_t start;
+  int64_t elapsed;
+  int i;
+  for (i = 0; i < 5; i++)
+  {
+    start = getClockNanoseconds();
+    runHarnessRequest(option, value, "--fields", "handle", "--format", "ndjson", NULL);
+    elapsed = getClockNanoseconds() - start;
+    best = best == 0 || elapsed < best ? elapsed : best;
+  }
+  return best / 1e3;
+}
+
+// Returns the fastest time of listing the pid and class of every window and filtering them afterwards, in microseconds
+double measureListThenFilter(int64_t pid)
+{
+  int64_t best = 0;
+  int64_t start;
+  int64_t elapsed;
+  volatile int count = 0;
+  const char *line;
+  int i;
+  for (i = 0; i < 5; i++)
+  {
+    start = getClockNanoseconds();
+    runHarnessRequest("--desktop", "--fields", "handle,pid,classname", "--format", "ndjson", NULL);
+    for (line = output; line != NULL && *line == '{'; line = strchr(line, '\n'), line = line != NULL ? line + 1 : NULL)
+      count += findJsonNumber(line, strchr(line, '\n'), "pid") == pid;
+    elapsed = getClockNanoseconds() - start;
+    best = best == 0 || elapsed < best ? elapsed : best;
+  }
+  return best / 1e3;
+}
+
+int main(int argn, char **argv)
+{
+  char count_text[32];
+  char pid_text[32];
+  int64_t pid;
+  int64_t calls;
+  int64_t source_calls;
+  int64_t single_calls = 0;
+  int64_t merged_calls = 0;
+  int single_count = 0;
+  int merged_count = 0;
+  int count;
+  int lowest;
+  int is_merged;
+  int i;
+  test_windows = (TestWindow *)malloc(sizeof(TestWindow) * TEST_WINDOW_COUNT);
+  if (test_windows == NULL)
+    return 1;
+  snprintf(count_text, sizeof(count_text), "%d", TEST_WINDOW_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", count_text);
+  initHarness();
+
+  readTestWindows();
+  checkHarness(test_window_count == TEST_WINDOW_COUNT, "%d windows are listed instead of %d", test_window_count, TEST_WINDOW_COUNT);
+  for (i = 0; i < TEST_PID_COUNT; i++)
+  {
+    pid = i == 0 ? 999 : i == 1 ? test_windows[TEST_WINDOW_COUNT - 1].pid : test_windows[nextRandom() % TEST_WINDOW_COUNT].pid;
+    snprintf(pid_text, sizeof(pid_text), "%lld", (long long)pid);
+    runHarnessRequest("--pid", pid_text, "--fields", "handle", "--format", "ndjson", NULL);
+    calls = readCounter(&backend_call_count);
+    if (!checkHarness(isSelectionLikeReference(pid, NULL, 0, &count, &lowest, &is_merged), "--pid %lld differs from the filtered desktop", (long long)pid))
+      continue;
+    // The threads of the process are listed, then the walk of several threads reads every handle down to the lowest window
+    source_calls = calls - (int64_t)TEST_WINDOW_CALLS * count;
+    if (is_merged)
+    {
+      checkHarness(source_calls <= 4 + lowest + 2, "--pid %lld makes %lld calls to list %d windows down to position %d", (long long)pid, (long long)calls, count, lowest);
+      merged_calls += calls;
+      merged_count++;
+    }
+    else
+    {
+      checkHarness(source_calls <= 4, "--pid %lld makes %lld calls to list %d windows of one thread", (long long)pid, (long long)calls, count);
+      single_calls += calls;
+      single_count++;
+    }
+    runHarnessRequest("--pid", pid_text, "--style", "268435456", "--fields", "handle", "--format", "ndjson", NULL);
+    checkHarness(isSelectionLikeReference(pid, NULL, 268435456, &count, &lowest, &is_merged), "--pid %lld --style differs from the filtered desktop", (long long)pid);
+    runHarnessRequest("--pid", pid_text, "--class", "notepad", "--fields", "handle", "--format", "ndjson", NULL);
+    checkHarness(isSelectionLikeReference(pid, "notepad", 0, &count, &lowest, &is_merged), "--pid %lld --class differs from the filtered desktop", (long long)pid);
+  }
+  checkHarness(single_count > 0 && merged_count > 0, "%d processes have one window thread and %d several", single_count, merged_count);
+  for (i = 0; i < (int)(sizeof(test_classes) / sizeof(test_classes[0])); i++)
+  {
+    runHarnessRequest("--class", test_classes[i], "--fields", "handle", "--format", "ndjson", NULL);
+    calls = readCounter(&backend_call_count);
+    if (!checkHarness(isSelectionLikeReference(-1, test_classes[i], 0, &count, &lowest, &is_merged), "--class %s differs from the filtered desktop", test_classes[i]))
+      continue;
+    // Each search is one call that returns the next window of the class
+    checkHarness(calls <= (int64_t)(TEST_WINDOW_CALLS + 1) * count + 2, "--class %s makes %lld calls to list %d windows", test_classes[i], (long long)calls, count);
+    runHarnessRequest("--desktop", "--class", test_classes[i], "--style", "268435456", "--fields", "handle", "--format", "ndjson", NULL);
+    checkHarness(isSelectionLikeReference(-1, test_classes[i], 268435456, &count, &lowest, &is_merged), "--desktop --class %s --style differs from the filtered desktop", test_classes[i]);
+  }
+
+  pid = test_windows[TEST_WINDOW_COUNT / 2].pid;
+  snprintf(pid_text, sizeof(pid_text), "%lld", (long long)pid);
+  printf("windows: %d, calls of --pid: %.1f with one window thread, %.1f with several (%d and %d processes)\n", test_window_count, single_count > 0 ? (double)single_calls / single_count : 0.0, merged_count > 0 ? (double)merged_calls / merged_count : 0.0, single_count, merged_count);
+  printf("--pid of a window in the middle: %.1f us, every pid and class listed and filtered: %.1f us\n", measureRequest("--pid", pid_text), measureListThenFilter(pid));
+  printf("--class TaskManagerWindow: %.1f us\n", measureRequest("--class", "TaskManagerWindow"));
+  free(test_windows);
+  return finishHarness("filters");
+}
@@ -0,0 +1,347 @@
+// Focus test: records the foreground changes of a script of the in-memory backend with --record-focus and compares the
+// records of --focus-history with a model of the script, then reads a ring that wrapped and a ring written by another
+// process while it is read.
+//
+// The script focuses windows, renames the focused window and others, destroys the focused window and waits between some
+// steps. A record must be written for each change of the foreground window or of its title and for nothing else, with the
+// pid and title hash of its window and a duration of at least the waits until the next change. --focus-since must skip the
+// records of the windows that lost the focus before its time. A ring written past its capacity must return its last
+// records, and a reader lapped by a writer must skip the records overwritten while they were read and return the others
+// unchanged and in order:
+//
+//   gcc -O2 -pthread ./tests/focus.c -o focus-test
+//   ./focus-test
+
+#include "harness.h"
+#include <signal.h>
+#include <sys/wait.h>
+
+#define TEST_TOP_COUNT 40
+#define TEST_STEP_COUNT 400
+#define TEST_RECORD_COUNT (TEST_STEP_COUNT + 1)
+#define TEST_TITLE_SIZE 64
+#define TEST_LAP_READ_COUNT 50
+
+typedef struct
+{
+  int64_t handle;
+  uint32_t pid;
+  uint32_t title_hash;
+  // Milliseconds waited from this record to the next one
+  int64_t wait;
+} TestRecord;
+
+HWND tops[TEST_TOP_COUNT];
+DWORD top_pids[TEST_TOP_COUNT];
+char titles[TEST_TOP_COUNT][TEST_TITLE_SIZE];
+int is_alive[TEST_TOP_COUNT];
+TestRecord expected[TEST_RECORD_COUNT];
+int expected_count = 0;
+char script_path[64];
+char ring_path[64];
+char lap_path[64];
+uint64_t random_state = 88172645463325252ull;
+
+uint64_t nextRandom()
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+// Appends the expected record of a foreground window when it or its title changed
+void expectForeground(int top)
+{
+  TestRecord record;
+  record.handle = top < 0 ? 0 : (int64_t)(intptr_t)tops[top];
+  record.pid = top < 0 ? 0 : (uint32_t)top_pids[top];
+  record.title_hash = top < 0 ? 0 : hashWatchTitle(titles[top], strlen(titles[top]));
+  record.wait = 0;
+  if (expected_count > 0 && expected[expected_count - 1].handle == record.handle && expected[expected_count - 1].title_hash == record.title_hash)
+    return;
+  expected[expected_count++] = record;
+}
+
+// Writes the script of the steps and the records it must produce
+int writeScript()
+{
+  FILE *file = fopen(script_path, "wb");
+  int foreground = -1;
+  int top;
+  int step;
+  int wait;
+  int i;
+  if (file == NULL)
+    return 0;
+  for (i = 0; i < TEST_TOP_COUNT; i++)
+    if (tops[i] == backendGetForegroundWindow())
+      foreground = i;
+  expectForeground(foreground);
+  for (step = 0; step < TEST_STEP_COUNT; step++)
+  {
+    wait = nextRandom() % 8 == 0 ? 1 + (int)(nextRandom() % 4) : 0;
+    if (wait > 0)
+      fprintf(file, "sleep %d\n", wait);
+    expected[expected_count - 1].wait += wait;
+    for (top = (int)(nextRandom() % TEST_TOP_COUNT); !is_alive[top]; top = (top + 1) % TEST_TOP_COUNT)
+    {
+    }
+    switch (nextRandom() % 10)
+    {
+    case 0:
+      // The focused window is renamed to the same title, which is no change
+      if (foreground >= 0 && titles[foreground][0] != '\0')
+        fprintf(file, "title %lld %s\n", (long long)(intptr_t)tops[foreground], titles[foreground]);
+      break;
+    case 1:
+    case 2:
+      if (foreground >= 0 && nextRandom() % 2 == 0)
+        top = foreground;
+      snprintf(titles[top], TEST_TITLE_SIZE, "Focus Title %d", step);
+      fprintf(file, "title %lld %s\n", (long long)(intptr_t)tops[top], titles[top]);
+      break;
+    case 3:
+      if (foreground >= 0 && step % 3 == 0)
+      {
+        fprintf(file, "destroy %lld\n", (long long)(intptr_t)tops[foreground]);
+        is_alive[foreground] = 0;
+        foreground = -1;
+      }
+      break;
+    default:
+      fprintf(file, "focus %lld\n", (long long)(intptr_t)tops[top]);
+      foreground = top;
+    }
+    fprintf(file, "tick\n");
+    expectForeground(foreground);
+  }
+  expected[expected_count - 1].wait = 0;
+  fclose(file);
+  return 1;
+}
+
+// Runs --record-focus on a script until its end in a child process, since recording is not available to served requests,
+// an empty path records the foreground window once, returns the exit code of the child
+int recordScript(const char *path, const char *ring)
+{
+  char *arguments[4] = {(char *)"window-state", (char *)"--record-focus", (char *)ring, NULL};
+  pid_t child;
+  int status = 0;
+  fflush(stdout);
+  child = fork();
+  if (child == 0)
+  {
+    setHarnessVariable("WINDOW_STATE_MEMORY_SCRIPT", path);
+    is_memory_script_opened = 0;
+    // The options of the requests run before the child are forgotten as in a new process
+    resetState();
+    _exit(runWindowState(3, arguments));
+  }
+  waitpid(child, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Returns the duration of a line of the history, -1 when it is null
+int64_t readDuration(const char *line)
+{
+  const char *position = strstr(line, "\"duration\": ") + 12;
+  return strncmp(position, "null", 4) == 0 ? -1 : strtoll(position, NULL, 10);
+}
+
+// Returns the number of records of the history that differ from the expected ones
+int countRecordDifferences()
+{
+  const char *line = output;
+  int64_t handle;
+  int64_t duration;
+  int count = 0;
+  int i;
+  for (i = 0; i < expected_count; i++, line = strchr(line, '\n') + 1)
+  {
+    if (strncmp(line, "{\"time\": ", 9) != 0 || strchr(line, '\n') == NULL)
+      return expected_count - i;
+    handle = strtoll(strstr(line, "\"handle\": ") + 10, NULL, 10);
+    duration = readDuration(line);
+    count += handle != expected[i].handle || strtoll(strstr(line, "\"pid\": ") + 7, NULL, 10) != expected[i].pid || strtoll(strstr(line, "\"title_hash\": ") + 14, NULL, 10) != expected[i].title_hash || (i + 1 < expected_count ? duration < expected[i].wait : duration != -1);
+  }
+  return count + (*line != '\0');
+}
+
+// Returns the lines of the full history whose window had the focus at or after a time
+size_t copyLinesSince(const char *history, int64_t since, char *lines)
+{
+  const char *line;
+  const char *next;
+  size_t length = 0;
+  for (line = history; *line != '\0'; line = next)
+  {
+    next = strchr(line, '\n') + 1;
+    if (*next == '\0' || strtoll(next + 9, NULL, 10) > since)
+    {
+      memcpy(&lines[length], line, (size_t)(next - line));
+      length += (size_t)(next - line);
+    }
+  }
+  lines[length] = '\0';
+  return length;
+}
+
+// Appends records numbered by their index until the process is stopped
+void writeLappingRecords()
+{
+  FocusMapping mapping;
+  FocusHeader *header;
+  int64_t index;
+  if (!openFocusMapping(&mapping, lap_path, 1))
+    _exit(1);
+  header = (FocusHeader *)mapping.view;
+  for (;;)
+  {
+    index = header->write_count;
+    appendFocusRecord(header, (HWND)(intptr_t)(index + 1), (DWORD)(index * 7), (uint32_t)index * 2654435761u);
+  }
+}
+
+// Returns zero when a history of numbered records has a record that differs from its index or is out of order, and adds
+// its records and skipped records to the counts
+int isLappedHistoryValid(int64_t *record_count, int64_t *skipped_count)
+{
+  const char *line;
+  int64_t previous = 0;
+  int64_t index;
+  for (line = output; strncmp(line, "{\"time\": ", 9) == 0; line = strchr(line, '\n') + 1)
+  {
+    index = strtoll(strstr(line, "\"handle\": ") + 10, NULL, 10) - 1;
+    // The record of the empty script is not numbered
+    if (index + 1 == (int64_t)(intptr_t)backendGetForegroundWindow() && previous == 0)
+      continue;
+    if (index <= previous || strtoll(strstr(line, "\"pid\": ") + 7, NULL, 10) != (uint32_t)(index * 7) || strtoll(strstr(line, "\"title_hash\": ") + 14, NULL, 10) != ((uint32_t)index * 2654435761u))
+      return 0;
+    // Only the last record has a null duration
+    if (readDuration(line) < (strchr(line, '\n')[1] == '\0' ? -1 : 0))
+      return 0;
+    previous = index;
+    (*record_count)++;
+  }
+  *skipped_count += focus_skipped_count;
+  return *line == '\0';
+}
+
+int main(int argn, char **argv)
+{
+  char *history;
+  char *lines;
+  const char *line;
+  char text[32];
+  FocusMapping mapping;
+  FocusHeader *header;
+  pid_t writer;
+  int64_t record_count = 0;
+  int64_t skipped_count = 0;
+  int64_t first;
+  int64_t start;
+  int64_t elapsed;
+  int64_t since;
+  size_t length;
+  HWND h;
+  int failures = 0;
+  int count = 0;
+  int i;
+  snprintf(text, sizeof(text), "%d", TEST_TOP_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", text);
+  initHarness();
+  snprintf(script_path, sizeof(script_path), "/tmp/window-state-focus-test-%d.txt", (int)getpid());
+  snprintf(ring_path, sizeof(ring_path), "/tmp/window-state-focus-test-%d.bin", (int)getpid());
+  snprintf(lap_path, sizeof(lap_path), "/tmp/window-state-focus-test-%d-lap.bin", (int)getpid());
+  remove(ring_path);
+  remove(lap_path);
+  for (h = backendGetFirstChild(NULL); h != NULL && count < TEST_TOP_COUNT; h = backendGetWindow(h, GW_HWNDNEXT), count++)
+  {
+    tops[count] = h;
+    backendGetWindowThreadProcessId(h, &top_pids[count]);
+    backendGetWindowText(h, titles[count], TEST_TITLE_SIZE);
+    is_alive[count] = 1;
+  }
+  if (!writeScript())
+    return 1;
+
+  // Records of the script
+  checkHarness(recordScript(script_path, ring_path) == 0, "--record-focus of the script fails");
+  runHarnessRequest("--focus-history", ring_path, "--format", "ndjson", NULL);
+  history = (char *)malloc(output_length + 1);
+  lines = (char *)malloc(output_length + 1);
+  if (history == NULL || lines == NULL)
+    return 1;
+  memcpy(history, output, output_length + 1);
+  failures = countRecordDifferences();
+  checkHarness(failures == 0, "%d of %d records of --focus-history differ from the script", failures, expected_count);
+  runHarnessRequest("--focus-history", ring_path, NULL);
+  checkHarness(output[0] == '[' && output[output_length - 1] == ']' && strstr(output, "}, {\"time\": ") != NULL, "--focus-history writes a JSON list as %.80s", output);
+
+  // Times between the first and the last record, then before the first and after the last
+  first = strtoll(history + 9, NULL, 10);
+  for (i = 0, failures = 0, line = history; i < expected_count; i++, line = strchr(line, '\n') + 1)
+  {
+    if (i % 37 != 0 && i != expected_count - 1)
+      continue;
+    since = strtoll(line + 9, NULL, 10) + (i % 2);
+    snprintf(text, sizeof(text), "%lld", (long long)since);
+    runHarnessRequest("--focus-history", ring_path, "--format", "ndjson", "--focus-since", text, NULL);
+    length = copyLinesSince(history, since, lines);
+    failures += output_length != length || memcmp(output, lines, length) != 0;
+  }
+  snprintf(text, sizeof(text), "%lld", (long long)(first - getWallClockMilliseconds() - 1000));
+  runHarnessRequest("--focus-history", ring_path, "--format", "ndjson", "--focus-since", text, NULL);
+  failures += strcmp(output, history) != 0;
+  checkHarness(failures == 0, "%d times of --focus-since select other records than the history", failures);
+
+  // A ring written past its capacity keeps its last records
+  if (recordScript("", lap_path) != 0 || !openFocusMapping(&mapping, lap_path, 1))
+    return 1;
+  header = (FocusHeader *)mapping.view;
+  for (i = 1; i < FOCUS_CAPACITY + 1000; i++)
+    appendFocusRecord(header, (HWND)(intptr_t)(i + 1), (DWORD)(i * 7), (uint32_t)i * 2654435761u);
+  closeFocusMapping(&mapping);
+  start = getClockNanoseconds();
+  runHarnessRequest("--focus-history", lap_path, "--format", "ndjson", NULL);
+  elapsed = getClockNanoseconds() - start;
+  record_count = 0;
+  checkHarness(isLappedHistoryValid(&record_count, &skipped_count) && record_count == FOCUS_CAPACITY && skipped_count == 0 && strtoll(output + 9, NULL, 10) > 0 && strtoll(strstr(output, "\"handle\": ") + 10, NULL, 10) == 1001, "a ring written past its capacity returns %lld records, %lld skipped", (long long)record_count, (long long)skipped_count);
+  printf("full ring: %d records read in %.2f ms", FOCUS_CAPACITY, elapsed / 1e6);
+
+  // Readers lapped by another process
+  fflush(stdout);
+  writer = fork();
+  if (writer == 0)
+    writeLappingRecords();
+  sleepThread(10);
+  record_count = 0;
+  skipped_count = 0;
+  for (i = 0, failures = 0; i < TEST_LAP_READ_COUNT; i++)
+  {
+    runHarnessRequest("--focus-history", lap_path, "--format", "ndjson", NULL);
+    failures += !isLappedHistoryValid(&record_count, &skipped_count);
+  }
+  kill(writer, SIGKILL);
+  waitpid(writer, NULL, 0);
+  checkHarness(failures == 0, "%d of %d lapped readings return records that differ from their index", failures, TEST_LAP_READ_COUNT);
+  checkHarness(skipped_count > 0 && record_count > 0, "lapped readings return %lld records and skip %lld", (long long)record_count, (long long)skipped_count);
+  printf(", lapped readings: %lld records returned and %lld skipped in %d readings\n", (long long)record_count, (long long)skipped_count, TEST_LAP_READ_COUNT);
+
+  runHarnessRequest("--focus-history", ring_path, "--focus-since", "12x", NULL);
+  checkHarness(strncmp(output, "Error: Invalid focus history time", 33) == 0, "--focus-since 12x writes %.80s", output);
+  runHarnessRequest("--desktop", "--focus-since", "12", NULL);
+  checkHarness(strncmp(output, "Error: The --focus-since time only applies", 42) == 0, "--focus-since without history writes %.80s", output);
+  runHarnessRequest("--focus-history", script_path, NULL);
+  checkHarness(strncmp(output, "Error: Could not read the focus history file", 44) == 0, "--focus-history of another file writes %.80s", output);
+  runHarnessRequest("--record-focus", ring_path, NULL);
+  checkHarness(strncmp(output, "Error: Focus recording is not available in serve mode", 53) == 0, "--record-focus in serve mode writes %.80s", output);
+
+  remove(script_path);
+  remove(ring_path);
+  remove(lap_path);
+  free(lines);
+  free(history);
+  return finishHarness("focus");
+}
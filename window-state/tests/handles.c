@@ -0,0 +1,275 @@
+// Handle stream test: writes a file of 100,000 handle lines for --handles-from and compares the output with the windows,
+// errors and counters expected from the lines, then checks that results are written while the handles are still read.
+//
+// The lines mix handles of the 60,000 generated windows in decimal and hexadecimal, repeated handles, handles of no
+// window, comments, blank lines and lines that are not handles. Every window must be written once in the order of its first
+// line, and every other line reported in place without stopping the stream. A child process then reads handles from a pipe
+// and must answer each before the next is written:
+//
+//   gcc -O2 -pthread ./tests/handles.c -o handles-test
+//   ./handles-test
+
+#include "harness.h"
+
+#include <poll.h>
+#include <sys/wait.h>
+
+#define TEST_TOP_COUNT 20000
+#define TEST_LINE_COUNT 100000
+#define TEST_MISSING_COUNT 50
+#define TEST_STREAM_COUNT 100
+#define TEST_REQUEST_HANDLES 15
+
+const char *invalid_lines[] = {"abc", "12x", "-5", "0", "0x", "99999999999999999999", "65552 65554", "0x1g"};
+
+char file_path[256];
+char *expected;
+size_t expected_length = 0;
+int64_t expected_read = 0;
+int64_t expected_duplicates = 0;
+int64_t expected_invalid = 0;
+uint64_t random_state = 88172645463325252ull;
+
+uint64_t nextRandom()
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+void expectLine(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  expected_length += (size_t)vsprintf(&expected[expected_length], format, args);
+  va_end(args);
+}
+
+// Expects the line of a window, or a duplicate when its handle was already read
+void expectWindow(int64_t handle, char *is_read)
+{
+  DWORD pid = 0;
+  expected_read++;
+  if (*is_read)
+  {
+    expected_duplicates++;
+    return;
+  }
+  *is_read = 1;
+  backendGetWindowThreadProcessId((HWND)(intptr_t)handle, &pid);
+  expectLine("{\"handle\": %lld, \"pid\": %lu}\n", (long long)handle, (unsigned long)pid);
+}
+
+// Writes the lines of the handle file and the output expected for them
+int writeHandleFile(const char *path, int line_count)
+{
+  char *is_window_read = (char *)calloc((size_t)memory_window_count, 1);
+  char is_missing_read[TEST_MISSING_COUNT];
+  int64_t missing[TEST_MISSING_COUNT];
+  int64_t handle;
+  uint64_t kind;
+  int index;
+  int i;
+  FILE *file = fopen(path, "wb");
+  if (file == NULL || is_window_read == NULL)
+    return 0;
+  // Handles between the windows, past the last one and far from them
+  for (i = 0; i < TEST_MISSING_COUNT; i++)
+  {
+    missing[i] = i % 3 == 0 ? (int64_t)(intptr_t)memoryGetHandle(i * 7) + 1 : i % 3 == 1 ? (int64_t)(intptr_t)memoryGetHandle(memory_window_count - 1) + 2 * (i + 1) : 999 + i;
+    is_missing_read[i] = 0;
+  }
+  expected_length = 0;
+  for (i = 1; i <= line_count; i++)
+  {
+    kind = nextRandom() % 100;
+    if (kind < 80)
+    {
+      // Some windows are read many times
+      index = (int)(kind < 20 ? nextRandom() % 100 : nextRandom() % (uint64_t)memory_window_count);
+      handle = (int64_t)(intptr_t)memoryGetHandle(index);
+      fprintf(file, kind % 3 == 0 ? "0x%llx\n" : kind % 3 == 1 ? "  %lld \r\n" : "%lld\n", (long long)handle);
+      expectWindow(handle, &is_window_read[index]);
+    }
+    else if (kind < 88)
+    {
+      index = (int)(nextRandom() % TEST_MISSING_COUNT);
+      fprintf(file, "%lld\n", (long long)missing[index]);
+      expected_read++;
+      if (is_missing_read[index])
+        expected_duplicates++;
+      else
+      {
+        expectLine("{\"handle\": %lld, \"error\": \"not found\"}\n", (long long)missing[index]);
+        expected_invalid++;
+      }
+      is_missing_read[index] = 1;
+    }
+    else if (kind < 94)
+    {
+      fprintf(file, kind % 2 == 0 ? "# comment %d\n" : "\n", i);
+    }
+    else
+    {
+      // A line longer than the buffer is cut and read as a single invalid line
+      if (kind == 99)
+        fprintf(file, "%0200d\n", 1);
+      else
+        fprintf(file, "%s\n", invalid_lines[nextRandom() % (sizeof(invalid_lines) / sizeof(invalid_lines[0]))]);
+      expectLine("{\"line\": %d, \"error\": \"invalid handle\"}\n", i);
+      expected_read++;
+      expected_invalid++;
+    }
+  }
+  expected[expected_length] = '\0';
+  fclose(file);
+  free(is_window_read);
+  return 1;
+}
+
+// Reads a line of a child process with a timeout, returns zero when none came
+int readChildLine(int descriptor, char *line, size_t size)
+{
+  struct pollfd poll_descriptor;
+  size_t length = 0;
+  poll_descriptor.fd = descriptor;
+  poll_descriptor.events = POLLIN;
+  while (length + 1 < size)
+  {
+    if (poll(&poll_descriptor, 1, 5000) <= 0 || read(descriptor, &line[length], 1) != 1)
+      return 0;
+    if (line[length++] == '\n')
+      break;
+  }
+  line[length] = '\0';
+  return 1;
+}
+
+// Writes handles to a child process one at a time and returns the number of them answered before the next was written
+int countStreamedAnswers()
+{
+  char *arguments[] = {(char *)"window-state", (char *)"--handles-from", (char *)"-", (char *)"--fields", (char *)"handle", (char *)"--format", (char *)"ndjson", NULL};
+  char line[256];
+  char answer[256];
+  int input[2];
+  int answers[2];
+  int count = 0;
+  int status;
+  int i;
+  pid_t child;
+  if (pipe(input) != 0 || pipe(answers) != 0)
+    return 0;
+  child = fork();
+  if (child == 0)
+  {
+    dup2(input[0], 0);
+    dup2(answers[1], 1);
+    close(input[1]);
+    close(answers[0]);
+    status = runWindowState(7, arguments);
+    fflush(stdout);
+    _exit(status);
+  }
+  close(input[0]);
+  close(answers[1]);
+  for (i = 0; i < TEST_STREAM_COUNT; i++)
+  {
+    // Every fourth line is a handle of no window
+    snprintf(line, sizeof(line), "%lld\n", (long long)(intptr_t)memoryGetHandle(i * 5) + (i % 4 == 3 ? 1 : 0));
+    if (write(input[1], line, strlen(line)) != (ssize_t)strlen(line) || !readChildLine(answers[0], answer, sizeof(answer)))
+      break;
+    line[strlen(line) - 1] = '\0';
+    if (strncmp(answer, "{\"handle\": ", 11) != 0 || strncmp(answer + 11, line, strlen(line)) != 0 || (strstr(answer, "not found") != NULL) != (i % 4 == 3))
+      break;
+    count++;
+  }
+  close(input[1]);
+  waitpid(child, &status, 0);
+  close(answers[0]);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? count : 0;
+}
+
+int main(int argn, char **argv)
+{
+  const char *arguments[2 * TEST_REQUEST_HANDLES];
+  char handle_texts[TEST_REQUEST_HANDLES][32];
+  char text[64];
+  char line_text[96];
+  int64_t start;
+  int64_t stream_time;
+  int64_t request_time;
+  size_t lines = 0;
+  size_t position;
+  int answered;
+  int code;
+  int i;
+  int j;
+  snprintf(file_path, sizeof(file_path), "/tmp/window-state-handles-test-%d.txt", (int)getpid());
+  snprintf(text, sizeof(text), "%d", TEST_TOP_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", text);
+  initHarness();
+  runHarnessRequest("--desktop", "--fields", "handle", NULL);
+  expected = (char *)malloc((size_t)TEST_LINE_COUNT * 64);
+  if (expected == NULL || !writeHandleFile(file_path, TEST_LINE_COUNT))
+    return 1;
+
+  start = getClockNanoseconds();
+  code = runHarnessRequest("--handles-from", file_path, "--fields", "handle,pid", "--format", "ndjson", NULL);
+  stream_time = getClockNanoseconds() - start;
+  checkHarness(code == 0, "--handles-from of %d lines exits with %d", TEST_LINE_COUNT, code);
+  checkHarness(output_length == expected_length && memcmp(output, expected, expected_length) == 0, "--handles-from writes %zu bytes that differ from the %zu bytes expected", output_length, expected_length);
+  checkHarness(handle_read_count == expected_read && handle_duplicate_count == expected_duplicates && handle_invalid_count == expected_invalid, "--handles-from counts %lld read, %lld duplicates and %lld invalid instead of %lld, %lld and %lld", (long long)handle_read_count, (long long)handle_duplicate_count, (long long)handle_invalid_count, (long long)expected_read, (long long)expected_duplicates, (long long)expected_invalid);
+  for (position = 0; position < expected_length; position++)
+    lines += expected[position] == '\n';
+
+  // The JSON format writes the same objects in a list
+  runHarnessRequest("--handles-from", file_path, "--fields", "handle,pid", NULL);
+  for (position = 0, i = 0; i < (int)output_length && output[0] == '[' && position < expected_length; position++)
+  {
+    if (expected[position] == '\n')
+    {
+      if (position + 1 < expected_length && strncmp(&output[i + 1], ", ", 2) != 0)
+        break;
+      i += 2;
+      continue;
+    }
+    if (output[++i] != expected[position])
+      break;
+  }
+  checkHarness(position == expected_length && output[output_length - 1] == ']', "--handles-from in JSON differs from the NDJSON lines at byte %d", i);
+
+  // Handles of --handle are read first and count as read for the stream
+  snprintf(text, sizeof(text), "%lld", (long long)(intptr_t)memoryGetHandle(0));
+  runHarnessRequest("--handle", text, "--handles-from", file_path, "--fields", "handle,pid", "--format", "ndjson", NULL);
+  snprintf(line_text, sizeof(line_text), "{\"handle\": %s, ", text);
+  checkHarness(strncmp(output, line_text, strlen(line_text)) == 0 && strstr(output + 1, line_text) == NULL && handle_read_count == expected_read + 1, "--handle with --handles-from does not list its window first and once");
+  runHarnessRequest("--handles-from", file_path, "--fields", "handle", "--format", "ndjson", "--pid", "1000", NULL);
+  for (position = 0, j = 0; output[position] != '\0'; position++)
+    j += output[position] == '\n';
+  checkHarness(j > 0 && j < (int)lines && strstr(output, "\"error\"") != NULL, "--handles-from with --pid writes %d of %zu lines", j, lines);
+  runHarnessRequest("--handles-from", "/nonexistent/handles.txt", NULL);
+  checkHarness(strncmp(output, "Error: Could not open handle file", 33) == 0, "a missing handle file is answered with \"%s\"", output);
+
+  answered = countStreamedAnswers();
+  checkHarness(answered == TEST_STREAM_COUNT, "%d of %d handles written to a pipe are answered before the next one", answered, TEST_STREAM_COUNT);
+
+  // The same windows asked with requests of --handle arguments
+  start = getClockNanoseconds();
+  for (i = 0; i + TEST_REQUEST_HANDLES <= TEST_LINE_COUNT; i += TEST_REQUEST_HANDLES)
+  {
+    for (j = 0; j < TEST_REQUEST_HANDLES; j++)
+    {
+      snprintf(handle_texts[j], sizeof(handle_texts[j]), "%lld", (long long)(intptr_t)memoryGetHandle((i + j) % memory_window_count));
+      arguments[2 * j] = "--handle";
+      arguments[2 * j + 1] = handle_texts[j];
+    }
+    runHarnessRequest(arguments[0], arguments[1], arguments[2], arguments[3], arguments[4], arguments[5], arguments[6], arguments[7], arguments[8], arguments[9], arguments[10], arguments[11], arguments[12], arguments[13], arguments[14], arguments[15], arguments[16], arguments[17], arguments[18], arguments[19], arguments[20], arguments[21], arguments[22], arguments[23], arguments[24], arguments[25], arguments[26], arguments[27], arguments[28], arguments[29], "--fields", "handle,pid", NULL);
+  }
+  request_time = getClockNanoseconds() - start;
+  printf("%d lines, %zu written (%lld duplicates, %lld invalid): %.1f ms with --handles-from, %.1f ms with requests of %d --handle\n", TEST_LINE_COUNT, lines, (long long)expected_duplicates, (long long)expected_invalid, stream_time / 1e6, request_time / 1e6, TEST_REQUEST_HANDLES);
+
+  remove(file_path);
+  free(expected);
+  return finishHarness("handles");
+}
@@ -0,0 +1,95 @@
+// Test harness: compiles the program into a test with its entry point renamed, so that the test calls its functions and
+// runs requests in the same process as serve mode does, against the in-memory backend.
+//
+// A test is built from the window-state directory with the same line as the program:
+//
+//   gcc -O2 -pthread ./tests/expression.c -o expression-test
+
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <stdarg.h>
+
+#define main runWindowState
+#include "../main.c"
+#undef main
+
+#define HARNESS_ARGUMENT_COUNT 32
+
+int harness_check_count = 0;
+int harness_failure_count = 0;
+char harness_arguments[HARNESS_ARGUMENT_COUNT][BUFFER_SIZE];
+
+// Counts a check and writes its message to stderr when it fails, returns the condition
+int checkHarness(int condition, const char *format, ...)
+{
+  va_list args;
+  harness_check_count++;
+  if (condition)
+    return 1;
+  harness_failure_count++;
+  fprintf(stderr, "FAIL: ");
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fprintf(stderr, "\n");
+  return 0;
+}
+
+// Sets a variable of the in-memory backend, before the first request reads the desktop
+void setHarnessVariable(const char *name, const char *value)
+{
+#if defined(_WIN32)
+  _putenv_s(name, value);
+#else
+  setenv(name, value, 1);
+#endif
+}
+
+void initHarness()
+{
+  initJsonWriter(&output_writer, NULL, 0, emitOutputBytes);
+  initMutex(&process_cache_mutex);
+  initMutex(&stats_mutex);
+  initFetch();
+}
+
+// Executes the arguments that follow until a NULL one as a served request, the output is left in output and
+// output_length with a null character after it, returns the exit code
+int runHarnessRequest(const char *argument, ...)
+{
+  char *argv[HARNESS_ARGUMENT_COUNT + 2];
+  int argn = 0;
+  int code;
+  va_list args;
+  argv[argn++] = (char *)"window-state";
+  va_start(args, argument);
+  for (; argument != NULL && argn <= HARNESS_ARGUMENT_COUNT; argument = va_arg(args, const char *))
+  {
+    // Requests may parse their arguments in place, so they are copied like the arguments of a request line
+    snprintf(harness_arguments[argn - 1], BUFFER_SIZE, "%s", argument);
+    argv[argn] = harness_arguments[argn - 1];
+    argn++;
+  }
+  va_end(args);
+  argv[argn] = NULL;
+  waitFetchWorkers();
+  resetState();
+  is_output_captured = 1;
+  output_length = 0;
+  code = executeArguments(argn, argv);
+  flushJsonWriter(&output_writer);
+  is_output_captured = 0;
+  if (output != NULL)
+    output[output_length] = '\0';
+  return code;
+}
+
+// Writes the number of checks and failures, returns the exit code of the test
+int finishHarness(const char *name)
+{
+  printf("%s: %d checks, %d failed\n", name, harness_check_count, harness_failure_count);
+  return harness_failure_count > 0 ? 1 : 0;
+}
+
+#endif
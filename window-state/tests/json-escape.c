@@ -0,0 +1,318 @@
+// JSON escape test: compares the strings written by the shared JSON writer, whose runs of plain characters are found 16 or
+// 32 bytes at a time, with a byte-by-byte escaper over random texts of every length and alignment, then measures both.
+//
+// The texts favor the characters that must be escaped and the bytes next to them (0x1F, 0x20, 0x7F, 0x80, 0xFF), and the
+// chunk of the writer is kept small so that it is flushed in the middle of a text. Bytes that are not valid UTF-8 must be
+// written as \ufffd, the reference decodes each code point to find them, and a list of invalid sequences checks the edges
+// of RFC 3629. Building with -mavx2 tests the AVX2 scan instead of the SSE2 one:
+//
+//   gcc -O2 -pthread ./tests/json-escape.c -o json-escape-test
+//   ./json-escape-test
+
+#include "harness.h"
+
+#define ESCAPE_CASE_COUNT 200000
+#define ESCAPE_TEXT_SIZE 4096
+#define ESCAPE_BENCHMARK_SIZE (1024 * 1024)
+#define ESCAPE_BENCHMARK_BYTES ((int64_t)512 * 1024 * 1024)
+
+char *escaped = NULL;
+size_t escaped_length = 0;
+size_t escaped_size = 0;
+uint64_t random_state = 88172645463325252ull;
+
+uint64_t nextRandom()
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+void collectEscaped(const char *data, size_t length)
+{
+  if (escaped_length + length > escaped_size)
+  {
+    while (escaped_length + length > escaped_size)
+      escaped_size = escaped_size == 0 ? 64 * 1024 : escaped_size * 2;
+    escaped = (char *)realloc(escaped, escaped_size);
+  }
+  memcpy(&escaped[escaped_length], data, length);
+  escaped_length += length;
+}
+
+void discardEscaped(const char *data, size_t length)
+{
+  escaped_length += length;
+}
+
+// Returns the length of the UTF-8 sequence at a position by decoding its code point, zero when the sequence is cut, overlong,
+// a surrogate or above U+10FFFF
+size_t decodeReference(const unsigned char *text, size_t length, size_t i)
+{
+  size_t count = text[i] >= 0xF0 ? 4 : text[i] >= 0xE0 ? 3 : 2;
+  uint32_t code = text[i] & (0x7F >> count);
+  size_t j;
+  if (text[i] < 0xC0 || text[i] >= 0xF8)
+    return 0;
+  for (j = 1; j < count; j++)
+  {
+    if (i + j >= length || (text[i + j] & 0xC0) != 0x80)
+      return 0;
+    code = (code << 6) | (text[i + j] & 0x3F);
+  }
+  if (code < (count == 2 ? 0x80u : count == 3 ? 0x800u : 0x10000u) || (code >= 0xD800 && code <= 0xDFFF) || code > 0x10FFFF)
+    return 0;
+  return count;
+}
+
+// Escapes a text one byte at a time as RFC 8259 describes, returns the length written
+size_t escapeReference(const unsigned char *text, size_t length, char *result)
+{
+  size_t count = 0;
+  size_t sequence;
+  size_t i;
+  unsigned char c;
+  for (i = 0; i < length; i++)
+  {
+    c = text[i];
+    if (c >= 0x80)
+    {
+      sequence = decodeReference(text, length, i);
+      if (sequence == 0)
+      {
+        memcpy(&result[count], "\\ufffd", 6);
+        count += 6;
+        continue;
+      }
+      memcpy(&result[count], &text[i], sequence);
+      count += sequence;
+      i += sequence - 1;
+    }
+    else if (c == '"' || c == '\\')
+    {
+      result[count++] = '\\';
+      result[count++] = (char)c;
+    }
+    else if (c == '\b' || c == '\f' || c == '\n' || c == '\r' || c == '\t')
+    {
+      result[count++] = '\\';
+      result[count++] = c == '\b' ? 'b' : c == '\f' ? 'f' : c == '\n' ? 'n' : c == '\r' ? 'r' : 't';
+    }
+    else if (c < 0x20)
+    {
+      count += (size_t)sprintf(&result[count], "\\u%04x", c);
+    }
+    else
+    {
+      result[count++] = (char)c;
+    }
+  }
+  return count;
+}
+
+// Fills a text with one of four mixes: any byte, plain text with rare escapes, only escapes and their neighbors, UTF-8
+void fillText(unsigned char *text, size_t length, int mix)
+{
+  static const unsigned char edges[] = {0x00, 0x08, 0x09, 0x0A, 0x1F, 0x20, '"', '\\', 0x7F, 0x80, 0xC3, 0xFF};
+  static const char *words[] = {"Caf\xC3\xA9", "\xE2\x80\x94", "\xF0\x9F\x93\x81", "Stra\xC3\x9F" "e", "\xE6\x97\xA5\xE6\x9C\xAC"};
+  size_t i = 0;
+  size_t word_length;
+  uint64_t value;
+  while (i < length)
+  {
+    value = nextRandom();
+    if (mix == 0)
+    {
+      text[i++] = (unsigned char)value;
+    }
+    else if (mix == 1)
+    {
+      text[i++] = value % 64 == 0 ? edges[(value >> 8) % sizeof(edges)] : (unsigned char)(' ' + (value >> 16) % 95);
+    }
+    else if (mix == 2)
+    {
+      text[i++] = edges[(value >> 8) % sizeof(edges)];
+    }
+    else
+    {
+      word_length = strlen(words[(value >> 8) % 5]);
+      if (value % 4 != 0 || i + word_length > length)
+        text[i++] = (unsigned char)('a' + (value >> 16) % 26);
+      else
+      {
+        memcpy(&text[i], words[(value >> 8) % 5], word_length);
+        i += word_length;
+      }
+    }
+  }
+}
+
+// Returns zero when the writer escapes a text differently from the reference
+int isEscapedLikeReference(const unsigned char *text, size_t length, size_t chunk_size, char *expected)
+{
+  JsonWriter writer;
+  size_t expected_length = escapeReference(text, length, expected);
+  initJsonWriter(&writer, NULL, chunk_size, collectEscaped);
+  escaped_length = 0;
+  putJsonEscaped(&writer, (const char *)text, length);
+  flushJsonWriter(&writer);
+  freeJsonWriter(&writer);
+  return escaped_length == expected_length && memcmp(escaped, expected, expected_length) == 0;
+}
+
+// Returns zero when the writer does not escape a text as expected
+int isEscapedAs(const char *text, const char *expected)
+{
+  JsonWriter writer;
+  initJsonWriter(&writer, NULL, 64, collectEscaped);
+  escaped_length = 0;
+  putJsonEscaped(&writer, text, strlen(text));
+  flushJsonWriter(&writer);
+  freeJsonWriter(&writer);
+  return escaped_length == strlen(expected) && memcmp(escaped, expected, escaped_length) == 0;
+}
+
+// Returns zero when findJsonEscape skips a character to escape from any start position
+int isScanLikeReference(const unsigned char *text, size_t length)
+{
+  size_t start;
+  size_t expected = length;
+  size_t i;
+  for (start = length + 1; start-- > 0;)
+  {
+    if (start < length && json_escape_table[text[start]] != 0)
+      expected = start;
+    i = findJsonEscape((const char *)text, length, start);
+    if (i != expected)
+      return 0;
+  }
+  return 1;
+}
+
+// Returns the throughput of the fastest of several passes over a text, in megabytes of text per second
+double measureEscaping(const unsigned char *text, size_t length, char *expected, int is_reference)
+{
+  JsonWriter writer;
+  int64_t best = 0;
+  int64_t start;
+  int64_t elapsed;
+  int64_t processed;
+  int pass;
+  for (pass = 0; pass < 5; pass++)
+  {
+    initJsonWriter(&writer, NULL, 0, discardEscaped);
+    start = getClockNanoseconds();
+    for (processed = 0; processed < ESCAPE_BENCHMARK_BYTES / 5; processed += (int64_t)length)
+    {
+      if (is_reference)
+        escaped_length += escapeReference(text, length, expected);
+      else
+        putJsonEscaped(&writer, (const char *)text, length);
+    }
+    flushJsonWriter(&writer);
+    elapsed = getClockNanoseconds() - start;
+    freeJsonWriter(&writer);
+    best = best == 0 || elapsed < best ? elapsed : best;
+  }
+  return (double)(ESCAPE_BENCHMARK_BYTES / 5) / 1e6 / (best / 1e9);
+}
+
+int main(int argn, char **argv)
+{
+  static const char *mixes[] = {"any byte", "text", "escapes", "utf-8"};
+  unsigned char *buffer = (unsigned char *)malloc(ESCAPE_BENCHMARK_SIZE + 64);
+  char *expected = (char *)malloc(ESCAPE_BENCHMARK_SIZE * 6 + 64);
+  unsigned char *text;
+  size_t length;
+  size_t chunk_size;
+  int mix;
+  int i;
+#if defined(JSON_WRITER_AVX2)
+  printf("scan: avx2\n");
+#elif defined(JSON_WRITER_SSE2)
+  printf("scan: sse2\n");
+#else
+  printf("scan: bytes\n");
+#endif
+  if (buffer == NULL || expected == NULL)
+    return 1;
+  for (i = 0; i < ESCAPE_CASE_COUNT; i++)
+  {
+    // Most texts are as long as titles, some span many blocks
+    length = (size_t)(nextRandom() % (i % 16 == 0 ? ESCAPE_TEXT_SIZE : 100));
+    text = &buffer[nextRandom() % 64];
+    mix = (int)(nextRandom() % 4);
+    chunk_size = 16 + (size_t)(nextRandom() % 256);
+    fillText(text, length, mix);
+    if (!checkHarness(isEscapedLikeReference(text, length, chunk_size, expected), "%s text of %zu bytes at offset %d is escaped differently", mixes[mix], length, (int)(text - buffer)))
+      break;
+    if (i % 8 == 0 && !checkHarness(isScanLikeReference(text, length), "%s text of %zu bytes at offset %d is scanned differently", mixes[mix], length, (int)(text - buffer)))
+      break;
+  }
+  // A single character to escape at every position of a plain text, across the block boundaries
+  for (length = 0; length <= 96; length++)
+  {
+    for (i = 0; i <= (int)length; i++)
+    {
+      memset(buffer, 'a', length + 1);
+      buffer[i] = (unsigned char)(i % 2 == 0 ? '"' : 0x1F);
+      checkHarness(isEscapedLikeReference(buffer, length, 64, expected) && isScanLikeReference(buffer, length), "escape at %d of %zu bytes is missed", i, length);
+    }
+  }
+
+  // Sequences at the edges of RFC 3629: the shortest and longest forms, overlong forms, surrogates, code points above
+  // U+10FFFF, lone continuation bytes and sequences cut by another character or by the end of the text
+  {
+    static const char *cases[][2] = {
+        {"\xC2\x80", "\xC2\x80"},
+        {"\xDF\xBF", "\xDF\xBF"},
+        {"\xE0\xA0\x80", "\xE0\xA0\x80"},
+        {"\xED\x9F\xBF", "\xED\x9F\xBF"},
+        {"\xEF\xBF\xBF", "\xEF\xBF\xBF"},
+        {"\xF0\x90\x80\x80", "\xF0\x90\x80\x80"},
+        {"\xF4\x8F\xBF\xBF", "\xF4\x8F\xBF\xBF"},
+        {"\xC0\x80", "\\ufffd\\ufffd"},
+        {"\xC1\xBF", "\\ufffd\\ufffd"},
+        {"\xE0\x9F\xBF", "\\ufffd\\ufffd\\ufffd"},
+        {"\xED\xA0\x80", "\\ufffd\\ufffd\\ufffd"},
+        {"\xF0\x8F\xBF\xBF", "\\ufffd\\ufffd\\ufffd\\ufffd"},
+        {"\xF4\x90\x80\x80", "\\ufffd\\ufffd\\ufffd\\ufffd"},
+        {"\xF5\x80\x80\x80", "\\ufffd\\ufffd\\ufffd\\ufffd"},
+        {"\xFF", "\\ufffd"},
+        {"\x80" "a", "\\ufffda"},
+        {"a\xC3", "a\\ufffd"},
+        {"\xE2\x80", "\\ufffd\\ufffd"},
+        {"\xE2\x80\"", "\\ufffd\\ufffd\\\""},
+        {"\xF0\x9F\x93", "\\ufffd\\ufffd\\ufffd"},
+        {"Caf\xC3\xA9 \xE9t\xE9", "Caf\xC3\xA9 \\ufffdt\\ufffd"},
+    };
+    for (i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++)
+      checkHarness(isEscapedAs(cases[i][0], cases[i][1]) && isEscapedLikeReference((const unsigned char *)cases[i][0], strlen(cases[i][0]), 64, expected), "UTF-8 case %d is escaped differently", i);
+  }
+  // An invalid byte at every position of a plain text, across the block boundaries
+  for (length = 1; length <= 96; length++)
+  {
+    for (i = 0; i < (int)length; i++)
+    {
+      memset(buffer, 'a', length);
+      buffer[i] = 0xFF;
+      escaped_length = 0;
+      checkHarness(isEscapedLikeReference(buffer, length, 64, expected) && escaped_length == length + 5, "invalid byte at %d of %zu bytes is not replaced", i, length);
+    }
+  }
+
+  // Titles with rare escapes and UTF-8 titles
+  for (mix = 1; mix < 4; mix += 2)
+  {
+    fillText(buffer, ESCAPE_BENCHMARK_SIZE, mix);
+    printf("%s: writer %.0f MB/s, byte by byte %.0f MB/s\n", mixes[mix], measureEscaping(buffer, ESCAPE_BENCHMARK_SIZE, expected, 0), measureEscaping(buffer, ESCAPE_BENCHMARK_SIZE, expected, 1));
+  }
+  // Titles without any character to escape, the common case
+  memset(buffer, 'a', ESCAPE_BENCHMARK_SIZE);
+  printf("plain: writer %.0f MB/s, byte by byte %.0f MB/s\n", measureEscaping(buffer, ESCAPE_BENCHMARK_SIZE, expected, 0), measureEscaping(buffer, ESCAPE_BENCHMARK_SIZE, expected, 1));
+  free(buffer);
+  free(expected);
+  free(escaped);
+  return finishHarness("json-escape");
+}
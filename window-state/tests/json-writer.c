@@ -0,0 +1,342 @@
+// JSON writer test: compares the integers and window objects written by the shared JSON writer with those of the snprintf
+// chains the program used before it, checks the chunks it flushes and the buffers of the caller it fills, then measures both.
+//
+// The window objects are those of 2,000 generated windows with every field, a few of them renamed with characters to escape,
+// and their reference is written with snprintf and a byte-by-byte escaper as the program did. The writer must give the same
+// lines with chunks of any size, never write past a buffer of the caller, and flush a full chunk with a single call:
+//
+//   gcc -O2 -pthread ./tests/json-writer.c -o json-writer-test
+//   ./json-writer-test
+
+#include "harness.h"
+
+#define TEST_WINDOW_COUNT 2000
+#define TEST_INTEGER_COUNT 1000000
+#define TEST_BENCHMARK_OBJECTS 200000
+#define TEST_LINE_SIZE 4096
+
+typedef struct
+{
+  WindowRecord record;
+  char title[MIDDLE_BUFFER_SIZE];
+  char module[MIDDLE_BUFFER_SIZE];
+  char exec[MIDDLE_BUFFER_SIZE];
+  char class[MIDDLE_BUFFER_SIZE];
+} TestWindow;
+
+TestWindow *test_windows;
+int test_window_count = 0;
+char *collected = NULL;
+size_t collected_length = 0;
+size_t collected_size = 0;
+int64_t chunk_count = 0;
+size_t largest_chunk = 0;
+uint64_t random_state = 88172645463325252ull;
+
+uint64_t nextRandom()
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+void collectChunk(const char *data, size_t length)
+{
+  if (collected_length + length > collected_size)
+  {
+    while (collected_length + length > collected_size)
+      collected_size = collected_size == 0 ? 64 * 1024 : collected_size * 2;
+    collected = (char *)realloc(collected, collected_size);
+  }
+  memcpy(&collected[collected_length], data, length);
+  collected_length += length;
+  chunk_count++;
+  largest_chunk = length > largest_chunk ? length : largest_chunk;
+}
+
+void discardChunk(const char *data, size_t length)
+{
+  collected_length += length;
+  chunk_count++;
+}
+
+// Escapes a text one byte at a time into a buffer of TEST_LINE_SIZE bytes, like the program before the writer, for the
+// ASCII texts of the generated desktop
+const char *escapeWithSnprintf(const char *text, size_t length, char *result)
+{
+  size_t count = 0;
+  size_t i;
+  unsigned char c;
+  for (i = 0; i < length && count + 7 < TEST_LINE_SIZE; i++)
+  {
+    c = (unsigned char)text[i];
+    if (c == '"' || c == '\\')
+    {
+      result[count++] = '\\';
+      result[count++] = (char)c;
+    }
+    else if (c == '\b' || c == '\f' || c == '\n' || c == '\r' || c == '\t')
+    {
+      result[count++] = '\\';
+      result[count++] = c == '\b' ? 'b' : c == '\f' ? 'f' : c == '\n' ? 'n' : c == '\r' ? 'r' : 't';
+    }
+    else if (c < 0x20)
+    {
+      count += (size_t)snprintf(&result[count], TEST_LINE_SIZE - count, "\\u%04x", c);
+    }
+    else
+    {
+      result[count++] = (char)c;
+    }
+  }
+  result[count] = '\0';
+  return result;
+}
+
+// Writes the object of a window with every field with a chain of snprintf calls, returns its length
+size_t putWindowWithSnprintf(char *buffer, size_t buffer_size, const TestWindow *window)
+{
+  const WindowRecord *record = &window->record;
+  char escaped[TEST_LINE_SIZE];
+  int is_visible = (record->flags & FIELD_VISIBLE) != 0;
+  size_t i = 0;
+  i += snprintf(&buffer[i], buffer_size - i, "{\"handle\": %" PRId64, record->handle);
+  if (record->title_length > 0)
+    i += snprintf(&buffer[i], buffer_size - i, ", \"title\": \"%s\"", escapeWithSnprintf(window->title, record->title_length, escaped));
+  if (record->module_length > 0)
+    i += snprintf(&buffer[i], buffer_size - i, ", \"module\": \"%s\"", escapeWithSnprintf(window->module, record->module_length, escaped));
+  if (record->executable_length > 0)
+    i += snprintf(&buffer[i], buffer_size - i, ", \"executable\": \"%s\"", escapeWithSnprintf(window->exec, record->executable_length, escaped));
+  if (record->classname_length > 0)
+    i += snprintf(&buffer[i], buffer_size - i, ", \"classname\": \"%s\"", escapeWithSnprintf(window->class, record->classname_length, escaped));
+  i += snprintf(&buffer[i], buffer_size - i, ", \"parent\": %" PRId64, record->parent);
+  if (record->sibling != 0)
+    i += snprintf(&buffer[i], buffer_size - i, ", \"sibling\": %" PRId64, record->sibling);
+  if (record->child != 0)
+    i += snprintf(&buffer[i], buffer_size - i, ", \"child\": %" PRId64, record->child);
+  i += snprintf(&buffer[i], buffer_size - i, ", \"pid\": %u, \"thread\": %u, \"style\": %d, \"exstyle\": %" PRId64, record->pid, record->thread, record->style, record->exstyle);
+  i += snprintf(&buffer[i], buffer_size - i, ", \"visible\": %s, \"unicode\": %s", is_visible ? "true" : "false", (record->flags & FIELD_UNICODE) ? "true" : "false");
+  if (record->flags & FIELD_POPUP)
+    i += snprintf(&buffer[i], buffer_size - i, ", \"popup\": true");
+  if (record->flags & FIELD_CONTAINED)
+    i += snprintf(&buffer[i], buffer_size - i, ", \"contained\": true");
+  if (record->flags & FIELD_BORDERED)
+    i += snprintf(&buffer[i], buffer_size - i, ", \"bordered\": true");
+  if (record->flags & FIELD_SCROLLABLE)
+    i += snprintf(&buffer[i], buffer_size - i, ", \"scrollable\": true");
+  if (((record->flags & FIELD_VISIBLE_ALT) != 0) != is_visible)
+    i += snprintf(&buffer[i], buffer_size - i, ", \"visible_alt\": true");
+  if (record->flags & FIELD_MINIMIZED)
+    i += snprintf(&buffer[i], buffer_size - i, ", \"minimized\": true");
+  if (record->flags & FIELD_TOPMOST)
+    i += snprintf(&buffer[i], buffer_size - i, ", \"topmost\": true");
+  if (record->flags & FIELD_TRANSPARENT)
+    i += snprintf(&buffer[i], buffer_size - i, ", \"transparent\": true");
+  if (record->top != 0 || record->right != 0 || record->bottom != 0 || record->left != 0)
+    i += snprintf(&buffer[i], buffer_size - i, ", \"top\": %d, \"right\": %d, \"bottom\": %d, \"left\": %d", record->top, record->right, record->bottom, record->left);
+  i += snprintf(&buffer[i], buffer_size - i, "}");
+  return i;
+}
+
+void putWindowWithWriter(JsonWriter *writer, TestWindow *window)
+{
+  putJsonChar(writer, '{');
+  putWindowRecordKeys(writer, 1, FIELD_ALL, &window->record, window->title, window->module, window->exec, window->class);
+  putJsonChar(writer, '}');
+}
+
+// Reads every field of the windows of the desktop in z-order
+void readTestWindows()
+{
+  const char *line;
+  TestWindow *window;
+  runHarnessRequest("--desktop", "--fields", "handle", "--format", "ndjson", NULL);
+  for (line = output; line != NULL && strncmp(line, "{\"handle\": ", 11) == 0 && test_window_count < TEST_WINDOW_COUNT; line = strchr(line, '\n'), line = line != NULL ? line + 1 : NULL)
+  {
+    window = &test_windows[test_window_count++];
+    fetchWindowRecordStrings((HWND)(intptr_t)strtoll(line + 11, NULL, 10), FIELD_ALL, &window->record, window->title, window->module, window->exec, window->class);
+  }
+}
+
+// Returns zero when the writer formats an integer differently from snprintf
+int isIntegerLikeSnprintf(int64_t value, int is_unsigned)
+{
+  char written[32];
+  char expected[32];
+  JsonWriter writer;
+  initJsonWriter(&writer, written, sizeof(written), NULL);
+  if (is_unsigned)
+  {
+    putJsonUnsigned(&writer, (uint64_t)value);
+    snprintf(expected, sizeof(expected), "%" PRIu64, (uint64_t)value);
+  }
+  else
+  {
+    putJsonInteger(&writer, value);
+    snprintf(expected, sizeof(expected), "%" PRId64, value);
+  }
+  finishJsonWriter(&writer);
+  return strcmp(written, expected) == 0;
+}
+
+// Returns zero when the lines of every window written in chunks of a size limit differ from the reference, or when a chunk
+// is flushed before it is full
+int isChunkedLikeReference(const char *expected, size_t expected_length, size_t limit, size_t longest)
+{
+  JsonWriter writer;
+  int i;
+  collected_length = 0;
+  chunk_count = 0;
+  largest_chunk = 0;
+  initJsonWriter(&writer, NULL, limit, collectChunk);
+  for (i = 0; i < test_window_count; i++)
+  {
+    putWindowWithWriter(&writer, &test_windows[i]);
+    putJsonChar(&writer, '\n');
+  }
+  flushJsonWriter(&writer);
+  freeJsonWriter(&writer);
+  if (collected_length != expected_length || memcmp(collected, expected, expected_length) != 0)
+    return 0;
+  // Strings longer than a small chunk are written directly after it, larger chunks hold whole lines
+  if (limit <= longest)
+    return 1;
+  return largest_chunk <= limit && chunk_count == writer.flush_count && (size_t)chunk_count <= expected_length / (limit - longest) + 1;
+}
+
+// Returns zero when a buffer of the caller holds something else than the start of a line, or is written past its end
+int isBoundedLikeReference(const char *expected, size_t expected_length, size_t size)
+{
+  char area[TEST_LINE_SIZE + 16];
+  JsonWriter writer;
+  size_t length;
+  size_t i;
+  memset(area, 0x5A, sizeof(area));
+  initJsonWriter(&writer, area, size, NULL);
+  putWindowWithWriter(&writer, &test_windows[0]);
+  length = finishJsonWriter(&writer);
+  if (length != (expected_length < size ? expected_length : size - 1) || memcmp(area, expected, length) != 0 || area[length] != '\0')
+    return 0;
+  if (writer.is_truncated != (expected_length >= size))
+    return 0;
+  for (i = size; i < sizeof(area); i++)
+    if (area[i] != 0x5A)
+      return 0;
+  return 1;
+}
+
+// Returns the fastest time of formatting the objects of the benchmark, in nanoseconds per object
+double measureFormatting(int is_snprintf)
+{
+  char line[TEST_LINE_SIZE];
+  JsonWriter writer;
+  int64_t best = 0;
+  int64_t start;
+  int64_t elapsed;
+  size_t length;
+  int pass;
+  int i;
+  for (pass = 0; pass < 5; pass++)
+  {
+    collected_length = 0;
+    initJsonWriter(&writer, NULL, 0, discardChunk);
+    start = getClockNanoseconds();
+    for (i = 0; i < TEST_BENCHMARK_OBJECTS; i++)
+    {
+      if (is_snprintf)
+      {
+        length = putWindowWithSnprintf(line, sizeof(line), &test_windows[i % test_window_count]);
+        line[length++] = '\n';
+        discardChunk(line, length);
+      }
+      else
+      {
+        putWindowWithWriter(&writer, &test_windows[i % test_window_count]);
+        putJsonChar(&writer, '\n');
+      }
+    }
+    flushJsonWriter(&writer);
+    elapsed = getClockNanoseconds() - start;
+    freeJsonWriter(&writer);
+    best = best == 0 || elapsed < best ? elapsed : best;
+  }
+  return (double)best / TEST_BENCHMARK_OBJECTS;
+}
+
+int main(int argn, char **argv)
+{
+  static const int64_t edges[] = {0, 1, -1, 9, 10, 99, 100, 101, 999, 1000, 4294967295ll, 4294967296ll, -2147483648ll, 999999999999999999ll, 1000000000000000000ll, INT64_MAX, INT64_MIN, INT64_MIN + 1};
+  const char *renames[] = {"Quote \"a\" and back\\slash", "Tab\tbetween", "Trailing backslash \\"};
+  char count_text[32];
+  char command[256];
+  char line[TEST_LINE_SIZE];
+  char *expected;
+  size_t expected_length = 0;
+  size_t longest = 0;
+  size_t length;
+  size_t first_length;
+  int64_t value;
+  int integer_failures = 0;
+  int i;
+  test_windows = (TestWindow *)malloc(sizeof(TestWindow) * TEST_WINDOW_COUNT);
+  expected = (char *)malloc((size_t)TEST_WINDOW_COUNT * TEST_LINE_SIZE);
+  if (test_windows == NULL || expected == NULL)
+    return 1;
+  snprintf(count_text, sizeof(count_text), "%d", TEST_WINDOW_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", count_text);
+  setHarnessVariable("WINDOW_STATE_MEMORY_TITLE", "60");
+  initHarness();
+
+  for (i = 0; i < (int)(sizeof(edges) / sizeof(edges[0])); i++)
+  {
+    checkHarness(isIntegerLikeSnprintf(edges[i], 0), "putJsonInteger writes %lld differently from snprintf", (long long)edges[i]);
+    checkHarness(isIntegerLikeSnprintf(edges[i], 1), "putJsonUnsigned writes %llu differently from snprintf", (unsigned long long)edges[i]);
+  }
+  // Random values of every number of digits
+  for (i = 0; i < TEST_INTEGER_COUNT; i++)
+  {
+    value = (int64_t)(nextRandom() >> (nextRandom() % 64));
+    value = i % 2 == 0 ? value : -value;
+    integer_failures += !isIntegerLikeSnprintf(value, 0) + !isIntegerLikeSnprintf(value, 1);
+  }
+  checkHarness(integer_failures == 0, "%d of %d random integers are written differently from snprintf", integer_failures, 2 * TEST_INTEGER_COUNT);
+
+  runHarnessRequest("--desktop", "--fields", "handle", "--format", "ndjson", NULL);
+  for (i = 0; i < (int)(sizeof(renames) / sizeof(renames[0])); i++)
+  {
+    snprintf(command, sizeof(command), "title %lld %s", (long long)(intptr_t)memoryGetHandle(i * 3), renames[i]);
+    memoryApplyCommand(command);
+  }
+  readTestWindows();
+  checkHarness(test_window_count == TEST_WINDOW_COUNT, "%d windows are read instead of %d", test_window_count, TEST_WINDOW_COUNT);
+  for (i = 0; i < test_window_count; i++)
+  {
+    length = putWindowWithSnprintf(line, sizeof(line), &test_windows[i]);
+    memcpy(&expected[expected_length], line, length);
+    expected[expected_length + length] = '\n';
+    expected_length += length + 1;
+    longest = length + 1 > longest ? length + 1 : longest;
+  }
+  expected[expected_length] = '\0';
+  checkHarness(strstr(expected, "Quote \\\"a\\\" and back\\\\slash") != NULL && strstr(expected, "Tab\\tbetween") != NULL, "the renamed windows are not in the reference");
+
+  // The output of the program goes through the writer of the requests
+  runHarnessRequest("--desktop", "--fields", "all", "--format", "ndjson", NULL);
+  checkHarness(output_length == expected_length && memcmp(output, expected, expected_length) == 0, "--fields all writes %zu bytes that differ from the %zu bytes of the snprintf chains", output_length, expected_length);
+  checkHarness(isChunkedLikeReference(expected, expected_length, 64, longest), "chunks of 64 bytes write other lines");
+  checkHarness(isChunkedLikeReference(expected, expected_length, 256, longest), "chunks of 256 bytes write other lines");
+  checkHarness(isChunkedLikeReference(expected, expected_length, 4096, longest), "chunks of 4 KB write other lines or are flushed before they are full");
+  checkHarness(isChunkedLikeReference(expected, expected_length, JSON_WRITER_DEFAULT_LIMIT, longest), "chunks of 64 KB write other lines or are flushed before they are full");
+  printf("%d windows, %zu bytes with every field: %lld chunks of at most 64 KB\n", test_window_count, expected_length, (long long)chunk_count);
+
+  first_length = (size_t)(strchr(expected, '\n') - expected);
+  for (length = 1; length <= first_length + 2; length++)
+    checkHarness(isBoundedLikeReference(expected, first_length, length), "a buffer of %zu bytes holds another start of a line of %zu bytes", length, first_length);
+
+  printf("window objects with every field: %.0f ns with the writer, %.0f ns with snprintf chains\n", measureFormatting(0), measureFormatting(1));
+  free(expected);
+  free(collected);
+  free(test_windows);
+  return finishHarness("json-writer");
+}
@@ -0,0 +1,456 @@
+// Layout test: applies random layout files, --tile and --cascade to the in-memory backend and compares the calls it records
+// in WINDOW_STATE_MEMORY_LOG with the batches the readme describes, then checks the windows that were arranged.
+//
+// Each layout mixes top-level windows and children of several parents, with positions, z-orders and show states drawn at
+// random. The expected calls are built from the layout alone: one batch per parent in the order of their first window, the
+// windows to restore shown before their batch and those to minimize or maximize after it. The measures compare a layout of
+// 30 windows with 30 executions of --move and --size:
+//
+//   gcc -O2 -pthread ./tests/layout.c -o layout-test
+//   ./layout-test
+
+#include "harness.h"
+
+#define TEST_WINDOW_COUNT 60
+#define TEST_LAYOUT_COUNT 200
+#define TEST_ENTRY_LIMIT 40
+#define TEST_MEASURE_COUNT 30
+#define TEST_LOG_SIZE (1024 * 1024)
+
+typedef struct
+{
+  int index;
+  int is_placed;
+  int x;
+  int y;
+  int width;
+  int height;
+  int z_order;
+  int show_state;
+} TestEntry;
+
+const char *test_z_names[] = {"keep", "top", "bottom", "topmost", "notopmost"};
+const char *test_show_names[] = {"keep", "show", "hide", "restore", "minimize", "maximize"};
+
+char log_path[256];
+char layout_file_path[256];
+long log_offset = 0;
+char recorded[TEST_LOG_SIZE];
+char expected[TEST_LOG_SIZE];
+size_t expected_length = 0;
+uint64_t random_state = 88172645463325252ull;
+
+uint64_t nextRandom()
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+// Reads the calls recorded since the previous read
+size_t readRecordedCalls()
+{
+  size_t length = 0;
+  FILE *file = fopen(log_path, "rb");
+  if (file == NULL)
+  {
+    recorded[0] = '\0';
+    return 0;
+  }
+  fseek(file, log_offset, SEEK_SET);
+  length = fread(recorded, 1, TEST_LOG_SIZE - 1, file);
+  fclose(file);
+  log_offset += (long)length;
+  recorded[length] = '\0';
+  return length;
+}
+
+void expectCall(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  expected_length += (size_t)vsnprintf(&expected[expected_length], TEST_LOG_SIZE - expected_length, format, args);
+  va_end(args);
+  expected[expected_length++] = '\n';
+  expected[expected_length] = '\0';
+}
+
+int64_t getTestHandle(int index)
+{
+  return (int64_t)(intptr_t)memoryGetHandle(index);
+}
+
+// Returns the index of the parent that positions a window, -1 for a top-level window
+int getTestParent(int index)
+{
+  return (memory_windows[index].style & WS_CHILD) != 0 ? memory_windows[index].parent : -1;
+}
+
+// Builds the calls of a layout: the windows of each parent form a batch in the order of the first window of the parent,
+// and "top" and "topmost" windows are inserted after the previous window of the same kind in the batch
+void expectLayoutCalls(const TestEntry *entries, int entry_count)
+{
+  const TestEntry *entry;
+  int64_t last_top;
+  int64_t last_topmost;
+  int64_t insert_after;
+  unsigned int flags;
+  int is_first;
+  int deferred_count;
+  int parent;
+  int i;
+  int j;
+  int k;
+  expected_length = 0;
+  expected[0] = '\0';
+  for (i = 0; i < entry_count; i++)
+  {
+    parent = getTestParent(entries[i].index);
+    for (j = 0, is_first = 1; j < i && is_first; j++)
+      is_first = getTestParent(entries[j].index) != parent;
+    if (!is_first)
+      continue;
+    deferred_count = 0;
+    for (j = i; j < entry_count; j++)
+    {
+      entry = &entries[j];
+      if (getTestParent(entry->index) != parent)
+        continue;
+      if (entry->show_state == LAYOUT_SHOW_RESTORE)
+        expectCall("ShowWindow %lld %d", (long long)getTestHandle(entry->index), SW_SHOWNOACTIVATE);
+      deferred_count += entry->is_placed || entry->z_order != LAYOUT_Z_KEEP || entry->show_state == LAYOUT_SHOW_SHOW || entry->show_state == LAYOUT_SHOW_HIDE;
+    }
+    if (deferred_count > 0)
+    {
+      expectCall("BeginDeferWindowPos %d", deferred_count);
+      last_top = 0;
+      last_topmost = 0;
+      for (j = i; j < entry_count; j++)
+      {
+        entry = &entries[j];
+        if (getTestParent(entry->index) != parent || !(entry->is_placed || entry->z_order != LAYOUT_Z_KEEP || entry->show_state == LAYOUT_SHOW_SHOW || entry->show_state == LAYOUT_SHOW_HIDE))
+          continue;
+        flags = SWP_NOACTIVATE | (entry->is_placed ? 0 : SWP_NOMOVE | SWP_NOSIZE);
+        flags |= entry->show_state == LAYOUT_SHOW_SHOW ? SWP_SHOWWINDOW : entry->show_state == LAYOUT_SHOW_HIDE ? SWP_HIDEWINDOW : 0;
+        insert_after = 0;
+        if (entry->z_order == LAYOUT_Z_TOP)
+        {
+          insert_after = last_top != 0 ? last_top : (int64_t)(intptr_t)HWND_TOP;
+          last_top = getTestHandle(entry->index);
+        }
+        else if (entry->z_order == LAYOUT_Z_TOPMOST)
+        {
+          insert_after = last_topmost != 0 ? last_topmost : (int64_t)(intptr_t)HWND_TOPMOST;
+          last_topmost = getTestHandle(entry->index);
+        }
+        else if (entry->z_order == LAYOUT_Z_BOTTOM)
+          insert_after = (int64_t)(intptr_t)HWND_BOTTOM;
+        else if (entry->z_order == LAYOUT_Z_NOTOPMOST)
+          insert_after = (int64_t)(intptr_t)HWND_NOTOPMOST;
+        else
+          flags |= SWP_NOZORDER;
+        expectCall("DeferWindowPos %lld %lld %d %d %d %d 0x%X", (long long)getTestHandle(entry->index), (long long)insert_after, entry->x, entry->y, entry->width, entry->height, flags);
+      }
+      expectCall("EndDeferWindowPos %d", deferred_count);
+    }
+    for (k = i; k < entry_count; k++)
+    {
+      entry = &entries[k];
+      if (getTestParent(entry->index) != parent)
+        continue;
+      if (entry->show_state == LAYOUT_SHOW_MINIMIZE || entry->show_state == LAYOUT_SHOW_MAXIMIZE)
+        expectCall("ShowWindow %lld %d", (long long)getTestHandle(entry->index), entry->show_state == LAYOUT_SHOW_MINIMIZE ? SW_MINIMIZE : SW_MAXIMIZE);
+    }
+  }
+}
+
+// Draws distinct windows with random positions, z-orders and show states
+int drawLayout(TestEntry *entries)
+{
+  int count = 1 + (int)(nextRandom() % TEST_ENTRY_LIMIT);
+  int is_used[TEST_WINDOW_COUNT * 3];
+  TestEntry *entry;
+  int i;
+  memset(is_used, 0, sizeof(is_used));
+  for (i = 0; i < count; i++)
+  {
+    entry = &entries[i];
+    do
+      entry->index = (int)(nextRandom() % (uint64_t)memory_window_count);
+    while (is_used[entry->index]);
+    is_used[entry->index] = 1;
+    entry->is_placed = nextRandom() % 10 < 7;
+    entry->x = entry->is_placed ? (int)(nextRandom() % 3000) - 200 : 0;
+    entry->y = entry->is_placed ? (int)(nextRandom() % 1800) - 100 : 0;
+    entry->width = entry->is_placed ? 100 + (int)(nextRandom() % 1500) : 0;
+    entry->height = entry->is_placed ? 100 + (int)(nextRandom() % 900) : 0;
+    entry->z_order = nextRandom() % 3 == 0 ? LAYOUT_Z_KEEP : (int)(nextRandom() % 5);
+    entry->show_state = nextRandom() % 3 == 0 ? LAYOUT_SHOW_KEEP : (int)(nextRandom() % 6);
+  }
+  return count;
+}
+
+// Writes a layout file, with the hexadecimal handles, comments and blank lines that the format allows
+int writeLayoutFile(const TestEntry *entries, int entry_count)
+{
+  const TestEntry *entry;
+  FILE *file = fopen(layout_file_path, "wb");
+  int i;
+  if (file == NULL)
+    return 0;
+  fprintf(file, "# handle x y width height [z-order] [show-state]\n\n");
+  for (i = 0; i < entry_count; i++)
+  {
+    entry = &entries[i];
+    fprintf(file, i % 2 == 0 ? "%lld" : "0x%llx", (long long)getTestHandle(entry->index));
+    if (entry->is_placed)
+      fprintf(file, " %d %d %d %d", entry->x, entry->y, entry->width, entry->height);
+    else
+      fprintf(file, " -");
+    if (entry->z_order != LAYOUT_Z_KEEP || entry->show_state != LAYOUT_SHOW_KEEP)
+      fprintf(file, " %s", test_z_names[entry->z_order]);
+    if (entry->show_state != LAYOUT_SHOW_KEEP)
+      fprintf(file, "\t%s", test_show_names[entry->show_state]);
+    fprintf(file, "\n");
+  }
+  fclose(file);
+  return 1;
+}
+
+// Returns the positions of windows in the z-order of their siblings
+void readSiblingOrder(int *positions)
+{
+  int count = 0;
+  int index;
+  int i;
+  for (i = 0; i < memory_window_count; i++)
+    positions[i] = -1;
+  for (index = memory_first_top; index >= 0; index = memory_windows[index].next)
+    positions[index] = count++;
+  for (i = 0; i < memory_window_count; i++)
+  {
+    count = 0;
+    for (index = memory_windows[i].first_child; index >= 0; index = memory_windows[index].next)
+      positions[index] = count++;
+  }
+}
+
+// Returns zero when a window of the layout does not have its position or show state, or when the "top" or "topmost"
+// windows of a parent are not stacked one below the other in the order of the layout
+int isLayoutApplied(const TestEntry *entries, int entry_count)
+{
+  int positions[TEST_WINDOW_COUNT * 3];
+  const TestEntry *entry;
+  const MemoryWindow *w;
+  int previous[TEST_WINDOW_COUNT * 3 + 1][2];
+  int kind;
+  int i;
+  readSiblingOrder(positions);
+  for (i = 0; i <= memory_window_count; i++)
+    previous[i][0] = previous[i][1] = -1;
+  for (i = 0; i < entry_count; i++)
+  {
+    entry = &entries[i];
+    w = &memory_windows[entry->index];
+    if (entry->is_placed && entry->show_state != LAYOUT_SHOW_MAXIMIZE && (w->rect.left != entry->x || w->rect.top != entry->y || w->rect.right != entry->x + entry->width || w->rect.bottom != entry->y + entry->height))
+      return 0;
+    if (entry->show_state == LAYOUT_SHOW_HIDE && (w->style & WS_VISIBLE) != 0)
+      return 0;
+    if (entry->show_state != LAYOUT_SHOW_KEEP && entry->show_state != LAYOUT_SHOW_HIDE && (w->style & WS_VISIBLE) == 0)
+      return 0;
+    if ((entry->show_state == LAYOUT_SHOW_MINIMIZE) != ((w->style & WS_MINIMIZE) != 0) && entry->show_state != LAYOUT_SHOW_KEEP && entry->show_state != LAYOUT_SHOW_SHOW && entry->show_state != LAYOUT_SHOW_HIDE)
+      return 0;
+    if (entry->z_order != LAYOUT_Z_TOP && entry->z_order != LAYOUT_Z_TOPMOST)
+      continue;
+    kind = entry->z_order == LAYOUT_Z_TOP ? 0 : 1;
+    // Indexed by the parent plus one, so that top-level windows use the first slot
+    if (previous[getTestParent(entry->index) + 1][kind] >= 0 && positions[entry->index] != positions[previous[getTestParent(entry->index) + 1][kind]] + 1)
+      return 0;
+    previous[getTestParent(entry->index) + 1][kind] = entry->index;
+  }
+  return 1;
+}
+
+// Returns zero when the windows with a layout rectangle do not cover the work area once each
+int isWorkAreaTiled(const int *indexes, int count)
+{
+  const RECT *a;
+  const RECT *b;
+  int64_t area = 0;
+  int i;
+  int j;
+  for (i = 0; i < count; i++)
+  {
+    a = &memory_windows[indexes[i]].rect;
+    if (a->left < 0 || a->top < 0 || a->right > MEMORY_SCREEN_WIDTH || a->bottom > MEMORY_SCREEN_HEIGHT - MEMORY_TASKBAR_HEIGHT)
+      return 0;
+    area += (int64_t)(a->right - a->left) * (a->bottom - a->top);
+    for (j = 0; j < i; j++)
+    {
+      b = &memory_windows[indexes[j]].rect;
+      if (a->left < b->right && b->left < a->right && a->top < b->bottom && b->top < a->bottom)
+        return 0;
+    }
+  }
+  return area == (int64_t)MEMORY_SCREEN_WIDTH * (MEMORY_SCREEN_HEIGHT - MEMORY_TASKBAR_HEIGHT);
+}
+
+// Lists the top-level windows that --tile and --cascade arrange, shown and not minimized, in z-order
+int readArrangedWindows(int *indexes)
+{
+  int count = 0;
+  int index;
+  for (index = memory_first_top; index >= 0; index = memory_windows[index].next)
+  {
+    if ((memory_windows[index].style & WS_VISIBLE) != 0 && (memory_windows[index].style & WS_MINIMIZE) == 0)
+      indexes[count++] = index;
+  }
+  return count;
+}
+
+// Returns the number of lines of the recorded calls that start with a call name
+int countRecordedCalls(const char *name)
+{
+  const char *line;
+  int count = 0;
+  for (line = recorded; *line != '\0'; line = strchr(line, '\n') + 1)
+    count += strncmp(line, name, strlen(name)) == 0;
+  return count;
+}
+
+int main(int argn, char **argv)
+{
+  TestEntry entries[TEST_ENTRY_LIMIT];
+  int indexes[TEST_WINDOW_COUNT];
+  int order[TEST_WINDOW_COUNT];
+  char text[64];
+  char handle_text[32];
+  char size_text[2][32];
+  int64_t start;
+  int64_t batch_time;
+  int64_t single_time;
+  int batch_calls;
+  int single_calls = 0;
+  int entry_count;
+  int call_failures = 0;
+  int state_failures = 0;
+  int count;
+  int code;
+  int i;
+  int k;
+  FILE *file;
+  snprintf(log_path, sizeof(log_path), "/tmp/window-state-layout-test-%d.log", (int)getpid());
+  snprintf(layout_file_path, sizeof(layout_file_path), "/tmp/window-state-layout-test-%d.txt", (int)getpid());
+  remove(log_path);
+  snprintf(text, sizeof(text), "%d", TEST_WINDOW_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", text);
+  setHarnessVariable("WINDOW_STATE_MEMORY_LOG", log_path);
+  initHarness();
+  runHarnessRequest("--desktop", "--fields", "handle", NULL);
+
+  for (i = 0; i < TEST_LAYOUT_COUNT; i++)
+  {
+    entry_count = drawLayout(entries);
+    if (!writeLayoutFile(entries, entry_count))
+      return 1;
+    expectLayoutCalls(entries, entry_count);
+    code = runHarnessRequest("--layout", layout_file_path, NULL);
+    readRecordedCalls();
+    if (code != 0 || strcmp(recorded, expected) != 0)
+    {
+      if (call_failures++ == 0)
+        fprintf(stderr, "layout %d answered %d with:\n%s\nrecorded calls:\n%s\nexpected calls:\n%s\n", i, code, output, recorded, expected);
+      continue;
+    }
+    state_failures += !isLayoutApplied(entries, entry_count);
+  }
+  checkHarness(call_failures == 0, "%d of %d layouts make other calls than their batches", call_failures, TEST_LAYOUT_COUNT);
+  checkHarness(state_failures == 0, "%d of %d layouts leave windows in other positions or states", state_failures, TEST_LAYOUT_COUNT);
+
+  // Rejected files make no call
+  file = fopen(layout_file_path, "wb");
+  fprintf(file, "%lld 0 0 100 100 top\n%lld 0 0 4294967296 100\n", (long long)getTestHandle(0), (long long)getTestHandle(3));
+  fclose(file);
+  code = runHarnessRequest("--layout", layout_file_path, NULL);
+  checkHarness(code != 0 && strstr(output, "line 2") != NULL && readRecordedCalls() == 0, "a width outside 32 bits is answered %d with \"%s\"", code, output);
+  file = fopen(layout_file_path, "wb");
+  fprintf(file, "%lld 0 0 100 100 top\n%lld 0 0 100 100 %0300d\n", (long long)getTestHandle(0), (long long)getTestHandle(3), 0);
+  fclose(file);
+  code = runHarnessRequest("--layout", layout_file_path, NULL);
+  checkHarness(code != 0 && strstr(output, "exceeds") != NULL && readRecordedCalls() == 0, "a line of 300 characters is answered %d with \"%s\"", code, output);
+  file = fopen(layout_file_path, "wb");
+  fprintf(file, "%lld 0 0 100 100 top\n1 0 0 100 100\n", (long long)getTestHandle(0));
+  fclose(file);
+  code = runHarnessRequest("--layout", layout_file_path, NULL);
+  checkHarness(code == 170 && readRecordedCalls() == 0, "a missing window is answered %d with \"%s\"", code, output);
+
+  // Tiling restores the maximized windows before their batch and keeps the z-order
+  memory_windows[memory_first_top].style |= WS_VISIBLE | WS_MAXIMIZE;
+  count = readArrangedWindows(indexes);
+  expected_length = 0;
+  for (i = 0; i < count; i++)
+  {
+    if ((memory_windows[indexes[i]].style & WS_MAXIMIZE) != 0)
+      expectCall("ShowWindow %lld %d", (long long)getTestHandle(indexes[i]), SW_SHOWNOACTIVATE);
+  }
+  expectCall("BeginDeferWindowPos %d", count);
+  code = runHarnessRequest("--desktop", "--tile", NULL);
+  readRecordedCalls();
+  checkHarness(code == 0 && strncmp(recorded, expected, expected_length) == 0 && countRecordedCalls("DeferWindowPos") == count && countRecordedCalls("EndDeferWindowPos") == 1, "--tile of %d windows makes other calls:\n%s", count, recorded);
+  checkHarness(readArrangedWindows(order) == count && memcmp(order, indexes, sizeof(int) * count) == 0, "--tile changes the z-order");
+  checkHarness(isWorkAreaTiled(indexes, count), "the %d tiles do not cover the work area once", count);
+  for (i = 0, k = 0; i < count; i++)
+    k += (memory_windows[indexes[i]].style & WS_MAXIMIZE) != 0;
+  checkHarness(k == 0, "--tile leaves %d windows maximized", k);
+
+  // Cascading keeps the order of the windows, offset diagonally so that the one on top is the furthest
+  runHarnessRequest("--desktop", "--cascade", NULL);
+  readRecordedCalls();
+  checkHarness(countRecordedCalls("DeferWindowPos") == count && countRecordedCalls("ShowWindow") == 0, "--cascade of %d windows makes other calls:\n%s", count, recorded);
+  checkHarness(readArrangedWindows(order) == count && memcmp(order, indexes, sizeof(int) * count) == 0, "--cascade changes the order of the windows");
+  for (i = 0, k = 0; i < count; i++)
+  {
+    const RECT *r = &memory_windows[order[i]].rect;
+    k += r->left != r->top || r->left % LAYOUT_CASCADE_STEP != 0 || r->right - r->left != MEMORY_SCREEN_WIDTH * 3 / 5 || r->bottom - r->top != (MEMORY_SCREEN_HEIGHT - MEMORY_TASKBAR_HEIGHT) * 3 / 5;
+    if (i + 1 < count && r->left != 0)
+      k += memory_windows[order[i + 1]].rect.left != r->left - LAYOUT_CASCADE_STEP;
+  }
+  checkHarness(k == 0 && memory_windows[order[count - 1]].rect.left == 0, "%d cascaded windows are not offset diagonally", k);
+
+  // A layout of the first windows against moving and resizing them one execution at a time
+  for (i = 0; i < TEST_MEASURE_COUNT; i++)
+  {
+    entries[i].index = i * 3;
+    entries[i].is_placed = 1;
+    entries[i].x = (i % 6) * 420;
+    entries[i].y = (i / 6) * 270;
+    entries[i].width = 420;
+    entries[i].height = 270;
+    entries[i].z_order = LAYOUT_Z_KEEP;
+    entries[i].show_state = LAYOUT_SHOW_KEEP;
+  }
+  writeLayoutFile(entries, TEST_MEASURE_COUNT);
+  start = getClockNanoseconds();
+  runHarnessRequest("--layout", layout_file_path, NULL);
+  batch_time = getClockNanoseconds() - start;
+  readRecordedCalls();
+  batch_calls = countRecordedCalls("");
+  checkHarness(countRecordedCalls("SetWindowPos") == 0 && countRecordedCalls("EndDeferWindowPos") == 1, "a layout of %d top-level windows makes other calls than one batch", TEST_MEASURE_COUNT);
+  start = getClockNanoseconds();
+  for (i = 0; i < TEST_MEASURE_COUNT; i++)
+  {
+    snprintf(handle_text, sizeof(handle_text), "%lld", (long long)getTestHandle(entries[i].index));
+    snprintf(size_text[0], sizeof(size_text[0]), "%d", entries[i].x);
+    snprintf(size_text[1], sizeof(size_text[1]), "%d", entries[i].y);
+    runHarnessRequest("--handle", handle_text, "--move", size_text[0], size_text[1], "--size", "420", "270", NULL);
+    readRecordedCalls();
+    single_calls += countRecordedCalls("");
+  }
+  single_time = getClockNanoseconds() - start;
+  printf("%d layouts of up to %d windows, %d windows: %d calls in one batch in %.0f us, against %d positions applied one at a time in %.0f us\n", TEST_LAYOUT_COUNT, TEST_ENTRY_LIMIT, TEST_MEASURE_COUNT, batch_calls, batch_time / 1e3, single_calls, single_time / 1e3);
+
+  remove(layout_file_path);
+  remove(log_path);
+  return finishHarness("layout");
+}
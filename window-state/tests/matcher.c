@@ -0,0 +1,207 @@
+// Pattern matcher test: compares the Aho-Corasick matcher of --title and --class-contains with a loop that checks each
+// pattern in turn, over generated titles in mixed case with Latin-1 letters, then measures both with 500 names.
+//
+// The patterns are slices of the words of the titles in another case, some cut in the middle of a UTF-8 sequence, so
+// that matches depend on the folding of the letters and on patterns that are prefixes or suffixes of each other:
+//
+//   gcc -O2 -pthread ./tests/matcher.c -o matcher-test
+//   ./matcher-test
+
+#include "harness.h"
+
+#define TEST_TITLE_COUNT 100000
+#define TEST_PATTERN_COUNT 500
+#define TEST_TITLE_SIZE 256
+
+const char *test_words[] = {
+    "Document", "Google", "Chrome", "Visual", "Studio", "Code", "Notepad", "Task", "Manager", "Explorer", "Settings",
+    "Terminal", "Firefox", "Mozilla", "Outlook", "Inbox", "Calendar", "Spotify", "Slack", "Teams", "Zoom", "Meeting",
+    "Caf\xC3\xA9", "CAF\xC3\x89", "\xC3\x89" "diteur", "Stra\xC3\x9F" "e", "\xC3\x86r\xC3\xB8", "\xC3\x85ngstr\xC3\xB6m",
+    "Gr\xC3\xBC\xC3\x9F" "e", "\xC3\x9C" "BER", "Na\xC3\xAFve", "R\xC3\xA9sum\xC3\xA9", "\xC3\x97", "\xC3\xB7",
+    "\xE2\x80\x94", "\xF0\x9F\x93\x81", "\xE6\x97\xA5\xE6\x9C\xAC", "-", "(1)", "v2.0", "README.md", "main.c"};
+#define TEST_WORD_COUNT (int)(sizeof(test_words) / sizeof(test_words[0]))
+
+char (*test_titles)[TEST_TITLE_SIZE];
+size_t test_title_lengths[TEST_TITLE_COUNT];
+char test_patterns[TEST_PATTERN_COUNT][MATCHER_PATTERN_SIZE];
+uint64_t random_state = 88172645463325252ull;
+
+uint64_t nextRandom()
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+// Changes the case of the ascii letters and the Latin-1 letters of a text at random
+void changeCase(char *text, size_t length)
+{
+  size_t i;
+  unsigned char c;
+  for (i = 0; i < length; i++)
+  {
+    c = (unsigned char)text[i];
+    if (nextRandom() % 2 == 0)
+      continue;
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+      text[i] = (char)(c ^ 32);
+    else if (i > 0 && (unsigned char)text[i - 1] == 0xC3 && c >= 0x80 && c <= 0xBE && c != 0x97 && c != 0xB7 && c != 0x9F && c != 0xBF)
+      text[i] = (char)(c ^ 32);
+  }
+}
+
+void generateTitles()
+{
+  const char *word;
+  size_t length;
+  size_t word_length;
+  int count;
+  int i;
+  int j;
+  for (i = 0; i < TEST_TITLE_COUNT; i++)
+  {
+    length = 0;
+    count = 1 + (int)(nextRandom() % 8);
+    for (j = 0; j < count; j++)
+    {
+      word = test_words[nextRandom() % TEST_WORD_COUNT];
+      word_length = strlen(word);
+      if (length + word_length + 1 >= TEST_TITLE_SIZE)
+        break;
+      if (j > 0)
+        test_titles[i][length++] = ' ';
+      memcpy(&test_titles[i][length], word, word_length);
+      length += word_length;
+    }
+    changeCase(test_titles[i], length);
+    test_titles[i][length] = '\0';
+    test_title_lengths[i] = length;
+  }
+}
+
+// Patterns are slices of a word or of two words, with their case changed, or words that no title contains
+void generatePatterns()
+{
+  char joined[MATCHER_PATTERN_SIZE];
+  size_t length;
+  size_t start;
+  size_t end;
+  int i;
+  for (i = 0; i < TEST_PATTERN_COUNT; i++)
+  {
+    if (nextRandom() % 8 == 0)
+    {
+      snprintf(test_patterns[i], MATCHER_PATTERN_SIZE, "absent%d", (int)(nextRandom() % 100000));
+      continue;
+    }
+    snprintf(joined, sizeof(joined), nextRandom() % 4 == 0 ? "%s %s" : "%s", test_words[nextRandom() % TEST_WORD_COUNT], test_words[nextRandom() % TEST_WORD_COUNT]);
+    length = strlen(joined);
+    start = (size_t)(nextRandom() % length);
+    end = start + 1 + (size_t)(nextRandom() % (length - start));
+    memcpy(test_patterns[i], &joined[start], end - start);
+    test_patterns[i][end - start] = '\0';
+    changeCase(test_patterns[i], end - start);
+  }
+}
+
+// Patterns of the measures are like the names of a block list, two words and a number, which few titles contain
+void generateNamePatterns()
+{
+  int i;
+  for (i = 0; i < TEST_PATTERN_COUNT; i++)
+    snprintf(test_patterns[i], MATCHER_PATTERN_SIZE, "%s %s %d", test_words[nextRandom() % TEST_WORD_COUNT], test_words[nextRandom() % TEST_WORD_COUNT], (int)(nextRandom() % 3));
+}
+
+// Returns one when a title contains any of the first patterns, checking each pattern in turn
+int matchPatternsInTurn(const char *title, size_t length, int pattern_count)
+{
+  int i;
+  for (i = 0; i < pattern_count; i++)
+    if (containsText(title, length, test_patterns[i]))
+      return 1;
+  return pattern_count == 0;
+}
+
+void buildTestMatcher(PatternMatcher *matcher, int pattern_count)
+{
+  int i;
+  initPatternMatcher(matcher);
+  for (i = 0; i < pattern_count; i++)
+    addPattern(matcher, test_patterns[i], strlen(test_patterns[i]));
+  buildPatternMatcher(matcher);
+}
+
+// Returns the time to check the titles with the matcher or with the loop, in nanoseconds per title
+double measureTitles(PatternMatcher *matcher, int title_count, int *match_count)
+{
+  int64_t start = getClockNanoseconds();
+  int i;
+  *match_count = 0;
+  for (i = 0; i < title_count; i++)
+    *match_count += matcher != NULL ? matchPatterns(matcher, test_titles[i], test_title_lengths[i]) : matchPatternsInTurn(test_titles[i], test_title_lengths[i], TEST_PATTERN_COUNT);
+  return (double)(getClockNanoseconds() - start) / title_count;
+}
+
+int main(int argn, char **argv)
+{
+  static const int pattern_counts[] = {0, 1, 2, 10, 50, 500};
+  PatternMatcher matcher;
+  char *first;
+  double matcher_time;
+  double loop_time;
+  int matcher_count;
+  int loop_count;
+  int pattern_count;
+  int i;
+  int j;
+  test_titles = (char (*)[TEST_TITLE_SIZE])malloc((size_t)TEST_TITLE_COUNT * TEST_TITLE_SIZE);
+  if (test_titles == NULL)
+    return 1;
+  initHarness();
+  generateTitles();
+  generatePatterns();
+
+  for (i = 0; i < (int)(sizeof(pattern_counts) / sizeof(pattern_counts[0])); i++)
+  {
+    pattern_count = pattern_counts[i];
+    buildTestMatcher(&matcher, pattern_count);
+    for (j = 0; j < TEST_TITLE_COUNT; j++)
+    {
+      if (!checkHarness(matchPatterns(&matcher, test_titles[j], test_title_lengths[j]) == matchPatternsInTurn(test_titles[j], test_title_lengths[j], pattern_count), "'%s' is matched differently by %d patterns", test_titles[j], pattern_count))
+        break;
+    }
+    freePatternMatcher(&matcher);
+  }
+  // Each pattern on its own, against the first titles
+  for (i = 0; i < TEST_PATTERN_COUNT; i++)
+  {
+    initPatternMatcher(&matcher);
+    addPattern(&matcher, test_patterns[i], strlen(test_patterns[i]));
+    buildPatternMatcher(&matcher);
+    for (j = 0; j < 2000; j++)
+    {
+      if (!checkHarness(matchPatterns(&matcher, test_titles[j], test_title_lengths[j]) == containsText(test_titles[j], test_title_lengths[j], test_patterns[i]), "'%s' is matched differently by '%s'", test_titles[j], test_patterns[i]))
+        break;
+    }
+    freePatternMatcher(&matcher);
+  }
+  // The filters of the program select the same windows with the matcher as with an expression of the same patterns
+  runHarnessRequest("--desktop", "--title", "CHROME", "--title", "notepad", "--title", "- visual", "--fields", "handle", NULL);
+  checkHarness(output_length > 2, "--title selects no window");
+  first = (char *)malloc(output_length + 1);
+  memcpy(first, output, output_length + 1);
+  runHarnessRequest("--desktop", "--where", "title ~ 'chrome' || title ~ 'NOTEPAD' || title ~ '- Visual'", "--fields", "handle", NULL);
+  checkHarness(strcmp(first, output) == 0, "--title selects other windows than title ~");
+  free(first);
+
+  generateNamePatterns();
+  buildTestMatcher(&matcher, TEST_PATTERN_COUNT);
+  matcher_time = measureTitles(&matcher, TEST_TITLE_COUNT, &matcher_count);
+  loop_time = measureTitles(NULL, TEST_TITLE_COUNT / 10, &loop_count);
+  printf("titles: %d, patterns: %d, states: %d, byte classes: %d\n", TEST_TITLE_COUNT, TEST_PATTERN_COUNT, matcher.state_count, matcher.class_count);
+  printf("matcher: %.1f ns per title (%d matches), patterns in turn: %.1f ns per title (%d matches in a tenth)\n", matcher_time, matcher_count, loop_time, loop_count);
+  freePatternMatcher(&matcher);
+  free(test_titles);
+  return finishHarness("matcher");
+}
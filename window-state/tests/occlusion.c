@@ -0,0 +1,270 @@
+// Occlusion test: compares the visible areas of --visible-area with areas painted pixel by pixel on desktops whose windows
+// are placed on a small canvas, then measures the computation on generated desktops of thousands of overlapping windows.
+//
+// The painting walks the top-level windows from the top of the z-order and gives each pixel of the canvas to the first
+// visible, not minimized window that covers it, so the visible area of a window is the number of pixels it was given. The
+// desktops mix random rectangles with stacked copies of the same rectangle, windows sharing edges, nested windows, thin
+// strips that split the region into many bands, and hidden and minimized windows. The output must write the same areas,
+// fractions truncated to six digits, and --where must select the windows of the painted fractions:
+//
+//   gcc -O2 -pthread ./tests/occlusion.c -o occlusion-test
+//   ./occlusion-test
+
+#include "harness.h"
+
+#define TEST_TOP_COUNT 600
+#define TEST_TRIAL_COUNT 60
+#define TEST_CANVAS_ORIGIN -64
+#define TEST_CANVAS_SIZE 576
+#define TEST_MEASURE_COUNTS 3
+
+HWND *tops;
+int top_count = 0;
+int64_t *painted;
+int *canvas;
+uint64_t random_state = 88172645463325252ull;
+
+uint64_t nextRandom()
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+// Returns a random coordinate of the canvas below a limit from its origin
+int64_t pickCoordinate(int64_t limit)
+{
+  return TEST_CANVAS_ORIGIN + (int64_t)(nextRandom() % (uint64_t)limit);
+}
+
+// Moves a window to a rectangle of the canvas
+void moveWindow(HWND h, int64_t left, int64_t top, int64_t width, int64_t height)
+{
+  char command[128];
+  snprintf(command, sizeof(command), "move %lld %lld %lld %lld %lld", (long long)(intptr_t)h, (long long)left, (long long)top, (long long)width, (long long)height);
+  memoryApplyCommand(command);
+}
+
+// Places the top-level windows of a trial, each window by one of the shapes of the test
+void placeWindows(int trial)
+{
+  MemoryWindow *w;
+  RECT rect = {0, 0, 0, 0};
+  int64_t width;
+  int64_t height;
+  int i;
+  for (i = 0; i < top_count; i++)
+  {
+    w = &memory_windows[memoryGetIndex(tops[i])];
+    width = 1 + (int64_t)(nextRandom() % 160);
+    height = 1 + (int64_t)(nextRandom() % 160);
+    switch (trial == 0 ? 0 : nextRandom() % 6)
+    {
+    case 1:
+      // The same rectangle as the window above
+      backendGetWindowRect(tops[i > 0 ? i - 1 : 0], &rect);
+      moveWindow(tops[i], rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top);
+      break;
+    case 2:
+      // Next to the window above, sharing an edge
+      backendGetWindowRect(tops[i > 0 ? i - 1 : 0], &rect);
+      moveWindow(tops[i], nextRandom() % 2 ? rect.right : rect.left - width, rect.top + (int64_t)(nextRandom() % 8) - 4, width, height);
+      break;
+    case 3:
+      // Inside or around the window above
+      backendGetWindowRect(tops[i > 0 ? i - 1 : 0], &rect);
+      moveWindow(tops[i], rect.left - 2 + (int64_t)(nextRandom() % 5), rect.top - 2 + (int64_t)(nextRandom() % 5), rect.right - rect.left + 2 - (int64_t)(nextRandom() % 5), rect.bottom - rect.top + 2 - (int64_t)(nextRandom() % 5));
+      break;
+    case 4:
+      // A strip across the canvas
+      if (nextRandom() % 2)
+        moveWindow(tops[i], pickCoordinate(TEST_CANVAS_SIZE - 8), TEST_CANVAS_ORIGIN, 1 + (int64_t)(nextRandom() % 4), TEST_CANVAS_SIZE);
+      else
+        moveWindow(tops[i], TEST_CANVAS_ORIGIN, pickCoordinate(TEST_CANVAS_SIZE - 8), TEST_CANVAS_SIZE, 1 + (int64_t)(nextRandom() % 4));
+      break;
+    default:
+      moveWindow(tops[i], pickCoordinate(TEST_CANVAS_SIZE - width), pickCoordinate(TEST_CANVAS_SIZE - height), width, height);
+    }
+    // Rectangles are kept on the canvas
+    backendGetWindowRect(tops[i], &rect);
+    rect.left = rect.left < TEST_CANVAS_ORIGIN ? TEST_CANVAS_ORIGIN : rect.left;
+    rect.top = rect.top < TEST_CANVAS_ORIGIN ? TEST_CANVAS_ORIGIN : rect.top;
+    rect.right = rect.right > TEST_CANVAS_ORIGIN + TEST_CANVAS_SIZE ? TEST_CANVAS_ORIGIN + TEST_CANVAS_SIZE : rect.right;
+    rect.bottom = rect.bottom > TEST_CANVAS_ORIGIN + TEST_CANVAS_SIZE ? TEST_CANVAS_ORIGIN + TEST_CANVAS_SIZE : rect.bottom;
+    moveWindow(tops[i], rect.left, rect.top, rect.right > rect.left ? rect.right - rect.left : 0, rect.bottom > rect.top ? rect.bottom - rect.top : 0);
+    w->style &= ~(WS_VISIBLE | WS_MINIMIZE);
+    w->style |= nextRandom() % 10 != 0 ? WS_VISIBLE : 0;
+    w->style |= nextRandom() % 20 == 0 ? WS_MINIMIZE : 0;
+  }
+}
+
+// Paints the canvas from the top of the z-order and counts the pixels given to each window into painted
+void paintWindows()
+{
+  RECT rect;
+  int64_t x;
+  int64_t y;
+  int *pixel;
+  int i;
+  for (i = 0; i < TEST_CANVAS_SIZE * TEST_CANVAS_SIZE; i++)
+    canvas[i] = -1;
+  for (i = 0; i < top_count; i++)
+  {
+    painted[i] = 0;
+    if (!backendIsWindowVisible(tops[i]) || (backendGetWindowLong(tops[i], GWL_STYLE) & WS_MINIMIZE) != 0 || !backendGetWindowRect(tops[i], &rect))
+      continue;
+    for (y = rect.top; y < rect.bottom; y++)
+    {
+      pixel = &canvas[(y - TEST_CANVAS_ORIGIN) * TEST_CANVAS_SIZE + rect.left - TEST_CANVAS_ORIGIN];
+      for (x = rect.left; x < rect.right; x++, pixel++)
+      {
+        if (*pixel >= 0)
+          continue;
+        *pixel = i;
+        painted[i]++;
+      }
+    }
+  }
+}
+
+// Returns the area of the rectangle of a window
+int64_t getArea(HWND h)
+{
+  RECT rect;
+  if (!backendGetWindowRect(h, &rect) || rect.right <= rect.left || rect.bottom <= rect.top)
+    return 0;
+  return ((int64_t)rect.right - rect.left) * ((int64_t)rect.bottom - rect.top);
+}
+
+// Returns the number of windows whose computed visible area differs from the painted one
+int countComputedDifferences()
+{
+  int index;
+  int count = 0;
+  int i;
+  if (!computeOcclusion())
+    return top_count;
+  for (i = 0; i < top_count; i++)
+  {
+    index = findOcclusionWindow(tops[i]);
+    count += index < 0 || occlusion_windows[index].visible_area != painted[i] || occlusion_windows[index].area != getArea(tops[i]);
+  }
+  return count;
+}
+
+// Returns the number of lines of the output whose visible area or fraction differs from the painted ones
+int countOutputDifferences()
+{
+  const char *line;
+  const char *position;
+  double fraction;
+  double expected;
+  int64_t area;
+  int count = 0;
+  int i;
+  runHarnessRequest("--desktop", "--visible-area", "--fields", "handle", "--format", "ndjson", NULL);
+  for (i = 0, line = output; i < top_count; i++, line = strchr(line, '\n') + 1)
+  {
+    if (strchr(line, '\n') == NULL || strtoll(line + 11, NULL, 10) != (int64_t)(intptr_t)tops[i] || (position = strstr(line, "\"visible_area\": ")) == NULL)
+      return top_count;
+    area = getArea(tops[i]);
+    if (strtoll(position + 16, NULL, 10) != painted[i] || (position = strstr(line, "\"visible_fraction\": ")) == NULL)
+    {
+      count++;
+      continue;
+    }
+    // The fraction is truncated to six digits
+    fraction = strtod(position + 20, NULL);
+    expected = area > 0 ? (double)painted[i] / (double)area : 0;
+    count += fraction > expected + 1e-12 || fraction < expected - 1e-6;
+  }
+  return count;
+}
+
+// Returns the number of windows selected by a --where filter of the visible fraction that the painting does not select, or
+// the other way around
+int countFilterDifferences(const char *where, int64_t numerator, int64_t denominator)
+{
+  const char *line;
+  int64_t handle;
+  int is_selected;
+  int count = 0;
+  int i;
+  runHarnessRequest("--desktop", "--where", where, "--fields", "handle", "--format", "ndjson", NULL);
+  line = output;
+  for (i = 0; i < top_count; i++)
+  {
+    handle = line != NULL && strncmp(line, "{\"handle\": ", 11) == 0 ? strtoll(line + 11, NULL, 10) : 0;
+    // Fractions are compared truncated to six digits
+    is_selected = getArea(tops[i]) > 0 && painted[i] * OCCLUSION_FRACTION_SCALE / getArea(tops[i]) * denominator >= numerator * OCCLUSION_FRACTION_SCALE;
+    if (handle == (int64_t)(intptr_t)tops[i])
+      line = strchr(line, '\n') != NULL ? strchr(line, '\n') + 1 : NULL;
+    count += is_selected != (handle == (int64_t)(intptr_t)tops[i]);
+  }
+  return count + (line != NULL && *line != '\0');
+}
+
+int main(int argn, char **argv)
+{
+  const int measure_counts[TEST_MEASURE_COUNTS] = {1000, 10000, 50000};
+  char text[32];
+  HWND h;
+  HWND child;
+  int64_t start;
+  int64_t elapsed;
+  int failures = 0;
+  int output_failures = 0;
+  int partial_count = 0;
+  int trial;
+  int i;
+  snprintf(text, sizeof(text), "%d", TEST_TOP_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", text);
+  initHarness();
+  tops = (HWND *)malloc(sizeof(HWND) * TEST_TOP_COUNT);
+  painted = (int64_t *)malloc(sizeof(int64_t) * TEST_TOP_COUNT);
+  canvas = (int *)malloc(sizeof(int) * TEST_CANVAS_SIZE * TEST_CANVAS_SIZE);
+  if (tops == NULL || painted == NULL || canvas == NULL)
+    return 1;
+  for (h = backendGetFirstChild(NULL); h != NULL && top_count < TEST_TOP_COUNT; h = backendGetWindow(h, GW_HWNDNEXT))
+    tops[top_count++] = h;
+
+  for (trial = 0; trial < TEST_TRIAL_COUNT; trial++)
+  {
+    placeWindows(trial);
+    paintWindows();
+    failures += countComputedDifferences();
+    for (i = 0; i < top_count; i++)
+      partial_count += painted[i] > 0 && painted[i] < getArea(tops[i]);
+    // The output of every few trials
+    if (trial % 10 == 0)
+      output_failures += countOutputDifferences();
+  }
+  checkHarness(partial_count > TEST_TRIAL_COUNT * TEST_TOP_COUNT / 10, "only %d windows are partly covered", partial_count);
+  checkHarness(failures == 0, "%d windows of %d desktops have other visible areas than painted", failures, TEST_TRIAL_COUNT);
+  checkHarness(output_failures == 0, "%d lines of --visible-area have other areas or fractions than painted", output_failures);
+  checkHarness(countFilterDifferences("visible_fraction >= 0.5", 1, 2) == 0, "--where 'visible_fraction >= 0.5' selects other windows than painted");
+  checkHarness(countFilterDifferences("visible_fraction >= 1", 1, 1) == 0, "--where 'visible_fraction >= 1' selects other windows than painted");
+  // Children are not top-level and have no visible area
+  child = backendGetFirstChild(tops[0]);
+  snprintf(text, sizeof(text), "%lld", (long long)(intptr_t)tops[0]);
+  runHarnessRequest("--parent", text, "--visible-area", "--fields", "handle", "--format", "ndjson", NULL);
+  checkHarness(child != NULL && strstr(output, "\"visible_area\": null, \"visible_fraction\": null}") != NULL, "a child is written with \"%.80s\"", output);
+
+  // Generated desktops of overlapping windows
+  for (i = 0; i < TEST_MEASURE_COUNTS; i++)
+  {
+    memoryGenerateDesktop(measure_counts[i], 0, 1, 0, 0, 1);
+    resetOcclusion();
+    start = getClockNanoseconds();
+    computeOcclusion();
+    elapsed = getClockNanoseconds() - start;
+    printf("%s%d windows in %.2f ms (%d bands, %d spans)", i == 0 ? "visible areas: " : ", ", measure_counts[i], elapsed / 1e6, occlusion_band_count, occlusion_live_span_count);
+  }
+  printf(", %d of the windows painted on the canvas partly covered\n", partial_count);
+
+  free(canvas);
+  free(painted);
+  free(tops);
+  return finishHarness("occlusion");
+}
@@ -0,0 +1,249 @@
+// Sort and page test: compares the pages of --sort, --limit and --offset, which keep the windows of the page in a bounded
+// heap, with the pages of the whole list sorted afterwards, then measures a page against writing and sorting every window.
+//
+// The desktop has 50,000 generated windows like the figures of the readme. Windows with the same key must stay in z-order,
+// which the reference keeps by sorting on the position of the window in the list as the last key:
+//
+//   gcc -O2 -pthread ./tests/order.c -o order-test
+//   ./order-test
+
+#include "harness.h"
+
+#include <ctype.h>
+
+#define TEST_WINDOW_COUNT 50000
+
+typedef struct
+{
+  int64_t handle;
+  int64_t area;
+  int64_t pid;
+  int64_t visible;
+  int position;
+  char title[MIDDLE_BUFFER_SIZE];
+} TestWindow;
+
+typedef struct
+{
+  const char *key;
+  int offset;
+  int limit;
+  // Only the visible windows are sorted when set
+  int is_visible;
+} PageCase;
+
+const PageCase page_cases[] = {
+    {"area", 0, 20, 0},
+    {"area", 0, 1, 0},
+    {"area", 37, 20, 0},
+    {"area", 49990, 20, 0},
+    {"area", 0, 20, 1},
+    {"title", 0, 20, 0},
+    {"title", 1000, 50, 0},
+    {"title", 0, 20, 1},
+    {"pid", 0, 20, 0},
+    {"pid", 25000, 100, 0},
+    {"pid", 0, 20, 1},
+    {"z", 0, 20, 0},
+    {"z", 123, 7, 1},
+    {"area", 0, 5000, 0},
+};
+
+TestWindow *test_windows;
+TestWindow **sorted_windows;
+int test_window_count = 0;
+const char *sort_key;
+
+// Returns the value of a number or boolean key of an NDJSON line, zero when the line does not have the key
+int64_t findJsonNumber(const char *line, const char *end, const char *key)
+{
+  char pattern[64];
+  const char *position;
+  snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+  position = strstr(line, pattern);
+  if (position == NULL || position > end)
+    return 0;
+  position += strlen(pattern);
+  if (strncmp(position, "true", 4) == 0)
+    return 1;
+  return strtoll(position, NULL, 10);
+}
+
+// Copies the title of an NDJSON line without its escapes, an empty title when the line does not have one
+void findJsonTitle(const char *line, const char *end, char *title, size_t title_size)
+{
+  const char *position = strstr(line, "\"title\": \"");
+  size_t length = 0;
+  title[0] = '\0';
+  if (position == NULL || position > end)
+    return;
+  for (position += 10; *position != '"' && length + 1 < title_size; position++)
+  {
+    if (*position == '\\')
+      position++;
+    title[length++] = *position;
+  }
+  title[length] = '\0';
+}
+
+// Lists every window in z-order with the attributes of the sort keys, or with every attribute
+void readTestWindows(int is_every_field)
+{
+  const char *line;
+  const char *end;
+  TestWindow *window;
+  int64_t width;
+  int64_t height;
+  test_window_count = 0;
+  if (is_every_field)
+    runHarnessRequest("--desktop", "--format", "ndjson", NULL);
+  else
+    runHarnessRequest("--desktop", "--fields", "handle,title,pid,visible,rect", "--format", "ndjson", NULL);
+  for (line = output; line != NULL && *line == '{' && test_window_count < TEST_WINDOW_COUNT; line = end + 1)
+  {
+    end = strchr(line, '\n');
+    if (end == NULL)
+      break;
+    window = &test_windows[test_window_count];
+    window->handle = findJsonNumber(line, end, "handle");
+    window->pid = findJsonNumber(line, end, "pid");
+    window->visible = findJsonNumber(line, end, "visible");
+    width = findJsonNumber(line, end, "right") - findJsonNumber(line, end, "left");
+    height = findJsonNumber(line, end, "bottom") - findJsonNumber(line, end, "top");
+    window->area = width > 0 && height > 0 ? width * height : 0;
+    window->position = test_window_count++;
+    findJsonTitle(line, end, window->title, MIDDLE_BUFFER_SIZE);
+  }
+}
+
+// Compares windows as the readme describes the keys: largest area first, titles with ascii letters compared without case
+// and then by their bytes, lowest pid first, and z-order between windows with the same key
+int compareTestWindows(const void *a, const void *b)
+{
+  const TestWindow *x = *(const TestWindow *const *)a;
+  const TestWindow *y = *(const TestWindow *const *)b;
+  int result = 0;
+  size_t i;
+  int p;
+  int q;
+  if (strcmp(sort_key, "area") == 0)
+    result = x->area > y->area ? -1 : x->area < y->area ? 1 : 0;
+  else if (strcmp(sort_key, "pid") == 0)
+    result = x->pid < y->pid ? -1 : x->pid > y->pid ? 1 : 0;
+  else if (strcmp(sort_key, "title") == 0)
+  {
+    for (i = 0; result == 0 && (x->title[i] != '\0' || y->title[i] != '\0'); i++)
+    {
+      p = tolower((unsigned char)x->title[i]);
+      q = tolower((unsigned char)y->title[i]);
+      result = p < q ? -1 : p > q ? 1 : 0;
+    }
+    if (result == 0)
+      result = strcmp(x->title, y->title);
+  }
+  if (result != 0)
+    return result;
+  return x->position < y->position ? -1 : 1;
+}
+
+// Returns zero when a page differs from the same page of the sorted list
+int isPageLikeReference(const PageCase *page)
+{
+  char offset_text[32];
+  char limit_text[32];
+  const char *line;
+  int count = 0;
+  int expected = 0;
+  int is_same = 1;
+  int i;
+  sort_key = page->key;
+  for (i = 0; i < test_window_count; i++)
+    if (!page->is_visible || test_windows[i].visible)
+      sorted_windows[count++] = &test_windows[i];
+  qsort(sorted_windows, (size_t)count, sizeof(TestWindow *), compareTestWindows);
+  snprintf(offset_text, sizeof(offset_text), "%d", page->offset);
+  snprintf(limit_text, sizeof(limit_text), "%d", page->limit);
+  if (page->is_visible)
+    runHarnessRequest("--desktop", "--where", "visible", "--sort", page->key, "--offset", offset_text, "--limit", limit_text, "--fields", "handle", "--format", "ndjson", NULL);
+  else
+    runHarnessRequest("--desktop", "--sort", page->key, "--offset", offset_text, "--limit", limit_text, "--fields", "handle", "--format", "ndjson", NULL);
+  for (line = output, i = page->offset; line != NULL && *line == '{'; line = strchr(line, '\n'), line = line != NULL ? line + 1 : NULL, i++)
+  {
+    expected++;
+    if (i >= count || i >= page->offset + page->limit || strtoll(line + 11, NULL, 10) != sorted_windows[i]->handle)
+      is_same = 0;
+  }
+  return is_same && expected == (count - page->offset < page->limit ? count - page->offset : page->limit);
+}
+
+// Returns the fastest time of several requests, in milliseconds
+double measureRequest(const char *sort, const char *format)
+{
+  int64_t best = 0;
+  int64_t start;
+  int64_t elapsed;
+  int i;
+  for (i = 0; i < 5; i++)
+  {
+    start = getClockNanoseconds();
+    if (sort != NULL)
+      runHarnessRequest("--desktop", "--sort", sort, "--limit", "20", "--format", format, NULL);
+    else
+      runHarnessRequest("--desktop", "--format", format, NULL);
+    elapsed = getClockNanoseconds() - start;
+    best = best == 0 || elapsed < best ? elapsed : best;
+  }
+  return best / 1e6;
+}
+
+// Returns the fastest time of writing every window as JSON and sorting them by area, in milliseconds
+double measureDumpThenSort()
+{
+  int64_t best = 0;
+  int64_t start;
+  int64_t elapsed;
+  int i;
+  int j;
+  sort_key = "area";
+  for (i = 0; i < 5; i++)
+  {
+    start = getClockNanoseconds();
+    readTestWindows(1);
+    for (j = 0; j < test_window_count; j++)
+      sorted_windows[j] = &test_windows[j];
+    qsort(sorted_windows, (size_t)test_window_count, sizeof(TestWindow *), compareTestWindows);
+    elapsed = getClockNanoseconds() - start;
+    best = best == 0 || elapsed < best ? elapsed : best;
+  }
+  return best / 1e6;
+}
+
+int main(int argn, char **argv)
+{
+  char count_text[32];
+  const PageCase *page;
+  int i;
+  test_windows = (TestWindow *)malloc(sizeof(TestWindow) * TEST_WINDOW_COUNT);
+  sorted_windows = (TestWindow **)malloc(sizeof(TestWindow *) * TEST_WINDOW_COUNT);
+  if (test_windows == NULL || sorted_windows == NULL)
+    return 1;
+  snprintf(count_text, sizeof(count_text), "%d", TEST_WINDOW_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", count_text);
+  initHarness();
+
+  readTestWindows(0);
+  checkHarness(test_window_count == TEST_WINDOW_COUNT, "%d windows are listed instead of %d", test_window_count, TEST_WINDOW_COUNT);
+  for (i = 0; i < (int)(sizeof(page_cases) / sizeof(page_cases[0])); i++)
+  {
+    page = &page_cases[i];
+    checkHarness(isPageLikeReference(page), "--sort %s --offset %d --limit %d%s differs from the sorted list", page->key, page->offset, page->limit, page->is_visible ? " of the visible windows" : "");
+  }
+
+  printf("windows: %d\n", test_window_count);
+  printf("--sort area --limit 20: %.1f ms\n", measureRequest("area", "json"));
+  printf("every window as JSON: %.1f ms, also read and sorted by area: %.1f ms\n", measureRequest(NULL, "json"), measureDumpThenSort());
+  printf("every window in the binary format: %.1f ms\n", measureRequest(NULL, "binary"));
+  free(test_windows);
+  free(sorted_windows);
+  return finishHarness("order");
+}
@@ -0,0 +1,162 @@
+// Process cache test: counts the processes opened by the in-memory backend to resolve executables, which stand for the
+// OpenProcess calls of Windows, and compares them with a model of the cache that opens a process on its first window only.
+//
+// The desktop has 10,000 windows of 1,000 processes, more than the cache keeps, so that the processes resolved after the
+// cache is three quarters full are opened for each of their windows:
+//
+//   gcc -O2 -pthread ./tests/process-cache.c -o process-cache-test
+//   ./process-cache-test
+
+#include "harness.h"
+
+#define TEST_WINDOW_COUNT 10000
+#define TEST_PROCESS_COUNT 1000
+// Processes whose pid is below this one fit in the cache, pids are 1000 + 4 * process
+#define TEST_CACHED_PID_LIMIT (1000 + 4 * 500)
+
+DWORD test_pids[TEST_WINDOW_COUNT];
+int test_window_count = 0;
+char is_test_pid_seen[TEST_PROCESS_COUNT];
+
+// Lists the pid of every window in z-order
+void readTestPids()
+{
+  const char *line;
+  test_window_count = 0;
+  runHarnessRequest("--desktop", "--fields", "pid", "--format", "ndjson", NULL);
+  for (line = output; line != NULL && strncmp(line, "{\"pid\": ", 8) == 0 && test_window_count < TEST_WINDOW_COUNT; line = strchr(line, '\n'), line = line != NULL ? line + 1 : NULL)
+    test_pids[test_window_count++] = (DWORD)strtoul(line + 8, NULL, 10);
+}
+
+// Returns the processes opened to list the executable of every window, which are those of the first window of a process
+// while the table has room and those of every window of the processes it has no room for
+int64_t countModelOpens(int64_t *hits)
+{
+  int64_t opens = 0;
+  int cached = 0;
+  int process;
+  int i;
+  memset(is_test_pid_seen, 0, sizeof(is_test_pid_seen));
+  *hits = 0;
+  for (i = 0; i < test_window_count; i++)
+  {
+    process = ((int)test_pids[i] - 1000) / 4;
+    if (is_test_pid_seen[process])
+    {
+      (*hits)++;
+      continue;
+    }
+    opens++;
+    if (cached < PROCESS_CACHE_SIZE * 3 / 4)
+    {
+      is_test_pid_seen[process] = 1;
+      cached++;
+    }
+  }
+  return opens;
+}
+
+// Returns zero when an executable of the output differs from the path the backend resolves for its pid
+int isExecutableLikeBackend()
+{
+  char exec[MIDDLE_BUFFER_SIZE];
+  char written[MIDDLE_BUFFER_SIZE];
+  const char *line;
+  const char *position;
+  size_t length;
+  int i = 0;
+  for (line = output; line != NULL && *line == '{'; line = strchr(line, '\n'), line = line != NULL ? line + 1 : NULL, i++)
+  {
+    position = strstr(line, "\"executable\": \"");
+    if (i >= test_window_count || position == NULL)
+      return 0;
+    for (position += 15, length = 0; *position != '"' && length + 1 < sizeof(written); position++)
+    {
+      if (*position == '\\')
+        position++;
+      written[length++] = *position;
+    }
+    written[length] = '\0';
+    backendGetProcessExecutable(test_pids[i], exec, sizeof(exec));
+    if (strcmp(exec, written) != 0)
+      return 0;
+  }
+  return i == test_window_count;
+}
+
+// Returns the number of different pids written in a tree
+int countWrittenPids()
+{
+  const char *position;
+  int count = 0;
+  int process;
+  memset(is_test_pid_seen, 0, sizeof(is_test_pid_seen));
+  for (position = strstr(output, "\"pid\": "); position != NULL; position = strstr(position + 7, "\"pid\": "))
+  {
+    process = ((int)strtol(position + 7, NULL, 10) - 1000) / 4;
+    if (process >= 0 && process < TEST_PROCESS_COUNT && !is_test_pid_seen[process])
+    {
+      is_test_pid_seen[process] = 1;
+      count++;
+    }
+  }
+  return count;
+}
+
+// Returns the fastest time of a request, in milliseconds
+double measureRequest(const char *fields)
+{
+  int64_t best = 0;
+  int64_t start;
+  int64_t elapsed;
+  int i;
+  for (i = 0; i < 5; i++)
+  {
+    start = getClockNanoseconds();
+    runHarnessRequest("--desktop", "--fields", fields, "--format", "ndjson", NULL);
+    elapsed = getClockNanoseconds() - start;
+    best = best == 0 || elapsed < best ? elapsed : best;
+  }
+  return best / 1e6;
+}
+
+int main(int argn, char **argv)
+{
+  char count_text[32];
+  char where[64];
+  int64_t model_opens;
+  int64_t model_hits;
+  int64_t opens;
+  int pid_count;
+  snprintf(count_text, sizeof(count_text), "%d", TEST_WINDOW_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", count_text);
+  snprintf(count_text, sizeof(count_text), "%d", TEST_PROCESS_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_PROCESSES", count_text);
+  initHarness();
+
+  readTestPids();
+  checkHarness(test_window_count == TEST_WINDOW_COUNT, "%d windows are listed instead of %d", test_window_count, TEST_WINDOW_COUNT);
+  checkHarness(readCounter(&backend_process_open_count) == 0, "listing pids opened %lld processes", (long long)readCounter(&backend_process_open_count));
+
+  // Each request starts with an empty cache, so the same request opens the same processes
+  model_opens = countModelOpens(&model_hits);
+  runHarnessRequest("--desktop", "--fields", "executable", "--format", "ndjson", NULL);
+  opens = readCounter(&backend_process_open_count);
+  checkHarness(opens == model_opens, "listing executables opened %lld processes instead of %lld", (long long)opens, (long long)model_opens);
+  checkHarness(process_cache_misses == model_opens && process_cache_hits == model_hits, "the cache counted %lld hits and %lld misses instead of %lld and %lld", (long long)process_cache_hits, (long long)process_cache_misses, (long long)model_hits, (long long)model_opens);
+  checkHarness(process_cache_count == PROCESS_CACHE_SIZE * 3 / 4, "the cache has %d entries instead of %d", process_cache_count, PROCESS_CACHE_SIZE * 3 / 4);
+  runHarnessRequest("--desktop", "--fields", "executable", "--format", "ndjson", NULL);
+  checkHarness(readCounter(&backend_process_open_count) == opens, "the same request opened %lld processes", (long long)readCounter(&backend_process_open_count));
+  checkHarness(isExecutableLikeBackend(), "an executable from the cache differs from the executable of its process");
+
+  // Workers of the tree mode share the cache, with processes that fit in it each is opened once whatever the thread
+  snprintf(where, sizeof(where), "pid < %d", TEST_CACHED_PID_LIMIT);
+  runHarnessRequest("--desktop", "--tree", "--threads", "4", "--where", where, "--fields", "handle,pid,executable", NULL);
+  pid_count = countWrittenPids();
+  checkHarness(pid_count > 0 && readCounter(&backend_process_open_count) == pid_count, "a tree of %d processes opened %lld processes", pid_count, (long long)readCounter(&backend_process_open_count));
+  checkHarness(process_cache_hits + process_cache_misses > pid_count, "the tree of %d processes was read without hits", pid_count);
+
+  printf("windows: %d, processes: %d, processes opened to list executables: %lld (one per window without the cache)\n", TEST_WINDOW_COUNT, TEST_PROCESS_COUNT, (long long)model_opens);
+  printf("pid: %.1f ms, pid and executable: %.1f ms\n", measureRequest("pid"), measureRequest("pid,executable"));
+  return finishHarness("process-cache");
+}
@@ -0,0 +1,290 @@
+// Published reader test: reader processes copy the list of a publisher with published-reader.h while the publisher keeps
+// replacing it, check that no copy mixes two lists and measure how long a read takes against listing the windows.
+//
+// The publisher lists the in-memory desktop with a script that renames four windows to "Step <n>" at each step, so every
+// copy must contain the same step in all of its titles and be a complete JSON array. The test needs fork and POSIX shared
+// memory, it is not built on Windows:
+//
+//   gcc -O2 -pthread ./tests/published-reader.c -o published-reader-test
+//   ./published-reader-test
+//   ./published-reader-test --windows 50000 --steps 20
+
+#define _GNU_SOURCE
+
+#include "harness.h"
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define READER_MAX_COUNT 16
+// Read latencies are counted in buckets of 10 ns up to 100 us and of 1 us up to 100 ms
+#define LATENCY_FINE_COUNT 10000
+#define LATENCY_BUCKET_COUNT (LATENCY_FINE_COUNT + 99900)
+
+typedef struct
+{
+  int64_t read_count;
+  int64_t inconsistent_count;
+  int64_t busy_count;
+  int64_t retry_count;
+  int64_t generation_count;
+  int64_t total_nanoseconds;
+  int64_t max_nanoseconds;
+  int64_t latency_counts[LATENCY_BUCKET_COUNT];
+} ReaderResult;
+
+typedef struct
+{
+  volatile int is_stopped;
+  ReaderResult readers[READER_MAX_COUNT];
+} SharedResults;
+
+int window_count = 48;
+int reader_count = 4;
+int step_count = 40000;
+const char *fields = NULL;
+char published_name[64];
+char script_path[256];
+
+// Returns zero when the titles of a copy name different steps or the copy is not a whole JSON array
+int isConsistentCopy(const char *copy, int64_t length)
+{
+  const char *position = copy;
+  const char *end = copy + length;
+  long step = -1;
+  long value;
+  while (length > 0 && (copy[length - 1] == '\n' || copy[length - 1] == '\r'))
+    length--;
+  if (length < 2 || copy[0] != '[' || copy[length - 1] != ']')
+    return 0;
+  while ((position = (const char *)memmem(position, (size_t)(end - position), "Step ", 5)) != NULL)
+  {
+    value = strtol(position + 5, NULL, 10);
+    if (step >= 0 && value != step)
+      return 0;
+    step = value;
+    position += 5;
+  }
+  return 1;
+}
+
+int getLatencyBucket(int64_t nanoseconds)
+{
+  int64_t bucket = nanoseconds < LATENCY_FINE_COUNT * 10 ? nanoseconds / 10 : LATENCY_FINE_COUNT + (nanoseconds - LATENCY_FINE_COUNT * 10) / 1000;
+  return bucket < LATENCY_BUCKET_COUNT ? (int)bucket : LATENCY_BUCKET_COUNT - 1;
+}
+
+// Returns the upper bound of the latencies of a bucket
+int64_t getBucketLatency(int bucket)
+{
+  return bucket < LATENCY_FINE_COUNT ? (int64_t)(bucket + 1) * 10 : (int64_t)LATENCY_FINE_COUNT * 10 + (int64_t)(bucket - LATENCY_FINE_COUNT + 1) * 1000;
+}
+
+void runReaderProcess(SharedResults *shared, int index, size_t buffer_size)
+{
+  ReaderResult *result = &shared->readers[index];
+  PublishedReader reader;
+  char *buffer = (char *)malloc(buffer_size);
+  uint64_t generation;
+  uint64_t last_generation = 0;
+  int64_t start;
+  int64_t elapsed;
+  int64_t length;
+  if (buffer == NULL)
+    _exit(1);
+  while (!openPublishedReader(&reader, published_name))
+  {
+    if (shared->is_stopped)
+      _exit(1);
+    sleepThread(1);
+  }
+  while (!shared->is_stopped)
+  {
+    start = getClockNanoseconds();
+    length = readPublishedSnapshot(&reader, buffer, buffer_size, &generation, NULL);
+    elapsed = getClockNanoseconds() - start;
+    if (length == PUBLISHED_ERROR_EMPTY)
+      continue;
+    if (length < 0)
+    {
+      result->busy_count++;
+      continue;
+    }
+    result->read_count++;
+    result->total_nanoseconds += elapsed;
+    result->max_nanoseconds = elapsed > result->max_nanoseconds ? elapsed : result->max_nanoseconds;
+    result->latency_counts[getLatencyBucket(elapsed)]++;
+    if (!isConsistentCopy(buffer, length) || generation < last_generation)
+      result->inconsistent_count++;
+    if (generation != last_generation)
+      result->generation_count++;
+    last_generation = generation;
+  }
+  result->retry_count = reader.retry_count;
+  closePublishedReader(&reader);
+  _exit(0);
+}
+
+// Runs the program as the publisher until the end of its script, with its output discarded
+void runPublisherProcess(size_t capacity)
+{
+  char size_text[32];
+  char *argv[] = {"window-state", "--desktop", "--publish", published_name, "--publish-size", size_text, "--fields", (char *)fields, NULL};
+  snprintf(size_text, sizeof(size_text), "%zu", capacity);
+  if (freopen("/dev/null", "w", stdout) == NULL)
+    _exit(1);
+  setHarnessVariable("WINDOW_STATE_MEMORY_SCRIPT", script_path);
+  _exit(runWindowState(fields != NULL ? 8 : 6, argv));
+}
+
+int writeScript()
+{
+  FILE *file = fopen(script_path, "w");
+  int step;
+  if (file == NULL)
+    return 0;
+  for (step = 1; step <= step_count; step++)
+  {
+    fprintf(file, "title 65552 Step %d\ntitle 65558 Step %d\ntitle 65564 Step %d\ntitle 65570 Step %d\n", step, step, step, step);
+    // Readers would otherwise only ever see the publisher writing when it publishes faster than they copy
+    if (step % 20 == 0)
+      fprintf(file, "sleep 1\n");
+    fprintf(file, "tick\n");
+  }
+  fclose(file);
+  return 1;
+}
+
+// Returns the latency below which a fraction of the reads completed
+int64_t findLatencyPercentile(const int64_t *counts, int64_t total, double fraction)
+{
+  int64_t target = (int64_t)(total * fraction);
+  int64_t seen = 0;
+  int i;
+  for (i = 0; i < LATENCY_BUCKET_COUNT; i++)
+  {
+    seen += counts[i];
+    if (seen > target)
+      return getBucketLatency(i);
+  }
+  return getBucketLatency(LATENCY_BUCKET_COUNT - 1);
+}
+
+// Returns the median time of listing the windows with the fields of the publisher, in nanoseconds
+int64_t measureListing(int repetitions)
+{
+  int64_t *times = (int64_t *)malloc(sizeof(int64_t) * repetitions);
+  int64_t start;
+  int64_t median;
+  int i;
+  int j;
+  int64_t swap;
+  for (i = 0; i < repetitions; i++)
+  {
+    start = getClockNanoseconds();
+    if (fields != NULL)
+      runHarnessRequest("--desktop", "--fields", fields, NULL);
+    else
+      runHarnessRequest("--desktop", NULL);
+    times[i] = getClockNanoseconds() - start;
+    for (j = i; j > 0 && times[j - 1] > times[j]; j--)
+    {
+      swap = times[j - 1];
+      times[j - 1] = times[j];
+      times[j] = swap;
+    }
+  }
+  median = times[repetitions / 2];
+  free(times);
+  return median;
+}
+
+int main(int argn, char **argv)
+{
+  SharedResults *shared;
+  ReaderResult total;
+  pid_t readers[READER_MAX_COUNT];
+  pid_t publisher;
+  int status;
+  int publisher_code;
+  size_t capacity;
+  int64_t listing;
+  char window_text[32];
+  int i;
+  int j;
+  for (i = 1; i + 1 < argn; i += 2)
+  {
+    if (strcmp(argv[i], "--windows") == 0)
+      window_count = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--readers") == 0)
+      reader_count = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--steps") == 0)
+      step_count = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--fields") == 0)
+      fields = argv[i + 1];
+  }
+  if (i != argn || window_count < 4 || reader_count < 1 || reader_count > READER_MAX_COUNT || step_count < 1)
+  {
+    fprintf(stderr, "Usage: published-reader-test [--windows <count>] [--readers <count>] [--steps <count>] [--fields <list>]\n");
+    return 1;
+  }
+  snprintf(window_text, sizeof(window_text), "%d", window_count);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", window_text);
+  snprintf(published_name, sizeof(published_name), "test-%d", (int)getpid());
+  snprintf(script_path, sizeof(script_path), "/tmp/window-state-test-%d.txt", (int)getpid());
+  if (!writeScript())
+  {
+    fprintf(stderr, "Error: Could not write the script \"%s\"\n", script_path);
+    return 1;
+  }
+  // About 440 bytes per window with the default fields, the region is sized with room to spare
+  capacity = (size_t)window_count * 1024 + 1024 * 1024;
+  shared = (SharedResults *)mmap(NULL, sizeof(SharedResults), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED)
+    return 1;
+  memset(shared, 0, sizeof(SharedResults));
+
+  // The processes are forked before the harness starts any thread
+  for (i = 0; i < reader_count; i++)
+  {
+    readers[i] = fork();
+    if (readers[i] == 0)
+      runReaderProcess(shared, i, capacity);
+  }
+  publisher = fork();
+  if (publisher == 0)
+    runPublisherProcess(capacity);
+  waitpid(publisher, &status, 0);
+  publisher_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  shared->is_stopped = 1;
+  for (i = 0; i < reader_count; i++)
+    waitpid(readers[i], &status, 0);
+  remove(script_path);
+
+  initHarness();
+  listing = measureListing(window_count >= 10000 ? 10 : 1000);
+
+  memset(&total, 0, sizeof(total));
+  for (i = 0; i < reader_count; i++)
+  {
+    ReaderResult *result = &shared->readers[i];
+    printf("reader %d: %" PRId64 " reads, %" PRId64 " generations, %" PRId64 " retries, %" PRId64 " busy, %" PRId64 " inconsistent\n", i, result->read_count, result->generation_count, result->retry_count, result->busy_count, result->inconsistent_count);
+    total.read_count += result->read_count;
+    total.inconsistent_count += result->inconsistent_count;
+    total.busy_count += result->busy_count;
+    total.total_nanoseconds += result->total_nanoseconds;
+    total.max_nanoseconds = result->max_nanoseconds > total.max_nanoseconds ? result->max_nanoseconds : total.max_nanoseconds;
+    for (j = 0; j < LATENCY_BUCKET_COUNT; j++)
+      total.latency_counts[j] += result->latency_counts[j];
+    checkHarness(result->read_count > 0, "reader %d made no read", i);
+  }
+  printf("windows: %d, steps: %d, list: %" PRId64 " bytes\n", window_count, step_count, (int64_t)output_length);
+  if (total.read_count > 0)
+    printf("read: median %.3f us, p99 %.3f us, mean %.3f us, max %.3f us\n", findLatencyPercentile(total.latency_counts, total.read_count, 0.5) / 1000.0, findLatencyPercentile(total.latency_counts, total.read_count, 0.99) / 1000.0, (double)total.total_nanoseconds / total.read_count / 1000.0, total.max_nanoseconds / 1000.0);
+  printf("list: median %.3f us\n", listing / 1000.0);
+  checkHarness(publisher_code == 0, "the publisher exited with code %d", publisher_code);
+  checkHarness(total.inconsistent_count == 0, "%" PRId64 " copies mixed two lists", total.inconsistent_count);
+  checkHarness(total.busy_count == 0, "%" PRId64 " reads gave up while the list was written", total.busy_count);
+  munmap(shared, sizeof(SharedResults));
+  return finishHarness("published-reader");
+}
@@ -0,0 +1,222 @@
+// Serve mode test: sends request lines to the program started with --serve through pipes, checks the framing, the ids and
+// the errors of its responses, then measures a request against starting a process for the same query.
+//
+// The process of each query runs this test again with --run, which makes it the program, so the measure includes the
+// creation, the loading and the exit of a process but not the work of a shell. The test needs fork, it is not built on
+// Windows:
+//
+//   gcc -O2 -pthread ./tests/serve.c -o serve-test
+//   ./serve-test
+
+#include "harness.h"
+
+#include <spawn.h>
+#include <sys/wait.h>
+
+#define TEST_REQUEST_COUNT 5000
+#define TEST_SPAWN_COUNT 200
+#define TEST_PIPELINE_COUNT 200
+
+extern char **environ;
+
+FILE *server_input;
+FILE *server_output;
+pid_t server;
+char *payload = NULL;
+size_t payload_size = 0;
+char response_id[SMALL_BUFFER_SIZE];
+int response_code;
+size_t response_length;
+
+// Starts the program in serve mode with pipes to its stdin and stdout
+int startServer()
+{
+  int input[2];
+  int result[2];
+  char *argv[] = {"window-state", "--serve", NULL};
+  if (pipe(input) != 0 || pipe(result) != 0)
+    return 0;
+  server = fork();
+  if (server == 0)
+  {
+    dup2(input[0], 0);
+    dup2(result[1], 1);
+    close(input[0]);
+    close(input[1]);
+    close(result[0]);
+    close(result[1]);
+    _exit(runWindowState(2, argv));
+  }
+  close(input[0]);
+  close(result[1]);
+  server_input = fdopen(input[1], "w");
+  server_output = fdopen(result[0], "r");
+  return server > 0 && server_input != NULL && server_output != NULL;
+}
+
+void sendRequest(const char *line)
+{
+  fputs(line, server_input);
+  fputc('\n', server_input);
+}
+
+// Reads a header line and the payload that follows it, returns zero when the response is not framed as the readme describes
+int readResponse()
+{
+  char header[256];
+  char *id;
+  char *end;
+  if (fgets(header, sizeof(header), server_output) == NULL || strncmp(header, "{\"id\": ", 7) != 0)
+    return 0;
+  id = header + 7;
+  end = strstr(id, ", \"code\": ");
+  if (end == NULL || (size_t)(end - id) >= SMALL_BUFFER_SIZE)
+    return 0;
+  memcpy(response_id, id, (size_t)(end - id));
+  response_id[end - id] = '\0';
+  response_code = (int)strtol(end + 10, &end, 10);
+  if (strncmp(end, ", \"length\": ", 12) != 0)
+    return 0;
+  response_length = (size_t)strtoull(end + 12, &end, 10);
+  if (strcmp(end, "}\n") != 0)
+    return 0;
+  if (response_length + 2 > payload_size)
+  {
+    payload_size = response_length + 2;
+    payload = (char *)realloc(payload, payload_size);
+  }
+  // The payload is followed by a line break that its length does not count
+  if (fread(payload, 1, response_length + 1, server_output) != response_length + 1 || payload[response_length] != '\n')
+    return 0;
+  payload[response_length] = '\0';
+  return 1;
+}
+
+// Sends a request and returns zero when its response does not have an id, a code or a payload
+int isServedAs(const char *line, const char *id, int code, const char *prefix)
+{
+  sendRequest(line);
+  fflush(server_input);
+  if (!readResponse())
+    return 0;
+  return strcmp(response_id, id) == 0 && response_code == code && strncmp(payload, prefix, strlen(prefix)) == 0;
+}
+
+// Returns the time of a request through the pipes, in microseconds
+double measureServed(const char *line, int count)
+{
+  int64_t start = getClockNanoseconds();
+  int i;
+  for (i = 0; i < count; i++)
+  {
+    sendRequest(line);
+    fflush(server_input);
+    if (!checkHarness(readResponse() && response_code == 0, "request %d of \"%s\" failed", i, line))
+      break;
+  }
+  return (getClockNanoseconds() - start) / 1e3 / count;
+}
+
+// Returns the time of starting this test as the program for a query and waiting for it, in microseconds
+double measureSpawned(const char *path, char **arguments, int count)
+{
+  posix_spawn_file_actions_t actions;
+  int64_t start;
+  pid_t child;
+  int status;
+  int i;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+  start = getClockNanoseconds();
+  for (i = 0; i < count; i++)
+  {
+    if (!checkHarness(posix_spawn(&child, path, &actions, NULL, arguments, environ) == 0, "%s could not be started", path))
+      break;
+    waitpid(child, &status, 0);
+    if (!checkHarness(WIFEXITED(status) && WEXITSTATUS(status) == 0, "the started query exited with status %d", status))
+      break;
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  return (getClockNanoseconds() - start) / 1e3 / count;
+}
+
+int main(int argn, char **argv)
+{
+  char *handle_arguments[] = {argv[0], "--run", "--handle", "65552", "--fields", "handle,title", NULL};
+  char *desktop_arguments[] = {argv[0], "--run", "--desktop", NULL};
+  char line[256];
+  char *long_line;
+  double served;
+  double spawned;
+  int status;
+  int is_ordered = 1;
+  int i;
+  if (argn > 1 && strcmp(argv[1], "--run") == 0)
+  {
+    argv[1] = argv[0];
+    return runWindowState(argn - 1, argv + 1);
+  }
+  // The server is forked before the harness starts any thread
+  if (!startServer())
+  {
+    fprintf(stderr, "Error: Could not start the server\n");
+    return 1;
+  }
+  initHarness();
+
+  checkHarness(isServedAs("{\"id\": 1, \"args\": [\"--handle\", 65552, \"--fields\", \"handle\"]}", "1", 0, "[{\"handle\": 65552}]"), "a request is answered with %s %d \"%s\"", response_id, response_code, payload);
+  checkHarness(response_length == strlen(payload), "the length of a payload is %zu instead of %zu", response_length, strlen(payload));
+  checkHarness(isServedAs("{\"args\": [\"--handle\", \"65558\", \"--fields\", \"handle\"], \"id\": \"a\\\"b\"}", "\"a\\\"b\"", 0, "[{\"handle\": 65558}]"), "a string id is not echoed as it was sent");
+  checkHarness(isServedAs("  {\"id\" : 3 , \"args\" : [ ] }  ", "3", 1, "window-state - "), "a request without arguments is not answered with the help");
+  checkHarness(isServedAs("{\"id\": 4, \"args\": [\"--pid\"]}", "4", 1, "Error: "), "an invalid request is answered with %d \"%s\"", response_code, payload);
+  checkHarness(isServedAs("{\"id\": 5, \"args\": [\"--title\", \"a\\q\"]}", "5", 1, "Error: Invalid request line"), "an unknown escape is accepted");
+  checkHarness(isServedAs("{\"id\": 6, \"args\": [\"--title\", \"a\\", "6", 1, "Error: Invalid request line"), "a backslash at the end of a line is accepted");
+  checkHarness(isServedAs("{\"id\": 7, \"args\": [\"--title\", \"\\u0000\"]}", "7", 1, "Error: Invalid request line"), "an escaped null character is accepted");
+  checkHarness(isServedAs("{\"id\": 8, \"args\": [\"--handle\", 65552, \"--fields\", \"title\", \"--title\", \"\\u00e9\\ud83d\\udcc1\\/\"]}", "8", 0, "[]"), "escapes of other planes are answered with %d \"%s\"", response_code, payload);
+  checkHarness(isServedAs("{\"id\": 9, \"args\": [\"--timeout\", 0]}", "9", 1, "Error: Invalid timeout"), "the exit code of a failed request is %d", response_code);
+  // A line longer than the buffer is rejected as a whole and the next request is read from the start of its line
+  long_line = (char *)malloc(BUFFER_SIZE + 64);
+  memset(long_line, ' ', BUFFER_SIZE + 63);
+  long_line[BUFFER_SIZE + 63] = '\0';
+  memcpy(long_line, "{\"id\": 10, \"args\": [", 20);
+  checkHarness(isServedAs(long_line, "null", 1, "Error: Request line exceeds"), "a long line is answered with %d \"%s\"", response_code, payload);
+  free(long_line);
+  checkHarness(isServedAs("{\"id\": 11, \"args\": [\"--handle\", 65552, \"--fields\", \"handle\"]}", "11", 0, "[{\"handle\": 65552}]"), "the request after a long line is answered with %s", response_id);
+
+  // A served list is the same as the list of an execution
+  sendRequest("{\"id\": 12, \"args\": [\"--desktop\"]}");
+  fflush(server_input);
+  checkHarness(readResponse(), "the list of the desktop is not framed");
+  runHarnessRequest("--desktop", NULL);
+  checkHarness(response_length == output_length && strcmp(payload, output) == 0, "the served list differs from the list of an execution");
+
+  // Pipelined requests are answered in order
+  for (i = 0; i < TEST_PIPELINE_COUNT; i++)
+  {
+    snprintf(line, sizeof(line), "{\"id\": %d, \"args\": [\"--handle\", %d, \"--fields\", \"handle\"]}", 1000 + i, 65552 + 6 * (i % 48));
+    sendRequest(line);
+  }
+  fflush(server_input);
+  for (i = 0; i < TEST_PIPELINE_COUNT; i++)
+  {
+    snprintf(line, sizeof(line), "%d", 1000 + i);
+    if (!readResponse() || strcmp(response_id, line) != 0 || response_code != 0)
+      is_ordered = 0;
+  }
+  checkHarness(is_ordered, "pipelined requests are not answered in order");
+
+  served = measureServed("{\"id\": 1, \"args\": [\"--handle\", 65552, \"--fields\", \"handle,title\"]}", TEST_REQUEST_COUNT);
+  spawned = measureSpawned(argv[0], handle_arguments, TEST_SPAWN_COUNT);
+  printf("--handle 65552 --fields handle,title: served %.1f us, started %.1f us (%.0f times)\n", served, spawned, spawned / served);
+  served = measureServed("{\"id\": 1, \"args\": [\"--desktop\"]}", TEST_REQUEST_COUNT / 10);
+  spawned = measureSpawned(argv[0], desktop_arguments, TEST_SPAWN_COUNT);
+  printf("--desktop: served %.1f us, started %.1f us (%.0f times)\n", served, spawned, spawned / served);
+
+  // The server exits when its input is closed
+  fclose(server_input);
+  waitpid(server, &status, 0);
+  checkHarness(WIFEXITED(status) && WEXITSTATUS(status) == 0, "the server exited with status %d", status);
+  fclose(server_output);
+  free(payload);
+  return finishHarness("serve");
+}
@@ -0,0 +1,316 @@
+// Snapshot test: writes a snapshot of the in-memory desktop, changes the desktop at random, then compares the difference
+// written by --since with the difference between the lists of the desktop before and after the changes.
+//
+// The lists are read with the fields of the snapshot, and the expected difference is built from them in the order of
+// snapshot.h: added windows, then removed and changed windows, each by handle, with the changed keys of each window:
+//
+//   gcc -O2 -pthread ./tests/snapshot.c -o snapshot-test
+//   ./snapshot-test
+
+#include "harness.h"
+
+#define TEST_WINDOW_COUNT 20000
+#define TEST_CHANGE_COUNT 2000
+#define TEST_FIELDS "handle,title,pid,style,visible,rect"
+
+typedef struct
+{
+  int64_t handle;
+  int64_t pid;
+  int64_t style;
+  int is_visible;
+  int64_t rect[4];
+  // Title as written in the list, with its escapes
+  char title[MIDDLE_BUFFER_SIZE];
+  // Line of the window in the list
+  const char *line;
+  size_t line_length;
+} TestWindow;
+
+typedef struct
+{
+  TestWindow *windows;
+  int count;
+  char *text;
+} TestList;
+
+uint64_t random_state = 88172645463325252ull;
+char *expected = NULL;
+size_t expected_length = 0;
+size_t expected_size = 0;
+
+uint64_t nextRandom()
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+// Returns the value of a number key of an NDJSON line, zero when the line does not have the key
+int64_t findJsonNumber(const char *line, const char *end, const char *key)
+{
+  char pattern[64];
+  const char *position;
+  snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+  position = strstr(line, pattern);
+  if (position == NULL || position > end)
+    return 0;
+  if (strncmp(position + strlen(pattern), "true", 4) == 0)
+    return 1;
+  return strtoll(position + strlen(pattern), NULL, 10);
+}
+
+int compareTestWindows(const void *a, const void *b)
+{
+  const TestWindow *x = (const TestWindow *)a;
+  const TestWindow *y = (const TestWindow *)b;
+  return x->handle < y->handle ? -1 : x->handle > y->handle ? 1 : 0;
+}
+
+// Lists the desktop with the fields of the snapshot, sorted by handle
+void readTestList(TestList *list)
+{
+  const char *line;
+  const char *end;
+  const char *position;
+  TestWindow *window;
+  size_t length;
+  runHarnessRequest("--desktop", "--fields", TEST_FIELDS, "--format", "ndjson", NULL);
+  list->text = (char *)malloc(output_length + 1);
+  memcpy(list->text, output, output_length + 1);
+  list->windows = (TestWindow *)malloc(sizeof(TestWindow) * (TEST_WINDOW_COUNT + TEST_CHANGE_COUNT));
+  list->count = 0;
+  for (line = list->text; *line == '{' && list->count < TEST_WINDOW_COUNT + TEST_CHANGE_COUNT; line = end + 1)
+  {
+    end = strchr(line, '\n');
+    if (end == NULL)
+      break;
+    window = &list->windows[list->count++];
+    window->handle = findJsonNumber(line, end, "handle");
+    window->pid = findJsonNumber(line, end, "pid");
+    window->style = findJsonNumber(line, end, "style");
+    window->is_visible = (int)findJsonNumber(line, end, "visible");
+    window->rect[0] = findJsonNumber(line, end, "top");
+    window->rect[1] = findJsonNumber(line, end, "right");
+    window->rect[2] = findJsonNumber(line, end, "bottom");
+    window->rect[3] = findJsonNumber(line, end, "left");
+    window->line = line;
+    window->line_length = (size_t)(end - line);
+    window->title[0] = '\0';
+    position = strstr(line, "\"title\": \"");
+    if (position != NULL && position < end)
+    {
+      position += 10;
+      for (length = 0; position[length] != '"' && length + 2 < MIDDLE_BUFFER_SIZE; length++)
+        if (position[length] == '\\')
+          length++;
+      memcpy(window->title, position, length);
+      window->title[length] = '\0';
+    }
+  }
+  qsort(list->windows, (size_t)list->count, sizeof(TestWindow), compareTestWindows);
+}
+
+void freeTestList(TestList *list)
+{
+  free(list->windows);
+  free(list->text);
+}
+
+void appendExpected(const char *format, ...)
+{
+  va_list args;
+  int length;
+  for (;;)
+  {
+    va_start(args, format);
+    length = vsnprintf(expected + expected_length, expected_size - expected_length, format, args);
+    va_end(args);
+    if (expected_length + (size_t)length < expected_size)
+      break;
+    expected_size = (expected_length + (size_t)length + 1) * 2;
+    expected = (char *)realloc(expected, expected_size);
+  }
+  expected_length += (size_t)length;
+}
+
+// Builds the difference of two lists, comparing only the pid and the rectangle of windows unless every field is compared
+void buildExpectedDifference(TestList *before, TestList *after, int is_every_field)
+{
+  TestWindow *x;
+  TestWindow *y;
+  int kind;
+  int count;
+  int i;
+  int j;
+  size_t start;
+  size_t changed;
+  expected_length = 0;
+  appendExpected("%s", "{\"added\": [");
+  for (kind = 0; kind < 3; kind++)
+  {
+    if (kind == 1)
+      appendExpected("%s", "], \"removed\": [");
+    else if (kind == 2)
+      appendExpected("%s", "], \"changed\": [");
+    for (i = 0, j = 0, count = 0; i < before->count || j < after->count;)
+    {
+      x = i < before->count ? &before->windows[i] : NULL;
+      y = j < after->count ? &after->windows[j] : NULL;
+      if (y == NULL || (x != NULL && x->handle < y->handle))
+      {
+        if (kind == 1)
+          appendExpected("%s%lld", count++ != 0 ? ", " : "", (long long)x->handle);
+        i++;
+        continue;
+      }
+      if (x == NULL || y->handle < x->handle)
+      {
+        if (kind == 0)
+          appendExpected("%s%.*s", count++ != 0 ? ", " : "", (int)y->line_length, y->line);
+        j++;
+        continue;
+      }
+      if (kind == 2)
+      {
+        start = expected_length;
+        appendExpected("%s{\"handle\": %lld", count != 0 ? ", " : "", (long long)y->handle);
+        changed = expected_length;
+        if (is_every_field && strcmp(x->title, y->title) != 0)
+          appendExpected(", \"title\": \"%s\"", y->title);
+        if (x->pid != y->pid)
+          appendExpected(", \"pid\": %lld", (long long)y->pid);
+        if (is_every_field && x->style != y->style)
+          appendExpected(", \"style\": %lld", (long long)y->style);
+        if (is_every_field && x->is_visible != y->is_visible)
+          appendExpected(", \"visible\": %s", y->is_visible ? "true" : "false");
+        if (memcmp(x->rect, y->rect, sizeof(x->rect)) != 0)
+          appendExpected(", \"top\": %lld, \"right\": %lld, \"bottom\": %lld, \"left\": %lld", (long long)y->rect[0], (long long)y->rect[1], (long long)y->rect[2], (long long)y->rect[3]);
+        // Windows without changes are not written
+        if (expected_length == changed)
+          expected_length = start;
+        else
+        {
+          appendExpected("%s", "}");
+          count++;
+        }
+      }
+      i++;
+      j++;
+    }
+  }
+  appendExpected("%s", "]}");
+}
+
+// Changes windows of the desktop at random, like the script of the watch mode does, and hides or shows some of them
+void changeTestDesktop()
+{
+  char command[128];
+  int64_t handle;
+  int index;
+  int i;
+  for (i = 0; i < TEST_CHANGE_COUNT; i++)
+  {
+    index = (int)(nextRandom() % (uint64_t)(TEST_WINDOW_COUNT * 3));
+    handle = (int64_t)memoryGetHandle(index);
+    switch (nextRandom() % 7)
+    {
+    case 0:
+      snprintf(command, sizeof(command), "create %d Created \"%d\" \\ window", (int)(nextRandom() % 500), i);
+      break;
+    case 1:
+      snprintf(command, sizeof(command), "destroy %lld", (long long)handle);
+      break;
+    case 2:
+      snprintf(command, sizeof(command), "move %lld %d %d 640 480", (long long)handle, (int)(nextRandom() % 2000), (int)(nextRandom() % 1000));
+      break;
+    case 3:
+      snprintf(command, sizeof(command), "title %lld Renamed %d", (long long)handle, (int)(nextRandom() % 3));
+      break;
+    case 4:
+      snprintf(command, sizeof(command), "focus %lld", (long long)handle);
+      break;
+    default:
+      memory_windows[index].style ^= nextRandom() % 2 == 0 ? WS_VISIBLE : WS_MINIMIZE;
+      continue;
+    }
+    memoryApplyCommand(command);
+  }
+}
+
+// Returns the fastest time of a request, in milliseconds
+double measureRequest(const char *option, const char *path)
+{
+  int64_t best = 0;
+  int64_t start;
+  int64_t elapsed;
+  int i;
+  for (i = 0; i < 5; i++)
+  {
+    start = getClockNanoseconds();
+    if (option != NULL)
+      runHarnessRequest("--desktop", "--fields", TEST_FIELDS, option, path, NULL);
+    else
+      runHarnessRequest("--desktop", "--fields", TEST_FIELDS, NULL);
+    elapsed = getClockNanoseconds() - start;
+    best = best == 0 || elapsed < best ? elapsed : best;
+  }
+  return best / 1e6;
+}
+
+int main(int argn, char **argv)
+{
+  char path[] = "/tmp/window-state-snapshot-XXXXXX";
+  char other_path[] = "/tmp/window-state-snapshot-XXXXXX";
+  char count_text[32];
+  TestList before;
+  TestList after;
+  size_t difference_length;
+  int descriptor = mkstemp(path);
+  int other_descriptor = mkstemp(other_path);
+  if (descriptor < 0 || other_descriptor < 0)
+    return 1;
+  close(descriptor);
+  close(other_descriptor);
+  snprintf(count_text, sizeof(count_text), "%d", TEST_WINDOW_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", count_text);
+  initHarness();
+
+  readTestList(&before);
+  runHarnessRequest("--desktop", "--fields", TEST_FIELDS, "--snapshot-out", path, NULL);
+  checkHarness(snapshot_record_count == before.count, "the snapshot has %d records instead of %d", snapshot_record_count, before.count);
+  runHarnessRequest("--desktop", "--fields", "handle,pid,rect", "--snapshot-out", other_path, NULL);
+  runHarnessRequest("--desktop", "--fields", TEST_FIELDS, "--since", path, NULL);
+  checkHarness(strcmp(output, "{\"added\": [], \"removed\": [], \"changed\": []}") == 0, "the difference to an unchanged desktop is %.200s", output);
+
+  changeTestDesktop();
+  readTestList(&after);
+  runHarnessRequest("--desktop", "--fields", TEST_FIELDS, "--since", path, NULL);
+  buildExpectedDifference(&before, &after, 1);
+  checkHarness(strstr(expected, "\"added\": [{") != NULL && strstr(expected, "\"removed\": []") == NULL && strstr(expected, "\"changed\": []") == NULL, "the changes of the desktop do not add, remove and change windows");
+  checkHarness(output_length == expected_length && strcmp(output, expected) == 0, "the difference is %.300s\ninstead of %.300s", output, expected);
+  // Only the fields of both executions are compared, the added windows have the fields of the current one
+  runHarnessRequest("--desktop", "--fields", TEST_FIELDS, "--since", other_path, NULL);
+  buildExpectedDifference(&before, &after, 0);
+  checkHarness(output_length == expected_length && strcmp(output, expected) == 0, "the difference to a snapshot of other fields is %.300s\ninstead of %.300s", output, expected);
+  // A difference and a new snapshot in the same execution, the next difference is empty
+  runHarnessRequest("--desktop", "--fields", TEST_FIELDS, "--since", path, "--snapshot-out", path, NULL);
+  runHarnessRequest("--desktop", "--fields", TEST_FIELDS, "--since", path, NULL);
+  checkHarness(strcmp(output, "{\"added\": [], \"removed\": [], \"changed\": []}") == 0, "the difference to the replaced snapshot is %.200s", output);
+  runHarnessRequest("--desktop", "--since", "/nonexistent/window-state.bin", NULL);
+  checkHarness(strncmp(output, "Error: ", 7) == 0, "a missing snapshot is answered with \"%.100s\"", output);
+
+  changeTestDesktop();
+  runHarnessRequest("--desktop", "--fields", TEST_FIELDS, "--since", path, NULL);
+  difference_length = output_length;
+  runHarnessRequest("--desktop", "--fields", TEST_FIELDS, NULL);
+  printf("windows: %d, changes: %d, difference: %zu bytes, list: %zu bytes\n", after.count, TEST_CHANGE_COUNT, difference_length, output_length);
+  printf("--since: %.1f ms, --snapshot-out: %.1f ms, the list: %.1f ms\n", measureRequest("--since", path), measureRequest("--snapshot-out", other_path), measureRequest(NULL, NULL));
+  remove(path);
+  remove(other_path);
+  freeTestList(&before);
+  freeTestList(&after);
+  free(expected);
+  return finishHarness("snapshot");
+}
@@ -0,0 +1,330 @@
+// Spatial test: compares the answers of the spatial index with a scan of every window for random points and rectangles on
+// a generated desktop of 10,000 top-level windows, then measures the index against the scan.
+//
+// The scan lists the visible, not minimized top-level windows with their rectangles in z-order through the backend: a
+// point must return the first of them that contains it and a rectangle all of those it intersects, in z-order. Points
+// fall on the edges of windows as well as inside and outside the desktop, and three windows are made larger than the
+// desktop so that the index keeps them apart. The requests check the output and the filters, and that the index is kept
+// between requests until the backend reports a change or a request moves a window:
+//
+//   gcc -O2 -pthread ./tests/spatial.c -o spatial-test
+//   ./spatial-test
+
+#include "harness.h"
+
+#define TEST_TOP_COUNT 10000
+#define TEST_POINT_COUNT 200000
+#define TEST_LARGE_COUNT 3
+#define TEST_RECT_COUNT 20000
+#define TEST_REQUEST_COUNT 500
+#define TEST_REQUEST_POINTS 6
+#define TEST_REQUEST_RECT (TEST_REQUEST_POINTS * 2)
+#define TEST_SPAN 3200
+
+typedef struct
+{
+  HWND handle;
+  RECT rect;
+  DWORD pid;
+} TestWindow;
+
+TestWindow *reference;
+int reference_count = 0;
+int *reference_hits;
+int64_t request_build_count = 0;
+uint64_t random_state = 88172645463325252ull;
+
+uint64_t nextRandom()
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+// Lists the visible, not minimized top-level windows with a rectangle in z-order
+void collectReference()
+{
+  RECT rect;
+  HWND h;
+  reference_count = 0;
+  for (h = backendGetFirstChild(NULL); h != NULL; h = backendGetWindow(h, GW_HWNDNEXT))
+  {
+    if (!backendIsWindowVisible(h) || (backendGetWindowLong(h, GWL_STYLE) & WS_MINIMIZE) != 0 || !backendGetWindowRect(h, &rect) || rect.right <= rect.left || rect.bottom <= rect.top)
+      continue;
+    reference[reference_count].handle = h;
+    reference[reference_count].rect = rect;
+    backendGetWindowThreadProcessId(h, &reference[reference_count].pid);
+    reference_count++;
+  }
+}
+
+// Returns the first window of the scan that contains a point and has a pid, any pid with zero, or -1
+int findReferenceWindow(int64_t x, int64_t y, DWORD pid)
+{
+  RECT *rect;
+  int i;
+  for (i = 0; i < reference_count; i++)
+  {
+    rect = &reference[i].rect;
+    if (x >= rect->left && x < rect->right && y >= rect->top && y < rect->bottom && (pid == 0 || reference[i].pid == pid))
+      return i;
+  }
+  return -1;
+}
+
+// Lists the windows of the scan that intersect a rectangle into reference_hits, returns their count
+int findReferenceWindows(int64_t left, int64_t top, int64_t right, int64_t bottom, DWORD pid)
+{
+  RECT *rect;
+  int count = 0;
+  int i;
+  for (i = 0; i < reference_count; i++)
+  {
+    rect = &reference[i].rect;
+    if (left < rect->right && right > rect->left && top < rect->bottom && bottom > rect->top && (pid == 0 || reference[i].pid == pid))
+      reference_hits[count++] = i;
+  }
+  return count;
+}
+
+// Picks a point inside, on the edge of or outside a random window of the scan, or anywhere around the desktop
+void pickPoint(int64_t *x, int64_t *y)
+{
+  RECT *rect = &reference[nextRandom() % (uint64_t)reference_count].rect;
+  switch (nextRandom() % 4)
+  {
+  case 0:
+    *x = rect->left + (int64_t)(nextRandom() % (uint64_t)(rect->right - rect->left));
+    *y = rect->top + (int64_t)(nextRandom() % (uint64_t)(rect->bottom - rect->top));
+    break;
+  case 1:
+    *x = nextRandom() % 2 ? rect->left : rect->right - 1;
+    *y = nextRandom() % 2 ? rect->top : rect->bottom - 1;
+    break;
+  case 2:
+    *x = nextRandom() % 2 ? rect->left - 1 : rect->right;
+    *y = nextRandom() % 2 ? rect->top - 1 : rect->bottom;
+    break;
+  default:
+    *x = (int64_t)(nextRandom() % (TEST_SPAN + 400)) - 200;
+    *y = (int64_t)(nextRandom() % (TEST_SPAN + 400)) - 200;
+  }
+}
+
+// Returns zero when the window of a line of --at differs from the scan
+int isPointLikeReference(const char *line, int64_t x, int64_t y, DWORD pid)
+{
+  const char *position = strstr(line, "\"window\": ");
+  int index = findReferenceWindow(x, y, pid);
+  if (position == NULL || strtoll(line + 6, NULL, 10) != x)
+    return 0;
+  position += 10;
+  if (index < 0)
+    return strncmp(position, "null}", 5) == 0;
+  return strncmp(position, "{\"handle\": ", 11) == 0 && strtoll(position + 11, NULL, 10) == (int64_t)(intptr_t)reference[index].handle;
+}
+
+// Returns zero when the windows of a line of --intersects differ from the scan
+int isRectangleLikeReference(const char *line, int64_t left, int64_t top, int64_t right, int64_t bottom, DWORD pid)
+{
+  const char *position = strstr(line, "\"windows\": [");
+  int count = findReferenceWindows(left, top, right, bottom, pid);
+  int i;
+  if (position == NULL)
+    return 0;
+  position += 12;
+  for (i = 0; i < count; i++)
+  {
+    if (strncmp(position, i == 0 ? "{\"handle\": " : ", {\"handle\": ", i == 0 ? 11 : 13) != 0)
+      return 0;
+    position += i == 0 ? 11 : 13;
+    if (strtoll(position, (char **)&position, 10) != (int64_t)(intptr_t)reference[reference_hits[i]].handle || *position++ != '}')
+      return 0;
+  }
+  return strncmp(position, "]}", 2) == 0;
+}
+
+// Runs a request of points and a rectangle, counts the builds of the index, returns zero when an answer differs
+int isRequestLikeReference(int64_t *values, DWORD pid)
+{
+  char arguments[TEST_REQUEST_POINTS * 2 + 4][24];
+  char pid_text[24];
+  const char *line;
+  int i;
+  for (i = 0; i < TEST_REQUEST_POINTS * 2 + 4; i++)
+    snprintf(arguments[i], sizeof(arguments[i]), "%lld", (long long)values[i]);
+  snprintf(pid_text, sizeof(pid_text), "%u", (unsigned)pid);
+#define TEST_POINT(i) "--at", arguments[i * 2], arguments[i * 2 + 1]
+  runHarnessRequest(TEST_POINT(0), TEST_POINT(1), TEST_POINT(2), TEST_POINT(3), TEST_POINT(4), TEST_POINT(5), "--intersects", arguments[TEST_REQUEST_RECT], arguments[TEST_REQUEST_RECT + 1], arguments[TEST_REQUEST_RECT + 2], arguments[TEST_REQUEST_RECT + 3], "--fields", "handle", "--format", "ndjson", pid == 0 ? NULL : "--pid", pid_text, NULL);
+#undef TEST_POINT
+  request_build_count += spatial_build_count;
+  // The windows changed by the script of the request are compared with their new rectangles
+  collectReference();
+  for (i = 0, line = output; i < TEST_REQUEST_POINTS; i++, line = strchr(line, '\n') + 1)
+  {
+    if (strchr(line, '\n') == NULL || !isPointLikeReference(line, values[i * 2], values[i * 2 + 1], pid))
+      return 0;
+  }
+  return strchr(line, '\n') != NULL && strchr(line, '\n')[1] == '\0' && isRectangleLikeReference(line, values[TEST_REQUEST_RECT], values[TEST_REQUEST_RECT + 1], values[TEST_REQUEST_RECT + 2], values[TEST_REQUEST_RECT + 3], pid);
+}
+
+// Picks the values of a request of points followed by a rectangle
+void pickRequest(int64_t *values)
+{
+  int64_t width = 1 + (int64_t)(nextRandom() % 400);
+  int64_t height = 1 + (int64_t)(nextRandom() % 400);
+  int i;
+  for (i = 0; i < TEST_REQUEST_POINTS; i++)
+    pickPoint(&values[i * 2], &values[i * 2 + 1]);
+  pickPoint(&values[TEST_REQUEST_RECT], &values[TEST_REQUEST_RECT + 1]);
+  values[TEST_REQUEST_RECT + 2] = values[TEST_REQUEST_RECT] + width;
+  values[TEST_REQUEST_RECT + 3] = values[TEST_REQUEST_RECT + 1] + height;
+}
+
+int main(int argn, char **argv)
+{
+  char path[64];
+  char text[128];
+  int64_t values[TEST_REQUEST_POINTS * 2 + 4];
+  int64_t builds;
+  int64_t start;
+  int64_t index_time;
+  int64_t scan_time;
+  int64_t x;
+  int64_t y;
+  int64_t width;
+  int64_t height;
+  FILE *script;
+  HWND moved;
+  int failures = 0;
+  int count;
+  int expected;
+  int found;
+  int i;
+  int j;
+  snprintf(text, sizeof(text), "%d", TEST_TOP_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", text);
+  initHarness();
+  reference = (TestWindow *)malloc(sizeof(TestWindow) * TEST_TOP_COUNT);
+  reference_hits = (int *)malloc(sizeof(int) * TEST_TOP_COUNT);
+  if (reference == NULL || reference_hits == NULL)
+    return 1;
+  collectReference();
+  // A few windows cover the desktop and more, which the index keeps in its list of large windows
+  for (i = 0; i < TEST_LARGE_COUNT; i++)
+  {
+    snprintf(text, sizeof(text), "move %lld %d %d %d %d", (long long)(intptr_t)reference[(i * 2 + 1) * reference_count / (TEST_LARGE_COUNT * 2)].handle, -TEST_SPAN * 2, -TEST_SPAN * 2, TEST_SPAN * 5, TEST_SPAN * 5);
+    memoryApplyCommand(text);
+  }
+  collectReference();
+  // The script reports a move at the second query request, the index must then be rebuilt once
+  moved = reference[reference_count / 2].handle;
+  snprintf(path, sizeof(path), "/tmp/window-state-spatial-test-%d.txt", (int)getpid());
+  script = fopen(path, "wb");
+  if (script == NULL)
+    return 1;
+  fprintf(script, "tick\nmove %lld 5 7 40 30\ntick\n", (long long)(intptr_t)moved);
+  fclose(script);
+  setHarnessVariable("WINDOW_STATE_MEMORY_SCRIPT", path);
+
+  // The index directly against the scan
+  start = getClockNanoseconds();
+  checkHarness(buildSpatialIndex(NULL), "the index cannot be built");
+  index_time = getClockNanoseconds() - start;
+  checkHarness(spatial_window_count == reference_count && spatial_large_count == TEST_LARGE_COUNT, "the index holds %d windows and %d large ones instead of %d and %d", spatial_window_count, spatial_large_count, reference_count, TEST_LARGE_COUNT);
+  printf("%d windows, %d visible: index built in %.2f ms (%d large)", TEST_TOP_COUNT, reference_count, index_time / 1e6, spatial_large_count);
+  for (i = 0; i < TEST_POINT_COUNT; i++)
+  {
+    pickPoint(&x, &y);
+    found = findSpatialWindow(x, y, 0);
+    expected = findReferenceWindow(x, y, 0);
+    failures += (found < 0 ? NULL : spatial_windows[found].handle) != (expected < 0 ? NULL : reference[expected].handle);
+  }
+  checkHarness(failures == 0, "%d of %d points differ from the scan", failures, TEST_POINT_COUNT);
+  for (i = 0, failures = 0; i < TEST_RECT_COUNT; i++)
+  {
+    pickPoint(&x, &y);
+    // Rectangles of a few pixels up to larger than the desktop
+    width = 1 + (int64_t)(nextRandom() % (i % 100 == 0 ? TEST_SPAN * 2 : 300));
+    height = 1 + (int64_t)(nextRandom() % (i % 100 == 0 ? TEST_SPAN * 2 : 300));
+    count = findSpatialWindows(&(SpatialQuery){SPATIAL_INTERSECTS, x, y, x + width, y + height});
+    expected = findReferenceWindows(x, y, x + width, y + height, 0);
+    for (j = 0; j < count && j < expected && spatial_windows[spatial_hits[j]].handle == reference[reference_hits[j]].handle; j++)
+    {
+    }
+    failures += count != expected || j != count;
+  }
+  checkHarness(failures == 0, "%d of %d rectangles differ from the scan", failures, TEST_RECT_COUNT);
+
+  // Hit-tests of the index and of the scan
+  start = getClockNanoseconds();
+  for (i = 0, found = 0; i < TEST_POINT_COUNT; i++)
+    found += findSpatialWindow((int64_t)(nextRandom() % TEST_SPAN), (int64_t)(nextRandom() % TEST_SPAN), 0) >= 0;
+  index_time = getClockNanoseconds() - start;
+  start = getClockNanoseconds();
+  for (i = 0; i < TEST_POINT_COUNT / 100; i++)
+    found += findReferenceWindow((int64_t)(nextRandom() % TEST_SPAN), (int64_t)(nextRandom() % TEST_SPAN), 0) >= 0;
+  scan_time = (getClockNanoseconds() - start) * 100;
+  printf(", a hit-test in %.3f us against %.3f us for the scan (%d hits)", index_time / 1e3 / TEST_POINT_COUNT, scan_time / 1e3 / TEST_POINT_COUNT, found);
+  start = getClockNanoseconds();
+  for (i = 0, count = 0; i < TEST_RECT_COUNT; i++)
+  {
+    x = (int64_t)(nextRandom() % TEST_SPAN);
+    y = (int64_t)(nextRandom() % TEST_SPAN);
+    count += findSpatialWindows(&(SpatialQuery){SPATIAL_INTERSECTS, x, y, x + 100, y + 100});
+  }
+  index_time = getClockNanoseconds() - start;
+  printf(", a 100x100 rectangle returns %d windows in %.1f us\n", count / TEST_RECT_COUNT, index_time / 1e3 / TEST_RECT_COUNT);
+  freeSpatialIndex();
+
+  // Requests against the scan, the first one builds the index and the second one rebuilds it for the move of the script
+  pickRequest(values);
+  checkHarness(isRequestLikeReference(values, 0) && request_build_count == 1, "the first request differs from the scan");
+  pickRequest(values);
+  values[TEST_REQUEST_RECT] = 5;
+  values[TEST_REQUEST_RECT + 1] = 7;
+  values[TEST_REQUEST_RECT + 2] = 45;
+  values[TEST_REQUEST_RECT + 3] = 37;
+  snprintf(text, sizeof(text), "{\"handle\": %lld}", (long long)(intptr_t)moved);
+  checkHarness(isRequestLikeReference(values, 0) && request_build_count == 2 && strstr(output, text) != NULL, "the window moved by the script is not found at its new position");
+  for (i = 0, failures = 0; i < TEST_REQUEST_COUNT; i++)
+  {
+    pickRequest(values);
+    failures += !isRequestLikeReference(values, 0);
+  }
+  checkHarness(failures == 0, "%d of %d requests differ from the scan", failures, TEST_REQUEST_COUNT);
+  checkHarness(request_build_count == 2, "%d requests build the index %lld times instead of 2", TEST_REQUEST_COUNT + 2, (long long)request_build_count);
+  // Filtered queries skip the windows of other processes
+  for (i = 0, failures = 0; i < TEST_REQUEST_COUNT / 10; i++)
+  {
+    pickRequest(values);
+    failures += !isRequestLikeReference(values, reference[nextRandom() % (uint64_t)reference_count].pid);
+  }
+  checkHarness(failures == 0, "%d of %d requests filtered by --pid differ from the scan", failures, TEST_REQUEST_COUNT / 10);
+
+  // A request that moves a window makes the next query rebuild the index
+  moved = reference[0].handle;
+  snprintf(text, sizeof(text), "%lld", (long long)(intptr_t)moved);
+  runHarnessRequest("--handle", text, "--move", "3000", "3000", NULL);
+  pickRequest(values);
+  values[TEST_REQUEST_RECT] = 3000;
+  values[TEST_REQUEST_RECT + 1] = 3000;
+  values[TEST_REQUEST_RECT + 2] = 3001;
+  values[TEST_REQUEST_RECT + 3] = 3001;
+  builds = request_build_count;
+  snprintf(text, sizeof(text), "{\"handle\": %lld}", (long long)(intptr_t)moved);
+  checkHarness(isRequestLikeReference(values, 0) && request_build_count == builds + 1 && strstr(output, text) != NULL, "the query after a move is answered from the previous index");
+
+  runHarnessRequest("--at", "10", NULL);
+  checkHarness(strncmp(output, "Error: Expected 2 coordinates", 29) == 0, "--at with one coordinate is answered with \"%.60s\"", output);
+  runHarnessRequest("--intersects", "10", "10", "10", "20", NULL);
+  checkHarness(strncmp(output, "Error: Invalid rectangle", 24) == 0, "an empty rectangle is answered with \"%.60s\"", output);
+  runHarnessRequest("--at", "10", "x", NULL);
+  checkHarness(strncmp(output, "Error: Invalid coordinate", 25) == 0, "a coordinate that is not a number is answered with \"%.60s\"", output);
+
+  remove(path);
+  free(reference_hits);
+  free(reference);
+  return finishHarness("spatial");
+}
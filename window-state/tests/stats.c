@@ -0,0 +1,245 @@
+// Stats test: reads the object written to stderr by --stats for listings of the generated desktop and compares its counters
+// with the windows and processes of the listing, then measures the instrumentation with and without the option.
+//
+// The timed calls must be counted once per window that reads their field, the process cache must open each process once,
+// and the histogram of each call must add up to its count with the slowest call in its last bucket. The counts must be the
+// same when the windows are read by the threads of --timeout. Without --stats, nothing is written to stderr and no call is
+// timed:
+//
+//   gcc -O2 -pthread ./tests/stats.c -o stats-test
+//   ./stats-test
+
+#include "harness.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TEST_TOP_COUNT 2000
+#define TEST_SECTION_COUNT 16
+#define TEST_MEASURE_COUNT 20
+
+char stats_path[64];
+char *stats_text = NULL;
+size_t stats_length = 0;
+int saved_stderr = -1;
+
+// Sends stderr to the file of the test until endStatsCapture
+void beginStatsCapture()
+{
+  int file;
+  fflush(stderr);
+  file = open(stats_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  saved_stderr = dup(2);
+  dup2(file, 2);
+  close(file);
+}
+
+// Restores stderr and reads what was written to it into stats_text
+void endStatsCapture()
+{
+  FILE *file;
+  long size;
+  fflush(stderr);
+  dup2(saved_stderr, 2);
+  close(saved_stderr);
+  file = fopen(stats_path, "rb");
+  fseek(file, 0, SEEK_END);
+  size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  free(stats_text);
+  stats_text = (char *)malloc((size_t)size + 1);
+  stats_length = fread(stats_text, 1, (size_t)size, file);
+  stats_text[stats_length] = '\0';
+  fclose(file);
+}
+
+// Returns the value of a key of the statistics after the first key of a section, or at the top level without section,
+// -1 when the key is not found
+int64_t readStatsNumber(const char *section, const char *key)
+{
+  char pattern[64];
+  const char *position = stats_text;
+  if (section != NULL)
+  {
+    snprintf(pattern, sizeof(pattern), "\"%s\": {", section);
+    position = strstr(position, pattern);
+    if (position == NULL)
+      return -1;
+  }
+  snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+  position = strstr(position, pattern);
+  return position == NULL ? -1 : strtoll(position + strlen(pattern), NULL, 10);
+}
+
+// Returns zero when the statistics are not a single line of one JSON object with its sections in the documented order
+int isStatsObject()
+{
+  const char *sections[TEST_SECTION_COUNT] = {"\"backend\": \"memory\"", "\"process_cache\": {", "\"expression\": {", "\"tree\": {", "\"layout\": {", "\"handles\": {", "\"fetch\": {", "\"spatial\": {", "\"occlusion\": {", "\"order\": {", "\"aggregate\": {", "\"capture\": {", "\"time\": {", "\"output\": {", "\"calls\": {", "\"GetWindowRect\": {"};
+  const char *previous = stats_text;
+  const char *position;
+  int level = 0;
+  int i;
+  if (stats_length < 2 || stats_text[0] != '{' || strchr(stats_text, '\n') != stats_text + stats_length - 1)
+    return 0;
+  for (i = 0; i < TEST_SECTION_COUNT; i++)
+  {
+    position = strstr(stats_text, sections[i]);
+    if (position == NULL || position < previous)
+      return 0;
+    previous = position;
+  }
+  for (position = stats_text; *position != '\0'; position++)
+  {
+    level += *position == '{' ? 1 : *position == '}' ? -1 : 0;
+    if (level == 0 && *position != '\n' && position[1] != '\n')
+      return 0;
+  }
+  return level == 0;
+}
+
+// Returns zero when the histogram of a call does not add up to its count or does not hold its slowest call in its last
+// bucket, with the buckets in increasing powers of two
+int isHistogramLikeCount(const char *call)
+{
+  char pattern[64];
+  const char *position;
+  char *end;
+  int64_t count = readStatsNumber(call, "count");
+  int64_t max = readStatsNumber(call, "max_ns");
+  int64_t total = readStatsNumber(call, "total_ns");
+  int64_t bound = 0;
+  int64_t previous = 0;
+  int64_t sum = 0;
+  snprintf(pattern, sizeof(pattern), "\"%s\": {", call);
+  position = strstr(stats_text, pattern);
+  if (position == NULL || count < 0 || (position = strstr(position, "\"histogram\": {")) == NULL)
+    return 0;
+  for (position += 14; *position == '"' || *position == ','; position = end)
+  {
+    position += *position == ',' ? 3 : 1;
+    bound = strtoll(position, &end, 10);
+    if (bound <= previous || (bound & (bound - 1)) != 0 || strncmp(end, "\": ", 3) != 0)
+      return 0;
+    sum += strtoll(end + 3, &end, 10);
+    previous = bound;
+  }
+  if (*position != '}')
+    return 0;
+  if (count == 0)
+    return sum == 0 && max == 0 && total == 0;
+  return sum == count && max <= total && max < bound && max >= bound / 2;
+}
+
+// Returns the fastest time of a desktop listing in milliseconds, with --stats or without
+double measureListing(int is_stats)
+{
+  int64_t best = 0;
+  int64_t start;
+  int64_t elapsed;
+  int i;
+  for (i = 0; i < TEST_MEASURE_COUNT; i++)
+  {
+    start = getClockNanoseconds();
+    if (is_stats)
+      runHarnessRequest("--desktop", "--fields", "handle,title,rect,exec", "--format", "ndjson", "--stats", NULL);
+    else
+      runHarnessRequest("--desktop", "--fields", "handle,title,rect,exec", "--format", "ndjson", NULL);
+    elapsed = getClockNanoseconds() - start;
+    best = best == 0 || elapsed < best ? elapsed : best;
+  }
+  return best / 1e6;
+}
+
+int main(int argn, char **argv)
+{
+  const char *calls[STATS_CALL_COUNT] = {"GetWindowText", "OpenProcess", "GetModuleFileNameEx", "GetWindowRect"};
+  const char *timeouts[2] = {NULL, "1000"};
+  char text[32];
+  DWORD *pids;
+  DWORD pid;
+  HWND h;
+  int64_t start;
+  int64_t total;
+  int process_count = 0;
+  int window_count = 0;
+  int count;
+  int i;
+  int j;
+  snprintf(text, sizeof(text), "%d", TEST_TOP_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", text);
+  initHarness();
+  snprintf(stats_path, sizeof(stats_path), "/tmp/window-state-stats-test-%d.json", (int)getpid());
+  pids = (DWORD *)malloc(sizeof(DWORD) * TEST_TOP_COUNT);
+  if (pids == NULL)
+    return 1;
+  // The processes of the top-level windows, each opened once by the process cache while they fit in it
+  for (h = backendGetFirstChild(NULL); h != NULL; h = backendGetWindow(h, GW_HWNDNEXT))
+  {
+    backendGetWindowThreadProcessId(h, &pid);
+    for (j = 0; j < process_count && pids[j] != pid; j++)
+    {
+    }
+    if (j == process_count)
+      pids[process_count++] = pid;
+    window_count++;
+  }
+  checkHarness(process_count <= PROCESS_CACHE_SIZE * 3 / 4, "the %d processes of the desktop do not fit in the process cache", process_count);
+
+  beginStatsCapture();
+  runHarnessRequest("--desktop", "--fields", "handle,title,rect,exec", "--format", "ndjson", NULL);
+  endStatsCapture();
+  checkHarness(stats_length == 0, "a listing without --stats writes %d bytes to stderr", (int)stats_length);
+  for (i = 0, count = 0; i < STATS_CALL_COUNT; i++)
+    count += stats_calls[i].count != 0;
+  checkHarness(count == 0, "a listing without --stats times %d calls", count);
+
+  for (i = 0; i < 2; i++)
+  {
+    beginStatsCapture();
+    if (timeouts[i] == NULL)
+      runHarnessRequest("--desktop", "--fields", "handle,title,rect,exec", "--format", "ndjson", "--stats", NULL);
+    else
+      runHarnessRequest("--desktop", "--fields", "handle,title,rect,exec", "--format", "ndjson", "--timeout", timeouts[i], "--threads", "4", "--stats", NULL);
+    waitFetchWorkers();
+    endStatsCapture();
+    snprintf(text, sizeof(text), "%s", timeouts[i] == NULL ? "--stats" : "--stats --timeout");
+    checkHarness(isStatsObject(), "%s writes another object than documented: %.200s", text, stats_text);
+    checkHarness(readStatsNumber("GetWindowText", "count") == window_count && readStatsNumber("GetWindowRect", "count") == window_count, "%s counts %lld titles and %lld rectangles for %d windows", text, (long long)readStatsNumber("GetWindowText", "count"), (long long)readStatsNumber("GetWindowRect", "count"), window_count);
+    checkHarness(readStatsNumber("process_cache", "misses") == process_count && readStatsNumber("process_cache", "hits") == window_count - process_count && readStatsNumber("process_cache", "entries") == process_count, "%s counts %lld misses and %lld hits for %d processes", text, (long long)readStatsNumber("process_cache", "misses"), (long long)readStatsNumber("process_cache", "hits"), process_count);
+    checkHarness(readStatsNumber(NULL, "process_opens") == process_count && readStatsNumber("OpenProcess", "count") == process_count && readStatsNumber("GetModuleFileNameEx", "count") == process_count, "%s opens %lld processes instead of %d", text, (long long)readStatsNumber("OpenProcess", "count"), process_count);
+    for (j = 0; j < STATS_CALL_COUNT; j++)
+      checkHarness(isHistogramLikeCount(calls[j]), "%s writes a histogram of %s unlike its count", text, calls[j]);
+    checkHarness(readStatsNumber("output", "bytes") == (int64_t)output_length && readStatsNumber("output", "peak_buffer") > 0, "%s counts %lld bytes for %d bytes of output", text, (long long)readStatsNumber("output", "bytes"), (int)output_length);
+    checkHarness(readStatsNumber("time", "parse_ns") > 0 && readStatsNumber("time", "enumerate_ns") > 0 && readStatsNumber("time", "parse_ns") + readStatsNumber("time", "enumerate_ns") <= readStatsNumber("time", "total_ns"), "%s writes phases longer than the execution", text);
+  }
+  // Requests that select no window time no call
+  beginStatsCapture();
+  runHarnessRequest("--desktop", "--title", "No Such Window", "--stats", NULL);
+  endStatsCapture();
+  for (j = 0, count = 0; j < STATS_CALL_COUNT; j++)
+    count += !isHistogramLikeCount(calls[j]);
+  checkHarness(isStatsObject() && count == 0 && readStatsNumber("GetWindowRect", "count") == 0, "--stats without windows writes %.200s", stats_text);
+
+  // A disabled call is a branch, an enabled one reads the clock twice
+  is_option_stats = 0;
+  start = getClockNanoseconds();
+  for (i = 0; i < 10000000; i++)
+    endStatsCall(STATS_CALL_WINDOW_RECT, beginStatsCall());
+  total = getClockNanoseconds() - start;
+  printf("timed calls: %.2f ns disabled", total / 1e7);
+  is_option_stats = 1;
+  start = getClockNanoseconds();
+  for (i = 0; i < 1000000; i++)
+    endStatsCall(STATS_CALL_WINDOW_RECT, beginStatsCall());
+  total = getClockNanoseconds() - start;
+  is_option_stats = 0;
+  printf(", %.1f ns enabled\n", total / 1e6);
+  beginStatsCapture();
+  printf("%d windows, --fields handle,title,rect,exec: %.2f ms without --stats, ", window_count, measureListing(0));
+  printf("%.2f ms with --stats\n", measureListing(1));
+  endStatsCapture();
+
+  remove(stats_path);
+  free(stats_text);
+  free(pids);
+  return finishHarness("stats");
+}
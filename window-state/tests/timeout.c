@@ -0,0 +1,275 @@
+// Timeout test: lists a generated desktop with --timeout while WINDOW_STATE_MEMORY_SLOW makes the title of some windows
+// take longer than the budget, and compares the output with the listing of the desktop without slow windows.
+//
+// The slow windows must be written with their handle and "timeout": true while every other line stays the same, and in
+// about the budget rather than the delay of the slow windows. Windows before a slow one must reach a reader before its
+// budget has elapsed, and more slow windows than the thread limit must not hold the listing back. In serve mode, a listing
+// that follows a timed out request must not wait for the abandoned threads, while a request that moves a window must:
+//
+//   gcc -O2 -pthread ./tests/timeout.c -o timeout-test
+//   ./timeout-test
+
+#include "harness.h"
+
+#include <poll.h>
+#include <sys/wait.h>
+
+#define TEST_TOP_COUNT 3000
+#define TEST_SLOW_COUNT 8
+#define TEST_SLOW_DELAY 400
+#define TEST_TIMEOUT 50
+#define TEST_LIMIT_COUNT 70
+#define TEST_STREAM_INDEX 50
+#define TEST_STREAM_DELAY 800
+#define TEST_STREAM_TIMEOUT 500
+
+int64_t *tops;
+int top_count = 0;
+char *reference;
+size_t reference_length = 0;
+
+// Lists the handles of the windows of the output in a list of the caller, returns their count
+int readHandles(int64_t *handles, int limit)
+{
+  const char *line;
+  int count = 0;
+  for (line = output; line != NULL && strncmp(line, "{\"handle\": ", 11) == 0 && count < limit; line = strchr(line, '\n'), line = line != NULL ? line + 1 : NULL)
+    handles[count++] = strtoll(line + 11, NULL, 10);
+  return count;
+}
+
+// Makes the windows of a list of indexes slow to read for a delay in milliseconds, none with a count of zero
+void setSlowWindows(const int *indexes, int count, int delay)
+{
+  char slow[TEST_LIMIT_COUNT * 24 + 1];
+  size_t length = 0;
+  int i;
+  slow[0] = '\0';
+  for (i = 0; i < count; i++)
+    length += (size_t)snprintf(&slow[length], sizeof(slow) - length, "%s%lld:%d", i == 0 ? "" : ",", (long long)tops[indexes[i]], delay);
+  setHarnessVariable("WINDOW_STATE_MEMORY_SLOW", slow);
+  memoryReadSlowWindows();
+}
+
+// Returns zero when a line of the output is neither the line of the reference at the same position nor a timeout, or when
+// a slow window was read, counts the timeouts into a counter of the caller
+int isOutputLikeReference(const int *indexes, int count, int *timeout_count)
+{
+  char timeout[64];
+  const char *line = output;
+  const char *expected = reference;
+  const char *end;
+  size_t length;
+  int is_slow;
+  int i;
+  int j;
+  *timeout_count = 0;
+  for (i = 0; i < top_count; i++, line += length, expected = strchr(expected, '\n') + 1)
+  {
+    end = strchr(line, '\n');
+    if (end == NULL)
+      return 0;
+    length = (size_t)(end - line) + 1;
+    for (j = 0, is_slow = 0; j < count; j++)
+      is_slow |= indexes[j] == i;
+    snprintf(timeout, sizeof(timeout), "{\"handle\": %lld, \"timeout\": true}\n", (long long)tops[i]);
+    if (strlen(timeout) == length && memcmp(line, timeout, length) == 0)
+    {
+      (*timeout_count)++;
+      continue;
+    }
+    if (is_slow || memcmp(line, expected, length) != 0)
+      return 0;
+  }
+  return *line == '\0';
+}
+
+// Reads a line of a child process into a buffer of the caller, returns zero when none comes within a few seconds
+int readChildLine(int descriptor, char *line, size_t size)
+{
+  struct pollfd poll_descriptor;
+  size_t length = 0;
+  poll_descriptor.fd = descriptor;
+  poll_descriptor.events = POLLIN;
+  while (length + 1 < size)
+  {
+    if (poll(&poll_descriptor, 1, 5000) <= 0 || read(descriptor, &line[length], 1) != 1)
+      return 0;
+    if (line[length++] == '\n')
+      break;
+  }
+  line[length] = '\0';
+  return 1;
+}
+
+// Reads the framed response of a served request and skips its payload, returns its exit code or -1 when none comes
+int readServedResponse(int descriptor)
+{
+  char header[128];
+  char payload[4096];
+  const char *position;
+  int64_t length;
+  ssize_t count;
+  if (!readChildLine(descriptor, header, sizeof(header)) || (position = strstr(header, "\"length\": ")) == NULL)
+    return -1;
+  for (length = strtoll(position + 10, NULL, 10) + 1; length > 0; length -= count)
+  {
+    count = read(descriptor, payload, length < (int64_t)sizeof(payload) ? (size_t)length : sizeof(payload));
+    if (count <= 0)
+      return -1;
+  }
+  return atoi(strstr(header, "\"code\": ") + 8);
+}
+
+// Starts a child process running the program with the arguments that follow until a NULL one, with pipes for its input
+// and output, returns its pid
+pid_t startChild(int *input, int *answers, const char *argument, ...)
+{
+  char *arguments[16];
+  int argn = 0;
+  int status;
+  pid_t child;
+  va_list args;
+  arguments[argn++] = (char *)"window-state";
+  va_start(args, argument);
+  for (; argument != NULL && argn < 15; argument = va_arg(args, const char *))
+    arguments[argn++] = (char *)argument;
+  va_end(args);
+  arguments[argn] = NULL;
+  if (pipe(input) != 0 || pipe(answers) != 0)
+    return -1;
+  // The output of the test still buffered would be written again by the child
+  fflush(stdout);
+  child = fork();
+  if (child == 0)
+  {
+    dup2(input[0], 0);
+    dup2(answers[1], 1);
+    close(input[1]);
+    close(answers[0]);
+    status = runWindowState(argn, arguments);
+    fflush(stdout);
+    _exit(status);
+  }
+  close(input[0]);
+  close(answers[1]);
+  return child;
+}
+
+int main(int argn, char **argv)
+{
+  int slow_indexes[TEST_SLOW_COUNT] = {5, 100, 101, 102, 1500, 1501, 2990, 2999};
+  int limit_indexes[TEST_LIMIT_COUNT];
+  int stream_index = TEST_STREAM_INDEX;
+  char text[256];
+  char timeout[32];
+  int64_t start;
+  int64_t elapsed;
+  int64_t before;
+  int input[2];
+  int answers[2];
+  int timeout_count = 0;
+  int status;
+  int code;
+  int i;
+  pid_t child;
+  snprintf(text, sizeof(text), "%d", TEST_TOP_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", text);
+  initHarness();
+  tops = (int64_t *)malloc(sizeof(int64_t) * TEST_TOP_COUNT);
+  if (tops == NULL)
+    return 1;
+  runHarnessRequest("--desktop", "--fields", "handle,title,pid,rect", "--format", "ndjson", NULL);
+  top_count = readHandles(tops, TEST_TOP_COUNT);
+  reference = (char *)malloc(output_length + 1);
+  if (reference == NULL)
+    return 1;
+  memcpy(reference, output, output_length + 1);
+  reference_length = output_length;
+  checkHarness(top_count == TEST_TOP_COUNT, "%d top-level windows are listed instead of %d", top_count, TEST_TOP_COUNT);
+
+  // Without slow windows, the pool writes the same bytes as the listing
+  runHarnessRequest("--desktop", "--fields", "handle,title,pid,rect", "--format", "ndjson", "--timeout", "1000", "--threads", "4", NULL);
+  checkHarness(output_length == reference_length && memcmp(output, reference, reference_length) == 0, "--timeout writes other bytes than the listing without slow windows");
+
+  setSlowWindows(slow_indexes, TEST_SLOW_COUNT, TEST_SLOW_DELAY);
+  snprintf(timeout, sizeof(timeout), "%d", TEST_TIMEOUT);
+  start = getClockNanoseconds();
+  runHarnessRequest("--desktop", "--fields", "handle,title,pid,rect", "--format", "ndjson", "--timeout", timeout, "--threads", "4", NULL);
+  elapsed = getClockNanoseconds() - start;
+  checkHarness(isOutputLikeReference(slow_indexes, TEST_SLOW_COUNT, &timeout_count) && timeout_count == TEST_SLOW_COUNT && fetch_timeout_count == TEST_SLOW_COUNT, "--timeout %s writes %d timeouts (%lld counted) instead of the %d slow windows", timeout, timeout_count, (long long)fetch_timeout_count, TEST_SLOW_COUNT);
+  checkHarness(elapsed < (int64_t)TEST_SLOW_DELAY * 1000000, "--timeout %s takes %.1f ms, longer than a slow window", timeout, elapsed / 1e6);
+  printf("%d windows with %d taking %d ms: %.1f ms with --timeout %s", top_count, TEST_SLOW_COUNT, TEST_SLOW_DELAY, elapsed / 1e6, timeout);
+  runHarnessRequest("--desktop", "--fields", "handle,title,pid,rect", "--format", "json", "--timeout", timeout, "--threads", "4", NULL);
+  for (i = 0, timeout_count = 0; output[i] != '\0'; i++)
+    timeout_count += strncmp(&output[i], ", \"timeout\": true}", 18) == 0;
+  checkHarness(output[0] == '[' && output[output_length - 1] == ']' && timeout_count == TEST_SLOW_COUNT, "--timeout %s --format json writes %d timeouts in \"%.40s\"", timeout, timeout_count, output);
+  // A budget longer than the slow windows reads them all
+  start = getClockNanoseconds();
+  runHarnessRequest("--desktop", "--fields", "handle,title,pid,rect", "--format", "ndjson", "--timeout", "2000", "--threads", "4", NULL);
+  elapsed = getClockNanoseconds() - start;
+  checkHarness(output_length == reference_length && memcmp(output, reference, reference_length) == 0 && fetch_timeout_count == 0, "--timeout 2000 does not read the slow windows");
+  printf(", %.1f ms with --timeout 2000\n", elapsed / 1e6);
+
+  // Slow windows past the thread limit, the windows left once every thread is stuck are written without being read
+  for (i = 0; i < TEST_LIMIT_COUNT; i++)
+    limit_indexes[i] = i;
+  setSlowWindows(limit_indexes, TEST_LIMIT_COUNT, TEST_SLOW_DELAY);
+  start = getClockNanoseconds();
+  runHarnessRequest("--desktop", "--fields", "handle,title,pid,rect", "--format", "ndjson", "--timeout", "10", "--threads", "4", NULL);
+  elapsed = getClockNanoseconds() - start;
+  checkHarness(isOutputLikeReference(limit_indexes, TEST_LIMIT_COUNT, &timeout_count) && timeout_count >= TEST_LIMIT_COUNT && elapsed < (int64_t)TEST_SLOW_DELAY * 1000000, "%d slow windows are written with %d timeouts in %.1f ms", TEST_LIMIT_COUNT, timeout_count, elapsed / 1e6);
+  printf("%d windows taking %d ms: %.1f ms with --timeout 10 and %d windows timed out\n", TEST_LIMIT_COUNT, TEST_SLOW_DELAY, elapsed / 1e6, timeout_count);
+  setSlowWindows(NULL, 0, 0);
+  runHarnessRequest("--desktop", "--fields", "handle,title,pid,rect", "--format", "ndjson", "--timeout", "1000", "--threads", "4", NULL);
+  checkHarness(output_length == reference_length && memcmp(output, reference, reference_length) == 0, "the request after the abandoned threads writes other bytes than the listing");
+
+  // The windows before a slow one are flushed to the reader before the budget of the slow one has elapsed
+  setSlowWindows(&stream_index, 1, TEST_STREAM_DELAY);
+  snprintf(timeout, sizeof(timeout), "%d", TEST_STREAM_TIMEOUT);
+  start = getClockNanoseconds();
+  child = startChild(input, answers, "--desktop", "--fields", "handle,title", "--format", "ndjson", "--timeout", timeout, "--threads", "4", NULL);
+  for (i = 0; i < TEST_STREAM_INDEX && readChildLine(answers[0], text, sizeof(text)); i++)
+  {
+  }
+  before = getClockNanoseconds() - start;
+  code = readChildLine(answers[0], text, sizeof(text));
+  elapsed = getClockNanoseconds() - start;
+  snprintf(timeout, sizeof(timeout), "{\"handle\": %lld, \"timeout\": true}", (long long)tops[TEST_STREAM_INDEX]);
+  checkHarness(i == TEST_STREAM_INDEX && before < (int64_t)TEST_STREAM_TIMEOUT * 1000000 / 2, "the %d windows before a slow one are read in %.1f ms", i, before / 1e6);
+  checkHarness(code && strncmp(text, timeout, strlen(timeout)) == 0 && elapsed >= (int64_t)TEST_STREAM_TIMEOUT * 1000000, "the slow window is written as \"%.60s\" after %.1f ms", text, elapsed / 1e6);
+  printf("streamed: %d windows before a slow one in %.1f ms, the slow one after %.1f ms\n", i, before / 1e6, elapsed / 1e6);
+  for (i++; readChildLine(answers[0], text, sizeof(text)); i++)
+  {
+  }
+  close(input[1]);
+  close(answers[0]);
+  waitpid(child, &status, 0);
+  checkHarness(i == top_count && WIFEXITED(status) && WEXITSTATUS(status) == 0, "the streaming listing writes %d windows and exits with status %d", i, status);
+
+  // In serve mode, a listing that does not read the slow title does not wait for the threads abandoned by the previous request but a move does
+  child = startChild(input, answers, "--serve", NULL);
+  snprintf(text, sizeof(text), "{\"id\": 1, \"args\": [\"--desktop\", \"--fields\", \"handle,title\", \"--timeout\", \"%d\"]}\n{\"id\": 2, \"args\": [\"--desktop\", \"--fields\", \"handle,pid\"]}\n", TEST_TIMEOUT);
+  start = getClockNanoseconds();
+  code = write(input[1], text, strlen(text)) == (ssize_t)strlen(text) && readServedResponse(answers[0]) == 0 && readServedResponse(answers[0]) == 0;
+  before = getClockNanoseconds() - start;
+  snprintf(text, sizeof(text), "{\"id\": 3, \"args\": [\"--handle\", %lld, \"--move\", 10, 10]}\n", (long long)tops[TEST_STREAM_INDEX]);
+  code = code && write(input[1], text, strlen(text)) == (ssize_t)strlen(text) && readServedResponse(answers[0]) == 0;
+  elapsed = getClockNanoseconds() - start;
+  checkHarness(code && before < (int64_t)TEST_STREAM_DELAY * 1000000 / 2, "a served listing after a timeout answers after %.1f ms", before / 1e6);
+  checkHarness(code && elapsed >= (int64_t)TEST_STREAM_DELAY * 1000000 * 3 / 4, "a served move after a timeout answers after %.1f ms, before the abandoned thread returns", elapsed / 1e6);
+  printf("served after a timeout: a listing in %.1f ms, a move in %.1f ms\n", before / 1e6, elapsed / 1e6);
+  close(input[1]);
+  close(answers[0]);
+  waitpid(child, &status, 0);
+  setSlowWindows(NULL, 0, 0);
+
+  runHarnessRequest("--desktop", "--timeout", "0", NULL);
+  checkHarness(strncmp(output, "Error: Invalid timeout", 22) == 0, "--timeout 0 is answered with \"%.60s\"", output);
+  runHarnessRequest("--tree", "--timeout", "100", NULL);
+  checkHarness(strncmp(output, "Error:", 6) == 0, "--tree --timeout is answered with \"%.60s\"", output);
+
+  free(reference);
+  free(tops);
+  return finishHarness("timeout");
+}
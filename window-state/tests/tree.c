@@ -0,0 +1,212 @@
+// Tree test: compares the output of --tree on a generated tree of about 100,000 windows for several thread counts, checks
+// its nesting against the children listed by --parent, then measures the workers.
+//
+// The desktop has 6,667 top-level windows with two children per level down to three levels. The output must be the same
+// bytes whatever the number of threads, and --depth must cut the same nesting at each level. The measures time the tree on
+// 1 to 8 threads, then with the 64 topmost windows made slow to read, which all fall in the range of the first worker, so
+// that the others only keep up by stealing its tasks:
+//
+//   gcc -O2 -pthread ./tests/tree.c -o tree-test
+//   ./tree-test
+
+#include "harness.h"
+
+#define TEST_TOP_COUNT 6667
+#define TEST_CHILD_COUNT 2
+#define TEST_DEPTH 3
+#define TEST_SLOW_COUNT 64
+#define TEST_SLOW_DELAY 2
+
+typedef struct
+{
+  int64_t handle;
+  int level;
+} TestNode;
+
+TestNode *reference_nodes;
+int reference_count = 0;
+TestNode *tree_nodes;
+int tree_count = 0;
+int node_limit = 0;
+
+// Lists the handles of the windows of a request in a list of the caller, returns their count
+int readHandles(int64_t *handles, int limit)
+{
+  const char *line;
+  int count = 0;
+  for (line = output; line != NULL && strncmp(line, "{\"handle\": ", 11) == 0 && count < limit; line = strchr(line, '\n'), line = line != NULL ? line + 1 : NULL)
+    handles[count++] = strtoll(line + 11, NULL, 10);
+  return count;
+}
+
+// Appends a window and its descendants read by --parent requests, in the order of the tree
+void appendReferenceNode(int64_t handle, int level)
+{
+  int64_t children[16];
+  char handle_text[32];
+  int count;
+  int i;
+  if (reference_count >= node_limit)
+    return;
+  reference_nodes[reference_count].handle = handle;
+  reference_nodes[reference_count].level = level;
+  reference_count++;
+  snprintf(handle_text, sizeof(handle_text), "%lld", (long long)handle);
+  runHarnessRequest("--parent", handle_text, "--fields", "handle", "--format", "ndjson", NULL);
+  count = readHandles(children, 16);
+  for (i = 0; i < count; i++)
+    appendReferenceNode(children[i], level + 1);
+}
+
+// Lists the windows of a tree output with their level, returns zero when the output is not nested as expected
+int readTreeNodes()
+{
+  const char *position = output;
+  int level = -1;
+  tree_count = 0;
+  for (; *position != '\0'; position++)
+  {
+    if (*position == '"')
+    {
+      for (position++; *position != '"' && *position != '\0'; position++)
+        if (*position == '\\')
+          position++;
+      if (*position == '\0')
+        return 0;
+    }
+    else if (*position == '[')
+      level++;
+    else if (*position == ']')
+      level--;
+    else if (*position == '{')
+    {
+      if (strncmp(position, "{\"handle\": ", 11) != 0 || tree_count >= node_limit)
+        return 0;
+      tree_nodes[tree_count].handle = strtoll(position + 11, NULL, 10);
+      tree_nodes[tree_count].level = level;
+      tree_count++;
+    }
+  }
+  return level == -1;
+}
+
+// Returns zero when the windows of the output are not those of the reference down to a depth, in the same order and levels
+int isTreeLikeReference(int depth)
+{
+  int i;
+  int j = 0;
+  if (!readTreeNodes())
+    return 0;
+  for (i = 0; i < reference_count; i++)
+  {
+    if (depth >= 0 && reference_nodes[i].level > depth)
+      continue;
+    if (j >= tree_count || tree_nodes[j].handle != reference_nodes[i].handle || tree_nodes[j].level != reference_nodes[i].level)
+      return 0;
+    j++;
+  }
+  return j == tree_count;
+}
+
+// Returns the fastest time of the tree of the desktop on a number of threads, in milliseconds
+double measureTree(const char *threads, int count)
+{
+  int64_t best = 0;
+  int64_t start;
+  int64_t elapsed;
+  int i;
+  for (i = 0; i < count; i++)
+  {
+    start = getClockNanoseconds();
+    runHarnessRequest("--tree", "--threads", threads, "--fields", "handle,title", NULL);
+    elapsed = getClockNanoseconds() - start;
+    best = best == 0 || elapsed < best ? elapsed : best;
+  }
+  return best / 1e6;
+}
+
+int main(int argn, char **argv)
+{
+  const char *threads[] = {"1", "2", "3", "4", "8", "16", "64"};
+  char text[32];
+  char slow[TEST_SLOW_COUNT * 24];
+  char *expected;
+  size_t expected_length;
+  size_t length = 0;
+  int64_t *tops;
+  int64_t steals;
+  double single;
+  double parallel;
+  int top_count;
+  int i;
+  snprintf(text, sizeof(text), "%d", TEST_TOP_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", text);
+  snprintf(text, sizeof(text), "%d", TEST_CHILD_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_CHILDREN", text);
+  snprintf(text, sizeof(text), "%d", TEST_DEPTH);
+  setHarnessVariable("WINDOW_STATE_MEMORY_DEPTH", text);
+  initHarness();
+  node_limit = TEST_TOP_COUNT * 16;
+  reference_nodes = (TestNode *)malloc(sizeof(TestNode) * node_limit);
+  tree_nodes = (TestNode *)malloc(sizeof(TestNode) * node_limit);
+  tops = (int64_t *)malloc(sizeof(int64_t) * TEST_TOP_COUNT);
+  if (reference_nodes == NULL || tree_nodes == NULL || tops == NULL)
+    return 1;
+
+  runHarnessRequest("--desktop", "--fields", "handle", "--format", "ndjson", NULL);
+  top_count = readHandles(tops, TEST_TOP_COUNT);
+  checkHarness(top_count == TEST_TOP_COUNT, "%d top-level windows are listed instead of %d", top_count, TEST_TOP_COUNT);
+  for (i = 0; i < top_count; i++)
+    appendReferenceNode(tops[i], 0);
+  checkHarness(reference_count == memory_window_count, "--parent lists %d windows instead of %d", reference_count, memory_window_count);
+
+  runHarnessRequest("--tree", "--threads", "1", "--fields", "handle,title,pid", NULL);
+  expected_length = output_length;
+  expected = (char *)malloc(expected_length + 1);
+  if (expected == NULL)
+    return 1;
+  memcpy(expected, output, expected_length + 1);
+  checkHarness(isTreeLikeReference(-1), "--tree differs from the children listed by --parent");
+  for (i = 1; i < (int)(sizeof(threads) / sizeof(threads[0])); i++)
+  {
+    runHarnessRequest("--tree", "--threads", threads[i], "--fields", "handle,title,pid", NULL);
+    checkHarness(output_length == expected_length && memcmp(output, expected, expected_length) == 0, "--tree --threads %s writes other bytes than one thread", threads[i]);
+  }
+  for (i = 0; i <= TEST_DEPTH; i++)
+  {
+    snprintf(text, sizeof(text), "%d", i);
+    runHarnessRequest("--tree", "--depth", text, "--threads", "4", "--fields", "handle", NULL);
+    checkHarness(isTreeLikeReference(i), "--tree --depth %d differs from the children listed by --parent", i);
+  }
+  // Without descendants, the tree is the list of the desktop
+  runHarnessRequest("--desktop", "--fields", "handle,title,pid", NULL);
+  memcpy(expected, output, output_length + 1);
+  expected_length = output_length;
+  runHarnessRequest("--tree", "--depth", "0", "--threads", "4", "--fields", "handle,title,pid", NULL);
+  checkHarness(output_length == expected_length && memcmp(output, expected, expected_length) == 0, "--tree --depth 0 differs from the list of the desktop");
+  runHarnessRequest("--tree", "--format", "ndjson", NULL);
+  checkHarness(strncmp(output, "Error:", 6) == 0, "--tree with another format than JSON is answered with \"%.60s\"", output);
+
+  printf("windows: %d in trees of %d, --tree --fields handle,title:", reference_count, reference_count / TEST_TOP_COUNT);
+  for (i = 0; i < 5; i++)
+    printf(" %.1f ms on %s thread%s%s", measureTree(threads[i], 3), threads[i], i == 0 ? "" : "s", i < 4 ? "," : "\n");
+
+  // The topmost windows are all in the range of the first worker
+  for (i = 0; i < TEST_SLOW_COUNT; i++)
+    length += (size_t)snprintf(&slow[length], sizeof(slow) - length, "%s%lld:%d", i == 0 ? "" : ",", (long long)tops[i], TEST_SLOW_DELAY);
+  setHarnessVariable("WINDOW_STATE_MEMORY_SLOW", slow);
+  memoryReadSlowWindows();
+  single = measureTree("1", 1);
+  parallel = measureTree("8", 1);
+  steals = tree_steal_count;
+  checkHarness(steals > 0 && parallel < single / 3, "8 threads take %.1f ms with %lld steals, against %.1f ms on one thread", parallel, (long long)steals, single);
+  printf("%d windows taking %d ms: %.1f ms on 1 thread, %.1f ms on 8 threads with %lld steals\n", TEST_SLOW_COUNT, TEST_SLOW_DELAY, single, parallel, (long long)steals);
+  setHarnessVariable("WINDOW_STATE_MEMORY_SLOW", "");
+  memoryReadSlowWindows();
+
+  free(expected);
+  free(tops);
+  free(tree_nodes);
+  free(reference_nodes);
+  return finishHarness("tree");
+}
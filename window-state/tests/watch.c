@@ -0,0 +1,361 @@
+// Watch mode test: writes a script of random changes for the in-memory backend, then compares the events of --watch after
+// each step of the script with the differences between the states of a model of the desktop before and after the step.
+//
+// Watch mode is not available to requests, so the program runs in a child process with its output read from a pipe. The
+// watch filters out the windows whose title contains "hidden", which the script gives to windows and takes back, so
+// that windows are also removed from the watch and added to it again. Events of a step are compared in any order:
+//
+//   gcc -O2 -pthread ./tests/watch.c -o watch-test
+//   ./watch-test
+
+#include "harness.h"
+
+#include <ctype.h>
+#include <sys/wait.h>
+
+#define TEST_WINDOW_COUNT 1000
+#define TEST_STEP_COUNT 500
+#define TEST_MODEL_SIZE (TEST_WINDOW_COUNT * 3 + TEST_STEP_COUNT * 4)
+#define TEST_LINE_SIZE 256
+
+typedef struct
+{
+  int64_t handle;
+  int is_alive;
+  int is_watched;
+  RECT rect;
+  char title[64];
+} TestWindow;
+
+typedef struct
+{
+  char text[TEST_LINE_SIZE];
+} TestLine;
+
+TestWindow test_windows[TEST_MODEL_SIZE];
+int test_window_count = 0;
+// Watched state of each window after the previous step
+TestWindow watched_windows[TEST_MODEL_SIZE];
+int64_t test_foreground;
+int next_index;
+char *program_output = NULL;
+size_t program_output_length = 0;
+TestLine *expected_lines;
+int *step_line_counts;
+int expected_count = 0;
+uint64_t random_state = 88172645463325252ull;
+
+uint64_t nextRandom()
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+// Returns the value of a number key of an NDJSON line, zero when the line does not have the key
+int64_t findJsonNumber(const char *line, const char *end, const char *key)
+{
+  char pattern[64];
+  const char *position;
+  snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+  position = strstr(line, pattern);
+  if (position == NULL || position > end)
+    return 0;
+  return strtoll(position + strlen(pattern), NULL, 10);
+}
+
+int isWatchedTitle(const char *title)
+{
+  char lower[64];
+  size_t i;
+  for (i = 0; title[i] != '\0' && i + 1 < sizeof(lower); i++)
+    lower[i] = (char)tolower((unsigned char)title[i]);
+  lower[i] = '\0';
+  return strstr(lower, "hidden") == NULL;
+}
+
+// Runs the program with the arguments that follow until a NULL one in a child process, the output is left in
+// program_output with a null character after it, returns the exit code
+int runProgram(const char *argument, ...)
+{
+  char *argv[HARNESS_ARGUMENT_COUNT + 2];
+  size_t size = 0;
+  ssize_t length;
+  int descriptors[2];
+  int argn = 0;
+  int status;
+  pid_t child;
+  va_list args;
+  argv[argn++] = (char *)"window-state";
+  va_start(args, argument);
+  for (; argument != NULL && argn <= HARNESS_ARGUMENT_COUNT; argument = va_arg(args, const char *))
+    argv[argn++] = (char *)argument;
+  va_end(args);
+  argv[argn] = NULL;
+  program_output_length = 0;
+  fflush(stdout);
+  if (pipe(descriptors) != 0)
+    return -1;
+  child = fork();
+  if (child == 0)
+  {
+    dup2(descriptors[1], 1);
+    close(descriptors[0]);
+    close(descriptors[1]);
+    status = runWindowState(argn, argv);
+    fflush(stdout);
+    _exit(status);
+  }
+  close(descriptors[1]);
+  for (;;)
+  {
+    if (program_output_length + 65536 + 1 > size)
+    {
+      size = (program_output_length + 65536 + 1) * 2;
+      program_output = (char *)realloc(program_output, size);
+    }
+    length = read(descriptors[0], program_output + program_output_length, 65536);
+    if (length <= 0)
+      break;
+    program_output_length += (size_t)length;
+  }
+  program_output[program_output_length] = '\0';
+  close(descriptors[0]);
+  waitpid(child, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Reads the top-level windows of the desktop into the model, before the watch takes its snapshot
+void readTestWindows()
+{
+  const char *line;
+  const char *end;
+  const char *position;
+  TestWindow *window;
+  size_t length;
+  runProgram("--desktop", "--fields", "handle,title,rect", "--format", "ndjson", NULL);
+  for (line = program_output; line != NULL && *line == '{' && test_window_count < TEST_MODEL_SIZE; line = end + 1)
+  {
+    end = strchr(line, '\n');
+    if (end == NULL)
+      break;
+    window = &test_windows[test_window_count++];
+    window->handle = findJsonNumber(line, end, "handle");
+    window->is_alive = 1;
+    window->rect.top = (LONG)findJsonNumber(line, end, "top");
+    window->rect.right = (LONG)findJsonNumber(line, end, "right");
+    window->rect.bottom = (LONG)findJsonNumber(line, end, "bottom");
+    window->rect.left = (LONG)findJsonNumber(line, end, "left");
+    window->title[0] = '\0';
+    position = strstr(line, "\"title\": \"");
+    if (position != NULL && position < end)
+    {
+      position += 10;
+      length = (size_t)(strchr(position, '"') - position);
+      length = length < sizeof(window->title) ? length : sizeof(window->title) - 1;
+      memcpy(window->title, position, length);
+      window->title[length] = '\0';
+    }
+    window->is_watched = isWatchedTitle(window->title);
+  }
+  memcpy(watched_windows, test_windows, sizeof(TestWindow) * (size_t)test_window_count);
+}
+
+// Returns a window of the model that still exists, NULL when there is none
+TestWindow *pickTestWindow()
+{
+  int i;
+  int start = (int)(nextRandom() % (uint64_t)test_window_count);
+  for (i = 0; i < test_window_count; i++)
+    if (test_windows[(start + i) % test_window_count].is_alive)
+      return &test_windows[(start + i) % test_window_count];
+  return NULL;
+}
+
+void addExpectedLine(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  vsnprintf(expected_lines[expected_count++].text, TEST_LINE_SIZE, format, args);
+  va_end(args);
+}
+
+// Writes a random command to the script and applies it to the model
+void writeTestCommand(FILE *script)
+{
+  TestWindow *window = pickTestWindow();
+  int kind = (int)(nextRandom() % 8);
+  int x;
+  int y;
+  if (kind == 0 || window == NULL)
+  {
+    window = &test_windows[test_window_count++];
+    window->handle = MEMORY_HANDLE_BASE + (int64_t)next_index++ * MEMORY_HANDLE_STRIDE;
+    window->is_alive = 1;
+    window->rect.left = 100;
+    window->rect.top = 100;
+    window->rect.right = 900;
+    window->rect.bottom = 700;
+    snprintf(window->title, sizeof(window->title), nextRandom() % 4 == 0 ? "Hidden Window %d" : "New Window %d", next_index);
+    fprintf(script, "create %d %s\n", (int)(nextRandom() % 100), window->title);
+  }
+  else if (kind == 1)
+  {
+    window->is_alive = 0;
+    if (window->handle == test_foreground)
+      test_foreground = 0;
+    fprintf(script, "destroy %lld\n", (long long)window->handle);
+  }
+  else if (kind <= 4)
+  {
+    // Some moves put the window back where it is, which is not a change
+    x = nextRandom() % 4 == 0 ? (int)window->rect.left : (int)(nextRandom() % 2000);
+    y = (int)window->rect.top;
+    window->rect.left = x;
+    window->rect.right = x + 400;
+    window->rect.bottom = y + 300;
+    fprintf(script, "move %lld %d %d 400 300\n", (long long)window->handle, x, y);
+  }
+  else if (kind <= 6)
+  {
+    snprintf(window->title, sizeof(window->title), nextRandom() % 3 == 0 ? "hidden %d" : "Renamed %d", (int)(nextRandom() % 50));
+    fprintf(script, "title %lld %s\n", (long long)window->handle, window->title);
+  }
+  else
+  {
+    test_foreground = window->handle;
+    fprintf(script, "focus %lld\n", (long long)window->handle);
+  }
+}
+
+// Adds the events of the differences between the watched state and the model, and takes the model as the watched state
+int addStepEvents(int64_t previous_foreground)
+{
+  TestWindow *window;
+  TestWindow *watched;
+  int count = expected_count;
+  int i;
+  for (i = 0; i < test_window_count; i++)
+  {
+    window = &test_windows[i];
+    watched = &watched_windows[i];
+    window->is_watched = window->is_alive && isWatchedTitle(window->title);
+    if (watched->is_watched && !window->is_watched)
+      addExpectedLine("{\"event\": \"%s\", \"handle\": %lld}", window->is_alive ? "removed" : "destroyed", (long long)window->handle);
+    else if (!watched->is_watched && window->is_watched)
+      addExpectedLine("{\"event\": \"created\", \"window\": {\"handle\": %lld, \"title\": \"%s\"}}", (long long)window->handle, window->title);
+    else if (window->is_watched)
+    {
+      if (memcmp(&watched->rect, &window->rect, sizeof(RECT)) != 0)
+        addExpectedLine("{\"event\": \"moved\", \"handle\": %lld, \"top\": %d, \"right\": %d, \"bottom\": %d, \"left\": %d}", (long long)window->handle, (int)window->rect.top, (int)window->rect.right, (int)window->rect.bottom, (int)window->rect.left);
+      if (strcmp(watched->title, window->title) != 0)
+        addExpectedLine("{\"event\": \"title\", \"handle\": %lld, \"title\": \"%s\"}", (long long)window->handle, window->title);
+    }
+    *watched = *window;
+  }
+  if (test_foreground != previous_foreground)
+    addExpectedLine("{\"event\": \"foreground\", \"handle\": %lld}", (long long)test_foreground);
+  return expected_count - count;
+}
+
+int compareTestLines(const void *a, const void *b)
+{
+  return strcmp(((const TestLine *)a)->text, ((const TestLine *)b)->text);
+}
+
+// Returns zero when the events written after the ready line differ from the events expected at each step
+int isWatchLikeModel(const char *line)
+{
+  TestLine *written = (TestLine *)malloc(sizeof(TestLine) * (size_t)(expected_count + 1));
+  const char *end;
+  int offset = 0;
+  int count;
+  int step;
+  int i;
+  int is_same = 1;
+  for (step = 0; step < TEST_STEP_COUNT && is_same; step++)
+  {
+    count = step_line_counts[step];
+    for (i = 0; i < count; i++)
+    {
+      end = line != NULL ? strchr(line, '\n') : NULL;
+      if (end == NULL || end - line >= TEST_LINE_SIZE)
+      {
+        is_same = checkHarness(0, "the watch wrote fewer events than expected at step %d", step);
+        break;
+      }
+      memcpy(written[i].text, line, (size_t)(end - line));
+      written[i].text[end - line] = '\0';
+      line = end + 1;
+    }
+    if (!is_same)
+      break;
+    qsort(written, (size_t)count, sizeof(TestLine), compareTestLines);
+    qsort(&expected_lines[offset], (size_t)count, sizeof(TestLine), compareTestLines);
+    for (i = 0; i < count && is_same; i++)
+      is_same = checkHarness(strcmp(written[i].text, expected_lines[offset + i].text) == 0, "step %d wrote %s instead of %s", step, written[i].text, expected_lines[offset + i].text);
+    offset += count;
+  }
+  free(written);
+  return is_same && checkHarness(line != NULL && *line == '\0', "the watch wrote more events than expected: %.100s", line != NULL ? line : "");
+}
+
+int main(int argn, char **argv)
+{
+  char path[] = "/tmp/window-state-watch-XXXXXX";
+  char count_text[32];
+  char ready[64];
+  FILE *script;
+  int64_t previous_foreground;
+  int64_t start;
+  double elapsed;
+  size_t polled_length;
+  int watched_count = 0;
+  int code;
+  int step;
+  int i;
+  int descriptor = mkstemp(path);
+  expected_lines = (TestLine *)malloc(sizeof(TestLine) * TEST_STEP_COUNT * 64);
+  step_line_counts = (int *)malloc(sizeof(int) * TEST_STEP_COUNT);
+  script = descriptor >= 0 ? fdopen(descriptor, "w") : NULL;
+  if (script == NULL || expected_lines == NULL || step_line_counts == NULL)
+    return 1;
+  snprintf(count_text, sizeof(count_text), "%d", TEST_WINDOW_COUNT);
+  setHarnessVariable("WINDOW_STATE_MEMORY_WINDOWS", count_text);
+  setHarnessVariable("WINDOW_STATE_MEMORY_SCRIPT", path);
+
+  // The model starts from the same generated desktop as the program, which creates windows after the last one
+  readTestWindows();
+  polled_length = program_output_length;
+  memoryInitialize();
+  test_foreground = (int64_t)memoryGetHandle(memory_foreground);
+  next_index = memory_window_count;
+  for (i = 0; i < test_window_count; i++)
+    watched_count += test_windows[i].is_watched;
+  for (step = 0; step < TEST_STEP_COUNT; step++)
+  {
+    previous_foreground = test_foreground;
+    for (i = 1 + (int)(nextRandom() % 6); i > 0; i--)
+      writeTestCommand(script);
+    fprintf(script, "tick\n");
+    step_line_counts[step] = addStepEvents(previous_foreground);
+  }
+  fclose(script);
+
+  start = getClockNanoseconds();
+  code = runProgram("--watch", "--where", "!(title ~ 'hidden')", "--fields", "handle,title", NULL);
+  elapsed = (getClockNanoseconds() - start) / 1e3 / TEST_STEP_COUNT;
+  checkHarness(code == 0, "the watch exited with %d at the end of the script", code);
+  snprintf(ready, sizeof(ready), "{\"event\": \"ready\", \"count\": %d}\n", watched_count);
+  if (checkHarness(strncmp(program_output, ready, strlen(ready)) == 0, "the watch started with %.60s instead of %s", program_output, ready))
+    isWatchLikeModel(program_output + strlen(ready));
+
+  printf("windows: %d, steps: %d, events: %d\n", TEST_WINDOW_COUNT, TEST_STEP_COUNT, expected_count);
+  printf("watch: %.0f bytes and %.1f us per step, polling the list: %zu bytes per step\n", (double)program_output_length / TEST_STEP_COUNT, elapsed, polled_length);
+  remove(path);
+  free(expected_lines);
+  free(step_line_counts);
+  free(program_output);
+  return finishHarness("watch");
+}
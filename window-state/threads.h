@@ -0,0 +1,201 @@
+// Threads: the few thread, mutex and condition operations used by the parallel modes, over Win32 threads or POSIX threads.
+//
+// Thread functions are declared with THREAD_FUNCTION(name, argument) and end with THREAD_RETURN, and THREAD_LOCAL declares a
+// variable with one instance per thread. Timed waits on a condition return zero when the timeout elapsed before the condition
+// was signaled, and may also return early without a signal.
+
+#if defined(_WIN32)
+typedef HANDLE ThreadHandle;
+typedef CRITICAL_SECTION ThreadMutex;
+typedef CONDITION_VARIABLE ThreadCondition;
+#define THREAD_FUNCTION(name, argument) DWORD WINAPI name(LPVOID argument)
+#define THREAD_RETURN return 0
+#define THREAD_LOCAL __declspec(thread)
+
+int startThread(ThreadHandle *thread, LPTHREAD_START_ROUTINE function, void *argument)
+{
+  *thread = CreateThread(NULL, 0, function, argument, 0, NULL);
+  return *thread != NULL;
+}
+
+void joinThread(ThreadHandle thread)
+{
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+// Lets a thread run on without being joined, its resources are released when it exits
+void detachThread(ThreadHandle thread)
+{
+  CloseHandle(thread);
+}
+
+void sleepThread(int64_t milliseconds)
+{
+  Sleep((DWORD)milliseconds);
+}
+
+void initMutex(ThreadMutex *mutex)
+{
+  InitializeCriticalSection(mutex);
+}
+
+void freeMutex(ThreadMutex *mutex)
+{
+  DeleteCriticalSection(mutex);
+}
+
+void lockMutex(ThreadMutex *mutex)
+{
+  EnterCriticalSection(mutex);
+}
+
+void unlockMutex(ThreadMutex *mutex)
+{
+  LeaveCriticalSection(mutex);
+}
+
+void initCondition(ThreadCondition *condition)
+{
+  InitializeConditionVariable(condition);
+}
+
+// Waits for a signal with the mutex held, for a number of milliseconds or without a limit when it is negative
+int waitCondition(ThreadCondition *condition, ThreadMutex *mutex, int64_t milliseconds)
+{
+  return SleepConditionVariableCS(condition, mutex, milliseconds < 0 ? INFINITE : (DWORD)milliseconds) != 0;
+}
+
+void signalAllConditions(ThreadCondition *condition)
+{
+  WakeAllConditionVariable(condition);
+}
+
+// Adds to a counter that several threads update, the counter is only read once they are done or for statistics
+void addCounter(volatile int64_t *counter, int64_t amount)
+{
+  InterlockedExchangeAdd64((volatile LONG64 *)counter, amount);
+}
+
+int64_t readCounter(volatile int64_t *counter)
+{
+  return InterlockedCompareExchange64((volatile LONG64 *)counter, 0, 0);
+}
+
+void resetCounter(volatile int64_t *counter)
+{
+  InterlockedExchange64((volatile LONG64 *)counter, 0);
+}
+
+int getProcessorCount()
+{
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (int)info.dwNumberOfProcessors;
+}
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef pthread_t ThreadHandle;
+typedef pthread_mutex_t ThreadMutex;
+typedef pthread_cond_t ThreadCondition;
+#define THREAD_FUNCTION(name, argument) void *name(void *argument)
+#define THREAD_RETURN return NULL
+#define THREAD_LOCAL __thread
+
+int startThread(ThreadHandle *thread, void *(*function)(void *), void *argument)
+{
+  return pthread_create(thread, NULL, function, argument) == 0;
+}
+
+void joinThread(ThreadHandle thread)
+{
+  pthread_join(thread, NULL);
+}
+
+// Lets a thread run on without being joined, its resources are released when it exits
+void detachThread(ThreadHandle thread)
+{
+  pthread_detach(thread);
+}
+
+void sleepThread(int64_t milliseconds)
+{
+  struct timespec duration;
+  duration.tv_sec = (time_t)(milliseconds / 1000);
+  duration.tv_nsec = (long)(milliseconds % 1000) * 1000000;
+  nanosleep(&duration, NULL);
+}
+
+void initMutex(ThreadMutex *mutex)
+{
+  pthread_mutex_init(mutex, NULL);
+}
+
+void freeMutex(ThreadMutex *mutex)
+{
+  pthread_mutex_destroy(mutex);
+}
+
+void lockMutex(ThreadMutex *mutex)
+{
+  pthread_mutex_lock(mutex);
+}
+
+void unlockMutex(ThreadMutex *mutex)
+{
+  pthread_mutex_unlock(mutex);
+}
+
+void initCondition(ThreadCondition *condition)
+{
+  pthread_cond_init(condition, NULL);
+}
+
+// Waits for a signal with the mutex held, for a number of milliseconds or without a limit when it is negative
+int waitCondition(ThreadCondition *condition, ThreadMutex *mutex, int64_t milliseconds)
+{
+  struct timespec deadline;
+  if (milliseconds < 0)
+    return pthread_cond_wait(condition, mutex) == 0;
+  // The deadline of a timed wait is measured by the realtime clock
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += (time_t)(milliseconds / 1000);
+  deadline.tv_nsec += (long)(milliseconds % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000)
+  {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  return pthread_cond_timedwait(condition, mutex, &deadline) == 0;
+}
+
+void signalAllConditions(ThreadCondition *condition)
+{
+  pthread_cond_broadcast(condition);
+}
+
+// Adds to a counter that several threads update, the counter is only read once they are done or for statistics
+void addCounter(volatile int64_t *counter, int64_t amount)
+{
+  __atomic_fetch_add(counter, amount, __ATOMIC_RELAXED);
+}
+
+int64_t readCounter(volatile int64_t *counter)
+{
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+void resetCounter(volatile int64_t *counter)
+{
+  __atomic_store_n(counter, 0, __ATOMIC_RELAXED);
+}
+
+int getProcessorCount()
+{
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int)count : 1;
+}
+#endif
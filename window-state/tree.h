@@ -0,0 +1,241 @@
+// Window tree: writes the selected windows with their descendants as nested JSON objects.
+//
+// Each selected window and its descendants form a task. The tasks are split into contiguous ranges, one per worker, and a
+// worker that runs out of tasks steals the second half of the range left to another worker. Workers serialize into their
+// own writer, and once every worker has finished the slice of each task is written in the z-order of the selected windows.
+
+#define TREE_WORKER_LIMIT 64
+#define TREE_WRITER_LIMIT ((size_t)-1 / 2)
+
+typedef struct
+{
+  ThreadMutex mutex;
+  ThreadHandle thread;
+  int index;
+  int begin;
+  int end;
+  JsonWriter writer;
+  char title[MIDDLE_BUFFER_SIZE];
+  char module[MIDDLE_BUFFER_SIZE];
+  char exec[MIDDLE_BUFFER_SIZE];
+  char class[MIDDLE_BUFFER_SIZE];
+  int64_t node_count;
+  int64_t steal_count;
+} TreeWorker;
+
+typedef struct
+{
+  int worker;
+  size_t offset;
+  size_t length;
+} TreeSlice;
+
+int is_option_tree = 0;
+int64_t tree_depth = -1;
+int64_t tree_thread_count = 0;
+int is_tree_overflow = 0;
+int64_t tree_node_count = 0;
+int64_t tree_steal_count = 0;
+int tree_used_worker_count = 0;
+
+TreeSlice *tree_slices = NULL;
+TreeWorker *tree_workers = NULL;
+int tree_worker_count = 0;
+
+// Serialization of the tree writers cannot be flushed, running out of memory is reported instead of writing partial output
+void discardTreeOutput(const char *data, size_t length)
+{
+  is_tree_overflow = 1;
+}
+
+// Writes a window and its descendants down to the selected depth, the descendants are listed by the "children" key
+void writeTreeNode(TreeWorker *worker, HWND h, int64_t level)
+{
+  WindowRecord record;
+  HWND child;
+  int is_first;
+  int count = 0;
+  fetchWindowRecordStrings(h, output_fields, &record, worker->title, worker->module, worker->exec, worker->class);
+  putJsonChar(&worker->writer, '{');
+  is_first = putWindowRecordKeys(&worker->writer, 1, output_fields, &record, worker->title, worker->module, worker->exec, worker->class);
+  worker->node_count++;
+  if (tree_depth >= 0 && level >= tree_depth)
+  {
+    putJsonChar(&worker->writer, '}');
+    return;
+  }
+  putJsonKey(&worker->writer, is_first, "children");
+  putJsonChar(&worker->writer, '[');
+  for (child = backendGetWindow(h, GW_CHILD); child != NULL; child = backendGetWindow(child, GW_HWNDNEXT))
+  {
+    if (count++ != 0)
+      putJsonBytes(&worker->writer, ", ", 2);
+    writeTreeNode(worker, child, level + 1);
+  }
+  putJsonBytes(&worker->writer, "]}", 2);
+}
+
+// Takes the next task of a worker, or steals the second half of the tasks left to another worker, returns -1 when none is left
+int takeTreeTask(TreeWorker *worker)
+{
+  TreeWorker *victim;
+  int task = -1;
+  int middle;
+  int end = 0;
+  int k;
+  lockMutex(&worker->mutex);
+  if (worker->begin < worker->end)
+    task = worker->begin++;
+  unlockMutex(&worker->mutex);
+  if (task >= 0)
+    return task;
+  for (k = 1; k < tree_worker_count && task < 0; k++)
+  {
+    victim = &tree_workers[(worker->index + k) % tree_worker_count];
+    lockMutex(&victim->mutex);
+    if (victim->begin < victim->end)
+    {
+      middle = victim->begin + (victim->end - victim->begin) / 2;
+      end = victim->end;
+      victim->end = middle;
+      task = middle;
+    }
+    unlockMutex(&victim->mutex);
+  }
+  if (task < 0)
+    return -1;
+  lockMutex(&worker->mutex);
+  worker->begin = task + 1;
+  worker->end = end;
+  worker->steal_count++;
+  unlockMutex(&worker->mutex);
+  return task;
+}
+
+THREAD_FUNCTION(runTreeWorker, argument)
+{
+  TreeWorker *worker = (TreeWorker *)argument;
+  int task;
+  size_t offset;
+  while ((task = takeTreeTask(worker)) >= 0)
+  {
+    offset = worker->writer.length;
+    writeTreeNode(worker, selected_list[task], 0);
+    tree_slices[task].worker = worker->index;
+    tree_slices[task].offset = offset;
+    tree_slices[task].length = worker->writer.length - offset;
+  }
+  THREAD_RETURN;
+}
+
+void freeWindowTree()
+{
+  int w;
+  for (w = 0; w < tree_worker_count; w++)
+  {
+    freeJsonWriter(&tree_workers[w].writer);
+    freeMutex(&tree_workers[w].mutex);
+  }
+  free(tree_workers);
+  tree_workers = NULL;
+  tree_worker_count = 0;
+  free(tree_slices);
+  tree_slices = NULL;
+  freeSelectedWindows();
+}
+
+// Writes the selected windows as a list of trees, the first worker runs on the calling thread
+int writeWindowTree()
+{
+  TreeSlice *slice;
+  // Threads abandoned by bounded fetching may still share the process cache, and read the flag
+  int was_shared = is_process_cache_shared;
+  int code = collectSelectedWindows();
+  int w;
+  int t;
+  if (code != 0)
+  {
+    freeWindowTree();
+    return code;
+  }
+  tree_worker_count = (int)(tree_thread_count > 0 ? tree_thread_count : getProcessorCount());
+  if (tree_worker_count > TREE_WORKER_LIMIT)
+    tree_worker_count = TREE_WORKER_LIMIT;
+  if (tree_worker_count > selected_count)
+    tree_worker_count = selected_count;
+  if (tree_worker_count < 1)
+    tree_worker_count = 1;
+  tree_workers = (TreeWorker *)calloc((size_t)tree_worker_count, sizeof(TreeWorker));
+  tree_slices = (TreeSlice *)calloc((size_t)(selected_count > 0 ? selected_count : 1), sizeof(TreeSlice));
+  if (tree_workers == NULL || tree_slices == NULL)
+  {
+    free(tree_workers);
+    tree_workers = NULL;
+    tree_worker_count = 0;
+    freeWindowTree();
+    writeOutput("Error: Could not allocate the window tree\n");
+    return 1;
+  }
+  is_tree_overflow = 0;
+  for (w = 0; w < tree_worker_count; w++)
+  {
+    initMutex(&tree_workers[w].mutex);
+    tree_workers[w].index = w;
+    tree_workers[w].begin = (int)((int64_t)selected_count * w / tree_worker_count);
+    tree_workers[w].end = (int)((int64_t)selected_count * (w + 1) / tree_worker_count);
+    initJsonWriter(&tree_workers[w].writer, NULL, TREE_WRITER_LIMIT, discardTreeOutput);
+  }
+  if (!was_shared)
+    is_process_cache_shared = tree_worker_count > 1;
+  is_stats_shared = tree_worker_count > 1;
+  for (t = 1; t < tree_worker_count; t++)
+  {
+    if (!startThread(&tree_workers[t].thread, runTreeWorker, &tree_workers[t]))
+      break;
+  }
+  // Workers that could not be started have their tasks stolen by the others
+  runTreeWorker(&tree_workers[0]);
+  for (w = 1; w < t; w++)
+    joinThread(tree_workers[w].thread);
+  for (; t < tree_worker_count; t++)
+    runTreeWorker(&tree_workers[t]);
+  if (!was_shared)
+    is_process_cache_shared = 0;
+  is_stats_shared = 0;
+  if (is_tree_overflow)
+  {
+    freeWindowTree();
+    writeOutput("Error: Could not allocate the window tree output\n");
+    return 1;
+  }
+  putJsonChar(&output_writer, '[');
+  for (w = 0; w < selected_count; w++)
+  {
+    slice = &tree_slices[w];
+    if (w != 0)
+      putJsonBytes(&output_writer, ", ", 2);
+    putJsonBytes(&output_writer, &tree_workers[slice->worker].writer.data[slice->offset], slice->length);
+  }
+  putJsonChar(&output_writer, ']');
+  tree_node_count = 0;
+  tree_steal_count = 0;
+  tree_used_worker_count = tree_worker_count;
+  for (w = 0; w < tree_worker_count; w++)
+  {
+    tree_node_count += tree_workers[w].node_count;
+    tree_steal_count += tree_workers[w].steal_count;
+    noteStatsBuffer(tree_workers[w].writer.size);
+  }
+  freeWindowTree();
+  return 0;
+}
+
+// Writes the "tree" section of the statistics object
+void writeTreeStats(JsonWriter *writer)
+{
+  beginStatsSection(writer, "tree");
+  putStatsCounter(writer, 1, "nodes", tree_node_count);
+  putStatsCounter(writer, 0, "workers", tree_used_worker_count);
+  putStatsCounter(writer, 0, "steals", tree_steal_count);
+  putJsonChar(writer, '}');
+}
@@ -0,0 +1,224 @@
+// Watch mode: streams window lifecycle events as newline-delimited JSON.
+//
+// The backend reports which windows changed (WinEvent hooks on Windows) or asks for a rescan, in which case the windows
+// of the scope are compared with the snapshot of the previous scan. Only windows that changed are serialized.
+//
+// Events:
+//   {"event": "ready", "count": N}                       The snapshot was taken and events will follow
+//   {"event": "created", "window": {...}}                A window appeared in the scope or started matching the filters
+//   {"event": "destroyed", "handle": N}                  A window was destroyed
+//   {"event": "removed", "handle": N}                    A window left the scope or stopped matching the filters
+//   {"event": "moved", "handle": N, "top": ..., ...}     A window was moved or resized
+//   {"event": "title", "handle": N, "title": "..."}      A window title changed
+//   {"event": "foreground", "handle": N}                 The foreground window changed
+
+#define WATCH_TABLE_SIZE 65536
+#define WATCH_EVENT_LIST_SIZE 4096
+
+typedef struct
+{
+  HWND handle;
+  RECT rect;
+  uint32_t title_hash;
+  int generation;
+} WatchEntry;
+
+// Open addressing table of the windows of the last snapshot, keyed by handle
+WatchEntry watch_table[WATCH_TABLE_SIZE];
+int watch_count = 0;
+int watch_generation = 0;
+HWND watch_foreground = NULL;
+HWND watch_event_list[WATCH_EVENT_LIST_SIZE];
+int64_t watch_event_count = 0;
+
+int is_option_watch = 0;
+int64_t watch_interval = 250;
+
+uint32_t hashWatchTitle(const char *text, size_t text_length)
+{
+  uint32_t hash = 2166136261u;
+  size_t i;
+  for (i = 0; i < text_length; i++)
+    hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+  return hash;
+}
+
+size_t getWatchSlot(HWND h)
+{
+  return (size_t)(((uint64_t)(intptr_t)h * 2654435761u) & (WATCH_TABLE_SIZE - 1));
+}
+
+WatchEntry *findWatchEntry(HWND h)
+{
+  size_t slot = getWatchSlot(h);
+  while (watch_table[slot].handle != NULL)
+  {
+    if (watch_table[slot].handle == h)
+      return &watch_table[slot];
+    slot = (slot + 1) & (WATCH_TABLE_SIZE - 1);
+  }
+  return NULL;
+}
+
+WatchEntry *insertWatchEntry(HWND h)
+{
+  size_t slot = getWatchSlot(h);
+  // Keeps a quarter of the table free so that probe sequences stay short
+  if (watch_count >= WATCH_TABLE_SIZE / 4 * 3)
+    return NULL;
+  while (watch_table[slot].handle != NULL)
+    slot = (slot + 1) & (WATCH_TABLE_SIZE - 1);
+  watch_table[slot].handle = h;
+  watch_count++;
+  return &watch_table[slot];
+}
+
+// Removes an entry by shifting back the entries of its probe sequence, so lookups never need tombstones
+void removeWatchEntry(WatchEntry *entry)
+{
+  size_t hole = (size_t)(entry - watch_table);
+  size_t slot = hole;
+  size_t home;
+  for (;;)
+  {
+    slot = (slot + 1) & (WATCH_TABLE_SIZE - 1);
+    if (watch_table[slot].handle == NULL)
+      break;
+    home = getWatchSlot(watch_table[slot].handle);
+    if (((slot - home) & (WATCH_TABLE_SIZE - 1)) >= ((slot - hole) & (WATCH_TABLE_SIZE - 1)))
+    {
+      watch_table[hole] = watch_table[slot];
+      hole = slot;
+    }
+  }
+  watch_table[hole].handle = NULL;
+  watch_count--;
+}
+
+void writeWatchEvent(const char *event, HWND h)
+{
+  writeOutput("{\"event\": \"%s\", \"handle\": %" PRId64 "}\n", event, (int64_t)h);
+  watch_event_count++;
+}
+
+// Compares a window with its snapshot entry and writes the events of what changed
+void checkWatchWindow(HWND h, int is_emitting)
+{
+  WatchEntry *entry = findWatchEntry(h);
+  RECT current;
+  uint32_t title_hash;
+  if (!backendIsWindow(h) || !isMatchingFilters(h, 0))
+  {
+    if (entry == NULL)
+      return;
+    removeWatchEntry(entry);
+    if (is_emitting)
+      writeWatchEvent(backendIsWindow(h) ? "removed" : "destroyed", h);
+    return;
+  }
+  memset(&current, 0, sizeof(current));
+  backendGetWindowRect(h, &current);
+  title_length = backendGetWindowText(h, title, MIDDLE_BUFFER_SIZE);
+  title_hash = hashWatchTitle(title, title_length);
+  if (entry == NULL)
+  {
+    entry = insertWatchEntry(h);
+    if (entry == NULL)
+      return;
+    entry->rect = current;
+    entry->title_hash = title_hash;
+    entry->generation = watch_generation;
+    if (is_emitting)
+    {
+      putJsonText(&output_writer, "{\"event\": \"created\", \"window\": ");
+      makeWindowJson(&output_writer, h);
+      putJsonBytes(&output_writer, "}\n", 2);
+      watch_event_count++;
+    }
+    return;
+  }
+  entry->generation = watch_generation;
+  if (memcmp(&entry->rect, &current, sizeof(RECT)) != 0)
+  {
+    entry->rect = current;
+    if (is_emitting)
+    {
+      writeOutput("{\"event\": \"moved\", \"handle\": %" PRId64 ", \"top\": %" PRId64 ", \"right\": %" PRId64 ", \"bottom\": %" PRId64 ", \"left\": %" PRId64 "}\n", (int64_t)h, (int64_t)current.top, (int64_t)current.right, (int64_t)current.bottom, (int64_t)current.left);
+      watch_event_count++;
+    }
+  }
+  if (entry->title_hash != title_hash)
+  {
+    entry->title_hash = title_hash;
+    if (is_emitting)
+    {
+      putJsonBytes(&output_writer, "{\"event\": \"title\", \"handle\": ", 29);
+      putJsonInteger(&output_writer, (int64_t)h);
+      putJsonBytes(&output_writer, ", \"title\": ", 11);
+      putJsonString(&output_writer, title, title_length);
+      putJsonBytes(&output_writer, "}\n", 2);
+      watch_event_count++;
+    }
+  }
+}
+
+// Compares every window of the scope with the snapshot, the windows that were not seen anymore are reported as destroyed
+void scanWatchWindows(HWND scope, int is_emitting)
+{
+  HWND h;
+  size_t slot;
+  watch_generation++;
+  for (h = backendGetFirstChild(scope); h != NULL; h = backendGetWindow(h, GW_HWNDNEXT))
+    checkWatchWindow(h, is_emitting);
+  for (slot = 0; slot < WATCH_TABLE_SIZE; slot++)
+  {
+    // Removing an entry may shift a later entry into this slot, so the slot is checked again
+    while (watch_table[slot].handle != NULL && watch_table[slot].generation != watch_generation)
+    {
+      h = watch_table[slot].handle;
+      removeWatchEntry(&watch_table[slot]);
+      if (is_emitting)
+        writeWatchEvent(backendIsWindow(h) ? "removed" : "destroyed", h);
+    }
+  }
+}
+
+void checkWatchForeground()
+{
+  HWND h = backendGetForegroundWindow();
+  if (h == watch_foreground)
+    return;
+  watch_foreground = h;
+  writeWatchEvent("foreground", h);
+}
+
+int watchWindows(HWND scope)
+{
+  int count;
+  int is_rescan;
+  int i;
+  scanWatchWindows(scope, 0);
+  watch_foreground = backendGetForegroundWindow();
+  writeOutput("{\"event\": \"ready\", \"count\": %d}\n", watch_count);
+  fflush(stdout);
+  for (;;)
+  {
+    is_rescan = 0;
+    count = backendWaitForWindowEvents(scope, watch_event_list, WATCH_EVENT_LIST_SIZE, (int)watch_interval, &is_rescan);
+    if (count < 0)
+      break;
+    if (is_rescan)
+    {
+      scanWatchWindows(scope, 1);
+    }
+    else
+    {
+      for (i = 0; i < count; i++)
+        checkWatchWindow(watch_event_list[i], 1);
+    }
+    checkWatchForeground();
+    flushJsonWriter(&output_writer);
+    fflush(stdout);
+  }
+  return 0;
+}